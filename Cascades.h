@@ -0,0 +1,238 @@
+#pragma once
+
+// Cascaded shadow maps
+// The camera frustum is split along view depth and every split gets its own orthographic shadow view fitted around it.
+// Split distances blend uniform and logarithmic distribution (practical split scheme), Lambda 1 is fully logarithmic.
+// Cascades are fitted to the bounding sphere of their split, so their size does not change when the camera rotates,
+// and they only move in whole shadow map texels, so edges do not shimmer when the camera moves.
+//
+// Casters are culled per cascade. A caster only matters if it lies inside the cascade box, which reaches towards the light,
+// and, when receivers are known, if it sits between the light and something the camera sees.
+//
+// Nothing here knows about the graphics API, renderers consume the matrices and the caster masks.
+
+#include "Frustum.h"
+
+struct cascade_settings
+{
+	u32 CascadeCount;
+	f32 Lambda;
+	f32 MaxDistance;     // Shadows end here, no reason to spend texels all the way to the far plane
+	f32 CasterExtension; // How far towards the light casters are still captured
+	u32 Resolution;
+	b32 CullAgainstReceivers;
+	shadow_depth_format DepthFormat; // Its steps are added to the bias
+};
+
+struct shadow_cascade
+{
+	m4 ViewProjection;
+	aabb LightSpaceBounds; // Ortho box in light view space
+	aabb ReceiverBounds;   // Light space, receivers clipped to the cascade
+	aabb CasterBounds;     // Light space, where casters have to be to matter
+	f32 SplitNear;
+	f32 SplitFar;
+	f32 TexelSize;  // World units per shadow map texel
+	f32 DepthBias;  // Roughly one and a half texels, in shadow map depth units
+};
+
+struct shadow_cascades
+{
+	m4 LightView; // Rotation only, so texel snapping happens on a grid fixed in the world
+	shadow_cascade Cascades[c_MaxShadowCascades];
+	u32 Count;
+	f32 DepthStepBias; // Rounding of the depth format. Not scaled with the slope and the filter radius like DepthBias, it does not grow with them
+};
+
+internal cascade_settings Cascades_GetDefaultSettings(u32 Resolution);
+
+// Writes Count + 1 distances, Splits[0] is Near and Splits[Count] is Far
+internal void Cascades_ComputeSplits(f32 Near, f32 Far, u32 Count, f32 Lambda, f32* Splits);
+
+internal void Cascades_Fit(shadow_cascades* Cascades, const cascade_settings& Settings, const camera& Camera, v3 LightDirection);
+
+// Receivers are whatever the camera sees this frame, add them after Cascades_Fit and before building caster bounds
+internal void Cascades_AddReceiver(shadow_cascades* Cascades, const aabb& WorldBounds);
+internal void Cascades_BuildCasterBounds(shadow_cascades* Cascades, const cascade_settings& Settings);
+
+// Bit per cascade the box can cast a visible shadow into
+internal u32 Cascades_GetCasterMask(const shadow_cascades* Cascades, const aabb& WorldBounds);
+
+internal void Cascades_GetConstants(const shadow_cascades* Cascades, shadow_cascade_constants* Constants);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+internal cascade_settings Cascades_GetDefaultSettings(u32 Resolution)
+{
+	cascade_settings Settings = {};
+	Settings.CascadeCount = c_MaxShadowCascades;
+	Settings.Lambda = 0.75f;
+	Settings.MaxDistance = 160.0f;
+	Settings.CasterExtension = 256.0f; // Whole world height
+	Settings.Resolution = Resolution;
+	Settings.CullAgainstReceivers = true;
+	Settings.DepthFormat = shadow_depth_format::D32;
+	return Settings;
+}
+
+internal void Cascades_ComputeSplits(f32 Near, f32 Far, u32 Count, f32 Lambda, f32* Splits)
+{
+	Splits[0] = Near;
+
+	for (u32 i = 1; i < Count; i++)
+	{
+		f32 T = (f32)i / Count;
+		f32 Uniform = Near + (Far - Near) * T;
+		f32 Logarithmic = Near * glm::pow(Far / Near, T);
+		Splits[i] = glm::mix(Uniform, Logarithmic, Lambda);
+	}
+
+	Splits[Count] = Far;
+}
+
+internal void Cascades_Fit(shadow_cascades* Cascades, const cascade_settings& Settings, const camera& Camera, v3 LightDirection)
+{
+	Assert(Settings.CascadeCount > 0 && Settings.CascadeCount <= c_MaxShadowCascades, "Invalid cascade count!");
+
+	v3 Up = glm::abs(LightDirection.y) > 0.99f ? v3(0.0f, 0.0f, 1.0f) : v3(0.0f, 1.0f, 0.0f);
+	Cascades->LightView = glm::lookAtLH(v3(0.0f), LightDirection, Up);
+	Cascades->Count = Settings.CascadeCount;
+
+	// A stored depth is off by half a step, and by up to a whole one once the static cache copy stores it again
+	Cascades->DepthStepBias = ShadowDepth_GetStep(Settings.DepthFormat);
+
+	f32 Splits[c_MaxShadowCascades + 1];
+	f32 Far = glm::min(Camera.PerspectiveFar, Settings.MaxDistance);
+	Cascades_ComputeSplits(Camera.PerspectiveNear, Far, Settings.CascadeCount, Settings.Lambda, Splits);
+
+	// Slope of the frustum edges, a corner at depth Z is Z * Slope away from the view axis
+	f32 TanHalfFOV = glm::tan(Camera.PerspectiveFOV * 0.5f);
+	f32 SlopeSquared = TanHalfFOV * TanHalfFOV * (1.0f + Camera.AspectRatio * Camera.AspectRatio);
+
+	m4 InverseView = glm::inverse(Camera.View);
+
+	// Light space boxes of all splits at once, they give each cascade a tight depth range
+	alignas(32) f32 SplitNear[c_SimdWidth] = {}, SplitFar[c_SimdWidth] = {};
+	for (u32 i = 0; i < Settings.CascadeCount; i++)
+	{
+		SplitNear[i] = Splits[i];
+		SplitFar[i] = Splits[i + 1];
+	}
+
+	v3x8 Corners[c_FrustumCornerCount], SplitMin, SplitMax;
+	Frustum_GetSliceCorners8(InverseView, TanHalfFOV, Camera.AspectRatio, F32x8Load(SplitNear), F32x8Load(SplitFar), Corners);
+	Frustum_FitBounds8(Corners, Cascades->LightView, &SplitMin, &SplitMax);
+
+	alignas(32) f32 DepthMin[c_SimdWidth], DepthMax[c_SimdWidth];
+	F32x8Store(DepthMin, SplitMin.Z);
+	F32x8Store(DepthMax, SplitMax.Z);
+
+	for (u32 i = 0; i < Settings.CascadeCount; i++)
+	{
+		shadow_cascade& Cascade = Cascades->Cascades[i];
+		f32 Near = Splits[i];
+		Far = Splits[i + 1];
+
+		// Smallest sphere around the split, centered on the view axis where near and far corners are equally far away.
+		// Wide splits end up centered on the far plane.
+		f32 CenterDepth = glm::min(0.5f * (Near + Far) * (1.0f + SlopeSquared), Far);
+		f32 Radius = glm::sqrt((Far - CenterDepth) * (Far - CenterDepth) + Far * Far * SlopeSquared);
+
+		v3 Center = v3(InverseView * v4(0.0f, 0.0f, CenterDepth, 1.0f));
+		v3 LightSpaceCenter = v3(Cascades->LightView * v4(Center, 1.0f));
+
+		// Snap to texels
+		f32 TexelSize = 2.0f * Radius / Settings.Resolution;
+		LightSpaceCenter.x = glm::floor(LightSpaceCenter.x / TexelSize) * TexelSize;
+		LightSpaceCenter.y = glm::floor(LightSpaceCenter.y / TexelSize) * TexelSize;
+
+		// Depth does not shimmer, so it can follow the split tightly
+		v3 Min = v3(LightSpaceCenter.x - Radius, LightSpaceCenter.y - Radius, DepthMin[i] - Settings.CasterExtension);
+		v3 Max = v3(LightSpaceCenter.x + Radius, LightSpaceCenter.y + Radius, DepthMax[i]);
+
+		m4 Projection = glm::orthoLH_ZO(Min.x, Max.x, Min.y, Max.y, Min.z, Max.z);
+
+		Cascade.ViewProjection = Projection * Cascades->LightView;
+		Cascade.LightSpaceBounds = { Min, Max };
+		Cascade.ReceiverBounds = { v3(FLT_MAX), v3(-FLT_MAX) };
+		Cascade.CasterBounds = Cascade.LightSpaceBounds;
+		Cascade.SplitNear = Near;
+		Cascade.SplitFar = Far;
+		Cascade.TexelSize = TexelSize;
+		Cascade.DepthBias = 1.5f * TexelSize / (Max.z - Min.z);
+	}
+}
+
+inline bool Cascades_Overlaps(const aabb& A, const aabb& B)
+{
+	return glm::all(glm::lessThanEqual(A.Min, B.Max)) && glm::all(glm::greaterThanEqual(A.Max, B.Min));
+}
+
+internal void Cascades_AddReceiver(shadow_cascades* Cascades, const aabb& WorldBounds)
+{
+	aabb Bounds = AABB_Transform(WorldBounds, Cascades->LightView);
+
+	for (u32 i = 0; i < Cascades->Count; i++)
+	{
+		shadow_cascade& Cascade = Cascades->Cascades[i];
+		if (!Cascades_Overlaps(Bounds, Cascade.LightSpaceBounds))
+			continue;
+
+		// Parts outside of the cascade are shadowed by other cascades
+		aabb& Receivers = Cascade.ReceiverBounds;
+		Receivers.Min = glm::min(Receivers.Min, glm::max(Bounds.Min, Cascade.LightSpaceBounds.Min));
+		Receivers.Max = glm::max(Receivers.Max, glm::min(Bounds.Max, Cascade.LightSpaceBounds.Max));
+	}
+}
+
+internal void Cascades_BuildCasterBounds(shadow_cascades* Cascades, const cascade_settings& Settings)
+{
+	for (u32 i = 0; i < Cascades->Count; i++)
+	{
+		shadow_cascade& Cascade = Cascades->Cascades[i];
+
+		if (!Settings.CullAgainstReceivers)
+		{
+			Cascade.CasterBounds = Cascade.LightSpaceBounds;
+			continue;
+		}
+
+		// Above the receivers in light space, anything behind them cannot cast onto them.
+		// No receivers leaves the box empty (Min > Max) and nothing overlaps it.
+		const aabb& Receivers = Cascade.ReceiverBounds;
+		Cascade.CasterBounds.Min = v3(Receivers.Min.x, Receivers.Min.y, Cascade.LightSpaceBounds.Min.z);
+		Cascade.CasterBounds.Max = Receivers.Max;
+	}
+}
+
+internal u32 Cascades_GetCasterMask(const shadow_cascades* Cascades, const aabb& WorldBounds)
+{
+	aabb Bounds = AABB_Transform(WorldBounds, Cascades->LightView);
+
+	u32 Mask = 0;
+	for (u32 i = 0; i < Cascades->Count; i++)
+		Mask |= (u32)Cascades_Overlaps(Bounds, Cascades->Cascades[i].CasterBounds) << i;
+
+	return Mask;
+}
+
+internal void Cascades_GetConstants(const shadow_cascades* Cascades, shadow_cascade_constants* Constants)
+{
+	*Constants = {};
+	Constants->CascadeCount = Cascades->Count;
+	Constants->DepthStepBias = Cascades->DepthStepBias;
+	Constants->UVScale = 1.0f;
+
+	for (u32 i = 0; i < Cascades->Count; i++)
+	{
+		Constants->ViewProjections[i] = Cascades->Cascades[i].ViewProjection;
+		Constants->SplitFar[i] = Cascades->Cascades[i].SplitFar;
+		Constants->DepthBias[i] = Cascades->Cascades[i].DepthBias;
+		Constants->TexelSize[i] = Cascades->Cascades[i].TexelSize;
+		Constants->DepthRange[i] = Cascades->Cascades[i].LightSpaceBounds.Max.z - Cascades->Cascades[i].LightSpaceBounds.Min.z;
+	}
+}
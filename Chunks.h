@@ -0,0 +1,758 @@
+#pragma once
+
+// Block world
+// The world is a fixed grid of chunks, chunk data is allocated lazily when the first block is placed.
+// Blocks are centered on integer coordinates, so block (0, 0, 0) spans [-0.5, 0.5] like the unit cube in c_CuboidVerticesPositions.
+//
+// LOD
+// Every chunk can be meshed at 1x, 2x, 4x and 8x downsampled resolution. A downsampled cell is solid if any of its blocks is solid
+// and takes the color that most of its blocks have. Since a coarser LOD is always a superset of a finer one, a chunk may cull its
+// border faces against a neighbor that is rendered at the same or coarser LOD. Next to a finer neighbor it has to keep them (skirts),
+// otherwise we would see through the gaps of the finer chunk into the interior of the coarser one.
+//
+// Meshes are built on the job system and cached per (LOD, variant) until the chunk changes.
+//
+// Occluders
+// The occluder variant is the opposite of LOD downsampling, a cell is solid only if all of its blocks are. That makes it a subset
+// of the real geometry, so anything it hides is really hidden. It is only built at c_ChunkOccluderLOD.
+
+#include <bit>
+
+inline constexpr i32 c_ChunkSize = 32;
+inline constexpr i32 c_ChunkBlockCount = c_ChunkSize * c_ChunkSize * c_ChunkSize;
+inline constexpr f32 c_ChunkBoundingRadius = 0.8660254f * c_ChunkSize; // sqrt(3) * Size / 2
+
+inline constexpr i32 c_WorldChunksX = 32;
+inline constexpr i32 c_WorldChunksY = 8;
+inline constexpr i32 c_WorldChunksZ = 32;
+inline constexpr i32 c_WorldChunkCount = c_WorldChunksX * c_WorldChunksY * c_WorldChunksZ;
+
+// World spans [c_WorldBlockMin, c_WorldBlockMin + c_WorldChunks * c_ChunkSize)
+inline constexpr v3i c_WorldBlockMin = v3i(-c_WorldChunksX * c_ChunkSize / 2, -c_WorldChunksY * c_ChunkSize / 2, -c_WorldChunksZ * c_ChunkSize / 2);
+
+inline constexpr u32 c_ChunkLODCount = 4;
+inline constexpr i32 c_ChunkMeshPad = 1 << (c_ChunkLODCount - 1); // One cell of the coarsest LOD around the chunk
+inline constexpr i32 c_ChunkMeshInputSize = c_ChunkSize + 2 * c_ChunkMeshPad;
+inline constexpr u32 c_ChunkOccluderLOD = 2; // 4x4x4 cells, coarse enough to keep triangle counts low, fine enough to still find full cells
+
+enum class chunk_mesh_variant : u32
+{
+	Culled = 0, // Border faces culled against neighbors, valid when no neighbor is finer
+	Skirted,    // Border faces always emitted
+	Occluder,   // Only fully solid cells, positions only, used by the occlusion culler
+
+	COUNT
+};
+
+enum class chunk_mesh_state : u32
+{
+	Idle = 0,
+	Building,
+	Ready
+};
+
+struct chunk_mesh
+{
+	quad_vertex* Vertices;
+	u32 QuadCount;
+	u32 Version; // Chunk version this mesh was built from
+	b32 IsBuilt;
+};
+
+struct chunk_mesh_slot
+{
+	chunk_mesh Mesh;    // Published mesh, owned by the main thread
+	chunk_mesh Pending; // Written by the job, published in BlockWorld_UpdateMeshes
+	std::atomic<chunk_mesh_state> State;
+};
+
+struct chunk
+{
+	u8 Blocks[c_ChunkBlockCount]; // Palette index, 0 is air. Laid out as [z][y][x]
+	u32 SolidCount;
+	u32 Version;
+	v3i Coord;
+
+	chunk_mesh_slot Meshes[c_ChunkLODCount][(u32)chunk_mesh_variant::COUNT];
+};
+
+// Input of the mesher, a copy of the chunk plus c_ChunkMeshPad blocks of its neighbors so jobs never touch live world data
+struct chunk_mesh_input
+{
+	u8 Blocks[c_ChunkMeshInputSize * c_ChunkMeshInputSize * c_ChunkMeshInputSize];
+};
+
+struct chunk_lod_settings
+{
+	f32 MaxCellPixels; // A cell can cover at most this many pixels before we switch to a finer LOD
+	i32 MainBias;
+	i32 ShadowBias;    // Shadow pass can usually afford to be coarser
+	f32 ShadowBiasDistance; // Closer chunks cast shadows with the mesh they are drawn with, see BlockWorld_SelectLODs
+	u32 MaxJobsPerFrame;
+	b32 Enabled;
+};
+
+struct chunk_lod_stats
+{
+	u32 MainChunksPerLOD[c_ChunkLODCount];
+	u32 ShadowChunksPerLOD[c_ChunkLODCount];
+	u32 MainQuads;
+	u32 ShadowQuads;
+	u32 FullResolutionQuads; // What the same chunks would cost at LOD 0, only counts chunks whose LOD 0 mesh is cached
+	u32 JobsScheduled;
+};
+
+struct chunk_lod_selection
+{
+	u8 LOD;
+	u8 Variant;
+};
+
+struct block_world
+{
+	chunk* Chunks[c_WorldChunkCount];
+	u32 ActiveChunks[c_WorldChunkCount];
+	u32 ActiveChunkCount;
+
+	v4 Palette[256];
+
+	chunk_lod_settings LODSettings;
+	chunk_lod_selection MainLOD[c_WorldChunkCount];
+	chunk_lod_selection ShadowLOD[c_WorldChunkCount];
+	chunk_lod_stats Stats;
+
+	job_counter MeshJobs;
+};
+
+internal void BlockWorld_Initialize(block_world* World);
+internal u8 BlockWorld_GetBlock(const block_world* World, v3i Block);
+internal void BlockWorld_SetBlock(block_world* World, v3i Block, u8 Value);
+internal v3i BlockWorld_WorldToBlock(v3 Position);
+internal void BlockWorld_SelectLODs(block_world* World, const camera& Camera, v3 CameraPosition, f32 ViewportHeight);
+internal void BlockWorld_UpdateMeshes(block_world* World);
+internal const chunk_mesh* BlockWorld_GetMesh(block_world* World, u32 ChunkIndex, chunk_lod_selection Selection);
+internal const chunk_mesh* BlockWorld_GetOccluder(block_world* World, u32 ChunkIndex);
+
+internal void ChunkMesher_Build(const chunk_mesh_input* Input, const v4* Palette, v3i ChunkCoord, u32 LOD, chunk_mesh_variant Variant, chunk_mesh* Out);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+inline bool BlockWorld_IsChunkCoordValid(v3i Coord)
+{
+	return Coord.x >= 0 && Coord.y >= 0 && Coord.z >= 0 && Coord.x < c_WorldChunksX && Coord.y < c_WorldChunksY && Coord.z < c_WorldChunksZ;
+}
+
+inline u32 BlockWorld_GetChunkIndex(v3i Coord)
+{
+	return (Coord.z * c_WorldChunksY + Coord.y) * c_WorldChunksX + Coord.x;
+}
+
+inline u32 Chunk_GetBlockIndex(i32 X, i32 Y, i32 Z)
+{
+	return (Z * c_ChunkSize + Y) * c_ChunkSize + X;
+}
+
+inline v3i Chunk_GetBlockMin(v3i ChunkCoord)
+{
+	return c_WorldBlockMin + ChunkCoord * c_ChunkSize;
+}
+
+inline v3 Chunk_GetCenter(v3i ChunkCoord)
+{
+	// Blocks are centered on integers, hence the half block offset
+	return v3(Chunk_GetBlockMin(ChunkCoord)) + v3(c_ChunkSize * 0.5f - 0.5f);
+}
+
+inline aabb Chunk_GetBounds(v3i ChunkCoord)
+{
+	v3 Min = v3(Chunk_GetBlockMin(ChunkCoord)) - v3(0.5f);
+	return { Min, Min + v3((f32)c_ChunkSize) };
+}
+
+// Splits world block coordinates into chunk coordinates and local block coordinates
+inline void BlockWorld_SplitBlock(v3i Block, v3i* ChunkCoord, v3i* Local)
+{
+	v3i Relative = Block - c_WorldBlockMin;
+
+	// Floor division, Relative can be negative outside of the world
+	*ChunkCoord = v3i(
+		(Relative.x >= 0 ? Relative.x : Relative.x - c_ChunkSize + 1) / c_ChunkSize,
+		(Relative.y >= 0 ? Relative.y : Relative.y - c_ChunkSize + 1) / c_ChunkSize,
+		(Relative.z >= 0 ? Relative.z : Relative.z - c_ChunkSize + 1) / c_ChunkSize);
+	*Local = Relative - *ChunkCoord * c_ChunkSize;
+}
+
+internal void BlockWorld_Initialize(block_world* World)
+{
+	// Palette, 0 is air
+	World->Palette[0] = v4(0.0f);
+	World->Palette[1] = v4(0.55f, 0.55f, 0.55f, 1.0f); // Stone
+	World->Palette[2] = v4(0.45f, 0.30f, 0.15f, 1.0f); // Dirt
+	World->Palette[3] = v4(0.30f, 0.65f, 0.20f, 1.0f); // Grass
+	World->Palette[4] = v4(0.90f, 0.85f, 0.55f, 1.0f); // Sand
+	World->Palette[5] = v4(0.95f, 0.95f, 0.95f, 1.0f); // Snow
+	World->Palette[6] = v4(1.00f, 1.00f, 0.00f, 1.0f); // Placed by the player
+
+	// Rest is a debug gradient
+	for (u32 i = 7; i < CountOf(World->Palette); i++)
+	{
+		f32 T = i / 255.0f;
+		World->Palette[i] = v4(T, 1.0f - T, 0.5f, 1.0f);
+	}
+
+	World->LODSettings.MaxCellPixels = 4.0f;
+	World->LODSettings.MainBias = 0;
+	World->LODSettings.ShadowBias = 1;
+	World->LODSettings.ShadowBiasDistance = 160.0f; // Where the cascades end
+	World->LODSettings.MaxJobsPerFrame = 64;
+	World->LODSettings.Enabled = true;
+}
+
+internal chunk* BlockWorld_GetOrCreateChunk(block_world* World, v3i Coord)
+{
+	u32 Index = BlockWorld_GetChunkIndex(Coord);
+	chunk* Chunk = World->Chunks[Index];
+
+	if (!Chunk)
+	{
+		Chunk = VmAllocArray(chunk, 1);
+		Chunk->Coord = Coord;
+		World->Chunks[Index] = Chunk;
+		World->ActiveChunks[World->ActiveChunkCount++] = Index;
+	}
+
+	return Chunk;
+}
+
+internal u8 BlockWorld_GetBlock(const block_world* World, v3i Block)
+{
+	v3i ChunkCoord, Local;
+	BlockWorld_SplitBlock(Block, &ChunkCoord, &Local);
+
+	if (!BlockWorld_IsChunkCoordValid(ChunkCoord))
+		return 0;
+
+	const chunk* Chunk = World->Chunks[BlockWorld_GetChunkIndex(ChunkCoord)];
+	return Chunk ? Chunk->Blocks[Chunk_GetBlockIndex(Local.x, Local.y, Local.z)] : 0;
+}
+
+internal void BlockWorld_SetBlock(block_world* World, v3i Block, u8 Value)
+{
+	v3i ChunkCoord, Local;
+	BlockWorld_SplitBlock(Block, &ChunkCoord, &Local);
+
+	if (!BlockWorld_IsChunkCoordValid(ChunkCoord))
+		return;
+
+	// Do not allocate chunks just to put air in them
+	if (Value == 0 && !World->Chunks[BlockWorld_GetChunkIndex(ChunkCoord)])
+		return;
+
+	chunk* Chunk = BlockWorld_GetOrCreateChunk(World, ChunkCoord);
+
+	u8& Current = Chunk->Blocks[Chunk_GetBlockIndex(Local.x, Local.y, Local.z)];
+	if (Current == Value)
+		return;
+
+	Chunk->SolidCount += (Value != 0) - (Current != 0);
+	Current = Value;
+	Chunk->Version++;
+
+	// Neighbors cull their border faces against our padding and read it for ambient occlusion, so they need a rebuild too.
+	// Occlusion looks diagonally, so the edge and corner neighbors count as well when the block is in their padding
+	for (i32 Z = -1; Z <= 1; Z++)
+	{
+		for (i32 Y = -1; Y <= 1; Y++)
+		{
+			for (i32 X = -1; X <= 1; X++)
+			{
+				v3i Direction = v3i(X, Y, Z);
+				if (Direction == v3i(0))
+					continue;
+
+				bool NearBorder = true;
+				for (i32 Axis = 0; Axis < 3; Axis++)
+				{
+					if (Direction[Axis] < 0)
+						NearBorder &= Local[Axis] < c_ChunkMeshPad;
+					else if (Direction[Axis] > 0)
+						NearBorder &= Local[Axis] >= c_ChunkSize - c_ChunkMeshPad;
+				}
+
+				v3i NeighborCoord = ChunkCoord + Direction;
+				if (NearBorder && BlockWorld_IsChunkCoordValid(NeighborCoord))
+				{
+					if (chunk* Neighbor = World->Chunks[BlockWorld_GetChunkIndex(NeighborCoord)])
+						Neighbor->Version++;
+				}
+			}
+		}
+	}
+}
+
+internal v3i BlockWorld_WorldToBlock(v3 Position)
+{
+	return v3i(glm::round(Position));
+}
+
+internal void BlockWorld_CopyMeshInput(const block_world* World, v3i ChunkCoord, chunk_mesh_input* Input)
+{
+	v3i Min = Chunk_GetBlockMin(ChunkCoord) - v3i(c_ChunkMeshPad);
+
+	for (i32 Z = 0; Z < c_ChunkMeshInputSize; Z++)
+	{
+		for (i32 Y = 0; Y < c_ChunkMeshInputSize; Y++)
+		{
+			u8* Row = &Input->Blocks[(Z * c_ChunkMeshInputSize + Y) * c_ChunkMeshInputSize];
+
+			// Row can span up to three chunks in X
+			i32 X = 0;
+			while (X < c_ChunkMeshInputSize)
+			{
+				v3i SourceChunk, Local;
+				BlockWorld_SplitBlock(Min + v3i(X, Y, Z), &SourceChunk, &Local);
+
+				i32 Count = glm::min(c_ChunkSize - Local.x, c_ChunkMeshInputSize - X);
+
+				const chunk* Source = BlockWorld_IsChunkCoordValid(SourceChunk) ? World->Chunks[BlockWorld_GetChunkIndex(SourceChunk)] : nullptr;
+				if (Source)
+					memcpy(Row + X, &Source->Blocks[Chunk_GetBlockIndex(Local.x, Local.y, Local.z)], Count);
+				else
+					memset(Row + X, 0, Count);
+
+				X += Count;
+			}
+		}
+	}
+}
+
+// Mesher
+// Downsamples the padded input to the LOD grid, builds occupancy bitsets and emits one quad per visible cell face.
+// Face order and winding follow c_CuboidVerticesPositions so that both passes cull the same way as for pushed cubes.
+//
+// Every vertex gets the classic voxel ambient occlusion from the same bitsets: of the two cells next to it and the one diagonal
+// to it in front of the face, the open ones count, 0 to 3. Both sides closed is 0 whatever the corner is. The level goes to the
+// vertex color's alpha as Level / 3, the main pass scales its light by it down to c_VoxelOcclusionFloor. Quads split along the
+// diagonal with the more open pair of vertices, otherwise one dark corner would bleed along the diagonal over both triangles.
+// The quad index buffer always splits 0-2, so the vertices of a flipped quad are rotated by one instead.
+// Skirted meshes have no padding cells, their border vertices see open space there.
+
+inline constexpr i32 c_ChunkMesherRowCount = c_ChunkSize + 2;
+
+struct chunk_mesher_scratch
+{
+	u8 Colors[c_ChunkBlockCount];                               // [z][y][x], inner cells only
+	u64 Rows[c_ChunkMesherRowCount][c_ChunkMesherRowCount];      // [z][y], bit x. One cell of padding on every side
+};
+
+internal u8 ChunkMesher_DownsampleCell(const chunk_mesh_input* Input, i32 StartX, i32 StartY, i32 StartZ, i32 Factor)
+{
+	// Majority vote over the solid blocks, a cell rarely contains more than a few distinct colors
+	u8 Candidates[16];
+	u16 Counts[16];
+	u32 CandidateCount = 0;
+
+	for (i32 Z = StartZ; Z < StartZ + Factor; Z++)
+	{
+		for (i32 Y = StartY; Y < StartY + Factor; Y++)
+		{
+			const u8* Row = &Input->Blocks[(Z * c_ChunkMeshInputSize + Y) * c_ChunkMeshInputSize];
+			for (i32 X = StartX; X < StartX + Factor; X++)
+			{
+				u8 Value = Row[X];
+				if (Value == 0)
+					continue;
+
+				u32 i = 0;
+				while (i < CandidateCount && Candidates[i] != Value)
+					i++;
+
+				if (i == CandidateCount)
+				{
+					if (CandidateCount == CountOf(Candidates))
+						continue; // Too colorful, ignore the rest
+
+					Candidates[CandidateCount] = Value;
+					Counts[CandidateCount] = 0;
+					CandidateCount++;
+				}
+
+				Counts[i]++;
+			}
+		}
+	}
+
+	u8 Result = 0;
+	u16 BestCount = 0;
+	for (u32 i = 0; i < CandidateCount; i++)
+	{
+		if (Counts[i] > BestCount)
+		{
+			BestCount = Counts[i];
+			Result = Candidates[i];
+		}
+	}
+
+	return Result;
+}
+
+internal bool ChunkMesher_IsCellFull(const chunk_mesh_input* Input, i32 StartX, i32 StartY, i32 StartZ, i32 Factor)
+{
+	for (i32 Z = StartZ; Z < StartZ + Factor; Z++)
+	{
+		for (i32 Y = StartY; Y < StartY + Factor; Y++)
+		{
+			const u8* Row = &Input->Blocks[(Z * c_ChunkMeshInputSize + Y) * c_ChunkMeshInputSize];
+			for (i32 X = StartX; X < StartX + Factor; X++)
+			{
+				if (Row[X] == 0)
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+internal void ChunkMesher_Build(const chunk_mesh_input* Input, const v4* Palette, v3i ChunkCoord, u32 LOD, chunk_mesh_variant Variant, chunk_mesh* Out)
+{
+	Assert(LOD < c_ChunkLODCount, "Invalid chunk LOD!");
+
+	const i32 Factor = 1 << LOD;
+	const i32 N = c_ChunkSize / Factor;
+	const bool IsOccluder = Variant == chunk_mesh_variant::Occluder;
+	const bool CullBorders = Variant != chunk_mesh_variant::Skirted; // Occluders are full cells, culling against them is always safe
+
+	// ~40 KB, fine for the stack of a worker
+	chunk_mesher_scratch Scratch;
+	memset(Scratch.Rows, 0, sizeof(Scratch.Rows));
+
+	// Downsample, cell -1 and N are the padding
+	for (i32 Z = -1; Z <= N; Z++)
+	{
+		for (i32 Y = -1; Y <= N; Y++)
+		{
+			bool BorderRow = Z < 0 || Y < 0 || Z == N || Y == N;
+			u64 Row = 0;
+
+			for (i32 X = -1; X <= N; X++)
+			{
+				bool Border = BorderRow || X < 0 || X == N;
+				if (Border && !CullBorders)
+					continue;
+
+				i32 StartX = c_ChunkMeshPad + X * Factor, StartY = c_ChunkMeshPad + Y * Factor, StartZ = c_ChunkMeshPad + Z * Factor;
+				u8 Color = IsOccluder ? (u8)ChunkMesher_IsCellFull(Input, StartX, StartY, StartZ, Factor) : ChunkMesher_DownsampleCell(Input, StartX, StartY, StartZ, Factor);
+
+				if (Color)
+					Row |= 1ull << (X + 1);
+
+				if (!Border)
+					Scratch.Colors[(Z * N + Y) * N + X] = Color;
+			}
+
+			Scratch.Rows[Z + 1][Y + 1] = Row;
+		}
+	}
+
+	// Visible faces per row, in c_CuboidVerticesPositions face order: -Z, +Z, -X, +X, +Y, -Y
+	const u64 InnerMask = ((1ull << N) - 1) << 1;
+	auto VisibleFaces = [&Scratch, InnerMask](i32 Z, i32 Y, u64 Faces[6])
+	{
+		u64 Row = Scratch.Rows[Z][Y];
+		Faces[0] = Row & ~Scratch.Rows[Z - 1][Y] & InnerMask;
+		Faces[1] = Row & ~Scratch.Rows[Z + 1][Y] & InnerMask;
+		Faces[2] = Row & ~(Row << 1) & InnerMask;
+		Faces[3] = Row & ~(Row >> 1) & InnerMask;
+		Faces[4] = Row & ~Scratch.Rows[Z][Y + 1] & InnerMask;
+		Faces[5] = Row & ~Scratch.Rows[Z][Y - 1] & InnerMask;
+	};
+
+	// Count first so the mesh is allocated exactly once
+	u32 QuadCount = 0;
+	for (i32 Z = 1; Z <= N; Z++)
+	{
+		for (i32 Y = 1; Y <= N; Y++)
+		{
+			u64 Faces[6];
+			VisibleFaces(Z, Y, Faces);
+			for (u32 f = 0; f < 6; f++)
+				QuadCount += std::popcount(Faces[f]);
+		}
+	}
+
+	Out->Vertices = QuadCount > 0 ? VmAllocArray(quad_vertex, QuadCount * 4) : nullptr;
+	Out->QuadCount = QuadCount;
+	Out->IsBuilt = true;
+
+	if (QuadCount == 0)
+		return;
+
+	// Emit
+	const v3 Origin = v3(Chunk_GetBlockMin(ChunkCoord)) + v3((Factor - 1) * 0.5f);
+	const f32 CellSize = static_cast<f32>(Factor);
+	quad_vertex* Vertex = Out->Vertices;
+
+	// Cells around each vertex that occlude it, two sides and the corner, relative to the cell of the face
+	v3i OcclusionOffsets[6][4][3];
+	for (u32 f = 0; f < 6; f++)
+	{
+		v3i Normal = v3i(c_CuboidNormals[f * 4]);
+		i32 Axis = Normal.x != 0 ? 0 : Normal.y != 0 ? 1 : 2;
+		i32 AxisU = (Axis + 1) % 3, AxisV = (Axis + 2) % 3;
+
+		for (u32 i = 0; i < 4; i++)
+		{
+			v3i Corner = v3i(glm::sign(v3(c_CuboidVerticesPositions[f * 4 + i])));
+			v3i SideU = Corner, SideV = Corner;
+			SideU[AxisV] = 0;
+			SideV[AxisU] = 0;
+
+			OcclusionOffsets[f][i][0] = SideU;
+			OcclusionOffsets[f][i][1] = SideV;
+			OcclusionOffsets[f][i][2] = Corner;
+		}
+	}
+
+	auto IsSolid = [&Scratch](i32 X, i32 Y, i32 Z, v3i Offset) -> u32
+	{
+		return (Scratch.Rows[Z + Offset.z][Y + Offset.y] >> (X + Offset.x)) & 1;
+	};
+
+	for (i32 Z = 1; Z <= N; Z++)
+	{
+		for (i32 Y = 1; Y <= N; Y++)
+		{
+			u64 Faces[6];
+			VisibleFaces(Z, Y, Faces);
+
+			for (u32 f = 0; f < 6; f++)
+			{
+				u64 Bits = Faces[f];
+				while (Bits)
+				{
+					i32 X = std::countr_zero(Bits);
+					Bits &= Bits - 1;
+
+					i32 CellX = X - 1, CellY = Y - 1, CellZ = Z - 1;
+					v3 Center = Origin + v3(CellX, CellY, CellZ) * CellSize;
+					v4 Color = IsOccluder ? v4(1.0f) : Palette[Scratch.Colors[(CellZ * N + CellY) * N + CellX]];
+
+					// Occluders are never shaded
+					u32 Occlusion[4] = { 3, 3, 3, 3 };
+					if (!IsOccluder)
+					{
+						for (u32 i = 0; i < 4; i++)
+						{
+							u32 SideU = IsSolid(X, Y, Z, OcclusionOffsets[f][i][0]);
+							u32 SideV = IsSolid(X, Y, Z, OcclusionOffsets[f][i][1]);
+							u32 Corner = IsSolid(X, Y, Z, OcclusionOffsets[f][i][2]);
+							Occlusion[i] = (SideU && SideV) ? 0 : 3 - (SideU + SideV + Corner);
+						}
+					}
+
+					u32 First = Occlusion[0] + Occlusion[2] < Occlusion[1] + Occlusion[3] ? 1 : 0;
+					for (u32 j = 0; j < 4; j++)
+					{
+						u32 i = (First + j) & 3;
+						Vertex->Position = v4(Center + v3(c_CuboidVerticesPositions[f * 4 + i]) * CellSize, 1.0f);
+						Vertex->Color = v4(v3(Color), Occlusion[i] / 3.0f);
+						Vertex->Normal = c_CuboidNormals[f * 4 + i];
+						Vertex++;
+					}
+				}
+			}
+		}
+	}
+}
+
+// LOD selection
+
+internal u32 BlockWorld_ComputeLOD(const camera& Camera, v3 CameraPosition, v3 ChunkCenter, f32 ViewportHeight, f32 MaxCellPixels, i32 Bias)
+{
+	f32 Distance = glm::max(glm::length(ChunkCenter - CameraPosition) - c_ChunkBoundingRadius, Camera.PerspectiveNear);
+	f32 BlockPixels = Camera.GetProjectedSize(1.0f, Distance, ViewportHeight);
+
+	i32 LOD = BlockPixels >= MaxCellPixels ? 0 : static_cast<i32>(glm::floor(glm::log2(MaxCellPixels / BlockPixels)));
+	return static_cast<u32>(glm::clamp(LOD + Bias, 0, static_cast<i32>(c_ChunkLODCount) - 1));
+}
+
+internal void BlockWorld_ResolveVariants(const block_world* World, chunk_lod_selection* Selections)
+{
+	v3i Directions[6] = { v3i(-1, 0, 0), v3i(1, 0, 0), v3i(0, -1, 0), v3i(0, 1, 0), v3i(0, 0, -1), v3i(0, 0, 1) };
+
+	for (u32 i = 0; i < World->ActiveChunkCount; i++)
+	{
+		u32 ChunkIndex = World->ActiveChunks[i];
+		const chunk* Chunk = World->Chunks[ChunkIndex];
+		chunk_lod_selection& Selection = Selections[ChunkIndex];
+
+		Selection.Variant = (u8)chunk_mesh_variant::Culled;
+
+		if (Selection.LOD == 0)
+			continue;
+
+		for (const v3i& Direction : Directions)
+		{
+			v3i NeighborCoord = Chunk->Coord + Direction;
+			if (!BlockWorld_IsChunkCoordValid(NeighborCoord))
+				continue;
+
+			u32 NeighborIndex = BlockWorld_GetChunkIndex(NeighborCoord);
+			if (World->Chunks[NeighborIndex] && Selections[NeighborIndex].LOD < Selection.LOD)
+			{
+				Selection.Variant = (u8)chunk_mesh_variant::Skirted;
+				break;
+			}
+		}
+	}
+}
+
+internal void BlockWorld_SelectLODs(block_world* World, const camera& Camera, v3 CameraPosition, f32 ViewportHeight)
+{
+	const chunk_lod_settings& Settings = World->LODSettings;
+
+	for (u32 i = 0; i < World->ActiveChunkCount; i++)
+	{
+		u32 ChunkIndex = World->ActiveChunks[i];
+		const chunk* Chunk = World->Chunks[ChunkIndex];
+
+		if (!Settings.Enabled)
+		{
+			World->MainLOD[ChunkIndex].LOD = World->ShadowLOD[ChunkIndex].LOD = 0;
+			continue;
+		}
+
+		// A coarser cell is solid if any of its blocks is, so a coarser shadow mesh is larger than the mesh it shades and puts the
+		// chunk's own surface in its shadow. Only chunks too far to receive shadows themselves can cast them coarser.
+		v3 Center = Chunk_GetCenter(Chunk->Coord);
+		f32 Distance = glm::length(Center - CameraPosition) - c_ChunkBoundingRadius;
+		i32 ShadowBias = Distance < Settings.ShadowBiasDistance ? Settings.MainBias : Settings.ShadowBias;
+
+		World->MainLOD[ChunkIndex].LOD = (u8)BlockWorld_ComputeLOD(Camera, CameraPosition, Center, ViewportHeight, Settings.MaxCellPixels, Settings.MainBias);
+		World->ShadowLOD[ChunkIndex].LOD = (u8)BlockWorld_ComputeLOD(Camera, CameraPosition, Center, ViewportHeight, Settings.MaxCellPixels, ShadowBias);
+	}
+
+	BlockWorld_ResolveVariants(World, World->MainLOD);
+	BlockWorld_ResolveVariants(World, World->ShadowLOD);
+}
+
+// Mesh cache
+
+internal void BlockWorld_UpdateMeshes(block_world* World)
+{
+	memset(&World->Stats, 0, sizeof(World->Stats));
+
+	// Publish finished jobs
+	for (u32 i = 0; i < World->ActiveChunkCount; i++)
+	{
+		chunk* Chunk = World->Chunks[World->ActiveChunks[i]];
+
+		for (auto& LODSlots : Chunk->Meshes)
+		{
+			for (chunk_mesh_slot& Slot : LODSlots)
+			{
+				if (Slot.State.load(std::memory_order_acquire) != chunk_mesh_state::Ready)
+					continue;
+
+				if (Slot.Mesh.Vertices)
+					VmFree(Slot.Mesh.Vertices);
+
+				Slot.Mesh = Slot.Pending;
+				Slot.Pending = {};
+				Slot.State.store(chunk_mesh_state::Idle, std::memory_order_release);
+			}
+		}
+	}
+}
+
+internal bool BlockWorld_ScheduleMesh(block_world* World, chunk* Chunk, u32 LOD, chunk_mesh_variant Variant)
+{
+	if (World->Stats.JobsScheduled >= World->LODSettings.MaxJobsPerFrame)
+		return false;
+
+	World->Stats.JobsScheduled++;
+
+	chunk_mesh_slot* Slot = &Chunk->Meshes[LOD][(u32)Variant];
+	Slot->State.store(chunk_mesh_state::Building, std::memory_order_relaxed);
+
+	// Snapshot the data now, the world may change while the job runs
+	chunk_mesh_input* Input = VmAllocArray(chunk_mesh_input, 1);
+	BlockWorld_CopyMeshInput(World, Chunk->Coord, Input);
+
+	u32 Version = Chunk->Version;
+	v3i Coord = Chunk->Coord;
+	const v4* Palette = World->Palette;
+
+	JobSystem_Submit(&g_Jobs, &World->MeshJobs, [Slot, Input, Palette, Coord, LOD, Variant, Version]()
+	{
+		ChunkMesher_Build(Input, Palette, Coord, LOD, Variant, &Slot->Pending);
+		Slot->Pending.Version = Version;
+		VmFree(Input);
+
+		Slot->State.store(chunk_mesh_state::Ready, std::memory_order_release);
+	});
+
+	return true;
+}
+
+// Returns the requested mesh if it is cached, otherwise schedules it and returns the closest cached LOD meanwhile (or nullptr)
+internal const chunk_mesh* BlockWorld_GetMesh(block_world* World, u32 ChunkIndex, chunk_lod_selection Selection)
+{
+	chunk* Chunk = World->Chunks[ChunkIndex];
+	if (!Chunk || Chunk->SolidCount == 0)
+		return nullptr;
+
+	chunk_mesh_slot& Slot = Chunk->Meshes[Selection.LOD][Selection.Variant];
+
+	bool UpToDate = Slot.Mesh.IsBuilt && Slot.Mesh.Version == Chunk->Version;
+	if (!UpToDate && Slot.State.load(std::memory_order_acquire) == chunk_mesh_state::Idle)
+	{
+		BlockWorld_ScheduleMesh(World, Chunk, Selection.LOD, (chunk_mesh_variant)Selection.Variant);
+	}
+
+	if (Slot.Mesh.IsBuilt)
+		return &Slot.Mesh;
+
+	// Fallback, skirted meshes first since they never leave holes
+	for (u32 Distance = 1; Distance < c_ChunkLODCount; Distance++)
+	{
+		i32 Candidates[2] = { (i32)Selection.LOD + (i32)Distance, (i32)Selection.LOD - (i32)Distance };
+		for (i32 LOD : Candidates)
+		{
+			if (LOD < 0 || LOD >= (i32)c_ChunkLODCount)
+				continue;
+
+			for (i32 Variant = (i32)chunk_mesh_variant::Skirted; Variant >= 0; Variant--)
+			{
+				if (Chunk->Meshes[LOD][Variant].Mesh.IsBuilt)
+					return &Chunk->Meshes[LOD][Variant].Mesh;
+			}
+		}
+	}
+
+	return nullptr;
+}
+
+// Returns the occluder mesh if it is cached and up to date, otherwise schedules it.
+// Stale occluders are never returned, they could hide something that was just dug out.
+internal const chunk_mesh* BlockWorld_GetOccluder(block_world* World, u32 ChunkIndex)
+{
+	chunk* Chunk = World->Chunks[ChunkIndex];
+	if (!Chunk || Chunk->SolidCount == 0)
+		return nullptr;
+
+	chunk_mesh_slot& Slot = Chunk->Meshes[c_ChunkOccluderLOD][(u32)chunk_mesh_variant::Occluder];
+
+	bool UpToDate = Slot.Mesh.IsBuilt && Slot.Mesh.Version == Chunk->Version;
+	if (!UpToDate && Slot.State.load(std::memory_order_acquire) == chunk_mesh_state::Idle)
+	{
+		BlockWorld_ScheduleMesh(World, Chunk, c_ChunkOccluderLOD, chunk_mesh_variant::Occluder);
+	}
+
+	return UpToDate && Slot.Mesh.QuadCount > 0 ? &Slot.Mesh : nullptr;
+}
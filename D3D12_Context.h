@@ -423,7 +423,7 @@ internal void D3D12Context_Initialize(d3d12_context* Context, const game_window&
 		{
 			D3D12_CLEAR_VALUE OptimizedClearValue = {};
 			OptimizedClearValue.Format = DXGI_FORMAT_D32_FLOAT;
-			OptimizedClearValue.DepthStencil = { 1.0f, 0 };
+			OptimizedClearValue.DepthStencil = { 0.0f, 0 }; // Reverse Z
 
 			D3D12_HEAP_PROPERTIES HeapProperties = {};
 			HeapProperties.Type = D3D12_HEAP_TYPE_DEFAULT;
@@ -1,7 +1,5 @@
 #include "D3D12_Shadows.h"
 
-#include <vector>
-
 #define SHADOW_MAP_SIZE 1024
 
 
@@ -14,7 +12,7 @@ internal void D3D12Shadows_Initialize(d3d12_shadows_test* Test, d3d12_context* C
 	{
 		//  Root Signature
 		{
-			D3D12_STATIC_SAMPLER_DESC Samplers[1] = {};
+			D3D12_STATIC_SAMPLER_DESC Samplers[4] = {};
 
 			// Sampler
 			Samplers[0].Filter = D3D12_FILTER_MIN_MAG_POINT_MIP_LINEAR;
@@ -31,14 +29,52 @@ internal void D3D12Shadows_Initialize(d3d12_shadows_test* Test, d3d12_context* C
 			Samplers[0].RegisterSpace = 0;
 			Samplers[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
 
+			// Comparison sampler for the filtered shadow lookups, a bilinear compare gives the 2x2 PCF for free
+			// Outside the map counts as lit
+			Samplers[1].Filter = D3D12_FILTER_COMPARISON_MIN_MAG_LINEAR_MIP_POINT;
+			Samplers[1].AddressU = D3D12_TEXTURE_ADDRESS_MODE_BORDER;
+			Samplers[1].AddressV = D3D12_TEXTURE_ADDRESS_MODE_BORDER;
+			Samplers[1].AddressW = D3D12_TEXTURE_ADDRESS_MODE_BORDER;
+			Samplers[1].MipLODBias = 0;
+			Samplers[1].MaxAnisotropy = 1;
+			Samplers[1].ComparisonFunc = D3D12_COMPARISON_FUNC_LESS_EQUAL;
+			Samplers[1].BorderColor = D3D12_STATIC_BORDER_COLOR_OPAQUE_WHITE;
+			Samplers[1].MinLOD = 0.0f;
+			Samplers[1].MaxLOD = D3D12_FLOAT32_MAX;
+			Samplers[1].ShaderRegister = 1;
+			Samplers[1].RegisterSpace = 0;
+			Samplers[1].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+
+			// Trilinear sampler for the prefiltered moments, edges clamp since a border is no valid moment
+			Samplers[2].Filter = D3D12_FILTER_MIN_MAG_MIP_LINEAR;
+			Samplers[2].AddressU = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+			Samplers[2].AddressV = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+			Samplers[2].AddressW = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+			Samplers[2].MipLODBias = 0;
+			Samplers[2].MaxAnisotropy = 1;
+			Samplers[2].ComparisonFunc = D3D12_COMPARISON_FUNC_NEVER;
+			Samplers[2].BorderColor = D3D12_STATIC_BORDER_COLOR_OPAQUE_WHITE;
+			Samplers[2].MinLOD = 0.0f;
+			Samplers[2].MaxLOD = D3D12_FLOAT32_MAX;
+			Samplers[2].ShaderRegister = 2;
+			Samplers[2].RegisterSpace = 0;
+			Samplers[2].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+
+			// Point shadow cubes, same compare. Lookups never leave the cube, so the address mode does not matter
+			Samplers[3] = Samplers[1];
+			Samplers[3].AddressU = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+			Samplers[3].AddressV = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+			Samplers[3].AddressW = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+			Samplers[3].ShaderRegister = 3;
+
 			D3D12_DESCRIPTOR_RANGE Ranges[1] = {};
 			Ranges[0].RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
-			Ranges[0].NumDescriptors = 1;
+			Ranges[0].NumDescriptors = 4; // Depth, moments, point shadow cubes, virtual shadow pool
 			Ranges[0].BaseShaderRegister = 0;
 			Ranges[0].RegisterSpace = 0;
 			Ranges[0].OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
 
-			D3D12_ROOT_PARAMETER Parameters[3] = {};
+			D3D12_ROOT_PARAMETER Parameters[9] = {};
 			Parameters[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
 			Parameters[0].Constants.Num32BitValues = sizeof(quad_root_signature_constant_buffer) / 4;
 			Parameters[0].Constants.ShaderRegister = 0;  // b0
@@ -57,6 +93,42 @@ internal void D3D12Shadows_Initialize(d3d12_shadows_test* Test, d3d12_context* C
 			Parameters[2].DescriptorTable.pDescriptorRanges = Ranges;
 			Parameters[2].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
 
+			// Shadow cascades
+			Parameters[3].ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV;
+			Parameters[3].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+			Parameters[3].Descriptor.ShaderRegister = 2; // b2
+			Parameters[3].Descriptor.RegisterSpace = 0;
+
+			// Virtual shadows
+			Parameters[4].ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV;
+			Parameters[4].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+			Parameters[4].Descriptor.ShaderRegister = 3; // b3
+			Parameters[4].Descriptor.RegisterSpace = 0;
+
+			// Virtual shadow page table, a structured buffer straight from the upload heap
+			Parameters[5].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+			Parameters[5].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+			Parameters[5].Descriptor.ShaderRegister = 4; // t4
+			Parameters[5].Descriptor.RegisterSpace = 0;
+
+			// Light clusters, same as the page table
+			Parameters[6].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+			Parameters[6].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+			Parameters[6].Descriptor.ShaderRegister = 5; // t5
+			Parameters[6].Descriptor.RegisterSpace = 0;
+
+			// Point lights, same as the page table
+			Parameters[7].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+			Parameters[7].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+			Parameters[7].Descriptor.ShaderRegister = 6; // t6
+			Parameters[7].Descriptor.RegisterSpace = 0;
+
+			// Irradiance probes, same as the page table
+			Parameters[8].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+			Parameters[8].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+			Parameters[8].Descriptor.ShaderRegister = 7; // t7
+			Parameters[8].Descriptor.RegisterSpace = 0;
+
 			D3D12_ROOT_SIGNATURE_DESC Desc = {};
 			Desc.pParameters = Parameters;
 			Desc.NumParameters = CountOf(Parameters);
@@ -101,7 +173,7 @@ internal void D3D12Shadows_Initialize(d3d12_shadows_test* Test, d3d12_context* C
 			// Depth and stencil state
 			PipelineDesc.DepthStencilState.DepthEnable = true;
 			PipelineDesc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ALL;
-			PipelineDesc.DepthStencilState.DepthFunc = D3D12_COMPARISON_FUNC_LESS;  // Closer pixels are drawn
+			PipelineDesc.DepthStencilState.DepthFunc = D3D12_COMPARISON_FUNC_GREATER;  // Closer pixels are drawn, reverse Z
 			PipelineDesc.DepthStencilState.StencilEnable = FALSE;  // Stencil disabled for now
 			PipelineDesc.DSVFormat = DXGI_FORMAT_D32_FLOAT;  // Must match depth buffer format
 
@@ -125,7 +197,6 @@ internal void D3D12Shadows_Initialize(d3d12_shadows_test* Test, d3d12_context* C
 			PipelineDesc.InputLayout = { InputElementDescs, CountOf(InputElementDescs) };
 			PipelineDesc.pRootSignature = Test->Quad.RootSignature;
 			PipelineDesc.VS = CompileVertexShader(ShaderPath);
-			PipelineDesc.PS = CompileFragmentShader(ShaderPath);
 			PipelineDesc.SampleMask = UINT_MAX;
 			PipelineDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
 
@@ -133,7 +204,25 @@ internal void D3D12Shadows_Initialize(d3d12_shadows_test* Test, d3d12_context* C
 			PipelineDesc.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
 			PipelineDesc.SampleDesc.Count = 1;
 
-			DxAssert(Device->CreateGraphicsPipelineState(&PipelineDesc, IID_PPV_ARGS(&Test->Quad.Pipeline)));
+			// One pixel shader permutation per shadow filter preset, the filter loops are unrolled at compile time
+			for (u32 i = 0; i < c_ShadowFilterPresetCount; i++)
+			{
+				const shadow_filter_preset& Preset = c_ShadowFilterPresets[i];
+
+				wchar_t DefineStrings[5][64];
+				swprintf_s(DefineStrings[0], L"SHADOW_FILTER=%u", (u32)Preset.Filter);
+				swprintf_s(DefineStrings[1], L"SHADOW_FILTER_TAPS=%u", Preset.Taps);
+				swprintf_s(DefineStrings[2], L"SHADOW_FILTER_RADIUS=%f", Preset.Radius);
+				swprintf_s(DefineStrings[3], L"SHADOW_FILTER_LIGHT_SIZE=%f", Preset.LightSize);
+				swprintf_s(DefineStrings[4], L"SHADOW_FILTER_LIGHT_BLEEDING=%f", Preset.LightBleeding);
+
+				const wchar_t* Defines[] = { DefineStrings[0], DefineStrings[1], DefineStrings[2], DefineStrings[3], DefineStrings[4] };
+				PipelineDesc.PS = CompileFragmentShader(ShaderPath, Defines, CountOf(Defines));
+
+				DxAssert(Device->CreateGraphicsPipelineState(&PipelineDesc, IID_PPV_ARGS(&Test->Quad.Pipelines[i])));
+			}
+
+			Test->Quad.ShadowFilter = c_DefaultShadowFilter;
 		}
 
 		// Vertex buffers and index buffers
@@ -163,16 +252,68 @@ internal void D3D12Shadows_Initialize(d3d12_shadows_test* Test, d3d12_context* C
 					Offset += 4;
 				}
 				Test->Quad.IndexBuffer = DX12IndexBufferCreate(Device, Context->DirectCommandAllocators[0], Context->DirectCommandList, Context->DirectCommandQueue, QuadIndices, c_MaxQuadIndices);
+				Test->Quad.Indices = QuadIndices;
 			}
 		}
 	}
 
 	// Light environment
 	{
+		LightStore_Initialize(&Test->LightStore, c_MaxPointLights);
+		LightTree_Initialize(&Test->LightTree, c_MaxPointLights);
+
 		// Create light environment constant buffer for each frame
 		for (u32 i = 0; i < FIF; i++)
 		{
 			Test->LightEnvironmentConstantBuffers[i] = DX12ConstantBufferCreate(Device, sizeof(light_environment));
+			Test->PointLightBuffers[i] = DX12ConstantBufferCreate(Device, sizeof(point_light) * Test->LightStore.Capacity);
+			Test->LightClusterBuffers[i] = DX12ConstantBufferCreate(Device, sizeof(u32) * c_LightClusterBufferSize);
+			Test->IrradianceProbeBuffers[i] = DX12ConstantBufferCreate(Device, sizeof(irradiance_probe_gpu) * c_IrradianceProbeCount);
+		}
+
+		Test->LightClusters = VmAllocArray(light_clusters, 1);
+		Test->LightClusters->LightBudget = 64;
+		Test->LightSwarm = VmAllocArray(light_handle, c_LightSwarmSize);
+	}
+
+	// Block world
+	{
+		Test->BlockWorld = VmAllocArray(block_world, 1);
+		BlockWorld_Initialize(Test->BlockWorld);
+
+		Test->Occlusion = VmAllocArray(occlusion_culler, 1);
+		OcclusionCuller_Initialize(Test->Occlusion);
+
+		// Around the camera at startup
+		Test->IrradianceProbes = VmAllocArray(irradiance_probes, 1);
+		IrradianceProbes_Initialize(Test->IrradianceProbes, IrradianceProbes_GetDefaultSettings(), v3(0.0f, 6.0f, -10.0f));
+	}
+
+	// Entities
+	{
+		entity_store* Entities = &Test->Entities;
+		Entities_Initialize(Entities, c_MaxEntities);
+
+		auto& Scene = Test->Scene;
+		Scene.EyeDebug = Entities_Create(Entities, v3(0.0f), v3(0.0f), v3(0.5f), v4(1.0f), entity_flags::Debug);
+		Scene.CameraDebug = Entities_Create(Entities, v3(0.0f), v3(0.0f), v3(0.5f), v4(1.0f), entity_flags::Debug);
+		Scene.RotatingCube = Entities_Create(Entities, v3(0, 5, 0), v3(0.0f), v3(1.0f));
+		Scene.Ground = Entities_Create(Entities, v3(0, 0, 0), v3(0.0f), v3(20.0f, 1.0f, 20.0f), v4(1.0f), entity_flags::Static | entity_flags::CastsShadow);
+
+		// Gizmo, the axes are children of a node that follows Eye, so only the root moves
+		transform_hierarchy* Hierarchy = &Test->Hierarchy;
+		TransformHierarchy_Initialize(Hierarchy, c_MaxTransformNodes);
+
+		Scene.EyeGizmo = TransformHierarchy_Create(Hierarchy, {}, v3(0.0f));
+
+		const v3 AxisOffsets[3] = { v3(0.6f, 0.0f, 0.0f), v3(0.0f, 0.6f, 0.0f), v3(0.0f, 0.0f, 0.6f) };
+		const v3 AxisScales[3] = { v3(0.7f, 0.05f, 0.05f), v3(0.05f, 0.7f, 0.05f), v3(0.05f, 0.05f, 0.7f) };
+		const v4 AxisColors[3] = { v4(1.0f, 0.2f, 0.2f, 1.0f), v4(0.2f, 1.0f, 0.2f, 1.0f), v4(0.2f, 0.2f, 1.0f, 1.0f) };
+
+		for (u32 i = 0; i < 3; i++)
+		{
+			Scene.EyeGizmoAxes[i] = TransformHierarchy_Create(Hierarchy, Scene.EyeGizmo, AxisOffsets[i], v3(0.0f), AxisScales[i]);
+			Scene.EyeGizmoEntities[i] = Entities_Create(Entities, v3(0.0f), v3(0.0f), v3(1.0f), AxisColors[i], entity_flags::Debug | entity_flags::ExternalTransform);
 		}
 	}
 
@@ -244,7 +385,136 @@ internal void D3D12Shadows_Initialize(d3d12_shadows_test* Test, d3d12_context* C
 			PipelineDesc.NumRenderTargets = 0;
 			PipelineDesc.SampleDesc.Count = 1;
 
+			DxAssert(Device->CreateGraphicsPipelineState(&PipelineDesc, IID_PPV_ARGS(&Test->ShadowPass.AtlasPipeline)));
+
+			PipelineDesc.DSVFormat = c_CascadeDSVFormat;
 			DxAssert(Device->CreateGraphicsPipelineState(&PipelineDesc, IID_PPV_ARGS(&Test->ShadowPass.Pipeline)));
+
+			// Same pass writing moments next to depth
+			PipelineDesc.NumRenderTargets = 1;
+			PipelineDesc.RTVFormats[0] = DXGI_FORMAT_R32G32B32A32_FLOAT;
+			PipelineDesc.BlendState.RenderTarget[0].BlendEnable = FALSE;
+			PipelineDesc.BlendState.RenderTarget[0].RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_ALL;
+
+			const wchar_t* MomentDefines[2] = { L"SHADOW_MOMENTS=1", L"SHADOW_MOMENTS=2" }; // VSM, EVSM
+			for (u32 i = 0; i < CountOf(MomentDefines); i++)
+			{
+				PipelineDesc.PS = CompileFragmentShader(ShaderPath, &MomentDefines[i], 1, L"PSMoments");
+				DxAssert(Device->CreateGraphicsPipelineState(&PipelineDesc, IID_PPV_ARGS(&Test->ShadowPass.MomentPipelines[i])));
+			}
+		}
+
+		// Static cache copy, full screen triangle that writes depth
+		{
+			D3D12_DESCRIPTOR_RANGE Range = {};
+			Range.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
+			Range.NumDescriptors = 1;
+			Range.BaseShaderRegister = 0; // t0
+			Range.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
+
+			D3D12_ROOT_PARAMETER Parameters[2] = {};
+			Parameters[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+			Parameters[0].Constants.Num32BitValues = 5; // Offset, depth scale and offset, slice
+			Parameters[0].Constants.ShaderRegister = 0;  // b0
+			Parameters[0].Constants.RegisterSpace = 0;
+			Parameters[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+
+			Parameters[1].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+			Parameters[1].DescriptorTable.NumDescriptorRanges = 1;
+			Parameters[1].DescriptorTable.pDescriptorRanges = &Range;
+			Parameters[1].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+
+			D3D12_ROOT_SIGNATURE_DESC Desc = {};
+			Desc.NumParameters = CountOf(Parameters);
+			Desc.pParameters = Parameters;
+
+			ID3DBlob* Error;
+			ID3DBlob* Signature;
+			DxAssert(D3D12SerializeRootSignature(&Desc, D3D_ROOT_SIGNATURE_VERSION_1, &Signature, &Error));
+			DxAssert(Device->CreateRootSignature(0, Signature->GetBufferPointer(), Signature->GetBufferSize(), IID_PPV_ARGS(&Test->ShadowPass.CopyRootSignature)));
+
+			const wchar_t* ShaderPath = L"ShadowCache.hlsl";
+
+			D3D12_GRAPHICS_PIPELINE_STATE_DESC PipelineDesc = {};
+			PipelineDesc.RasterizerState.FillMode = D3D12_FILL_MODE_SOLID;
+			PipelineDesc.RasterizerState.CullMode = D3D12_CULL_MODE_NONE;
+			PipelineDesc.RasterizerState.DepthClipEnable = true;
+
+			// Replaces whatever the cascade held, no clear needed
+			PipelineDesc.DepthStencilState.DepthEnable = true;
+			PipelineDesc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ALL;
+			PipelineDesc.DepthStencilState.DepthFunc = D3D12_COMPARISON_FUNC_ALWAYS;
+			PipelineDesc.DepthStencilState.StencilEnable = FALSE;
+			PipelineDesc.DSVFormat = c_CascadeDSVFormat;
+
+			PipelineDesc.InputLayout = { nullptr, 0 };
+			PipelineDesc.pRootSignature = Test->ShadowPass.CopyRootSignature;
+			PipelineDesc.VS = CompileVertexShader(ShaderPath);
+			PipelineDesc.PS = CompileFragmentShader(ShaderPath);
+			PipelineDesc.SampleMask = UINT_MAX;
+			PipelineDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+			PipelineDesc.NumRenderTargets = 0;
+			PipelineDesc.SampleDesc.Count = 1;
+
+			DxAssert(Device->CreateGraphicsPipelineState(&PipelineDesc, IID_PPV_ARGS(&Test->ShadowPass.CopyPipeline)));
+		}
+
+		// Moment filtering, compute
+		{
+			D3D12_DESCRIPTOR_RANGE Ranges[2] = {};
+			Ranges[0].RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
+			Ranges[0].NumDescriptors = 1;
+			Ranges[0].BaseShaderRegister = 0; // t0
+			Ranges[0].OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
+
+			Ranges[1].RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_UAV;
+			Ranges[1].NumDescriptors = 1;
+			Ranges[1].BaseShaderRegister = 0; // u0
+			Ranges[1].OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
+
+			D3D12_ROOT_PARAMETER Parameters[3] = {};
+			Parameters[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+			Parameters[0].Constants.Num32BitValues = 4; // Step, size, slice count
+			Parameters[0].Constants.ShaderRegister = 0;  // b0
+			Parameters[0].Constants.RegisterSpace = 0;
+			Parameters[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+
+			// Source and destination are separate tables, they point anywhere into the frame block
+			for (u32 i = 0; i < CountOf(Ranges); i++)
+			{
+				Parameters[i + 1].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+				Parameters[i + 1].DescriptorTable.NumDescriptorRanges = 1;
+				Parameters[i + 1].DescriptorTable.pDescriptorRanges = &Ranges[i];
+				Parameters[i + 1].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+			}
+
+			D3D12_ROOT_SIGNATURE_DESC Desc = {};
+			Desc.NumParameters = CountOf(Parameters);
+			Desc.pParameters = Parameters;
+
+			ID3DBlob* Error;
+			ID3DBlob* Signature;
+			DxAssert(D3D12SerializeRootSignature(&Desc, D3D_ROOT_SIGNATURE_VERSION_1, &Signature, &Error));
+			DxAssert(Device->CreateRootSignature(0, Signature->GetBufferPointer(), Signature->GetBufferSize(), IID_PPV_ARGS(&Test->ShadowPass.FilterRootSignature)));
+
+			const wchar_t* ShaderPath = L"ShadowBlur.hlsl";
+
+			D3D12_COMPUTE_PIPELINE_STATE_DESC PipelineDesc = {};
+			PipelineDesc.pRootSignature = Test->ShadowPass.FilterRootSignature;
+
+			// Blur permutation per odd tap count
+			for (u32 i = 0; i < CountOf(Test->ShadowPass.BlurPipelines); i++)
+			{
+				wchar_t Define[64];
+				swprintf_s(Define, L"SHADOW_BLUR_TAPS=%u", 3 + i * 2);
+
+				const wchar_t* Defines[] = { Define };
+				PipelineDesc.CS = CompileComputeShader(ShaderPath, L"BlurCS", Defines, CountOf(Defines));
+				DxAssert(Device->CreateComputePipelineState(&PipelineDesc, IID_PPV_ARGS(&Test->ShadowPass.BlurPipelines[i])));
+			}
+
+			PipelineDesc.CS = CompileComputeShader(ShaderPath, L"DownsampleCS");
+			DxAssert(Device->CreateComputePipelineState(&PipelineDesc, IID_PPV_ARGS(&Test->ShadowPass.DownsamplePipeline)));
 		}
 
 		// Create resources
@@ -254,15 +524,23 @@ internal void D3D12Shadows_Initialize(d3d12_shadows_test* Test, d3d12_context* C
 		// Our very own descriptor heaps
 		{
 			// Create the descriptor heap for the depth-stencil view.
+			// Cascades of every frame, then the point shadow faces, then the virtual shadow pool, then the static cache slices
 			D3D12_DESCRIPTOR_HEAP_DESC HeapDesc = {};
-			HeapDesc.NumDescriptors = FIF;
+			HeapDesc.NumDescriptors = FIF * c_MaxShadowCascades + 1 + 1 + c_MaxShadowCascades;
 			HeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_DSV;
 			HeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
 			DxAssert(Context->Device->CreateDescriptorHeap(&HeapDesc, IID_PPV_ARGS(&Test->ShadowPass.DSVDescriptorHeap)));
 
-			// SRV
+			// Moment render targets
+			HeapDesc = {};
+			HeapDesc.NumDescriptors = FIF * c_MaxShadowCascades;
+			HeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
+			HeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+			DxAssert(Context->Device->CreateDescriptorHeap(&HeapDesc, IID_PPV_ARGS(&Test->ShadowPass.RTVDescriptorHeap)));
+
+			// SRV and UAV
 			HeapDesc = {};
-			HeapDesc.NumDescriptors = FIF;
+			HeapDesc.NumDescriptors = FIF * c_ShadowDescriptorsPerFrame;
 			HeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
 			HeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
 			DxAssert(Context->Device->CreateDescriptorHeap(&HeapDesc, IID_PPV_ARGS(&Test->ShadowPass.SRVDescriptorHeap)));
@@ -277,16 +555,16 @@ internal void D3D12Shadows_Initialize(d3d12_shadows_test* Test, d3d12_context* C
 			for (u32 i = 0; i < FIF; i++)
 			{
 				D3D12_CLEAR_VALUE OptimizedClearValue = {};
-				OptimizedClearValue.Format = DXGI_FORMAT_D32_FLOAT;
+				OptimizedClearValue.Format = c_CascadeDSVFormat;
 				OptimizedClearValue.DepthStencil = { 1.0f, 0 };
 
 				D3D12_RESOURCE_DESC DepthStencilDesc = {};
 				DepthStencilDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
 				DepthStencilDesc.Width = SHADOW_MAP_SIZE;
 				DepthStencilDesc.Height = SHADOW_MAP_SIZE;
-				DepthStencilDesc.DepthOrArraySize = 1;
+				DepthStencilDesc.DepthOrArraySize = c_MaxShadowCascades;
 				DepthStencilDesc.MipLevels = 1;
-				DepthStencilDesc.Format = DXGI_FORMAT_D32_FLOAT;
+				DepthStencilDesc.Format = c_CascadeDSVFormat;
 				DepthStencilDesc.SampleDesc.Count = 1;  // No MSAA
 				DepthStencilDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL;
 
@@ -312,117 +590,672 @@ internal void D3D12Shadows_Initialize(d3d12_shadows_test* Test, d3d12_context* C
 
 				Test->ShadowPass.ShadowMaps[i]->SetName(DebugNames[i]);
 
-				// Update the depth-stencil view.
+				// Depth-stencil view per cascade
+				for (u32 Cascade = 0; Cascade < c_MaxShadowCascades; Cascade++)
+				{
+					D3D12_DEPTH_STENCIL_VIEW_DESC DSV = {};
+					DSV.Format = c_CascadeDSVFormat;
+					DSV.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2DARRAY;
+					DSV.Texture2DArray.MipSlice = 0;
+					DSV.Texture2DArray.FirstArraySlice = Cascade;
+					DSV.Texture2DArray.ArraySize = 1;
+					DSV.Flags = D3D12_DSV_FLAG_NONE;
+
+					Context->Device->CreateDepthStencilView(Test->ShadowPass.ShadowMaps[i], &DSV, DsvHandle);
+					Test->ShadowPass.DSVHandles[i][Cascade] = DsvHandle;
+					DsvHandle.ptr += DSVDescriptorSize;
+				}
+			}
+
+			// Shadow atlas, point shadow faces are tiles of it
+			{
+				D3D12_CLEAR_VALUE OptimizedClearValue = {};
+				OptimizedClearValue.Format = DXGI_FORMAT_D32_FLOAT;
+				OptimizedClearValue.DepthStencil = { 1.0f, 0 };
+
+				D3D12_RESOURCE_DESC AtlasDesc = {};
+				AtlasDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+				AtlasDesc.Width = c_ShadowAtlasSize;
+				AtlasDesc.Height = c_ShadowAtlasSize;
+				AtlasDesc.DepthOrArraySize = 1;
+				AtlasDesc.MipLevels = 1;
+				AtlasDesc.Format = DXGI_FORMAT_D32_FLOAT;
+				AtlasDesc.SampleDesc.Count = 1;
+				AtlasDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL;
+
+				D3D12_HEAP_PROPERTIES HeapProperties = {};
+				HeapProperties.Type = D3D12_HEAP_TYPE_DEFAULT;
+				HeapProperties.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
+				HeapProperties.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
+				HeapProperties.CreationNodeMask = 1;
+				HeapProperties.VisibleNodeMask = 1;
+				DxAssert(Context->Device->CreateCommittedResource(
+					&HeapProperties,
+					D3D12_HEAP_FLAG_NONE,
+					&AtlasDesc,
+					D3D12_RESOURCE_STATE_GENERIC_READ,
+					&OptimizedClearValue,
+					IID_PPV_ARGS(&Test->PointShadows.AtlasTexture)
+				));
+				Test->PointShadows.AtlasTexture->SetName(L"ShadowAtlas");
+
+				D3D12_DEPTH_STENCIL_VIEW_DESC DSV = {};
+				DSV.Format = DXGI_FORMAT_D32_FLOAT;
+				DSV.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2D;
+				DSV.Texture2D.MipSlice = 0;
+				DSV.Flags = D3D12_DSV_FLAG_NONE;
+
+				Context->Device->CreateDepthStencilView(Test->PointShadows.AtlasTexture, &DSV, DsvHandle);
+				Test->PointShadows.AtlasDSV = DsvHandle;
+				DsvHandle.ptr += DSVDescriptorSize;
+			}
+
+			// Virtual shadow pool, a page per c_VirtualShadowPageSize square
+			{
+				D3D12_CLEAR_VALUE OptimizedClearValue = {};
+				OptimizedClearValue.Format = DXGI_FORMAT_D32_FLOAT;
+				OptimizedClearValue.DepthStencil = { 1.0f, 0 };
+
+				D3D12_RESOURCE_DESC PoolDesc = {};
+				PoolDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+				PoolDesc.Width = c_VirtualShadowPoolSize;
+				PoolDesc.Height = c_VirtualShadowPoolSize;
+				PoolDesc.DepthOrArraySize = 1;
+				PoolDesc.MipLevels = 1;
+				PoolDesc.Format = DXGI_FORMAT_D32_FLOAT;
+				PoolDesc.SampleDesc.Count = 1;
+				PoolDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL;
+
+				D3D12_HEAP_PROPERTIES HeapProperties = {};
+				HeapProperties.Type = D3D12_HEAP_TYPE_DEFAULT;
+				HeapProperties.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
+				HeapProperties.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
+				HeapProperties.CreationNodeMask = 1;
+				HeapProperties.VisibleNodeMask = 1;
+				DxAssert(Context->Device->CreateCommittedResource(
+					&HeapProperties,
+					D3D12_HEAP_FLAG_NONE,
+					&PoolDesc,
+					D3D12_RESOURCE_STATE_GENERIC_READ,
+					&OptimizedClearValue,
+					IID_PPV_ARGS(&Test->VirtualShadows.Pool)
+				));
+				Test->VirtualShadows.Pool->SetName(L"VirtualShadowPool");
+
 				D3D12_DEPTH_STENCIL_VIEW_DESC DSV = {};
 				DSV.Format = DXGI_FORMAT_D32_FLOAT;
 				DSV.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2D;
 				DSV.Texture2D.MipSlice = 0;
 				DSV.Flags = D3D12_DSV_FLAG_NONE;
 
-				Context->Device->CreateDepthStencilView(Test->ShadowPass.ShadowMaps[i], &DSV, DsvHandle);
-				Test->ShadowPass.DSVHandles[i] = DsvHandle;
+				Context->Device->CreateDepthStencilView(Test->VirtualShadows.Pool, &DSV, DsvHandle);
+				Test->VirtualShadows.PoolDSV = DsvHandle;
 				DsvHandle.ptr += DSVDescriptorSize;
 			}
 
-			// Shadow map
+			// Static cache, a slice per cascade with a border around it
+			{
+				const u32 CacheSize = SHADOW_MAP_SIZE + 2 * c_ShadowCacheBorder;
+
+				D3D12_CLEAR_VALUE OptimizedClearValue = {};
+				OptimizedClearValue.Format = c_CascadeDSVFormat;
+				OptimizedClearValue.DepthStencil = { 1.0f, 0 };
+
+				D3D12_RESOURCE_DESC CacheDesc = {};
+				CacheDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+				CacheDesc.Width = CacheSize;
+				CacheDesc.Height = CacheSize;
+				CacheDesc.DepthOrArraySize = c_MaxShadowCascades;
+				CacheDesc.MipLevels = 1;
+				CacheDesc.Format = c_CascadeDSVFormat;
+				CacheDesc.SampleDesc.Count = 1;
+				CacheDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL;
+
+				D3D12_HEAP_PROPERTIES HeapProperties = {};
+				HeapProperties.Type = D3D12_HEAP_TYPE_DEFAULT;
+				HeapProperties.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
+				HeapProperties.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
+				HeapProperties.CreationNodeMask = 1;
+				HeapProperties.VisibleNodeMask = 1;
+				DxAssert(Context->Device->CreateCommittedResource(
+					&HeapProperties,
+					D3D12_HEAP_FLAG_NONE,
+					&CacheDesc,
+					D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+					&OptimizedClearValue,
+					IID_PPV_ARGS(&Test->ShadowPass.StaticCache)
+				));
+				Test->ShadowPass.StaticCache->SetName(L"ShadowStaticCache");
+
+				for (u32 Slice = 0; Slice < c_MaxShadowCascades; Slice++)
+				{
+					D3D12_DEPTH_STENCIL_VIEW_DESC DSV = {};
+					DSV.Format = c_CascadeDSVFormat;
+					DSV.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2DARRAY;
+					DSV.Texture2DArray.MipSlice = 0;
+					DSV.Texture2DArray.FirstArraySlice = Slice;
+					DSV.Texture2DArray.ArraySize = 1;
+					DSV.Flags = D3D12_DSV_FLAG_NONE;
+
+					Context->Device->CreateDepthStencilView(Test->ShadowPass.StaticCache, &DSV, DsvHandle);
+					Test->ShadowPass.StaticCacheDSVs[Slice] = DsvHandle;
+					DsvHandle.ptr += DSVDescriptorSize;
+				}
+			}
+
+			// Moment maps, same layout as the depth array plus mips
+			const u32 MipCount = ShadowMoments_GetMipCount(SHADOW_MAP_SIZE);
+			Test->ShadowPass.MomentMipCount = MipCount;
+
+			D3D12_HEAP_PROPERTIES HeapProperties = {};
+			HeapProperties.Type = D3D12_HEAP_TYPE_DEFAULT;
+			HeapProperties.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
+			HeapProperties.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
+			HeapProperties.CreationNodeMask = 1;
+			HeapProperties.VisibleNodeMask = 1;
+
+			D3D12_RESOURCE_DESC MomentDesc = {};
+			MomentDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+			MomentDesc.Width = SHADOW_MAP_SIZE;
+			MomentDesc.Height = SHADOW_MAP_SIZE;
+			MomentDesc.DepthOrArraySize = c_MaxShadowCascades;
+			MomentDesc.MipLevels = (u16)MipCount;
+			MomentDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+			MomentDesc.SampleDesc.Count = 1;
+			MomentDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET | D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+
+			auto RTVHandle = Test->ShadowPass.RTVDescriptorHeap->GetCPUDescriptorHandleForHeapStart();
+			u32 RTVDescriptorSize = Context->Device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
+			for (u32 i = 0; i < FIF; i++)
+			{
+				DxAssert(Context->Device->CreateCommittedResource(
+					&HeapProperties,
+					D3D12_HEAP_FLAG_NONE,
+					&MomentDesc,
+					D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+					nullptr,
+					IID_PPV_ARGS(&Test->ShadowPass.MomentMaps[i])
+				));
+
+				const wchar_t* DebugNames[]{
+					L"ShadowMoments0",
+					L"ShadowMoments1"
+				};
+
+				Test->ShadowPass.MomentMaps[i]->SetName(DebugNames[i]);
+
+				// Render target view per cascade, top mip only
+				for (u32 Cascade = 0; Cascade < c_MaxShadowCascades; Cascade++)
+				{
+					D3D12_RENDER_TARGET_VIEW_DESC RTV = {};
+					RTV.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+					RTV.ViewDimension = D3D12_RTV_DIMENSION_TEXTURE2DARRAY;
+					RTV.Texture2DArray.MipSlice = 0;
+					RTV.Texture2DArray.FirstArraySlice = Cascade;
+					RTV.Texture2DArray.ArraySize = 1;
+
+					Context->Device->CreateRenderTargetView(Test->ShadowPass.MomentMaps[i], &RTV, RTVHandle);
+					Test->ShadowPass.MomentRTVHandles[i][Cascade] = RTVHandle;
+					RTVHandle.ptr += RTVDescriptorSize;
+				}
+			}
+
+			// Frames never filter at the same time on one queue, a single scratch is enough
+			MomentDesc.MipLevels = 1;
+			MomentDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+			DxAssert(Context->Device->CreateCommittedResource(
+				&HeapProperties,
+				D3D12_HEAP_FLAG_NONE,
+				&MomentDesc,
+				D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+				nullptr,
+				IID_PPV_ARGS(&Test->ShadowPass.MomentBlurScratch)
+			));
+			Test->ShadowPass.MomentBlurScratch->SetName(L"ShadowMomentBlurScratch");
+
+			// Shader visible block per frame, see c_ShadowDescriptorsPerFrame
+			auto SRVHeapStart = Test->ShadowPass.SRVDescriptorHeap->GetCPUDescriptorHandleForHeapStart();
+			auto DescriptorSize = Context->Device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+			auto DescriptorAt = [SRVHeapStart, DescriptorSize](u32 Frame, u32 Index)
+			{
+				D3D12_CPU_DESCRIPTOR_HANDLE Handle = SRVHeapStart;
+				Handle.ptr += (Frame * c_ShadowDescriptorsPerFrame + Index) * DescriptorSize;
+				return Handle;
+			};
+
 			for (u32 i = 0; i < FIF; i++)
 			{
-				auto SRVDescriptor = Test->ShadowPass.SRVDescriptorHeap->GetCPUDescriptorHandleForHeapStart();
-				auto DescriptorSize = Context->Device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+				D3D12_SHADER_RESOURCE_VIEW_DESC Desc = {};
+				Desc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+				Desc.Format = c_CascadeSRVFormat;
+				Desc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
+				Desc.Texture2DArray.MipLevels = 1;
+				Desc.Texture2DArray.MostDetailedMip = 0;
+				Desc.Texture2DArray.FirstArraySlice = 0;
+				Desc.Texture2DArray.ArraySize = c_MaxShadowCascades;
+				Desc.Texture2DArray.PlaneSlice = 0;
+				Desc.Texture2DArray.ResourceMinLODClamp = 0.0f;
+
+				Context->Device->CreateShaderResourceView(Test->ShadowPass.ShadowMaps[i], &Desc, DescriptorAt(i, c_ShadowDepthSRV));
+
+				// Shadow atlas, the same texture in every frame block
+				D3D12_SHADER_RESOURCE_VIEW_DESC AtlasSRV = {};
+				AtlasSRV.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+				AtlasSRV.Format = DXGI_FORMAT_R32_FLOAT;
+				AtlasSRV.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+				AtlasSRV.Texture2D.MostDetailedMip = 0;
+				AtlasSRV.Texture2D.MipLevels = 1;
+				AtlasSRV.Texture2D.ResourceMinLODClamp = 0.0f;
+				Context->Device->CreateShaderResourceView(Test->PointShadows.AtlasTexture, &AtlasSRV, DescriptorAt(i, c_ShadowAtlasSRV));
+
+				// Virtual shadow pool, shared like the atlas
+				Context->Device->CreateShaderResourceView(Test->VirtualShadows.Pool, &AtlasSRV, DescriptorAt(i, c_ShadowVirtualPoolSRV));
+
+				// Static cache, also shared
+				Context->Device->CreateShaderResourceView(Test->ShadowPass.StaticCache, &Desc, DescriptorAt(i, c_ShadowCacheSRV));
+
+				// Moments, every mip for the main pass
+				Desc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+				Desc.Texture2DArray.MipLevels = MipCount;
+				Context->Device->CreateShaderResourceView(Test->ShadowPass.MomentMaps[i], &Desc, DescriptorAt(i, c_ShadowMomentsSRV));
+
+				// Scratch
+				Desc.Texture2DArray.MipLevels = 1;
+				Context->Device->CreateShaderResourceView(Test->ShadowPass.MomentBlurScratch, &Desc, DescriptorAt(i, c_ShadowScratchSRV));
+
+				D3D12_UNORDERED_ACCESS_VIEW_DESC UAV = {};
+				UAV.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+				UAV.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2DARRAY;
+				UAV.Texture2DArray.MipSlice = 0;
+				UAV.Texture2DArray.FirstArraySlice = 0;
+				UAV.Texture2DArray.ArraySize = c_MaxShadowCascades;
+				UAV.Texture2DArray.PlaneSlice = 0;
+				Context->Device->CreateUnorderedAccessView(Test->ShadowPass.MomentBlurScratch, nullptr, &UAV, DescriptorAt(i, c_ShadowScratchUAV));
+
+				// Single mip views, the blur and the downsample chain read one and write the next
+				for (u32 Mip = 0; Mip < MipCount; Mip++)
 				{
-					D3D12_SHADER_RESOURCE_VIEW_DESC Desc = {};
-					Desc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-					Desc.Format = DXGI_FORMAT_R32_FLOAT;
-					Desc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-					Desc.Texture2D.MipLevels = 1;
-					Desc.Texture2D.MostDetailedMip = 0;
-					Desc.Texture2D.PlaneSlice = 0;
-					Desc.Texture2D.ResourceMinLODClamp = 0.0f;
-
-					Context->Device->CreateShaderResourceView(Test->ShadowPass.ShadowMaps[i], &Desc, SRVDescriptor);
-					Test->ShadowPass.SRVHandles[i] = SRVDescriptor;
-					SRVDescriptor.ptr += DescriptorSize;
+					Desc.Texture2DArray.MostDetailedMip = Mip;
+					Context->Device->CreateShaderResourceView(Test->ShadowPass.MomentMaps[i], &Desc, DescriptorAt(i, c_ShadowMomentMipSRVs + Mip));
+
+					UAV.Texture2DArray.MipSlice = Mip;
+					Context->Device->CreateUnorderedAccessView(Test->ShadowPass.MomentMaps[i], nullptr, &UAV, DescriptorAt(i, c_ShadowMomentMipUAVs + Mip));
 				}
 			}
 		}
+
+		// Cascades
+		{
+			for (u32 i = 0; i < FIF; i++)
+			{
+				Test->ShadowPass.CascadeConstantBuffers[i] = DX12ConstantBufferCreate(Device, sizeof(shadow_cascade_constants));
+			}
+
+			Test->ShadowPass.CascadeSettings = Cascades_GetDefaultSettings(SHADOW_MAP_SIZE);
+			Test->ShadowPass.CascadeSettings.DepthFormat = c_CascadeDepthFormat;
+			Test->ShadowPass.Casters = VmAllocArray(shadow_caster, c_MaxShadowDraws);
+			Test->ShadowPass.Rasterizer = VmAllocArray(shadow_rasterizer, 1);
+			ShadowRaster_Initialize(Test->ShadowPass.Rasterizer, SHADOW_MAP_SIZE, c_MaxQuads * 2);
+			Test->ShadowPass.Moments = VmAllocArray(shadow_moment_map, 1);
+			ShadowMoments_Initialize(Test->ShadowPass.Moments, SHADOW_MAP_SIZE, c_MaxShadowCascades);
+			ShadowCache_Initialize(&Test->ShadowPass.Cache, SHADOW_MAP_SIZE, c_ShadowCacheBorder);
+			Test->ShadowPass.CacheEnabled = true;
+
+			// Only casters inside a light are tracked, a few chunks and entities each
+			PointShadows_Initialize(&Test->PointShadows.Tracker, 16 * 1024);
+			ShadowAtlas_Initialize(&Test->PointShadows.Atlas, c_ShadowAtlasSize, c_ShadowAtlasMinTile);
+
+			// Vertical extent of the block world, entities stay inside of it
+			f32 WorldMinY = (f32)c_WorldBlockMin.y;
+			f32 WorldMaxY = (f32)(c_WorldBlockMin.y + c_WorldChunksY * c_ChunkSize);
+			VirtualShadows_Initialize(&Test->VirtualShadows.Map, VirtualShadows_GetDefaultSettings(WorldMinY, WorldMaxY));
+			for (u32 i = 0; i < FIF; i++)
+			{
+				Test->VirtualShadows.ConstantBuffers[i] = DX12ConstantBufferCreate(Device, sizeof(virtual_shadow_constants));
+				Test->VirtualShadows.PageTables[i] = DX12ConstantBufferCreate(Device, sizeof(virtual_shadow_gpu_page) * c_VirtualShadowTableSize);
+			}
+
+			for (u32 i = 0; i < c_MaxShadowCascades; i++)
+			{
+				Test->ShadowPass.Draws[i] = VmAllocArray(shadow_draw, c_MaxShadowDraws);
+				Test->ShadowPass.StaticDraws[i] = VmAllocArray(shadow_draw, c_MaxShadowDraws);
+			}
+		}
+
+		// Shadow quality governor
+		{
+			D3D12_QUERY_HEAP_DESC QueryHeapDesc = {};
+			QueryHeapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+			QueryHeapDesc.Count = c_ShadowTimestamps * FIF;
+			DxAssert(Device->CreateQueryHeap(&QueryHeapDesc, IID_PPV_ARGS(&Test->ShadowQuality.QueryHeap)));
+			Test->ShadowQuality.Readback = DX12BufferCreate(Device, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_HEAP_TYPE_READBACK, sizeof(u64) * c_ShadowTimestamps * FIF);
+
+			u64 Frequency;
+			DxAssert(Context->DirectCommandQueue->GetTimestampFrequency(&Frequency));
+			Test->ShadowQuality.TicksPerMillisecond = Frequency / 1000.0;
+
+			ShadowGovernor_Initialize(&Test->ShadowQuality.Governor, ShadowGovernor_GetDefaultSettings(c_DefaultShadowBudget));
+		}
 	}
 }
 
-internal void D3D12PushCube(d3d12_shadows_test* Shadows, const m4 Transform)
+internal void D3D12PushCube(d3d12_shadows_test* Shadows, const m4& Transform, const v4& Color)
 {
 	Assert(Shadows->Quad.IndexCount < c_MaxQuadIndices, "Shadows->QuadIndexCount < c_MaxQuadIndices");
 
+	m3 NormalMatrix = m3(glm::transpose(glm::inverse(Transform)));
+
 	for (u32 i = 0; i < CountOf(c_CuboidVerticesPositions); i++)
 	{
 		Shadows->Quad.VertexDataPtr->Position = Transform * c_CuboidVerticesPositions[i];
-		Shadows->Quad.VertexDataPtr->Color = c_CuboidVerticesColor[i];
-		Shadows->Quad.VertexDataPtr->Normal = m3(glm::transpose(glm::inverse(Transform))) * c_CuboidNormals[i];
+		Shadows->Quad.VertexDataPtr->Color = c_CuboidVerticesColor[i] * Color;
+		Shadows->Quad.VertexDataPtr->Normal = NormalMatrix * c_CuboidNormals[i];
 		Shadows->Quad.VertexDataPtr++;
 	}
 
 	Shadows->Quad.IndexCount += 36;
 }
 
-internal void D3D12PushCube(d3d12_shadows_test* Shadows, const v3& Translation, const v3& Rotation, const v3& Scale)
+// Records indices pushed since IndexOffset as a shadow caster, cascades pick it up in D3D12CullShadowCasters
+// Key and Revision identify the caster across frames for the point shadow tracker and the static cache, see PointShadows.h
+// Static casters never move on their own, a new revision is still picked up
+internal void D3D12PushShadowCaster(d3d12_shadows_test* Test, u32 IndexOffset, const aabb& Bounds, u64 Key, u64 Revision, bool Static)
 {
-	Assert(Shadows->Quad.IndexCount < c_MaxQuadIndices, "Shadows->QuadIndexCount < c_MaxQuadIndices");
+	auto& ShadowPass = Test->ShadowPass;
 
-	m4 Transform = glm::translate(m4(1.0f), Translation)
-		* glm::toMat4(qtn(Rotation))
-		* glm::scale(m4(1.0f), Scale);
-
-	D3D12PushCube(Shadows, Transform);
-}
+	u32 IndexCount = Test->Quad.IndexCount - IndexOffset;
+	if (IndexCount == 0)
+		return;
 
-internal void D3D12PushDirectionalLight(d3d12_shadows_test* Shadows, const v3& Direction, f32 Intensity, const v3& Radiance)
-{
-	directional_light& DirLight = Shadows->LightEnvironment.EmplaceDirectionalLight();
-	DirLight.Direction = Direction;
-	DirLight.Intensity = Intensity;
-	DirLight.Radiance = Radiance;
-}
+	PointShadows_SubmitCaster(&Test->PointShadows.Tracker, Key, Revision, Bounds);
 
-internal void D3D12PushPointLight(d3d12_shadows_test* Shadows, const v3& Position, f32 Radius, f32 FallOff, const v3& Radiance, f32 Intensity)
-{
-	point_light& Light = Shadows->LightEnvironment.EmplacePointLight();
-	Light.Position = Position;
-	Light.Radius = Radius;
-	Light.FallOff = FallOff;
-	Light.Radiance = Radiance;
-	Light.Intensity = Intensity;
+	Assert(ShadowPass.CasterCount < c_MaxShadowDraws, "Too many shadow casters!");
+	ShadowPass.Casters[ShadowPass.CasterCount++] = { IndexOffset, IndexCount, Bounds, Key, Revision, Static };
+	ShadowPass.CasterIndexCount += IndexCount;
 }
 
-internal void D3D12CameraMovement(game_input* Input, v3* CameraPosition, v3* CameraRotation, v3* CameraForward, f32 TimeStep)
+// Builds the draw list of every cascade, has to run after everything is pushed so all receivers are known
+// While the static cache is active static casters go to the slices instead, every slice gets a list but only out of date ones are drawn
+// While virtual shadows are enabled it signs their pages instead and no cascade is drawn
+internal void D3D12CullShadowCasters(d3d12_shadows_test* Test)
 {
-	// Rotating
-	local_persist bool TPressed = false;
-
-	bool JustPressed = false;
-	bool JumpKeyPressed = false;
+	auto& ShadowPass = Test->ShadowPass;
+	shadow_cascades* Cascades = &ShadowPass.Cascades;
+	shadow_cache* Cache = &ShadowPass.Cache;
 
-	if (Input->IsKeyPressed(key::T))
+	// Virtual shadows replace the cascades, pages pick their casters when they are rendered
+	if (Test->VirtualShadows.Enabled)
 	{
-		TPressed = !TPressed;
+		virtual_shadow_map* Map = &Test->VirtualShadows.Map;
+		for (u32 i = 0; i < ShadowPass.CasterCount; i++)
+		{
+			const shadow_caster& Caster = ShadowPass.Casters[i];
+			VirtualShadows_AddCaster(Map, Caster.Key, Caster.Revision, Caster.Bounds);
+		}
 
-		JustPressed = true;
+		Test->VirtualShadows.Stats = VirtualShadows_EndFrame(Map);
+
+		// Slices are not rendered meanwhile
+		ShadowCache_Invalidate(Cache);
+		ShadowPass.CacheActive = false;
+		ShadowPass.StaticMask = 0;
+		return;
 	}
 
-	if (TPressed)
+	Cascades_BuildCasterBounds(Cascades, ShadowPass.CascadeSettings);
+
+	// The copy only carries depth, moments of static casters would be missing
+	ShadowPass.CacheActive = ShadowPass.CacheEnabled && !ShadowFilter_UsesMoments(c_ShadowFilterPresets[Test->Quad.ShadowFilter].Filter);
+	if (ShadowPass.CacheActive)
+		ShadowCache_BeginFrame(Cache, Cascades);
+	else
+		ShadowCache_Invalidate(Cache);
+
+	auto AddDraw = [](shadow_draw* Draws, u32& DrawCount, const shadow_caster& Caster)
 	{
-		local_persist v2i OldMousePos;
+		if (DrawCount > 0 && Draws[DrawCount - 1].IndexOffset + Draws[DrawCount - 1].IndexCount == Caster.IndexOffset)
+		{
+			Draws[DrawCount - 1].IndexCount += Caster.IndexCount;
+			return;
+		}
 
-		v2i MousePos = Input->GetRawMouseInput();
+		Draws[DrawCount++] = { Caster.IndexOffset, Caster.IndexCount };
+	};
 
-		// Avoids teleporting with camera rotation due to large delta
-		if (JustPressed)
-			OldMousePos = MousePos;
+	for (u32 i = 0; i < ShadowPass.CasterCount; i++)
+	{
+		const shadow_caster& Caster = ShadowPass.Casters[i];
 
-		v2i MouseDelta = MousePos - OldMousePos;
+		if (ShadowPass.CacheActive && Caster.Static)
+		{
+			u32 SliceMask = ShadowCache_AddStaticCaster(Cache, Caster.Key, Caster.Revision, Caster.Bounds);
+			for (u32 Slice = 0; Slice < Cascades->Count; Slice++)
+			{
+				if (!(SliceMask & (1u << Slice)))
+					continue;
 
-		//Trace("%i %i", MouseDelta.x, MouseDelta.y);
-		OldMousePos = MousePos;
+				ShadowPass.StaticDrawIndexCounts[Slice] += Caster.IndexCount;
+				AddDraw(ShadowPass.StaticDraws[Slice], ShadowPass.StaticDrawCounts[Slice], Caster);
+			}
 
-		f32 MouseSensitivity = 0.35f;
+			continue;
+		}
+
+		u32 CascadeMask = Cascades_GetCasterMask(Cascades, Caster.Bounds);
+		for (u32 Cascade = 0; Cascade < Cascades->Count; Cascade++)
+		{
+			if (!(CascadeMask & (1u << Cascade)))
+				continue;
+
+			ShadowPass.DrawIndexCounts[Cascade] += Caster.IndexCount;
+			AddDraw(ShadowPass.Draws[Cascade], ShadowPass.DrawCounts[Cascade], Caster);
+		}
+	}
+
+	ShadowPass.StaticMask = ShadowPass.CacheActive ? ShadowCache_EndFrame(Cache) : 0;
+}
+
+// Expansion stage, streams over world matrices and colors
+// Renders the cascades like the shadow pass does, but on the CPU
+// Static and dynamic casters alike, so it is also the reference for the static cache
+internal void D3D12RasterizeShadowsOnCPU(d3d12_shadows_test* Test)
+{
+	auto& ShadowPass = Test->ShadowPass;
+	shadow_rasterizer* Rasterizer = ShadowPass.Rasterizer;
+
+	for (u32 Cascade = 0; Cascade < ShadowPass.Cascades.Count; Cascade++)
+	{
+		ShadowRaster_Begin(Rasterizer, ShadowPass.Cascades.Cascades[Cascade].ViewProjection, Test->Quad.VertexDataBase, Test->Quad.Indices);
+
+		for (u32 i = 0; i < ShadowPass.CasterCount; i++)
+		{
+			const shadow_caster& Caster = ShadowPass.Casters[i];
+			if (Cascades_GetCasterMask(&ShadowPass.Cascades, Caster.Bounds) & (1u << Cascade))
+				ShadowRaster_AddDraw(Rasterizer, Caster.IndexOffset, Caster.IndexCount);
+		}
+
+		const shadow_raster_stats& Stats = ShadowRaster_Render(Rasterizer);
+		Trace("CPU shadow cascade %u: %u triangles, %u rasterized, %u dropped | setup %.2f ms, binning %.2f ms, raster %.2f ms, total %.2f ms",
+			Cascade, Stats.Triangles, Stats.RasterTriangles, Stats.DroppedTriangles, Stats.SetupMilliseconds, Stats.BinMilliseconds, Stats.RasterMilliseconds, Stats.TotalMilliseconds);
+
+		// Same filtering the compute passes do on the GPU
+		const shadow_filter_preset& Preset = c_ShadowFilterPresets[Test->Quad.ShadowFilter];
+		if (ShadowFilter_UsesMoments(Preset.Filter))
+		{
+			const shadow_moment_stats& MomentStats = ShadowMoments_BuildSlice(ShadowPass.Moments, Cascade, Rasterizer->Depth, Preset.Filter, Preset.Taps);
+			Trace("CPU shadow moments %u (%s): convert %.2f ms, blur %.2f ms, mips %.2f ms, total %.2f ms",
+				Cascade, Preset.Name, MomentStats.ConvertMilliseconds, MomentStats.BlurMilliseconds, MomentStats.MipMilliseconds, MomentStats.TotalMilliseconds);
+		}
+	}
+}
+
+// Debug geometry neither casts nor receives, it would only drag cascades towards itself
+internal void D3D12PushEntities(d3d12_shadows_test* Test, const entity_store* Entities)
+{
+	for (u32 i = 0; i < Entities->Count; i++)
+	{
+		u32 IndexOffset = Test->Quad.IndexCount;
+		D3D12PushCube(Test, Entities->WorldMatrices[i], Entities->Colors[i]);
+
+		if ((Entities->Flags[i] & entity_flags::Debug) != entity_flags::None)
+			continue;
+
+		Cascades_AddReceiver(&Test->ShadowPass.Cascades, Entities->WorldBounds[i]);
+		if (Test->VirtualShadows.Enabled)
+			VirtualShadows_AddReceiver(&Test->VirtualShadows.Map, Entities->WorldBounds[i]);
+
+		if ((Entities->Flags[i] & entity_flags::CastsShadow) != entity_flags::None)
+		{
+			// Handle as the key, the transform as the revision
+			u32 Slot = Entities->DenseToSlot[i];
+			u64 Key = ((u64)Entities->Generations[Slot] << 32) | Slot;
+			bool Static = (Entities->Flags[i] & entity_flags::Static) != entity_flags::None;
+			D3D12PushShadowCaster(Test, IndexOffset, Entities->WorldBounds[i], Key, PointShadows_HashTransform(Entities->WorldMatrices[i]), Static);
+		}
+	}
+}
+
+// Copies already expanded quads into the stream, returns false when they do not fit
+internal bool D3D12PushQuads(d3d12_shadows_test* Shadows, const quad_vertex* Vertices, u32 QuadCount)
+{
+	u32 VertexCount = static_cast<u32>(Shadows->Quad.VertexDataPtr - Shadows->Quad.VertexDataBase);
+	if (VertexCount + QuadCount * 4 > c_MaxQuadVertices)
+		return false;
+
+	memcpy(Shadows->Quad.VertexDataPtr, Vertices, sizeof(quad_vertex) * QuadCount * 4);
+	Shadows->Quad.VertexDataPtr += QuadCount * 4;
+	Shadows->Quad.IndexCount += QuadCount * 6;
+	return true;
+}
+
+// Pushes chunk meshes at their selected LODs
+// Chunks that use the same mesh in both passes go first so both passes can share them, then main-only and shadow-only ones.
+// Occluded chunks are skipped in the main pass only, they can still cast shadows onto visible ones.
+internal void D3D12PushChunks(d3d12_shadows_test* Test, block_world* World, const occlusion_result* Occlusion)
+{
+	chunk_lod_stats& Stats = World->Stats;
+	bool Overflow = false;
+
+	auto GetMainMesh = [World, Occlusion](u32 ActiveIndex) -> const chunk_mesh*
+	{
+		if (Occlusion[ActiveIndex] != occlusion_result::Visible)
+			return nullptr;
+
+		u32 ChunkIndex = World->ActiveChunks[ActiveIndex];
+		return BlockWorld_GetMesh(World, ChunkIndex, World->MainLOD[ChunkIndex]);
+	};
+
+	auto PushMesh = [Test, World, &Overflow](const chunk_mesh* Mesh, u32 ChunkIndex, bool CastsShadow)
+	{
+		if (!Mesh || Mesh->QuadCount == 0 || Overflow)
+			return;
+
+		u32 IndexOffset = Test->Quad.IndexCount;
+		Overflow = !D3D12PushQuads(Test, Mesh->Vertices, Mesh->QuadCount);
+
+		// Chunk keys have the top bit set so they never collide with entity handles, a new mesh or LOD is a new revision
+		if (CastsShadow)
+		{
+			u64 Key = (1ull << 63) | ChunkIndex;
+			u64 Revision = ((u64)Mesh->Version << 16) | ((u64)World->ShadowLOD[ChunkIndex].LOD << 8) | World->ShadowLOD[ChunkIndex].Variant;
+			D3D12PushShadowCaster(Test, IndexOffset, Chunk_GetBounds(World->Chunks[ChunkIndex]->Coord), Key, Revision, true);
+		}
+	};
+
+	for (u32 i = 0; i < World->ActiveChunkCount; i++)
+	{
+		u32 ChunkIndex = World->ActiveChunks[i];
+		const chunk_mesh* MainMesh = GetMainMesh(i);
+		const chunk_mesh* ShadowMesh = BlockWorld_GetMesh(World, ChunkIndex, World->ShadowLOD[ChunkIndex]);
+
+		if (MainMesh)
+		{
+			Cascades_AddReceiver(&Test->ShadowPass.Cascades, Chunk_GetBounds(World->Chunks[ChunkIndex]->Coord));
+			if (Test->VirtualShadows.Enabled)
+				VirtualShadows_AddReceiver(&Test->VirtualShadows.Map, Chunk_GetBounds(World->Chunks[ChunkIndex]->Coord));
+			Stats.MainChunksPerLOD[World->MainLOD[ChunkIndex].LOD]++;
+			Stats.MainQuads += MainMesh->QuadCount;
+		}
+
+		if (ShadowMesh)
+		{
+			Stats.ShadowChunksPerLOD[World->ShadowLOD[ChunkIndex].LOD]++;
+			Stats.ShadowQuads += ShadowMesh->QuadCount;
+		}
+
+		const chunk_mesh& FullResolution = World->Chunks[ChunkIndex]->Meshes[0][(u32)chunk_mesh_variant::Culled].Mesh;
+		Stats.FullResolutionQuads += FullResolution.QuadCount;
+
+		if (MainMesh == ShadowMesh)
+			PushMesh(MainMesh, ChunkIndex, true);
+	}
+
+	for (u32 i = 0; i < World->ActiveChunkCount; i++)
+	{
+		u32 ChunkIndex = World->ActiveChunks[i];
+		const chunk_mesh* MainMesh = GetMainMesh(i);
+		if (MainMesh != BlockWorld_GetMesh(World, ChunkIndex, World->ShadowLOD[ChunkIndex]))
+			PushMesh(MainMesh, ChunkIndex, false);
+	}
+
+	Test->Quad.MainIndexCount = Test->Quad.IndexCount;
+
+	for (u32 i = 0; i < World->ActiveChunkCount; i++)
+	{
+		u32 ChunkIndex = World->ActiveChunks[i];
+		const chunk_mesh* ShadowMesh = BlockWorld_GetMesh(World, ChunkIndex, World->ShadowLOD[ChunkIndex]);
+		if (ShadowMesh != GetMainMesh(i))
+			PushMesh(ShadowMesh, ChunkIndex, true);
+	}
+
+	// Generated terrain overflows easily, once is enough
+	local_persist bool OverflowReported = false;
+	if (Overflow && !OverflowReported)
+	{
+		Warn("Quad stream is full, some chunks were not rendered!");
+		OverflowReported = true;
+	}
+}
+
+internal void D3D12PushDirectionalLight(d3d12_shadows_test* Shadows, const v3& Direction, f32 Intensity, const v3& Radiance)
+{
+	directional_light& DirLight = Shadows->LightEnvironment.EmplaceDirectionalLight();
+	DirLight.Direction = Direction;
+	DirLight.Intensity = Intensity;
+	DirLight.Radiance = Radiance;
+}
+
+internal void D3D12CameraMovement(game_input* Input, v3* CameraPosition, v3* CameraRotation, v3* CameraForward, f32 TimeStep)
+{
+	// Rotating
+	local_persist bool TPressed = false;
+
+	bool JustPressed = false;
+	bool JumpKeyPressed = false;
+
+	if (Input->IsKeyPressed(key::T))
+	{
+		TPressed = !TPressed;
+
+		JustPressed = true;
+	}
+
+	if (TPressed)
+	{
+		local_persist v2i OldMousePos;
+
+		v2i MousePos = Input->GetRawMouseInput();
+
+		// Avoids teleporting with camera rotation due to large delta
+		if (JustPressed)
+			OldMousePos = MousePos;
+
+		v2i MouseDelta = MousePos - OldMousePos;
+
+		//Trace("%i %i", MouseDelta.x, MouseDelta.y);
+		OldMousePos = MousePos;
+
+		f32 MouseSensitivity = 0.35f;
 
 		// Update rotation based on mouse input
 		CameraRotation->y += (f32)MouseDelta.x * MouseSensitivity * TimeStep; // Yaw
@@ -493,133 +1326,408 @@ internal void D3D12Shadows_Update(d3d12_shadows_test* Test, game_input* Input, d
 	local_persist v3 CameraRotation(glm::pi<f32>() / 4, 0, 0);
 	local_persist v3 CameraForward;
 	local_persist v3 Eye = v3(-2.0f, 3.0f, 0.0f);
-	m4 LightSpaceMatrix(1.0f);
+	camera Camera;
+	const f32 ViewportWidth = 2160.0f, ViewportHeight = 1185.0f;
 
 	// Camera
 	{
 		D3D12CameraMovement(Input, &CameraPosition, &CameraRotation, &CameraForward, TimeStep);
 
+		//CameraPosition.x = 6 * bkm::Sin(TimeSinceStart);
+
+		m4 InverseView = glm::translate(m4(1.0f), CameraPosition) * glm::toMat4(qtn(CameraRotation));
+		Camera.View = glm::inverse(InverseView);
+		Camera.ReverseZ = true;
+		Camera.InfiniteFar = true;
+		Camera.RecalculateProjectionPerspective((u32)ViewportWidth, (u32)ViewportHeight);
+
+		Test->Quad.RootSignatureBuffer.ViewProjection = Camera.GetViewProjection();
+		Test->Quad.RootSignatureBuffer.View = Camera.View;
+	}
+
+	// Light shines from Eye towards the origin
+	v3 LightDirection = glm::normalize(-Eye);
+
+	// Shadows
+	{
+		cascade_settings& Settings = Test->ShadowPass.CascadeSettings;
+
+		if (Input->IsKeyPressed(key::Q))
+		{
+			Settings.CascadeCount = glm::min(Settings.CascadeCount + 1, c_MaxShadowCascades);
+			printf("Cascades: %u\n", Settings.CascadeCount);
+		}
 
-		// Shadows
+		if (Input->IsKeyPressed(key::E))
 		{
-			local_persist f32 Size = 15;
-			local_persist f32 Near = 1.0f;
-			local_persist f32 Far = 7.5;
-			m4 LightSpaceProjection = glm::orthoLH_ZO(-Size, Size, -Size, Size, Near, Far);
-			m4 LightSpaceView = glm::lookAtLH(Eye, v3(0, 0, 0), v3(0, 1, 0));
+			Settings.CascadeCount = glm::max(Settings.CascadeCount - 1, 1u);
+			printf("Cascades: %u\n", Settings.CascadeCount);
+		}
 
-			LightSpaceMatrix = LightSpaceProjection * LightSpaceView;
+		// Split scheme
+		if (Input->IsKeyPressed(key::F))
+		{
+			Settings.Lambda = glm::min(Settings.Lambda + 0.05f, 1.0f);
+			printf("Cascade lambda: %.3f\n", Settings.Lambda);
+		}
+		if (Input->IsKeyPressed(key::H))
+		{
+			Settings.Lambda = glm::max(Settings.Lambda - 0.05f, 0.0f);
+			printf("Cascade lambda: %.3f\n", Settings.Lambda);
+		}
 
-			if (Input->IsKeyPressed(key::Q))
-			{
-				Size++;
-				printf("Current Size: %.3f\n", Size);
-			}
+		// Shadow distance
+		if (Input->IsKeyPressed(key::N))
+		{
+			Settings.MaxDistance += 10.0f;
+			printf("Shadow distance: %.3f\n", Settings.MaxDistance);
+		}
+		if (Input->IsKeyPressed(key::M))
+		{
+			Settings.MaxDistance = glm::max(Settings.MaxDistance - 10.0f, 10.0f);
+			printf("Shadow distance: %.3f\n", Settings.MaxDistance);
+		}
 
-			if (Input->IsKeyPressed(key::E))
-			{
-				Size--;
-				printf("Current Size: %.3f\n", Size);
-			}
+		// Shadow filter preset, cheapest to most expensive
+		if (Input->IsKeyPressed(key::K))
+		{
+			Test->Quad.ShadowFilter = (Test->Quad.ShadowFilter + 1) % c_ShadowFilterPresetCount;
 
-			// Near
-			if (Input->IsKeyPressed(key::F))
-			{
-				Near += 0.5f;
-				printf("Current Near: %.3f\n", Near);
-			}
-			if (Input->IsKeyPressed(key::H))
-			{
-				Near -= 0.5f;
-				printf("Current Near: %.3f\n", Near);
-			}
+			const shadow_filter_preset& Preset = c_ShadowFilterPresets[Test->Quad.ShadowFilter];
+			printf("Shadow filter: %s (%u samples per pixel)\n", Preset.Name, ShadowFilter_GetSampleCount(Preset));
+		}
+
+		if (Input->IsKeyDown(key::Up))
+		{
+			Eye.y += TimeStep;
+		}
 
-			// Far
-			if (Input->IsKeyPressed(key::N))
+		if (Input->IsKeyDown(key::Down))
+		{
+			Eye.y -= TimeStep;
+		}
+
+		if (Input->IsKeyDown(key::Left))
+		{
+			Eye.x -= TimeStep;
+		}
+
+		if (Input->IsKeyDown(key::Right))
+		{
+			Eye.x += TimeStep;
+		}
+
+		if (Input->IsKeyPressed(key::R))
+		{
+			Settings.CullAgainstReceivers = !Settings.CullAgainstReceivers;
+			printf("Cull shadow casters against receivers: %s\n", Settings.CullAgainstReceivers ? "ON" : "OFF");
+		}
+
+		if (Input->IsKeyPressed(key::C))
+		{
+			Test->ShadowPass.CacheEnabled = !Test->ShadowPass.CacheEnabled;
+			printf("Static shadow cache: %s\n", Test->ShadowPass.CacheEnabled ? "ON" : "OFF");
+		}
+
+		if (Input->IsKeyPressed(key::V))
+		{
+			Test->VirtualShadows.Enabled = !Test->VirtualShadows.Enabled;
+			printf("Virtual shadow map: %s\n", Test->VirtualShadows.Enabled ? "ON" : "OFF");
+		}
+
+		// Shadow quality governor, overrides the knobs above while it is on
+		auto& ShadowQuality = Test->ShadowQuality;
+		if (Input->IsKeyPressed(key::I))
+		{
+			ShadowQuality.Enabled = !ShadowQuality.Enabled;
+			if (!ShadowQuality.Enabled)
+				Test->PointShadows.Tracker.MaxTileSize = c_ShadowAtlasMaxTile;
+
+			printf("Shadow governor: %s, %.1f ms budget\n", ShadowQuality.Enabled ? "ON" : "OFF", ShadowQuality.Governor.Settings.BudgetMilliseconds);
+		}
+
+		if (Input->IsKeyPressed(key::X))
+		{
+			if (ShadowQuality.Trace)
 			{
-				Far += 0.5f;
-				printf("Current Far: %.3f\n", Far);
+				fclose(ShadowQuality.Trace);
+				ShadowQuality.Trace = nullptr;
+				printf("Shadow timings: recorded to %s\n", c_ShadowGovernorTracePath);
 			}
-			if (Input->IsKeyPressed(key::M))
+			else
 			{
-				Far -= 0.5f;
-				printf("Current Far: %.3f\n", Far);
+#if defined(_WIN32)
+				fopen_s(&ShadowQuality.Trace, c_ShadowGovernorTracePath, "w");
+#else
+				ShadowQuality.Trace = fopen(c_ShadowGovernorTracePath, "w");
+#endif
+				printf("Shadow timings: recording\n");
 			}
+		}
 
-			if (Input->IsKeyDown(key::Up))
-			{
-				Eye.y += TimeStep;
-			}
+		if (ShadowQuality.Enabled)
+		{
+			const shadow_quality& Quality = ShadowGovernor_GetQuality(&ShadowQuality.Governor);
+			Settings.CascadeCount = Quality.CascadeCount;
+			Settings.MaxDistance = Quality.MaxDistance;
+			Test->Quad.ShadowFilter = Quality.ShadowFilter;
+			Test->PointShadows.Tracker.MaxTileSize = Quality.PointTileSize;
+		}
 
-			if (Input->IsKeyDown(key::Down))
-			{
-				Eye.y -= TimeStep;
-			}
+		// Texel size follows the governed resolution, the slices stay SHADOW_MAP_SIZE and the cascades take their top left corner
+		Settings.Resolution = ShadowQuality.Enabled ? ShadowGovernor_GetQuality(&ShadowQuality.Governor).CascadeResolution : SHADOW_MAP_SIZE;
+
+		// Fitted before anything is pushed, pushes collect receivers for caster culling
+		Cascades_Fit(&Test->ShadowPass.Cascades, Settings, Camera, LightDirection);
+		if (Test->VirtualShadows.Enabled)
+			VirtualShadows_BeginFrame(&Test->VirtualShadows.Map, Test->ShadowPass.Cascades.LightView, Camera, ViewportHeight);
+	}
+
+	// LIGHT
+	D3D12PushDirectionalLight(Test, LightDirection, 1.0f, v3(1.0f));
+
+	//PushPointLight(Shadows, v3(5.0f * bkm::Sin(0 * 5.0f), 1.0f, 0), 10.0, 1.0f, v3(1.0f), 2.0f);
 
-			if (Input->IsKeyDown(key::Left))
+	// Shadowed point lights, J drops one at the camera
+	{
+		auto& PointShadows = Test->PointShadows;
+		if (Input->IsKeyPressed(key::J))
+		{
+			light_handle& Handle = PointShadows.Lights[PointShadows.NextLight];
+			LightStore_Remove(&Test->LightStore, Handle);
+			Handle = LightStore_Create(&Test->LightStore, CameraPosition, 12.0f, 1.0f, v3(1.0f, 0.8f, 0.6f), 1.5f, light_flags::CastsShadow);
+
+			PointShadows.NextLight = (PointShadows.NextLight + 1) % c_MaxPointShadows;
+			PointShadows.LightCount = glm::min(PointShadows.LightCount + 1, c_MaxPointShadows);
+			printf("Point lights: %u\n", PointShadows.LightCount);
+		}
+	}
+
+	// B scatters animated lights around the camera, B again removes them
+	if (Input->IsKeyPressed(key::B))
+	{
+		if (Test->LightSwarmCount == 0)
+		{
+			u32 State = 0x9E3779B9;
+			auto Random = [&State](f32 Min, f32 Max)
 			{
-				Eye.x -= TimeStep;
-			}
+				State = State * 1664525u + 1013904223u;
+				return Min + (Max - Min) * (f32)(State >> 8) / (f32)(1u << 24);
+			};
 
-			if (Input->IsKeyDown(key::Right))
+			for (u32 i = 0; i < c_LightSwarmSize; i++)
 			{
-				Eye.x += TimeStep;
+				v3 Position = CameraPosition + v3(Random(-80.0f, 80.0f), Random(-4.0f, 4.0f), Random(-80.0f, 80.0f));
+				v3 Radiance = v3(Random(0.2f, 1.0f), Random(0.2f, 1.0f), Random(0.2f, 1.0f));
+				light_handle Handle = LightStore_Create(&Test->LightStore, Position, Random(2.0f, 6.0f), 1.0f, Radiance, Random(0.5f, 2.0f));
+
+				light_animation Animation;
+				Animation.Flicker = Random(0.0f, 0.5f);
+				Animation.FlickerRate = Random(2.0f, 10.0f);
+				Animation.OrbitRadius = Random(0.0f, 3.0f);
+				Animation.OrbitRate = Random(-2.0f, 2.0f);
+				Animation.Phase = Random(0.0f, 2.0f * glm::pi<f32>());
+				LightStore_SetAnimation(&Test->LightStore, Handle, Animation);
+
+				Test->LightSwarm[Test->LightSwarmCount++] = Handle;
 			}
 		}
+		else
+		{
+			for (u32 i = 0; i < Test->LightSwarmCount; i++)
+				LightStore_Remove(&Test->LightStore, Test->LightSwarm[i]);
 
-		//CameraPosition.x = 6 * bkm::Sin(TimeSinceStart);
-
-		camera Camera;
-		m4 InverseView = glm::translate(m4(1.0f), CameraPosition) * glm::toMat4(qtn(CameraRotation));
-		Camera.View = glm::inverse(InverseView);
-		Camera.RecalculateProjectionPerspective(2160, 1185);
+			Test->LightSwarmCount = 0;
+		}
 
-		Test->Quad.RootSignatureBuffer.ViewProjection = Camera.GetViewProjection();
-		Test->Quad.RootSignatureBuffer.View = Camera.View;
+		printf("Light store: %u lights\n", Test->LightStore.Count);
+	}
 
-		Test->Quad.RootSignatureBuffer.LightSpaceMatrix = LightSpaceMatrix;
+	Test->AnimatedLights = LightStore_Animate(&Test->LightStore, TimeSinceStart);
 
-		// Copy
-		Test->ShadowPass.RootSignatureBuffer.LightSpaceMatrix = Test->Quad.RootSignatureBuffer.LightSpaceMatrix;
+	// Casters are submitted while they are pushed
+	{
+		auto& PointShadows = Test->PointShadows;
+		PointShadows_BeginFrame(&PointShadows.Tracker, &Test->LightStore);
+		PointShadows.AtlasStats = PointShadows_AssignTiles(&PointShadows.Tracker, &PointShadows.Atlas, &Test->LightStore, &Test->LightEnvironment, Camera, ViewportHeight);
 	}
 
-	// LIGHT
-	D3D12PushDirectionalLight(Test, glm::normalize(v3(Eye.x, -Eye.y, Eye.z)), 1.0f, v3(1.0f));
+	// Lights past the budget of a cluster are the least important ones, 0 keeps them all
+	if (Input->IsKeyPressed(key::U))
+	{
+		const u32 Budgets[] = { 64, 32, 16, 0 };
+		u32 Next = 0;
+		while (Next < CountOf(Budgets) && Budgets[Next] != Test->LightClusters->LightBudget)
+			Next++;
 
-	//PushPointLight(Shadows, v3(5.0f * bkm::Sin(0 * 5.0f), 1.0f, 0), 10.0, 1.0f, v3(1.0f), 2.0f);
+		Test->LightClusters->LightBudget = Budgets[(Next + 1) % CountOf(Budgets)];
+		printf("Light budget per cluster: %u\n", Test->LightClusters->LightBudget);
+	}
 
-	struct block
-	{
-		v3 Position;
-	};
+	LightTree_Update(&Test->LightTree, &Test->LightStore, Camera.View);
+	LightClusters_Build(Test->LightClusters, Camera, ViewportWidth, ViewportHeight, &Test->LightStore, &Test->LightTree, &Test->LightEnvironment);
 
-	local_persist std::vector<block> Blocks;
+	block_world* World = Test->BlockWorld;
+	occlusion_culler* Occlusion = Test->Occlusion;
 
 	if (Input->IsMousePressed(mouse::Left))
 	{
 		f32 Range = 5;
-		auto& Block = Blocks.emplace_back();
-		Block.Position = CameraPosition + CameraForward * Range;
+		BlockWorld_SetBlock(World, BlockWorld_WorldToBlock(CameraPosition + CameraForward * Range), 6);
 	}
 
-	// Directional light debug
+	// BLOCKS
 	{
-		//D3D12PushCube(Test, LightSpaceMatrix);
-		D3D12PushCube(Test, Eye, v3(0, 0, 0), v3(0.5f, 0.5f, 0.5f));
-		D3D12PushCube(Test, CameraPosition, v3(0, 0, 0), v3(0.5f, 0.5f, 0.5f));
-	}
+		if (Input->IsKeyPressed(key::L))
+		{
+			World->LODSettings.Enabled = !World->LODSettings.Enabled;
+
+			const chunk_lod_stats& Stats = World->Stats;
+			Trace("Chunk LOD: %s", World->LODSettings.Enabled ? "ON" : "OFF");
+			Trace("  Main:   %u/%u/%u/%u chunks per LOD, %u triangles", Stats.MainChunksPerLOD[0], Stats.MainChunksPerLOD[1], Stats.MainChunksPerLOD[2], Stats.MainChunksPerLOD[3], Stats.MainQuads * 2);
+			Trace("  Shadow: %u/%u/%u/%u chunks per LOD, %u triangles", Stats.ShadowChunksPerLOD[0], Stats.ShadowChunksPerLOD[1], Stats.ShadowChunksPerLOD[2], Stats.ShadowChunksPerLOD[3], Stats.ShadowQuads * 2);
+			Trace("  Full resolution (cached): %u triangles", Stats.FullResolutionQuads * 2);
+		}
+
+		if (Input->IsKeyPressed(key::O))
+		{
+			Occlusion->Settings.Enabled = !Occlusion->Settings.Enabled;
+			Trace("Occlusion culling: %s", Occlusion->Settings.Enabled ? "ON" : "OFF");
+		}
+
+		// Regenerates 512x256x512 blocks around the camera, new seed every time
+		if (Input->IsKeyPressed(key::G))
+		{
+			v3i CameraChunk, Local;
+			BlockWorld_SplitBlock(BlockWorld_WorldToBlock(CameraPosition), &CameraChunk, &Local);
 
-	// CUBE
-	D3D12PushCube(Test, v3(0, 5, 0), v3(0, TimeSinceStart, 0), v3(1.0f, 1.0f, 1.0f));
-	//D3D12PushCube(Test, v3(3, 5, 0), v3(0, TimeSinceStart, 0), v3(1.0f, 1.0f, 1.0f));
+			v3i Min = v3i(CameraChunk.x - 8, 0, CameraChunk.z - 8);
+			v3i Max = v3i(CameraChunk.x + 8, c_WorldChunksY, CameraChunk.z + 8);
 
-	for (size_t i = 0; i < Blocks.size(); i++)
+			terrain_stats Stats = Terrain_Generate(World, Terrain_GetDefaultSettings(Test->TerrainSeed++), Min, Max);
+			Trace("Terrain (seed %u): %u chunks, %llu solid blocks | heightmaps %.2f ms, fill %.2f ms, total %.2f ms",
+				Test->TerrainSeed - 1, Stats.ChunksFilled, Stats.SolidBlocks, Stats.HeightmapMilliseconds, Stats.FillMilliseconds, Stats.TotalMilliseconds);
+
+			IrradianceProbes_SetCenter(Test->IrradianceProbes, CameraPosition);
+		}
+
+		// Probes near the blocks that changed, and the ones still left from before, as far as the budget goes
+		IrradianceProbes_Update(Test->IrradianceProbes, World, Test->LightEnvironment, c_DefaultIrradianceProbeBudget);
+		Test->LightEnvironment.IrradianceProbeGrid = IrradianceProbes_GetGrid(Test->IrradianceProbes);
+
+		BlockWorld_UpdateMeshes(World);
+		BlockWorld_SelectLODs(World, Camera, CameraPosition, ViewportHeight);
+
+		// Culling runs on a worker while we push the rest of the scene
+		OcclusionCuller_Begin(Occlusion, Camera.GetForwardViewProjection());
+		OcclusionCuller_AddBlockWorld(Occlusion, World, CameraPosition);
+		OcclusionCuller_Kick(Occlusion);
+	}
+
+	// ENTITIES
 	{
-		D3D12PushCube(Test, Blocks[i].Position, v3(0, 0, 0), v3(1.0f, 1.0f, 1.0f));
+		entity_store* Entities = &Test->Entities;
+
+		// Directional light debug
+		Entities_SetPosition(Entities, Test->Scene.EyeDebug, Eye);
+		Entities_SetPosition(Entities, Test->Scene.CameraDebug, CameraPosition);
+
+		// CUBE
+		Entities_SetRotation(Entities, Test->Scene.RotatingCube, v3(0, TimeSinceStart, 0));
+
+		Entities_UpdateTransforms(Entities);
+
+		// Hierarchy
+		{
+			transform_hierarchy* Hierarchy = &Test->Hierarchy;
+			TransformHierarchy_SetLocalPosition(Hierarchy, Test->Scene.EyeGizmo, Eye);
+			TransformHierarchy_Update(Hierarchy);
+
+			for (u32 i = 0; i < 3; i++)
+			{
+				transform_node Axis = Test->Scene.EyeGizmoAxes[i];
+				Entities_SetWorldTransform(Entities, Test->Scene.EyeGizmoEntities[i], TransformHierarchy_GetWorldMatrix(Hierarchy, Axis), TransformHierarchy_GetWorldBounds(Hierarchy, Axis));
+			}
+		}
+
+		D3D12PushEntities(Test, Entities);
 	}
 
-	// GROUND
-	D3D12PushCube(Test, v3(0, 0, 0), v3(0, 0, 0), v3(20.0f, 1.0f, 20.0f));
+	// BLOCKS
+	{
+		OcclusionCuller_Wait(Occlusion);
+		D3D12PushChunks(Test, World, Occlusion->Results);
+		D3D12CullShadowCasters(Test);
+		Test->PointShadows.Stats = PointShadows_EndFrame(&Test->PointShadows.Tracker);
+
+		if (Input->IsKeyPressed(key::P))
+			D3D12RasterizeShadowsOnCPU(Test);
+
+		// Once per second is enough to follow it without flooding the console
+		local_persist f32 StatsTimer = 0.0f;
+		StatsTimer += TimeStep;
+		if (StatsTimer >= 1.0f)
+		{
+			StatsTimer = 0.0f;
+
+			const occlusion_stats& Stats = Occlusion->Stats;
+			Trace("Occlusion: %u chunks, %u visible, %u occluded, %u outside frustum | %u occluders, %u triangles | %.3f ms",
+				Stats.Candidates, Stats.Visible, Stats.Occluded, Stats.OutsideFrustum, Stats.OccluderMeshes, Stats.OccluderTriangles, Stats.Milliseconds);
+
+			const auto& ShadowPass = Test->ShadowPass;
+			Trace("Shadow casters: %u, %u triangles | per cascade %u/%u/%u/%u triangles in %u/%u/%u/%u draws",
+				ShadowPass.CasterCount, ShadowPass.CasterIndexCount / 3,
+				ShadowPass.DrawIndexCounts[0] / 3, ShadowPass.DrawIndexCounts[1] / 3, ShadowPass.DrawIndexCounts[2] / 3, ShadowPass.DrawIndexCounts[3] / 3,
+				ShadowPass.DrawCounts[0], ShadowPass.DrawCounts[1], ShadowPass.DrawCounts[2], ShadowPass.DrawCounts[3]);
+
+			// Summed over the second, then started over
+			shadow_cache_stats& CacheStats = Test->ShadowPass.Cache.Stats;
+			Trace("Static shadow cache: %s | %u slices copied, %u rendered after moving, %u after casters changed | per slice %u/%u/%u/%u static triangles",
+				ShadowPass.CacheActive ? "ON" : "OFF", CacheStats.Copied, CacheStats.Recentered, CacheStats.CastersChanged,
+				ShadowPass.StaticDrawIndexCounts[0] / 3, ShadowPass.StaticDrawIndexCounts[1] / 3, ShadowPass.StaticDrawIndexCounts[2] / 3, ShadowPass.StaticDrawIndexCounts[3] / 3);
+			CacheStats = {};
+
+			const point_shadow_stats& PointStats = Test->PointShadows.Stats;
+			Trace("Point shadows: %u lights, %u casters tracked | %u faces rendered, casters %u added, %u moved, %u removed",
+				PointStats.Lights, PointStats.TrackedCasters, PointStats.DirtyFaces, PointStats.AddedCasters, PointStats.MovedCasters, PointStats.RemovedCasters);
+
+			const shadow_atlas_stats& AtlasStats = Test->PointShadows.AtlasStats;
+			Trace("Shadow atlas: %u lights in %u tiles, %.1f%% used, %.1f%% fragmented, largest free %u | %u reallocated, %u downgraded, %u without room",
+				AtlasStats.Owners, AtlasStats.Tiles, AtlasStats.Occupancy * 100.0f, AtlasStats.Fragmentation * 100.0f, AtlasStats.LargestFreeTile,
+				AtlasStats.Reallocated, AtlasStats.Downgraded, AtlasStats.Failed);
+
+			const light_cluster_stats& ClusterStats = Test->LightClusters->Stats;
+			Trace("Light clusters: %u lights in %u clusters, at most %u per cluster, %u indices, %u dropped | %.3f ms",
+				ClusterStats.Lights, ClusterStats.Clusters, ClusterStats.MaxClusterLights, ClusterStats.Indices, ClusterStats.DroppedIndices, ClusterStats.CullMilliseconds);
+
+			Trace("Light store: %u lights, %u animated, %u uploaded", Test->LightStore.Count, Test->AnimatedLights, Test->UploadedLights);
+
+			const irradiance_probe_stats& ProbeStats = Test->IrradianceProbes->Stats;
+			Trace("Irradiance probes: %u traced in %u batches, %u queued, %u chunks changed | %.2f ms",
+				ProbeStats.Probes, ProbeStats.Batches, ProbeStats.Queued, ProbeStats.ChangedChunks, ProbeStats.Milliseconds);
+
+			const light_tree_stats& TreeStats = Test->LightTree.Stats;
+			Trace("Light tree: %u lights in %u leaves, %s | %.3f ms | budget %u, %u clusters over it, %u lights left out",
+				TreeStats.Lights, TreeStats.Leaves, TreeStats.Rebuilt ? "rebuilt" : "refit", TreeStats.Milliseconds,
+				Test->LightClusters->LightBudget, ClusterStats.BudgetClusters, ClusterStats.BudgetDropped);
+
+			if (Test->ShadowQuality.Enabled)
+			{
+				const shadow_governor_stats& GovernorStats = Test->ShadowQuality.Governor.Stats;
+				Trace("Shadow governor: level %u, %s | %.2f ms, shadows %.2f ms | %u of %u frames over budget, %u lowered, %u raised",
+					GovernorStats.Level, ShadowGovernor_GetDecisionName(GovernorStats.Decision), GovernorStats.FrameMilliseconds, GovernorStats.ShadowMilliseconds,
+					GovernorStats.FramesOverBudget, GovernorStats.Frames, GovernorStats.Lowered, GovernorStats.Raised);
+			}
+
+			if (Test->VirtualShadows.Enabled)
+			{
+				const virtual_shadow_stats& VirtualStats = Test->VirtualShadows.Stats;
+				Trace("Virtual shadows: %u pages requested, %u resident, LOD bias %u | %u rendered, %u waiting, %u allocated, %u evicted, %u without room",
+					VirtualStats.Requested, VirtualStats.Resident, VirtualStats.LodBias, VirtualStats.Rendered, VirtualStats.Waiting,
+					VirtualStats.Allocated, VirtualStats.Evicted, VirtualStats.Overflowed);
+			}
+		}
+	}
 
 
 	//PushCube(Shadows, v3(10, 10, 0), v3(0, 0, glm::pi<f32>() / 2), v3(40.0f, 1.0f, 40.0f));
@@ -649,54 +1757,361 @@ internal void D3D12Shadows_UpdateAndRender(d3d12_shadows_test* Test, game_input*
 
 	DxAssert(CommandList->Reset(DirectCommandAllocator, nullptr));
 
+	const u32 FirstTimestamp = CurrentBackBufferIndex * c_ShadowTimestamps;
+	CommandList->EndQuery(Test->ShadowQuality.QueryHeap, D3D12_QUERY_TYPE_TIMESTAMP, FirstTimestamp);
+
+	u32 VertexCount = static_cast<u32>(Test->Quad.VertexDataPtr - Test->Quad.VertexDataBase);
+
 	{
 		// Set light environment data
 		DX12ConstantBufferSetData(&Test->LightEnvironmentConstantBuffers[CurrentBackBufferIndex], &Test->LightEnvironment, sizeof(light_environment));
+		DX12ConstantBufferSetData(&Test->LightClusterBuffers[CurrentBackBufferIndex], Test->LightClusters->Data, sizeof(u32) * Test->LightClusters->DataSize);
+
+		// The whole grid, but only into buffers that have not seen the latest probes yet
+		if (Test->IrradianceProbeRevisions[CurrentBackBufferIndex] != Test->IrradianceProbes->Revision)
+		{
+			DX12ConstantBufferSetData(&Test->IrradianceProbeBuffers[CurrentBackBufferIndex], Test->IrradianceProbes->Probes, sizeof(irradiance_probe_gpu) * c_IrradianceProbeCount);
+			Test->IrradianceProbeRevisions[CurrentBackBufferIndex] = Test->IrradianceProbes->Revision;
+		}
+
+		// Only the lights that changed since this buffer was last written
+		Test->UploadedLights = LightStore_Upload(&Test->LightStore, CurrentBackBufferIndex, (point_light*)Test->PointLightBuffers[CurrentBackBufferIndex].MappedData);
+
+		// Set cascade data
+		shadow_cascade_constants CascadeConstants;
+		Cascades_GetConstants(&Test->ShadowPass.Cascades, &CascadeConstants);
+		CascadeConstants.UVScale = (f32)Test->ShadowPass.CascadeSettings.Resolution / SHADOW_MAP_SIZE;
+		DX12ConstantBufferSetData(&Test->ShadowPass.CascadeConstantBuffers[CurrentBackBufferIndex], &CascadeConstants, sizeof(shadow_cascade_constants));
+
+		// Set virtual shadow data, the page table is written in place
+		virtual_shadow_constants VirtualConstants = {};
+		if (Test->VirtualShadows.Enabled)
+		{
+			VirtualShadows_GetConstants(&Test->VirtualShadows.Map, &VirtualConstants);
+			VirtualShadows_GetPageTable(&Test->VirtualShadows.Map, (virtual_shadow_gpu_page*)Test->VirtualShadows.PageTables[CurrentBackBufferIndex].MappedData);
+		}
+		DX12ConstantBufferSetData(&Test->VirtualShadows.ConstantBuffers[CurrentBackBufferIndex], &VirtualConstants, sizeof(virtual_shadow_constants));
 
 		// Send vertex data
-		DX12VertexBufferSendData(&Test->Quad.VertexBuffers[CurrentBackBufferIndex], Context->DirectCommandList, Test->Quad.VertexDataBase, sizeof(quad_vertex) * Test->Quad.IndexCount);
+		DX12VertexBufferSendData(&Test->Quad.VertexBuffers[CurrentBackBufferIndex], Context->DirectCommandList, Test->Quad.VertexDataBase, sizeof(quad_vertex) * VertexCount);
 	}
 
-	// Shadow Pass
-	if (1)
+	// Shadow Pass, the cascades are not sampled while virtual shadows are enabled
+	if (!Test->VirtualShadows.Enabled)
 	{
 		auto& ShadowPass = Test->ShadowPass;
 		auto ShadowMap = ShadowPass.ShadowMaps[CurrentBackBufferIndex];
+		auto MomentMap = ShadowPass.MomentMaps[CurrentBackBufferIndex];
+
+		const shadow_filter_preset& Preset = c_ShadowFilterPresets[Test->Quad.ShadowFilter];
+		const bool UsesMoments = ShadowFilter_UsesMoments(Preset.Filter);
 
 		// From resource to depth write
 		DX12CmdTransition(CommandList, ShadowMap, D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_DEPTH_WRITE);
-		DX12CmdSetViewport(CommandList, 0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
-		DX12CmdSetScissorRect(CommandList, 0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+		if (UsesMoments)
+			DX12CmdTransition(CommandList, MomentMap, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET);
+
+		const u32 Resolution = ShadowPass.CascadeSettings.Resolution;
+		DX12CmdSetViewport(CommandList, 0, 0, Resolution, Resolution);
+		DX12CmdSetScissorRect(CommandList, 0, 0, Resolution, Resolution);
 
-		auto ShadowPassDSV = ShadowPass.DSVHandles[CurrentBackBufferIndex];
-		CommandList->ClearDepthStencilView(ShadowPassDSV, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
-		CommandList->OMSetRenderTargets(0, nullptr, false, &ShadowPassDSV);
 		CommandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		CommandList->SetPipelineState(UsesMoments ? ShadowPass.MomentPipelines[Preset.Filter == shadow_filter::EVSM] : ShadowPass.Pipeline);
+		CommandList->SetGraphicsRootSignature(ShadowPass.RootSignature);
 
-		// Render instanced cuboids
-		if (Test->Quad.IndexCount > 0)
+		// Bind vertex buffer
+		DX12CmdSetVertexBuffer(CommandList, 0, Test->Quad.VertexBuffers[CurrentBackBufferIndex].Buffer.Handle, VertexCount * sizeof(quad_vertex), sizeof(quad_vertex));
+
+		// Bind index buffer
+		DX12CmdSetIndexBuffer(CommandList, Test->Quad.IndexBuffer.Buffer.Handle, Test->Quad.IndexCount * sizeof(u32), DXGI_FORMAT_R32_UINT);
+
+		// Static cache slices that are out of date, the cascades copy them below
+		if (ShadowPass.StaticMask)
 		{
-			CommandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-			CommandList->SetPipelineState(ShadowPass.Pipeline);
-			CommandList->SetGraphicsRootSignature(ShadowPass.RootSignature);
+			// Rendered at the cascade resolution too, a slice is invalidated whenever the texel size changes
+			const u32 CacheSize = Resolution + 2 * ShadowPass.Cache.Border;
 
-			// TODO: For now just share the first half of the signature buffer, this needs some sort of distinction between HUD and Game stuff
-			CommandList->SetGraphicsRoot32BitConstants(0, sizeof(ShadowPass.RootSignatureBuffer) / 4, &ShadowPass.RootSignatureBuffer, 0);
+			DX12CmdTransition(CommandList, ShadowPass.StaticCache, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_DEPTH_WRITE);
+			DX12CmdSetViewport(CommandList, 0, 0, CacheSize, CacheSize);
+			DX12CmdSetScissorRect(CommandList, 0, 0, CacheSize, CacheSize);
 
-			// Bind vertex buffer
-			DX12CmdSetVertexBuffer(CommandList, 0, Test->Quad.VertexBuffers[CurrentBackBufferIndex].Buffer.Handle, Test->Quad.IndexCount * sizeof(quad_vertex), sizeof(quad_vertex));
+			for (u32 Slice = 0; Slice < ShadowPass.Cascades.Count; Slice++)
+			{
+				if (!(ShadowPass.StaticMask & (1u << Slice)))
+					continue;
 
-			// Bind index buffer
-			DX12CmdSetIndexBuffer(CommandList, Test->Quad.IndexBuffer.Buffer.Handle, Test->Quad.IndexCount * sizeof(u32), DXGI_FORMAT_R32_UINT);
+				auto SliceDSV = ShadowPass.StaticCacheDSVs[Slice];
+				CommandList->ClearDepthStencilView(SliceDSV, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
+				CommandList->OMSetRenderTargets(0, nullptr, false, &SliceDSV);
 
-			// Issue draw call
-			CommandList->DrawIndexedInstanced(Test->Quad.IndexCount, 1, 0, 0, 0);
+				ShadowPass.RootSignatureBuffer.LightSpaceMatrix = ShadowPass.Cache.Slices[Slice].ViewProjection;
+				CommandList->SetGraphicsRoot32BitConstants(0, sizeof(ShadowPass.RootSignatureBuffer) / 4, &ShadowPass.RootSignatureBuffer, 0);
+
+				for (u32 i = 0; i < ShadowPass.StaticDrawCounts[Slice]; i++)
+				{
+					const shadow_draw& Draw = ShadowPass.StaticDraws[Slice][i];
+					CommandList->DrawIndexedInstanced(Draw.IndexCount, 1, Draw.IndexOffset, 0, 0);
+				}
+			}
+
+			DX12CmdTransition(CommandList, ShadowPass.StaticCache, D3D12_RESOURCE_STATE_DEPTH_WRITE, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+			DX12CmdSetViewport(CommandList, 0, 0, Resolution, Resolution);
+			DX12CmdSetScissorRect(CommandList, 0, 0, Resolution, Resolution);
+		}
+
+		if (ShadowPass.CacheActive)
+			CommandList->SetDescriptorHeaps(1, (ID3D12DescriptorHeap* const*)&ShadowPass.SRVDescriptorHeap);
+
+		for (u32 Cascade = 0; Cascade < ShadowPass.Cascades.Count; Cascade++)
+		{
+			auto ShadowPassDSV = ShadowPass.DSVHandles[CurrentBackBufferIndex][Cascade];
+
+			if (ShadowPass.CacheActive)
+			{
+				// The copy writes every texel of the cascade, it replaces the clear. Constants are laid out like shadow_cache_copy, then the slice
+				// Below SHADOW_MAP_SIZE the rest of the slice is still cleared, filters reaching past the cascade edge read it
+				if (Resolution < SHADOW_MAP_SIZE)
+					CommandList->ClearDepthStencilView(ShadowPassDSV, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
+				CommandList->OMSetRenderTargets(0, nullptr, false, &ShadowPassDSV);
+
+				D3D12_GPU_DESCRIPTOR_HANDLE CacheSRV = ShadowPass.SRVDescriptorHeap->GetGPUDescriptorHandleForHeapStart();
+				CacheSRV.ptr += (CurrentBackBufferIndex * c_ShadowDescriptorsPerFrame + c_ShadowCacheSRV) * Context->Device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+				shadow_cache_copy Copy = ShadowCache_GetCopy(&ShadowPass.Cache, &ShadowPass.Cascades, Cascade);
+				CommandList->SetPipelineState(ShadowPass.CopyPipeline);
+				CommandList->SetGraphicsRootSignature(ShadowPass.CopyRootSignature);
+				CommandList->SetGraphicsRoot32BitConstants(0, sizeof(Copy) / 4, &Copy, 0);
+				CommandList->SetGraphicsRoot32BitConstant(0, Cascade, sizeof(Copy) / 4);
+				CommandList->SetGraphicsRootDescriptorTable(1, CacheSRV);
+				CommandList->DrawInstanced(3, 1, 0, 0);
+
+				CommandList->SetPipelineState(ShadowPass.Pipeline);
+				CommandList->SetGraphicsRootSignature(ShadowPass.RootSignature);
+			}
+			else
+			{
+				CommandList->ClearDepthStencilView(ShadowPassDSV, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
+			}
+
+			if (UsesMoments)
+			{
+				// Cleared to the moments of the far plane, same as the cleared depth
+				auto MomentRTV = ShadowPass.MomentRTVHandles[CurrentBackBufferIndex][Cascade];
+				v4 ClearMoments = ShadowMoments_FromDepth(1.0f, Preset.Filter);
+				CommandList->ClearRenderTargetView(MomentRTV, &ClearMoments.x, 0, nullptr);
+				CommandList->OMSetRenderTargets(1, &MomentRTV, false, &ShadowPassDSV);
+			}
+			else
+			{
+				CommandList->OMSetRenderTargets(0, nullptr, false, &ShadowPassDSV);
+			}
+
+			ShadowPass.RootSignatureBuffer.LightSpaceMatrix = ShadowPass.Cascades.Cascades[Cascade].ViewProjection;
+			CommandList->SetGraphicsRoot32BitConstants(0, sizeof(ShadowPass.RootSignatureBuffer) / 4, &ShadowPass.RootSignatureBuffer, 0);
+
+			for (u32 i = 0; i < ShadowPass.DrawCounts[Cascade]; i++)
+			{
+				const shadow_draw& Draw = ShadowPass.Draws[Cascade][i];
+				CommandList->DrawIndexedInstanced(Draw.IndexCount, 1, Draw.IndexOffset, 0, 0);
+			}
 		}
 
 		// From depth write to resource
 		DX12CmdTransition(CommandList, ShadowMap, D3D12_RESOURCE_STATE_DEPTH_WRITE, D3D12_RESOURCE_STATE_GENERIC_READ);
+
+		// Moment filtering: horizontal blur into the scratch, vertical blur back into mip 0, then the mip chain
+		if (UsesMoments)
+		{
+			Assert(Preset.Taps >= 3, "Moment presets blur with 3 taps at least!");
+
+			const u32 MipCount = ShadowPass.MomentMipCount;
+			const u32 SliceCount = ShadowPass.Cascades.Count;
+			auto Scratch = ShadowPass.MomentBlurScratch;
+
+			auto DescriptorBase = ShadowPass.SRVDescriptorHeap->GetGPUDescriptorHandleForHeapStart();
+			auto DescriptorSize = Context->Device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+			auto Descriptor = [&](u32 Index)
+			{
+				D3D12_GPU_DESCRIPTOR_HANDLE Handle = DescriptorBase;
+				Handle.ptr += (CurrentBackBufferIndex * c_ShadowDescriptorsPerFrame + Index) * DescriptorSize;
+				return Handle;
+			};
+
+			// Source SRV, destination UAV, destination size
+			auto DispatchFilter = [&](u32 Source, u32 Destination, i32 StepX, i32 StepY, u32 Size)
+			{
+				u32 Constants[4] = { (u32)StepX, (u32)StepY, Size, SliceCount };
+				CommandList->SetComputeRoot32BitConstants(0, CountOf(Constants), Constants, 0);
+				CommandList->SetComputeRootDescriptorTable(1, Descriptor(Source));
+				CommandList->SetComputeRootDescriptorTable(2, Descriptor(Destination));
+				CommandList->Dispatch((Size + 7) / 8, (Size + 7) / 8, SliceCount);
+			};
+
+			DX12CmdTransition(CommandList, MomentMap, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+
+			CommandList->SetDescriptorHeaps(1, (ID3D12DescriptorHeap* const*)&ShadowPass.SRVDescriptorHeap);
+			CommandList->SetComputeRootSignature(ShadowPass.FilterRootSignature);
+			CommandList->SetPipelineState(ShadowPass.BlurPipelines[(Preset.Taps - 3) / 2]);
+
+			DispatchFilter(c_ShadowMomentMipSRVs, c_ShadowScratchUAV, 1, 0, SHADOW_MAP_SIZE);
+
+			DX12CmdTransition(CommandList, Scratch, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			DX12CmdTransition(CommandList, MomentMap, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+
+			DispatchFilter(c_ShadowScratchSRV, c_ShadowMomentMipUAVs, 0, 1, SHADOW_MAP_SIZE);
+
+			DX12CmdTransition(CommandList, Scratch, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+
+			// Each mip reads the one above, which has to leave UAV first. Subresources are mip + slice * mip count
+			CommandList->SetPipelineState(ShadowPass.DownsamplePipeline);
+			for (u32 Mip = 1; Mip < MipCount; Mip++)
+			{
+				for (u32 Slice = 0; Slice < c_MaxShadowCascades; Slice++)
+					DX12CmdTransition(CommandList, MomentMap, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, (Mip - 1) + Slice * MipCount);
+
+				DispatchFilter(c_ShadowMomentMipSRVs + Mip - 1, c_ShadowMomentMipUAVs + Mip, 0, 0, SHADOW_MAP_SIZE >> Mip);
+			}
+
+			// Back to where the main pass samples it
+			for (u32 Slice = 0; Slice < c_MaxShadowCascades; Slice++)
+			{
+				for (u32 Mip = 0; Mip < MipCount; Mip++)
+				{
+					D3D12_RESOURCE_STATES Before = (Mip + 1 < MipCount) ? D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE : D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+					DX12CmdTransition(CommandList, MomentMap, Before, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, Mip + Slice * MipCount);
+				}
+			}
+		}
 	}
 
+	// Point light shadows, only the faces the tracker found dirty. Clean faces keep last frame's depth
+	if (Test->PointShadows.Stats.DirtyFaces > 0)
+	{
+		auto& ShadowPass = Test->ShadowPass;
+		auto& PointShadows = Test->PointShadows;
+
+		DX12CmdTransition(CommandList, PointShadows.AtlasTexture, D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_DEPTH_WRITE);
+		CommandList->OMSetRenderTargets(0, nullptr, false, &PointShadows.AtlasDSV);
+
+		CommandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		CommandList->SetPipelineState(ShadowPass.AtlasPipeline);
+		CommandList->SetGraphicsRootSignature(ShadowPass.RootSignature);
+
+		DX12CmdSetVertexBuffer(CommandList, 0, Test->Quad.VertexBuffers[CurrentBackBufferIndex].Buffer.Handle, VertexCount * sizeof(quad_vertex), sizeof(quad_vertex));
+		DX12CmdSetIndexBuffer(CommandList, Test->Quad.IndexBuffer.Buffer.Handle, Test->Quad.IndexCount * sizeof(u32), DXGI_FORMAT_R32_UINT);
+
+		for (u32 Light = 0; Light < PointShadows.Tracker.LightCount; Light++)
+		{
+			const point_shadow_light& PointLight = PointShadows.Tracker.Lights[Light];
+			const u32 DirtyFaces = PointShadows_GetDirtyFaces(&PointShadows.Tracker, Light);
+
+			for (u32 Face = 0; Face < c_PointShadowFaceCount; Face++)
+			{
+				if (!(DirtyFaces & (1u << Face)))
+					continue;
+
+				// Tile is the viewport, the clear is limited to it
+				shadow_atlas_rect Tile = ShadowAtlas_GetRect(&PointShadows.Atlas, PointShadows.Atlas.Owners[Light].Tiles[Face]);
+				D3D12_RECT TileRect = { (LONG)Tile.X, (LONG)Tile.Y, (LONG)(Tile.X + Tile.Size), (LONG)(Tile.Y + Tile.Size) };
+				CommandList->ClearDepthStencilView(PointShadows.AtlasDSV, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 1, &TileRect);
+
+				DX12CmdSetViewport(CommandList, (f32)Tile.X, (f32)Tile.Y, (f32)Tile.Size, (f32)Tile.Size);
+				DX12CmdSetScissorRect(CommandList, Tile.X, Tile.Y, Tile.X + Tile.Size, Tile.Y + Tile.Size);
+
+				ShadowPass.RootSignatureBuffer.LightSpaceMatrix = PointShadows_GetFaceViewProjection(PointLight.Position, PointLight.Radius, Face);
+				CommandList->SetGraphicsRoot32BitConstants(0, sizeof(ShadowPass.RootSignatureBuffer) / 4, &ShadowPass.RootSignatureBuffer, 0);
+
+				// Casters are in stream order, neighbors that both hit the face go out as one draw
+				shadow_draw Draw = {};
+				for (u32 i = 0; i < ShadowPass.CasterCount; i++)
+				{
+					const shadow_caster& Caster = ShadowPass.Casters[i];
+					if (!(PointShadows_GetFaceMask(PointLight.Position, PointLight.Radius, Caster.Bounds) & (1u << Face)))
+						continue;
+
+					if (Draw.IndexCount > 0 && Draw.IndexOffset + Draw.IndexCount == Caster.IndexOffset)
+					{
+						Draw.IndexCount += Caster.IndexCount;
+						continue;
+					}
+
+					if (Draw.IndexCount > 0)
+						CommandList->DrawIndexedInstanced(Draw.IndexCount, 1, Draw.IndexOffset, 0, 0);
+
+					Draw = { Caster.IndexOffset, Caster.IndexCount };
+				}
+
+				if (Draw.IndexCount > 0)
+					CommandList->DrawIndexedInstanced(Draw.IndexCount, 1, Draw.IndexOffset, 0, 0);
+			}
+
+			PointShadows_MarkClean(&PointShadows.Tracker, Light, DirtyFaces);
+		}
+
+		DX12CmdTransition(CommandList, PointShadows.AtlasTexture, D3D12_RESOURCE_STATE_DEPTH_WRITE, D3D12_RESOURCE_STATE_GENERIC_READ);
+	}
+
+	// Virtual shadow pages whose casters changed or that just got a pool page, coarsest first
+	if (Test->VirtualShadows.Enabled && Test->VirtualShadows.Map.RenderCount > 0)
+	{
+		auto& ShadowPass = Test->ShadowPass;
+		auto& VirtualShadows = Test->VirtualShadows;
+		const virtual_shadow_map& Map = VirtualShadows.Map;
+
+		DX12CmdTransition(CommandList, VirtualShadows.Pool, D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_DEPTH_WRITE);
+		CommandList->OMSetRenderTargets(0, nullptr, false, &VirtualShadows.PoolDSV);
+
+		CommandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		CommandList->SetPipelineState(ShadowPass.AtlasPipeline);
+		CommandList->SetGraphicsRootSignature(ShadowPass.RootSignature);
+
+		DX12CmdSetVertexBuffer(CommandList, 0, Test->Quad.VertexBuffers[CurrentBackBufferIndex].Buffer.Handle, VertexCount * sizeof(quad_vertex), sizeof(quad_vertex));
+		DX12CmdSetIndexBuffer(CommandList, Test->Quad.IndexBuffer.Buffer.Handle, Test->Quad.IndexCount * sizeof(u32), DXGI_FORMAT_R32_UINT);
+
+		for (u32 i = 0; i < Map.RenderCount; i++)
+		{
+			u32 Page = Map.RenderList[i];
+
+			// Page is the viewport, the clear is limited to it
+			shadow_atlas_rect Rect = VirtualShadows_GetPoolRect(Map.Pages[Page].PhysicalPage);
+			D3D12_RECT PageRect = { (LONG)Rect.X, (LONG)Rect.Y, (LONG)(Rect.X + Rect.Size), (LONG)(Rect.Y + Rect.Size) };
+			CommandList->ClearDepthStencilView(VirtualShadows.PoolDSV, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 1, &PageRect);
+
+			DX12CmdSetViewport(CommandList, (f32)Rect.X, (f32)Rect.Y, (f32)Rect.Size, (f32)Rect.Size);
+			DX12CmdSetScissorRect(CommandList, Rect.X, Rect.Y, Rect.X + Rect.Size, Rect.Y + Rect.Size);
+
+			ShadowPass.RootSignatureBuffer.LightSpaceMatrix = VirtualShadows_GetPageViewProjection(&Map, Page);
+			CommandList->SetGraphicsRoot32BitConstants(0, sizeof(ShadowPass.RootSignatureBuffer) / 4, &ShadowPass.RootSignatureBuffer, 0);
+
+			// Casters are in stream order, neighbors that both overlap the page go out as one draw
+			shadow_draw Draw = {};
+			for (u32 j = 0; j < ShadowPass.CasterCount; j++)
+			{
+				const shadow_caster& Caster = ShadowPass.Casters[j];
+				if (!VirtualShadows_CasterOverlapsPage(&Map, Page, Caster.Bounds))
+					continue;
+
+				if (Draw.IndexCount > 0 && Draw.IndexOffset + Draw.IndexCount == Caster.IndexOffset)
+				{
+					Draw.IndexCount += Caster.IndexCount;
+					continue;
+				}
+
+				if (Draw.IndexCount > 0)
+					CommandList->DrawIndexedInstanced(Draw.IndexCount, 1, Draw.IndexOffset, 0, 0);
+
+				Draw = { Caster.IndexOffset, Caster.IndexCount };
+			}
+
+			if (Draw.IndexCount > 0)
+				CommandList->DrawIndexedInstanced(Draw.IndexCount, 1, Draw.IndexOffset, 0, 0);
+		}
+
+		DX12CmdTransition(CommandList, VirtualShadows.Pool, D3D12_RESOURCE_STATE_DEPTH_WRITE, D3D12_RESOURCE_STATE_GENERIC_READ);
+	}
+
+	CommandList->EndQuery(Test->ShadowQuality.QueryHeap, D3D12_QUERY_TYPE_TIMESTAMP, FirstTimestamp + 1);
+
 	// Geometry and composition pass
 	{
 		// Frame that was presented needs to be set to render target again
@@ -705,7 +2120,7 @@ internal void D3D12Shadows_UpdateAndRender(d3d12_shadows_test* Test, game_input*
 		// Set and clear render target view
 		v4 ClearColor = { 0.2f, 0.3f, 0.8f, 1.0f };
 		CommandList->ClearRenderTargetView(RTV, &ClearColor.x, 0, nullptr);
-		CommandList->ClearDepthStencilView(DSV, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
+		CommandList->ClearDepthStencilView(DSV, D3D12_CLEAR_FLAG_DEPTH, 0.0f, 0, 0, nullptr); // Reverse Z, the far plane is at 0
 		CommandList->OMSetRenderTargets(1, &RTV, false, &DSV);
 
 		// Set viewport and scissor rect
@@ -717,7 +2132,7 @@ internal void D3D12Shadows_UpdateAndRender(d3d12_shadows_test* Test, game_input*
 		{
 			CommandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 			CommandList->SetGraphicsRootSignature(Test->Quad.RootSignature);
-			CommandList->SetPipelineState(Test->Quad.Pipeline);
+			CommandList->SetPipelineState(Test->Quad.Pipelines[Test->Quad.ShadowFilter]);
 
 			// 0
 			CommandList->SetGraphicsRoot32BitConstants(0, sizeof(Test->Quad.RootSignatureBuffer) / 4, &Test->Quad.RootSignatureBuffer, 0);
@@ -729,24 +2144,43 @@ internal void D3D12Shadows_UpdateAndRender(d3d12_shadows_test* Test, game_input*
 			{
 				CommandList->SetDescriptorHeaps(1, (ID3D12DescriptorHeap* const*)&Test->ShadowPass.SRVDescriptorHeap);
 				auto SRVPTR = Test->ShadowPass.SRVDescriptorHeap->GetGPUDescriptorHandleForHeapStart();
-				//SRVPTR.ptr += CurrentBackBufferIndex * Context->Device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+				SRVPTR.ptr += CurrentBackBufferIndex * c_ShadowDescriptorsPerFrame * Context->Device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
 				CommandList->SetGraphicsRootDescriptorTable(2, SRVPTR);
 			}
 
+			// 3
+			CommandList->SetGraphicsRootConstantBufferView(3, Test->ShadowPass.CascadeConstantBuffers[CurrentBackBufferIndex].Buffer.Handle->GetGPUVirtualAddress());
+
+			// 4, 5
+			CommandList->SetGraphicsRootConstantBufferView(4, Test->VirtualShadows.ConstantBuffers[CurrentBackBufferIndex].Buffer.Handle->GetGPUVirtualAddress());
+			CommandList->SetGraphicsRootShaderResourceView(5, Test->VirtualShadows.PageTables[CurrentBackBufferIndex].Buffer.Handle->GetGPUVirtualAddress());
+
+			// 6
+			CommandList->SetGraphicsRootShaderResourceView(6, Test->LightClusterBuffers[CurrentBackBufferIndex].Buffer.Handle->GetGPUVirtualAddress());
+
+			// 7
+			CommandList->SetGraphicsRootShaderResourceView(7, Test->PointLightBuffers[CurrentBackBufferIndex].Buffer.Handle->GetGPUVirtualAddress());
+
+			// 8
+			CommandList->SetGraphicsRootShaderResourceView(8, Test->IrradianceProbeBuffers[CurrentBackBufferIndex].Buffer.Handle->GetGPUVirtualAddress());
+
 			// Bind vertex buffer
-			DX12CmdSetVertexBuffer(CommandList, 0, Test->Quad.VertexBuffers[CurrentBackBufferIndex].Buffer.Handle, Test->Quad.IndexCount * sizeof(quad_vertex), sizeof(quad_vertex));
+			DX12CmdSetVertexBuffer(CommandList, 0, Test->Quad.VertexBuffers[CurrentBackBufferIndex].Buffer.Handle, VertexCount * sizeof(quad_vertex), sizeof(quad_vertex));
 
 			// Bind index buffer
 			DX12CmdSetIndexBuffer(CommandList, Test->Quad.IndexBuffer.Buffer.Handle, Test->Quad.IndexCount * sizeof(u32), DXGI_FORMAT_R32_UINT);
 
-			// Issue draw call
-			CommandList->DrawIndexedInstanced(Test->Quad.IndexCount, 1, 0, 0, 0);
+			// Issue draw call, everything up to the shadow-only LODs
+			CommandList->DrawIndexedInstanced(Test->Quad.MainIndexCount, 1, 0, 0, 0);
 		}
 
 		// Rendered frame needs to be transitioned to present state
 		DX12CmdTransition(CommandList, BackBuffer, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT);
 	}
 
+	CommandList->EndQuery(Test->ShadowQuality.QueryHeap, D3D12_QUERY_TYPE_TIMESTAMP, FirstTimestamp + 2);
+	CommandList->ResolveQueryData(Test->ShadowQuality.QueryHeap, D3D12_QUERY_TYPE_TIMESTAMP, FirstTimestamp, c_ShadowTimestamps, Test->ShadowQuality.Readback.Handle, sizeof(u64) * FirstTimestamp);
+
 	// Finalize the command list
 	DxAssert(CommandList->Close());
 
@@ -759,6 +2193,36 @@ internal void D3D12Shadows_UpdateAndRender(d3d12_shadows_test* Test, game_input*
 	FrameFenceValue = D3D12Context_Signal(Context->DirectCommandQueue, Context->Fence, &Context->FenceValue);
 	D3D12Context_WaitForFenceValue(Context->Fence, FrameFenceValue, Context->DirectFenceEvent);
 
+	// The frame is done, its timestamps are in
+	{
+		auto& ShadowQuality = Test->ShadowQuality;
+
+		D3D12_RANGE ReadRange = { sizeof(u64) * FirstTimestamp, sizeof(u64) * (FirstTimestamp + c_ShadowTimestamps) };
+		D3D12_RANGE WrittenRange = { 0, 0 };
+		u64* Timestamps;
+		DxAssert(ShadowQuality.Readback.Handle->Map(0, &ReadRange, (void**)&Timestamps));
+		Timestamps += FirstTimestamp;
+		ShadowQuality.Sample.ShadowMilliseconds = (f32)((Timestamps[1] - Timestamps[0]) / ShadowQuality.TicksPerMillisecond);
+		ShadowQuality.Sample.FrameMilliseconds = (f32)((Timestamps[2] - Timestamps[0]) / ShadowQuality.TicksPerMillisecond);
+		ShadowQuality.Readback.Handle->Unmap(0, &WrittenRange);
+
+		if (ShadowQuality.Trace)
+			fprintf(ShadowQuality.Trace, "%.4f,%.4f\n", ShadowQuality.Sample.FrameMilliseconds, ShadowQuality.Sample.ShadowMilliseconds);
+
+		if (ShadowQuality.Enabled)
+		{
+			shadow_governor_decision Decision = ShadowGovernor_Update(&ShadowQuality.Governor, ShadowQuality.Sample);
+			if (Decision == shadow_governor_decision::Lower || Decision == shadow_governor_decision::Raise)
+			{
+				const shadow_governor_stats& Stats = ShadowQuality.Governor.Stats;
+				const shadow_quality& Quality = ShadowGovernor_GetQuality(&ShadowQuality.Governor);
+				printf("Shadow governor: %s to level %u at %.2f ms (shadows %.2f ms) | %u cascades of %u, %.0f distance, %s, point tiles %u\n",
+					ShadowGovernor_GetDecisionName(Decision), Stats.Level, Stats.FrameMilliseconds, Stats.ShadowMilliseconds,
+					Quality.CascadeCount, Quality.CascadeResolution, Quality.MaxDistance, c_ShadowFilterPresets[Quality.ShadowFilter].Name, Quality.PointTileSize);
+			}
+		}
+	}
+
 	// Move to another back buffer
 	Context->CurrentBackBufferIndex = Context->SwapChain->GetCurrentBackBufferIndex();
 
@@ -766,6 +2230,16 @@ internal void D3D12Shadows_UpdateAndRender(d3d12_shadows_test* Test, game_input*
 
 	 // Reset indices
 	Test->Quad.IndexCount = 0;
+	Test->Quad.MainIndexCount = 0;
+	Test->ShadowPass.CasterCount = 0;
+	Test->ShadowPass.CasterIndexCount = 0;
+	for (u32 i = 0; i < c_MaxShadowCascades; i++)
+	{
+		Test->ShadowPass.DrawCounts[i] = 0;
+		Test->ShadowPass.DrawIndexCounts[i] = 0;
+		Test->ShadowPass.StaticDrawCounts[i] = 0;
+		Test->ShadowPass.StaticDrawIndexCounts[i] = 0;
+	}
 	Test->Quad.VertexDataPtr = Test->Quad.VertexDataBase;
 
 	Test->LightEnvironment.Clear();
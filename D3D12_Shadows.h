@@ -2,40 +2,226 @@
 
 #include "Shadows.h"
 #include "D3D12_Buffers.h"
+#include "Jobs.h"
+#include "Chunks.h"
+#include "Occlusion.h"
+#include "Entities.h"
+#include "TransformHierarchy.h"
+#include "Terrain.h"
+#include "Cascades.h"
+#include "ShadowCache.h"
+#include "ShadowRaster.h"
+#include "ShadowMoments.h"
+#include "ShadowAtlas.h"
+#include "LightStore.h"
+#include "LightTree.h"
+#include "PointShadows.h"
+#include "VirtualShadows.h"
+#include "LightClusters.h"
+#include "ShadowGovernor.h"
+#include "IrradianceProbes.h"
+
+// Range of the quad stream the shadow pass draws, bit per cascade it can cast into
+// Indices recorded while pushing, sorted into cascades once all receivers are known
+struct shadow_caster
+{
+	u32 IndexOffset;
+	u32 IndexCount;
+	aabb Bounds;
+	u64 Key;      // Same as the point shadow tracker gets, the static cache signs its slices with them
+	u64 Revision;
+	b32 Static;   // Goes into the static cache instead of the cascade draw lists
+};
+
+struct shadow_draw
+{
+	u32 IndexOffset;
+	u32 IndexCount;
+};
 
-#include <vector>
+// Shader visible descriptors of the shadow pass, a block per frame
+// [depth SRV][moments SRV][shadow atlas SRV][virtual shadow pool SRV][scratch SRV][scratch UAV][moments SRV per mip][moments UAV per mip]
+// [static cache SRV]
+// The first four are the main pass table (t0, t1, t2, t3)
+inline constexpr u32 c_ShadowDepthSRV = 0;
+inline constexpr u32 c_ShadowMomentsSRV = 1;
+inline constexpr u32 c_ShadowAtlasSRV = 2;
+inline constexpr u32 c_ShadowVirtualPoolSRV = 3;
+inline constexpr u32 c_ShadowScratchSRV = 4;
+inline constexpr u32 c_ShadowScratchUAV = 5;
+inline constexpr u32 c_ShadowMomentMipSRVs = 6;
+inline constexpr u32 c_ShadowMomentMipUAVs = c_ShadowMomentMipSRVs + c_MaxShadowMomentMips;
+inline constexpr u32 c_ShadowCacheSRV = c_ShadowMomentMipUAVs + c_MaxShadowMomentMips;
+inline constexpr u32 c_ShadowDescriptorsPerFrame = c_ShadowCacheSRV + 1;
+
+// Cascades and their static cache. D16 halves their memory and bandwidth, the cascade bias grows by its steps.
+// The point shadow atlas and the virtual pool stay D32, their pass has its own pipeline
+inline constexpr shadow_depth_format c_CascadeDepthFormat = shadow_depth_format::D32;
+inline constexpr DXGI_FORMAT c_CascadeDSVFormat = c_CascadeDepthFormat == shadow_depth_format::D16 ? DXGI_FORMAT_D16_UNORM : DXGI_FORMAT_D32_FLOAT;
+inline constexpr DXGI_FORMAT c_CascadeSRVFormat = c_CascadeDepthFormat == shadow_depth_format::D16 ? DXGI_FORMAT_R16_UNORM : DXGI_FORMAT_R32_FLOAT;
+
+inline constexpr u32 c_LightSwarmSize = 4096;
+inline constexpr u32 c_ShadowTimestamps = 3;
+inline constexpr const char* c_ShadowGovernorTracePath = "shadow_timings.csv";
 
 struct d3d12_shadows_test
 {
 	// Quad
 	struct
 	{
-		ID3D12PipelineState* Pipeline;
+		ID3D12PipelineState* Pipelines[c_ShadowFilterPresetCount]; // Permutation per shadow filter preset
+		u32 ShadowFilter;
 		dx12_index_buffer IndexBuffer;
 		dx12_vertex_buffer VertexBuffers[FIF];
 		quad_vertex* VertexDataBase;
 		quad_vertex* VertexDataPtr;
+		u32* Indices; // CPU copy of the index buffer
 		u32 IndexCount;
+
+		// Stream layout: [shared by both passes][main pass only][shadow pass only], cascades draw their ShadowPass.Draws
+		u32 MainIndexCount;
 		ID3D12RootSignature* RootSignature;
 		quad_root_signature_constant_buffer RootSignatureBuffer;
 	} Quad;
 
+	// World
+	block_world* BlockWorld;
+	u32 TerrainSeed;
+	occlusion_culler* Occlusion;
+	entity_store Entities;
+	transform_hierarchy Hierarchy;
+
+	struct
+	{
+		entity_handle EyeDebug;
+		entity_handle CameraDebug;
+		entity_handle RotatingCube;
+		entity_handle Ground;
+
+		// Axis gizmo that follows the light
+		transform_node EyeGizmo;
+		transform_node EyeGizmoAxes[3];
+		entity_handle EyeGizmoEntities[3];
+	} Scene;
+
 	// Light stuff
 	light_environment LightEnvironment;
 	dx12_constant_buffer LightEnvironmentConstantBuffers[FIF];
+	light_store LightStore;
+	dx12_constant_buffer PointLightBuffers[FIF]; // Upload heap, read as a structured buffer (t6). Only what changed is written
+	u32 AnimatedLights;
+	u32 UploadedLights;
+	light_tree LightTree;
+	light_clusters* LightClusters; // U cycles the light budget per cluster
+	dx12_constant_buffer LightClusterBuffers[FIF]; // Upload heap, read as a structured buffer (t5)
+	irradiance_probes* IrradianceProbes; // Traced a few milliseconds per frame, G centers them on the camera
+	dx12_constant_buffer IrradianceProbeBuffers[FIF]; // Upload heap, read as a structured buffer (t7). Only written after the probes changed
+	u32 IrradianceProbeRevisions[FIF];
+
+	// B spawns animated lights around the camera and removes them again
+	light_handle* LightSwarm; // c_LightSwarmSize
+	u32 LightSwarmCount;
 
 	// Shadows
 	struct
 	{
-		ID3D12Resource* ShadowMaps[FIF];
-		D3D12_CPU_DESCRIPTOR_HANDLE DSVHandles[FIF];
-		D3D12_CPU_DESCRIPTOR_HANDLE SRVHandles[FIF];
-		ID3D12PipelineState* Pipeline;
+		ID3D12Resource* ShadowMaps[FIF]; // Texture array, slice per cascade
+		D3D12_CPU_DESCRIPTOR_HANDLE DSVHandles[FIF][c_MaxShadowCascades];
+		ID3D12PipelineState* Pipeline;      // Cascades and the static cache, c_CascadeDSVFormat
+		ID3D12PipelineState* AtlasPipeline; // Point shadow atlas and virtual pool, D32
 		ID3D12RootSignature* RootSignature;
 		ID3D12DescriptorHeap* DSVDescriptorHeap;
 		ID3D12DescriptorHeap* SRVDescriptorHeap;
 		shadow_pass_root_signature_constant_buffer RootSignatureBuffer;
+
+		cascade_settings CascadeSettings;
+		shadow_cascades Cascades;
+		dx12_constant_buffer CascadeConstantBuffers[FIF];
+
+		shadow_caster* Casters;
+		u32 CasterCount;
+		u32 CasterIndexCount;
+
+		// Compact list per cascade, neighbors merged. Only dynamic casters while the static cache is active
+		shadow_draw* Draws[c_MaxShadowCascades];
+		u32 DrawCounts[c_MaxShadowCascades];
+		u32 DrawIndexCounts[c_MaxShadowCascades];
+
+		// Static casters are rendered into the cache only when a slice is out of date, cascades start as a copy of their slice
+		// Moment presets render everything into the cascades, the copy only carries depth
+		ID3D12Resource* StaticCache; // Texture array, slice per cascade, shared by the frames in flight
+		D3D12_CPU_DESCRIPTOR_HANDLE StaticCacheDSVs[c_MaxShadowCascades];
+		ID3D12PipelineState* CopyPipeline;
+		ID3D12RootSignature* CopyRootSignature;
+		shadow_cache Cache;
+		b32 CacheEnabled; // C toggles
+		b32 CacheActive;  // This frame
+		u32 StaticMask;   // Slices rendered this frame
+		shadow_draw* StaticDraws[c_MaxShadowCascades];
+		u32 StaticDrawCounts[c_MaxShadowCascades];
+		u32 StaticDrawIndexCounts[c_MaxShadowCascades];
+
+		// Reference for the GPU pass, renders the cascades on demand
+		shadow_rasterizer* Rasterizer;
+
+		// Moment shadow maps, only rendered while a VSM/EVSM preset is selected
+		// The depth pass writes the moments next to depth, compute blurs them and builds the mips
+		ID3D12Resource* MomentMaps[FIF];   // RGBA32F texture array with mips, slice per cascade
+		ID3D12Resource* MomentBlurScratch; // Horizontal blur result, mip 0 only
+		D3D12_CPU_DESCRIPTOR_HANDLE MomentRTVHandles[FIF][c_MaxShadowCascades];
+		ID3D12DescriptorHeap* RTVDescriptorHeap;
+		ID3D12PipelineState* MomentPipelines[2]; // VSM, EVSM
+		ID3D12RootSignature* FilterRootSignature;
+		ID3D12PipelineState* BlurPipelines[c_MaxShadowMomentBlurTaps / 2]; // 3, 5, 7 and 9 taps
+		ID3D12PipelineState* DownsamplePipeline;
+		u32 MomentMipCount;
+
+		// Reference for the moment filtering, built from the CPU cascades
+		shadow_moment_map* Moments;
 	} ShadowPass;
+
+	// Point light shadows, six atlas tiles per shadowed light
+	// The atlas is shared by the frames in flight, faces keep their depth until the tracker finds them dirty or the light gets new tiles
+	struct
+	{
+		ID3D12Resource* AtlasTexture;
+		D3D12_CPU_DESCRIPTOR_HANDLE AtlasDSV;
+		shadow_atlas Atlas;
+		shadow_atlas_stats AtlasStats;
+		point_shadow_tracker Tracker;
+		point_shadow_stats Stats;
+
+		// J drops a light at the camera, the oldest one goes once all are placed
+		light_handle Lights[c_MaxPointShadows];
+		u32 LightCount;
+		u32 NextLight;
+	} PointShadows;
+
+	// Virtual shadow map for the directional light, replaces the cascades while enabled
+	// The pool is shared by the frames in flight, pages keep their depth until their casters change or they get evicted
+	struct
+	{
+		ID3D12Resource* Pool;
+		D3D12_CPU_DESCRIPTOR_HANDLE PoolDSV;
+		virtual_shadow_map Map;
+		virtual_shadow_stats Stats;
+		dx12_constant_buffer ConstantBuffers[FIF];
+		dx12_constant_buffer PageTables[FIF]; // Upload heap, read as a structured buffer (t4)
+		b32 Enabled; // V toggles
+	} VirtualShadows;
+
+	// Shadow quality governor, drives the cascade count, shadow distance, filter preset and point shadow resolution while enabled
+	// GPU timestamps per frame in flight: start, shadow passes done, end
+	struct
+	{
+		shadow_governor Governor;
+		b32 Enabled;  // I toggles
+		FILE* Trace;  // X records the samples to c_ShadowGovernorTracePath, for Headless_Shadows to replay
+		ID3D12QueryHeap* QueryHeap;
+		dx12_buffer Readback;
+		f64 TicksPerMillisecond;
+		shadow_timing_sample Sample; // Of the last frame
+	} ShadowQuality;
 };
 
 // Helpers
@@ -103,27 +289,43 @@ D3D12_SHADER_BYTECODE CompileVertexShader(const wchar_t* Path)
 }
 
 
-D3D12_SHADER_BYTECODE CompileFragmentShader(const wchar_t* Path)
+// Defines are "NAME=VALUE" strings, each one compiles a separate permutation
+D3D12_SHADER_BYTECODE CompileShader(const wchar_t* Path, const wchar_t* Profile, const wchar_t* EntryPoint, const wchar_t* const* Defines, u32 DefineCount)
 {
-	IDxcBlob* PixelShader = nullptr;
+	IDxcBlob* Shader = nullptr;
 
 #if defined(_DEBUG)
-	LPCWSTR Arguments[] = {
-	   L"-T", L"ps_6_0",  // Shader profile
-	   L"-E", L"PSMain", // Entry point
+	LPCWSTR BaseArguments[] = {
+	   L"-T", Profile,    // Shader profile
+	   L"-E", EntryPoint, // Entry point
 	   L"-Zi",            // Debug info
 	   L"-Qembed_debug",  // Embed debug info
 	   L"-IResources"
 	};
 #else
-	LPCWSTR Arguments[] = {
-	   L"-T", L"ps_6_0",  // Shader profile
-	   L"-E", L"PSMain", // Entry point
+	LPCWSTR BaseArguments[] = {
+	   L"-T", Profile,    // Shader profile
+	   L"-E", EntryPoint, // Entry point
 	   L"-IResources"
 	   //L"-Zi",            // Debug info
 	   //L"-Qembed_debug",  // Embed debug info
 	};
 #endif
+
+	constexpr u32 MaxDefines = 8;
+	Assert(DefineCount <= MaxDefines, "Too many shader defines");
+
+	LPCWSTR Arguments[CountOf(BaseArguments) + MaxDefines * 2];
+	u32 ArgumentCount = 0;
+	for (LPCWSTR Argument : BaseArguments)
+		Arguments[ArgumentCount++] = Argument;
+
+	for (u32 i = 0; i < DefineCount; i++)
+	{
+		Arguments[ArgumentCount++] = L"-D";
+		Arguments[ArgumentCount++] = Defines[i];
+	}
+
 	// Initialize DXC
 	IDxcCompiler3* Compiler;
 	IDxcLibrary* Library;
@@ -143,7 +345,7 @@ D3D12_SHADER_BYTECODE CompileFragmentShader(const wchar_t* Path)
 	Buffer.Size = SourceShader->GetBufferSize();
 
 	IDxcResult* Result;
-	DxAssert(Compiler->Compile(&Buffer, Arguments, CountOf(Arguments), IncludeHandler, IID_PPV_ARGS(&Result)));
+	DxAssert(Compiler->Compile(&Buffer, Arguments, ArgumentCount, IncludeHandler, IID_PPV_ARGS(&Result)));
 
 	HRESULT ErrorCode;
 	Result->GetStatus(&ErrorCode);
@@ -159,33 +361,18 @@ D3D12_SHADER_BYTECODE CompileFragmentShader(const wchar_t* Path)
 	}
 	else
 	{
-		Result->GetResult(&PixelShader);
+		Result->GetResult(&Shader);
 	}
 
-	return { PixelShader->GetBufferPointer(), PixelShader->GetBufferSize() };
+	return { Shader->GetBufferPointer(), Shader->GetBufferSize() };
 }
 
-internal std::vector<glm::vec4> getFrustumCornersWorldSpace(const glm::mat4& proj, const glm::mat4& view)
+D3D12_SHADER_BYTECODE CompileFragmentShader(const wchar_t* Path, const wchar_t* const* Defines = nullptr, u32 DefineCount = 0, const wchar_t* EntryPoint = L"PSMain")
 {
-	const auto inv = glm::inverse(proj * view);
-
-	std::vector<glm::vec4> frustumCorners;
-	for (unsigned int x = 0; x < 2; ++x)
-	{
-		for (unsigned int y = 0; y < 2; ++y)
-		{
-			for (unsigned int z = 0; z < 2; ++z)
-			{
-				const glm::vec4 pt =
-					inv * glm::vec4(
-						2.0f * x - 1.0f,
-						2.0f * y - 1.0f,
-						2.0f * z - 1.0f,
-						1.0f);
-				frustumCorners.push_back(pt / pt.w);
-			}
-		}
-	}
+	return CompileShader(Path, L"ps_6_0", EntryPoint, Defines, DefineCount);
+}
 
-	return frustumCorners;
-}
\ No newline at end of file
+D3D12_SHADER_BYTECODE CompileComputeShader(const wchar_t* Path, const wchar_t* EntryPoint, const wchar_t* const* Defines = nullptr, u32 DefineCount = 0)
+{
+	return CompileShader(Path, L"cs_6_0", EntryPoint, Defines, DefineCount);
+}
@@ -0,0 +1,245 @@
+#pragma once
+
+// Entity store
+// Components live in parallel dense arrays (structure of arrays), so every stage streams over exactly the data it needs.
+// Handles stay valid while other entities come and go, they point to a slot which maps to the current dense index.
+// Destroying swaps the last entity into the hole, dense arrays never have gaps.
+//
+// Transform stage reads Position/Rotation/Scale/LocalBounds of dirty entities and writes WorldMatrix/WorldBounds,
+// culling reads WorldBounds, expansion reads WorldMatrix/Color.
+
+enum class entity_flags : u32
+{
+	None = 0,
+	Static = 1 << 0,      // Does not move after creation, later systems may cache anything derived from it
+	CastsShadow = 1 << 1,
+	Debug = 1 << 2,       // Visualization helpers
+	ExternalTransform = 1 << 3, // World matrix is written by someone else (transform hierarchy), the transform stage leaves it alone
+};
+
+ENABLE_BITWISE_OPERATORS(entity_flags, u32)
+
+enum entity_dirty : u8
+{
+	EntityDirty_Transform = 1 << 0,
+};
+
+struct entity_handle
+{
+	u32 Slot;
+	u32 Generation; // 0 is never valid, so a zeroed handle is a null handle
+};
+
+struct entity_store
+{
+	u32 Capacity;
+	u32 Count;
+
+	// Dense, [0, Count)
+	v3* Positions;
+	v3* Rotations; // Euler angles, same as D3D12PushCube always took
+	v3* Scales;
+	v4* Colors;    // Multiplies the face colors
+	entity_flags* Flags;
+	aabb* LocalBounds;
+	u8* Dirty;     // entity_dirty bits
+
+	m4* WorldMatrices;
+	aabb* WorldBounds;
+
+	u32* DenseToSlot;
+
+	// Sparse, [0, Capacity)
+	u32* SlotToDense; // Next free slot while the slot is unused
+	u32* Generations;
+	u32 FreeSlot;
+	u32 SlotCount;
+};
+
+internal void Entities_Initialize(entity_store* Store, u32 Capacity);
+internal entity_handle Entities_Create(entity_store* Store, v3 Position, v3 Rotation, v3 Scale, v4 Color = v4(1.0f), entity_flags Flags = entity_flags::CastsShadow);
+internal void Entities_Destroy(entity_store* Store, entity_handle Handle);
+internal bool Entities_IsValid(const entity_store* Store, entity_handle Handle);
+internal u32 Entities_GetIndex(const entity_store* Store, entity_handle Handle);
+
+internal void Entities_SetPosition(entity_store* Store, entity_handle Handle, v3 Position);
+internal void Entities_SetRotation(entity_store* Store, entity_handle Handle, v3 Rotation);
+internal void Entities_SetScale(entity_store* Store, entity_handle Handle, v3 Scale);
+internal void Entities_SetColor(entity_store* Store, entity_handle Handle, v4 Color);
+internal void Entities_SetWorldTransform(entity_store* Store, entity_handle Handle, const m4& WorldMatrix, const aabb& WorldBounds);
+
+// Recomputes world matrices and bounds of dirty entities, clears the transform dirty bit
+internal u32 Entities_UpdateTransforms(entity_store* Store);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+inline constexpr u32 c_InvalidEntitySlot = 0xFFFFFFFF;
+
+internal void Entities_Initialize(entity_store* Store, u32 Capacity)
+{
+	Store->Capacity = Capacity;
+	Store->Count = 0;
+
+	Store->Positions = VmAllocArray(v3, Capacity);
+	Store->Rotations = VmAllocArray(v3, Capacity);
+	Store->Scales = VmAllocArray(v3, Capacity);
+	Store->Colors = VmAllocArray(v4, Capacity);
+	Store->Flags = VmAllocArray(entity_flags, Capacity);
+	Store->LocalBounds = VmAllocArray(aabb, Capacity);
+	Store->Dirty = VmAllocArray(u8, Capacity);
+	Store->WorldMatrices = VmAllocArray(m4, Capacity);
+	Store->WorldBounds = VmAllocArray(aabb, Capacity);
+	Store->DenseToSlot = VmAllocArray(u32, Capacity);
+
+	Store->SlotToDense = VmAllocArray(u32, Capacity);
+	Store->Generations = VmAllocArray(u32, Capacity);
+	Store->FreeSlot = c_InvalidEntitySlot;
+	Store->SlotCount = 0;
+}
+
+internal entity_handle Entities_Create(entity_store* Store, v3 Position, v3 Rotation, v3 Scale, v4 Color, entity_flags Flags)
+{
+	Assert(Store->Count < Store->Capacity, "Entity store is full!");
+
+	u32 Slot;
+	if (Store->FreeSlot != c_InvalidEntitySlot)
+	{
+		Slot = Store->FreeSlot;
+		Store->FreeSlot = Store->SlotToDense[Slot];
+	}
+	else
+	{
+		Slot = Store->SlotCount++;
+	}
+
+	if (Store->Generations[Slot] == 0)
+		Store->Generations[Slot] = 1;
+
+	u32 Index = Store->Count++;
+	Store->SlotToDense[Slot] = Index;
+	Store->DenseToSlot[Index] = Slot;
+
+	Store->Positions[Index] = Position;
+	Store->Rotations[Index] = Rotation;
+	Store->Scales[Index] = Scale;
+	Store->Colors[Index] = Color;
+	Store->Flags[Index] = Flags;
+	Store->LocalBounds[Index] = { v3(-0.5f), v3(0.5f) }; // Unit cube
+	Store->Dirty[Index] = EntityDirty_Transform;
+
+	return { Slot, Store->Generations[Slot] };
+}
+
+internal bool Entities_IsValid(const entity_store* Store, entity_handle Handle)
+{
+	return Handle.Generation != 0 && Handle.Slot < Store->SlotCount && Store->Generations[Handle.Slot] == Handle.Generation;
+}
+
+internal u32 Entities_GetIndex(const entity_store* Store, entity_handle Handle)
+{
+	Assert(Entities_IsValid(Store, Handle), "Invalid entity handle!");
+	return Store->SlotToDense[Handle.Slot];
+}
+
+internal void Entities_Destroy(entity_store* Store, entity_handle Handle)
+{
+	if (!Entities_IsValid(Store, Handle))
+		return;
+
+	u32 Index = Store->SlotToDense[Handle.Slot];
+	u32 Last = --Store->Count;
+
+	// Swap-remove, the last entity fills the hole
+	if (Index != Last)
+	{
+		Store->Positions[Index] = Store->Positions[Last];
+		Store->Rotations[Index] = Store->Rotations[Last];
+		Store->Scales[Index] = Store->Scales[Last];
+		Store->Colors[Index] = Store->Colors[Last];
+		Store->Flags[Index] = Store->Flags[Last];
+		Store->LocalBounds[Index] = Store->LocalBounds[Last];
+		Store->Dirty[Index] = Store->Dirty[Last];
+		Store->WorldMatrices[Index] = Store->WorldMatrices[Last];
+		Store->WorldBounds[Index] = Store->WorldBounds[Last];
+
+		u32 MovedSlot = Store->DenseToSlot[Last];
+		Store->DenseToSlot[Index] = MovedSlot;
+		Store->SlotToDense[MovedSlot] = Index;
+	}
+
+	// Old handles die with the generation, skip 0 on wrap around
+	if (++Store->Generations[Handle.Slot] == 0)
+		Store->Generations[Handle.Slot] = 1;
+
+	Store->SlotToDense[Handle.Slot] = Store->FreeSlot;
+	Store->FreeSlot = Handle.Slot;
+}
+
+internal void Entities_SetPosition(entity_store* Store, entity_handle Handle, v3 Position)
+{
+	u32 Index = Entities_GetIndex(Store, Handle);
+	Store->Positions[Index] = Position;
+	Store->Dirty[Index] |= EntityDirty_Transform;
+}
+
+internal void Entities_SetRotation(entity_store* Store, entity_handle Handle, v3 Rotation)
+{
+	u32 Index = Entities_GetIndex(Store, Handle);
+	Store->Rotations[Index] = Rotation;
+	Store->Dirty[Index] |= EntityDirty_Transform;
+}
+
+internal void Entities_SetScale(entity_store* Store, entity_handle Handle, v3 Scale)
+{
+	u32 Index = Entities_GetIndex(Store, Handle);
+	Store->Scales[Index] = Scale;
+	Store->Dirty[Index] |= EntityDirty_Transform;
+}
+
+internal void Entities_SetColor(entity_store* Store, entity_handle Handle, v4 Color)
+{
+	u32 Index = Entities_GetIndex(Store, Handle);
+	Store->Colors[Index] = Color;
+}
+
+internal void Entities_SetWorldTransform(entity_store* Store, entity_handle Handle, const m4& WorldMatrix, const aabb& WorldBounds)
+{
+	u32 Index = Entities_GetIndex(Store, Handle);
+	Assert((Store->Flags[Index] & entity_flags::ExternalTransform) != entity_flags::None, "Entity does not have an external transform!");
+
+	Store->WorldMatrices[Index] = WorldMatrix;
+	Store->WorldBounds[Index] = WorldBounds;
+}
+
+internal u32 Entities_UpdateTransforms(entity_store* Store)
+{
+	std::atomic<u32> Updated = 0;
+
+	// Big batches, most entities are clean and skipping them is just a byte compare
+	JobSystem_ParallelFor(&g_Jobs, Store->Count, 16 * 1024, [Store, &Updated](u32 Begin, u32 End)
+	{
+		u32 Count = 0;
+		for (u32 i = Begin; i < End; i++)
+		{
+			if (!(Store->Dirty[i] & EntityDirty_Transform) || (Store->Flags[i] & entity_flags::ExternalTransform) != entity_flags::None)
+				continue;
+
+			m4 Transform = glm::translate(m4(1.0f), Store->Positions[i])
+				* glm::toMat4(qtn(Store->Rotations[i]))
+				* glm::scale(m4(1.0f), Store->Scales[i]);
+
+			Store->WorldMatrices[i] = Transform;
+			Store->WorldBounds[i] = AABB_Transform(Store->LocalBounds[i], Transform);
+			Store->Dirty[i] &= ~EntityDirty_Transform;
+			Count++;
+		}
+
+		Updated.fetch_add(Count, std::memory_order_relaxed);
+	});
+
+	return Updated.load();
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+// Frustum corners and fitting
+// Nothing allocates, callers pass in the inverse matrices they usually already have and get the corners in fixed arrays.
+// The 8-wide variants process up to 8 frusta at once (cascade splits, split views), lane i is frustum i.
+//
+// Corner i has bit 0 set for max x, bit 1 for max y and bit 2 for the far plane, in NDC.
+
+#include "SIMD.h"
+
+inline constexpr u32 c_FrustumCornerCount = 8;
+
+struct bounding_sphere
+{
+	v3 Center;
+	f32 Radius;
+};
+
+// NDC depth is [0, 1]
+internal void Frustum_GetCorners(const m4& InverseViewProjection, v3* Corners);
+
+// Perspective camera slice between view depths Near and Far, no matrix inverse needed
+internal void Frustum_GetSliceCorners(const m4& InverseView, f32 TanHalfFOV, f32 AspectRatio, f32 Near, f32 Far, v3* Corners);
+
+internal bounding_sphere Frustum_FitSphere(const v3* Corners);
+
+// Box around the corners in the space of Transform (usually a light view), Transform has to be affine
+internal aabb Frustum_FitBounds(const v3* Corners, const m4& Transform);
+
+internal void Frustum_GetSliceCorners8(const m4& InverseView, f32 TanHalfFOV, f32 AspectRatio, f32x8 Near, f32x8 Far, v3x8* Corners);
+internal void Frustum_FitSpheres8(const v3x8* Corners, v3x8* Center, f32x8* Radius);
+internal void Frustum_FitBounds8(const v3x8* Corners, const m4& Transform, v3x8* Min, v3x8* Max);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+internal void Frustum_GetCorners(const m4& InverseViewProjection, v3* Corners)
+{
+	// Inverse * (x, y, z, 1) is a sum of columns, so corners are just adds
+	const m4& M = InverseViewProjection;
+	v4 X[2] = { M[3] - M[0], M[3] + M[0] };
+	v4 Y[2] = { -M[1], M[1] };
+	v4 Z[2] = { v4(0.0f), M[2] };
+
+	for (u32 i = 0; i < c_FrustumCornerCount; i++)
+	{
+		v4 Corner = X[i & 1] + Y[(i >> 1) & 1] + Z[i >> 2];
+		Corners[i] = v3(Corner) / Corner.w;
+	}
+}
+
+// Directions of the four frustum edges, scaled so that view depth 1 is at the end
+internal void Frustum_GetEdgeDirections(const m4& InverseView, f32 TanHalfFOV, f32 AspectRatio, v3* Directions)
+{
+	v3 Right = v3(InverseView[0]) * (TanHalfFOV * AspectRatio);
+	v3 Up = v3(InverseView[1]) * TanHalfFOV;
+	v3 Forward = v3(InverseView[2]);
+
+	Directions[0] = Forward - Right - Up;
+	Directions[1] = Forward + Right - Up;
+	Directions[2] = Forward - Right + Up;
+	Directions[3] = Forward + Right + Up;
+}
+
+internal void Frustum_GetSliceCorners(const m4& InverseView, f32 TanHalfFOV, f32 AspectRatio, f32 Near, f32 Far, v3* Corners)
+{
+	v3 Origin = v3(InverseView[3]);
+	v3 Directions[4];
+	Frustum_GetEdgeDirections(InverseView, TanHalfFOV, AspectRatio, Directions);
+
+	for (u32 i = 0; i < 4; i++)
+	{
+		Corners[i] = Origin + Directions[i] * Near;
+		Corners[i + 4] = Origin + Directions[i] * Far;
+	}
+}
+
+internal bounding_sphere Frustum_FitSphere(const v3* Corners)
+{
+	v3 Center(0.0f);
+	for (u32 i = 0; i < c_FrustumCornerCount; i++)
+		Center += Corners[i];
+
+	Center /= (f32)c_FrustumCornerCount;
+
+	f32 RadiusSquared = 0.0f;
+	for (u32 i = 0; i < c_FrustumCornerCount; i++)
+		RadiusSquared = glm::max(RadiusSquared, glm::dot(Corners[i] - Center, Corners[i] - Center));
+
+	return { Center, glm::sqrt(RadiusSquared) };
+}
+
+internal aabb Frustum_FitBounds(const v3* Corners, const m4& Transform)
+{
+	aabb Bounds = { v3(FLT_MAX), v3(-FLT_MAX) };
+
+	for (u32 i = 0; i < c_FrustumCornerCount; i++)
+	{
+		v3 Corner = v3(Transform * v4(Corners[i], 1.0f));
+		Bounds.Min = glm::min(Bounds.Min, Corner);
+		Bounds.Max = glm::max(Bounds.Max, Corner);
+	}
+
+	return Bounds;
+}
+
+internal void Frustum_GetSliceCorners8(const m4& InverseView, f32 TanHalfFOV, f32 AspectRatio, f32x8 Near, f32x8 Far, v3x8* Corners)
+{
+	v3x8 Origin = V3x8(v3(InverseView[3]));
+	v3 Directions[4];
+	Frustum_GetEdgeDirections(InverseView, TanHalfFOV, AspectRatio, Directions);
+
+	for (u32 i = 0; i < 4; i++)
+	{
+		v3x8 Direction = V3x8(Directions[i]);
+		Corners[i] = { MulAdd(Direction.X, Near, Origin.X), MulAdd(Direction.Y, Near, Origin.Y), MulAdd(Direction.Z, Near, Origin.Z) };
+		Corners[i + 4] = { MulAdd(Direction.X, Far, Origin.X), MulAdd(Direction.Y, Far, Origin.Y), MulAdd(Direction.Z, Far, Origin.Z) };
+	}
+}
+
+internal void Frustum_FitSpheres8(const v3x8* Corners, v3x8* Center, f32x8* Radius)
+{
+	v3x8 Sum = Corners[0];
+	for (u32 i = 1; i < c_FrustumCornerCount; i++)
+		Sum = Sum + Corners[i];
+
+	*Center = Sum * F32x8(1.0f / c_FrustumCornerCount);
+
+	f32x8 RadiusSquared = F32x8Zero();
+	for (u32 i = 0; i < c_FrustumCornerCount; i++)
+	{
+		v3x8 Offset = Corners[i] - *Center;
+		RadiusSquared = Max(RadiusSquared, Dot(Offset, Offset));
+	}
+
+	*Radius = Sqrt(RadiusSquared);
+}
+
+internal void Frustum_FitBounds8(const v3x8* Corners, const m4& Transform, v3x8* Min, v3x8* Max)
+{
+	*Min = V3x8(v3(FLT_MAX));
+	*Max = V3x8(v3(-FLT_MAX));
+
+	for (u32 i = 0; i < c_FrustumCornerCount; i++)
+	{
+		f32x8 X, Y, Z, W;
+		TransformPoints(Transform, Corners[i], &X, &Y, &Z, &W);
+
+		*Min = { ::Min(Min->X, X), ::Min(Min->Y, Y), ::Min(Min->Z, Z) };
+		*Max = { ::Max(Max->X, X), ::Max(Max->Y, Y), ::Max(Max->Z, Z) };
+	}
+}
@@ -0,0 +1,1447 @@
+#include "Headless_Shadows.h"
+
+#include "Shadows.h"
+#include "Jobs.h"
+#include "Chunks.h"
+#include "Occlusion.h"
+#include "Entities.h"
+#include "Terrain.h"
+#include "Cascades.h"
+#include "ShadowCache.h"
+#include "ShadowRaster.h"
+#include "ShadowMoments.h"
+#include "ShadowAtlas.h"
+#include "LightStore.h"
+#include "LightTree.h"
+#include "PointShadows.h"
+#include "VirtualShadows.h"
+#include "LightClusters.h"
+#include "ShadowGovernor.h"
+#include "IrradianceProbes.h"
+#include "SoftwareRenderer.h"
+#include "ShadowTracer.h"
+#include "Lightmap.h"
+
+// Headless reference renderer
+// Builds the same scene as D3D12Shadows, renders the cascades with the shadow rasterizer and the main pass with the software renderer,
+// then writes a PPM. No window and no GPU, so it runs on CI and the image can be diffed against a golden one.
+//
+// Usage: Headless_Shadows [Output.ppm] [Width] [Height] [TerrainSeed] [ShadowFilter] [PointLights] [VirtualShadows] [LightBenchmark] [GovernorTrace] [DepthPrecision] [RayTracedShadows] [Lightmap] [IrradianceProbes]
+// ShadowFilter is an index into c_ShadowFilterPresets, or "all" to render every preset as Output_<index>.ppm
+// and print its cost and its error against the most expensive one.
+// PointLights places that many shadowed point lights in a ring in front of the camera. Their cubes get shadow atlas tiles
+// and are tracked twice over the same casters, the second pass has to find nothing dirty.
+// VirtualShadows 1 shades with the virtual shadow map instead of the cascades. Its pages are requested and rendered twice too,
+// the second pass has to render no page.
+// LightBenchmark 1 shades the frame again with 8 up to 4096 animated point lights, with and without the light clusters,
+// and prints the animation, upload and culling time, the lights per pixel and the shading time of both. Then it caps the lights
+// per cluster with the light tree and prints the error of every budget against the full light loop.
+// GovernorTrace is a frame,shadow milliseconds CSV recorded by D3D12Shadows (X key). It is fed to the shadow governor with the
+// default budget and every level change is printed, to tune the governor settings offline. - skips it.
+// DepthPrecision 1 shades the frame again against D16 cascades and prints how much acne and peter panning it adds. Not with VirtualShadows,
+// which shades without the cascades.
+// RayTracedShadows 1 traces shadow rays from every pixel to every light, once over the shadow casters and once over the drawn geometry,
+// and compares them with the shadows the frame was shaded with pixel by pixel. Prints the rays per second and writes both comparisons.
+// Lightmap 1 bakes a lightmap for the chunks in front of the camera, writes it as Output.lightmap and the frame lit by it as
+// Output_lightmap.ppm. Then it places a few blocks, rebakes only what they reach and prints how that compares to a full rebake.
+// IrradianceProbes 1 bakes the probe grid around the camera and writes the frame with its ambient light as Output_probes.ppm. Then it
+// places a few blocks, updates the probes near them a frame budget at a time and prints how that compares to a full rebake.
+// The camera uses reverse Z with an infinite far plane like D3D12Shadows, the culler and the renderer get its forward form.
+
+#define SHADOW_MAP_SIZE 1024
+
+struct headless_caster
+{
+	u32 IndexOffset;
+	u32 IndexCount;
+	aabb Bounds;
+	u64 Key;      // Same keys and revisions as D3D12PushShadowCaster
+	u64 Revision;
+	b32 Static;
+	u32 SliceMask; // Static cache slices it is in
+};
+
+struct headless_shadows_test
+{
+	// Quad stream, same layout as the D3D12 one
+	quad_vertex* VertexDataBase;
+	quad_vertex* VertexDataPtr;
+	u32* Indices;
+	u32 IndexCount;
+	u32 MainIndexCount; // [main pass][shadow pass only]
+
+	headless_caster* Casters;
+	u32 CasterCount;
+	aabb* Receivers; // Virtual shadows request their pages after everything is pushed
+	u32 ReceiverCount;
+
+	block_world* BlockWorld;
+	occlusion_culler* Occlusion;
+	entity_store Entities;
+	entity_handle RotatingCube;
+
+	light_environment LightEnvironment;
+	light_store LightStore;
+	point_light* PointLights; // What the GPU would read, written by LightStore_Upload
+	light_tree LightTree;
+	cascade_settings CascadeSettings;
+	shadow_cascades Cascades;
+
+	shadow_rasterizer* ShadowRasterizer; // Resized between cascades and static cache slices
+	f32* ShadowMap; // Cascade slices, like the texture array
+	shadow_cache ShadowCache;
+	f32* StaticCache; // Static cache slices
+	shadow_moment_map* ShadowMoments;
+	software_renderer* Renderer;
+
+	point_shadow_tracker PointShadows;
+	shadow_atlas Atlas;
+	shadow_rasterizer* PointRasterizer; // Resized to each tile
+	f32* ShadowAtlas;
+
+	virtual_shadow_map VirtualShadows;
+	shadow_rasterizer* PageRasterizer;
+	f32* VirtualShadowPool;
+	virtual_shadow_gpu_page* VirtualShadowPages;
+
+	light_clusters* LightClusters;
+};
+
+internal void Headless_PushCube(headless_shadows_test* Test, const m4& Transform, const v4& Color)
+{
+	Assert(Test->IndexCount < c_MaxQuadIndices, "Test->IndexCount < c_MaxQuadIndices");
+
+	m3 NormalMatrix = m3(glm::transpose(glm::inverse(Transform)));
+
+	for (u32 i = 0; i < CountOf(c_CuboidVerticesPositions); i++)
+	{
+		Test->VertexDataPtr->Position = Transform * c_CuboidVerticesPositions[i];
+		Test->VertexDataPtr->Color = c_CuboidVerticesColor[i] * Color;
+		Test->VertexDataPtr->Normal = NormalMatrix * c_CuboidNormals[i];
+		Test->VertexDataPtr++;
+	}
+
+	Test->IndexCount += 36;
+}
+
+internal void Headless_PushShadowCaster(headless_shadows_test* Test, u32 IndexOffset, const aabb& Bounds, u64 Key, u64 Revision, bool Static)
+{
+	u32 IndexCount = Test->IndexCount - IndexOffset;
+	if (IndexCount == 0)
+		return;
+
+	Assert(Test->CasterCount < c_MaxShadowDraws, "Too many shadow casters!");
+	Test->Casters[Test->CasterCount++] = { IndexOffset, IndexCount, Bounds, Key, Revision, Static, 0 }; // SliceMask comes with the cache update
+}
+
+internal void Headless_AddReceiver(headless_shadows_test* Test, const aabb& Bounds)
+{
+	Cascades_AddReceiver(&Test->Cascades, Bounds);
+
+	Assert(Test->ReceiverCount < c_MaxShadowDraws, "Too many receivers!");
+	Test->Receivers[Test->ReceiverCount++] = Bounds;
+}
+
+internal void Headless_PushEntities(headless_shadows_test* Test)
+{
+	const entity_store* Entities = &Test->Entities;
+
+	for (u32 i = 0; i < Entities->Count; i++)
+	{
+		u32 IndexOffset = Test->IndexCount;
+		Headless_PushCube(Test, Entities->WorldMatrices[i], Entities->Colors[i]);
+
+		Headless_AddReceiver(Test, Entities->WorldBounds[i]);
+
+		if ((Entities->Flags[i] & entity_flags::CastsShadow) != entity_flags::None)
+		{
+			u32 Slot = Entities->DenseToSlot[i];
+			u64 Key = ((u64)Entities->Generations[Slot] << 32) | Slot;
+			bool Static = (Entities->Flags[i] & entity_flags::Static) != entity_flags::None;
+			Headless_PushShadowCaster(Test, IndexOffset, Entities->WorldBounds[i], Key, PointShadows_HashTransform(Entities->WorldMatrices[i]), Static);
+		}
+	}
+}
+
+// Copies already expanded quads into the stream, returns false when they do not fit
+internal bool Headless_PushQuads(headless_shadows_test* Test, const quad_vertex* Vertices, u32 QuadCount)
+{
+	u32 VertexCount = static_cast<u32>(Test->VertexDataPtr - Test->VertexDataBase);
+	if (VertexCount + QuadCount * 4 > c_MaxQuadVertices)
+		return false;
+
+	memcpy(Test->VertexDataPtr, Vertices, sizeof(quad_vertex) * QuadCount * 4);
+	Test->VertexDataPtr += QuadCount * 4;
+	Test->IndexCount += QuadCount * 6;
+	return true;
+}
+
+// Same stream layout as D3D12PushChunks, [shared by both passes][main pass only][shadow pass only]
+internal void Headless_PushChunks(headless_shadows_test* Test)
+{
+	block_world* World = Test->BlockWorld;
+	const occlusion_result* Occlusion = Test->Occlusion->Results;
+	bool Overflow = false;
+
+	auto GetMainMesh = [World, Occlusion](u32 ActiveIndex) -> const chunk_mesh*
+	{
+		if (Occlusion[ActiveIndex] != occlusion_result::Visible)
+			return nullptr;
+
+		u32 ChunkIndex = World->ActiveChunks[ActiveIndex];
+		return BlockWorld_GetMesh(World, ChunkIndex, World->MainLOD[ChunkIndex]);
+	};
+
+	auto PushMesh = [Test, World, &Overflow](const chunk_mesh* Mesh, u32 ChunkIndex, bool CastsShadow)
+	{
+		if (!Mesh || Mesh->QuadCount == 0 || Overflow)
+			return;
+
+		u32 IndexOffset = Test->IndexCount;
+		Overflow = !Headless_PushQuads(Test, Mesh->Vertices, Mesh->QuadCount);
+
+		if (CastsShadow)
+		{
+			u64 Key = (1ull << 63) | ChunkIndex;
+			u64 Revision = ((u64)Mesh->Version << 16) | ((u64)World->ShadowLOD[ChunkIndex].LOD << 8) | World->ShadowLOD[ChunkIndex].Variant;
+			Headless_PushShadowCaster(Test, IndexOffset, Chunk_GetBounds(World->Chunks[ChunkIndex]->Coord), Key, Revision, true);
+		}
+	};
+
+	for (u32 i = 0; i < World->ActiveChunkCount; i++)
+	{
+		u32 ChunkIndex = World->ActiveChunks[i];
+		const chunk_mesh* MainMesh = GetMainMesh(i);
+
+		if (MainMesh)
+			Headless_AddReceiver(Test, Chunk_GetBounds(World->Chunks[ChunkIndex]->Coord));
+
+		if (MainMesh == BlockWorld_GetMesh(World, ChunkIndex, World->ShadowLOD[ChunkIndex]))
+			PushMesh(MainMesh, ChunkIndex, true);
+	}
+
+	for (u32 i = 0; i < World->ActiveChunkCount; i++)
+	{
+		u32 ChunkIndex = World->ActiveChunks[i];
+		const chunk_mesh* MainMesh = GetMainMesh(i);
+		if (MainMesh != BlockWorld_GetMesh(World, ChunkIndex, World->ShadowLOD[ChunkIndex]))
+			PushMesh(MainMesh, ChunkIndex, false);
+	}
+
+	Test->MainIndexCount = Test->IndexCount;
+
+	for (u32 i = 0; i < World->ActiveChunkCount; i++)
+	{
+		u32 ChunkIndex = World->ActiveChunks[i];
+		const chunk_mesh* ShadowMesh = BlockWorld_GetMesh(World, ChunkIndex, World->ShadowLOD[ChunkIndex]);
+		if (ShadowMesh != GetMainMesh(i))
+			PushMesh(ShadowMesh, ChunkIndex, true);
+	}
+
+	if (Overflow)
+		Warn("Quad stream is full, some chunks were not rendered!");
+}
+
+// Cascade by cascade into the slices of the shadow map
+// Static casters go through the shadow cache like on the GPU, only out of date slices are rendered.
+// Cascades get the dynamic casters, then their slice is merged in, which is what the copy pass and the depth test add up to.
+internal void Headless_RenderShadowMaps(headless_shadows_test* Test)
+{
+	shadow_rasterizer* Rasterizer = Test->ShadowRasterizer;
+	shadow_cache* Cache = &Test->ShadowCache;
+
+	Cascades_BuildCasterBounds(&Test->Cascades, Test->CascadeSettings);
+
+	ShadowCache_BeginFrame(Cache, &Test->Cascades);
+	for (u32 i = 0; i < Test->CasterCount; i++)
+	{
+		headless_caster& Caster = Test->Casters[i];
+		Caster.SliceMask = Caster.Static ? ShadowCache_AddStaticCaster(Cache, Caster.Key, Caster.Revision, Caster.Bounds) : 0;
+	}
+	u32 StaticMask = ShadowCache_EndFrame(Cache);
+
+	ShadowRaster_Resize(Rasterizer, (i32)Cache->Size);
+	for (u32 Slice = 0; Slice < Test->Cascades.Count; Slice++)
+	{
+		if (!(StaticMask & (1u << Slice)))
+			continue;
+
+		ShadowRaster_Begin(Rasterizer, Cache->Slices[Slice].ViewProjection, Test->VertexDataBase, Test->Indices);
+
+		for (u32 i = 0; i < Test->CasterCount; i++)
+		{
+			const headless_caster& Caster = Test->Casters[i];
+			if (Caster.SliceMask & (1u << Slice))
+				ShadowRaster_AddDraw(Rasterizer, Caster.IndexOffset, Caster.IndexCount);
+		}
+
+		const shadow_raster_stats& Stats = ShadowRaster_Render(Rasterizer);
+		Trace("Static shadow cache slice %u: %u triangles, %u rasterized, %u dropped | %.2f ms",
+			Slice, Stats.Triangles, Stats.RasterTriangles, Stats.DroppedTriangles, Stats.TotalMilliseconds);
+
+		memcpy(Test->StaticCache + (u64)Slice * Cache->Size * Cache->Size, Rasterizer->Depth, sizeof(f32) * Cache->Size * Cache->Size);
+	}
+
+	ShadowRaster_Resize(Rasterizer, SHADOW_MAP_SIZE);
+	for (u32 Cascade = 0; Cascade < Test->Cascades.Count; Cascade++)
+	{
+		ShadowRaster_Begin(Rasterizer, Test->Cascades.Cascades[Cascade].ViewProjection, Test->VertexDataBase, Test->Indices);
+
+		for (u32 i = 0; i < Test->CasterCount; i++)
+		{
+			const headless_caster& Caster = Test->Casters[i];
+			if (!Caster.Static && (Cascades_GetCasterMask(&Test->Cascades, Caster.Bounds) & (1u << Cascade)))
+				ShadowRaster_AddDraw(Rasterizer, Caster.IndexOffset, Caster.IndexCount);
+		}
+
+		const shadow_raster_stats& Stats = ShadowRaster_Render(Rasterizer);
+		Trace("Shadow cascade %u: %u dynamic triangles, %u rasterized, %u dropped | %.2f ms",
+			Cascade, Stats.Triangles, Stats.RasterTriangles, Stats.DroppedTriangles, Stats.TotalMilliseconds);
+
+		const f32* Slice = Test->StaticCache + (u64)Cascade * Cache->Size * Cache->Size;
+		ShadowCache_Composite(Cache, ShadowCache_GetCopy(Cache, &Test->Cascades, Cascade), Slice, Rasterizer->Depth);
+
+		memcpy(Test->ShadowMap + Cascade * SHADOW_MAP_SIZE * SHADOW_MAP_SIZE, Rasterizer->Depth, sizeof(f32) * SHADOW_MAP_SIZE * SHADOW_MAP_SIZE);
+	}
+
+	Trace("Static shadow cache: %u slices copied, %u rendered after moving, %u after casters changed",
+		Cache->Stats.Copied, Cache->Stats.Recentered, Cache->Stats.CastersChanged);
+	Cache->Stats = {};
+}
+
+// Submits every caster to the tracker and renders the cube faces it finds dirty, clean faces keep their depth
+internal void Headless_RenderPointShadows(headless_shadows_test* Test, const camera& Camera, f32 ViewportHeight)
+{
+	point_shadow_tracker* Tracker = &Test->PointShadows;
+	shadow_rasterizer* Rasterizer = Test->PointRasterizer;
+
+	PointShadows_BeginFrame(Tracker, &Test->LightStore);
+	const shadow_atlas_stats& AtlasStats = PointShadows_AssignTiles(Tracker, &Test->Atlas, &Test->LightStore, &Test->LightEnvironment, Camera, ViewportHeight);
+	for (u32 i = 0; i < Test->CasterCount; i++)
+		PointShadows_SubmitCaster(Tracker, Test->Casters[i].Key, Test->Casters[i].Revision, Test->Casters[i].Bounds);
+	const point_shadow_stats& Stats = PointShadows_EndFrame(Tracker);
+
+	f32 Milliseconds = 0.0f;
+	for (u32 Light = 0; Light < Tracker->LightCount; Light++)
+	{
+		const point_shadow_light& PointLight = Tracker->Lights[Light];
+		const u32 DirtyFaces = PointShadows_GetDirtyFaces(Tracker, Light);
+
+		for (u32 Face = 0; Face < c_PointShadowFaceCount; Face++)
+		{
+			if (!(DirtyFaces & (1u << Face)))
+				continue;
+
+			shadow_atlas_rect Tile = ShadowAtlas_GetRect(&Test->Atlas, Test->Atlas.Owners[Light].Tiles[Face]);
+			ShadowRaster_Resize(Rasterizer, (i32)Tile.Size);
+			ShadowRaster_Begin(Rasterizer, PointShadows_GetFaceViewProjection(PointLight.Position, PointLight.Radius, Face), Test->VertexDataBase, Test->Indices);
+
+			for (u32 i = 0; i < Test->CasterCount; i++)
+			{
+				const headless_caster& Caster = Test->Casters[i];
+				if (PointShadows_GetFaceMask(PointLight.Position, PointLight.Radius, Caster.Bounds) & (1u << Face))
+					ShadowRaster_AddDraw(Rasterizer, Caster.IndexOffset, Caster.IndexCount);
+			}
+
+			Milliseconds += ShadowRaster_Render(Rasterizer).TotalMilliseconds;
+			for (u32 Row = 0; Row < Tile.Size; Row++)
+				memcpy(Test->ShadowAtlas + (u64)(Tile.Y + Row) * c_ShadowAtlasSize + Tile.X, Rasterizer->Depth + Row * Tile.Size, sizeof(f32) * Tile.Size);
+		}
+
+		PointShadows_MarkClean(Tracker, Light, DirtyFaces);
+	}
+
+	Trace("Point shadows: %u lights, %u casters tracked | %u faces rendered, casters %u added, %u moved, %u removed | %.2f ms",
+		Stats.Lights, Stats.TrackedCasters, Stats.DirtyFaces, Stats.AddedCasters, Stats.MovedCasters, Stats.RemovedCasters, Milliseconds);
+	Trace("Shadow atlas: %u lights in %u tiles, %.1f%% used, %.1f%% fragmented, largest free %u | %u reallocated, %u downgraded, %u without room",
+		AtlasStats.Owners, AtlasStats.Tiles, AtlasStats.Occupancy * 100.0f, AtlasStats.Fragmentation * 100.0f, AtlasStats.LargestFreeTile,
+		AtlasStats.Reallocated, AtlasStats.Downgraded, AtlasStats.Failed);
+}
+
+// Requests pages for the receivers, signs them with every caster and renders the dirty ones into the pool
+internal void Headless_RenderVirtualShadows(headless_shadows_test* Test, const camera& Camera, f32 ViewportHeight)
+{
+	virtual_shadow_map* Map = &Test->VirtualShadows;
+	shadow_rasterizer* Rasterizer = Test->PageRasterizer;
+
+	VirtualShadows_BeginFrame(Map, Test->Cascades.LightView, Camera, ViewportHeight);
+	for (u32 i = 0; i < Test->ReceiverCount; i++)
+		VirtualShadows_AddReceiver(Map, Test->Receivers[i]);
+	for (u32 i = 0; i < Test->CasterCount; i++)
+		VirtualShadows_AddCaster(Map, Test->Casters[i].Key, Test->Casters[i].Revision, Test->Casters[i].Bounds);
+	const virtual_shadow_stats& Stats = VirtualShadows_EndFrame(Map);
+
+	f32 Milliseconds = 0.0f;
+	for (u32 i = 0; i < Map->RenderCount; i++)
+	{
+		u32 Page = Map->RenderList[i];
+		ShadowRaster_Begin(Rasterizer, VirtualShadows_GetPageViewProjection(Map, Page), Test->VertexDataBase, Test->Indices);
+
+		for (u32 j = 0; j < Test->CasterCount; j++)
+		{
+			const headless_caster& Caster = Test->Casters[j];
+			if (VirtualShadows_CasterOverlapsPage(Map, Page, Caster.Bounds))
+				ShadowRaster_AddDraw(Rasterizer, Caster.IndexOffset, Caster.IndexCount);
+		}
+
+		Milliseconds += ShadowRaster_Render(Rasterizer).TotalMilliseconds;
+
+		shadow_atlas_rect Rect = VirtualShadows_GetPoolRect(Map->Pages[Page].PhysicalPage);
+		for (u32 Row = 0; Row < Rect.Size; Row++)
+			memcpy(Test->VirtualShadowPool + (u64)(Rect.Y + Row) * c_VirtualShadowPoolSize + Rect.X, Rasterizer->Depth + Row * Rect.Size, sizeof(f32) * Rect.Size);
+	}
+
+	VirtualShadows_GetPageTable(Map, Test->VirtualShadowPages);
+
+	Trace("Virtual shadows: %u pages requested, %u resident, LOD bias %u | %u rendered, %u waiting, %u allocated, %u evicted, %u without room | %.2f ms",
+		Stats.Requested, Stats.Resident, Stats.LodBias, Stats.Rendered, Stats.Waiting, Stats.Allocated, Stats.Evicted, Stats.Overflowed, Milliseconds);
+}
+
+// RMSE in 8 bit levels over the color channels
+internal f64 Headless_GetImageError(const u32* Image, const u32* Reference, u32 PixelCount)
+{
+	f64 SquaredError = 0.0;
+	for (u32 Pixel = 0; Pixel < PixelCount; Pixel++)
+	{
+		for (u32 Channel = 0; Channel < 3; Channel++)
+		{
+			f64 Difference = (f64)((Image[Pixel] >> (Channel * 8)) & 0xFF) - (f64)((Reference[Pixel] >> (Channel * 8)) & 0xFF);
+			SquaredError += Difference * Difference;
+		}
+	}
+
+	return glm::sqrt(SquaredError / (PixelCount * 3.0));
+}
+
+// Unshadowed animated point lights scattered in front of the camera, the frame is shaded with and without clusters for every light count.
+// Without them the lights per pixel grow with the light count, with them they follow how many lights overlap.
+internal void Headless_BenchmarkLightClusters(headless_shadows_test* Test, const camera& Camera, i32 Width, i32 Height)
+{
+	constexpr u32 MaxLights = 4096;
+
+	using clock = std::chrono::high_resolution_clock;
+	software_renderer* Renderer = Test->Renderer;
+	m4 InverseView = glm::inverse(Camera.View);
+
+	light_store Lights;
+	LightStore_Initialize(&Lights, MaxLights);
+	point_light* Packed = VmAllocArray(point_light, Lights.Capacity);
+
+	// Xorshift, same sequence every run
+	u32 State = 2891336453u;
+	auto Random = [&State](f32 Min, f32 Max)
+	{
+		State ^= State << 13;
+		State ^= State >> 17;
+		State ^= State << 5;
+		return Min + (Max - Min) * (State & 0xFFFFFF) / (f32)0xFFFFFF;
+	};
+
+	Trace("Light store and clusters, %ux%ux%u, best of 3 | lights per pixel and shading time without clusters -> with them:", c_LightClustersX, c_LightClustersY, c_LightClustersZ);
+	for (u32 Count = 8; Count <= MaxLights; Count *= 2)
+	{
+		// Adds to the lights of the last count
+		while (Lights.Count < Count)
+		{
+			v3 Position = v3(InverseView * v4(Random(-30.0f, 30.0f), Random(-12.0f, 2.0f), Random(2.0f, 80.0f), 1.0f));
+			v3 Radiance = v3(Random(0.2f, 1.0f), Random(0.2f, 1.0f), Random(0.2f, 1.0f));
+			light_handle Handle = LightStore_Create(&Lights, Position, 8.0f, 1.0f, Radiance, 1.0f);
+
+			light_animation Animation;
+			Animation.Flicker = Random(0.0f, 0.5f);
+			Animation.FlickerRate = Random(2.0f, 10.0f);
+			Animation.OrbitRadius = Random(0.0f, 2.0f);
+			Animation.OrbitRate = Random(-2.0f, 2.0f);
+			Animation.Phase = Random(0.0f, glm::two_pi<f32>());
+			LightStore_SetAnimation(&Lights, Handle, Animation);
+		}
+
+		// Every light moves every frame, so every light is uploaded
+		f32 AnimateMilliseconds = FLT_MAX, UploadMilliseconds = FLT_MAX;
+		u32 Uploaded = 0;
+		for (u32 i = 0; i < 100; i++)
+		{
+			auto Start = clock::now();
+			LightStore_Animate(&Lights, i / 60.0f);
+			auto Animated = clock::now();
+			Uploaded = LightStore_Upload(&Lights, 0, Packed);
+			auto End = clock::now();
+
+			AnimateMilliseconds = glm::min(AnimateMilliseconds, std::chrono::duration<f32, std::milli>(Animated - Start).count());
+			UploadMilliseconds = glm::min(UploadMilliseconds, std::chrono::duration<f32, std::milli>(End - Animated).count());
+		}
+
+		f32 CullMilliseconds = FLT_MAX;
+		light_cluster_stats Stats;
+		for (u32 i = 0; i < 100; i++)
+		{
+			Stats = LightClusters_Build(Test->LightClusters, Camera, (f32)Width, (f32)Height, &Lights, nullptr, &Test->LightEnvironment);
+			CullMilliseconds = glm::min(CullMilliseconds, Stats.CullMilliseconds);
+		}
+
+		software_render_stats Shading[2];
+		for (u32 Clustered = 0; Clustered < 2; Clustered++)
+		{
+			SoftwareRenderer_SetPointLights(Renderer, Packed, Lights.Count);
+			SoftwareRenderer_SetLightClusters(Renderer, Clustered ? Test->LightClusters->Data : nullptr);
+
+			Shading[Clustered] = SoftwareRenderer_Render(Renderer, Test->VertexDataBase, Test->Indices, 0, Test->MainIndexCount);
+			for (u32 i = 1; i < 3; i++)
+			{
+				const software_render_stats& Run = SoftwareRenderer_Render(Renderer, Test->VertexDataBase, Test->Indices, 0, Test->MainIndexCount);
+				Shading[Clustered].ShadeMilliseconds = glm::min(Shading[Clustered].ShadeMilliseconds, Run.ShadeMilliseconds);
+			}
+		}
+
+		f32 PixelCount = (f32)glm::max(Shading[0].ShadedPixels, 1u);
+		Trace("  %4u lights: animate %.3f ms, upload %u in %.3f ms, cull %.3f ms, %u clusters lit, at most %u lights, %u indices | %6.2f -> %5.2f lights per pixel | shading %7.2f -> %6.2f ms",
+			Count, AnimateMilliseconds, Uploaded, UploadMilliseconds, CullMilliseconds, Stats.Clusters, Stats.MaxClusterLights, Stats.Indices,
+			Shading[0].PointLightSamples / PixelCount, Shading[1].PointLightSamples / PixelCount, Shading[0].ShadeMilliseconds, Shading[1].ShadeMilliseconds);
+	}
+
+	// Nothing changed since the last upload, so nothing goes up
+	Trace("  Upload without changes: %u lights", LightStore_Upload(&Lights, 0, Packed));
+
+	// Light tree over the last count
+	light_tree Tree;
+	LightTree_Initialize(&Tree, MaxLights);
+
+	f32 BuildMilliseconds = FLT_MAX, RefitMilliseconds = FLT_MAX;
+	for (u32 i = 0; i < 100; i++)
+	{
+		auto Start = clock::now();
+		LightTree_Build(&Tree, &Lights, Camera.View);
+		auto Built = clock::now();
+		LightTree_Refit(&Tree, &Lights, Camera.View);
+		auto End = clock::now();
+
+		BuildMilliseconds = glm::min(BuildMilliseconds, std::chrono::duration<f32, std::milli>(Built - Start).count());
+		RefitMilliseconds = glm::min(RefitMilliseconds, std::chrono::duration<f32, std::milli>(End - Built).count());
+	}
+
+	// The full light loop is the reference, the clusters without a budget have to match it
+	const u32 PixelCount = (u32)(Width * Height);
+	u32* Reference = VmAllocArray(u32, PixelCount);
+	SoftwareRenderer_SetLightClusters(Renderer, nullptr);
+	SoftwareRenderer_Render(Renderer, Test->VertexDataBase, Test->Indices, 0, Test->MainIndexCount);
+	memcpy(Reference, Renderer->Color, sizeof(u32) * PixelCount);
+
+	Trace("Light tree, %u lights, build %.3f ms, refit %.3f ms | error against the full light loop, RMSE in 8 bit levels:", Lights.Count, BuildMilliseconds, RefitMilliseconds);
+	const u32 Budgets[] = { 0, 256, 128, 64, 32, 16, 8 };
+	for (u32 Budget : Budgets)
+	{
+		Test->LightClusters->LightBudget = Budget;
+		const light_cluster_stats& Stats = LightClusters_Build(Test->LightClusters, Camera, (f32)Width, (f32)Height, &Lights, &Tree, &Test->LightEnvironment);
+		SoftwareRenderer_SetLightClusters(Renderer, Test->LightClusters->Data);
+
+		software_render_stats Shading = SoftwareRenderer_Render(Renderer, Test->VertexDataBase, Test->Indices, 0, Test->MainIndexCount);
+		f64 Error = Headless_GetImageError(Renderer->Color, Reference, PixelCount);
+		for (u32 i = 1; i < 3; i++)
+			Shading.ShadeMilliseconds = glm::min(Shading.ShadeMilliseconds, SoftwareRenderer_Render(Renderer, Test->VertexDataBase, Test->Indices, 0, Test->MainIndexCount).ShadeMilliseconds);
+
+		f32 ShadedPixels = (f32)glm::max(Shading.ShadedPixels, 1u);
+		Trace("  budget %3u: cull %.3f ms, %u clusters over it, %u lights left out, at most %u lights | %6.2f lights per pixel | shading %6.2f ms | RMSE %.3f",
+			Budget, Stats.CullMilliseconds, Stats.BudgetClusters, Stats.BudgetDropped, Budget ? glm::min(Budget, Stats.MaxClusterLights) : Stats.MaxClusterLights,
+			Shading.PointLightSamples / ShadedPixels, Shading.ShadeMilliseconds, Error);
+	}
+
+	Test->LightClusters->LightBudget = 0;
+	VmFree(Reference);
+	LightTree_Destroy(&Tree);
+	LightStore_Destroy(&Lights);
+	VmFree(Packed);
+
+	// Back to the frame
+	LightTree_Update(&Test->LightTree, &Test->LightStore, Camera.View);
+	LightClusters_Build(Test->LightClusters, Camera, (f32)Width, (f32)Height, &Test->LightStore, &Test->LightTree, &Test->LightEnvironment);
+	SoftwareRenderer_SetPointLights(Renderer, Test->PointLights, Test->LightStore.Count);
+}
+
+// Moments for the VSM/EVSM presets, rebuilt only when the representation or the blur changes
+internal void Headless_BuildShadowMoments(headless_shadows_test* Test, const shadow_filter_preset& Preset)
+{
+	shadow_moment_map* Moments = Test->ShadowMoments;
+	if (!ShadowFilter_UsesMoments(Preset.Filter) || (Moments->Filter == Preset.Filter && Moments->BlurTaps == Preset.Taps))
+		return;
+
+	for (u32 Cascade = 0; Cascade < Test->Cascades.Count; Cascade++)
+	{
+		const shadow_moment_stats& Stats = ShadowMoments_BuildSlice(Moments, Cascade, Test->ShadowMap + Cascade * SHADOW_MAP_SIZE * SHADOW_MAP_SIZE, Preset.Filter, Preset.Taps);
+		Trace("Shadow moments %u (%s): convert %.2f ms, blur %.2f ms, mips %.2f ms, total %.2f ms",
+			Cascade, Preset.Name, Stats.ConvertMilliseconds, Stats.BlurMilliseconds, Stats.MipMilliseconds, Stats.TotalMilliseconds);
+	}
+}
+
+// Shading against D16 cascades, which the D3D12 path can store them in, compared to the D32 frame the renderer just drew.
+// Pixels that turn darker are acne, depth steps closer than the receiver. Pixels that turn brighter lost a shadow to the larger
+// bias, peter panning, or lost acne the D32 bias only just let through. Once with the D32 bias and once with the depth step
+// Cascades_Fit adds for D16
+internal void Headless_MeasureDepthPrecision(headless_shadows_test* Test, const camera& Camera, v3 LightDirection, u32 IndexCount)
+{
+	software_renderer* Renderer = Test->Renderer;
+	if (ShadowFilter_UsesMoments(c_ShadowFilterPresets[Renderer->Settings.ShadowFilter].Filter))
+	{
+		Trace("Shadow depth precision: moment filters read the moment maps, the depth format does not reach them");
+		return;
+	}
+
+	if (Renderer->VirtualShadows.Enabled)
+	{
+		Trace("Shadow depth precision: the frame was shaded with the virtual shadow map, whose pool is always D32. Run it without VirtualShadows");
+		return;
+	}
+
+	const u32 PixelCount = (u32)(Renderer->Width * Renderer->Height);
+	u32* Reference = VmAllocArray(u32, PixelCount);
+	memcpy(Reference, Renderer->Color, sizeof(u32) * PixelCount);
+
+	// What D16 slices read back, the GPU also rounds a second time when it copies the static cache
+	const u64 TexelCount = (u64)c_MaxShadowCascades * SHADOW_MAP_SIZE * SHADOW_MAP_SIZE;
+	f32* Quantized = VmAllocArray(f32, TexelCount);
+	for (u64 i = 0; i < TexelCount; i++)
+		Quantized[i] = ShadowDepth_Store(Test->ShadowMap[i], shadow_depth_format::D16);
+
+	cascade_settings Settings = Test->CascadeSettings;
+	Settings.DepthFormat = shadow_depth_format::D16;
+	shadow_cascades Cascades16;
+	Cascades_Fit(&Cascades16, Settings, Camera, LightDirection);
+
+	Trace("Shadow depth precision, cascades %.1f MB in D32, %.1f MB in D16:", TexelCount * 4.0f / (1024 * 1024), TexelCount * 2.0f / (1024 * 1024));
+	for (u32 i = 0; i < Test->Cascades.Count; i++)
+	{
+		const shadow_cascade& Cascade = Test->Cascades.Cascades[i];
+		f32 Range = Cascade.LightSpaceBounds.Max.z - Cascade.LightSpaceBounds.Min.z;
+		Trace("  cascade %u: %6.1f m deep, texel %.1f mm | bias %.1f mm and up, D16 adds %.2f mm",
+			i, Range, Cascade.TexelSize * 1000.0f, Cascade.DepthBias * Range * 1000.0f, Cascades16.DepthStepBias * Range * 1000.0f);
+	}
+
+	const shadow_cascades* Biases[2] = { &Test->Cascades, &Cascades16 };
+	const char* BiasNames[2] = { "D32 bias", "D16 bias" };
+	for (u32 Variant = 0; Variant < 2; Variant++)
+	{
+		shadow_cascade_constants Constants;
+		Cascades_GetConstants(Biases[Variant], &Constants);
+		SoftwareRenderer_SetShadowMap(Renderer, Constants, Quantized, SHADOW_MAP_SIZE);
+		SoftwareRenderer_Render(Renderer, Test->VertexDataBase, Test->Indices, 0, IndexCount);
+
+		// Luma, a few levels of difference are filtering noise
+		u32 Darker = 0, Brighter = 0;
+		for (u32 Pixel = 0; Pixel < PixelCount; Pixel++)
+		{
+			u32 A = Renderer->Color[Pixel], B = Reference[Pixel];
+			i32 LumaA = (i32)(((A & 0xFF) * 77 + ((A >> 8) & 0xFF) * 150 + ((A >> 16) & 0xFF) * 29) >> 8);
+			i32 LumaB = (i32)(((B & 0xFF) * 77 + ((B >> 8) & 0xFF) * 150 + ((B >> 16) & 0xFF) * 29) >> 8);
+			Darker += LumaA < LumaB - 2;
+			Brighter += LumaA > LumaB + 2;
+		}
+
+		f32 Shaded = (f32)glm::max(Renderer->Stats.ShadedPixels, 1u);
+		Trace("  D16 with the %s: %.3f%% darker, %.3f%% brighter of %u shaded pixels | RMSE %.3f",
+			BiasNames[Variant], Darker * 100.0f / Shaded, Brighter * 100.0f / Shaded, Renderer->Stats.ShadedPixels,
+			Headless_GetImageError(Renderer->Color, Reference, PixelCount));
+	}
+
+	shadow_cascade_constants Constants;
+	Cascades_GetConstants(&Test->Cascades, &Constants);
+	SoftwareRenderer_SetShadowMap(Renderer, Constants, Test->ShadowMap, SHADOW_MAP_SIZE);
+	memcpy(Renderer->Color, Reference, sizeof(u32) * PixelCount);
+
+	VmFree(Quantized);
+	VmFree(Reference);
+}
+
+// Prints how the shadows a frame was shaded with differ from traced ones, plane by plane. A pixel counts as darker when it was shaded
+// more than half a shadow darker than the rays say, acne or a light that has no shadow map. Brighter is the other way around, peter
+// panning and light leaking through the filter
+internal void Headless_CompareShadowMasks(const f32* Rasterized, const f32* Traced, u32 PixelCount, u32 PlaneCount)
+{
+	for (u32 Plane = 0; Plane < PlaneCount; Plane++)
+	{
+		const f32* A = Rasterized + (u64)Plane * PixelCount;
+		const f32* B = Traced + (u64)Plane * PixelCount;
+
+		// Both reach the same pixels from the same normals, unless the light clusters left a light out
+		u32 Reached = 0, Unmatched = 0, Darker = 0, Brighter = 0;
+		f64 Error = 0.0;
+		for (u32 Pixel = 0; Pixel < PixelCount; Pixel++)
+		{
+			if (A[Pixel] < 0.0f || B[Pixel] < 0.0f)
+			{
+				Unmatched += (A[Pixel] < 0.0f) != (B[Pixel] < 0.0f);
+				continue;
+			}
+
+			Reached++;
+			Darker += A[Pixel] - B[Pixel] > 0.5f;
+			Brighter += B[Pixel] - A[Pixel] > 0.5f;
+			Error += glm::abs(A[Pixel] - B[Pixel]);
+		}
+
+		char Name[32];
+		if (Plane + 1 < PlaneCount)
+			snprintf(Name, sizeof(Name), "directional %u", Plane);
+		else
+			snprintf(Name, sizeof(Name), "point lights");
+
+		f32 Percent = 100.0f / (f32)glm::max(Reached, 1u);
+		Trace("    %-14s %u pixels reached, %.3f%% darker, %.3f%% brighter | mean error %.4f, %u reached by one side only",
+			Name, Reached, Darker * Percent, Brighter * Percent, Reached ? Error / Reached : 0.0, Unmatched);
+	}
+}
+
+// Traced shadow of the first directional light in gray, darker pixels in red and brighter ones in blue. Through the color target
+// like the frame itself, which is put back afterwards
+internal bool Headless_WriteShadowMaskPPM(software_renderer* Renderer, const f32* Rasterized, const f32* Traced, const char* Path)
+{
+	const u32 PixelCount = (u32)(Renderer->Width * Renderer->Height);
+	u32* Frame = VmAllocArray(u32, PixelCount);
+	memcpy(Frame, Renderer->Color, sizeof(u32) * PixelCount);
+
+	for (u32 Pixel = 0; Pixel < PixelCount; Pixel++)
+	{
+		f32 Rays = Traced[Pixel], Shaded = Rasterized[Pixel];
+		u32 Gray = Rays < 0.0f ? 32 : (u32)(255.0f - Rays * 160.0f);
+		u32 Color = Gray | (Gray << 8) | (Gray << 16);
+		if (Rays >= 0.0f && Shaded >= 0.0f && Shaded - Rays > 0.5f)
+			Color = 0x0000FF;
+		else if (Rays >= 0.0f && Shaded >= 0.0f && Rays - Shaded > 0.5f)
+			Color = 0xFF0000;
+		Renderer->Color[Pixel] = Color | 0xFF000000;
+	}
+
+	bool Written = SoftwareRenderer_WritePPM(Renderer, Path);
+	memcpy(Renderer->Color, Frame, sizeof(u32) * PixelCount);
+	VmFree(Frame);
+	return Written;
+}
+
+// Shadow rays against the shadows of the frame the renderer just drew, over two sets of triangles. The shadow casters are what the
+// shadow maps were rendered from, so what is left is bias, filtering and resolution. The drawn geometry has every chunk at the LOD
+// the main pass draws it with, this is the ground truth. The casters only differ from it past ShadowBiasDistance, where chunks cast
+// shadows with their coarser shadow LOD. Occluded chunks receive nothing on screen and keep their shadow LOD there.
+// Writes Output_rays_casters.ppm and Output_rays_drawn.ppm
+internal bool Headless_TraceReferenceShadows(headless_shadows_test* Test, const char* OutputPath)
+{
+	software_renderer* Renderer = Test->Renderer;
+	block_world* World = Test->BlockWorld;
+	const u32 PixelCount = (u32)(Renderer->Width * Renderer->Height);
+	const u32 PlaneCount = SoftwareRenderer_GetShadowMaskPlanes(Test->LightEnvironment);
+
+	// The same frame again for the mask, shading does not change
+	f32* Rasterized = VmAllocArray(f32, (u64)PixelCount * PlaneCount);
+	f32* Traced = VmAllocArray(f32, (u64)PixelCount * PlaneCount);
+	SoftwareRenderer_SetShadowMask(Renderer, Rasterized);
+	SoftwareRenderer_Render(Renderer, Test->VertexDataBase, Test->Indices, 0, Test->MainIndexCount);
+	SoftwareRenderer_SetShadowMask(Renderer, nullptr);
+
+	// Drawn geometry, copied into a stream of its own
+	quad_vertex* Vertices = VmAllocArray(quad_vertex, c_MaxQuadVertices);
+	u32 QuadCount = 0;
+	auto PushQuads = [Vertices, &QuadCount](const quad_vertex* Source, u32 Count)
+	{
+		Count = glm::min(Count, c_MaxQuads - QuadCount);
+		memcpy(Vertices + QuadCount * 4, Source, sizeof(quad_vertex) * Count * 4);
+		QuadCount += Count;
+	};
+
+	for (u32 i = 0; i < Test->CasterCount; i++)
+	{
+		const headless_caster& Caster = Test->Casters[i];
+		if (!(Caster.Key >> 63))
+			PushQuads(Test->VertexDataBase + Caster.IndexOffset / 6 * 4, Caster.IndexCount / 6);
+	}
+
+	for (u32 i = 0; i < World->ActiveChunkCount; i++)
+	{
+		u32 ChunkIndex = World->ActiveChunks[i];
+		bool Visible = Test->Occlusion->Results[i] == occlusion_result::Visible;
+		const chunk_mesh* Mesh = BlockWorld_GetMesh(World, ChunkIndex, Visible ? World->MainLOD[ChunkIndex] : World->ShadowLOD[ChunkIndex]);
+		if (Mesh)
+			PushQuads(Mesh->Vertices, Mesh->QuadCount);
+	}
+
+	shadow_tracer* Tracer = VmAllocArray(shadow_tracer, 1);
+	ShadowTracer_Initialize(Tracer, c_MaxQuads * 2);
+
+	const char* Names[2] = { "shadow casters", "drawn geometry" };
+	const char* Suffixes[2] = { "casters", "drawn" };
+	bool Written = true;
+	for (u32 Variant = 0; Variant < 2 && Written; Variant++)
+	{
+		if (Variant == 0)
+		{
+			ShadowTracer_Begin(Tracer, Test->VertexDataBase, Test->Indices);
+			for (u32 i = 0; i < Test->CasterCount; i++)
+				ShadowTracer_AddDraw(Tracer, Test->Casters[i].IndexOffset, Test->Casters[i].IndexCount);
+		}
+		else
+		{
+			ShadowTracer_Begin(Tracer, Vertices, Test->Indices);
+			ShadowTracer_AddDraw(Tracer, 0, QuadCount * 6);
+		}
+
+		const shadow_tracer_stats& BuildStats = ShadowTracer_Build(Tracer);
+		const shadow_tracer_stats& Stats = ShadowTracer_TraceMask(Tracer, Renderer, Traced);
+		Trace("Shadow rays over the %s: %u triangles, %u dropped, %u nodes, depth %u, built in %.2f ms | %llu rays for %u pixels in %.2f ms, %.2f Mrays/s on %u threads",
+			Names[Variant], BuildStats.Triangles, BuildStats.DroppedTriangles, BuildStats.Nodes, BuildStats.Depth, BuildStats.BuildMilliseconds,
+			(unsigned long long)Stats.Rays, Stats.Pixels, Stats.TraceMilliseconds, Stats.TraceMilliseconds > 0.0f ? Stats.Rays / (Stats.TraceMilliseconds * 1000.0f) : 0.0f,
+			JobSystem_GetWorkerCount(&g_Jobs) + 1);
+
+		Headless_CompareShadowMasks(Rasterized, Traced, PixelCount, PlaneCount);
+
+		// Output.ppm -> Output_rays_<variant>.ppm
+		char Path[512];
+		const char* Extension = strrchr(OutputPath, '.');
+		i32 StemLength = Extension ? (i32)(Extension - OutputPath) : (i32)strlen(OutputPath);
+		snprintf(Path, sizeof(Path), "%.*s_rays_%s%s", StemLength, OutputPath, Suffixes[Variant], Extension ? Extension : ".ppm");
+		Written = Headless_WriteShadowMaskPPM(Renderer, Rasterized, Traced, Path);
+	}
+
+	ShadowTracer_Destroy(Tracer);
+	VmFree(Tracer);
+	VmFree(Vertices);
+	VmFree(Traced);
+	VmFree(Rasterized);
+	return Written;
+}
+
+internal void Headless_TraceLightmapStats(const char* Name, const lightmap_stats& Stats)
+{
+	Trace("%s: %u chunks, %u faces, %u texels, %u lights with %u in the mask | geometry %u triangles, %u dropped in %.2f ms | %llu rays in %.2f ms, %.2f Mrays/s on %u threads | total %.2f ms",
+		Name, Stats.Chunks, Stats.Faces, Stats.Texels, Stats.Lights, Stats.MaskLights, Stats.Triangles, Stats.DroppedTriangles, Stats.GeometryMilliseconds,
+		(unsigned long long)Stats.Rays, Stats.TraceMilliseconds, Stats.TraceMilliseconds > 0.0f ? Stats.Rays / (Stats.TraceMilliseconds * 1000.0f) : 0.0f,
+		JobSystem_GetWorkerCount(&g_Jobs) + 1, Stats.TotalMilliseconds);
+}
+
+// The frame lit by the lightmap alone: the baked irradiance plus the direct light of the mask lights through their mask channel,
+// no shadow map. Surfaces outside of the lightmap keep their shading. Through the color target, which is put back afterwards
+internal bool Headless_WriteLightmapPPM(software_renderer* Renderer, const lightmap* Lightmap, const char* Path)
+{
+	const u32 PixelCount = (u32)(Renderer->Width * Renderer->Height);
+	u32* Frame = VmAllocArray(u32, PixelCount);
+	memcpy(Frame, Renderer->Color, sizeof(u32) * PixelCount);
+
+	for (i32 Y = 0; Y < Renderer->Height; Y++)
+	{
+		for (i32 X = 0; X < Renderer->Width; X += c_SimdWidth)
+		{
+			v3x8 WorldPosition, Normal, Color;
+			f32x8 Covered = SoftwareRenderer_GetSurface(Renderer, X, Y, &WorldPosition, &Normal, &Color);
+
+			alignas(32) f32 Lanes[9][c_SimdWidth];
+			f32x8 Values[9] = { WorldPosition.X, WorldPosition.Y, WorldPosition.Z, Normal.X, Normal.Y, Normal.Z, Color.X, Color.Y, Color.Z };
+			for (u32 i = 0; i < 9; i++)
+				F32x8Store(Lanes[i], Values[i]);
+
+			u32 CoveredMask = MoveMask(Covered);
+			for (u32 i = 0; i < c_SimdWidth; i++)
+			{
+				v3 Position = v3(Lanes[0][i], Lanes[1][i], Lanes[2][i]);
+				v3 SurfaceNormal = v3(Lanes[3][i], Lanes[4][i], Lanes[5][i]);
+
+				v3 Irradiance;
+				f32 Mask[c_LightmapMaskChannels];
+				if (!(CoveredMask & (1u << i)) || !Lightmap_Sample(Lightmap, Position, SurfaceNormal, &Irradiance, Mask))
+					continue;
+
+				for (u32 Channel = 0; Channel < Lightmap->MaskLightCount; Channel++)
+				{
+					const lightmap_light& Light = Lightmap->Lights[Channel];
+
+					v3x8 Direction;
+					f32x8 Distance;
+					f32x8 Weight = Lightmap_GetLightWeight(Light, V3x8(Position), V3x8(SurfaceNormal), &Direction, &Distance);
+					Irradiance += Light.Diffuse * (HorizontalMax(Weight) * Mask[Channel]);
+				}
+
+				v3 Result = glm::clamp(v3(Lanes[6][i], Lanes[7][i], Lanes[8][i]) * Irradiance, v3(0.0f), v3(1.0f)) * 255.0f + 0.5f;
+				Renderer->Color[Y * Renderer->Width + X + i] = (u32)Result.x | ((u32)Result.y << 8) | ((u32)Result.z << 16) | 0xFF000000;
+			}
+		}
+	}
+
+	bool Written = SoftwareRenderer_WritePPM(Renderer, Path);
+	memcpy(Renderer->Color, Frame, sizeof(u32) * PixelCount);
+	VmFree(Frame);
+	return Written;
+}
+
+// Bakes the chunks the camera looks at, writes the lightmap and the frame lit by it, then places a pillar on the ground in front of
+// the camera and rebakes only what it reaches. A full rebake afterwards shows what the incremental one missed, texels of the chunks
+// both bake are the same by construction. The pillar is removed again at the end.
+internal bool Headless_BakeLightmap(headless_shadows_test* Test, v3 CameraPosition, const char* OutputPath)
+{
+	block_world* World = Test->BlockWorld;
+
+	v3i CameraChunk, Local;
+	BlockWorld_SplitBlock(BlockWorld_WorldToBlock(CameraPosition), &CameraChunk, &Local);
+
+	lightmap* Lightmap = VmAllocArray(lightmap, 1);
+	lightmap_settings Settings = Lightmap_GetDefaultSettings();
+	Settings.Samples = 32;
+	Lightmap_Initialize(Lightmap, Settings, v3i(CameraChunk.x - 1, 0, CameraChunk.z), v3i(CameraChunk.x + 2, c_WorldChunksY, CameraChunk.z + 2), Test->LightStore.Capacity);
+
+	Headless_TraceLightmapStats("Lightmap bake", Lightmap_Bake(Lightmap, World, Test->LightEnvironment, &Test->LightStore));
+
+	// Output.ppm -> Output.lightmap and Output_lightmap.ppm
+	char Path[512];
+	const char* Extension = strrchr(OutputPath, '.');
+	i32 StemLength = Extension ? (i32)(Extension - OutputPath) : (i32)strlen(OutputPath);
+	snprintf(Path, sizeof(Path), "%.*s.lightmap", StemLength, OutputPath);
+	bool Written = Lightmap_Write(Lightmap, Path);
+
+	snprintf(Path, sizeof(Path), "%.*s_lightmap%s", StemLength, OutputPath, Extension ? Extension : ".ppm");
+	Written = Written && Headless_WriteLightmapPPM(Test->Renderer, Lightmap, Path);
+
+	// Pillar on the ground where the point light ring is
+	v3i Pillar = BlockWorld_WorldToBlock(CameraPosition + v3(0.0f, 0.0f, 14.0f));
+	for (i32 Y = c_WorldBlockMin.y + c_WorldChunksY * c_ChunkSize - 1; Y >= c_WorldBlockMin.y; Y--)
+	{
+		if (BlockWorld_GetBlock(World, v3i(Pillar.x, Y, Pillar.z)) != 0)
+		{
+			Pillar.y = Y + 1;
+			break;
+		}
+	}
+
+	constexpr i32 PillarHeight = 4;
+	u32 Invalidated = 0;
+	for (i32 i = 0; i < PillarHeight; i++)
+	{
+		BlockWorld_SetBlock(World, Pillar + v3i(0, i, 0), 6);
+		Invalidated += Lightmap_InvalidateBlock(Lightmap, Pillar + v3i(0, i, 0));
+	}
+
+	const lightmap_stats Incremental = Lightmap_Bake(Lightmap, World, Test->LightEnvironment, &Test->LightStore);
+	Headless_TraceLightmapStats("Lightmap rebake", Incremental);
+
+	// Keep the incremental result and bake everything again
+	u32 TexelsPerTile = Settings.TexelsPerFace * Settings.TexelsPerFace;
+	lightmap_chunk* Kept = VmAllocArray(lightmap_chunk, c_WorldChunkCount);
+	for (u32 i = 0; i < c_WorldChunkCount; i++)
+	{
+		const lightmap_chunk& Chunk = Lightmap->Chunks[i];
+		Kept[i] = Chunk;
+		if (Chunk.FaceCount == 0)
+			continue;
+
+		Kept[i].Irradiance = VmAllocArray(v3, (u64)Chunk.FaceCount * TexelsPerTile);
+		Kept[i].Mask = VmAllocArray(u32, (u64)Chunk.FaceCount * TexelsPerTile);
+		memcpy(Kept[i].Irradiance, Chunk.Irradiance, sizeof(v3) * Chunk.FaceCount * TexelsPerTile);
+		memcpy(Kept[i].Mask, Chunk.Mask, sizeof(u32) * Chunk.FaceCount * TexelsPerTile);
+	}
+
+	Lightmap_InvalidateAll(Lightmap);
+	const lightmap_stats& Full = Lightmap_Bake(Lightmap, World, Test->LightEnvironment, &Test->LightStore);
+
+	u32 Texels = 0, Differ = 0;
+	f32 MaxIrradiance = 0.0f;
+	u32 MaxMask = 0;
+	for (u32 i = 0; i < c_WorldChunkCount; i++)
+	{
+		const lightmap_chunk& Chunk = Lightmap->Chunks[i];
+		for (u32 Texel = 0; Texel < Chunk.FaceCount * TexelsPerTile; Texel++)
+		{
+			f32 Irradiance = glm::compMax(glm::abs(Chunk.Irradiance[Texel] - Kept[i].Irradiance[Texel]));
+			u32 Mask = 0;
+			for (u32 Channel = 0; Channel < c_LightmapMaskChannels; Channel++)
+				Mask = glm::max(Mask, (u32)glm::abs((i32)((Chunk.Mask[Texel] >> (Channel * 8)) & 0xFF) - (i32)((Kept[i].Mask[Texel] >> (Channel * 8)) & 0xFF)));
+
+			Texels++;
+			Differ += Irradiance > 0.0f || Mask > 0;
+			MaxIrradiance = glm::max(MaxIrradiance, Irradiance);
+			MaxMask = glm::max(MaxMask, Mask);
+		}
+
+		if (Kept[i].FaceCount > 0)
+		{
+			VmFree(Kept[i].Irradiance);
+			VmFree(Kept[i].Mask);
+		}
+	}
+
+	Trace("Lightmap rebake after %d blocks: %u chunks invalidated, %.2f ms against %.2f ms for all %u chunks | %u of %u texels differ from the full rebake, by up to %.4f irradiance and %u mask levels",
+		PillarHeight, Invalidated, Incremental.TotalMilliseconds, Full.TotalMilliseconds, Full.Chunks, Differ, Texels, MaxIrradiance, MaxMask);
+
+	for (i32 i = 0; i < PillarHeight; i++)
+		BlockWorld_SetBlock(World, Pillar + v3i(0, i, 0), 0);
+
+	VmFree(Kept);
+	Lightmap_Destroy(Lightmap);
+	VmFree(Lightmap);
+	return Written;
+}
+
+internal void Headless_TraceIrradianceProbeStats(const char* Name, const irradiance_probe_stats& Stats)
+{
+	Trace("%s: %u probes, %u enabled, %u batches, %u left in the queue, %u chunks changed | %llu rays in %.2f ms, %.2f Mrays/s on %u threads",
+		Name, Stats.Probes, Stats.EnabledProbes, Stats.Batches, Stats.Queued, Stats.ChangedChunks, (unsigned long long)Stats.Rays, Stats.Milliseconds,
+		Stats.Milliseconds > 0.0f ? Stats.Rays / (Stats.Milliseconds * 1000.0f) : 0.0f, JobSystem_GetWorkerCount(&g_Jobs) + 1);
+}
+
+// Bakes the probes around the ground the camera looks at and renders the frame with them. Then places a pillar there and updates
+// the probes a frame budget at a time until the queue is empty, like D3D12Shadows does. A full rebake afterwards shows how far the
+// incremental result is off, also where the pillar's change did not reach. The pillar is removed again at the end.
+internal bool Headless_BakeIrradianceProbes(headless_shadows_test* Test, v3 CameraPosition, const char* OutputPath)
+{
+	block_world* World = Test->BlockWorld;
+	software_renderer* Renderer = Test->Renderer;
+
+	irradiance_probes* Probes = VmAllocArray(irradiance_probes, 1);
+	IrradianceProbes_Initialize(Probes, IrradianceProbes_GetDefaultSettings(), CameraPosition + v3(0.0f, -16.0f, 16.0f));
+	Headless_TraceIrradianceProbeStats("Irradiance probe bake", IrradianceProbes_Bake(Probes, World, Test->LightEnvironment));
+
+	// Output.ppm -> Output_probes.ppm
+	char Path[512];
+	const char* Extension = strrchr(OutputPath, '.');
+	i32 StemLength = Extension ? (i32)(Extension - OutputPath) : (i32)strlen(OutputPath);
+	snprintf(Path, sizeof(Path), "%.*s_probes%s", StemLength, OutputPath, Extension ? Extension : ".ppm");
+
+	light_environment Environment = Test->LightEnvironment;
+	Environment.IrradianceProbeGrid = IrradianceProbes_GetGrid(Probes);
+	SoftwareRenderer_SetConstants(Renderer, Renderer->Constants, Environment);
+	SoftwareRenderer_SetIrradianceProbes(Renderer, Probes->Probes);
+
+	const software_render_stats& RenderStats = SoftwareRenderer_Render(Renderer, Test->VertexDataBase, Test->Indices, 0, Test->MainIndexCount);
+	Trace("Main pass with irradiance probes: %u pixels shaded | shading %.2f ms, total %.2f ms", RenderStats.ShadedPixels, RenderStats.ShadeMilliseconds, RenderStats.TotalMilliseconds);
+	bool Written = SoftwareRenderer_WritePPM(Renderer, Path);
+
+	SoftwareRenderer_SetConstants(Renderer, Renderer->Constants, Test->LightEnvironment);
+	SoftwareRenderer_SetIrradianceProbes(Renderer, nullptr);
+
+	// Pillar on the ground where the point light ring is
+	v3i Pillar = BlockWorld_WorldToBlock(CameraPosition + v3(0.0f, 0.0f, 14.0f));
+	for (i32 Y = c_WorldBlockMin.y + c_WorldChunksY * c_ChunkSize - 1; Y >= c_WorldBlockMin.y; Y--)
+	{
+		if (BlockWorld_GetBlock(World, v3i(Pillar.x, Y, Pillar.z)) != 0)
+		{
+			Pillar.y = Y + 1;
+			break;
+		}
+	}
+
+	constexpr i32 PillarHeight = 4;
+	for (i32 i = 0; i < PillarHeight; i++)
+		BlockWorld_SetBlock(World, Pillar + v3i(0, i, 0), 6);
+
+	// Frames until the queue is empty, the first one finds the changed chunks
+	constexpr f32 Budget = c_DefaultIrradianceProbeBudget;
+	u32 Frames = 0, Updated = 0, ChangedChunks = 0;
+	f32 Milliseconds = 0.0f, MaxMilliseconds = 0.0f;
+	do
+	{
+		const irradiance_probe_stats& Stats = IrradianceProbes_Update(Probes, World, Test->LightEnvironment, Budget);
+		Frames++;
+		Updated += Stats.Probes;
+		ChangedChunks += Stats.ChangedChunks;
+		Milliseconds += Stats.Milliseconds;
+		MaxMilliseconds = glm::max(MaxMilliseconds, Stats.Milliseconds);
+	} while (Probes->QueueCount > 0);
+
+	// Keep the incremental result and bake everything again
+	irradiance_probe_gpu* Kept = VmAllocArray(irradiance_probe_gpu, c_IrradianceProbeCount);
+	memcpy(Kept, Probes->Probes, sizeof(irradiance_probe_gpu) * c_IrradianceProbeCount);
+	const irradiance_probe_stats& Full = IrradianceProbes_Bake(Probes, World, Test->LightEnvironment);
+
+	// Average irradiance over all normals is the first coefficient times the first basis function
+	u32 Differ = 0;
+	f32 MaxDifference = 0.0f;
+	for (u32 i = 0; i < c_IrradianceProbeCount; i++)
+	{
+		f32 Difference = 0.0f;
+		for (u32 Channel = 0; Channel < 3; Channel++)
+			Difference = glm::max(Difference, glm::abs(IrradianceProbes_Unpack(Probes->Probes[i], Channel) - IrradianceProbes_Unpack(Kept[i], Channel)) * 0.282095f);
+
+		Differ += Difference > 0.01f;
+		MaxDifference = glm::max(MaxDifference, Difference);
+	}
+
+	Trace("Irradiance probe update after %d blocks: %u chunks changed, %u probes in %u frames of %.1f ms, %.2f ms in all and %.2f ms in the longest frame, against %.2f ms for a full rebake | %u of %u probes differ by more than 0.01 from it, by up to %.4f",
+		PillarHeight, ChangedChunks, Updated, Frames, Budget, Milliseconds, MaxMilliseconds, Full.Milliseconds, Differ, c_IrradianceProbeCount, MaxDifference);
+
+	for (i32 i = 0; i < PillarHeight; i++)
+		BlockWorld_SetBlock(World, Pillar + v3i(0, i, 0), 0);
+
+	VmFree(Kept);
+	IrradianceProbes_Destroy(Probes);
+	VmFree(Probes);
+	return Written;
+}
+
+// Same samples, same decisions, the governor only sees what it is given
+internal bool Headless_ReplayGovernorTrace(const char* Path)
+{
+#if defined(_WIN32)
+	FILE* File = nullptr;
+	fopen_s(&File, Path, "r");
+#else
+	FILE* File = fopen(Path, "r");
+#endif
+
+	if (!File)
+	{
+		Err("Could not open %s!", Path);
+		return false;
+	}
+
+	shadow_governor Governor;
+	ShadowGovernor_Initialize(&Governor, ShadowGovernor_GetDefaultSettings(c_DefaultShadowBudget));
+
+	char Line[128];
+	while (fgets(Line, sizeof(Line), File))
+	{
+		shadow_timing_sample Sample;
+		if (sscanf(Line, "%f,%f", &Sample.FrameMilliseconds, &Sample.ShadowMilliseconds) != 2)
+			continue;
+
+		shadow_governor_decision Decision = ShadowGovernor_Update(&Governor, Sample);
+		if (Decision == shadow_governor_decision::Lower || Decision == shadow_governor_decision::Raise)
+		{
+			const shadow_quality& Quality = ShadowGovernor_GetQuality(&Governor);
+			Trace("  frame %5u: %s to level %u at %.2f ms (shadows %.2f ms) | %u cascades of %u, %.0f distance, %s, point tiles %u",
+				Governor.Stats.Frames, ShadowGovernor_GetDecisionName(Decision), Governor.Level, Governor.Stats.FrameMilliseconds, Governor.Stats.ShadowMilliseconds,
+				Quality.CascadeCount, Quality.CascadeResolution, Quality.MaxDistance, c_ShadowFilterPresets[Quality.ShadowFilter].Name, Quality.PointTileSize);
+		}
+	}
+
+	fclose(File);
+
+	const shadow_governor_stats& Stats = Governor.Stats;
+	Trace("Shadow governor, %.1f ms budget: %u frames, %u over budget, %u lowered, %u raised, level %u at the end",
+		Governor.Settings.BudgetMilliseconds, Stats.Frames, Stats.FramesOverBudget, Stats.Lowered, Stats.Raised, Stats.Level);
+	return true;
+}
+
+int main(int ArgumentCount, char** Arguments)
+{
+	const char* OutputPath = ArgumentCount > 1 ? Arguments[1] : "Headless_Shadows.ppm";
+	i32 Width = ArgumentCount > 2 ? atoi(Arguments[2]) : 1280;
+	i32 Height = ArgumentCount > 3 ? atoi(Arguments[3]) : 720;
+	u32 Seed = ArgumentCount > 4 ? (u32)atoi(Arguments[4]) : 0;
+	bool AllFilters = ArgumentCount > 5 && strcmp(Arguments[5], "all") == 0;
+	u32 ShadowFilter = (ArgumentCount > 5 && !AllFilters) ? glm::min((u32)atoi(Arguments[5]), c_ShadowFilterPresetCount - 1) : c_DefaultShadowFilter;
+	u32 PointLightCount = ArgumentCount > 6 ? glm::min((u32)atoi(Arguments[6]), c_MaxPointShadows) : 0;
+	bool UseVirtualShadows = ArgumentCount > 7 && atoi(Arguments[7]) != 0;
+	bool LightBenchmark = ArgumentCount > 8 && atoi(Arguments[8]) != 0;
+	const char* GovernorTrace = (ArgumentCount > 9 && strcmp(Arguments[9], "-") != 0) ? Arguments[9] : nullptr;
+	bool DepthPrecision = ArgumentCount > 10 && atoi(Arguments[10]) != 0;
+	bool RayTracedShadows = ArgumentCount > 11 && atoi(Arguments[11]) != 0;
+	bool BakeLightmap = ArgumentCount > 12 && atoi(Arguments[12]) != 0;
+	bool BakeIrradianceProbes = ArgumentCount > 13 && atoi(Arguments[13]) != 0;
+
+	Width = (glm::max(Width, 8) + c_SimdWidth - 1) & ~(i32)(c_SimdWidth - 1);
+	Height = glm::max(Height, 1);
+
+	Trace("Hello, Headless Blocky! %dx%d, seed %u -> %s", Width, Height, Seed, OutputPath);
+
+	JobSystem_Initialize(&g_Jobs);
+
+	headless_shadows_test* Test = VmAllocArray(headless_shadows_test, 1);
+	Test->VertexDataBase = VmAllocArray(quad_vertex, c_MaxQuadVertices);
+	Test->VertexDataPtr = Test->VertexDataBase;
+	Test->Casters = VmAllocArray(headless_caster, c_MaxShadowDraws);
+	Test->Receivers = VmAllocArray(aabb, c_MaxShadowDraws);
+
+	// Quad index buffer
+	{
+		Test->Indices = VmAllocArray(u32, c_MaxQuadIndices);
+		u32 Offset = 0;
+		for (u32 i = 0; i < c_MaxQuadIndices; i += 6)
+		{
+			Test->Indices[i + 0] = Offset + 0;
+			Test->Indices[i + 1] = Offset + 1;
+			Test->Indices[i + 2] = Offset + 2;
+
+			Test->Indices[i + 3] = Offset + 2;
+			Test->Indices[i + 4] = Offset + 3;
+			Test->Indices[i + 5] = Offset + 0;
+
+			Offset += 4;
+		}
+	}
+
+	Test->ShadowRasterizer = VmAllocArray(shadow_rasterizer, 1);
+	ShadowRaster_Initialize(Test->ShadowRasterizer, SHADOW_MAP_SIZE + 2 * c_ShadowCacheBorder, c_MaxQuads * 2);
+	Test->ShadowMap = VmAllocArray(f32, c_MaxShadowCascades * SHADOW_MAP_SIZE * SHADOW_MAP_SIZE);
+	ShadowCache_Initialize(&Test->ShadowCache, SHADOW_MAP_SIZE, c_ShadowCacheBorder);
+	Test->StaticCache = VmAllocArray(f32, (u64)c_MaxShadowCascades * Test->ShadowCache.Size * Test->ShadowCache.Size);
+	Test->ShadowMoments = VmAllocArray(shadow_moment_map, 1);
+	ShadowMoments_Initialize(Test->ShadowMoments, SHADOW_MAP_SIZE, c_MaxShadowCascades);
+	Test->CascadeSettings = Cascades_GetDefaultSettings(SHADOW_MAP_SIZE);
+
+	PointShadows_Initialize(&Test->PointShadows, 16 * 1024);
+	ShadowAtlas_Initialize(&Test->Atlas, c_ShadowAtlasSize, c_ShadowAtlasMinTile);
+	Test->PointRasterizer = VmAllocArray(shadow_rasterizer, 1);
+	ShadowRaster_Initialize(Test->PointRasterizer, c_ShadowAtlasMaxTile, c_MaxQuads * 2);
+	Test->ShadowAtlas = VmAllocArray(f32, (u64)c_ShadowAtlasSize * c_ShadowAtlasSize);
+
+	// Every page renders in one frame here, there is no frame time to spread them over
+	virtual_shadow_settings VirtualSettings = VirtualShadows_GetDefaultSettings((f32)c_WorldBlockMin.y, (f32)(c_WorldBlockMin.y + c_WorldChunksY * c_ChunkSize));
+	VirtualSettings.MaxPageRenders = c_VirtualShadowPoolPageCount;
+	VirtualShadows_Initialize(&Test->VirtualShadows, VirtualSettings);
+	Test->PageRasterizer = VmAllocArray(shadow_rasterizer, 1);
+	ShadowRaster_Initialize(Test->PageRasterizer, c_VirtualShadowPageSize, c_MaxQuads * 2);
+	Test->VirtualShadowPool = VmAllocArray(f32, (u64)c_VirtualShadowPoolSize * c_VirtualShadowPoolSize);
+	Test->VirtualShadowPages = VmAllocArray(virtual_shadow_gpu_page, c_VirtualShadowTableSize);
+
+	Test->LightClusters = VmAllocArray(light_clusters, 1);
+	LightStore_Initialize(&Test->LightStore, c_MaxPointShadows);
+	Test->PointLights = VmAllocArray(point_light, Test->LightStore.Capacity);
+	LightTree_Initialize(&Test->LightTree, Test->LightStore.Capacity);
+
+	Test->Renderer = VmAllocArray(software_renderer, 1);
+	SoftwareRenderer_Initialize(Test->Renderer, Width, Height, c_MaxQuads * 2);
+
+	// Same camera and light as D3D12Shadows at startup
+	v3 CameraPosition(0, 6, -10);
+	v3 CameraRotation(glm::pi<f32>() / 4, 0, 0);
+	v3 Eye = v3(-2.0f, 3.0f, 0.0f);
+	v3 LightDirection = glm::normalize(-Eye);
+
+	// World
+	{
+		Test->BlockWorld = VmAllocArray(block_world, 1);
+		block_world* World = Test->BlockWorld;
+		BlockWorld_Initialize(World);
+
+		Test->Occlusion = VmAllocArray(occlusion_culler, 1);
+		OcclusionCuller_Initialize(Test->Occlusion);
+
+		v3i CameraChunk, Local;
+		BlockWorld_SplitBlock(BlockWorld_WorldToBlock(CameraPosition), &CameraChunk, &Local);
+
+		// Quarter of the G key region and no caves, so everything fits the quad stream and the image does not depend on chunk order
+		v3i Min = v3i(CameraChunk.x - 4, 0, CameraChunk.z - 4);
+		v3i Max = v3i(CameraChunk.x + 4, c_WorldChunksY, CameraChunk.z + 4);
+
+		terrain_settings Settings = Terrain_GetDefaultSettings(Seed);
+		Settings.Caves = false;
+
+		terrain_stats Stats = Terrain_Generate(World, Settings, Min, Max);
+		Trace("Terrain (seed %u): %u chunks, %llu solid blocks | %.2f ms", Seed, Stats.ChunksFilled, (unsigned long long)Stats.SolidBlocks, Stats.TotalMilliseconds);
+
+		// Generated terrain easily buries the default camera, lift it above the ground under it
+		v3i Block = BlockWorld_WorldToBlock(CameraPosition);
+		for (i32 Y = c_WorldBlockMin.y + c_WorldChunksY * c_ChunkSize - 1; Y >= c_WorldBlockMin.y; Y--)
+		{
+			if (BlockWorld_GetBlock(World, v3i(Block.x, Y, Block.z)) != 0)
+			{
+				CameraPosition.y = glm::max(CameraPosition.y, Y + 16.0f);
+				break;
+			}
+		}
+	}
+
+	camera Camera;
+	{
+		// Same projection as D3D12Shadows
+		m4 InverseView = glm::translate(m4(1.0f), CameraPosition) * glm::toMat4(qtn(CameraRotation));
+		Camera.View = glm::inverse(InverseView);
+		Camera.ReverseZ = true;
+		Camera.InfiniteFar = true;
+		Camera.RecalculateProjectionPerspective((u32)Width, (u32)Height);
+	}
+
+	// Meshes are built by jobs, keep publishing until every chunk has its occluder and the LODs both passes want
+	{
+		block_world* World = Test->BlockWorld;
+
+		for (;;)
+		{
+			BlockWorld_UpdateMeshes(World);
+			BlockWorld_SelectLODs(World, Camera, CameraPosition, (f32)Height);
+
+			for (u32 i = 0; i < World->ActiveChunkCount; i++)
+			{
+				u32 ChunkIndex = World->ActiveChunks[i];
+				BlockWorld_GetMesh(World, ChunkIndex, World->MainLOD[ChunkIndex]);
+				BlockWorld_GetMesh(World, ChunkIndex, World->ShadowLOD[ChunkIndex]);
+				BlockWorld_GetOccluder(World, ChunkIndex);
+			}
+
+			if (World->Stats.JobsScheduled == 0)
+				break;
+
+			JobSystem_WaitForCounter(&g_Jobs, &World->MeshJobs);
+		}
+	}
+
+	// Entities
+	{
+		entity_store* Entities = &Test->Entities;
+		Entities_Initialize(Entities, c_MaxEntities);
+
+		Test->RotatingCube = Entities_Create(Entities, v3(0, 5, 0), v3(0.0f), v3(1.0f));
+		Entities_Create(Entities, v3(0, 0, 0), v3(0.0f), v3(20.0f, 1.0f, 20.0f), v4(1.0f), entity_flags::Static | entity_flags::CastsShadow);
+
+		Entities_SetRotation(Entities, Test->RotatingCube, v3(0, 1.0f, 0));
+		Entities_UpdateTransforms(Entities);
+	}
+
+	// Frame
+	{
+		Test->LightEnvironment.Clear();
+		directional_light& Light = Test->LightEnvironment.EmplaceDirectionalLight();
+		Light.Direction = LightDirection;
+		Light.Intensity = 1.0f;
+		Light.Radiance = v3(1.0f);
+
+		// Ring a little above the ground the camera looks at
+		for (u32 i = 0; i < PointLightCount; i++)
+		{
+			f32 Angle = glm::two_pi<f32>() * i / PointLightCount;
+			v3 Position = CameraPosition + v3(5.0f * glm::cos(Angle), 0.0f, 14.0f + 5.0f * glm::sin(Angle));
+
+			v3i Block = BlockWorld_WorldToBlock(Position);
+			for (i32 Y = c_WorldBlockMin.y + c_WorldChunksY * c_ChunkSize - 1; Y >= c_WorldBlockMin.y; Y--)
+			{
+				if (BlockWorld_GetBlock(Test->BlockWorld, v3i(Block.x, Y, Block.z)) != 0)
+				{
+					Position.y = Y + 3.5f;
+					break;
+				}
+			}
+
+			LightStore_Create(&Test->LightStore, Position, 12.0f, 1.0f, v3(1.0f, 0.8f, 0.6f), 1.5f, light_flags::CastsShadow);
+		}
+
+		Cascades_Fit(&Test->Cascades, Test->CascadeSettings, Camera, LightDirection);
+
+		occlusion_culler* Occlusion = Test->Occlusion;
+		OcclusionCuller_Begin(Occlusion, Camera.GetForwardViewProjection());
+		OcclusionCuller_AddBlockWorld(Occlusion, Test->BlockWorld, CameraPosition);
+		OcclusionCuller_Run(Occlusion);
+
+		Headless_PushEntities(Test);
+		Headless_PushChunks(Test);
+		// Nothing moves between the two either, the second one only copies the static cache
+		Headless_RenderShadowMaps(Test);
+		Headless_RenderShadowMaps(Test);
+
+		// Nothing moves between the two, so the second one renders no faces
+		Headless_RenderPointShadows(Test, Camera, (f32)Height);
+		Headless_RenderPointShadows(Test, Camera, (f32)Height);
+
+		// Same for the pages, the second pass renders none
+		virtual_shadow_constants VirtualConstants = {};
+		if (UseVirtualShadows)
+		{
+			Headless_RenderVirtualShadows(Test, Camera, (f32)Height);
+			Headless_RenderVirtualShadows(Test, Camera, (f32)Height);
+			VirtualShadows_GetConstants(&Test->VirtualShadows, &VirtualConstants);
+		}
+
+		// After the point shadows, the lights have their shadow indices
+		// The second upload has nothing left to write
+		u32 Uploaded = LightStore_Upload(&Test->LightStore, 0, Test->PointLights);
+		u32 Reuploaded = LightStore_Upload(&Test->LightStore, 0, Test->PointLights);
+		Trace("Light store: %u lights, %u uploaded, then %u", Test->LightStore.Count, Uploaded, Reuploaded);
+
+		LightTree_Update(&Test->LightTree, &Test->LightStore, Camera.View);
+		const light_cluster_stats& ClusterStats = LightClusters_Build(Test->LightClusters, Camera, (f32)Width, (f32)Height, &Test->LightStore, &Test->LightTree, &Test->LightEnvironment);
+		Trace("Light clusters: %u lights in %u clusters, at most %u per cluster, %u indices, %u dropped | %.3f ms",
+			ClusterStats.Lights, ClusterStats.Clusters, ClusterStats.MaxClusterLights, ClusterStats.Indices, ClusterStats.DroppedIndices, ClusterStats.CullMilliseconds);
+
+		quad_root_signature_constant_buffer Constants;
+		Constants.ViewProjection = Camera.GetForwardViewProjection();
+		Constants.View = Camera.View;
+
+		shadow_cascade_constants CascadeConstants;
+		Cascades_GetConstants(&Test->Cascades, &CascadeConstants);
+
+		software_renderer* Renderer = Test->Renderer;
+		SoftwareRenderer_SetConstants(Renderer, Constants, Test->LightEnvironment);
+		SoftwareRenderer_SetShadowMap(Renderer, CascadeConstants, Test->ShadowMap, SHADOW_MAP_SIZE);
+		SoftwareRenderer_SetShadowMoments(Renderer, Test->ShadowMoments);
+		SoftwareRenderer_SetShadowAtlas(Renderer, Test->ShadowAtlas, c_ShadowAtlasSize);
+		SoftwareRenderer_SetVirtualShadows(Renderer, VirtualConstants, Test->VirtualShadowPages, Test->VirtualShadowPool);
+		SoftwareRenderer_SetPointLights(Renderer, Test->PointLights, Test->LightStore.Count);
+		SoftwareRenderer_SetLightClusters(Renderer, Test->LightClusters->Data);
+
+		if (!AllFilters)
+		{
+			Renderer->Settings.ShadowFilter = ShadowFilter;
+			Headless_BuildShadowMoments(Test, c_ShadowFilterPresets[ShadowFilter]);
+
+			const software_render_stats& Stats = SoftwareRenderer_Render(Renderer, Test->VertexDataBase, Test->Indices, 0, Test->MainIndexCount);
+			Trace("Main pass (%s): %u triangles, %u rasterized, %u dropped, %u pixels shaded, %.2f point lights per pixel | setup %.2f ms, raster %.2f ms, shading %.2f ms, total %.2f ms",
+				c_ShadowFilterPresets[ShadowFilter].Name, Stats.Triangles, Stats.RasterTriangles, Stats.DroppedTriangles, Stats.ShadedPixels,
+				Stats.ShadedPixels ? (f32)Stats.PointLightSamples / Stats.ShadedPixels : 0.0f,
+				Stats.SetupMilliseconds, Stats.RasterMilliseconds, Stats.ShadeMilliseconds, Stats.TotalMilliseconds);
+
+			if (!SoftwareRenderer_WritePPM(Renderer, OutputPath))
+				return 1;
+
+			if (DepthPrecision)
+				Headless_MeasureDepthPrecision(Test, Camera, LightDirection, Test->MainIndexCount);
+
+			if (RayTracedShadows && !Headless_TraceReferenceShadows(Test, OutputPath))
+				return 1;
+
+			if (LightBenchmark)
+				Headless_BenchmarkLightClusters(Test, Camera, Width, Height);
+
+			// Last, it changes blocks
+			if (BakeLightmap && !Headless_BakeLightmap(Test, CameraPosition, OutputPath))
+				return 1;
+
+			if (BakeIrradianceProbes && !Headless_BakeIrradianceProbes(Test, CameraPosition, OutputPath))
+				return 1;
+		}
+		else
+		{
+			// Every preset over the same frame, the one with the most samples is the reference
+			u32 ReferenceFilter = 0;
+			for (u32 i = 1; i < c_ShadowFilterPresetCount; i++)
+			{
+				if (ShadowFilter_GetSampleCount(c_ShadowFilterPresets[i]) > ShadowFilter_GetSampleCount(c_ShadowFilterPresets[ReferenceFilter]))
+					ReferenceFilter = i;
+			}
+
+			const u32 PixelCount = (u32)(Width * Height);
+			u32* Images = VmAllocArray(u32, (u64)PixelCount * c_ShadowFilterPresetCount);
+			software_render_stats* PresetStats = VmAllocArray(software_render_stats, c_ShadowFilterPresetCount);
+
+			// Warm up, the first frame pays for page faults and cold caches
+			SoftwareRenderer_Render(Renderer, Test->VertexDataBase, Test->Indices, 0, Test->MainIndexCount);
+
+			for (u32 i = 0; i < c_ShadowFilterPresetCount; i++)
+			{
+				Renderer->Settings.ShadowFilter = i;
+				Headless_BuildShadowMoments(Test, c_ShadowFilterPresets[i]);
+				PresetStats[i] = SoftwareRenderer_Render(Renderer, Test->VertexDataBase, Test->Indices, 0, Test->MainIndexCount);
+				memcpy(Images + (u64)i * PixelCount, Renderer->Color, sizeof(u32) * PixelCount);
+
+				// Output.ppm -> Output_<index>.ppm
+				char Path[512];
+				const char* Extension = strrchr(OutputPath, '.');
+				i32 StemLength = Extension ? (i32)(Extension - OutputPath) : (i32)strlen(OutputPath);
+				snprintf(Path, sizeof(Path), "%.*s_%u%s", StemLength, OutputPath, i, Extension ? Extension : ".ppm");
+
+				if (!SoftwareRenderer_WritePPM(Renderer, Path))
+					return 1;
+			}
+
+			const u32* Reference = Images + (u64)ReferenceFilter * PixelCount;
+			Trace("Shadow filters, %u pixels shaded, RMSE in 8 bit levels against %s:", PresetStats[0].ShadedPixels, c_ShadowFilterPresets[ReferenceFilter].Name);
+			for (u32 i = 0; i < c_ShadowFilterPresetCount; i++)
+			{
+				f64 Error = Headless_GetImageError(Images + (u64)i * PixelCount, Reference, PixelCount);
+
+				const software_render_stats& Stats = PresetStats[i];
+				f32 SamplesPerPixel = Stats.ShadedPixels ? (f32)Stats.ShadowSamples / Stats.ShadedPixels : 0.0f;
+				Trace("  %-12s %5.2f samples per pixel | shading %7.2f ms | RMSE %.3f",
+					c_ShadowFilterPresets[i].Name, SamplesPerPixel, Stats.ShadeMilliseconds, Error);
+			}
+
+			VmFree(Images);
+			VmFree(PresetStats);
+		}
+	}
+
+	if (GovernorTrace && !Headless_ReplayGovernorTrace(GovernorTrace))
+		return 1;
+
+	JobSystem_Shutdown(&g_Jobs);
+	return 0;
+}
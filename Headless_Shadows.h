@@ -0,0 +1,155 @@
+#pragma once
+
+// Platform layer without a window or a GPU, same defines and types as Win32_Shadows.h
+// Used by the headless reference renderer so it builds on any desktop compiler (CI runners included).
+
+// STL headers that use 'internal' or 'global' as identifiers (ios_base::internal, locale::global)
+// have to be included before the defines below
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <chrono>
+
+// General defines
+#define internal static
+#define local_persist static
+#define global static
+
+#define CountOf(arr) sizeof(arr) / sizeof(arr[0])
+#define STRINGIFY(x) #x
+
+#define ENABLE_BITWISE_OPERATORS(Enum, SizeOfEnum)                   \
+constexpr Enum operator|(Enum inLHS, Enum inRHS)                     \
+{                                                                    \
+    return Enum(static_cast<SizeOfEnum>(inLHS) |                     \
+                static_cast<SizeOfEnum>(inRHS));                     \
+}                                                                    \
+                                                                     \
+constexpr Enum operator&(Enum inLHS, Enum inRHS)                     \
+{                                                                    \
+    return Enum(static_cast<SizeOfEnum>(inLHS) &                     \
+                static_cast<SizeOfEnum>(inRHS));                     \
+}                                                                    \
+                                                                     \
+constexpr Enum operator^(Enum inLHS, Enum inRHS)                     \
+{                                                                    \
+    return Enum(static_cast<SizeOfEnum>(inLHS) ^                     \
+                static_cast<SizeOfEnum>(inRHS));                     \
+}                                                                    \
+                                                                     \
+constexpr Enum operator~(Enum inLHS)                                 \
+{                                                                    \
+    return Enum(~static_cast<SizeOfEnum>(inLHS));                    \
+}                                                                    \
+                                                                     \
+constexpr Enum& operator|=(Enum& ioLHS, Enum inRHS)                  \
+{                                                                    \
+    ioLHS = ioLHS | inRHS;                                           \
+    return ioLHS;                                                    \
+}                                                                    \
+                                                                     \
+constexpr Enum& operator&=(Enum& ioLHS, Enum inRHS)                  \
+{                                                                    \
+    ioLHS = ioLHS & inRHS;                                           \
+    return ioLHS;                                                    \
+}                                                                    \
+                                                                     \
+constexpr Enum& operator^=(Enum& ioLHS, Enum inRHS)                  \
+{                                                                    \
+    ioLHS = ioLHS ^ inRHS;                                           \
+    return ioLHS;                                                    \
+}
+
+// Zeroed like VirtualAlloc, the rest of the code relies on that
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#define VmAllocArray(__type, __count) (__type*)::VirtualAlloc(nullptr, sizeof(__type) * __count, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE)
+#define VmFree(__ptr) ::VirtualFree(__ptr, 0, MEM_RELEASE)
+#else
+#include <stdlib.h>
+#define VmAllocArray(__type, __count) (__type*)::calloc(__count, sizeof(__type))
+#define VmFree(__ptr) ::free(__ptr)
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <cfloat>
+
+// Primitive types
+using u8 = uint8_t;
+using u16 = uint16_t;
+using u32 = uint32_t;
+using u64 = uint64_t;
+
+using i8 = int8_t;
+using i16 = int16_t;
+using i32 = int32_t;
+using i64 = int64_t;
+
+using f32 = float;
+using f64 = double;
+
+using b32 = u32;
+
+// Assert
+#if defined(_MSC_VER)
+#define Debugbreak() __debugbreak()
+#else
+#define Debugbreak() __builtin_trap()
+#endif
+#define Assert(__cond__, ...) do { if(!(__cond__)) { Err(__VA_ARGS__); Debugbreak(); } } while(0)
+
+// Log
+#include <stdio.h>
+#define BK_RESET_COLOR "\033[0m"
+#define BK_GREEN_COLOR "\033[32m"
+#define BK_YELLOW_COLOR "\033[33m"
+#define BK_RED_COLOR "\033[31m"
+#define BK_WHITE_RED_BG_COLOR "\033[41;37m"
+
+#define Trace(...) do { \
+    printf(__VA_ARGS__); \
+    printf(BK_RESET_COLOR "\n"); \
+} while(0)
+
+#define Info(...) do { \
+    printf(BK_GREEN_COLOR); \
+    printf(__VA_ARGS__); \
+    printf(BK_RESET_COLOR "\n"); \
+} while(0)
+
+#define Warn(...) do { \
+    printf(BK_YELLOW_COLOR); \
+    printf(__VA_ARGS__); \
+    printf(BK_RESET_COLOR "\n"); \
+} while(0)
+
+#define Err(...) do { \
+    printf(BK_WHITE_RED_BG_COLOR); \
+    printf(__VA_ARGS__); \
+    printf(BK_RESET_COLOR "\n"); \
+} while(0)
+
+#define TraceV3(__V3) Trace("(%.3f, %.3f, %.3f)", __V3.x, __V3.y, __V3.z)
+#define InfoV3(__V3) Info("(%.3f, %.3f, %.3f)", __V3.x, __V3.y, __V3.z)
+
+#define GLM_ENABLE_EXPERIMENTAL
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_FORCE_LEFT_HANDED
+#include "glm/glm.hpp"
+#include "glm/gtc/constants.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include "glm/gtc/packing.hpp"
+#include "glm/gtx/quaternion.hpp"
+
+using v4 = glm::vec4;
+using v3 = glm::vec3;
+using v2 = glm::vec2;
+using v2i = glm::i32vec2;
+using v3i = glm::i32vec3;
+using m3 = glm::mat3;
+using m4 = glm::mat4;
+using qtn = glm::quat;
@@ -0,0 +1,625 @@
+#pragma once
+
+// Irradiance probes
+// Ambient light for everything the main pass draws. A grid of c_IrradianceProbes* probes, Spacing blocks apart, stores the light
+// arriving at every probe as L2 spherical harmonics. The shader blends the 8 probes around a surface and evaluates them for its
+// normal, so a floor under an overhang gets less sky than one in the open and a wall next to a lit one picks up some of its color,
+// with no GI pass at runtime.
+//
+// Probes are traced on the CPU over the job system, straight through the blocks of the world with a 3D DDA, there is no geometry
+// to build. Every probe shoots the same Rays directions, a spherical Fibonacci set. A ray that gets away brings the sky back, one
+// that hits a block brings its palette color times the direct light of the directional lights there, behind a shadow ray, plus
+// the probes' own irradiance at the hit point. That last part is the bounced light: a pass reads the probes of the pass before,
+// so a full bake of Passes passes has Passes - 1 bounces and later updates keep adding them.
+// Only indirect light goes into the probes, the direct light still comes from the shadow maps.
+// Coefficients are convolved with the cosine lobe and divided by pi before they are stored, so evaluating them gives the units of
+// the constant ambient of Light.hlsl: a uniform sky of SkyRadiance evaluates to SkyRadiance for every normal.
+//
+// Probes inside a block get a weight of 0 and are skipped. Probes behind the surface count less and the sample point is pushed
+// half a block along the normal, so walls and floors leak as little as they can without visibility per probe.
+//
+// Incremental updates
+// IrradianceProbes_Update compares the versions of the chunks under the grid with the ones it saw last and queues the probes
+// within InvalidateReach of every chunk that changed. Everything is queued when the directional lights change or the grid moves.
+// Queued probes are traced in batches until the frame's budget is spent, what is left waits for the next frame. A batch is what
+// the rest of the budget fits at the average speed of the batches before, up to BatchProbes, and one probe per worker before there
+// is an average. Workers stop taking probes of a batch once the budget is spent and those go back to the front of the queue.
+//
+// Upload: 56 bytes per probe, 27 half float coefficients and the weight, see irradiance_probe_gpu.
+
+inline constexpr u32 c_IrradianceProbesX = 32; // Same in Quad.hlsl
+inline constexpr u32 c_IrradianceProbesY = 16;
+inline constexpr u32 c_IrradianceProbesZ = 32;
+inline constexpr u32 c_IrradianceProbeCount = c_IrradianceProbesX * c_IrradianceProbesY * c_IrradianceProbesZ;
+inline constexpr f32 c_DefaultIrradianceProbeBudget = 2.0f; // CPU milliseconds per frame for IrradianceProbes_Update
+
+// Matches irradiance_probe in Quad.hlsl. L2 spherical harmonics of the irradiance around the probe as half floats, RGB per
+// coefficient, then the probe's weight in the last half: 0 when the probe is inside a block
+struct irradiance_probe_gpu
+{
+	u32 Packed[14];
+};
+
+struct irradiance_probe_settings
+{
+	i32 Spacing;          // Blocks between probes
+	u32 Rays;             // Per probe and pass
+	u32 Passes;           // Of a full bake, every pass after the first adds a bounce
+	f32 SkyRadiance;      // What a ray that gets away brings back, 0.5 is the ambient of Light.hlsl
+	f32 MaxDistance;      // Blocks, rays that get further count as sky
+	f32 ShadowReach;      // Blocks, shadow rays that get further are lit
+	f32 InvalidateReach;  // Blocks around a changed chunk
+	u32 BatchProbes;      // Most probes traced together between two looks at the average probe cost
+};
+
+struct irradiance_probe_stats
+{
+	u32 Probes;  // Traced by the last bake or update, every pass counts
+	u32 EnabledProbes; // Of those, the ones that are not inside a block
+	u32 Batches;
+	u32 Queued;  // Left for the next updates
+	u32 ChangedChunks;
+	u64 Rays;
+	f32 Milliseconds;
+};
+
+struct irradiance_probes
+{
+	irradiance_probe_settings Settings;
+	v3i Origin; // Block of the first probe
+
+	irradiance_probe_gpu* Probes; // c_IrradianceProbeCount, X fastest then Y then Z. What is uploaded and what the bounces read
+	irradiance_probe_gpu* Traced; // Results of a pass or a batch, copied over when it is done
+	v3* Directions;               // Settings.Rays
+
+	u32* Queue;      // Ring of probe indices, every probe is in it at most once
+	u32 QueueHead;
+	u32 QueueCount;
+	u8* Queued;
+	u32* Batch;      // Settings.BatchProbes
+	f32 ProbeMilliseconds; // Per probe, averaged over the last batches. Sizes the next ones to the budget
+
+	u32* ChunkVersions; // c_WorldChunkCount, chunk version + 1 when it was last looked at, 0 for no chunk
+	u64 LightHash;
+	u32 Revision;       // Bumped whenever Probes changes, uploads only need to happen then
+
+	irradiance_probe_stats Stats;
+};
+
+internal irradiance_probe_settings IrradianceProbes_GetDefaultSettings();
+internal void IrradianceProbes_Initialize(irradiance_probes* Probes, const irradiance_probe_settings& Settings, v3 Center);
+internal void IrradianceProbes_Destroy(irradiance_probes* Probes);
+
+// Moves the grid to be centered on Center, the probes are cleared and all queued
+internal void IrradianceProbes_SetCenter(irradiance_probes* Probes, v3 Center);
+
+// Traces every probe Passes times and empties the queue, blocks until done
+internal const irradiance_probe_stats& IrradianceProbes_Bake(irradiance_probes* Probes, const block_world* World, const light_environment& Environment);
+
+// Queues the probes near chunks that changed, then traces queued probes until BudgetMilliseconds are spent, at least one probe
+internal const irradiance_probe_stats& IrradianceProbes_Update(irradiance_probes* Probes, const block_world* World, const light_environment& Environment, f32 BudgetMilliseconds);
+
+// For light_environment::IrradianceProbeGrid
+internal v4 IrradianceProbes_GetGrid(const irradiance_probes* Probes);
+
+// Trilinear between the 8 probes around the point, evaluated for the normal. Same as IrradianceProbeSample in Quad.hlsl,
+// 0 outside of the grid or when none of the probes is enabled
+internal v3 IrradianceProbes_Sample(const irradiance_probe_gpu* Probes, v4 Grid, v3 Position, v3 Normal);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+inline constexpr f32 c_IrradianceProbeBandScales[3] = { 1.0f, 2.0f / 3.0f, 0.25f }; // Cosine lobe convolution over pi, per band
+inline constexpr u32 c_IrradianceProbeBands[9] = { 0, 1, 1, 1, 2, 2, 2, 2, 2 };
+inline constexpr f32 c_IrradianceProbeNormalOffset = 0.01f; // Secondary rays start this far off the block face
+
+internal irradiance_probe_settings IrradianceProbes_GetDefaultSettings()
+{
+	irradiance_probe_settings Settings = {};
+	Settings.Spacing = 4;
+	Settings.Rays = 64;
+	Settings.Passes = 2;
+	Settings.SkyRadiance = 0.5f;
+	Settings.MaxDistance = 32.0f;
+	Settings.ShadowReach = 48.0f;
+	Settings.InvalidateReach = 8.0f;
+	Settings.BatchProbes = 32;
+	return Settings;
+}
+
+inline v3i IrradianceProbes_GetCoord(u32 Index)
+{
+	return v3i(Index % c_IrradianceProbesX, (Index / c_IrradianceProbesX) % c_IrradianceProbesY, Index / (c_IrradianceProbesX * c_IrradianceProbesY));
+}
+
+inline u32 IrradianceProbes_GetIndex(v3i Coord)
+{
+	return ((u32)Coord.z * c_IrradianceProbesY + (u32)Coord.y) * c_IrradianceProbesX + (u32)Coord.x;
+}
+
+// Real L2 basis in the order of Quad.hlsl
+inline void IrradianceProbes_EvaluateBasis(v3 Direction, f32 Out[9])
+{
+	Out[0] = 0.282095f;
+	Out[1] = 0.488603f * Direction.y;
+	Out[2] = 0.488603f * Direction.z;
+	Out[3] = 0.488603f * Direction.x;
+	Out[4] = 1.092548f * Direction.x * Direction.y;
+	Out[5] = 1.092548f * Direction.y * Direction.z;
+	Out[6] = 0.315392f * (3.0f * Direction.z * Direction.z - 1.0f);
+	Out[7] = 1.092548f * Direction.x * Direction.z;
+	Out[8] = 0.546274f * (Direction.x * Direction.x - Direction.y * Direction.y);
+}
+
+inline f32 IrradianceProbes_Unpack(const irradiance_probe_gpu& Probe, u32 Half)
+{
+	return glm::unpackHalf1x16((u16)(Probe.Packed[Half / 2] >> ((Half % 2) * 16)));
+}
+
+internal irradiance_probe_gpu IrradianceProbes_Pack(const v3 Coefficients[9], f32 Weight)
+{
+	u16 Halves[28];
+	for (u32 i = 0; i < 9; i++)
+	{
+		for (u32 Channel = 0; Channel < 3; Channel++)
+			Halves[i * 3 + Channel] = glm::packHalf1x16(Coefficients[i][Channel]);
+	}
+	Halves[27] = glm::packHalf1x16(Weight);
+
+	irradiance_probe_gpu Probe;
+	for (u32 i = 0; i < CountOf(Probe.Packed); i++)
+		Probe.Packed[i] = (u32)Halves[i * 2] | ((u32)Halves[i * 2 + 1] << 16);
+	return Probe;
+}
+
+internal void IrradianceProbes_QueueAll(irradiance_probes* Probes)
+{
+	for (u32 i = 0; i < c_IrradianceProbeCount; i++)
+	{
+		Probes->Queue[i] = i;
+		Probes->Queued[i] = 1;
+	}
+
+	Probes->QueueHead = 0;
+	Probes->QueueCount = c_IrradianceProbeCount;
+}
+
+internal void IrradianceProbes_Initialize(irradiance_probes* Probes, const irradiance_probe_settings& Settings, v3 Center)
+{
+	*Probes = {};
+	Probes->Settings = Settings;
+	Probes->Settings.Spacing = glm::max(Settings.Spacing, 1);
+	Probes->Settings.Rays = glm::max(Settings.Rays, 1u);
+	Probes->Settings.Passes = glm::max(Settings.Passes, 1u);
+	Probes->Settings.BatchProbes = glm::max(Settings.BatchProbes, 1u);
+
+	Probes->Probes = VmAllocArray(irradiance_probe_gpu, c_IrradianceProbeCount);
+	Probes->Traced = VmAllocArray(irradiance_probe_gpu, c_IrradianceProbeCount);
+	Probes->Queue = VmAllocArray(u32, c_IrradianceProbeCount);
+	Probes->Queued = VmAllocArray(u8, c_IrradianceProbeCount);
+	Probes->Batch = VmAllocArray(u32, Probes->Settings.BatchProbes);
+	Probes->ChunkVersions = VmAllocArray(u32, c_WorldChunkCount);
+
+	// Spherical Fibonacci, even coverage for any count
+	const u32 Rays = Probes->Settings.Rays;
+	Probes->Directions = VmAllocArray(v3, Rays);
+	for (u32 i = 0; i < Rays; i++)
+	{
+		f32 Y = 1.0f - (2.0f * i + 1.0f) / Rays;
+		f32 Radius = glm::sqrt(glm::max(1.0f - Y * Y, 0.0f));
+		f32 Angle = i * glm::pi<f32>() * (3.0f - glm::sqrt(5.0f));
+		Probes->Directions[i] = v3(Radius * glm::cos(Angle), Y, Radius * glm::sin(Angle));
+	}
+
+	IrradianceProbes_SetCenter(Probes, Center);
+}
+
+internal void IrradianceProbes_Destroy(irradiance_probes* Probes)
+{
+	VmFree(Probes->Probes);
+	VmFree(Probes->Traced);
+	VmFree(Probes->Directions);
+	VmFree(Probes->Queue);
+	VmFree(Probes->Queued);
+	VmFree(Probes->Batch);
+	VmFree(Probes->ChunkVersions);
+	*Probes = {};
+}
+
+internal void IrradianceProbes_SetCenter(irradiance_probes* Probes, v3 Center)
+{
+	const i32 Spacing = Probes->Settings.Spacing;
+	const v3i Snapped = v3i(glm::round(Center / (f32)Spacing)) * Spacing;
+	Probes->Origin = Snapped - v3i(c_IrradianceProbesX / 2, c_IrradianceProbesY / 2, c_IrradianceProbesZ / 2) * Spacing;
+
+	memset(Probes->Probes, 0, sizeof(irradiance_probe_gpu) * c_IrradianceProbeCount);
+	Probes->Revision++;
+	IrradianceProbes_QueueAll(Probes);
+}
+
+internal v4 IrradianceProbes_GetGrid(const irradiance_probes* Probes)
+{
+	return v4(v3(Probes->Origin), 1.0f / Probes->Settings.Spacing);
+}
+
+internal v3 IrradianceProbes_Sample(const irradiance_probe_gpu* Probes, v4 Grid, v3 Position, v3 Normal)
+{
+	if (Grid.w == 0.0f)
+		return v3(0.0f);
+
+	const v3 Last = v3(c_IrradianceProbesX - 1, c_IrradianceProbesY - 1, c_IrradianceProbesZ - 1);
+	const v3 Local = (Position + Normal * 0.5f - v3(Grid)) * Grid.w;
+	if (glm::any(glm::lessThan(Local, v3(0.0f))) || glm::any(glm::greaterThan(Local, Last)))
+		return v3(0.0f);
+
+	const v3i Base = glm::min(v3i(Local), v3i(Last) - v3i(1));
+	const v3 Fraction = Local - v3(Base);
+
+	f32 Basis[9];
+	IrradianceProbes_EvaluateBasis(Normal, Basis);
+
+	v3 Sum = v3(0.0f);
+	f32 Total = 0.0f;
+	for (u32 Corner = 0; Corner < 8; Corner++)
+	{
+		const v3i Offset = v3i(Corner & 1, (Corner >> 1) & 1, (Corner >> 2) & 1);
+		const irradiance_probe_gpu& Probe = Probes[IrradianceProbes_GetIndex(Base + Offset)];
+
+		f32 Weight = IrradianceProbes_Unpack(Probe, 27);
+		if (Weight <= 0.0f)
+			continue;
+
+		// Probes behind the surface count less, but never for nothing so a surface between them still gets some light
+		v3 ToProbe = v3(Grid) + v3(Base + Offset) / Grid.w - Position;
+		ToProbe *= glm::inversesqrt(glm::max(glm::dot(ToProbe, ToProbe), 1e-8f));
+		f32 Wrap = (glm::dot(ToProbe, Normal) + 1.0f) * 0.5f;
+
+		v3 Trilinear = glm::mix(v3(1.0f) - Fraction, Fraction, v3(Offset));
+		Weight *= Trilinear.x * Trilinear.y * Trilinear.z * (Wrap * Wrap + 0.2f);
+
+		v3 Irradiance = v3(0.0f);
+		for (u32 i = 0; i < 9; i++)
+			Irradiance += v3(IrradianceProbes_Unpack(Probe, i * 3), IrradianceProbes_Unpack(Probe, i * 3 + 1), IrradianceProbes_Unpack(Probe, i * 3 + 2)) * Basis[i];
+
+		// L2 rings below zero behind bright spots
+		Sum += glm::max(Irradiance, v3(0.0f)) * Weight;
+		Total += Weight;
+	}
+
+	return Total > 1e-4f ? Sum / Total : v3(0.0f);
+}
+
+// Amanatides and Woo through the blocks, starting in the block of the origin which is never hit.
+// False when no solid block starts within MaxDistance
+internal bool IrradianceProbes_TraceBlocks(const block_world* World, v3 Origin, v3 Direction, f32 MaxDistance, f32* OutDistance, v3* OutNormal, u8* OutColor)
+{
+	v3i Block = BlockWorld_WorldToBlock(Origin);
+	v3i Step;
+	v3 Next, Delta;
+	for (i32 Axis = 0; Axis < 3; Axis++)
+	{
+		Step[Axis] = Direction[Axis] < 0.0f ? -1 : 1;
+		if (Direction[Axis] == 0.0f)
+		{
+			Next[Axis] = FLT_MAX;
+			Delta[Axis] = FLT_MAX;
+			continue;
+		}
+
+		// Blocks are centered on integers
+		Next[Axis] = (Block[Axis] + Step[Axis] * 0.5f - Origin[Axis]) / Direction[Axis];
+		Delta[Axis] = glm::abs(1.0f / Direction[Axis]);
+	}
+
+	for (;;)
+	{
+		i32 Axis = Next.x < Next.y ? (Next.x < Next.z ? 0 : 2) : (Next.y < Next.z ? 1 : 2);
+		f32 Distance = Next[Axis];
+		if (Distance > MaxDistance)
+			return false;
+
+		Block[Axis] += Step[Axis];
+		Next[Axis] += Delta[Axis];
+
+		u8 Color = BlockWorld_GetBlock(World, Block);
+		if (Color != 0)
+		{
+			*OutDistance = Distance;
+			*OutNormal = v3(0.0f);
+			(*OutNormal)[Axis] = (f32)-Step[Axis];
+			*OutColor = Color;
+			return true;
+		}
+	}
+}
+
+// False when the probe is inside a block, it is disabled then
+internal bool IrradianceProbes_TraceProbe(const irradiance_probes* Probes, const block_world* World, const light_environment& Environment, u32 Index, bool Bounce, irradiance_probe_gpu* Out, u64* Rays)
+{
+	const irradiance_probe_settings& Settings = Probes->Settings;
+	const v3i Block = Probes->Origin + IrradianceProbes_GetCoord(Index) * Settings.Spacing;
+	if (BlockWorld_GetBlock(World, Block) != 0)
+	{
+		*Out = {};
+		return false;
+	}
+
+	// Same diffuse as the lightmap's lights
+	v3 LightDirections[light_environment::MaxDirectionalLights];
+	v3 LightDiffuse[light_environment::MaxDirectionalLights];
+	for (i32 i = 0; i < Environment.DirectionalLightCount; i++)
+	{
+		const directional_light& Light = Environment.DirectionalLight[i];
+		LightDirections[i] = glm::normalize(-Light.Direction);
+		LightDiffuse[i] = Light.Radiance * Light.Intensity * 0.8f;
+	}
+
+	const v3 Position = v3(Block);
+	const v4 Grid = IrradianceProbes_GetGrid(Probes);
+
+	v3 Coefficients[9] = {};
+	u64 ProbeRays = Settings.Rays;
+	for (u32 Ray = 0; Ray < Settings.Rays; Ray++)
+	{
+		const v3 Direction = Probes->Directions[Ray];
+
+		v3 Radiance = v3(Settings.SkyRadiance);
+		f32 Distance;
+		v3 Normal;
+		u8 Color;
+		if (IrradianceProbes_TraceBlocks(World, Position, Direction, Settings.MaxDistance, &Distance, &Normal, &Color))
+		{
+			const v3 Hit = Position + Direction * Distance + Normal * c_IrradianceProbeNormalOffset;
+
+			v3 Irradiance = v3(0.0f);
+			for (i32 i = 0; i < Environment.DirectionalLightCount; i++)
+			{
+				f32 Cosine = glm::dot(Normal, LightDirections[i]);
+				if (Cosine <= 0.0f)
+					continue;
+
+				f32 ShadowDistance;
+				v3 ShadowNormal;
+				u8 ShadowColor;
+				ProbeRays++;
+				if (!IrradianceProbes_TraceBlocks(World, Hit, LightDirections[i], Settings.ShadowReach, &ShadowDistance, &ShadowNormal, &ShadowColor))
+					Irradiance += LightDiffuse[i] * Cosine;
+			}
+
+			if (Bounce)
+				Irradiance += IrradianceProbes_Sample(Probes->Probes, Grid, Hit, Normal);
+
+			Radiance = v3(World->Palette[Color]) * Irradiance;
+		}
+
+		f32 Basis[9];
+		IrradianceProbes_EvaluateBasis(Direction, Basis);
+		for (u32 i = 0; i < 9; i++)
+			Coefficients[i] += Radiance * Basis[i];
+	}
+
+	// Monte Carlo over the sphere, then the cosine lobe
+	for (u32 i = 0; i < 9; i++)
+		Coefficients[i] *= 4.0f * glm::pi<f32>() / Settings.Rays * c_IrradianceProbeBandScales[c_IrradianceProbeBands[i]];
+
+	*Out = IrradianceProbes_Pack(Coefficients, 1.0f);
+	*Rays += ProbeRays;
+	return true;
+}
+
+// FNV-1a over what the probes take from the directional lights
+internal u64 IrradianceProbes_HashLights(const light_environment& Environment)
+{
+	u64 Hash = 0xCBF29CE484222325ull;
+	auto Add = [&Hash](const void* Data, u64 Size)
+	{
+		for (u64 i = 0; i < Size; i++)
+			Hash = (Hash ^ ((const u8*)Data)[i]) * 0x100000001B3ull;
+	};
+
+	Add(&Environment.DirectionalLightCount, sizeof(i32));
+	for (i32 i = 0; i < Environment.DirectionalLightCount; i++)
+	{
+		const directional_light& Light = Environment.DirectionalLight[i];
+		Add(&Light.Direction, sizeof(v3));
+		Add(&Light.Intensity, sizeof(f32));
+		Add(&Light.Radiance, sizeof(v3));
+	}
+
+	return Hash;
+}
+
+internal void IrradianceProbes_Enqueue(irradiance_probes* Probes, u32 Index)
+{
+	if (Probes->Queued[Index])
+		return;
+
+	Probes->Queue[(Probes->QueueHead + Probes->QueueCount) % c_IrradianceProbeCount] = Index;
+	Probes->QueueCount++;
+	Probes->Queued[Index] = 1;
+}
+
+// Chunks under the grid and its reach whose version is not the one seen last. With Enqueue, the probes near them are queued
+internal u32 IrradianceProbes_CheckChunks(irradiance_probes* Probes, const block_world* World, bool Enqueue)
+{
+	const irradiance_probe_settings& Settings = Probes->Settings;
+	const i32 Reach = (i32)glm::ceil(Settings.InvalidateReach);
+	const v3i GridMax = Probes->Origin + v3i(c_IrradianceProbesX - 1, c_IrradianceProbesY - 1, c_IrradianceProbesZ - 1) * Settings.Spacing;
+
+	v3i MinChunk, MaxChunk, Local;
+	BlockWorld_SplitBlock(Probes->Origin - v3i(Reach), &MinChunk, &Local);
+	BlockWorld_SplitBlock(GridMax + v3i(Reach), &MaxChunk, &Local);
+	MinChunk = glm::max(MinChunk, v3i(0));
+	MaxChunk = glm::min(MaxChunk, v3i(c_WorldChunksX - 1, c_WorldChunksY - 1, c_WorldChunksZ - 1));
+
+	u32 Changed = 0;
+	for (i32 Z = MinChunk.z; Z <= MaxChunk.z; Z++)
+	for (i32 Y = MinChunk.y; Y <= MaxChunk.y; Y++)
+	for (i32 X = MinChunk.x; X <= MaxChunk.x; X++)
+	{
+		u32 ChunkIndex = BlockWorld_GetChunkIndex(v3i(X, Y, Z));
+		const chunk* Chunk = World->Chunks[ChunkIndex];
+		u32 Version = Chunk ? Chunk->Version + 1 : 0;
+		if (Probes->ChunkVersions[ChunkIndex] == Version)
+			continue;
+
+		Probes->ChunkVersions[ChunkIndex] = Version;
+		Changed++;
+		if (!Enqueue)
+			continue;
+
+		// Probes within the reach of the chunk's blocks
+		const v3i BlockMin = Chunk_GetBlockMin(v3i(X, Y, Z)) - v3i(Reach);
+		const v3i BlockMax = Chunk_GetBlockMin(v3i(X, Y, Z)) + v3i(c_ChunkSize - 1 + Reach);
+		const v3i ProbeMin = glm::max(v3i(glm::ceil(v3(BlockMin - Probes->Origin) / (f32)Settings.Spacing)), v3i(0));
+		const v3i ProbeMax = glm::min(v3i(glm::floor(v3(BlockMax - Probes->Origin) / (f32)Settings.Spacing)), v3i(c_IrradianceProbesX - 1, c_IrradianceProbesY - 1, c_IrradianceProbesZ - 1));
+
+		for (i32 PZ = ProbeMin.z; PZ <= ProbeMax.z; PZ++)
+		for (i32 PY = ProbeMin.y; PY <= ProbeMax.y; PY++)
+		for (i32 PX = ProbeMin.x; PX <= ProbeMax.x; PX++)
+			IrradianceProbes_Enqueue(Probes, IrradianceProbes_GetIndex(v3i(PX, PY, PZ)));
+	}
+
+	return Changed;
+}
+
+internal const irradiance_probe_stats& IrradianceProbes_Bake(irradiance_probes* Probes, const block_world* World, const light_environment& Environment)
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto Start = clock::now();
+
+	irradiance_probe_stats& Stats = Probes->Stats;
+	Stats = {};
+
+	// Everything is traced anyway, the next update only has to look for what changes after this
+	Stats.ChangedChunks = IrradianceProbes_CheckChunks(Probes, World, false);
+	Probes->LightHash = IrradianceProbes_HashLights(Environment);
+
+	std::atomic<u64> Rays = 0;
+	std::atomic<u32> Enabled = 0;
+	for (u32 Pass = 0; Pass < Probes->Settings.Passes; Pass++)
+	{
+		JobSystem_ParallelFor(&g_Jobs, c_IrradianceProbeCount, 16, [Probes, World, &Environment, Pass, &Rays, &Enabled](u32 Begin, u32 End)
+		{
+			u64 BatchRays = 0;
+			u32 BatchEnabled = 0;
+			for (u32 i = Begin; i < End; i++)
+				BatchEnabled += IrradianceProbes_TraceProbe(Probes, World, Environment, i, Pass > 0, &Probes->Traced[i], &BatchRays);
+
+			Rays += BatchRays;
+			Enabled += BatchEnabled;
+		});
+
+		memcpy(Probes->Probes, Probes->Traced, sizeof(irradiance_probe_gpu) * c_IrradianceProbeCount);
+	}
+
+	memset(Probes->Queued, 0, c_IrradianceProbeCount);
+	Probes->QueueHead = 0;
+	Probes->QueueCount = 0;
+	Probes->Revision++;
+
+	Stats.Probes = c_IrradianceProbeCount * Probes->Settings.Passes;
+	Stats.EnabledProbes = Enabled.load();
+	Stats.Batches = Probes->Settings.Passes;
+	Stats.Rays = Rays.load();
+	Stats.Milliseconds = std::chrono::duration<f32, std::milli>(clock::now() - Start).count();
+	return Stats;
+}
+
+internal const irradiance_probe_stats& IrradianceProbes_Update(irradiance_probes* Probes, const block_world* World, const light_environment& Environment, f32 BudgetMilliseconds)
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto Start = clock::now();
+
+	irradiance_probe_stats& Stats = Probes->Stats;
+	Stats = {};
+
+	u64 LightHash = IrradianceProbes_HashLights(Environment);
+	if (LightHash != Probes->LightHash)
+	{
+		Probes->LightHash = LightHash;
+		IrradianceProbes_QueueAll(Probes);
+	}
+
+	Stats.ChangedChunks = IrradianceProbes_CheckChunks(Probes, World, true);
+
+	// Bounces read the probes as they were before the batch, so a batch traces the same on any number of threads
+	const auto Deadline = Start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<f32, std::milli>(BudgetMilliseconds));
+	const u32 FirstBatch = JobSystem_GetWorkerCount(&g_Jobs);
+	std::atomic<u64> Rays = 0;
+	std::atomic<u32> Enabled = 0;
+	while (Probes->QueueCount > 0)
+	{
+		auto BatchStart = clock::now();
+		if (Stats.Batches > 0 && BatchStart >= Deadline)
+			break;
+
+		// Nothing to go by yet, one probe per worker. The estimate stays rough, the workers check the deadline themselves
+		f32 Left = std::chrono::duration<f32, std::milli>(Deadline - BatchStart).count();
+		u32 Count = glm::min(Probes->Settings.BatchProbes, Probes->QueueCount);
+		if (Probes->ProbeMilliseconds > 0.0f)
+			Count = glm::clamp((u32)glm::min(Left / Probes->ProbeMilliseconds, (f32)Count), 1u, Count);
+		else
+			Count = glm::clamp(FirstBatch, 1u, Count);
+
+		// Probes stay marked as queued until they are traced
+		for (u32 i = 0; i < Count; i++)
+			Probes->Batch[i] = Probes->Queue[(Probes->QueueHead + i) % c_IrradianceProbeCount];
+
+		Probes->QueueHead = (Probes->QueueHead + Count) % c_IrradianceProbeCount;
+		Probes->QueueCount -= Count;
+
+		// Workers stop taking probes at the deadline, so a frame runs over by at most the probes in flight. The first probe of
+		// the first batch is always traced, an update with no budget left still gets somewhere
+		std::atomic<u32> TracedCount = 0;
+		JobSystem_ParallelFor(&g_Jobs, Count, 1, [Probes, World, &Environment, &Rays, &Enabled, &TracedCount, Deadline, First = Stats.Batches == 0](u32 Begin, u32 End)
+		{
+			u64 BatchRays = 0;
+			u32 BatchEnabled = 0, BatchTraced = 0;
+			for (u32 i = Begin; i < End; i++)
+			{
+				if ((i > 0 || !First) && clock::now() >= Deadline)
+					break;
+
+				BatchEnabled += IrradianceProbes_TraceProbe(Probes, World, Environment, Probes->Batch[i], true, &Probes->Traced[i], &BatchRays);
+				Probes->Queued[Probes->Batch[i]] = 0;
+				BatchTraced++;
+			}
+
+			Rays += BatchRays;
+			Enabled += BatchEnabled;
+			TracedCount += BatchTraced;
+		});
+
+		// What the deadline stopped goes back to the front of the queue, into the slots the batch came from
+		u32 Untraced = Count - TracedCount.load();
+		Probes->QueueHead = (Probes->QueueHead + c_IrradianceProbeCount - Untraced) % c_IrradianceProbeCount;
+		Probes->QueueCount += Untraced;
+		for (u32 i = 0, Slot = 0; i < Count; i++)
+		{
+			if (Probes->Queued[Probes->Batch[i]])
+				Probes->Queue[(Probes->QueueHead + Slot++) % c_IrradianceProbeCount] = Probes->Batch[i];
+			else
+				Probes->Probes[Probes->Batch[i]] = Probes->Traced[i];
+		}
+
+		if (Untraced == Count)
+			break;
+
+		// Probes in the open cost many times what buried ones do, a batch alone says little
+		f32 ProbeMilliseconds = std::chrono::duration<f32, std::milli>(clock::now() - BatchStart).count() / (Count - Untraced);
+		Probes->ProbeMilliseconds = Probes->ProbeMilliseconds > 0.0f ? glm::mix(Probes->ProbeMilliseconds, ProbeMilliseconds, 0.25f) : ProbeMilliseconds;
+		Probes->Revision++;
+		Stats.Probes += Count - Untraced;
+		Stats.Batches++;
+	}
+
+	Stats.EnabledProbes = Enabled.load();
+	Stats.Queued = Probes->QueueCount;
+	Stats.Rays = Rays.load();
+	Stats.Milliseconds = std::chrono::duration<f32, std::milli>(clock::now() - Start).count();
+	return Stats;
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+// Tiny job system
+// Workers pull type-erased jobs from a single locked queue. This is not the fastest thing in the world,
+// but jobs in this project are coarse (whole chunks, tiles, bins), so the lock is never the bottleneck.
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <deque>
+#include <vector>
+
+// Tracks completion of a group of jobs, the submitting thread can wait on it and help with the work meanwhile
+struct job_counter
+{
+	std::atomic<u32> Pending;
+};
+
+struct job_system
+{
+	struct job
+	{
+		std::function<void()> Func;
+		job_counter* Counter;
+	};
+
+	std::vector<std::thread> Workers;
+	std::mutex Mutex;
+	std::condition_variable WakeCondition;
+	std::deque<job> Queue;
+	bool IsRunning = false;
+};
+
+// Global, since every subsystem wants it and there is only ever one
+global job_system g_Jobs;
+
+internal void JobSystem_Initialize(job_system* Jobs, u32 WorkerCount = 0);
+internal void JobSystem_Shutdown(job_system* Jobs);
+internal u32 JobSystem_GetWorkerCount(const job_system* Jobs);
+internal void JobSystem_Submit(job_system* Jobs, job_counter* Counter, std::function<void()>&& Func);
+internal bool JobSystem_TryRunOne(job_system* Jobs);
+internal void JobSystem_WaitForCounter(job_system* Jobs, job_counter* Counter);
+
+// Splits [0, Count) into batches of BatchSize and blocks until all of them are done.
+// Func(u32 Begin, u32 End) is called once per batch, the calling thread participates.
+template<typename F>
+internal void JobSystem_ParallelFor(job_system* Jobs, u32 Count, u32 BatchSize, F&& Func);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+internal void JobSystem_WorkerLoop(job_system* Jobs)
+{
+	while (true)
+	{
+		job_system::job Job;
+
+		{
+			std::unique_lock<std::mutex> Lock(Jobs->Mutex);
+			Jobs->WakeCondition.wait(Lock, [Jobs]() { return !Jobs->Queue.empty() || !Jobs->IsRunning; });
+
+			if (!Jobs->IsRunning && Jobs->Queue.empty())
+				return;
+
+			Job = std::move(Jobs->Queue.front());
+			Jobs->Queue.pop_front();
+		}
+
+		Job.Func();
+
+		if (Job.Counter)
+			Job.Counter->Pending.fetch_sub(1, std::memory_order_acq_rel);
+	}
+}
+
+internal void JobSystem_Initialize(job_system* Jobs, u32 WorkerCount)
+{
+	Assert(!Jobs->IsRunning, "Job system is already initialized!");
+
+	if (WorkerCount == 0)
+	{
+		// Leave one core for the main thread
+		u32 HardwareThreads = std::thread::hardware_concurrency();
+		WorkerCount = HardwareThreads > 1 ? HardwareThreads - 1 : 1;
+	}
+
+	Jobs->IsRunning = true;
+	Jobs->Workers.reserve(WorkerCount);
+	for (u32 i = 0; i < WorkerCount; i++)
+	{
+		Jobs->Workers.emplace_back(JobSystem_WorkerLoop, Jobs);
+	}
+
+	Trace("Job system initialized with %u workers.", WorkerCount);
+}
+
+internal void JobSystem_Shutdown(job_system* Jobs)
+{
+	{
+		std::lock_guard<std::mutex> Lock(Jobs->Mutex);
+		Jobs->IsRunning = false;
+	}
+	Jobs->WakeCondition.notify_all();
+
+	for (auto& Worker : Jobs->Workers)
+		Worker.join();
+
+	Jobs->Workers.clear();
+}
+
+internal u32 JobSystem_GetWorkerCount(const job_system* Jobs)
+{
+	return static_cast<u32>(Jobs->Workers.size());
+}
+
+internal void JobSystem_Submit(job_system* Jobs, job_counter* Counter, std::function<void()>&& Func)
+{
+	if (Counter)
+		Counter->Pending.fetch_add(1, std::memory_order_relaxed);
+
+	{
+		std::lock_guard<std::mutex> Lock(Jobs->Mutex);
+		Jobs->Queue.push_back({ std::move(Func), Counter });
+	}
+	Jobs->WakeCondition.notify_one();
+}
+
+internal bool JobSystem_TryRunOne(job_system* Jobs)
+{
+	job_system::job Job;
+
+	{
+		std::lock_guard<std::mutex> Lock(Jobs->Mutex);
+		if (Jobs->Queue.empty())
+			return false;
+
+		Job = std::move(Jobs->Queue.front());
+		Jobs->Queue.pop_front();
+	}
+
+	Job.Func();
+
+	if (Job.Counter)
+		Job.Counter->Pending.fetch_sub(1, std::memory_order_acq_rel);
+
+	return true;
+}
+
+internal void JobSystem_WaitForCounter(job_system* Jobs, job_counter* Counter)
+{
+	while (Counter->Pending.load(std::memory_order_acquire) > 0)
+	{
+		// Help out instead of sleeping, this also makes waiting from inside a job safe
+		if (!JobSystem_TryRunOne(Jobs))
+			std::this_thread::yield();
+	}
+}
+
+template<typename F>
+internal void JobSystem_ParallelFor(job_system* Jobs, u32 Count, u32 BatchSize, F&& Func)
+{
+	if (Count == 0)
+		return;
+
+	if (BatchSize == 0)
+		BatchSize = 1;
+
+	// Not worth the overhead
+	if (Count <= BatchSize || Jobs->Workers.empty())
+	{
+		Func(0u, Count);
+		return;
+	}
+
+	job_counter Counter;
+	Counter.Pending = 0;
+
+	for (u32 Begin = 0; Begin < Count; Begin += BatchSize)
+	{
+		u32 End = Begin + BatchSize < Count ? Begin + BatchSize : Count;
+		JobSystem_Submit(Jobs, &Counter, [&Func, Begin, End]() { Func(Begin, End); });
+	}
+
+	JobSystem_WaitForCounter(Jobs, &Counter);
+}
@@ -10,7 +10,8 @@ struct point_light
     float Radius;
 
     float FallOff;
-    float3 _Pad;
+    int ShadowIndex; // Faces are u_PointShadowTiles[ShadowIndex * 6 + face], -1 without shadows
+    float2 _Pad;
 };
 
 struct directional_light
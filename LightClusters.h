@@ -0,0 +1,279 @@
+#pragma once
+
+#include <bit>
+
+// Clustered point lights
+// The view frustum is split into a grid of clusters, c_LightClustersX by c_LightClustersY tiles on screen and c_LightClustersZ slices
+// in depth. Every frame the point lights are binned into the clusters they touch and the main pass only loops over the lights
+// of the cluster its pixel is in, so the cost of a pixel follows the lights near it and not how many there are in total.
+//
+// Slice 0 goes from the near plane to c_LightClusterNearDepth, the others are spaced exponentially from there to the far plane
+// so clusters stay roughly as deep as they are wide. Cluster bounds are view space boxes around their piece of the frustum,
+// rebuilt only when the projection or the viewport changes. Lights are spheres, each is tested against the slices its depth range
+// touches, a row of clusters at a time with SIMD. Hits are collected as (cluster, light) pairs in light order, then counted
+// and scattered into the lists.
+//
+// With a light tree and a LightBudget, clusters with more lights than the budget keep only the most important ones, so the cost
+// of a pixel is capped and what is lost are the lights that add the least. The tree has to be in view space.
+//
+// The buffer Quad.hlsl reads as g_LightClusters:
+// [c_LightClusterCount headers, Offset << 10 | Count][light indices]
+// Offsets are from the start of the buffer, the lights of a cluster are in ascending order.
+
+inline constexpr u32 c_LightClustersX = 16; // Same in Quad.hlsl
+inline constexpr u32 c_LightClustersY = 9;
+inline constexpr u32 c_LightClustersZ = 24;
+inline constexpr u32 c_LightClusterCount = c_LightClustersX * c_LightClustersY * c_LightClustersZ;
+inline constexpr u32 c_MaxLightClusterIndices = 512 * 1024; // Light lists of every cluster together, lights past it are dropped
+inline constexpr f32 c_LightClusterNearDepth = 1.0f; // End of the first slice, everything closer is one slice
+inline constexpr u32 c_LightClusterBufferSize = c_LightClusterCount + c_MaxLightClusterIndices;
+inline constexpr u32 c_LightClusterCountBits = 10;
+inline constexpr u32 c_MaxLightsPerCluster = (1u << c_LightClusterCountBits) - 1; // Lights past it are dropped
+static_assert(c_LightClustersX % c_SimdWidth == 0, "A row of clusters has to be whole SIMD vectors!");
+static_assert(c_LightClusterBufferSize < (1u << (32 - c_LightClusterCountBits)), "Cluster offsets do not fit!");
+
+struct light_cluster_stats
+{
+	u32 Lights;           // Point lights that touch the frustum
+	u32 Clusters;         // With at least one light
+	u32 MaxClusterLights;
+	u32 Indices;
+	u32 DroppedIndices;   // Did not fit c_MaxLightClusterIndices or c_MaxLightsPerCluster
+	u32 BudgetClusters;   // Had more lights than LightBudget
+	u32 BudgetDropped;    // Lights those left out
+	f32 CullMilliseconds;
+};
+
+struct light_clusters
+{
+	u32 LightBudget; // Most lights a cluster keeps when there is a light tree, 0 keeps them all
+
+	// View space bounds, [Z][Y][X] so a row is whole SIMD vectors. Built for Projection and the viewport size
+	m4 Projection;
+	v2 ViewportSize;
+	f32 MinX[c_LightClusterCount];
+	f32 MinY[c_LightClusterCount];
+	f32 MinZ[c_LightClusterCount];
+	f32 MaxX[c_LightClusterCount];
+	f32 MaxY[c_LightClusterCount];
+	f32 MaxZ[c_LightClusterCount];
+	f32 SliceDepths[c_LightClustersZ + 1];
+
+	// Slice = log2(ViewDepth) * DepthScale + DepthBias
+	f32 DepthScale;
+	f32 DepthBias;
+
+	// Hits of the frame in light order
+	u32 PairClusters[c_MaxLightClusterIndices];
+	u32 PairLights[c_MaxLightClusterIndices];
+	u32 PairCount;
+	u32 ClusterCounts[c_LightClusterCount]; // Then the write cursors
+
+	u32 Data[c_LightClusterBufferSize];  // Uploaded as it is
+	u32 DataSize;                        // In u32s, headers and the indices that were written
+
+	light_cluster_stats Stats;
+};
+
+// Bins the lights of the store, writes light_environment::LightClusterScale. Tree can be null, it has to be updated for Lights
+// in the view space of Camera
+internal const light_cluster_stats& LightClusters_Build(light_clusters* Clusters, const camera& Camera, f32 ViewportWidth, f32 ViewportHeight, const light_store* Lights, light_tree* Tree, light_environment* Environment);
+
+// Same as LightClusterIndex in Quad.hlsl, Scale is light_environment::LightClusterScale
+inline u32 LightClusters_GetIndex(const v4& Scale, f32 PixelX, f32 PixelY, f32 ViewDepth);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+inline u32 LightClusters_GetSlice(f32 Scale, f32 Bias, f32 ViewDepth)
+{
+	f32 Slice = glm::floor(glm::log2(glm::max(ViewDepth, FLT_MIN)) * Scale + Bias);
+	return (u32)glm::clamp(Slice, 0.0f, (f32)(c_LightClustersZ - 1));
+}
+
+inline u32 LightClusters_GetIndex(const v4& Scale, f32 PixelX, f32 PixelY, f32 ViewDepth)
+{
+	u32 X = glm::min((u32)(PixelX * Scale.x), c_LightClustersX - 1);
+	u32 Y = glm::min((u32)(PixelY * Scale.y), c_LightClustersY - 1);
+	u32 Z = LightClusters_GetSlice(Scale.z, Scale.w, ViewDepth);
+	return (Z * c_LightClustersY + Y) * c_LightClustersX + X;
+}
+
+// Symmetric perspective projection, a view space point at depth Z lands on NDC X * Z / Projection[0][0]
+internal void LightClusters_BuildBounds(light_clusters* Clusters, const camera& Camera, f32 ViewportWidth, f32 ViewportHeight)
+{
+	Clusters->Projection = Camera.Projection;
+	Clusters->ViewportSize = v2(ViewportWidth, ViewportHeight);
+
+	const f32 Near = Camera.PerspectiveNear;
+	const f32 Far = Camera.PerspectiveFar;
+	const f32 First = glm::max(c_LightClusterNearDepth, Near);
+
+	Clusters->DepthScale = (c_LightClustersZ - 1) / glm::log2(Far / First);
+	Clusters->DepthBias = 1.0f - glm::log2(First) * Clusters->DepthScale;
+
+	Clusters->SliceDepths[0] = Near;
+	for (u32 Z = 1; Z <= c_LightClustersZ; Z++)
+		Clusters->SliceDepths[Z] = First * glm::pow(Far / First, (f32)(Z - 1) / (c_LightClustersZ - 1));
+
+	const f32 InvScaleX = 1.0f / Camera.Projection[0][0];
+	const f32 InvScaleY = 1.0f / Camera.Projection[1][1];
+
+	for (u32 Z = 0; Z < c_LightClustersZ; Z++)
+	{
+		f32 ZNear = Clusters->SliceDepths[Z];
+		f32 ZFar = Clusters->SliceDepths[Z + 1];
+
+		for (u32 Y = 0; Y < c_LightClustersY; Y++)
+		{
+			// Rows go down while NDC Y goes up
+			f32 Bottom = (1.0f - 2.0f * (Y + 1) / c_LightClustersY) * InvScaleY;
+			f32 Top = (1.0f - 2.0f * Y / c_LightClustersY) * InvScaleY;
+
+			for (u32 X = 0; X < c_LightClustersX; X++)
+			{
+				f32 Left = (2.0f * X / c_LightClustersX - 1.0f) * InvScaleX;
+				f32 Right = (2.0f * (X + 1) / c_LightClustersX - 1.0f) * InvScaleX;
+
+				u32 Index = (Z * c_LightClustersY + Y) * c_LightClustersX + X;
+				Clusters->MinX[Index] = glm::min(Left * ZNear, Left * ZFar);
+				Clusters->MaxX[Index] = glm::max(Right * ZNear, Right * ZFar);
+				Clusters->MinY[Index] = glm::min(Bottom * ZNear, Bottom * ZFar);
+				Clusters->MaxY[Index] = glm::max(Top * ZNear, Top * ZFar);
+				Clusters->MinZ[Index] = ZNear;
+				Clusters->MaxZ[Index] = ZFar;
+			}
+		}
+	}
+}
+
+internal const light_cluster_stats& LightClusters_Build(light_clusters* Clusters, const camera& Camera, f32 ViewportWidth, f32 ViewportHeight, const light_store* Lights, light_tree* Tree, light_environment* Environment)
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto Start = clock::now();
+
+	light_cluster_stats& Stats = Clusters->Stats;
+	Stats = {};
+
+	if (Clusters->Projection != Camera.Projection || Clusters->ViewportSize != v2(ViewportWidth, ViewportHeight))
+		LightClusters_BuildBounds(Clusters, Camera, ViewportWidth, ViewportHeight);
+
+	Environment->LightClusterScale = v4(c_LightClustersX / ViewportWidth, c_LightClustersY / ViewportHeight, Clusters->DepthScale, Clusters->DepthBias);
+
+	memset(Clusters->ClusterCounts, 0, sizeof(Clusters->ClusterCounts));
+	Clusters->PairCount = 0;
+
+	// 1. Every light adds a pair per cluster its sphere touches
+	const f32x8 Zero = F32x8Zero();
+	for (u32 i = 0; i < Lights->Count; i++)
+	{
+		v3 Center = v3(Camera.View * v4(LightStore_GetPosition(Lights, i), 1.0f));
+		f32 Radius = Lights->Radius[i];
+
+		if (Center.z + Radius < Clusters->SliceDepths[0] || Center.z - Radius > Clusters->SliceDepths[c_LightClustersZ])
+			continue;
+
+		u32 FirstSlice = LightClusters_GetSlice(Clusters->DepthScale, Clusters->DepthBias, Center.z - Radius);
+		u32 LastSlice = LightClusters_GetSlice(Clusters->DepthScale, Clusters->DepthBias, Center.z + Radius);
+
+		f32x8 CenterX = F32x8(Center.x), CenterY = F32x8(Center.y), CenterZ = F32x8(Center.z);
+		f32x8 RadiusSquared = F32x8(Radius * Radius);
+		bool Touched = false;
+
+		for (u32 Z = FirstSlice; Z <= LastSlice; Z++)
+		{
+			for (u32 Row = Z * c_LightClustersY * c_LightClustersX; Row < (Z + 1) * c_LightClustersY * c_LightClustersX; Row += c_SimdWidth)
+			{
+				// Distance from the center to the box, per axis
+				f32x8 DX = Max(Max(F32x8Load(Clusters->MinX + Row) - CenterX, CenterX - F32x8Load(Clusters->MaxX + Row)), Zero);
+				f32x8 DY = Max(Max(F32x8Load(Clusters->MinY + Row) - CenterY, CenterY - F32x8Load(Clusters->MaxY + Row)), Zero);
+				f32x8 DZ = Max(Max(F32x8Load(Clusters->MinZ + Row) - CenterZ, CenterZ - F32x8Load(Clusters->MaxZ + Row)), Zero);
+
+				u32 Hits = MoveMask(MulAdd(DX, DX, MulAdd(DY, DY, DZ * DZ)) <= RadiusSquared);
+				Touched |= Hits != 0;
+				while (Hits)
+				{
+					u32 Cluster = Row + std::countr_zero(Hits);
+					Hits &= Hits - 1;
+
+					if (Clusters->PairCount == c_MaxLightClusterIndices)
+					{
+						Stats.DroppedIndices++;
+						continue;
+					}
+
+					Clusters->PairClusters[Clusters->PairCount] = Cluster;
+					Clusters->PairLights[Clusters->PairCount] = i;
+					Clusters->PairCount++;
+					Clusters->ClusterCounts[Cluster]++;
+				}
+			}
+		}
+
+		Stats.Lights += Touched;
+	}
+
+	// 2. Headers, the counts become write cursors
+	const bool UseBudget = Tree && Clusters->LightBudget > 0;
+	const u32 Budget = glm::min(Clusters->LightBudget, c_MaxLightsPerCluster);
+	u32 Offset = c_LightClusterCount;
+	for (u32 Cluster = 0; Cluster < c_LightClusterCount; Cluster++)
+	{
+		u32 Count = Clusters->ClusterCounts[Cluster];
+		Stats.Clusters += Count > 0;
+		Stats.MaxClusterLights = glm::max(Stats.MaxClusterLights, Count);
+
+		if (UseBudget && Count > Budget)
+		{
+			// The tree writes the list right away, a full cursor makes step 3 skip the cluster
+			aabb Box = { v3(Clusters->MinX[Cluster], Clusters->MinY[Cluster], Clusters->MinZ[Cluster]), v3(Clusters->MaxX[Cluster], Clusters->MaxY[Cluster], Clusters->MaxZ[Cluster]) };
+			u32* List = Clusters->Data + Offset;
+			u32 Selected = LightTree_Select(Tree, Box, Budget, List);
+
+			// Lists are in ascending order
+			for (u32 i = 1; i < Selected; i++)
+			{
+				u32 Light = List[i];
+				u32 j = i;
+				for (; j > 0 && List[j - 1] > Light; j--)
+					List[j] = List[j - 1];
+				List[j] = Light;
+			}
+
+			Stats.BudgetClusters++;
+			Stats.BudgetDropped += Count - Selected;
+
+			Clusters->Data[Cluster] = Offset << c_LightClusterCountBits | Selected;
+			Clusters->ClusterCounts[Cluster] = Offset + Selected;
+			Offset += Selected;
+			continue;
+		}
+
+		if (Count > c_MaxLightsPerCluster)
+		{
+			Stats.DroppedIndices += Count - c_MaxLightsPerCluster;
+			Count = c_MaxLightsPerCluster;
+		}
+
+		Clusters->Data[Cluster] = Offset << c_LightClusterCountBits | Count;
+		Clusters->ClusterCounts[Cluster] = Offset;
+		Offset += Count;
+	}
+
+	// 3. Pairs are in light order, so are the lists
+	for (u32 i = 0; i < Clusters->PairCount; i++)
+	{
+		u32 Cluster = Clusters->PairClusters[i];
+		u32 Header = Clusters->Data[Cluster];
+		if (Clusters->ClusterCounts[Cluster] < (Header >> c_LightClusterCountBits) + (Header & c_MaxLightsPerCluster))
+			Clusters->Data[Clusters->ClusterCounts[Cluster]++] = Clusters->PairLights[i];
+	}
+
+	Clusters->DataSize = Offset;
+	Stats.Indices = Offset - c_LightClusterCount;
+	Stats.CullMilliseconds = std::chrono::duration<f32, std::milli>(clock::now() - Start).count();
+	return Stats;
+}
@@ -0,0 +1,377 @@
+#pragma once
+
+// Point light store
+// Lights stay here between frames instead of being pushed again every frame. Fields are parallel dense arrays like the entity store,
+// handles point to a slot which maps to the current dense index and removing swaps the last light into the hole.
+//
+// The GPU reads the lights as a structured buffer of point_light in dense order. Every change marks its dense index dirty and every
+// frame in flight keeps its own dirty range, so a frame only packs and uploads what changed since its buffer was written last.
+// With nothing moving that is nothing at all.
+//
+// Animated lights flicker and orbit around where they were created, LightStore_Animate updates them 8 at a time over the arrays.
+
+inline constexpr u32 c_MaxPointLights = 32 * 1024; // Capacity of the store the backends create
+
+enum class light_flags : u32
+{
+	None = 0,
+	CastsShadow = 1 << 0, // Can get one of the c_MaxPointShadows shadow cubes, see PointShadows_BeginFrame
+	Animated = 1 << 1,
+};
+
+ENABLE_BITWISE_OPERATORS(light_flags, u32)
+
+struct light_handle
+{
+	u32 Slot;
+	u32 Generation; // 0 is never valid, so a zeroed handle is a null handle
+};
+
+struct light_animation
+{
+	f32 Flicker;     // Part of the intensity that comes and goes
+	f32 FlickerRate; // Radians per second
+	f32 OrbitRadius; // Circle in XZ around the position the light was created at
+	f32 OrbitRate;   // Radians per second
+	f32 Phase;
+};
+
+struct light_store
+{
+	u32 Capacity; // Multiple of the SIMD width, the arrays can be read 8 at a time past Count
+	u32 Count;
+
+	// Dense, [0, Count)
+	f32* PositionX;
+	f32* PositionY;
+	f32* PositionZ;
+	f32* Radius;
+	f32* FallOff;
+	f32* RadianceR;
+	f32* RadianceG;
+	f32* RadianceB;
+	f32* Intensity;
+	i32* ShadowIndex; // Written by PointShadows_BeginFrame and PointShadows_AssignTiles, -1 without a shadow cube
+	light_flags* Flags;
+
+	// Animation, what animated lights are computed from
+	f32* BaseX;
+	f32* BaseZ;
+	f32* BaseIntensity;
+	f32* Flicker;
+	f32* FlickerRate;
+	f32* OrbitRadius;
+	f32* OrbitRate;
+	f32* Phase;
+
+	u32* DenseToSlot;
+
+	// Sparse, [0, Capacity)
+	u32* SlotToDense; // Next free slot while the slot is unused
+	u32* Generations;
+	u32 FreeSlot;
+	u32 SlotCount;
+
+	// Dense range [Begin, End) that changed since the buffer of the frame in flight was written
+	u32 DirtyBegin[FIF];
+	u32 DirtyEnd[FIF];
+};
+
+internal void LightStore_Initialize(light_store* Store, u32 Capacity);
+internal void LightStore_Destroy(light_store* Store);
+
+internal light_handle LightStore_Create(light_store* Store, v3 Position, f32 Radius, f32 FallOff, v3 Radiance, f32 Intensity, light_flags Flags = light_flags::None);
+internal void LightStore_Remove(light_store* Store, light_handle Handle);
+internal bool LightStore_IsValid(const light_store* Store, light_handle Handle);
+internal u32 LightStore_GetIndex(const light_store* Store, light_handle Handle);
+
+internal void LightStore_SetPosition(light_store* Store, light_handle Handle, v3 Position);
+internal void LightStore_SetAnimation(light_store* Store, light_handle Handle, const light_animation& Animation);
+
+// By dense index, only marks the light dirty when the index changes
+internal void LightStore_SetShadowIndex(light_store* Store, u32 Index, i32 ShadowIndex);
+
+// Moves and flickers every animated light, returns how many there are
+internal u32 LightStore_Animate(light_store* Store, f32 Time);
+
+// Packs the lights that changed since the last call for this frame in flight into Lights (a mapped buffer of Capacity lights).
+// Returns how many were written
+internal u32 LightStore_Upload(light_store* Store, u32 Frame, point_light* Lights);
+
+inline v3 LightStore_GetPosition(const light_store* Store, u32 Index) { return v3(Store->PositionX[Index], Store->PositionY[Index], Store->PositionZ[Index]); }
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+inline constexpr u32 c_InvalidLightSlot = 0xFFFFFFFF;
+
+inline void LightStore_MarkDirty(light_store* Store, u32 Begin, u32 End)
+{
+	for (u32 Frame = 0; Frame < FIF; Frame++)
+	{
+		Store->DirtyBegin[Frame] = glm::min(Store->DirtyBegin[Frame], Begin);
+		Store->DirtyEnd[Frame] = glm::max(Store->DirtyEnd[Frame], End);
+	}
+}
+
+internal void LightStore_Initialize(light_store* Store, u32 Capacity)
+{
+	*Store = {};
+	Capacity = (Capacity + c_SimdWidth - 1) & ~(c_SimdWidth - 1);
+	Store->Capacity = Capacity;
+
+	Store->PositionX = VmAllocArray(f32, Capacity);
+	Store->PositionY = VmAllocArray(f32, Capacity);
+	Store->PositionZ = VmAllocArray(f32, Capacity);
+	Store->Radius = VmAllocArray(f32, Capacity);
+	Store->FallOff = VmAllocArray(f32, Capacity);
+	Store->RadianceR = VmAllocArray(f32, Capacity);
+	Store->RadianceG = VmAllocArray(f32, Capacity);
+	Store->RadianceB = VmAllocArray(f32, Capacity);
+	Store->Intensity = VmAllocArray(f32, Capacity);
+	Store->ShadowIndex = VmAllocArray(i32, Capacity);
+	Store->Flags = VmAllocArray(light_flags, Capacity);
+
+	Store->BaseX = VmAllocArray(f32, Capacity);
+	Store->BaseZ = VmAllocArray(f32, Capacity);
+	Store->BaseIntensity = VmAllocArray(f32, Capacity);
+	Store->Flicker = VmAllocArray(f32, Capacity);
+	Store->FlickerRate = VmAllocArray(f32, Capacity);
+	Store->OrbitRadius = VmAllocArray(f32, Capacity);
+	Store->OrbitRate = VmAllocArray(f32, Capacity);
+	Store->Phase = VmAllocArray(f32, Capacity);
+
+	Store->DenseToSlot = VmAllocArray(u32, Capacity);
+	Store->SlotToDense = VmAllocArray(u32, Capacity);
+	Store->Generations = VmAllocArray(u32, Capacity);
+	Store->FreeSlot = c_InvalidLightSlot;
+
+	for (u32 Frame = 0; Frame < FIF; Frame++)
+		Store->DirtyBegin[Frame] = Capacity;
+}
+
+internal void LightStore_Destroy(light_store* Store)
+{
+	VmFree(Store->PositionX);
+	VmFree(Store->PositionY);
+	VmFree(Store->PositionZ);
+	VmFree(Store->Radius);
+	VmFree(Store->FallOff);
+	VmFree(Store->RadianceR);
+	VmFree(Store->RadianceG);
+	VmFree(Store->RadianceB);
+	VmFree(Store->Intensity);
+	VmFree(Store->ShadowIndex);
+	VmFree(Store->Flags);
+
+	VmFree(Store->BaseX);
+	VmFree(Store->BaseZ);
+	VmFree(Store->BaseIntensity);
+	VmFree(Store->Flicker);
+	VmFree(Store->FlickerRate);
+	VmFree(Store->OrbitRadius);
+	VmFree(Store->OrbitRate);
+	VmFree(Store->Phase);
+
+	VmFree(Store->DenseToSlot);
+	VmFree(Store->SlotToDense);
+	VmFree(Store->Generations);
+	*Store = {};
+}
+
+internal light_handle LightStore_Create(light_store* Store, v3 Position, f32 Radius, f32 FallOff, v3 Radiance, f32 Intensity, light_flags Flags)
+{
+	Assert(Store->Count < Store->Capacity, "Light store is full!");
+
+	u32 Slot;
+	if (Store->FreeSlot != c_InvalidLightSlot)
+	{
+		Slot = Store->FreeSlot;
+		Store->FreeSlot = Store->SlotToDense[Slot];
+	}
+	else
+	{
+		Slot = Store->SlotCount++;
+	}
+
+	if (Store->Generations[Slot] == 0)
+		Store->Generations[Slot] = 1;
+
+	u32 Index = Store->Count++;
+	Store->SlotToDense[Slot] = Index;
+	Store->DenseToSlot[Index] = Slot;
+
+	Store->PositionX[Index] = Position.x;
+	Store->PositionY[Index] = Position.y;
+	Store->PositionZ[Index] = Position.z;
+	Store->Radius[Index] = Radius;
+	Store->FallOff[Index] = FallOff;
+	Store->RadianceR[Index] = Radiance.r;
+	Store->RadianceG[Index] = Radiance.g;
+	Store->RadianceB[Index] = Radiance.b;
+	Store->Intensity[Index] = Intensity;
+	Store->ShadowIndex[Index] = -1;
+	Store->Flags[Index] = Flags & ~light_flags::Animated;
+
+	Store->BaseX[Index] = Position.x;
+	Store->BaseZ[Index] = Position.z;
+	Store->BaseIntensity[Index] = Intensity;
+
+	LightStore_MarkDirty(Store, Index, Index + 1);
+	return { Slot, Store->Generations[Slot] };
+}
+
+internal bool LightStore_IsValid(const light_store* Store, light_handle Handle)
+{
+	return Handle.Generation != 0 && Handle.Slot < Store->SlotCount && Store->Generations[Handle.Slot] == Handle.Generation;
+}
+
+internal u32 LightStore_GetIndex(const light_store* Store, light_handle Handle)
+{
+	Assert(LightStore_IsValid(Store, Handle), "Invalid light handle!");
+	return Store->SlotToDense[Handle.Slot];
+}
+
+internal void LightStore_Remove(light_store* Store, light_handle Handle)
+{
+	if (!LightStore_IsValid(Store, Handle))
+		return;
+
+	u32 Index = Store->SlotToDense[Handle.Slot];
+	u32 Last = --Store->Count;
+
+	// Swap-remove, the last light fills the hole. What is past Count on the GPU is never read
+	if (Index != Last)
+	{
+		Store->PositionX[Index] = Store->PositionX[Last];
+		Store->PositionY[Index] = Store->PositionY[Last];
+		Store->PositionZ[Index] = Store->PositionZ[Last];
+		Store->Radius[Index] = Store->Radius[Last];
+		Store->FallOff[Index] = Store->FallOff[Last];
+		Store->RadianceR[Index] = Store->RadianceR[Last];
+		Store->RadianceG[Index] = Store->RadianceG[Last];
+		Store->RadianceB[Index] = Store->RadianceB[Last];
+		Store->Intensity[Index] = Store->Intensity[Last];
+		Store->ShadowIndex[Index] = Store->ShadowIndex[Last];
+		Store->Flags[Index] = Store->Flags[Last];
+
+		Store->BaseX[Index] = Store->BaseX[Last];
+		Store->BaseZ[Index] = Store->BaseZ[Last];
+		Store->BaseIntensity[Index] = Store->BaseIntensity[Last];
+		Store->Flicker[Index] = Store->Flicker[Last];
+		Store->FlickerRate[Index] = Store->FlickerRate[Last];
+		Store->OrbitRadius[Index] = Store->OrbitRadius[Last];
+		Store->OrbitRate[Index] = Store->OrbitRate[Last];
+		Store->Phase[Index] = Store->Phase[Last];
+
+		u32 MovedSlot = Store->DenseToSlot[Last];
+		Store->DenseToSlot[Index] = MovedSlot;
+		Store->SlotToDense[MovedSlot] = Index;
+
+		LightStore_MarkDirty(Store, Index, Index + 1);
+	}
+
+	// The last one is not animated anymore, animation reads whole SIMD blocks
+	Store->Flags[Last] = light_flags::None;
+
+	// Old handles die with the generation, skip 0 on wrap around
+	if (++Store->Generations[Handle.Slot] == 0)
+		Store->Generations[Handle.Slot] = 1;
+
+	Store->SlotToDense[Handle.Slot] = Store->FreeSlot;
+	Store->FreeSlot = Handle.Slot;
+}
+
+internal void LightStore_SetPosition(light_store* Store, light_handle Handle, v3 Position)
+{
+	u32 Index = LightStore_GetIndex(Store, Handle);
+	Store->PositionX[Index] = Store->BaseX[Index] = Position.x;
+	Store->PositionY[Index] = Position.y;
+	Store->PositionZ[Index] = Store->BaseZ[Index] = Position.z;
+	LightStore_MarkDirty(Store, Index, Index + 1);
+}
+
+internal void LightStore_SetAnimation(light_store* Store, light_handle Handle, const light_animation& Animation)
+{
+	u32 Index = LightStore_GetIndex(Store, Handle);
+	Store->Flicker[Index] = Animation.Flicker;
+	Store->FlickerRate[Index] = Animation.FlickerRate;
+	Store->OrbitRadius[Index] = Animation.OrbitRadius;
+	Store->OrbitRate[Index] = Animation.OrbitRate;
+	Store->Phase[Index] = Animation.Phase;
+	Store->Flags[Index] |= light_flags::Animated;
+}
+
+internal void LightStore_SetShadowIndex(light_store* Store, u32 Index, i32 ShadowIndex)
+{
+	if (Store->ShadowIndex[Index] == ShadowIndex)
+		return;
+
+	Store->ShadowIndex[Index] = ShadowIndex;
+	LightStore_MarkDirty(Store, Index, Index + 1);
+}
+
+internal u32 LightStore_Animate(light_store* Store, f32 Time)
+{
+	const i32x8 Animated = I32x8((i32)light_flags::Animated);
+	const f32x8 Half = F32x8(0.5f);
+	const f32x8 T = F32x8(Time);
+
+	u32 AnimatedCount = 0;
+	u32 Begin = Store->Capacity, End = 0;
+	for (u32 i = 0; i < Store->Count; i += c_SimdWidth)
+	{
+		// Lights past Count have no flags
+		f32x8 Mask = AsF32((I32x8Load((const i32*)Store->Flags + i) & Animated) == Animated);
+		u32 Bits = MoveMask(Mask);
+		if (Bits == 0)
+			continue;
+
+		f32x8 Orbit = MulAdd(T, F32x8Load(Store->OrbitRate + i), F32x8Load(Store->Phase + i));
+		f32x8 OrbitRadius = F32x8Load(Store->OrbitRadius + i);
+		f32x8 X = MulAdd(OrbitRadius, Cos(Orbit), F32x8Load(Store->BaseX + i));
+		f32x8 Z = MulAdd(OrbitRadius, Sin(Orbit), F32x8Load(Store->BaseZ + i));
+
+		// Intensity goes between Base * (1 - Flicker) and Base
+		f32x8 Wave = MulAdd(Sin(MulAdd(T, F32x8Load(Store->FlickerRate + i), F32x8Load(Store->Phase + i))), Half, Half);
+		f32x8 Intensity = F32x8Load(Store->BaseIntensity + i) * (F32x8(1.0f) - F32x8Load(Store->Flicker + i) * Wave);
+
+		F32x8Store(Store->PositionX + i, Select(Mask, X, F32x8Load(Store->PositionX + i)));
+		F32x8Store(Store->PositionZ + i, Select(Mask, Z, F32x8Load(Store->PositionZ + i)));
+		F32x8Store(Store->Intensity + i, Select(Mask, Intensity, F32x8Load(Store->Intensity + i)));
+
+		AnimatedCount += std::popcount(Bits);
+		Begin = glm::min(Begin, i + std::countr_zero(Bits));
+		End = i + 32 - std::countl_zero(Bits);
+	}
+
+	if (AnimatedCount > 0)
+		LightStore_MarkDirty(Store, Begin, End);
+
+	return AnimatedCount;
+}
+
+internal u32 LightStore_Upload(light_store* Store, u32 Frame, point_light* Lights)
+{
+	u32 Begin = Store->DirtyBegin[Frame];
+	u32 End = glm::min(Store->DirtyEnd[Frame], Store->Count);
+
+	for (u32 i = Begin; i < End; i++)
+	{
+		point_light& Light = Lights[i];
+		Light.Position = LightStore_GetPosition(Store, i);
+		Light.Intensity = Store->Intensity[i];
+		Light.Radiance = v3(Store->RadianceR[i], Store->RadianceG[i], Store->RadianceB[i]);
+		Light.Radius = Store->Radius[i];
+		Light.FallOff = Store->FallOff[i];
+		Light.ShadowIndex = Store->ShadowIndex[i];
+		Light._Pad0 = v2(0.0f);
+	}
+
+	Store->DirtyBegin[Frame] = Store->Capacity;
+	Store->DirtyEnd[Frame] = 0;
+	return End > Begin ? End - Begin : 0;
+}
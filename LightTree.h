@@ -0,0 +1,336 @@
+#pragma once
+
+#include <bit>
+
+// Light tree
+// A binary tree over the lights of the store for finding the ones that matter most to a region when there are too many to shade
+// them all. Lights are sorted along a Morton curve of their positions and the tree is built over that order. It is complete and
+// implicit like a heap: node 1 is the root, the children of N are 2N and 2N + 1 and the leaves are the last LeafCount nodes,
+// padded with empty ones up to a power of two.
+//
+// A node keeps the bounds of its lights' positions, their largest radius, their summed power and the largest power of one of them.
+// Point lights shine the same way in every direction, so there is no orientation cone to keep.
+//
+// Node bounds are in the space the tree was last refit in, the view for the light clusters, so their boxes need no transform.
+// The order only depends on where the lights are relative to each other, which a rigid transform keeps.
+//
+// Refit recomputes the nodes bottom up in the order of the last build. It stays correct however the lights move, only looser,
+// so LightTree_Update rebuilds when the light count changes or every c_LightTreeRebuildInterval updates and refits otherwise.
+//
+// LightTree_Select is a branch and bound. The importance of a node bounds the importance of every light under it, so subtrees
+// that cannot beat the worst of the lights picked so far are skipped, as are the ones that cannot reach at all. The bound uses the
+// largest power and not the sum, a node full of weak lights does not have to be opened before one strong light.
+
+inline constexpr u32 c_LightTreeRebuildInterval = 30;
+
+struct light_tree_node
+{
+	v3 Min;
+	f32 Power;    // Intensity times the luminance of the radiance, summed
+	v3 Max;
+	f32 MaxRadius;
+	f32 MaxPower;
+};
+
+struct light_tree_stats
+{
+	u32 Lights;
+	u32 Leaves;
+	bool Rebuilt;
+	f32 Milliseconds;
+};
+
+struct light_tree_entry
+{
+	f32 Importance;
+	u32 Node;
+};
+
+struct light_tree
+{
+	u32 Capacity;  // Leaves, a power of two
+	u32 LeafCount; // Smallest power of two that fits LightCount
+	u32 LightCount;
+	u32 UpdatesSinceBuild;
+
+	light_tree_node* Nodes;     // [1, 2 * LeafCount)
+	u32* Lights;                // Leaf -> dense light index
+	u32* Keys;                  // Morton codes while sorting
+	u32* SortLights;
+	u32* SortKeys;
+	light_tree_entry* Heap; // Best lights in LightTree_Select
+
+	light_tree_stats Stats;
+};
+
+internal void LightTree_Initialize(light_tree* Tree, u32 Capacity);
+internal void LightTree_Destroy(light_tree* Tree);
+
+// Builds or refits for the lights of the store with the bounds in the space of Transform, see the top of the file
+internal const light_tree_stats& LightTree_Update(light_tree* Tree, const light_store* Lights, const m4& Transform);
+internal void LightTree_Build(light_tree* Tree, const light_store* Lights, const m4& Transform);
+internal void LightTree_Refit(light_tree* Tree, const light_store* Lights, const m4& Transform);
+
+// Writes the dense indices of the at most MaxLights most important lights for a box, in the space of the tree, to Result,
+// in no particular order.
+// Lights that cannot reach the box are never selected. Returns how many were written
+internal u32 LightTree_Select(light_tree* Tree, const aabb& Box, u32 MaxLights, u32* Result);
+
+// Upper bound of what any one light under the node adds to a point in the box, attenuation without the fall off
+inline f32 LightTree_GetImportance(const light_tree_node& Node, const aabb& Box);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+inline f32 LightTree_GetImportance(const light_tree_node& Node, const aabb& Box)
+{
+	// Closest the positions get to the box, every light is at least this far away
+	v3 Distance = glm::max(glm::max(Node.Min - Box.Max, Box.Min - Node.Max), v3(0.0f));
+	f32 DistanceSquared = glm::dot(Distance, Distance);
+	f32 RadiusSquared = Node.MaxRadius * Node.MaxRadius;
+	if (DistanceSquared >= RadiusSquared)
+		return 0.0f;
+
+	return Node.MaxPower * (1.0f - DistanceSquared / RadiusSquared);
+}
+
+// 10 bits per axis, interleaved
+inline u32 LightTree_SpreadBits(u32 X)
+{
+	X &= 0x3FF;
+	X = (X | (X << 16)) & 0x030000FF;
+	X = (X | (X << 8)) & 0x0300F00F;
+	X = (X | (X << 4)) & 0x030C30C3;
+	X = (X | (X << 2)) & 0x09249249;
+	return X;
+}
+
+internal void LightTree_Initialize(light_tree* Tree, u32 Capacity)
+{
+	*Tree = {};
+	Tree->Capacity = std::bit_ceil(glm::max(Capacity, 1u));
+	Tree->Nodes = VmAllocArray(light_tree_node, 2 * Tree->Capacity);
+	Tree->Lights = VmAllocArray(u32, Tree->Capacity);
+	Tree->Keys = VmAllocArray(u32, Tree->Capacity);
+	Tree->SortLights = VmAllocArray(u32, Tree->Capacity);
+	Tree->SortKeys = VmAllocArray(u32, Tree->Capacity);
+	Tree->Heap = VmAllocArray(light_tree_entry, Tree->Capacity);
+}
+
+internal void LightTree_Destroy(light_tree* Tree)
+{
+	VmFree(Tree->Nodes);
+	VmFree(Tree->Lights);
+	VmFree(Tree->Keys);
+	VmFree(Tree->SortLights);
+	VmFree(Tree->SortKeys);
+	VmFree(Tree->Heap);
+	*Tree = {};
+}
+
+internal const light_tree_stats& LightTree_Update(light_tree* Tree, const light_store* Lights, const m4& Transform)
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto Start = clock::now();
+
+	light_tree_stats& Stats = Tree->Stats;
+	Stats = {};
+
+	Stats.Rebuilt = Tree->LeafCount == 0 || Lights->Count != Tree->LightCount || ++Tree->UpdatesSinceBuild >= c_LightTreeRebuildInterval;
+	if (Stats.Rebuilt)
+		LightTree_Build(Tree, Lights, Transform);
+	else
+		LightTree_Refit(Tree, Lights, Transform);
+
+	Stats.Lights = Tree->LightCount;
+	Stats.Leaves = Tree->LeafCount;
+	Stats.Milliseconds = std::chrono::duration<f32, std::milli>(clock::now() - Start).count();
+	return Stats;
+}
+
+internal void LightTree_Build(light_tree* Tree, const light_store* Lights, const m4& Transform)
+{
+	Assert(Lights->Count <= Tree->Capacity, "Light tree is too small!");
+
+	const u32 Count = Lights->Count;
+	Tree->LightCount = Count;
+	Tree->LeafCount = std::bit_ceil(glm::max(Count, 1u));
+	Tree->UpdatesSinceBuild = 0;
+
+	v3 Min = v3(FLT_MAX), Max = v3(-FLT_MAX);
+	for (u32 i = 0; i < Count; i++)
+	{
+		v3 Position = LightStore_GetPosition(Lights, i);
+		Min = glm::min(Min, Position);
+		Max = glm::max(Max, Position);
+	}
+
+	v3 Scale = 1023.0f / glm::max(Max - Min, v3(1e-6f));
+	for (u32 i = 0; i < Count; i++)
+	{
+		v3 Cell = (LightStore_GetPosition(Lights, i) - Min) * Scale;
+		Tree->Keys[i] = LightTree_SpreadBits((u32)Cell.x) | LightTree_SpreadBits((u32)Cell.y) << 1 | LightTree_SpreadBits((u32)Cell.z) << 2;
+		Tree->Lights[i] = i;
+	}
+
+	// Radix sort, 3 counting passes of 10 bits. Stable, equal keys stay in dense order
+	u32* Keys = Tree->Keys;
+	u32* Indices = Tree->Lights;
+	u32* OutKeys = Tree->SortKeys;
+	u32* OutIndices = Tree->SortLights;
+	for (u32 Shift = 0; Shift < 30; Shift += 10)
+	{
+		u32 Offsets[1024] = {};
+		for (u32 i = 0; i < Count; i++)
+			Offsets[(Keys[i] >> Shift) & 0x3FF]++;
+
+		u32 Offset = 0;
+		for (u32 Bucket = 0; Bucket < 1024; Bucket++)
+		{
+			u32 BucketCount = Offsets[Bucket];
+			Offsets[Bucket] = Offset;
+			Offset += BucketCount;
+		}
+
+		for (u32 i = 0; i < Count; i++)
+		{
+			u32 Target = Offsets[(Keys[i] >> Shift) & 0x3FF]++;
+			OutKeys[Target] = Keys[i];
+			OutIndices[Target] = Indices[i];
+		}
+
+		std::swap(Keys, OutKeys);
+		std::swap(Indices, OutIndices);
+	}
+
+	// Odd number of passes, the result is in the scratch arrays
+	std::swap(Tree->Keys, Tree->SortKeys);
+	std::swap(Tree->Lights, Tree->SortLights);
+
+	LightTree_Refit(Tree, Lights, Transform);
+}
+
+internal void LightTree_Refit(light_tree* Tree, const light_store* Lights, const m4& Transform)
+{
+	Assert(Lights->Count == Tree->LightCount, "Light count changed since the build!");
+
+	light_tree_node* Leaves = Tree->Nodes + Tree->LeafCount;
+	for (u32 i = 0; i < Tree->LightCount; i++)
+	{
+		u32 Light = Tree->Lights[i];
+		v3 Radiance = v3(Lights->RadianceR[Light], Lights->RadianceG[Light], Lights->RadianceB[Light]);
+
+		light_tree_node& Leaf = Leaves[i];
+		Leaf.Min = Leaf.Max = v3(Transform * v4(LightStore_GetPosition(Lights, Light), 1.0f));
+		Leaf.Power = Leaf.MaxPower = Lights->Intensity[Light] * glm::dot(Radiance, v3(0.2126f, 0.7152f, 0.0722f));
+		Leaf.MaxRadius = Lights->Radius[Light];
+	}
+
+	// Padding reaches nothing and does not grow the bounds
+	for (u32 i = Tree->LightCount; i < Tree->LeafCount; i++)
+		Leaves[i] = { v3(FLT_MAX), 0.0f, v3(-FLT_MAX), 0.0f, 0.0f };
+
+	for (u32 Node = Tree->LeafCount - 1; Node > 0; Node--)
+	{
+		const light_tree_node& Left = Tree->Nodes[2 * Node];
+		const light_tree_node& Right = Tree->Nodes[2 * Node + 1];
+
+		light_tree_node& Parent = Tree->Nodes[Node];
+		Parent.Min = glm::min(Left.Min, Right.Min);
+		Parent.Max = glm::max(Left.Max, Right.Max);
+		Parent.Power = Left.Power + Right.Power;
+		Parent.MaxRadius = glm::max(Left.MaxRadius, Right.MaxRadius);
+		Parent.MaxPower = glm::max(Left.MaxPower, Right.MaxPower);
+	}
+}
+
+internal u32 LightTree_Select(light_tree* Tree, const aabb& Box, u32 MaxLights, u32* Result)
+{
+	if (Tree->LightCount == 0 || MaxLights == 0)
+		return 0;
+
+	const v3 Center = 0.5f * (Box.Min + Box.Max);
+
+	// Best lights so far, a min-heap so the worst one is at the top and is what a subtree has to beat
+	light_tree_entry* Best = Tree->Heap;
+	u32 Count = 0;
+
+	// Depth first, the more important child is taken first. Two entries per level at most
+	light_tree_entry Stack[64];
+	u32 StackSize = 0;
+
+	f32 RootImportance = LightTree_GetImportance(Tree->Nodes[1], Box);
+	if (RootImportance > 0.0f)
+		Stack[StackSize++] = { RootImportance, 1 };
+
+	while (StackSize > 0)
+	{
+		light_tree_entry Entry = Stack[--StackSize];
+		if (Count == MaxLights && Entry.Importance <= Best[0].Importance)
+			continue;
+
+		if (Entry.Node >= Tree->LeafCount)
+		{
+			// Ranked by the attenuation halfway between the closest point and the center of the box, a light in a corner matters less
+			// than one in the middle. Never above the bound, so the pruning still holds
+			const light_tree_node& Leaf = Tree->Nodes[Entry.Node];
+			v3 ToCenter = Leaf.Min - Center;
+			f32 Rank = 0.5f * (Leaf.Power + Entry.Importance) - 0.5f * Leaf.Power * glm::dot(ToCenter, ToCenter) / (Leaf.MaxRadius * Leaf.MaxRadius);
+			light_tree_entry Light = { glm::max(Rank, Entry.Importance * 1e-3f), Tree->Lights[Entry.Node - Tree->LeafCount] };
+
+			u32 i;
+			if (Count < MaxLights)
+			{
+				// Up from the bottom
+				for (i = Count++; i > 0 && Best[(i - 1) / 2].Importance > Light.Importance; i = (i - 1) / 2)
+					Best[i] = Best[(i - 1) / 2];
+			}
+			else
+			{
+				if (Light.Importance <= Best[0].Importance)
+					continue;
+
+				// Replaces the worst, down from the top
+				i = 0;
+				for (u32 Child = 1; Child < Count; i = Child, Child = 2 * Child + 1)
+				{
+					if (Child + 1 < Count && Best[Child + 1].Importance < Best[Child].Importance)
+						Child++;
+					if (Best[Child].Importance >= Light.Importance)
+						break;
+					Best[i] = Best[Child];
+				}
+			}
+
+			Best[i] = Light;
+			continue;
+		}
+
+		u32 Left = 2 * Entry.Node;
+		f32 LeftImportance = LightTree_GetImportance(Tree->Nodes[Left], Box);
+		f32 RightImportance = LightTree_GetImportance(Tree->Nodes[Left + 1], Box);
+
+		// The one pushed last comes out first
+		if (LeftImportance > RightImportance)
+		{
+			if (RightImportance > 0.0f)
+				Stack[StackSize++] = { RightImportance, Left + 1 };
+			Stack[StackSize++] = { LeftImportance, Left };
+		}
+		else
+		{
+			if (LeftImportance > 0.0f)
+				Stack[StackSize++] = { LeftImportance, Left };
+			if (RightImportance > 0.0f)
+				Stack[StackSize++] = { RightImportance, Left + 1 };
+		}
+	}
+
+	for (u32 i = 0; i < Count; i++)
+		Result[i] = Best[i].Node;
+
+	return Count;
+}
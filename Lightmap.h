@@ -0,0 +1,852 @@
+#pragma once
+
+// Baked lightmaps
+// Offline lighting for static blocks. Every visible block face gets a tile of TexelsPerFace x TexelsPerFace texels in a lightmap
+// atlas. Faces are unwrapped one by one straight from the blocks at full resolution, so the LODs do not change what is baked.
+// A face is visible when the block next to it is air, like in the mesher.
+//
+// Every texel gets two things, path traced on the CPU over the job system with the shadow tracer's BVH:
+// - Irradiance: the sky, bounced light and the direct light of the static lights that have no mask channel. It replaces the
+//   constant ambient of Light.hlsl, so a face under an overhang gets less sky than one in the open.
+// - A shadow mask: the visibility of up to c_LightmapMaskChannels static lights. Their direct light is still computed at runtime,
+//   but from the mask instead of a shadow map, so static lights on static geometry need no shadow map at all. The directional lights
+//   take the first channels, then the static point lights. Animated lights are left out and keep their shadow maps.
+// Paths start at jittered points of the texel, bounce Bounces times off the palette colors and take the direct light of every
+// baked light at every bounce with a shadow ray. Every texel has its own random sequence, so it bakes the same no matter which
+// thread or which bake it is in.
+//
+// Incremental rebake
+// Lightmap_InvalidateBlock marks dirty the chunks a changed block can reach:
+// - the ones within IndirectReach of it, for bounced light
+// - the ones along every directional light up to ShadowReach, for the block's shadow
+// - the ones in range of a static point light that the block is in range of too
+// The next Lightmap_Bake re-unwraps and bakes only those. Bounced light can go further than IndirectReach, but what is left there is
+// faint enough to wait for a full bake. A chunk whose blocks changed is rebaked even if nobody invalidated it.
+//
+// The geometry of a bake is the region grown by c_LightmapMarginChunks, so shadows and bounces do not stop at the region's edge.
+//
+// Lightmap_Write stores the atlas: a header, the face table and the texels of every tile, irradiance as f32 RGB and the mask as RGBA8.
+
+inline constexpr u32 c_LightmapMaskChannels = 4;
+inline constexpr i32 c_LightmapMarginChunks = 1;
+inline constexpr u32 c_LightmapFileVersion = 1;
+
+// Face normals as block offsets, c_CuboidVerticesPositions face order: -Z, +Z, -X, +X, +Y, -Y
+inline constexpr i32 c_LightmapFaceOffsets[6][3] = { { 0, 0, -1 }, { 0, 0, 1 }, { -1, 0, 0 }, { 1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 } };
+inline constexpr i32 c_LightmapFaceAxes[6] = { 2, 2, 0, 0, 1, 1 }; // Axis of the normal, texels go along the next two
+
+struct lightmap_face
+{
+	v3i Block;
+	u8 Face;  // c_LightmapFaceOffsets order
+	u8 Color; // Palette index
+	u16 _Pad0;
+};
+
+struct lightmap_chunk
+{
+	u32 FaceCount;
+	lightmap_face* Faces; // In block index order, then face order
+	v3* Irradiance;       // TexelsPerFace^2 per face, row by row
+	u32* Mask;            // RGBA8, a channel per mask light
+	u32 Version;          // Of the chunk when it was baked
+	b32 Baked;
+	b32 Dirty;
+};
+
+// What the bake needs of a light, mask lights first
+struct lightmap_light
+{
+	b32 Directional;
+	u32 Source;    // Index in the light environment, or the light store slot of a point light
+	v3 Position;   // Point lights
+	f32 Radius;
+	v3 Direction;  // Directional lights, normalized and towards the light
+	f32 FallOff;
+	v3 Diffuse;    // Radiance * Intensity * 0.8 like Light.hlsl
+};
+
+struct lightmap_settings
+{
+	u32 TexelsPerFace; // Along an edge
+	u32 Samples;       // Paths per texel, rounded up to the SIMD width
+	u32 Bounces;
+	f32 SkyRadiance;   // What a ray that gets away brings back, 0.5 is the ambient of Light.hlsl
+	f32 IndirectReach; // Blocks
+	f32 ShadowReach;   // Blocks
+	u32 Seed;
+};
+
+struct lightmap_stats
+{
+	u32 Chunks; // Baked by the last bake
+	u32 Faces;
+	u32 Texels;
+	u32 Lights;
+	u32 MaskLights;
+	u32 Triangles; // Geometry
+	u32 DroppedTriangles;
+	u64 Rays;
+	f32 GeometryMilliseconds; // Faces and the BVH
+	f32 TraceMilliseconds;
+	f32 TotalMilliseconds;
+};
+
+struct lightmap
+{
+	lightmap_settings Settings;
+	v3i RegionMin; // Chunk coordinates, [Min, Max)
+	v3i RegionMax;
+
+	lightmap_chunk* Chunks; // c_WorldChunkCount, only the region is ever baked
+
+	lightmap_light* Lights;
+	u32 MaxLights;
+	u32 LightCount;
+	u32 MaskLightCount;
+	u64 LightHash; // Of the last bake, everything is rebaked when the lights change
+
+	// Geometry
+	shadow_tracer Tracer;
+	lightmap_face* GeometryFaces; // Two triangles each, in submission order
+	u32 MaxGeometryFaces;
+
+	lightmap_stats Stats;
+};
+
+internal lightmap_settings Lightmap_GetDefaultSettings();
+internal void Lightmap_Initialize(lightmap* Lightmap, const lightmap_settings& Settings, v3i RegionMin, v3i RegionMax, u32 MaxPointLights);
+internal void Lightmap_Destroy(lightmap* Lightmap);
+
+// Bakes the chunks of the region that were never baked, are dirty or changed. The static lights are the directional lights and
+// every light of the store that is not animated
+internal const lightmap_stats& Lightmap_Bake(lightmap* Lightmap, const block_world* World, const light_environment& Environment, const light_store* Store);
+
+// Before or after the block changed, returns how many chunks became dirty
+internal u32 Lightmap_InvalidateBlock(lightmap* Lightmap, v3i Block);
+internal void Lightmap_InvalidateAll(lightmap* Lightmap);
+
+// Bilinear within the face's tile. False when the surface is not in the lightmap
+internal bool Lightmap_Sample(const lightmap* Lightmap, v3 Position, v3 Normal, v3* OutIrradiance, f32 OutMask[c_LightmapMaskChannels]);
+
+internal bool Lightmap_Write(const lightmap* Lightmap, const char* Path);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+struct lightmap_file_header
+{
+	char Magic[4]; // BLMP
+	u32 Version;
+	u32 TexelsPerFace;
+	u32 AtlasWidth; // Texels, tiles are in face order row by row
+	u32 AtlasHeight;
+	u32 FaceCount;
+	u32 MaskLightCount;
+	u32 MaskLights[c_LightmapMaskChannels]; // Directional light index, or light store slot | 0x80000000 for point lights
+};
+
+struct lightmap_file_face
+{
+	i32 Block[3];
+	u32 Face;
+};
+
+internal lightmap_settings Lightmap_GetDefaultSettings()
+{
+	lightmap_settings Settings = {};
+	Settings.TexelsPerFace = 2;
+	Settings.Samples = 64;
+	Settings.Bounces = 2;
+	Settings.SkyRadiance = 0.5f;
+	Settings.IndirectReach = 8.0f;
+	Settings.ShadowReach = 64.0f;
+	Settings.Seed = 1;
+	return Settings;
+}
+
+internal void Lightmap_Initialize(lightmap* Lightmap, const lightmap_settings& Settings, v3i RegionMin, v3i RegionMax, u32 MaxPointLights)
+{
+	*Lightmap = {};
+	Lightmap->Settings = Settings;
+	Lightmap->Settings.TexelsPerFace = glm::max(Settings.TexelsPerFace, 1u);
+	Lightmap->RegionMin = glm::clamp(RegionMin, v3i(0), v3i(c_WorldChunksX, c_WorldChunksY, c_WorldChunksZ));
+	Lightmap->RegionMax = glm::clamp(RegionMax, Lightmap->RegionMin, v3i(c_WorldChunksX, c_WorldChunksY, c_WorldChunksZ));
+	Lightmap->Chunks = VmAllocArray(lightmap_chunk, c_WorldChunkCount);
+	Lightmap->MaxLights = light_environment::MaxDirectionalLights + MaxPointLights;
+	Lightmap->Lights = VmAllocArray(lightmap_light, Lightmap->MaxLights);
+}
+
+internal void Lightmap_FreeChunk(lightmap_chunk* Chunk)
+{
+	if (Chunk->Faces)
+	{
+		VmFree(Chunk->Faces);
+		VmFree(Chunk->Irradiance);
+		VmFree(Chunk->Mask);
+	}
+
+	*Chunk = {};
+}
+
+internal void Lightmap_Destroy(lightmap* Lightmap)
+{
+	for (u32 i = 0; i < c_WorldChunkCount; i++)
+		Lightmap_FreeChunk(&Lightmap->Chunks[i]);
+
+	if (Lightmap->MaxGeometryFaces > 0)
+	{
+		ShadowTracer_Destroy(&Lightmap->Tracer);
+		VmFree(Lightmap->GeometryFaces);
+	}
+
+	VmFree(Lightmap->Chunks);
+	VmFree(Lightmap->Lights);
+}
+
+inline bool Lightmap_IsInRegion(const lightmap* Lightmap, v3i ChunkCoord)
+{
+	return glm::all(glm::greaterThanEqual(ChunkCoord, Lightmap->RegionMin)) && glm::all(glm::lessThan(ChunkCoord, Lightmap->RegionMax));
+}
+
+// Visible faces of a chunk in block index order, Out can be null to count them
+internal u32 Lightmap_CollectFaces(const block_world* World, const chunk* Chunk, lightmap_face* Out)
+{
+	const v3i BlockMin = Chunk_GetBlockMin(Chunk->Coord);
+
+	u32 Count = 0;
+	for (i32 Z = 0; Z < c_ChunkSize; Z++)
+	for (i32 Y = 0; Y < c_ChunkSize; Y++)
+	for (i32 X = 0; X < c_ChunkSize; X++)
+	{
+		u8 Color = Chunk->Blocks[Chunk_GetBlockIndex(X, Y, Z)];
+		if (Color == 0)
+			continue;
+
+		for (u32 Face = 0; Face < 6; Face++)
+		{
+			v3i Neighbor = v3i(X + c_LightmapFaceOffsets[Face][0], Y + c_LightmapFaceOffsets[Face][1], Z + c_LightmapFaceOffsets[Face][2]);
+			bool Inside = glm::all(glm::greaterThanEqual(Neighbor, v3i(0))) && glm::all(glm::lessThan(Neighbor, v3i(c_ChunkSize)));
+			u8 Next = Inside ? Chunk->Blocks[Chunk_GetBlockIndex(Neighbor.x, Neighbor.y, Neighbor.z)] : BlockWorld_GetBlock(World, BlockMin + Neighbor);
+			if (Next != 0)
+				continue;
+
+			if (Out)
+				Out[Count] = { BlockMin + v3i(X, Y, Z), (u8)Face, Color, 0 };
+			Count++;
+		}
+	}
+
+	return Count;
+}
+
+// Weight of the light's diffuse term at the points, N.L times the attenuation, and the shadow ray towards it
+internal f32x8 Lightmap_GetLightWeight(const lightmap_light& Light, const v3x8& Position, const v3x8& Normal, v3x8* OutDirection, f32x8* OutDistance)
+{
+	const f32x8 Zero = F32x8Zero(), One = F32x8(1.0f);
+
+	if (Light.Directional)
+	{
+		*OutDirection = V3x8(Light.Direction);
+		*OutDistance = F32x8(FLT_MAX);
+		return Max(Dot(Normal, *OutDirection), Zero);
+	}
+
+	v3x8 ToLight = V3x8(Light.Position) - Position;
+	f32x8 DistanceSquared = Max(Dot(ToLight, ToLight), F32x8(1e-8f));
+	f32x8 Distance = Sqrt(DistanceSquared);
+	*OutDirection = ToLight * (One / Distance);
+	*OutDistance = Distance;
+
+	f32x8 Attenuation = Clamp(One - DistanceSquared * F32x8(1.0f / (Light.Radius * Light.Radius)), Zero, One);
+	Attenuation = Attenuation * Lerp(Attenuation, One, F32x8(Light.FallOff));
+	return Max(Dot(Normal, *OutDirection), Zero) * Attenuation;
+}
+
+// Direct light of lights [FirstLight, LightCount) at the points, each behind a shadow ray
+internal v3x8 Lightmap_GatherDirectLight(const lightmap* Lightmap, u32 FirstLight, const v3x8& Origin, const v3x8& Normal, f32x8 Active, u64* Rays)
+{
+	const f32x8 Zero = F32x8Zero();
+
+	v3x8 Result = { Zero, Zero, Zero };
+	for (u32 i = FirstLight; i < Lightmap->LightCount; i++)
+	{
+		const lightmap_light& Light = Lightmap->Lights[i];
+
+		v3x8 Direction;
+		f32x8 Distance;
+		f32x8 Weight = Lightmap_GetLightWeight(Light, Origin, Normal, &Direction, &Distance);
+		f32x8 Reaches = Active & (Weight > Zero);
+		if (!Any(Reaches))
+			continue;
+
+		*Rays += std::popcount(MoveMask(Reaches));
+		f32x8 Lit = AndNot(ShadowTracer_Occluded(&Lightmap->Tracer, Origin, Direction, Distance, Reaches), Reaches) & Weight;
+		Result = Result + V3x8(Light.Diffuse) * Lit;
+	}
+
+	return Result;
+}
+
+// Xorshift like Noise_Initialize, a sequence per lane, [0, 1)
+inline f32x8 Lightmap_Random(i32x8* State)
+{
+	i32x8 S = *State;
+	S = S ^ (S << 13);
+	S = S ^ ShiftRightLogical(S, 17);
+	S = S ^ (S << 5);
+	*State = S;
+	return ConvertToF32(ShiftRightLogical(S, 8)) * F32x8(1.0f / 16777216.0f);
+}
+
+// SplitMix64 finalizer
+inline u32 Lightmap_Hash(u64 Key)
+{
+	Key = (Key ^ (Key >> 30)) * 0xBF58476D1CE4E5B9ull;
+	Key = (Key ^ (Key >> 27)) * 0x94D049BB133111EBull;
+	return (u32)(Key ^ (Key >> 31));
+}
+
+// Cosine weighted directions around the normals, the basis is the branchless one of Duff et al.
+internal v3x8 Lightmap_SampleHemisphere(const v3x8& Normal, f32x8 U1, f32x8 U2)
+{
+	const f32x8 Zero = F32x8Zero(), One = F32x8(1.0f);
+
+	f32x8 Sign = Select(Normal.Z < Zero, F32x8(-1.0f), One);
+	f32x8 A = F32x8(-1.0f) / (Sign + Normal.Z);
+	f32x8 B = Normal.X * Normal.Y * A;
+	v3x8 Tangent = { One + Sign * Normal.X * Normal.X * A, Sign * B, -(Sign * Normal.X) };
+	v3x8 Bitangent = { B, Sign + Normal.Y * Normal.Y * A, -Normal.Y };
+
+	f32x8 Radius = Sqrt(U1);
+	f32x8 Angle = U2 * F32x8(glm::two_pi<f32>());
+	f32x8 Height = Sqrt(Max(One - U1, Zero));
+	return Tangent * (Radius * Cos(Angle)) + Bitangent * (Radius * Sin(Angle)) + Normal * Height;
+}
+
+internal void Lightmap_BakeFace(const lightmap* Lightmap, const block_world* World, const lightmap_face& Face, v3* OutIrradiance, u32* OutMask, u64* Rays)
+{
+	const lightmap_settings& Settings = Lightmap->Settings;
+	const u32 TexelsPerFace = Settings.TexelsPerFace;
+	const u32 Packets = glm::max((Settings.Samples + c_SimdWidth - 1) / c_SimdWidth, 1u);
+	const f32x8 Zero = F32x8Zero(), One = F32x8(1.0f);
+
+	const v3 Normal = v3(c_LightmapFaceOffsets[Face.Face][0], c_LightmapFaceOffsets[Face.Face][1], c_LightmapFaceOffsets[Face.Face][2]);
+	const i32 Axis = c_LightmapFaceAxes[Face.Face];
+	const i32 AxisU = (Axis + 1) % 3, AxisV = (Axis + 2) % 3;
+	const v3 Center = v3(Face.Block) + Normal * 0.5f;
+	const v3x8 FaceNormal = V3x8(Normal);
+
+	for (u32 Texel = 0; Texel < TexelsPerFace * TexelsPerFace; Texel++)
+	{
+		const f32 TexelU = (f32)(Texel % TexelsPerFace), TexelV = (f32)(Texel / TexelsPerFace);
+
+		alignas(32) i32 Seeds[c_SimdWidth];
+		u64 Key = (u64)(u16)Face.Block.x | (u64)(u16)Face.Block.y << 16 | (u64)(u16)Face.Block.z << 32 | (u64)(Face.Face * TexelsPerFace * TexelsPerFace + Texel) << 48;
+		for (u32 i = 0; i < c_SimdWidth; i++)
+			Seeds[i] = (i32)glm::max(Lightmap_Hash((Key ^ (u64)Settings.Seed * 0x9E3779B97F4A7C15ull) * c_SimdWidth + i), 1u); // Zero would get stuck
+		i32x8 State = I32x8Load(Seeds);
+
+		v3x8 Irradiance = { Zero, Zero, Zero };
+		f32x8 Visible[c_LightmapMaskChannels] = {};
+
+		for (u32 Packet = 0; Packet < Packets; Packet++)
+		{
+			// Jittered point of the texel
+			f32x8 Components[3] = { F32x8(Center.x), F32x8(Center.y), F32x8(Center.z) };
+			Components[AxisU] = Components[AxisU] + (F32x8(TexelU) + Lightmap_Random(&State)) * F32x8(1.0f / TexelsPerFace) - F32x8(0.5f);
+			Components[AxisV] = Components[AxisV] + (F32x8(TexelV) + Lightmap_Random(&State)) * F32x8(1.0f / TexelsPerFace) - F32x8(0.5f);
+			v3x8 Origin = v3x8{ Components[0], Components[1], Components[2] } + FaceNormal * F32x8(c_ShadowTracerNormalOffset);
+
+			// Mask lights only need their visibility, points they do not reach count as visible
+			for (u32 i = 0; i < Lightmap->MaskLightCount; i++)
+			{
+				v3x8 Direction;
+				f32x8 Distance;
+				f32x8 Reaches = Lightmap_GetLightWeight(Lightmap->Lights[i], Origin, FaceNormal, &Direction, &Distance) > Zero;
+				f32x8 Occluded = Zero;
+				if (Any(Reaches))
+				{
+					*Rays += std::popcount(MoveMask(Reaches));
+					Occluded = ShadowTracer_Occluded(&Lightmap->Tracer, Origin, Direction, Distance, Reaches);
+				}
+				Visible[i] += AndNot(Occluded, One);
+			}
+
+			Irradiance = Irradiance + Lightmap_GatherDirectLight(Lightmap, Lightmap->MaskLightCount, Origin, FaceNormal, AsF32(I32x8(-1)), Rays);
+
+			// Bounces, every light counts at the points they hit
+			v3x8 Throughput = { One, One, One };
+			v3x8 SurfaceNormal = FaceNormal;
+			f32x8 Active = AsF32(I32x8(-1));
+			for (u32 Bounce = 0; Bounce < Settings.Bounces && Any(Active); Bounce++)
+			{
+				f32x8 U1 = Lightmap_Random(&State), U2 = Lightmap_Random(&State);
+				v3x8 Direction = Lightmap_SampleHemisphere(SurfaceNormal, U1, U2);
+
+				f32x8 Distance = F32x8(FLT_MAX); // Missed lanes are not written
+				i32x8 Triangle = I32x8(-1);
+				*Rays += std::popcount(MoveMask(Active));
+				f32x8 Hit = ShadowTracer_Intersect(&Lightmap->Tracer, Origin, Direction, F32x8(FLT_MAX), Active, &Distance, &Triangle);
+
+				f32x8 Escaped = AndNot(Hit, Active);
+				Irradiance = Irradiance + Throughput * (Escaped & F32x8(Settings.SkyRadiance));
+
+				// Normal and color of the faces that were hit
+				alignas(32) i32 Triangles[c_SimdWidth];
+				alignas(32) f32 HitNormal[3][c_SimdWidth];
+				alignas(32) f32 HitColor[3][c_SimdWidth];
+				I32x8Store(Triangles, Triangle);
+				u32 HitMask = MoveMask(Hit);
+				for (u32 i = 0; i < c_SimdWidth; i++)
+				{
+					const lightmap_face* HitFace = (HitMask & (1u << i)) ? &Lightmap->GeometryFaces[Triangles[i] / 2] : nullptr;
+					const v4 Color = HitFace ? World->Palette[HitFace->Color] : v4(0.0f);
+					for (u32 Component = 0; Component < 3; Component++)
+					{
+						HitNormal[Component][i] = HitFace ? (f32)c_LightmapFaceOffsets[HitFace->Face][Component] : 0.0f;
+						HitColor[Component][i] = Color[Component];
+					}
+				}
+
+				SurfaceNormal = { F32x8Load(HitNormal[0]), F32x8Load(HitNormal[1]), F32x8Load(HitNormal[2]) };
+				v3x8 Color = { F32x8Load(HitColor[0]), F32x8Load(HitColor[1]), F32x8Load(HitColor[2]) };
+
+				// The back of a face is inside a block at the edge of the geometry, nothing comes from there
+				Active = Hit & (Dot(Direction, SurfaceNormal) < Zero);
+				Throughput = { Throughput.X * Color.X, Throughput.Y * Color.Y, Throughput.Z * Color.Z };
+				Origin = Origin + Direction * Distance + SurfaceNormal * F32x8(c_ShadowTracerNormalOffset);
+
+				v3x8 Direct = Lightmap_GatherDirectLight(Lightmap, 0, Origin, SurfaceNormal, Active, Rays);
+				Irradiance = Irradiance + v3x8{ Throughput.X * Direct.X, Throughput.Y * Direct.Y, Throughput.Z * Direct.Z };
+			}
+		}
+
+		const f32 Scale = 1.0f / (Packets * c_SimdWidth);
+		OutIrradiance[Texel] = v3(HorizontalAdd(Irradiance.X), HorizontalAdd(Irradiance.Y), HorizontalAdd(Irradiance.Z)) * Scale;
+
+		u32 Mask = 0;
+		for (u32 i = 0; i < Lightmap->MaskLightCount; i++)
+			Mask |= (u32)(HorizontalAdd(Visible[i]) * Scale * 255.0f + 0.5f) << (i * 8);
+		OutMask[Texel] = Mask;
+	}
+}
+
+// The static lights of this bake, hashed to see whether they changed since the last one
+internal void Lightmap_GatherLights(lightmap* Lightmap, const light_environment& Environment, const light_store* Store)
+{
+	Lightmap->LightCount = 0;
+
+	for (i32 i = 0; i < Environment.DirectionalLightCount; i++)
+	{
+		const directional_light& Light = Environment.DirectionalLight[i];
+
+		lightmap_light& Out = Lightmap->Lights[Lightmap->LightCount++];
+		Out = {};
+		Out.Directional = true;
+		Out.Source = (u32)i;
+		Out.Direction = glm::normalize(-Light.Direction);
+		Out.Diffuse = Light.Radiance * Light.Intensity * 0.8f;
+	}
+
+	for (u32 i = 0; Store && i < Store->Count && Lightmap->LightCount < Lightmap->MaxLights; i++)
+	{
+		if ((Store->Flags[i] & light_flags::Animated) != light_flags::None)
+			continue;
+
+		lightmap_light& Out = Lightmap->Lights[Lightmap->LightCount++];
+		Out = {};
+		Out.Source = Store->DenseToSlot[i];
+		Out.Position = v3(Store->PositionX[i], Store->PositionY[i], Store->PositionZ[i]);
+		Out.Radius = Store->Radius[i];
+		Out.FallOff = Store->FallOff[i];
+		Out.Diffuse = v3(Store->RadianceR[i], Store->RadianceG[i], Store->RadianceB[i]) * Store->Intensity[i] * 0.8f;
+	}
+
+	Lightmap->MaskLightCount = glm::min(Lightmap->LightCount, c_LightmapMaskChannels);
+
+	// FNV-1a, the structs are zeroed before they are filled so padding hashes the same every time
+	u64 Hash = 0xCBF29CE484222325ull;
+	const u8* Bytes = (const u8*)Lightmap->Lights;
+	for (u64 i = 0; i < sizeof(lightmap_light) * Lightmap->LightCount; i++)
+		Hash = (Hash ^ Bytes[i]) * 0x100000001B3ull;
+
+	if (Hash != Lightmap->LightHash)
+		Lightmap_InvalidateAll(Lightmap);
+	Lightmap->LightHash = Hash;
+}
+
+internal const lightmap_stats& Lightmap_Bake(lightmap* Lightmap, const block_world* World, const light_environment& Environment, const light_store* Store)
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto Start = clock::now();
+
+	lightmap_stats& Stats = Lightmap->Stats;
+	Stats = {};
+
+	Lightmap_GatherLights(Lightmap, Environment, Store);
+
+	// Chunks to bake, the region's chunks that were never baked, were invalidated or changed
+	u32* BakeChunks = VmAllocArray(u32, c_WorldChunkCount);
+	u32 BakeChunkCount = 0;
+	for (i32 Z = Lightmap->RegionMin.z; Z < Lightmap->RegionMax.z; Z++)
+	for (i32 Y = Lightmap->RegionMin.y; Y < Lightmap->RegionMax.y; Y++)
+	for (i32 X = Lightmap->RegionMin.x; X < Lightmap->RegionMax.x; X++)
+	{
+		u32 ChunkIndex = BlockWorld_GetChunkIndex(v3i(X, Y, Z));
+		const chunk* Chunk = World->Chunks[ChunkIndex];
+		lightmap_chunk& Baked = Lightmap->Chunks[ChunkIndex];
+
+		u32 Version = Chunk ? Chunk->Version + 1 : 0;
+		if (Baked.Baked && !Baked.Dirty && Baked.Version == Version)
+			continue;
+
+		Lightmap_FreeChunk(&Baked);
+		Baked.Version = Version;
+		Baked.Baked = true;
+		BakeChunks[BakeChunkCount++] = ChunkIndex;
+	}
+
+	if (BakeChunkCount == 0)
+	{
+		VmFree(BakeChunks);
+		return Stats;
+	}
+
+	// Geometry, the visible faces of the region and its margin, counted and then collected over the job system
+	const v3i GeometryMin = glm::max(Lightmap->RegionMin - v3i(c_LightmapMarginChunks), v3i(0));
+	const v3i GeometryMax = glm::min(Lightmap->RegionMax + v3i(c_LightmapMarginChunks), v3i(c_WorldChunksX, c_WorldChunksY, c_WorldChunksZ));
+
+	u32* GeometryChunks = VmAllocArray(u32, c_WorldChunkCount);
+	u32 GeometryChunkCount = 0;
+	for (i32 Z = GeometryMin.z; Z < GeometryMax.z; Z++)
+	for (i32 Y = GeometryMin.y; Y < GeometryMax.y; Y++)
+	for (i32 X = GeometryMin.x; X < GeometryMax.x; X++)
+	{
+		u32 ChunkIndex = BlockWorld_GetChunkIndex(v3i(X, Y, Z));
+		if (World->Chunks[ChunkIndex] && World->Chunks[ChunkIndex]->SolidCount > 0)
+			GeometryChunks[GeometryChunkCount++] = ChunkIndex;
+	}
+
+	u32* FaceOffsets = VmAllocArray(u32, GeometryChunkCount + 1);
+	JobSystem_ParallelFor(&g_Jobs, GeometryChunkCount, 1, [World, GeometryChunks, FaceOffsets](u32 Begin, u32 End)
+	{
+		for (u32 i = Begin; i < End; i++)
+			FaceOffsets[i + 1] = Lightmap_CollectFaces(World, World->Chunks[GeometryChunks[i]], nullptr);
+	});
+
+	for (u32 i = 0; i < GeometryChunkCount; i++)
+		FaceOffsets[i + 1] += FaceOffsets[i];
+
+	const u32 GeometryFaceCount = FaceOffsets[GeometryChunkCount];
+	if (GeometryFaceCount > Lightmap->MaxGeometryFaces)
+	{
+		if (Lightmap->MaxGeometryFaces > 0)
+		{
+			ShadowTracer_Destroy(&Lightmap->Tracer);
+			VmFree(Lightmap->GeometryFaces);
+		}
+
+		// Some room so that placing a few blocks does not reallocate
+		Lightmap->MaxGeometryFaces = GeometryFaceCount + GeometryFaceCount / 8;
+		ShadowTracer_Initialize(&Lightmap->Tracer, Lightmap->MaxGeometryFaces * 2);
+		Lightmap->GeometryFaces = VmAllocArray(lightmap_face, Lightmap->MaxGeometryFaces);
+	}
+
+	lightmap_face* GeometryFaces = Lightmap->GeometryFaces;
+	JobSystem_ParallelFor(&g_Jobs, GeometryChunkCount, 1, [World, GeometryChunks, FaceOffsets, GeometryFaces](u32 Begin, u32 End)
+	{
+		for (u32 i = Begin; i < End; i++)
+			Lightmap_CollectFaces(World, World->Chunks[GeometryChunks[i]], GeometryFaces + FaceOffsets[i]);
+	});
+
+	// Same corners and winding as the meshes
+	shadow_tracer* Tracer = &Lightmap->Tracer;
+	ShadowTracer_Begin(Tracer, nullptr, nullptr);
+	for (u32 i = 0; i < GeometryFaceCount; i++)
+	{
+		const lightmap_face& Face = GeometryFaces[i];
+		v3 Corners[4];
+		for (u32 Corner = 0; Corner < 4; Corner++)
+			Corners[Corner] = v3(Face.Block) + v3(c_CuboidVerticesPositions[Face.Face * 4 + Corner]);
+
+		ShadowTracer_AddTriangle(Tracer, Corners[0], Corners[1], Corners[2]);
+		ShadowTracer_AddTriangle(Tracer, Corners[2], Corners[3], Corners[0]);
+	}
+
+	const shadow_tracer_stats& TracerStats = ShadowTracer_Build(Tracer);
+	Stats.Triangles = TracerStats.Triangles;
+	Stats.DroppedTriangles = TracerStats.DroppedTriangles;
+	Stats.GeometryMilliseconds = std::chrono::duration<f32, std::milli>(clock::now() - Start).count();
+
+	// Unwrap, the faces of a chunk to bake are its slice of the geometry
+	const u32 TexelsPerTile = Lightmap->Settings.TexelsPerFace * Lightmap->Settings.TexelsPerFace;
+	u32* BakeFaceOffsets = VmAllocArray(u32, BakeChunkCount + 1);
+	for (u32 i = 0; i < BakeChunkCount; i++)
+	{
+		lightmap_chunk& Baked = Lightmap->Chunks[BakeChunks[i]];
+		for (u32 j = 0; j < GeometryChunkCount; j++)
+		{
+			if (GeometryChunks[j] != BakeChunks[i])
+				continue;
+
+			Baked.FaceCount = FaceOffsets[j + 1] - FaceOffsets[j];
+			if (Baked.FaceCount > 0)
+			{
+				Baked.Faces = VmAllocArray(lightmap_face, Baked.FaceCount);
+				Baked.Irradiance = VmAllocArray(v3, (u64)Baked.FaceCount * TexelsPerTile);
+				Baked.Mask = VmAllocArray(u32, (u64)Baked.FaceCount * TexelsPerTile);
+				memcpy(Baked.Faces, GeometryFaces + FaceOffsets[j], sizeof(lightmap_face) * Baked.FaceCount);
+			}
+			break;
+		}
+
+		BakeFaceOffsets[i + 1] = BakeFaceOffsets[i] + Baked.FaceCount;
+	}
+
+	// Faces are spread over the job system, chunks are too few to keep every thread busy
+	auto TraceStart = clock::now();
+	const u32 BakeFaceCount = BakeFaceOffsets[BakeChunkCount];
+	std::atomic<u64> Rays = 0;
+	JobSystem_ParallelFor(&g_Jobs, BakeFaceCount, 16, [Lightmap, World, BakeChunks, BakeFaceOffsets, BakeChunkCount, TexelsPerTile, &Rays](u32 Begin, u32 End)
+	{
+		u64 BatchRays = 0;
+		for (u32 i = Begin; i < End; i++)
+		{
+			u32 Chunk = (u32)(std::upper_bound(BakeFaceOffsets, BakeFaceOffsets + BakeChunkCount + 1, i) - BakeFaceOffsets) - 1;
+			lightmap_chunk& Baked = Lightmap->Chunks[BakeChunks[Chunk]];
+			u32 Face = i - BakeFaceOffsets[Chunk];
+			Lightmap_BakeFace(Lightmap, World, Baked.Faces[Face], Baked.Irradiance + Face * TexelsPerTile, Baked.Mask + Face * TexelsPerTile, &BatchRays);
+		}
+
+		Rays += BatchRays;
+	});
+
+	for (u32 i = 0; i < BakeChunkCount; i++)
+		Lightmap->Chunks[BakeChunks[i]].Dirty = false;
+
+	VmFree(BakeFaceOffsets);
+	VmFree(FaceOffsets);
+	VmFree(GeometryChunks);
+	VmFree(BakeChunks);
+
+	Stats.Chunks = BakeChunkCount;
+	Stats.Faces = BakeFaceCount;
+	Stats.Texels = BakeFaceCount * TexelsPerTile;
+	Stats.Lights = Lightmap->LightCount;
+	Stats.MaskLights = Lightmap->MaskLightCount;
+	Stats.Rays = Rays.load();
+	Stats.TraceMilliseconds = std::chrono::duration<f32, std::milli>(clock::now() - TraceStart).count();
+	Stats.TotalMilliseconds = std::chrono::duration<f32, std::milli>(clock::now() - Start).count();
+	return Stats;
+}
+
+internal u32 Lightmap_InvalidateBlock(lightmap* Lightmap, v3i Block)
+{
+	u32 Marked = 0;
+	auto MarkBox = [Lightmap, &Marked](v3 Min, v3 Max)
+	{
+		v3i MinChunk, MaxChunk, Local;
+		BlockWorld_SplitBlock(BlockWorld_WorldToBlock(Min), &MinChunk, &Local);
+		BlockWorld_SplitBlock(BlockWorld_WorldToBlock(Max), &MaxChunk, &Local);
+		MinChunk = glm::max(MinChunk, Lightmap->RegionMin);
+		MaxChunk = glm::min(MaxChunk, Lightmap->RegionMax - v3i(1));
+
+		for (i32 Z = MinChunk.z; Z <= MaxChunk.z; Z++)
+		for (i32 Y = MinChunk.y; Y <= MaxChunk.y; Y++)
+		for (i32 X = MinChunk.x; X <= MaxChunk.x; X++)
+		{
+			lightmap_chunk& Chunk = Lightmap->Chunks[BlockWorld_GetChunkIndex(v3i(X, Y, Z))];
+			if (Chunk.Baked && !Chunk.Dirty)
+			{
+				Chunk.Dirty = true;
+				Marked++;
+			}
+		}
+	};
+
+	// The block's own faces and its neighbors', plus bounced light
+	const v3 Center = v3(Block);
+	const f32 Reach = Lightmap->Settings.IndirectReach + 1.0f;
+	MarkBox(Center - v3(Reach), Center + v3(Reach));
+
+	for (u32 i = 0; i < Lightmap->LightCount; i++)
+	{
+		const lightmap_light& Light = Lightmap->Lights[i];
+		if (Light.Directional)
+		{
+			// The shadow goes away from the light, a block at a time so no chunk the line crosses is skipped
+			for (f32 Distance = 0.0f; Distance <= Lightmap->Settings.ShadowReach; Distance += 1.0f)
+			{
+				v3 Point = Center - Light.Direction * Distance;
+				MarkBox(Point - v3(1.0f), Point + v3(1.0f));
+			}
+		}
+		else if (glm::distance(Center, Light.Position) < Light.Radius + 1.0f)
+		{
+			MarkBox(Light.Position - v3(Light.Radius), Light.Position + v3(Light.Radius));
+		}
+	}
+
+	return Marked;
+}
+
+internal void Lightmap_InvalidateAll(lightmap* Lightmap)
+{
+	for (u32 i = 0; i < c_WorldChunkCount; i++)
+		Lightmap->Chunks[i].Dirty = Lightmap->Chunks[i].Baked;
+}
+
+internal bool Lightmap_Sample(const lightmap* Lightmap, v3 Position, v3 Normal, v3* OutIrradiance, f32 OutMask[c_LightmapMaskChannels])
+{
+	// Face of the normal, then the block behind the surface
+	u32 FaceIndex = 0;
+	f32 Best = -FLT_MAX;
+	for (u32 Face = 0; Face < 6; Face++)
+	{
+		f32 Cosine = glm::dot(Normal, v3(c_LightmapFaceOffsets[Face][0], c_LightmapFaceOffsets[Face][1], c_LightmapFaceOffsets[Face][2]));
+		if (Cosine > Best)
+		{
+			Best = Cosine;
+			FaceIndex = Face;
+		}
+	}
+
+	const i32 Axis = c_LightmapFaceAxes[FaceIndex];
+	v3 Inside = Position;
+	Inside[Axis] -= c_LightmapFaceOffsets[FaceIndex][Axis] * 0.5f;
+	v3i Block = BlockWorld_WorldToBlock(Inside);
+
+	// Only on the face itself, anything else in front of it is not a block
+	if (glm::abs(Inside[Axis] - Block[Axis]) > 0.05f)
+		return false;
+
+	v3i ChunkCoord, Local;
+	BlockWorld_SplitBlock(Block, &ChunkCoord, &Local);
+	if (!BlockWorld_IsChunkCoordValid(ChunkCoord) || !Lightmap_IsInRegion(Lightmap, ChunkCoord))
+		return false;
+
+	const lightmap_chunk& Chunk = Lightmap->Chunks[BlockWorld_GetChunkIndex(ChunkCoord)];
+	if (!Chunk.Baked || Chunk.FaceCount == 0)
+		return false;
+
+	// Faces are in block index order, then face order
+	const lightmap_face Key = { Block, (u8)FaceIndex, 0, 0 };
+	auto Less = [](const lightmap_face& A, const lightmap_face& B)
+	{
+		v3i LocalA = A.Block - c_WorldBlockMin, LocalB = B.Block - c_WorldBlockMin;
+		u32 IndexA = Chunk_GetBlockIndex(LocalA.x % c_ChunkSize, LocalA.y % c_ChunkSize, LocalA.z % c_ChunkSize) * 6 + A.Face;
+		u32 IndexB = Chunk_GetBlockIndex(LocalB.x % c_ChunkSize, LocalB.y % c_ChunkSize, LocalB.z % c_ChunkSize) * 6 + B.Face;
+		return IndexA < IndexB;
+	};
+
+	const lightmap_face* Face = std::lower_bound(Chunk.Faces, Chunk.Faces + Chunk.FaceCount, Key, Less);
+	if (Face == Chunk.Faces + Chunk.FaceCount || Face->Block != Block || Face->Face != FaceIndex)
+		return false;
+
+	// Texel centers, clamped to the tile so faces never bleed into each other
+	const i32 TexelsPerFace = (i32)Lightmap->Settings.TexelsPerFace;
+	const i32 AxisU = (Axis + 1) % 3, AxisV = (Axis + 2) % 3;
+	f32 U = glm::clamp((Position[AxisU] - Block[AxisU] + 0.5f) * TexelsPerFace - 0.5f, 0.0f, TexelsPerFace - 1.0f);
+	f32 V = glm::clamp((Position[AxisV] - Block[AxisV] + 0.5f) * TexelsPerFace - 0.5f, 0.0f, TexelsPerFace - 1.0f);
+	i32 U0 = glm::min((i32)U, TexelsPerFace - 1), V0 = glm::min((i32)V, TexelsPerFace - 1);
+	i32 U1 = glm::min(U0 + 1, TexelsPerFace - 1), V1 = glm::min(V0 + 1, TexelsPerFace - 1);
+	f32 FracU = U - U0, FracV = V - V0;
+
+	const u32 Base = (u32)(Face - Chunk.Faces) * TexelsPerFace * TexelsPerFace;
+	const u32 Texels[4] = { Base + V0 * TexelsPerFace + U0, Base + V0 * TexelsPerFace + U1, Base + V1 * TexelsPerFace + U0, Base + V1 * TexelsPerFace + U1 };
+	const f32 Weights[4] = { (1.0f - FracU) * (1.0f - FracV), FracU * (1.0f - FracV), (1.0f - FracU) * FracV, FracU * FracV };
+
+	*OutIrradiance = v3(0.0f);
+	for (u32 Channel = 0; Channel < c_LightmapMaskChannels; Channel++)
+		OutMask[Channel] = 0.0f;
+
+	for (u32 i = 0; i < 4; i++)
+	{
+		*OutIrradiance += Chunk.Irradiance[Texels[i]] * Weights[i];
+		for (u32 Channel = 0; Channel < c_LightmapMaskChannels; Channel++)
+			OutMask[Channel] += ((Chunk.Mask[Texels[i]] >> (Channel * 8)) & 0xFF) * (Weights[i] / 255.0f);
+	}
+
+	return true;
+}
+
+internal bool Lightmap_Write(const lightmap* Lightmap, const char* Path)
+{
+	const u32 TexelsPerFace = Lightmap->Settings.TexelsPerFace;
+	const u32 TexelsPerTile = TexelsPerFace * TexelsPerFace;
+
+	u32 FaceCount = 0;
+	for (u32 i = 0; i < c_WorldChunkCount; i++)
+		FaceCount += Lightmap->Chunks[i].FaceCount;
+
+	// Square atlas of tiles, the last row may be partly empty
+	u32 TilesPerRow = glm::max((u32)glm::ceil(glm::sqrt((f32)FaceCount)), 1u);
+	u32 TileRows = glm::max((FaceCount + TilesPerRow - 1) / TilesPerRow, 1u);
+
+	lightmap_file_header Header = {};
+	memcpy(Header.Magic, "BLMP", 4);
+	Header.Version = c_LightmapFileVersion;
+	Header.TexelsPerFace = TexelsPerFace;
+	Header.AtlasWidth = TilesPerRow * TexelsPerFace;
+	Header.AtlasHeight = TileRows * TexelsPerFace;
+	Header.FaceCount = FaceCount;
+	Header.MaskLightCount = Lightmap->MaskLightCount;
+	for (u32 i = 0; i < Lightmap->MaskLightCount; i++)
+		Header.MaskLights[i] = Lightmap->Lights[i].Source | (Lightmap->Lights[i].Directional ? 0u : 0x80000000u);
+
+	const u64 AtlasTexels = (u64)Header.AtlasWidth * Header.AtlasHeight;
+	lightmap_file_face* Faces = VmAllocArray(lightmap_file_face, glm::max(FaceCount, 1u));
+	f32* Irradiance = VmAllocArray(f32, AtlasTexels * 3);
+	u32* Mask = VmAllocArray(u32, AtlasTexels);
+
+	u32 Tile = 0;
+	for (u32 i = 0; i < c_WorldChunkCount; i++)
+	{
+		const lightmap_chunk& Chunk = Lightmap->Chunks[i];
+		for (u32 Face = 0; Face < Chunk.FaceCount; Face++, Tile++)
+		{
+			const lightmap_face& Source = Chunk.Faces[Face];
+			Faces[Tile] = { { Source.Block.x, Source.Block.y, Source.Block.z }, Source.Face };
+
+			u32 TileX = (Tile % TilesPerRow) * TexelsPerFace, TileY = (Tile / TilesPerRow) * TexelsPerFace;
+			for (u32 Texel = 0; Texel < TexelsPerTile; Texel++)
+			{
+				u64 Index = (u64)(TileY + Texel / TexelsPerFace) * Header.AtlasWidth + TileX + Texel % TexelsPerFace;
+				const v3& Value = Chunk.Irradiance[Face * TexelsPerTile + Texel];
+				Irradiance[Index * 3 + 0] = Value.x;
+				Irradiance[Index * 3 + 1] = Value.y;
+				Irradiance[Index * 3 + 2] = Value.z;
+				Mask[Index] = Chunk.Mask[Face * TexelsPerTile + Texel];
+			}
+		}
+	}
+
+#if defined(_WIN32)
+	FILE* File = nullptr;
+	fopen_s(&File, Path, "wb");
+#else
+	FILE* File = fopen(Path, "wb");
+#endif
+
+	bool Written = false;
+	if (File)
+	{
+		Written = fwrite(&Header, sizeof(Header), 1, File) == 1;
+		Written = Written && fwrite(Faces, sizeof(lightmap_file_face), FaceCount, File) == FaceCount;
+		Written = Written && fwrite(Irradiance, sizeof(f32) * 3, AtlasTexels, File) == AtlasTexels;
+		Written = Written && fwrite(Mask, sizeof(u32), AtlasTexels, File) == AtlasTexels;
+		fclose(File);
+	}
+
+	if (!Written)
+		Err("Could not write lightmap %s", Path);
+
+	VmFree(Faces);
+	VmFree(Irradiance);
+	VmFree(Mask);
+	return Written;
+}
@@ -295,6 +295,33 @@ namespace bkm {
 		return result;
 	}
 
+	// D3D clip volume with reverse Z, zNear maps to depth 1 and zFar to 0
+	inline m4 PerspectiveLH_ReverseZ(f32 fovy, f32 aspect, f32 zNear, f32 zFar)
+	{
+		m4 result(0.0f);
+
+		f32 tanHalfFovy = Tan(fovy / 2.0f);
+		result[0][0] = 1.0f / (aspect * tanHalfFovy);
+		result[1][1] = 1.0f / (tanHalfFovy);
+		result[2][2] = zNear / (zNear - zFar);
+		result[2][3] = 1.0f;
+		result[3][2] = (zFar * zNear) / (zFar - zNear);
+		return result;
+	}
+
+	// Reverse Z with the far plane at infinity, depth is zNear / z
+	inline m4 InfinitePerspectiveLH_ReverseZ(f32 fovy, f32 aspect, f32 zNear)
+	{
+		m4 result(0.0f);
+
+		f32 tanHalfFovy = Tan(fovy / 2.0f);
+		result[0][0] = 1.0f / (aspect * tanHalfFovy);
+		result[1][1] = 1.0f / (tanHalfFovy);
+		result[2][3] = 1.0f;
+		result[3][2] = zNear;
+		return result;
+	}
+
     inline m4 Ortho(f32 left, f32 right, f32 bottom, f32 top, f32 zNear, f32 zFar)
     {
         m4 result(1.0f);
@@ -0,0 +1,181 @@
+#pragma once
+
+// Gradient noise
+// Classic Perlin noise evaluated 8 points at a time, the permutation table is shuffled from a seed so results are reproducible.
+// Output is roughly in [-1, 1].
+
+#include "SIMD.h"
+
+struct noise_table
+{
+	i32 Permutation[512]; // Twice, so hashes never have to wrap
+	u32 Seed;
+};
+
+internal void Noise_Initialize(noise_table* Table, u32 Seed);
+internal f32x8 Noise_Perlin2(const noise_table* Table, f32x8 X, f32x8 Y);
+internal f32x8 Noise_Perlin3(const noise_table* Table, f32x8 X, f32x8 Y, f32x8 Z);
+internal f32x8 Noise_FBm2(const noise_table* Table, f32x8 X, f32x8 Y, u32 Octaves, f32 Lacunarity = 2.0f, f32 Gain = 0.5f);
+internal f32x8 Noise_FBm3(const noise_table* Table, f32x8 X, f32x8 Y, f32x8 Z, u32 Octaves, f32 Lacunarity = 2.0f, f32 Gain = 0.5f);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+internal void Noise_Initialize(noise_table* Table, u32 Seed)
+{
+	Table->Seed = Seed;
+
+	for (i32 i = 0; i < 256; i++)
+		Table->Permutation[i] = i;
+
+	// Fisher-Yates with xorshift, zero state would get stuck
+	u32 State = Seed * 747796405u + 2891336453u;
+	if (State == 0)
+		State = 1;
+
+	for (i32 i = 255; i > 0; i--)
+	{
+		State ^= State << 13;
+		State ^= State >> 17;
+		State ^= State << 5;
+
+		i32 j = static_cast<i32>(State % static_cast<u32>(i + 1));
+		i32 Temp = Table->Permutation[i];
+		Table->Permutation[i] = Table->Permutation[j];
+		Table->Permutation[j] = Temp;
+	}
+
+	for (i32 i = 0; i < 256; i++)
+		Table->Permutation[256 + i] = Table->Permutation[i];
+}
+
+inline f32x8 Noise_Fade(f32x8 T)
+{
+	// 6t^5 - 15t^4 + 10t^3
+	return T * T * T * MulAdd(T, MulAdd(T, F32x8(6.0f), F32x8(-15.0f)), F32x8(10.0f));
+}
+
+// Flips the sign of A where the given bit of Hash is set
+inline f32x8 Noise_FlipSign(f32x8 A, i32x8 Hash, i32 Bit)
+{
+	return A ^ AsF32((Hash & I32x8(1 << Bit)) << (31 - Bit));
+}
+
+inline f32x8 Noise_Grad2(i32x8 Hash, f32x8 X, f32x8 Y)
+{
+	// Diagonal gradients (+-1, +-1)
+	return Noise_FlipSign(X, Hash, 0) + Noise_FlipSign(Y, Hash, 1);
+}
+
+inline f32x8 Noise_Grad3(i32x8 Hash, f32x8 X, f32x8 Y, f32x8 Z)
+{
+	// Ken Perlin's 12 edge gradients (plus 4 repeats)
+	Hash = Hash & I32x8(15);
+	f32x8 UseX = AsF32(I32x8(8) > Hash);
+	f32x8 UseY = AsF32(I32x8(4) > Hash);
+	f32x8 UseXForV = AsF32((Hash == I32x8(12)) | (Hash == I32x8(14)));
+
+	f32x8 U = Select(UseX, X, Y);
+	f32x8 V = Select(UseY, Y, Select(UseXForV, X, Z));
+	return Noise_FlipSign(U, Hash, 0) + Noise_FlipSign(V, Hash, 1);
+}
+
+internal f32x8 Noise_Perlin2(const noise_table* Table, f32x8 X, f32x8 Y)
+{
+	const i32* P = Table->Permutation;
+
+	f32x8 FloorX = Floor(X), FloorY = Floor(Y);
+	i32x8 XI = ConvertToI32(FloorX) & I32x8(255);
+	i32x8 YI = ConvertToI32(FloorY) & I32x8(255);
+	f32x8 FX = X - FloorX, FY = Y - FloorY;
+	f32x8 U = Noise_Fade(FX), V = Noise_Fade(FY);
+
+	const i32x8 One = I32x8(1);
+	i32x8 A = Gather(P, XI) + YI;
+	i32x8 B = Gather(P, XI + One) + YI;
+
+	const f32x8 F1 = F32x8(1.0f);
+	f32x8 G00 = Noise_Grad2(Gather(P, A), FX, FY);
+	f32x8 G10 = Noise_Grad2(Gather(P, B), FX - F1, FY);
+	f32x8 G01 = Noise_Grad2(Gather(P, A + One), FX, FY - F1);
+	f32x8 G11 = Noise_Grad2(Gather(P, B + One), FX - F1, FY - F1);
+
+	// Diagonal gradients peak at ~1.41
+	return Lerp(Lerp(G00, G10, U), Lerp(G01, G11, U), V) * F32x8(0.7071f);
+}
+
+internal f32x8 Noise_Perlin3(const noise_table* Table, f32x8 X, f32x8 Y, f32x8 Z)
+{
+	const i32* P = Table->Permutation;
+
+	f32x8 FloorX = Floor(X), FloorY = Floor(Y), FloorZ = Floor(Z);
+	i32x8 XI = ConvertToI32(FloorX) & I32x8(255);
+	i32x8 YI = ConvertToI32(FloorY) & I32x8(255);
+	i32x8 ZI = ConvertToI32(FloorZ) & I32x8(255);
+	f32x8 FX = X - FloorX, FY = Y - FloorY, FZ = Z - FloorZ;
+	f32x8 U = Noise_Fade(FX), V = Noise_Fade(FY), W = Noise_Fade(FZ);
+
+	const i32x8 One = I32x8(1);
+	i32x8 A = Gather(P, XI) + YI;
+	i32x8 AA = Gather(P, A) + ZI;
+	i32x8 AB = Gather(P, A + One) + ZI;
+	i32x8 B = Gather(P, XI + One) + YI;
+	i32x8 BA = Gather(P, B) + ZI;
+	i32x8 BB = Gather(P, B + One) + ZI;
+
+	const f32x8 F1 = F32x8(1.0f);
+	f32x8 FX1 = FX - F1, FY1 = FY - F1, FZ1 = FZ - F1;
+
+	f32x8 G000 = Noise_Grad3(Gather(P, AA), FX, FY, FZ);
+	f32x8 G100 = Noise_Grad3(Gather(P, BA), FX1, FY, FZ);
+	f32x8 G010 = Noise_Grad3(Gather(P, AB), FX, FY1, FZ);
+	f32x8 G110 = Noise_Grad3(Gather(P, BB), FX1, FY1, FZ);
+	f32x8 G001 = Noise_Grad3(Gather(P, AA + One), FX, FY, FZ1);
+	f32x8 G101 = Noise_Grad3(Gather(P, BA + One), FX1, FY, FZ1);
+	f32x8 G011 = Noise_Grad3(Gather(P, AB + One), FX, FY1, FZ1);
+	f32x8 G111 = Noise_Grad3(Gather(P, BB + One), FX1, FY1, FZ1);
+
+	f32x8 Near = Lerp(Lerp(G000, G100, U), Lerp(G010, G110, U), V);
+	f32x8 Far = Lerp(Lerp(G001, G101, U), Lerp(G011, G111, U), V);
+	return Lerp(Near, Far, W);
+}
+
+internal f32x8 Noise_FBm2(const noise_table* Table, f32x8 X, f32x8 Y, u32 Octaves, f32 Lacunarity, f32 Gain)
+{
+	f32x8 Sum = F32x8Zero();
+	f32 Amplitude = 1.0f, Frequency = 1.0f, Normalization = 0.0f;
+
+	for (u32 i = 0; i < Octaves; i++)
+	{
+		// Offset octaves so they do not all share the lattice origin
+		f32x8 Offset = F32x8(i * 17.31f);
+		Sum = MulAdd(Noise_Perlin2(Table, MulAdd(X, F32x8(Frequency), Offset), MulAdd(Y, F32x8(Frequency), Offset)), F32x8(Amplitude), Sum);
+
+		Normalization += Amplitude;
+		Amplitude *= Gain;
+		Frequency *= Lacunarity;
+	}
+
+	return Sum * F32x8(1.0f / Normalization);
+}
+
+internal f32x8 Noise_FBm3(const noise_table* Table, f32x8 X, f32x8 Y, f32x8 Z, u32 Octaves, f32 Lacunarity, f32 Gain)
+{
+	f32x8 Sum = F32x8Zero();
+	f32 Amplitude = 1.0f, Frequency = 1.0f, Normalization = 0.0f;
+
+	for (u32 i = 0; i < Octaves; i++)
+	{
+		f32x8 Offset = F32x8(i * 17.31f);
+		Sum = MulAdd(Noise_Perlin3(Table, MulAdd(X, F32x8(Frequency), Offset), MulAdd(Y, F32x8(Frequency), Offset), MulAdd(Z, F32x8(Frequency), Offset)), F32x8(Amplitude), Sum);
+
+		Normalization += Amplitude;
+		Amplitude *= Gain;
+		Frequency *= Lacunarity;
+	}
+
+	return Sum * F32x8(1.0f / Normalization);
+}
@@ -0,0 +1,594 @@
+#pragma once
+
+// Software occlusion culling
+// Nearby occluders are rasterized into a small depth buffer on the CPU and a max (farthest depth) pyramid is built from it.
+// An object is hidden if its nearest depth lies behind the farthest occluder depth everywhere in its screen rect.
+// Depth follows the main pass, [0, 1] with 0 at the near plane.
+//
+// The depth buffer is split into tiles. Triangles are binned first and then every tile is rasterized 8 pixels at a time,
+// so a tile stays in L1 while all of its triangles are processed. The first pyramid level is built right after, while it is still hot.
+//
+// The whole thing runs as a single job, kick it as soon as the camera is known and wait for it right before pushing geometry.
+
+#include "SIMD.h"
+
+inline constexpr i32 c_OcclusionWidth = 256;
+inline constexpr i32 c_OcclusionHeight = 144;
+inline constexpr i32 c_OcclusionTileWidth = 32; // Multiple of the SIMD width
+inline constexpr i32 c_OcclusionTileHeight = 16;
+inline constexpr i32 c_OcclusionTilesX = c_OcclusionWidth / c_OcclusionTileWidth;
+inline constexpr i32 c_OcclusionTilesY = c_OcclusionHeight / c_OcclusionTileHeight;
+inline constexpr i32 c_OcclusionTileCount = c_OcclusionTilesX * c_OcclusionTilesY;
+inline constexpr i32 c_OcclusionTilePixels = c_OcclusionTileWidth * c_OcclusionTileHeight;
+
+// Level 0 is half of the depth buffer resolution, the last level is 1x1
+inline constexpr u32 c_OcclusionHiZLevelCount = 8;
+inline constexpr u32 c_OcclusionHiZStorage = 16 * 1024;
+
+inline constexpr u32 c_MaxOccluderMeshes = 128;
+inline constexpr u32 c_MaxOccluderTriangles = 32 * 1024;
+inline constexpr u32 c_MaxOcclusionBinEntries = 128 * 1024;
+inline constexpr u32 c_MaxOcclusionCandidates = 16 * 1024;
+
+enum class occlusion_result : u8
+{
+	Visible = 0,
+	Occluded,
+	OutsideFrustum
+};
+
+struct occluder_mesh
+{
+	const quad_vertex* Vertices;
+	u32 QuadCount;
+};
+
+// Screen space setup, edge functions and depth are planes in pixel coordinates
+struct occlusion_triangle
+{
+	f32 EdgeA[3], EdgeB[3], EdgeC[3];
+	f32 DepthA, DepthB, DepthC;
+	i32 MinX, MinY, MaxX, MaxY;
+};
+
+struct occlusion_settings
+{
+	u32 MaxOccluderMeshes;
+	f32 MaxOccluderDistance; // Far occluders cover few pixels and rarely hide anything
+	b32 Enabled;
+};
+
+struct occlusion_stats
+{
+	u32 Candidates;
+	u32 Visible;
+	u32 Occluded;
+	u32 OutsideFrustum;
+	u32 OccluderMeshes;
+	u32 OccluderTriangles;
+	f32 Milliseconds;
+};
+
+struct occlusion_culler
+{
+	occlusion_settings Settings;
+
+	// Input, filled on the main thread before the job is kicked
+	m4 ViewProjection;
+	occluder_mesh Occluders[c_MaxOccluderMeshes];
+	u32 OccluderCount;
+	aabb Candidates[c_MaxOcclusionCandidates];
+	u32 CandidateCount;
+
+	// Output, valid after OcclusionCuller_Wait
+	occlusion_result Results[c_MaxOcclusionCandidates];
+	occlusion_stats Stats;
+
+	// Internal
+	occlusion_triangle Triangles[c_MaxOccluderTriangles];
+	u32 TriangleCount;
+	u32 BinOffsets[c_OcclusionTileCount + 1];
+	u32 BinEntries[c_MaxOcclusionBinEntries];
+	f32 Depth[c_OcclusionTileCount * c_OcclusionTilePixels]; // Tile after tile, row-major inside of a tile
+	f32 HiZStorage[c_OcclusionHiZStorage];
+	f32* HiZ[c_OcclusionHiZLevelCount];                      // Row-major
+	i32 HiZWidths[c_OcclusionHiZLevelCount];
+	i32 HiZHeights[c_OcclusionHiZLevelCount];
+
+	job_counter Job;
+};
+
+internal void OcclusionCuller_Initialize(occlusion_culler* Culler);
+internal void OcclusionCuller_Begin(occlusion_culler* Culler, const m4& ViewProjection);
+internal bool OcclusionCuller_AddOccluder(occlusion_culler* Culler, const quad_vertex* Vertices, u32 QuadCount);
+internal u32 OcclusionCuller_AddCandidate(occlusion_culler* Culler, v3 Min, v3 Max);
+internal void OcclusionCuller_AddBlockWorld(occlusion_culler* Culler, block_world* World, v3 CameraPosition);
+internal void OcclusionCuller_Kick(occlusion_culler* Culler);
+internal void OcclusionCuller_Wait(occlusion_culler* Culler);
+internal void OcclusionCuller_Run(occlusion_culler* Culler);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+internal void OcclusionCuller_Initialize(occlusion_culler* Culler)
+{
+	Culler->Settings.MaxOccluderMeshes = 64;
+	Culler->Settings.MaxOccluderDistance = 128.0f;
+	Culler->Settings.Enabled = true;
+
+	u32 Offset = 0;
+	i32 Width = c_OcclusionWidth / 2, Height = c_OcclusionHeight / 2;
+	for (u32 Level = 0; Level < c_OcclusionHiZLevelCount; Level++)
+	{
+		Culler->HiZ[Level] = &Culler->HiZStorage[Offset];
+		Culler->HiZWidths[Level] = Width;
+		Culler->HiZHeights[Level] = Height;
+		Offset += Width * Height;
+
+		Width = (Width + 1) / 2;
+		Height = (Height + 1) / 2;
+	}
+
+	Assert(Offset <= c_OcclusionHiZStorage, "HiZ storage is too small!");
+}
+
+internal void OcclusionCuller_Begin(occlusion_culler* Culler, const m4& ViewProjection)
+{
+	Culler->ViewProjection = ViewProjection;
+	Culler->OccluderCount = 0;
+	Culler->CandidateCount = 0;
+}
+
+internal bool OcclusionCuller_AddOccluder(occlusion_culler* Culler, const quad_vertex* Vertices, u32 QuadCount)
+{
+	if (Culler->OccluderCount == c_MaxOccluderMeshes)
+		return false;
+
+	Culler->Occluders[Culler->OccluderCount++] = { Vertices, QuadCount };
+	return true;
+}
+
+internal u32 OcclusionCuller_AddCandidate(occlusion_culler* Culler, v3 Min, v3 Max)
+{
+	Assert(Culler->CandidateCount < c_MaxOcclusionCandidates, "Too many occlusion candidates!");
+
+	u32 Index = Culler->CandidateCount++;
+	Culler->Candidates[Index] = { Min, Max };
+	return Index;
+}
+
+// Candidates are the active chunks in the same order as World->ActiveChunks, occluders are the nearest chunks
+internal void OcclusionCuller_AddBlockWorld(occlusion_culler* Culler, block_world* World, v3 CameraPosition)
+{
+	for (u32 i = 0; i < World->ActiveChunkCount; i++)
+	{
+		aabb Bounds = Chunk_GetBounds(World->Chunks[World->ActiveChunks[i]]->Coord);
+		OcclusionCuller_AddCandidate(Culler, Bounds.Min, Bounds.Max);
+	}
+
+	if (!Culler->Settings.Enabled)
+		return;
+
+	struct nearest_chunk
+	{
+		f32 Distance;
+		u32 ChunkIndex;
+	};
+
+	nearest_chunk Nearest[c_MaxOccluderMeshes];
+	u32 NearestCount = 0;
+	u32 MaxCount = glm::min(Culler->Settings.MaxOccluderMeshes, c_MaxOccluderMeshes);
+
+	for (u32 i = 0; i < World->ActiveChunkCount; i++)
+	{
+		u32 ChunkIndex = World->ActiveChunks[i];
+		f32 Distance = glm::length(Chunk_GetCenter(World->Chunks[ChunkIndex]->Coord) - CameraPosition) - c_ChunkBoundingRadius;
+
+		if (Distance > Culler->Settings.MaxOccluderDistance)
+			continue;
+
+		if (NearestCount == MaxCount && Distance >= Nearest[NearestCount - 1].Distance)
+			continue;
+
+		// Insertion into a short sorted list
+		u32 Slot = NearestCount < MaxCount ? NearestCount++ : NearestCount - 1;
+		while (Slot > 0 && Nearest[Slot - 1].Distance > Distance)
+		{
+			Nearest[Slot] = Nearest[Slot - 1];
+			Slot--;
+		}
+
+		Nearest[Slot] = { Distance, ChunkIndex };
+	}
+
+	for (u32 i = 0; i < NearestCount; i++)
+	{
+		if (const chunk_mesh* Occluder = BlockWorld_GetOccluder(World, Nearest[i].ChunkIndex))
+			OcclusionCuller_AddOccluder(Culler, Occluder->Vertices, Occluder->QuadCount);
+	}
+}
+
+internal void OcclusionCuller_Kick(occlusion_culler* Culler)
+{
+	JobSystem_Submit(&g_Jobs, &Culler->Job, [Culler]()
+	{
+		OcclusionCuller_Run(Culler);
+	});
+}
+
+internal void OcclusionCuller_Wait(occlusion_culler* Culler)
+{
+	JobSystem_WaitForCounter(&g_Jobs, &Culler->Job);
+}
+
+// Triangle setup
+
+internal void OcclusionCuller_SetupTriangle(occlusion_culler* Culler, const v4& A, const v4& B, const v4& C)
+{
+	if (Culler->TriangleCount == c_MaxOccluderTriangles)
+		return;
+
+	// To pixels, y goes down like in the render target
+	v4 Clip[3] = { A, B, C };
+	f32 X[3], Y[3], Z[3];
+	for (u32 i = 0; i < 3; i++)
+	{
+		f32 InvW = 1.0f / Clip[i].w;
+		X[i] = (Clip[i].x * InvW * 0.5f + 0.5f) * c_OcclusionWidth;
+		Y[i] = (0.5f - Clip[i].y * InvW * 0.5f) * c_OcclusionHeight;
+		Z[i] = Clip[i].z * InvW;
+	}
+
+	// Same winding as the main pass, clockwise on screen is front facing. Back faces are always behind front faces of a closed mesh.
+	f32 Area = (X[1] - X[0]) * (Y[2] - Y[0]) - (X[2] - X[0]) * (Y[1] - Y[0]);
+	if (Area <= 0.0f)
+		return;
+
+	// Pixels whose centers can be covered
+	i32 MinX = glm::max((i32)glm::ceil(glm::min(X[0], glm::min(X[1], X[2])) - 0.5f), 0);
+	i32 MinY = glm::max((i32)glm::ceil(glm::min(Y[0], glm::min(Y[1], Y[2])) - 0.5f), 0);
+	i32 MaxX = glm::min((i32)glm::floor(glm::max(X[0], glm::max(X[1], X[2])) - 0.5f), c_OcclusionWidth - 1);
+	i32 MaxY = glm::min((i32)glm::floor(glm::max(Y[0], glm::max(Y[1], Y[2])) - 0.5f), c_OcclusionHeight - 1);
+
+	if (MinX > MaxX || MinY > MaxY)
+		return;
+
+	occlusion_triangle& Triangle = Culler->Triangles[Culler->TriangleCount++];
+
+	// Edge from vertex i to vertex i + 1 is stored at the opposite vertex, positive inside
+	for (u32 i = 0; i < 3; i++)
+	{
+		u32 From = (i + 1) % 3, To = (i + 2) % 3;
+		Triangle.EdgeA[i] = -(Y[To] - Y[From]);
+		Triangle.EdgeB[i] = X[To] - X[From];
+		Triangle.EdgeC[i] = -(Triangle.EdgeA[i] * X[From] + Triangle.EdgeB[i] * Y[From]);
+	}
+
+	// Depth is linear in screen space after the perspective divide
+	f32 InvArea = 1.0f / Area;
+	f32 DZ1 = Z[1] - Z[0], DZ2 = Z[2] - Z[0];
+	Triangle.DepthA = (DZ1 * (Y[2] - Y[0]) - DZ2 * (Y[1] - Y[0])) * InvArea;
+	Triangle.DepthB = (DZ2 * (X[1] - X[0]) - DZ1 * (X[2] - X[0])) * InvArea;
+	Triangle.DepthC = Z[0] - Triangle.DepthA * X[0] - Triangle.DepthB * Y[0];
+
+	Triangle.MinX = MinX;
+	Triangle.MinY = MinY;
+	Triangle.MaxX = MaxX;
+	Triangle.MaxY = MaxY;
+}
+
+// Clips against the near plane (z >= 0 in clip space) and sets up the resulting triangles
+internal void OcclusionCuller_AddTriangle(occlusion_culler* Culler, const v4& A, const v4& B, const v4& C)
+{
+	// Trivial reject, all vertices outside of the same plane
+	if ((A.x > A.w && B.x > B.w && C.x > C.w) || (A.x < -A.w && B.x < -B.w && C.x < -C.w) ||
+		(A.y > A.w && B.y > B.w && C.y > C.w) || (A.y < -A.w && B.y < -B.w && C.y < -C.w) ||
+		(A.z > A.w && B.z > B.w && C.z > C.w) || (A.z < 0.0f && B.z < 0.0f && C.z < 0.0f))
+		return;
+
+	if (A.z >= 0.0f && B.z >= 0.0f && C.z >= 0.0f)
+	{
+		OcclusionCuller_SetupTriangle(Culler, A, B, C);
+		return;
+	}
+
+	v4 Input[3] = { A, B, C };
+	v4 Polygon[4];
+	u32 Count = 0;
+
+	for (u32 i = 0; i < 3; i++)
+	{
+		const v4& Current = Input[i];
+		const v4& Next = Input[(i + 1) % 3];
+
+		if (Current.z >= 0.0f)
+			Polygon[Count++] = Current;
+
+		if ((Current.z >= 0.0f) != (Next.z >= 0.0f))
+		{
+			f32 T = Current.z / (Current.z - Next.z);
+			Polygon[Count++] = Current + (Next - Current) * T;
+		}
+	}
+
+	for (u32 i = 2; i < Count; i++)
+		OcclusionCuller_SetupTriangle(Culler, Polygon[0], Polygon[i - 1], Polygon[i]);
+}
+
+internal void OcclusionCuller_SetupOccluders(occlusion_culler* Culler)
+{
+	const m4& M = Culler->ViewProjection;
+
+	for (u32 MeshIndex = 0; MeshIndex < Culler->OccluderCount; MeshIndex++)
+	{
+		const occluder_mesh& Mesh = Culler->Occluders[MeshIndex];
+
+		// Two quads per batch, 8 vertices transformed at once
+		for (u32 Quad = 0; Quad < Mesh.QuadCount; Quad += 2)
+		{
+			u32 VertexCount = glm::min(Mesh.QuadCount - Quad, 2u) * 4;
+			const quad_vertex* Vertices = &Mesh.Vertices[Quad * 4];
+
+			alignas(32) f32 PX[8] = {}, PY[8] = {}, PZ[8] = {};
+			for (u32 i = 0; i < VertexCount; i++)
+			{
+				PX[i] = Vertices[i].Position.x;
+				PY[i] = Vertices[i].Position.y;
+				PZ[i] = Vertices[i].Position.z;
+			}
+
+			f32x8 X, Y, Z, W;
+			TransformPoints(M, { F32x8Load(PX), F32x8Load(PY), F32x8Load(PZ) }, &X, &Y, &Z, &W);
+
+			alignas(32) f32 CX[8], CY[8], CZ[8], CW[8];
+			F32x8Store(CX, X);
+			F32x8Store(CY, Y);
+			F32x8Store(CZ, Z);
+			F32x8Store(CW, W);
+
+			for (u32 First = 0; First < VertexCount; First += 4)
+			{
+				v4 Clip[4];
+				for (u32 i = 0; i < 4; i++)
+					Clip[i] = v4(CX[First + i], CY[First + i], CZ[First + i], CW[First + i]);
+
+				// Same triangulation as the index buffer
+				OcclusionCuller_AddTriangle(Culler, Clip[0], Clip[1], Clip[2]);
+				OcclusionCuller_AddTriangle(Culler, Clip[2], Clip[3], Clip[0]);
+			}
+		}
+	}
+}
+
+internal void OcclusionCuller_BinTriangles(occlusion_culler* Culler)
+{
+	u32 Counts[c_OcclusionTileCount] = {};
+	u32 TotalEntries = 0;
+
+	// Count, drop the triangles that would not fit
+	for (u32 i = 0; i < Culler->TriangleCount; i++)
+	{
+		const occlusion_triangle& Triangle = Culler->Triangles[i];
+		i32 TileMinX = Triangle.MinX / c_OcclusionTileWidth, TileMaxX = Triangle.MaxX / c_OcclusionTileWidth;
+		i32 TileMinY = Triangle.MinY / c_OcclusionTileHeight, TileMaxY = Triangle.MaxY / c_OcclusionTileHeight;
+
+		u32 Entries = (TileMaxX - TileMinX + 1) * (TileMaxY - TileMinY + 1);
+		if (TotalEntries + Entries > c_MaxOcclusionBinEntries)
+		{
+			Culler->TriangleCount = i;
+			break;
+		}
+
+		TotalEntries += Entries;
+		for (i32 TileY = TileMinY; TileY <= TileMaxY; TileY++)
+			for (i32 TileX = TileMinX; TileX <= TileMaxX; TileX++)
+				Counts[TileY * c_OcclusionTilesX + TileX]++;
+	}
+
+	Culler->BinOffsets[0] = 0;
+	for (i32 Tile = 0; Tile < c_OcclusionTileCount; Tile++)
+		Culler->BinOffsets[Tile + 1] = Culler->BinOffsets[Tile] + Counts[Tile];
+
+	// Fill, triangles keep their submission order inside of a bin
+	u32 Cursors[c_OcclusionTileCount];
+	memcpy(Cursors, Culler->BinOffsets, sizeof(Cursors));
+
+	for (u32 i = 0; i < Culler->TriangleCount; i++)
+	{
+		const occlusion_triangle& Triangle = Culler->Triangles[i];
+		for (i32 TileY = Triangle.MinY / c_OcclusionTileHeight; TileY <= Triangle.MaxY / c_OcclusionTileHeight; TileY++)
+			for (i32 TileX = Triangle.MinX / c_OcclusionTileWidth; TileX <= Triangle.MaxX / c_OcclusionTileWidth; TileX++)
+				Culler->BinEntries[Cursors[TileY * c_OcclusionTilesX + TileX]++] = i;
+	}
+}
+
+// Rasterization
+
+internal void OcclusionCuller_RasterizeTile(occlusion_culler* Culler, i32 TileIndex)
+{
+	const i32 TileX0 = (TileIndex % c_OcclusionTilesX) * c_OcclusionTileWidth;
+	const i32 TileY0 = (TileIndex / c_OcclusionTilesX) * c_OcclusionTileHeight;
+	f32* Tile = &Culler->Depth[TileIndex * c_OcclusionTilePixels];
+
+	for (i32 i = 0; i < c_OcclusionTilePixels; i += c_SimdWidth)
+		F32x8Store(Tile + i, F32x8(1.0f));
+
+	const f32x8 LaneOffset = F32x8LaneIndex() + F32x8(0.5f);
+	const f32x8 Zero = F32x8Zero();
+
+	for (u32 Entry = Culler->BinOffsets[TileIndex]; Entry < Culler->BinOffsets[TileIndex + 1]; Entry++)
+	{
+		const occlusion_triangle& Triangle = Culler->Triangles[Culler->BinEntries[Entry]];
+
+		// Spans start at a multiple of 8 inside of the tile, lanes past the triangle fail the edge tests
+		i32 MinX = glm::max(Triangle.MinX, TileX0);
+		i32 MaxX = glm::min(Triangle.MaxX, TileX0 + c_OcclusionTileWidth - 1);
+		i32 MinY = glm::max(Triangle.MinY, TileY0);
+		i32 MaxY = glm::min(Triangle.MaxY, TileY0 + c_OcclusionTileHeight - 1);
+		MinX = TileX0 + ((MinX - TileX0) & ~(i32)(c_SimdWidth - 1));
+
+		f32x8 EdgeA0 = F32x8(Triangle.EdgeA[0]), EdgeA1 = F32x8(Triangle.EdgeA[1]), EdgeA2 = F32x8(Triangle.EdgeA[2]);
+		f32x8 DepthA = F32x8(Triangle.DepthA);
+
+		for (i32 Y = MinY; Y <= MaxY; Y++)
+		{
+			f32 PixelY = Y + 0.5f;
+			f32x8 Row0 = F32x8(Triangle.EdgeB[0] * PixelY + Triangle.EdgeC[0]);
+			f32x8 Row1 = F32x8(Triangle.EdgeB[1] * PixelY + Triangle.EdgeC[1]);
+			f32x8 Row2 = F32x8(Triangle.EdgeB[2] * PixelY + Triangle.EdgeC[2]);
+			f32x8 RowDepth = F32x8(Triangle.DepthB * PixelY + Triangle.DepthC);
+
+			f32* DepthRow = &Tile[(Y - TileY0) * c_OcclusionTileWidth];
+
+			for (i32 X = MinX; X <= MaxX; X += c_SimdWidth)
+			{
+				f32x8 PixelX = F32x8((f32)X) + LaneOffset;
+
+				f32x8 Inside = (MulAdd(EdgeA0, PixelX, Row0) >= Zero) & (MulAdd(EdgeA1, PixelX, Row1) >= Zero) & (MulAdd(EdgeA2, PixelX, Row2) >= Zero);
+				if (!Any(Inside))
+					continue;
+
+				f32x8 Depth = MulAdd(DepthA, PixelX, RowDepth);
+				f32x8 Current = F32x8Load(DepthRow + X - TileX0);
+				F32x8Store(DepthRow + X - TileX0, Select(Inside, Min(Current, Depth), Current));
+			}
+		}
+	}
+
+	// First HiZ level while the tile is still in cache
+	f32* HiZ = Culler->HiZ[0];
+	const i32 HiZWidth = Culler->HiZWidths[0];
+	for (i32 Y = 0; Y < c_OcclusionTileHeight; Y += 2)
+	{
+		const f32* Row0 = &Tile[Y * c_OcclusionTileWidth];
+		const f32* Row1 = Row0 + c_OcclusionTileWidth;
+		f32* Out = &HiZ[((TileY0 + Y) / 2) * HiZWidth + TileX0 / 2];
+
+		for (i32 X = 0; X < c_OcclusionTileWidth; X += 2)
+			Out[X / 2] = glm::max(glm::max(Row0[X], Row0[X + 1]), glm::max(Row1[X], Row1[X + 1]));
+	}
+}
+
+internal void OcclusionCuller_BuildHiZ(occlusion_culler* Culler)
+{
+	for (u32 Level = 1; Level < c_OcclusionHiZLevelCount; Level++)
+	{
+		const f32* Source = Culler->HiZ[Level - 1];
+		const i32 SourceWidth = Culler->HiZWidths[Level - 1], SourceHeight = Culler->HiZHeights[Level - 1];
+		f32* Destination = Culler->HiZ[Level];
+		const i32 Width = Culler->HiZWidths[Level], Height = Culler->HiZHeights[Level];
+
+		// Odd sizes clamp, the last row and column just get counted twice
+		for (i32 Y = 0; Y < Height; Y++)
+		{
+			const f32* Row0 = &Source[(2 * Y) * SourceWidth];
+			const f32* Row1 = &Source[glm::min(2 * Y + 1, SourceHeight - 1) * SourceWidth];
+
+			for (i32 X = 0; X < Width; X++)
+			{
+				i32 X0 = 2 * X, X1 = glm::min(2 * X + 1, SourceWidth - 1);
+				Destination[Y * Width + X] = glm::max(glm::max(Row0[X0], Row0[X1]), glm::max(Row1[X0], Row1[X1]));
+			}
+		}
+	}
+}
+
+// Testing
+
+internal occlusion_result OcclusionCuller_TestBounds(const occlusion_culler* Culler, const aabb& Bounds)
+{
+	const v3& Min = Bounds.Min;
+	const v3& Max = Bounds.Max;
+
+	// All 8 corners at once
+	v3x8 Corners = {
+		F32x8(Min.x, Max.x, Min.x, Max.x, Min.x, Max.x, Min.x, Max.x),
+		F32x8(Min.y, Min.y, Max.y, Max.y, Min.y, Min.y, Max.y, Max.y),
+		F32x8(Min.z, Min.z, Min.z, Min.z, Max.z, Max.z, Max.z, Max.z)
+	};
+
+	f32x8 X, Y, Z, W;
+	TransformPoints(Culler->ViewProjection, Corners, &X, &Y, &Z, &W);
+
+	if (All(X > W) || All(X < -W) || All(Y > W) || All(Y < -W) || All(Z > W) || All(Z < F32x8Zero()))
+		return occlusion_result::OutsideFrustum;
+
+	// Crosses the near plane, the camera is basically inside of it
+	if (Any(Z < F32x8Zero()))
+		return occlusion_result::Visible;
+
+	f32x8 InvW = F32x8(1.0f) / W;
+	f32x8 NX = X * InvW, NY = Y * InvW;
+	f32 NearestDepth = HorizontalMin(Z * InvW);
+
+	// Rect in texels of the first HiZ level
+	const i32 Width = Culler->HiZWidths[0], Height = Culler->HiZHeights[0];
+	i32 MinX = glm::clamp((i32)((HorizontalMin(NX) * 0.5f + 0.5f) * Width), 0, Width - 1);
+	i32 MaxX = glm::clamp((i32)((HorizontalMax(NX) * 0.5f + 0.5f) * Width), 0, Width - 1);
+	i32 MinY = glm::clamp((i32)((0.5f - HorizontalMax(NY) * 0.5f) * Height), 0, Height - 1);
+	i32 MaxY = glm::clamp((i32)((0.5f - HorizontalMin(NY) * 0.5f) * Height), 0, Height - 1);
+
+	// Go up until the rect is at most 4x4 texels
+	u32 Level = 0;
+	while (Level + 1 < c_OcclusionHiZLevelCount && (MaxX - MinX >= 4 || MaxY - MinY >= 4))
+	{
+		MinX >>= 1; MaxX >>= 1;
+		MinY >>= 1; MaxY >>= 1;
+		Level++;
+	}
+
+	const f32* HiZ = Culler->HiZ[Level];
+	const i32 LevelWidth = Culler->HiZWidths[Level];
+
+	f32 FarthestOccluder = 0.0f;
+	for (i32 TY = MinY; TY <= MaxY; TY++)
+		for (i32 TX = MinX; TX <= MaxX; TX++)
+			FarthestOccluder = glm::max(FarthestOccluder, HiZ[TY * LevelWidth + TX]);
+
+	return NearestDepth > FarthestOccluder ? occlusion_result::Occluded : occlusion_result::Visible;
+}
+
+internal void OcclusionCuller_Run(occlusion_culler* Culler)
+{
+	auto Start = std::chrono::high_resolution_clock::now();
+
+	occlusion_stats& Stats = Culler->Stats;
+	memset(&Stats, 0, sizeof(Stats));
+	Stats.Candidates = Culler->CandidateCount;
+
+	if (!Culler->Settings.Enabled)
+	{
+		memset(Culler->Results, (u8)occlusion_result::Visible, Culler->CandidateCount);
+		Stats.Visible = Culler->CandidateCount;
+		return;
+	}
+
+	Culler->TriangleCount = 0;
+	OcclusionCuller_SetupOccluders(Culler);
+	OcclusionCuller_BinTriangles(Culler);
+
+	for (i32 Tile = 0; Tile < c_OcclusionTileCount; Tile++)
+		OcclusionCuller_RasterizeTile(Culler, Tile);
+
+	OcclusionCuller_BuildHiZ(Culler);
+
+	for (u32 i = 0; i < Culler->CandidateCount; i++)
+	{
+		occlusion_result Result = OcclusionCuller_TestBounds(Culler, Culler->Candidates[i]);
+		Culler->Results[i] = Result;
+
+		switch (Result)
+		{
+			case occlusion_result::Visible:        Stats.Visible++; break;
+			case occlusion_result::Occluded:       Stats.Occluded++; break;
+			case occlusion_result::OutsideFrustum: Stats.OutsideFrustum++; break;
+		}
+	}
+
+	Stats.OccluderMeshes = Culler->OccluderCount;
+	Stats.OccluderTriangles = Culler->TriangleCount;
+	Stats.Milliseconds = std::chrono::duration<f32, std::milli>(std::chrono::high_resolution_clock::now() - Start).count();
+}
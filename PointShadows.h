@@ -0,0 +1,371 @@
+#pragma once
+
+// Point light shadows
+// The first c_MaxPointShadows lights of the light store with light_flags::CastsShadow render their surroundings into a cube,
+// six tiles of the shadow atlas per light.
+// Tiles are sized by how big the light is on screen (PointShadows_AssignTiles), a light that gets new tiles renders all faces.
+// Cubes are cached between frames and a face is only rendered again when something it can see changed,
+// so a static light with static surroundings costs no shadow rendering at all after its first frame.
+//
+// Changes are found by diffing the shadow casters of two frames. Every frame the caller submits each caster with a stable key,
+// its world bounds and a revision (anything that changes together with its geometry, a mesh version or a transform hash).
+// Only casters inside the radius of some light are kept:
+// - Key that was not there last frame: added, the faces that see it are dirty
+// - Different bounds or revision: moved, the faces that saw it before and the ones that see it now are dirty
+// - Key that was not submitted: removed, either destroyed or out of every light, the faces that saw it are dirty
+// Lights are compared by position and radius, any change dirties their whole cube.
+//
+// Nothing here knows about a graphics API. Backends render the dirty faces, then mark them clean.
+
+inline constexpr u32 c_PointShadowFaceCount = 6; // +X -X +Y -Y +Z -Z, the D3D12 cube face order
+inline constexpr u32 c_PointShadowAllFaces = (1u << c_PointShadowFaceCount) - 1;
+static_assert(c_MaxPointShadowFaces == c_MaxPointShadows * c_PointShadowFaceCount);
+static_assert(c_MaxPointShadows <= c_ShadowAtlasMaxOwners && c_PointShadowFaceCount <= c_ShadowAtlasMaxOwnerTiles);
+
+struct point_shadow_caster
+{
+	u64 Key;
+	u64 Revision;
+	aabb Bounds;
+	u32 Frame; // Last frame it was submitted in
+};
+
+struct point_shadow_light
+{
+	v3 Position;
+	f32 Radius;
+	b32 Active;
+	u32 DirtyFaces; // Bit per face
+	u32 LightIndex; // In the light store, this frame
+};
+
+struct point_shadow_stats
+{
+	u32 Lights;
+	u32 TrackedCasters;
+	u32 AddedCasters;
+	u32 MovedCasters;
+	u32 RemovedCasters;
+	u32 DirtyFaces; // Faces the backend has to render this frame
+};
+
+struct point_shadow_tracker
+{
+	point_shadow_light Lights[c_MaxPointShadows];
+	u32 LightCount;
+	u32 MaxTileSize; // Largest tile a face gets, c_ShadowAtlasMaxTile unless the shadow governor lowers it
+
+	// Dense records, found through an open addressing index with linear probing
+	point_shadow_caster* Casters;
+	u32 CasterCount;
+	u32 MaxCasters;
+	u32* CasterIndex;
+	u32 IndexMask;
+
+	u32 Frame;
+	b32 OverflowReported;
+	point_shadow_stats Stats;
+};
+
+internal void PointShadows_Initialize(point_shadow_tracker* Tracker, u32 MaxCasters);
+internal void PointShadows_Destroy(point_shadow_tracker* Tracker);
+
+// Assigns the shadow cubes to the first shadow casting lights (writes their shadow index) and dirties the cubes of lights that changed
+internal void PointShadows_BeginFrame(point_shadow_tracker* Tracker, light_store* Lights);
+
+// Atlas tiles for the shadowed lights, after BeginFrame. Writes light_environment::PointShadowTiles,
+// lights the atlas has no room for lose their shadows (shadow index -1)
+internal const shadow_atlas_stats& PointShadows_AssignTiles(point_shadow_tracker* Tracker, shadow_atlas* Atlas, light_store* Lights, light_environment* Environment, const camera& Camera, f32 ViewportHeight);
+
+// Every shadow caster, every frame, after BeginFrame
+internal void PointShadows_SubmitCaster(point_shadow_tracker* Tracker, u64 Key, u64 Revision, const aabb& Bounds);
+
+// Casters that were not submitted are removed
+internal const point_shadow_stats& PointShadows_EndFrame(point_shadow_tracker* Tracker);
+
+inline u32 PointShadows_GetDirtyFaces(const point_shadow_tracker* Tracker, u32 Light) { return Tracker->Lights[Light].Active ? Tracker->Lights[Light].DirtyFaces : 0; }
+inline void PointShadows_MarkClean(point_shadow_tracker* Tracker, u32 Light, u32 Faces) { Tracker->Lights[Light].DirtyFaces &= ~Faces; }
+
+// Faces of a light whose frustum the bounds overlap, 0 when they are outside of its radius
+inline u32 PointShadows_GetFaceMask(v3 Position, f32 Radius, const aabb& Bounds)
+{
+	v3 Min = Bounds.Min - Position;
+	v3 Max = Bounds.Max - Position;
+
+	v3 Closest = glm::clamp(v3(0.0f), Min, Max);
+	if (glm::dot(Closest, Closest) > Radius * Radius)
+		return 0;
+
+	// Closest distance to the light along every axis
+	v3 MinAbs = glm::min(glm::abs(Min), glm::abs(Max));
+	for (u32 Axis = 0; Axis < 3; Axis++)
+	{
+		if (Min[Axis] <= 0.0f && Max[Axis] >= 0.0f)
+			MinAbs[Axis] = 0.0f;
+	}
+
+	// Face +A is the pyramid A >= |B|, A >= |C|. The box is best at its furthest A and closest B and C
+	u32 Mask = 0;
+	for (u32 Axis = 0; Axis < 3; Axis++)
+	{
+		f32 Other = glm::max(MinAbs[(Axis + 1) % 3], MinAbs[(Axis + 2) % 3]);
+		if (Max[Axis] > 0.0f && Max[Axis] >= Other)
+			Mask |= 1u << (Axis * 2);
+		if (Min[Axis] < 0.0f && -Min[Axis] >= Other)
+			Mask |= 1u << (Axis * 2 + 1);
+	}
+
+	return Mask;
+}
+
+// Revision for casters that only move, FNV-1a over the bits of the matrix
+inline u64 PointShadows_HashTransform(const m4& Transform)
+{
+	u64 Hash = 0xCBF29CE484222325ull;
+	const u8* Bytes = (const u8*)&Transform;
+	for (u32 i = 0; i < sizeof(m4); i++)
+		Hash = (Hash ^ Bytes[i]) * 0x100000001B3ull;
+
+	return Hash;
+}
+
+// 90 degree perspective looking down the face axis, depth goes from c_PointShadowNearPlane to the radius
+inline m4 PointShadows_GetFaceViewProjection(v3 Position, f32 Radius, u32 Face)
+{
+	local_persist const v3 Forward[c_PointShadowFaceCount] = { v3(1, 0, 0), v3(-1, 0, 0), v3(0, 1, 0), v3(0, -1, 0), v3(0, 0, 1), v3(0, 0, -1) };
+	local_persist const v3 Up[c_PointShadowFaceCount] = { v3(0, 1, 0), v3(0, 1, 0), v3(0, 0, -1), v3(0, 0, 1), v3(0, 1, 0), v3(0, 1, 0) };
+
+	m4 View = glm::lookAtLH(Position, Position + Forward[Face], Up[Face]);
+	m4 Projection = glm::perspectiveLH_ZO(glm::half_pi<f32>(), 1.0f, c_PointShadowNearPlane, Radius);
+	return Projection * View;
+}
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+inline constexpr u32 c_PointShadowNoCaster = 0xFFFFFFFF;
+
+// SplitMix64 finalizer
+inline u32 PointShadows_Hash(u64 Key)
+{
+	Key = (Key ^ (Key >> 30)) * 0xBF58476D1CE4E5B9ull;
+	Key = (Key ^ (Key >> 27)) * 0x94D049BB133111EBull;
+	return (u32)(Key ^ (Key >> 31));
+}
+
+internal void PointShadows_Initialize(point_shadow_tracker* Tracker, u32 MaxCasters)
+{
+	// Index stays at most half full
+	u32 IndexSize = 1;
+	while (IndexSize < MaxCasters * 2)
+		IndexSize *= 2;
+
+	Tracker->MaxTileSize = c_ShadowAtlasMaxTile;
+	Tracker->MaxCasters = MaxCasters;
+	Tracker->Casters = VmAllocArray(point_shadow_caster, MaxCasters);
+	Tracker->CasterIndex = VmAllocArray(u32, IndexSize);
+	Tracker->IndexMask = IndexSize - 1;
+	memset(Tracker->CasterIndex, 0xFF, sizeof(u32) * IndexSize);
+}
+
+internal void PointShadows_Destroy(point_shadow_tracker* Tracker)
+{
+	VmFree(Tracker->Casters);
+	VmFree(Tracker->CasterIndex);
+	*Tracker = {};
+}
+
+internal u32 PointShadows_FindCaster(const point_shadow_tracker* Tracker, u64 Key)
+{
+	for (u32 Slot = PointShadows_Hash(Key) & Tracker->IndexMask;; Slot = (Slot + 1) & Tracker->IndexMask)
+	{
+		u32 Index = Tracker->CasterIndex[Slot];
+		if (Index == c_PointShadowNoCaster || Tracker->Casters[Index].Key == Key)
+			return Index;
+	}
+}
+
+internal void PointShadows_IndexCaster(point_shadow_tracker* Tracker, u32 Index)
+{
+	u32 Slot = PointShadows_Hash(Tracker->Casters[Index].Key) & Tracker->IndexMask;
+	while (Tracker->CasterIndex[Slot] != c_PointShadowNoCaster)
+		Slot = (Slot + 1) & Tracker->IndexMask;
+
+	Tracker->CasterIndex[Slot] = Index;
+}
+
+internal void PointShadows_Invalidate(point_shadow_tracker* Tracker, const aabb& Bounds)
+{
+	for (u32 i = 0; i < Tracker->LightCount; i++)
+	{
+		point_shadow_light& Light = Tracker->Lights[i];
+		Light.DirtyFaces |= PointShadows_GetFaceMask(Light.Position, Light.Radius, Bounds);
+	}
+}
+
+internal void PointShadows_BeginFrame(point_shadow_tracker* Tracker, light_store* Lights)
+{
+	Tracker->Frame++;
+	Tracker->Stats = {};
+
+	u32 LightCount = 0;
+	for (u32 Index = 0; Index < Lights->Count; Index++)
+	{
+		if ((Lights->Flags[Index] & light_flags::CastsShadow) == light_flags::None)
+			continue;
+
+		if (LightCount == c_MaxPointShadows)
+		{
+			LightStore_SetShadowIndex(Lights, Index, -1);
+			continue;
+		}
+
+		u32 i = LightCount++;
+		point_shadow_light& Light = Tracker->Lights[i];
+		Light.LightIndex = Index;
+		LightStore_SetShadowIndex(Lights, Index, (i32)i);
+
+		// New, moved or resized, nothing in the cube can be trusted. Removing a light moves the ones after it to other cubes too
+		v3 Position = LightStore_GetPosition(Lights, Index);
+		if (!Light.Active || Light.Position != Position || Light.Radius != Lights->Radius[Index])
+		{
+			Light.Position = Position;
+			Light.Radius = Lights->Radius[Index];
+			Light.Active = true;
+			Light.DirtyFaces = c_PointShadowAllFaces;
+		}
+	}
+
+	for (u32 i = LightCount; i < c_MaxPointShadows; i++)
+		Tracker->Lights[i].Active = false;
+
+	Tracker->LightCount = LightCount;
+}
+
+internal const shadow_atlas_stats& PointShadows_AssignTiles(point_shadow_tracker* Tracker, shadow_atlas* Atlas, light_store* Lights, light_environment* Environment, const camera& Camera, f32 ViewportHeight)
+{
+	// Owner per light slot
+	ShadowAtlas_BeginFrame(Atlas);
+	for (u32 i = 0; i < Tracker->LightCount; i++)
+	{
+		const point_shadow_light& Light = Tracker->Lights[i];
+		u32 Size = ShadowAtlas_GetSphereTileSize(Atlas, Camera, ViewportHeight, Light.Position, Light.Radius, Atlas->Owners[i].RequestedSize, Tracker->MaxTileSize);
+		ShadowAtlas_Request(Atlas, i, Size, c_PointShadowFaceCount);
+	}
+
+	const shadow_atlas_stats& Stats = ShadowAtlas_EndFrame(Atlas);
+
+	const f32 InvAtlasSize = 1.0f / Atlas->Size;
+	for (u32 i = 0; i < Tracker->LightCount; i++)
+	{
+		point_shadow_light& Light = Tracker->Lights[i];
+		const shadow_atlas_owner& Owner = Atlas->Owners[i];
+
+		// Inactive until there is room, BeginFrame then sees it as a new light
+		if (Owner.TileCount == 0)
+		{
+			Light.Active = false;
+			LightStore_SetShadowIndex(Lights, Light.LightIndex, -1);
+			continue;
+		}
+
+		if (Owner.Changed)
+			Light.DirtyFaces = c_PointShadowAllFaces;
+
+		for (u32 Face = 0; Face < c_PointShadowFaceCount; Face++)
+		{
+			shadow_atlas_rect Rect = ShadowAtlas_GetRect(Atlas, Owner.Tiles[Face]);
+			Environment->PointShadowTiles[i * c_PointShadowFaceCount + Face] = v4(Rect.X * InvAtlasSize, Rect.Y * InvAtlasSize, Rect.Size * InvAtlasSize, (f32)Rect.Size);
+		}
+	}
+
+	return Stats;
+}
+
+internal void PointShadows_SubmitCaster(point_shadow_tracker* Tracker, u64 Key, u64 Revision, const aabb& Bounds)
+{
+	bool InsideLight = false;
+	for (u32 i = 0; i < Tracker->LightCount && !InsideLight; i++)
+		InsideLight = PointShadows_GetFaceMask(Tracker->Lights[i].Position, Tracker->Lights[i].Radius, Bounds) != 0;
+
+	u32 Index = PointShadows_FindCaster(Tracker, Key);
+	if (Index == c_PointShadowNoCaster)
+	{
+		if (!InsideLight)
+			return;
+
+		if (Tracker->CasterCount == Tracker->MaxCasters)
+		{
+			// Untracked casters could change unseen, every cube renders until there is room again
+			if (!Tracker->OverflowReported)
+			{
+				Warn("Point shadow tracker is full, cubes are rendered every frame!");
+				Tracker->OverflowReported = true;
+			}
+
+			for (u32 i = 0; i < Tracker->LightCount; i++)
+				Tracker->Lights[i].DirtyFaces = c_PointShadowAllFaces;
+			return;
+		}
+
+		Index = Tracker->CasterCount++;
+		Tracker->Casters[Index] = { Key, Revision, Bounds, Tracker->Frame };
+		PointShadows_IndexCaster(Tracker, Index);
+		PointShadows_Invalidate(Tracker, Bounds);
+		Tracker->Stats.AddedCasters++;
+		return;
+	}
+
+	// Left every light, EndFrame removes it like a destroyed one
+	if (!InsideLight)
+		return;
+
+	point_shadow_caster& Caster = Tracker->Casters[Index];
+	Caster.Frame = Tracker->Frame;
+
+	if (Caster.Revision != Revision || Caster.Bounds.Min != Bounds.Min || Caster.Bounds.Max != Bounds.Max)
+	{
+		PointShadows_Invalidate(Tracker, Caster.Bounds);
+		PointShadows_Invalidate(Tracker, Bounds);
+		Caster.Revision = Revision;
+		Caster.Bounds = Bounds;
+		Tracker->Stats.MovedCasters++;
+	}
+}
+
+internal const point_shadow_stats& PointShadows_EndFrame(point_shadow_tracker* Tracker)
+{
+	point_shadow_stats& Stats = Tracker->Stats;
+
+	// Swap-remove whatever was not submitted, the index is rebuilt once afterwards
+	for (u32 i = 0; i < Tracker->CasterCount;)
+	{
+		point_shadow_caster& Caster = Tracker->Casters[i];
+		if (Caster.Frame == Tracker->Frame)
+		{
+			i++;
+			continue;
+		}
+
+		PointShadows_Invalidate(Tracker, Caster.Bounds);
+		Caster = Tracker->Casters[--Tracker->CasterCount];
+		Stats.RemovedCasters++;
+	}
+
+	if (Stats.RemovedCasters > 0)
+	{
+		memset(Tracker->CasterIndex, 0xFF, sizeof(u32) * (Tracker->IndexMask + 1));
+		for (u32 i = 0; i < Tracker->CasterCount; i++)
+			PointShadows_IndexCaster(Tracker, i);
+	}
+
+	Stats.Lights = Tracker->LightCount;
+	Stats.TrackedCasters = Tracker->CasterCount;
+	for (u32 i = 0; i < Tracker->LightCount; i++)
+		Stats.DirtyFaces += std::popcount(PointShadows_GetDirtyFaces(Tracker, i));
+
+	return Stats;
+}
@@ -1,10 +1,10 @@
 #include "Light.hlsl"
+#include "ShadowMoments.hlsl"
 
 cbuffer root_constants : register(b0)
 {
     float4x4 c_ViewProjection;
     float4x4 c_ViewMatrix;
-    float4x4 c_LightSpaceMatrix;
 };
 
 struct vertex_shader_input
@@ -21,7 +21,6 @@ struct pixel_shader_input
     float4 Color : COLOR;
     float3 Normal : NORMAL;
     float3 ViewPosition : VIEWPOSITION;
-    float4 PositionInLightSpace : POSITIONINLIGHTSPACE;
 };
 
 pixel_shader_input VSMain(vertex_shader_input In)
@@ -33,52 +32,401 @@ pixel_shader_input VSMain(vertex_shader_input In)
     Out.Color = In.Color;
     Out.Normal = In.Normal;
     Out.ViewPosition = mul(c_ViewMatrix, Out.WorldPosition).xyz;
-    Out.PositionInLightSpace = mul(c_LightSpaceMatrix, float4(Out.WorldPosition)); // SHADOWS
     
     return Out;
 }
 
-// TODO: Reduce the amount of active point lights by calculating which light is visible and which is not
 cbuffer light_environment : register(b1)
 {
     directional_light u_DirectionalLights[4];
-    point_light u_PointLights[64];
-    int u_PointLightCount;
     int u_DirectionalLightCount;
+    float4 u_PointShadowTiles[48]; // c_MaxPointShadowFaces, atlas offset and size in UV, size in texels
+    float4 u_LightClusterScale;    // Pixel to cluster XY, log2 view depth to cluster Z scale and bias
+    float4 u_IrradianceProbeGrid;  // World position of the first probe, 1 / spacing. W is 0 without probes
 };
 
-Texture2D<float> g_ShadowMap : register(t0);
+// Point lights per cluster, LightClusters.h has the layout. [headers, Offset << 10 | Count][light indices]
+StructuredBuffer<uint> g_LightClusters : register(t5);
+
+// Every point light of the light store, dense
+StructuredBuffer<point_light> g_PointLights : register(t6);
+
+// Same as c_LightClusters* in LightClusters.h
+static const uint c_LightClustersX = 16;
+static const uint c_LightClustersY = 9;
+static const uint c_LightClustersZ = 24;
+
+// Same as LightClusters_GetIndex
+uint LightClusterIndex(float2 PixelPosition, float ViewDepth)
+{
+    uint X = min((uint)(PixelPosition.x * u_LightClusterScale.x), c_LightClustersX - 1);
+    uint Y = min((uint)(PixelPosition.y * u_LightClusterScale.y), c_LightClustersY - 1);
+    uint Z = (uint)clamp(floor(log2(ViewDepth) * u_LightClusterScale.z + u_LightClusterScale.w), 0.0, c_LightClustersZ - 1.0);
+    return (Z * c_LightClustersY + Y) * c_LightClustersX + X;
+}
+
+// Matches shadow_cascade_constants
+cbuffer shadow_cascades : register(b2)
+{
+    float4x4 u_CascadeViewProjections[4];
+    float4 u_CascadeSplitFar;
+    float4 u_CascadeDepthBias;
+    float4 u_CascadeTexelSize;
+    float4 u_CascadeDepthRange;
+    uint u_CascadeCount;
+    float u_CascadeDepthStepBias;
+    float u_CascadeUVScale; // Cascades are rendered into the top left corner of the slices
+};
+
+Texture2DArray<float> g_ShadowMap : register(t0);
+Texture2DArray<float4> g_ShadowMoments : register(t1); // Blurred and mipmapped, written only for the moment filters
 SamplerState g_ShadowMapSampler : register(s0);
+SamplerComparisonState g_ShadowMapComparisonSampler : register(s1);
+SamplerState g_ShadowMomentSampler : register(s2);
+
+// Point light shadows, six atlas tiles per shadowed light (point_light::ShadowIndex). Faces follow PointShadows_GetFaceViewProjection
+Texture2D<float> g_ShadowAtlas : register(t2);
+SamplerComparisonState g_PointShadowSampler : register(s3);
 
-float ShadowCalculation(float4 ShadowPos, directional_light Light, float3 Normal)
+static const float c_PointShadowNearPlane = 0.05;
+
+// Matches virtual_shadow_constants, VirtualShadows.h has the details
+cbuffer virtual_shadows : register(b3)
 {
-    float Shadow = 0.0f;
-    
-    // perform perspective divide
-    ShadowPos.xyz /= ShadowPos.w;
-    
-    // transform to [0,1] range
-    ShadowPos = ShadowPos * 0.5 + 0.5;
-    
-    // get depth of current fragment from light's perspective
-    float CurrentDepth = ShadowPos.z;
-    
+    float4x4 u_VirtualShadowLightView;
+    float u_VirtualShadowPageSize; // World units per page of the finest level
+    float u_VirtualShadowLodScale;
+    uint u_VirtualShadowLodBias;
+    uint u_VirtualShadowsEnabled;
+};
+
+// Matches virtual_shadow_gpu_page
+struct virtual_shadow_page
+{
+    uint Tag;
+    uint PhysicalPage;
+    float DepthMin;
+    float DepthScale;
+};
+
+Texture2D<float> g_VirtualShadowPool : register(t3);
+StructuredBuffer<virtual_shadow_page> g_VirtualShadowPages : register(t4);
+
+// Same as c_VirtualShadow* in VirtualShadows.h
+static const uint c_VirtualShadowPageSize = 128;
+static const uint c_VirtualShadowPages = 128;
+static const uint c_VirtualShadowLevels = 6;
+static const uint c_VirtualShadowPoolPages = 32;
+static const uint c_VirtualShadowNoPage = 0xFFFFFFFF;
+
+// Filter permutation, the defines come from shadow_filter_preset
+#define SHADOW_FILTER_HARD 0
+#define SHADOW_FILTER_HARDWARE_PCF 1
+#define SHADOW_FILTER_GRID_PCF 2
+#define SHADOW_FILTER_POISSON 3
+#define SHADOW_FILTER_PCSS 4
+#define SHADOW_FILTER_VSM 5
+#define SHADOW_FILTER_EVSM 6
+
+#ifndef SHADOW_FILTER
+#define SHADOW_FILTER SHADOW_FILTER_HARD
+#endif
+
+#ifndef SHADOW_FILTER_TAPS
+#define SHADOW_FILTER_TAPS 1
+#endif
+
+#ifndef SHADOW_FILTER_RADIUS
+#define SHADOW_FILTER_RADIUS 0.0
+#endif
+
+#ifndef SHADOW_FILTER_LIGHT_SIZE
+#define SHADOW_FILTER_LIGHT_SIZE 0.0
+#endif
+
+#ifndef SHADOW_FILTER_LIGHT_BLEEDING
+#define SHADOW_FILTER_LIGHT_BLEEDING 0.0
+#endif
+
+// Same table as c_ShadowPoissonDisk
+static const float2 c_PoissonDisk[16] =
+{
+    float2(-0.94201624, -0.39906216), float2(0.94558609, -0.76890725), float2(-0.09418410, -0.92938870), float2(0.34495938, 0.29387760),
+    float2(-0.91588581, 0.45771432), float2(-0.81544232, -0.87912464), float2(-0.38277543, 0.27676845), float2(0.97484398, 0.75648379),
+    float2(0.44323325, -0.97511554), float2(0.53742981, -0.47373420), float2(-0.26496911, -0.41893023), float2(0.79197514, 0.19090188),
+    float2(-0.24188840, 0.99706507), float2(-0.81409955, 0.91437590), float2(0.19984126, 0.78641367), float2(0.14383161, -0.14100790)
+};
+
+// First cascade whose split ends behind the given view depth
+uint SelectCascade(float ViewDepth)
+{
+    uint Cascade = 0;
+    for (uint i = 0; i < u_CascadeCount - 1; i++)
+        Cascade += ViewDepth > u_CascadeSplitFar[i] ? 1 : 0;
+
+    return Cascade;
+}
+
+// Lit fraction of the 2x2 texels around UV, compared and then filtered by the sampler
+float SampleShadowPCF(float2 UV, uint Cascade, float Reference)
+{
+    return g_ShadowMap.SampleCmpLevelZero(g_ShadowMapComparisonSampler, float3(UV, Cascade), Reference);
+}
+
+// Per pixel disk rotation, turns banding into noise
+float2x2 PoissonRotation(float2 PixelPosition)
+{
+    float Noise = frac(52.9829189 * frac(dot(PixelPosition, float2(0.06711056, 0.00583715))));
+    float Sin, Cos;
+    sincos(6.2831853 * Noise, Sin, Cos);
+    return float2x2(Cos, -Sin, Sin, Cos);
+}
+
+float SamplePoissonPCF(float2 UV, uint Cascade, float Reference, float2x2 Rotation, float2 Radius)
+{
+    float Lit = 0.0;
+
+    [unroll]
+    for (uint i = 0; i < SHADOW_FILTER_TAPS; i++)
+        Lit += SampleShadowPCF(UV + mul(Rotation, c_PoissonDisk[i]) * Radius, Cascade, Reference);
+
+    return Lit / SHADOW_FILTER_TAPS;
+}
+
+float ShadowCalculation(float3 WorldPosition, float ViewDepth, directional_light Light, float3 Normal, float2 PixelPosition)
+{
+    uint Cascade = SelectCascade(ViewDepth);
+    float4 ShadowPos = mul(u_CascadeViewProjections[Cascade], float4(WorldPosition, 1.0));
+
+    // Orthographic, no perspective divide. NDC y points up, texture v points down
+    float2 UV = (ShadowPos.xy * float2(0.5, -0.5) + 0.5) * u_CascadeUVScale;
+    float CurrentDepth = ShadowPos.z - u_CascadeDepthStepBias; // D16 rounding, the same at every slope
+
+#if SHADOW_FILTER == SHADOW_FILTER_VSM || SHADOW_FILTER == SHADOW_FILTER_EVSM
+    // Mip selection needs derivatives from uniform control flow, before any pixel returns
+    float2 UVDx = ddx(UV);
+    float2 UVDy = ddy(UV);
+#endif
+
+    // Past the last cascade
+    if (ViewDepth > u_CascadeSplitFar[u_CascadeCount - 1])
+        return 0.0;
+
     if (CurrentDepth > 1.0)
         return 0.0;
-    
-    // get closest depth value from light's perspective (using [0,1] range fragPosLight as coords)
-    float ClosestDepth = g_ShadowMap.Sample(g_ShadowMapSampler, ShadowPos.xy);
-    
-    //float Bias = 0.005;
+
+    float Width, Height, Elements;
+    g_ShadowMap.GetDimensions(Width, Height, Elements);
+    float2 Texel = 1.0 / float2(Width, Height);
+
+    // Bias is about a texel of the cascade, grazing angles need more
     float3 LightDir = normalize(-Light.Direction);
-    float Bias = max(0.05 * (1.0 - dot(Normal, LightDir)), 0.005);
-    //float Bias = 0.02;
-    Shadow = CurrentDepth > ClosestDepth ? 1.0 : 0.0;
-    
-    // check whether current frag pos is in shadow
-    //Shadow = CurrentDepth > ClosestDepth ? 1.0 : 0.0;
-    
-    return Shadow;
+    float Bias = u_CascadeDepthBias[Cascade] * (1.0 + 2.0 * (1.0 - saturate(dot(Normal, LightDir))));
+
+#if SHADOW_FILTER == SHADOW_FILTER_HARD
+    float ClosestDepth = g_ShadowMap.Sample(g_ShadowMapSampler, float3(UV, Cascade));
+    return CurrentDepth - Bias > ClosestDepth ? 1.0 : 0.0;
+
+#elif SHADOW_FILTER == SHADOW_FILTER_HARDWARE_PCF
+    // Wider kernels reach further across sloped receivers, the bias grows with the radius
+    return 1.0 - SampleShadowPCF(UV, Cascade, CurrentDepth - Bias * 1.5);
+
+#elif SHADOW_FILTER == SHADOW_FILTER_GRID_PCF
+    const int Half = SHADOW_FILTER_TAPS / 2;
+    float Reference = CurrentDepth - Bias * (1.5 + Half);
+    float Lit = 0.0;
+
+    [unroll]
+    for (int Y = -Half; Y <= Half; Y++)
+    {
+        [unroll]
+        for (int X = -Half; X <= Half; X++)
+            Lit += SampleShadowPCF(UV + float2(X, Y) * Texel, Cascade, Reference);
+    }
+
+    return 1.0 - Lit / (SHADOW_FILTER_TAPS * SHADOW_FILTER_TAPS);
+
+#elif SHADOW_FILTER == SHADOW_FILTER_POISSON
+    float Reference = CurrentDepth - Bias * (1.5 + SHADOW_FILTER_RADIUS);
+    return 1.0 - SamplePoissonPCF(UV, Cascade, Reference, PoissonRotation(PixelPosition), SHADOW_FILTER_RADIUS * Texel);
+
+#elif SHADOW_FILTER == SHADOW_FILTER_PCSS
+    float2x2 Rotation = PoissonRotation(PixelPosition);
+
+    // Blocker search, average depth of whatever is in front of the receiver
+    float SearchReference = CurrentDepth - Bias * (1.5 + SHADOW_FILTER_RADIUS);
+    float BlockerDepth = 0.0;
+    float BlockerCount = 0.0;
+
+    [unroll]
+    for (uint i = 0; i < SHADOW_FILTER_TAPS; i++)
+    {
+        float2 Offset = mul(Rotation, c_PoissonDisk[i]) * SHADOW_FILTER_RADIUS * Texel;
+        float Depth = g_ShadowMap.SampleLevel(g_ShadowMapSampler, float3(UV + Offset, Cascade), 0);
+        if (Depth < SearchReference)
+        {
+            BlockerDepth += Depth;
+            BlockerCount += 1.0;
+        }
+    }
+
+    if (BlockerCount == 0.0)
+        return 0.0;
+
+    // Penumbra grows with the distance to the blocker, in world units and then in texels
+    BlockerDepth /= BlockerCount;
+    float Penumbra = (CurrentDepth - BlockerDepth) * u_CascadeDepthRange[Cascade] * SHADOW_FILTER_LIGHT_SIZE / u_CascadeTexelSize[Cascade];
+    float Radius = clamp(Penumbra, 1.0, SHADOW_FILTER_RADIUS);
+
+    float Reference = CurrentDepth - Bias * (1.5 + Radius);
+    return 1.0 - SamplePoissonPCF(UV, Cascade, Reference, Rotation, Radius * Texel);
+
+#elif SHADOW_FILTER == SHADOW_FILTER_VSM || SHADOW_FILTER == SHADOW_FILTER_EVSM
+    // One trilinear fetch of prefiltered moments, distant receivers read the smaller mips
+    float4 Moments = g_ShadowMoments.SampleGrad(g_ShadowMomentSampler, float3(UV, Cascade), UVDx, UVDy);
+    uint Representation = SHADOW_FILTER == SHADOW_FILTER_EVSM ? SHADOW_MOMENTS_EVSM : SHADOW_MOMENTS_VSM;
+    return 1.0 - ShadowMomentsLit(Moments, CurrentDepth - Bias, Representation, SHADOW_FILTER_LIGHT_BLEEDING);
+#endif
+}
+
+// 1 is in shadow, like ShadowCalculation
+float PointShadowCalculation(point_light Light, float3 WorldPosition, float3 Normal)
+{
+    if (Light.ShadowIndex < 0)
+        return 0.0;
+
+    float3 ToSurface = WorldPosition - Light.Position;
+    float Major = max(abs(ToSurface.x), max(abs(ToSurface.y), abs(ToSurface.z)));
+    if (Major >= Light.Radius)
+        return 0.0;
+
+    // Normal offset of about a texel at that distance, a face covers 2 * Major. All faces of a light have the same size
+    uint FirstTile = Light.ShadowIndex * 6;
+    ToSurface += Normal * (3.0 * Major / u_PointShadowTiles[FirstTile].w);
+
+    // Cube face selection like the hardware, ties go to X then Y
+    float3 Axis = abs(ToSurface);
+    uint Face;
+    float2 FaceCoord;
+    if (Axis.x >= Axis.y && Axis.x >= Axis.z)
+    {
+        Major = Axis.x;
+        Face = ToSurface.x < 0.0 ? 1 : 0;
+        FaceCoord = float2(ToSurface.x < 0.0 ? ToSurface.z : -ToSurface.z, -ToSurface.y);
+    }
+    else if (Axis.y >= Axis.z)
+    {
+        Major = Axis.y;
+        Face = ToSurface.y < 0.0 ? 3 : 2;
+        FaceCoord = float2(ToSurface.x, ToSurface.y < 0.0 ? -ToSurface.z : ToSurface.z);
+    }
+    else
+    {
+        Major = Axis.z;
+        Face = ToSurface.z < 0.0 ? 5 : 4;
+        FaceCoord = float2(ToSurface.z < 0.0 ? -ToSurface.x : ToSurface.x, -ToSurface.y);
+    }
+
+    // Depth the face projection wrote, the major axis is the view depth
+    float Near = c_PointShadowNearPlane;
+    float Far = Light.Radius;
+    float Depth = Far / (Far - Near) * (1.0 - Near / Major);
+
+    // Kept half a texel inside the tile, so the bilinear footprint never reads a neighbor
+    float4 Tile = u_PointShadowTiles[FirstTile + Face];
+    float2 UV = clamp(FaceCoord / Major * 0.5 + 0.5, 0.5 / Tile.w, 1.0 - 0.5 / Tile.w);
+
+    return 1.0 - g_ShadowAtlas.SampleCmpLevelZero(g_PointShadowSampler, Tile.xy + UV * Tile.z, Depth);
+}
+
+// Same as VirtualShadows_GetLevel
+uint VirtualShadowLevel(float ViewDistance)
+{
+    float Texels = max(ViewDistance * u_VirtualShadowLodScale, 1.0);
+    return min(uint(floor(log2(Texels))) + u_VirtualShadowLodBias, c_VirtualShadowLevels - 1);
+}
+
+// 1 when lit by the page of the level, -1 when the page has no depth yet. Bias is in texels of the level
+float SampleVirtualShadow(float3 LightPosition, uint Level, float BiasTexels)
+{
+    float PageSize = u_VirtualShadowPageSize * (1u << Level);
+    int2 Page = int2(floor(LightPosition.xy / PageSize));
+
+    // Same as VirtualShadows_GetTableIndex
+    uint Pages = c_VirtualShadowPages >> Level;
+    uint Offset = (c_VirtualShadowPages * c_VirtualShadowPages - Pages * Pages) * 4 / 3;
+    virtual_shadow_page Entry = g_VirtualShadowPages[Offset + (uint(Page.y) & (Pages - 1)) * Pages + (uint(Page.x) & (Pages - 1))];
+
+    uint Tag = (uint(Page.x) & 0xFFFF) | (uint(Page.y) << 16);
+    if (Entry.Tag != Tag || Entry.PhysicalPage == c_VirtualShadowNoPage)
+        return -1.0;
+
+    // Rows go down while light space Y goes up
+    float2 InPage = LightPosition.xy / PageSize - Page;
+    uint2 Texel = min(uint2(InPage.x * c_VirtualShadowPageSize, (1.0 - InPage.y) * c_VirtualShadowPageSize), c_VirtualShadowPageSize - 1);
+    uint2 Origin = uint2(Entry.PhysicalPage % c_VirtualShadowPoolPages, Entry.PhysicalPage / c_VirtualShadowPoolPages) * c_VirtualShadowPageSize;
+    float ClosestDepth = g_VirtualShadowPool.Load(int3(Origin + Texel, 0));
+
+    float TexelSize = PageSize / c_VirtualShadowPageSize;
+    float Depth = (LightPosition.z - BiasTexels * TexelSize - Entry.DepthMin) * Entry.DepthScale;
+    return Depth <= ClosestDepth ? 1.0 : 0.0;
+}
+
+// 1 is in shadow, like ShadowCalculation. Its own 3x3 PCF at the texel size of the level the pixel asks for,
+// taps whose page has no depth yet fall back to coarser levels
+float VirtualShadowCalculation(float3 WorldPosition, float ViewDistance, directional_light Light, float3 Normal)
+{
+    float3 LightPosition = mul(u_VirtualShadowLightView, float4(WorldPosition, 1.0)).xyz;
+    uint Level = VirtualShadowLevel(ViewDistance);
+    float TexelSize = u_VirtualShadowPageSize * (1u << Level) / c_VirtualShadowPageSize;
+
+    // Same bias as the 3x3 grid PCF of the cascades
+    float3 LightDir = normalize(-Light.Direction);
+    float BiasTexels = 1.5 * (1.0 + 2.0 * (1.0 - saturate(dot(Normal, LightDir)))) * 2.5;
+
+    float Lit = 0.0;
+    for (int Y = -1; Y <= 1; Y++)
+    {
+        for (int X = -1; X <= 1; X++)
+        {
+            float3 Tap = LightPosition + float3(X, Y, 0.0) * TexelSize;
+
+            // Outside of every resident page counts as lit, like past the last cascade
+            float TapLit = 1.0;
+            for (uint L = Level; L < c_VirtualShadowLevels; L++)
+            {
+                float Sample = SampleVirtualShadow(Tap, L, BiasTexels);
+                if (Sample >= 0.0)
+                {
+                    TapLit = Sample;
+                    break;
+                }
+            }
+
+            Lit += TapLit;
+        }
+    }
+
+    return 1.0 - Lit / 9.0;
+}
+
+// CalculatePointLight with the diffuse part shadowed
+float3 CalculatePointLight2(point_light Light, float3 Normal, float3 WorldPosition, float3 TextureColor, float Shadow)
+{
+    float3 ToLight = Light.Position - WorldPosition;
+    float LightDistance = length(ToLight);
+    float DiffuseAngle = max(dot(Normal, ToLight / LightDistance), 0.0);
+
+    float Attenuation = clamp(1.0 - (LightDistance * LightDistance) / (Light.Radius * Light.Radius), 0.0, 1.0);
+    Attenuation *= lerp(Attenuation, 1.0, Light.FallOff);
+
+    // TODO: Materials
+    float3 LightAmbient = float3(0.05, 0.05, 0.05);
+    float3 LightDiffuse = float3(0.8, 0.8, 0.8);
+
+    float3 Ambient = Light.Intensity * LightAmbient * TextureColor;
+    float3 Diffuse = Light.Radiance * Light.Intensity * LightDiffuse * DiffuseAngle * TextureColor;
+    return (Ambient + (1.0 - Shadow) * Diffuse) * Attenuation;
 }
 
 float3 CalculateDirectionalLight2(directional_light Light, float3 Normal, float3 ViewDir, float Shininess, float3 TextureColor, float Shadow)
@@ -110,35 +458,129 @@ float3 CalculateDirectionalLight2(directional_light Light, float3 Normal, float3
     return Result;
 }
 
+// Same as c_VoxelOcclusionFloor in Shadows.h
+static const float c_VoxelOcclusionFloor = 0.5;
+
+// Matches irradiance_probe_gpu. L2 spherical harmonics as half floats, RGB per coefficient, then the weight, 0 inside a block
+struct irradiance_probe
+{
+    uint Packed[14];
+};
+
+// Probe grid from the upload heap, IrradianceProbes.h bakes and updates it
+StructuredBuffer<irradiance_probe> g_IrradianceProbes : register(t7);
+
+// Same as c_IrradianceProbes* in IrradianceProbes.h
+static const uint c_IrradianceProbesX = 32;
+static const uint c_IrradianceProbesY = 16;
+static const uint c_IrradianceProbesZ = 32;
+
+float IrradianceProbeHalf(irradiance_probe Probe, uint Half)
+{
+    return f16tof32(Probe.Packed[Half / 2] >> ((Half % 2) * 16));
+}
+
+// Same as IrradianceProbes_Sample. Trilinear between the 8 probes around the point, probes behind the surface count less
+float3 IrradianceProbeSample(float3 Position, float3 Normal)
+{
+    float3 Last = float3(c_IrradianceProbesX - 1, c_IrradianceProbesY - 1, c_IrradianceProbesZ - 1);
+    float3 Local = (Position + Normal * 0.5 - u_IrradianceProbeGrid.xyz) * u_IrradianceProbeGrid.w;
+    if (any(Local < 0.0) || any(Local > Last))
+        return float3(0, 0, 0);
+
+    uint3 Base = min((uint3)Local, (uint3)Last - 1);
+    float3 Fraction = Local - Base;
+
+    // Real L2 basis, the coefficients are already convolved with the cosine lobe
+    float Basis[9];
+    Basis[0] = 0.282095;
+    Basis[1] = 0.488603 * Normal.y;
+    Basis[2] = 0.488603 * Normal.z;
+    Basis[3] = 0.488603 * Normal.x;
+    Basis[4] = 1.092548 * Normal.x * Normal.y;
+    Basis[5] = 1.092548 * Normal.y * Normal.z;
+    Basis[6] = 0.315392 * (3.0 * Normal.z * Normal.z - 1.0);
+    Basis[7] = 1.092548 * Normal.x * Normal.z;
+    Basis[8] = 0.546274 * (Normal.x * Normal.x - Normal.y * Normal.y);
+
+    float3 Sum = float3(0, 0, 0);
+    float Total = 0.0;
+
+    [unroll]
+    for (uint Corner = 0; Corner < 8; Corner++)
+    {
+        uint3 Offset = uint3(Corner & 1, (Corner >> 1) & 1, (Corner >> 2) & 1);
+        uint3 Coord = Base + Offset;
+        irradiance_probe Probe = g_IrradianceProbes[(Coord.z * c_IrradianceProbesY + Coord.y) * c_IrradianceProbesX + Coord.x];
+
+        float Weight = IrradianceProbeHalf(Probe, 27);
+        if (Weight <= 0.0)
+            continue;
+
+        float3 ToProbe = u_IrradianceProbeGrid.xyz + Coord / u_IrradianceProbeGrid.w - Position;
+        ToProbe *= rsqrt(max(dot(ToProbe, ToProbe), 1e-8));
+        float Wrap = (dot(ToProbe, Normal) + 1.0) * 0.5;
+
+        float3 Trilinear = lerp(1.0 - Fraction, Fraction, (float3)Offset);
+        Weight *= Trilinear.x * Trilinear.y * Trilinear.z * (Wrap * Wrap + 0.2);
+
+        float3 Irradiance = float3(0, 0, 0);
+        [unroll]
+        for (uint i = 0; i < 9; i++)
+            Irradiance += float3(IrradianceProbeHalf(Probe, i * 3), IrradianceProbeHalf(Probe, i * 3 + 1), IrradianceProbeHalf(Probe, i * 3 + 2)) * Basis[i];
+
+        // L2 rings below zero behind bright spots
+        Sum += max(Irradiance, 0.0) * Weight;
+        Total += Weight;
+    }
+
+    return Total > 1e-4 ? Sum / Total : float3(0, 0, 0);
+}
+
 float4 PSMain(pixel_shader_input In) : SV_TARGET
 {
     float3 Normal = normalize(In.Normal);
     float3 ViewDir = normalize(In.ViewPosition - In.WorldPosition.xyz);
     float Shininess = 32.0;
-    float ShadowValue = ShadowCalculation(In.PositionInLightSpace, u_DirectionalLights[0], Normal);
+
+    // Uniform branch, the moment filters still get their derivatives
+    float ShadowValue;
+    if (u_VirtualShadowsEnabled)
+        ShadowValue = VirtualShadowCalculation(In.WorldPosition.xyz, length(In.ViewPosition), u_DirectionalLights[0], Normal);
+    else
+        ShadowValue = ShadowCalculation(In.WorldPosition.xyz, In.ViewPosition.z, u_DirectionalLights[0], Normal, In.Position.xy);
     
     // Phase 1: Directional lights
     float3 Result = float3(0, 0, 0);
     
-     // perform perspective divide
-    float3 projCoords = In.PositionInLightSpace.xyz / In.PositionInLightSpace.w;
-    
-    // transform to [0,1] range
-    projCoords = projCoords * 0.5 + 0.5;
-    
     for (int i = 0; i < u_DirectionalLightCount; i++)
     {
         //Result += CalculateDirectionalLight2(u_DirectionalLights[i], Normal, ViewDir, Shininess, In.Color.rgb, ShadowValue);
     }
     
-    // Phase 2: Point lights
-    for (int j = 0; j < u_PointLightCount; j++)
+    // Phase 2: Point lights of the cluster, added on top of the shadowed base color
+    uint Cluster = g_LightClusters[LightClusterIndex(In.Position.xy, In.ViewPosition.z)];
+    uint ClusterOffset = Cluster >> 10;
+    uint ClusterCount = Cluster & 0x3FF;
+
+    float3 PointLighting = float3(0, 0, 0);
+    for (uint j = 0; j < ClusterCount; j++)
     {
-        //Result += CalculatePointLight(u_PointLights[j], Normal, ViewDir, Shininess, In.WorldPosition.xyz, In.Color.rgb);
+        point_light Light = g_PointLights[g_LightClusters[ClusterOffset + j]];
+        //Result += CalculatePointLight(Light, Normal, ViewDir, Shininess, In.WorldPosition.xyz, In.Color.rgb);
+        float PointShadow = PointShadowCalculation(Light, In.WorldPosition.xyz, Normal);
+        PointLighting += CalculatePointLight2(Light, Normal, In.WorldPosition.xyz, In.Color.rgb, PointShadow);
     }
     
-    Result = float4(In.Color.rgb * (1.0 - ShadowValue), 1.0f);
+    // Shadows fall to the ambient light of the irradiance probes instead of black. Uniform branch
+    float3 Ambient = float3(0, 0, 0);
+    if (u_IrradianceProbeGrid.w > 0.0)
+        Ambient = saturate(IrradianceProbeSample(In.WorldPosition.xyz, Normal));
+
+    Result = In.Color.rgb * lerp(Ambient, 1.0, 1.0 - ShadowValue) + PointLighting;
+
+    // Voxel ambient occlusion from the block mesher, alpha is 1 on everything else
+    Result *= lerp(c_VoxelOcclusionFloor, 1.0, In.Color.a);
     
-    //return float4(projCoords, 1.0);
     return float4(Result, 1.0);
 }
\ No newline at end of file
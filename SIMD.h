@@ -0,0 +1,272 @@
+#pragma once
+
+// 8-wide SIMD
+// Thin wrappers over AVX2 so the CPU side code reads like math instead of intrinsics.
+// Projects are built with /arch:AVX2, the scalar path only exists so the code still builds (slowly) elsewhere.
+
+#if defined(__AVX2__)
+#define SIMD_AVX2 1
+#include <immintrin.h>
+#else
+#define SIMD_AVX2 0
+#include <cmath>
+#endif
+
+inline constexpr u32 c_SimdWidth = 8;
+
+#if SIMD_AVX2
+
+struct f32x8 { __m256 V; };
+struct i32x8 { __m256i V; };
+
+// Float
+inline f32x8 F32x8(f32 Value) { return { _mm256_set1_ps(Value) }; }
+inline f32x8 F32x8(f32 A, f32 B, f32 C, f32 D, f32 E, f32 F, f32 G, f32 H) { return { _mm256_setr_ps(A, B, C, D, E, F, G, H) }; }
+inline f32x8 F32x8Zero() { return { _mm256_setzero_ps() }; }
+inline f32x8 F32x8Load(const f32* Ptr) { return { _mm256_loadu_ps(Ptr) }; }
+inline void F32x8Store(f32* Ptr, f32x8 A) { _mm256_storeu_ps(Ptr, A.V); }
+
+inline f32x8 operator+(f32x8 A, f32x8 B) { return { _mm256_add_ps(A.V, B.V) }; }
+inline f32x8 operator-(f32x8 A, f32x8 B) { return { _mm256_sub_ps(A.V, B.V) }; }
+inline f32x8 operator*(f32x8 A, f32x8 B) { return { _mm256_mul_ps(A.V, B.V) }; }
+inline f32x8 operator/(f32x8 A, f32x8 B) { return { _mm256_div_ps(A.V, B.V) }; }
+inline f32x8 operator-(f32x8 A) { return { _mm256_xor_ps(A.V, _mm256_set1_ps(-0.0f)) }; }
+inline f32x8 operator&(f32x8 A, f32x8 B) { return { _mm256_and_ps(A.V, B.V) }; }
+inline f32x8 operator|(f32x8 A, f32x8 B) { return { _mm256_or_ps(A.V, B.V) }; }
+inline f32x8 operator^(f32x8 A, f32x8 B) { return { _mm256_xor_ps(A.V, B.V) }; }
+
+// Comparisons return lane masks (all bits set or zero)
+inline f32x8 operator<(f32x8 A, f32x8 B) { return { _mm256_cmp_ps(A.V, B.V, _CMP_LT_OQ) }; }
+inline f32x8 operator<=(f32x8 A, f32x8 B) { return { _mm256_cmp_ps(A.V, B.V, _CMP_LE_OQ) }; }
+inline f32x8 operator>(f32x8 A, f32x8 B) { return { _mm256_cmp_ps(A.V, B.V, _CMP_GT_OQ) }; }
+inline f32x8 operator>=(f32x8 A, f32x8 B) { return { _mm256_cmp_ps(A.V, B.V, _CMP_GE_OQ) }; }
+inline f32x8 operator==(f32x8 A, f32x8 B) { return { _mm256_cmp_ps(A.V, B.V, _CMP_EQ_OQ) }; }
+
+inline f32x8 Min(f32x8 A, f32x8 B) { return { _mm256_min_ps(A.V, B.V) }; }
+inline f32x8 Max(f32x8 A, f32x8 B) { return { _mm256_max_ps(A.V, B.V) }; }
+inline f32x8 Abs(f32x8 A) { return { _mm256_andnot_ps(_mm256_set1_ps(-0.0f), A.V) }; }
+inline f32x8 Sqrt(f32x8 A) { return { _mm256_sqrt_ps(A.V) }; }
+inline f32x8 Floor(f32x8 A) { return { _mm256_floor_ps(A.V) }; }
+inline f32x8 MulAdd(f32x8 A, f32x8 B, f32x8 C) { return { _mm256_fmadd_ps(A.V, B.V, C.V) }; } // A * B + C
+inline f32x8 AndNot(f32x8 Mask, f32x8 A) { return { _mm256_andnot_ps(Mask.V, A.V) }; }     // ~Mask & A
+inline f32x8 Select(f32x8 Mask, f32x8 A, f32x8 B) { return { _mm256_blendv_ps(B.V, A.V, Mask.V) }; } // Mask ? A : B
+
+inline u32 MoveMask(f32x8 Mask) { return static_cast<u32>(_mm256_movemask_ps(Mask.V)); }
+inline bool Any(f32x8 Mask) { return MoveMask(Mask) != 0; }
+inline bool All(f32x8 Mask) { return MoveMask(Mask) == 0xFF; }
+
+inline f32 HorizontalMin(f32x8 A)
+{
+	__m128 M = _mm_min_ps(_mm256_castps256_ps128(A.V), _mm256_extractf128_ps(A.V, 1));
+	M = _mm_min_ps(M, _mm_movehl_ps(M, M));
+	M = _mm_min_ss(M, _mm_shuffle_ps(M, M, 1));
+	return _mm_cvtss_f32(M);
+}
+
+inline f32 HorizontalMax(f32x8 A)
+{
+	__m128 M = _mm_max_ps(_mm256_castps256_ps128(A.V), _mm256_extractf128_ps(A.V, 1));
+	M = _mm_max_ps(M, _mm_movehl_ps(M, M));
+	M = _mm_max_ss(M, _mm_shuffle_ps(M, M, 1));
+	return _mm_cvtss_f32(M);
+}
+
+inline f32 HorizontalAdd(f32x8 A)
+{
+	__m128 S = _mm_add_ps(_mm256_castps256_ps128(A.V), _mm256_extractf128_ps(A.V, 1));
+	S = _mm_add_ps(S, _mm_movehl_ps(S, S));
+	S = _mm_add_ss(S, _mm_shuffle_ps(S, S, 1));
+	return _mm_cvtss_f32(S);
+}
+
+// Integer
+inline i32x8 I32x8(i32 Value) { return { _mm256_set1_epi32(Value) }; }
+inline i32x8 I32x8(i32 A, i32 B, i32 C, i32 D, i32 E, i32 F, i32 G, i32 H) { return { _mm256_setr_epi32(A, B, C, D, E, F, G, H) }; }
+inline i32x8 I32x8Load(const i32* Ptr) { return { _mm256_loadu_si256((const __m256i*)Ptr) }; }
+inline void I32x8Store(i32* Ptr, i32x8 A) { _mm256_storeu_si256((__m256i*)Ptr, A.V); }
+
+inline i32x8 operator+(i32x8 A, i32x8 B) { return { _mm256_add_epi32(A.V, B.V) }; }
+inline i32x8 operator-(i32x8 A, i32x8 B) { return { _mm256_sub_epi32(A.V, B.V) }; }
+inline i32x8 operator*(i32x8 A, i32x8 B) { return { _mm256_mullo_epi32(A.V, B.V) }; }
+inline i32x8 operator&(i32x8 A, i32x8 B) { return { _mm256_and_si256(A.V, B.V) }; }
+inline i32x8 operator|(i32x8 A, i32x8 B) { return { _mm256_or_si256(A.V, B.V) }; }
+inline i32x8 operator^(i32x8 A, i32x8 B) { return { _mm256_xor_si256(A.V, B.V) }; }
+inline i32x8 operator<<(i32x8 A, i32 Shift) { return { _mm256_slli_epi32(A.V, Shift) }; }
+inline i32x8 operator>>(i32x8 A, i32 Shift) { return { _mm256_srai_epi32(A.V, Shift) }; }
+inline i32x8 ShiftRightLogical(i32x8 A, i32 Shift) { return { _mm256_srli_epi32(A.V, Shift) }; }
+inline i32x8 operator==(i32x8 A, i32x8 B) { return { _mm256_cmpeq_epi32(A.V, B.V) }; }
+inline i32x8 operator>(i32x8 A, i32x8 B) { return { _mm256_cmpgt_epi32(A.V, B.V) }; }
+inline i32x8 Min(i32x8 A, i32x8 B) { return { _mm256_min_epi32(A.V, B.V) }; }
+inline i32x8 Max(i32x8 A, i32x8 B) { return { _mm256_max_epi32(A.V, B.V) }; }
+
+// Conversions and reinterpretation
+inline i32x8 ConvertToI32(f32x8 A) { return { _mm256_cvttps_epi32(A.V) }; } // Truncates
+inline f32x8 ConvertToF32(i32x8 A) { return { _mm256_cvtepi32_ps(A.V) }; }
+inline i32x8 AsI32(f32x8 A) { return { _mm256_castps_si256(A.V) }; }
+inline f32x8 AsF32(i32x8 A) { return { _mm256_castsi256_ps(A.V) }; }
+
+inline f32x8 Gather(const f32* Base, i32x8 Indices) { return { _mm256_i32gather_ps(Base, Indices.V, 4) }; }
+inline i32x8 Gather(const i32* Base, i32x8 Indices) { return { _mm256_i32gather_epi32(Base, Indices.V, 4) }; }
+
+#else
+
+struct f32x8 { f32 V[8]; };
+struct i32x8 { i32 V[8]; };
+
+#define SIMD_LANES(__expr) for (u32 i = 0; i < 8; i++) { __expr; }
+
+inline f32 SimdMaskF32(bool Value) { u32 Bits = Value ? 0xFFFFFFFFu : 0u; f32 Result; memcpy(&Result, &Bits, 4); return Result; }
+inline u32 SimdBitsF32(f32 Value) { u32 Bits; memcpy(&Bits, &Value, 4); return Bits; }
+inline f32 SimdF32Bits(u32 Bits) { f32 Value; memcpy(&Value, &Bits, 4); return Value; }
+
+inline f32x8 F32x8(f32 Value) { f32x8 R; SIMD_LANES(R.V[i] = Value); return R; }
+inline f32x8 F32x8(f32 A, f32 B, f32 C, f32 D, f32 E, f32 F, f32 G, f32 H) { return { { A, B, C, D, E, F, G, H } }; }
+inline f32x8 F32x8Zero() { return F32x8(0.0f); }
+inline f32x8 F32x8Load(const f32* Ptr) { f32x8 R; SIMD_LANES(R.V[i] = Ptr[i]); return R; }
+inline void F32x8Store(f32* Ptr, f32x8 A) { SIMD_LANES(Ptr[i] = A.V[i]); }
+
+inline f32x8 operator+(f32x8 A, f32x8 B) { SIMD_LANES(A.V[i] += B.V[i]); return A; }
+inline f32x8 operator-(f32x8 A, f32x8 B) { SIMD_LANES(A.V[i] -= B.V[i]); return A; }
+inline f32x8 operator*(f32x8 A, f32x8 B) { SIMD_LANES(A.V[i] *= B.V[i]); return A; }
+inline f32x8 operator/(f32x8 A, f32x8 B) { SIMD_LANES(A.V[i] /= B.V[i]); return A; }
+inline f32x8 operator-(f32x8 A) { SIMD_LANES(A.V[i] = -A.V[i]); return A; }
+inline f32x8 operator&(f32x8 A, f32x8 B) { SIMD_LANES(A.V[i] = SimdF32Bits(SimdBitsF32(A.V[i]) & SimdBitsF32(B.V[i]))); return A; }
+inline f32x8 operator|(f32x8 A, f32x8 B) { SIMD_LANES(A.V[i] = SimdF32Bits(SimdBitsF32(A.V[i]) | SimdBitsF32(B.V[i]))); return A; }
+inline f32x8 operator^(f32x8 A, f32x8 B) { SIMD_LANES(A.V[i] = SimdF32Bits(SimdBitsF32(A.V[i]) ^ SimdBitsF32(B.V[i]))); return A; }
+
+inline f32x8 operator<(f32x8 A, f32x8 B) { SIMD_LANES(A.V[i] = SimdMaskF32(A.V[i] < B.V[i])); return A; }
+inline f32x8 operator<=(f32x8 A, f32x8 B) { SIMD_LANES(A.V[i] = SimdMaskF32(A.V[i] <= B.V[i])); return A; }
+inline f32x8 operator>(f32x8 A, f32x8 B) { SIMD_LANES(A.V[i] = SimdMaskF32(A.V[i] > B.V[i])); return A; }
+inline f32x8 operator>=(f32x8 A, f32x8 B) { SIMD_LANES(A.V[i] = SimdMaskF32(A.V[i] >= B.V[i])); return A; }
+inline f32x8 operator==(f32x8 A, f32x8 B) { SIMD_LANES(A.V[i] = SimdMaskF32(A.V[i] == B.V[i])); return A; }
+
+inline f32x8 Min(f32x8 A, f32x8 B) { SIMD_LANES(A.V[i] = A.V[i] < B.V[i] ? A.V[i] : B.V[i]); return A; }
+inline f32x8 Max(f32x8 A, f32x8 B) { SIMD_LANES(A.V[i] = A.V[i] > B.V[i] ? A.V[i] : B.V[i]); return A; }
+inline f32x8 Abs(f32x8 A) { SIMD_LANES(A.V[i] = std::fabs(A.V[i])); return A; }
+inline f32x8 Sqrt(f32x8 A) { SIMD_LANES(A.V[i] = std::sqrt(A.V[i])); return A; }
+inline f32x8 Floor(f32x8 A) { SIMD_LANES(A.V[i] = std::floor(A.V[i])); return A; }
+inline f32x8 MulAdd(f32x8 A, f32x8 B, f32x8 C) { SIMD_LANES(A.V[i] = A.V[i] * B.V[i] + C.V[i]); return A; }
+inline f32x8 AndNot(f32x8 Mask, f32x8 A) { SIMD_LANES(A.V[i] = SimdF32Bits(~SimdBitsF32(Mask.V[i]) & SimdBitsF32(A.V[i]))); return A; }
+inline f32x8 Select(f32x8 Mask, f32x8 A, f32x8 B) { SIMD_LANES(A.V[i] = (SimdBitsF32(Mask.V[i]) >> 31) ? A.V[i] : B.V[i]); return A; }
+
+inline u32 MoveMask(f32x8 Mask) { u32 R = 0; SIMD_LANES(R |= (SimdBitsF32(Mask.V[i]) >> 31) << i); return R; }
+inline bool Any(f32x8 Mask) { return MoveMask(Mask) != 0; }
+inline bool All(f32x8 Mask) { return MoveMask(Mask) == 0xFF; }
+
+inline f32 HorizontalMin(f32x8 A) { f32 R = A.V[0]; SIMD_LANES(R = A.V[i] < R ? A.V[i] : R); return R; }
+inline f32 HorizontalMax(f32x8 A) { f32 R = A.V[0]; SIMD_LANES(R = A.V[i] > R ? A.V[i] : R); return R; }
+inline f32 HorizontalAdd(f32x8 A) { f32 R = 0.0f; SIMD_LANES(R += A.V[i]); return R; }
+
+inline i32x8 I32x8(i32 Value) { i32x8 R; SIMD_LANES(R.V[i] = Value); return R; }
+inline i32x8 I32x8(i32 A, i32 B, i32 C, i32 D, i32 E, i32 F, i32 G, i32 H) { return { { A, B, C, D, E, F, G, H } }; }
+inline i32x8 I32x8Load(const i32* Ptr) { i32x8 R; SIMD_LANES(R.V[i] = Ptr[i]); return R; }
+inline void I32x8Store(i32* Ptr, i32x8 A) { SIMD_LANES(Ptr[i] = A.V[i]); }
+
+inline i32x8 operator+(i32x8 A, i32x8 B) { SIMD_LANES(A.V[i] += B.V[i]); return A; }
+inline i32x8 operator-(i32x8 A, i32x8 B) { SIMD_LANES(A.V[i] -= B.V[i]); return A; }
+inline i32x8 operator*(i32x8 A, i32x8 B) { SIMD_LANES(A.V[i] = (i32)((u32)A.V[i] * (u32)B.V[i])); return A; }
+inline i32x8 operator&(i32x8 A, i32x8 B) { SIMD_LANES(A.V[i] &= B.V[i]); return A; }
+inline i32x8 operator|(i32x8 A, i32x8 B) { SIMD_LANES(A.V[i] |= B.V[i]); return A; }
+inline i32x8 operator^(i32x8 A, i32x8 B) { SIMD_LANES(A.V[i] ^= B.V[i]); return A; }
+inline i32x8 operator<<(i32x8 A, i32 Shift) { SIMD_LANES(A.V[i] = (i32)((u32)A.V[i] << Shift)); return A; }
+inline i32x8 operator>>(i32x8 A, i32 Shift) { SIMD_LANES(A.V[i] >>= Shift); return A; }
+inline i32x8 ShiftRightLogical(i32x8 A, i32 Shift) { SIMD_LANES(A.V[i] = (i32)((u32)A.V[i] >> Shift)); return A; }
+inline i32x8 operator==(i32x8 A, i32x8 B) { SIMD_LANES(A.V[i] = A.V[i] == B.V[i] ? -1 : 0); return A; }
+inline i32x8 operator>(i32x8 A, i32x8 B) { SIMD_LANES(A.V[i] = A.V[i] > B.V[i] ? -1 : 0); return A; }
+inline i32x8 Min(i32x8 A, i32x8 B) { SIMD_LANES(A.V[i] = A.V[i] < B.V[i] ? A.V[i] : B.V[i]); return A; }
+inline i32x8 Max(i32x8 A, i32x8 B) { SIMD_LANES(A.V[i] = A.V[i] > B.V[i] ? A.V[i] : B.V[i]); return A; }
+
+inline i32x8 ConvertToI32(f32x8 A) { i32x8 R; SIMD_LANES(R.V[i] = (i32)A.V[i]); return R; }
+inline f32x8 ConvertToF32(i32x8 A) { f32x8 R; SIMD_LANES(R.V[i] = (f32)A.V[i]); return R; }
+inline i32x8 AsI32(f32x8 A) { i32x8 R; memcpy(&R, &A, sizeof(R)); return R; }
+inline f32x8 AsF32(i32x8 A) { f32x8 R; memcpy(&R, &A, sizeof(R)); return R; }
+
+inline f32x8 Gather(const f32* Base, i32x8 Indices) { f32x8 R; SIMD_LANES(R.V[i] = Base[Indices.V[i]]); return R; }
+inline i32x8 Gather(const i32* Base, i32x8 Indices) { i32x8 R; SIMD_LANES(R.V[i] = Base[Indices.V[i]]); return R; }
+
+#undef SIMD_LANES
+
+#endif
+
+inline f32x8& operator+=(f32x8& A, f32x8 B) { A = A + B; return A; }
+inline f32x8& operator-=(f32x8& A, f32x8 B) { A = A - B; return A; }
+inline f32x8& operator*=(f32x8& A, f32x8 B) { A = A * B; return A; }
+inline i32x8& operator+=(i32x8& A, i32x8 B) { A = A + B; return A; }
+
+inline f32x8 Clamp(f32x8 A, f32x8 Low, f32x8 High) { return Min(Max(A, Low), High); }
+inline f32x8 Lerp(f32x8 A, f32x8 B, f32x8 T) { return MulAdd(B - A, T, A); }
+
+// Folded to [-pi/2, pi/2] and a Taylor polynomial up to x^11, off by less than 1e-6 there. Meant for animation, not for precision
+inline f32x8 Sin(f32x8 X)
+{
+	const f32 Pi = 3.14159265f;
+	X = MulAdd(Floor(MulAdd(X, F32x8(0.5f / Pi), F32x8(0.5f))), F32x8(-2.0f * Pi), X);
+	X = Select(X > F32x8(0.5f * Pi), F32x8(Pi) - X, X);
+	X = Select(X < F32x8(-0.5f * Pi), F32x8(-Pi) - X, X);
+
+	f32x8 X2 = X * X;
+	f32x8 P = F32x8(-1.0f / 39916800.0f);
+	P = MulAdd(P, X2, F32x8(1.0f / 362880.0f));
+	P = MulAdd(P, X2, F32x8(-1.0f / 5040.0f));
+	P = MulAdd(P, X2, F32x8(1.0f / 120.0f));
+	P = MulAdd(P, X2, F32x8(-1.0f / 6.0f));
+	P = MulAdd(P, X2, F32x8(1.0f));
+	return P * X;
+}
+
+inline f32x8 Cos(f32x8 X) { return Sin(X + F32x8(0.5f * 3.14159265f)); }
+
+// Lane index 0..7, handy for pixel spans
+inline f32x8 F32x8LaneIndex() { return F32x8(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f); }
+inline i32x8 I32x8LaneIndex() { return I32x8(0, 1, 2, 3, 4, 5, 6, 7); }
+
+// 8 vectors in SoA form
+struct v3x8
+{
+	f32x8 X, Y, Z;
+};
+
+inline v3x8 V3x8(v3 V) { return { F32x8(V.x), F32x8(V.y), F32x8(V.z) }; }
+inline v3x8 operator+(const v3x8& A, const v3x8& B) { return { A.X + B.X, A.Y + B.Y, A.Z + B.Z }; }
+inline v3x8 operator-(const v3x8& A, const v3x8& B) { return { A.X - B.X, A.Y - B.Y, A.Z - B.Z }; }
+inline v3x8 operator*(const v3x8& A, f32x8 S) { return { A.X * S, A.Y * S, A.Z * S }; }
+inline f32x8 Dot(const v3x8& A, const v3x8& B) { return MulAdd(A.X, B.X, MulAdd(A.Y, B.Y, A.Z * B.Z)); }
+inline v3x8 Cross(const v3x8& A, const v3x8& B) { return { A.Y * B.Z - A.Z * B.Y, A.Z * B.X - A.X * B.Z, A.X * B.Y - A.Y * B.X }; }
+
+// Column-major like glm, M[Column][Row]
+inline void TransformPoints(const m4& M, const v3x8& P, f32x8* OutX, f32x8* OutY, f32x8* OutZ, f32x8* OutW)
+{
+	*OutX = MulAdd(F32x8(M[0][0]), P.X, MulAdd(F32x8(M[1][0]), P.Y, MulAdd(F32x8(M[2][0]), P.Z, F32x8(M[3][0]))));
+	*OutY = MulAdd(F32x8(M[0][1]), P.X, MulAdd(F32x8(M[1][1]), P.Y, MulAdd(F32x8(M[2][1]), P.Z, F32x8(M[3][1]))));
+	*OutZ = MulAdd(F32x8(M[0][2]), P.X, MulAdd(F32x8(M[1][2]), P.Y, MulAdd(F32x8(M[2][2]), P.Z, F32x8(M[3][2]))));
+	*OutW = MulAdd(F32x8(M[0][3]), P.X, MulAdd(F32x8(M[1][3]), P.Y, MulAdd(F32x8(M[2][3]), P.Z, F32x8(M[3][3]))));
+}
+
+// 4x4 matrix product A * B, two result columns per 256-bit register
+inline m4 MultiplyM4(const m4& A, const m4& B)
+{
+#if SIMD_AVX2
+	__m256 A0 = _mm256_broadcast_ps((const __m128*)&A[0][0]);
+	__m256 A1 = _mm256_broadcast_ps((const __m128*)&A[1][0]);
+	__m256 A2 = _mm256_broadcast_ps((const __m128*)&A[2][0]);
+	__m256 A3 = _mm256_broadcast_ps((const __m128*)&A[3][0]);
+
+	m4 Result;
+	for (u32 Column = 0; Column < 4; Column += 2)
+	{
+		const f32* B0 = &B[Column][0];
+		const f32* B1 = &B[Column + 1][0];
+
+		__m256 R = _mm256_mul_ps(A0, _mm256_setr_ps(B0[0], B0[0], B0[0], B0[0], B1[0], B1[0], B1[0], B1[0]));
+		R = _mm256_fmadd_ps(A1, _mm256_setr_ps(B0[1], B0[1], B0[1], B0[1], B1[1], B1[1], B1[1], B1[1]), R);
+		R = _mm256_fmadd_ps(A2, _mm256_setr_ps(B0[2], B0[2], B0[2], B0[2], B1[2], B1[2], B1[2], B1[2]), R);
+		R = _mm256_fmadd_ps(A3, _mm256_setr_ps(B0[3], B0[3], B0[3], B0[3], B1[3], B1[3], B1[3], B1[3]), R);
+
+		_mm256_storeu_ps(&Result[Column][0], R);
+	}
+
+	return Result;
+#else
+	return A * B;
+#endif
+}
@@ -1,4 +1,10 @@
 #include "Light.hlsl"
+#include "ShadowMoments.hlsl"
+
+// Moment representation for PSMoments
+#ifndef SHADOW_MOMENTS
+#define SHADOW_MOMENTS SHADOW_MOMENTS_VSM
+#endif
 
 cbuffer root_constants : register(b0)
 {
@@ -24,4 +30,10 @@ pixel_shader_input VSMain(vertex_shader_input In)
     Out.Position = mul(c_LightSpaceMatrix, In.VertexPosition);
 
     return Out;
+}
+
+// Only for moment shadow maps, depth pass has no pixel shader
+float4 PSMoments(pixel_shader_input In) : SV_TARGET
+{
+    return MomentsFromDepth(In.Position.z, SHADOW_MOMENTS);
 }
\ No newline at end of file
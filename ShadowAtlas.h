@@ -0,0 +1,442 @@
+#pragma once
+
+// Shadow atlas
+// One big depth texture shared by many shadow maps. Tiles are power of two squares handed out by a buddy allocator:
+// the atlas is the root of a quadtree and every node is free, split into four children or used. Allocating takes a free node
+// of the wanted level or splits the smallest bigger one, freeing merges four free siblings back into their parent.
+// Free nodes of a level are kept in a list, so both are a handful of steps no matter how many tiles are out.
+//
+// Owners (a shadowed light) request a tile size and a tile count every frame between BeginFrame and EndFrame.
+// An owner keeps its tiles for as long as it requests the same size, so cached shadow maps in them stay valid.
+// A different request frees the old tiles, then EndFrame allocates every owner without tiles, biggest requests first.
+// When the atlas is full a request falls back to smaller sizes down to the minimum tile, or gets nothing.
+// A fallback is kept until the request changes, so a full atlas does not reallocate every frame.
+
+inline constexpr u32 c_ShadowAtlasSize = 4096; // Point shadow faces share one depth atlas
+inline constexpr u32 c_ShadowAtlasMinTile = 64;
+inline constexpr u32 c_ShadowAtlasMaxTile = 1024;
+inline constexpr u32 c_ShadowAtlasNoTile = 0xFFFFFFFF;
+inline constexpr u32 c_ShadowAtlasMaxLevels = 8;       // Root to minimum tile, 4096 down to 32
+inline constexpr u32 c_ShadowAtlasMaxOwners = 64;
+inline constexpr u32 c_ShadowAtlasMaxOwnerTiles = 6;   // Cube faces
+inline constexpr f32 c_ShadowAtlasSizeHysteresis = 1.6f; // Projected size has to move this far past the current size to change it
+
+enum class shadow_atlas_node : u8
+{
+	Covered = 0, // Inside a free or used ancestor
+	Free,
+	Split,
+	Used
+};
+
+struct shadow_atlas_rect
+{
+	u32 X;
+	u32 Y;
+	u32 Size;
+};
+
+struct shadow_atlas_owner
+{
+	u32 RequestedSize;  // What it asked for, the tiles can be smaller when the atlas was full
+	u32 RequestedTiles;
+	u32 TileSize;
+	u32 TileCount;      // 0 when it has no tiles
+	u32 Tiles[c_ShadowAtlasMaxOwnerTiles];
+	u32 Frame;          // Last frame it requested in
+	b32 Changed;        // Got new tiles this frame, whatever was rendered into the old ones is gone
+};
+
+struct shadow_atlas_stats
+{
+	u32 Owners;          // With tiles
+	u32 Tiles;
+	u32 TilesPerLevel[c_ShadowAtlasMaxLevels];
+	u32 Reallocated;     // Owners that got new tiles this frame
+	u32 Downgraded;      // Owners with smaller tiles than they requested
+	u32 Failed;          // Owners that requested and have nothing
+	u32 LargestFreeTile;
+	f32 Occupancy;       // Used texels over all texels
+	f32 Fragmentation;   // 1 - largest free tile over the largest one the free texels could make, 0 when nothing is left to merge
+};
+
+struct shadow_atlas
+{
+	u32 Size;
+	u32 MinTileSize;
+	u32 LevelCount; // Level 0 is the whole atlas, every level halves the tile size
+	u32 LevelOffsets[c_ShadowAtlasMaxLevels + 1]; // Nodes of level L are [LevelOffsets[L], LevelOffsets[L + 1]), row-major
+
+	shadow_atlas_node* Nodes;
+	u32* FreeNext; // Free list per level, doubly linked through the nodes
+	u32* FreePrev;
+	u32 FreeHeads[c_ShadowAtlasMaxLevels];
+	u32 FreeCounts[c_ShadowAtlasMaxLevels];
+	u32 UsedCounts[c_ShadowAtlasMaxLevels];
+
+	shadow_atlas_owner Owners[c_ShadowAtlasMaxOwners];
+	u32 Frame;
+	shadow_atlas_stats Stats;
+};
+
+// Size and MinTileSize are powers of two
+internal void ShadowAtlas_Initialize(shadow_atlas* Atlas, u32 Size, u32 MinTileSize);
+internal void ShadowAtlas_Destroy(shadow_atlas* Atlas);
+
+// Single tiles, c_ShadowAtlasNoTile when nothing of that size is left
+internal u32 ShadowAtlas_Allocate(shadow_atlas* Atlas, u32 TileSize);
+internal void ShadowAtlas_Free(shadow_atlas* Atlas, u32 Tile);
+internal shadow_atlas_rect ShadowAtlas_GetRect(const shadow_atlas* Atlas, u32 Tile);
+
+// Owners
+internal void ShadowAtlas_BeginFrame(shadow_atlas* Atlas);
+internal void ShadowAtlas_Request(shadow_atlas* Atlas, u32 Owner, u32 TileSize, u32 TileCount);
+
+// Frees the tiles of owners that did not request, allocates the new requests
+internal const shadow_atlas_stats& ShadowAtlas_EndFrame(shadow_atlas* Atlas);
+
+// Tile size for a sphere of shadow casters, about half of its diameter on screen since a cube face covers 90 degrees.
+// Spheres outside of the view get the minimum. CurrentSize is what it has now (0 for nothing) and only changes past the hysteresis.
+internal u32 ShadowAtlas_GetSphereTileSize(const shadow_atlas* Atlas, const camera& Camera, f32 ViewportHeight, v3 Center, f32 Radius, u32 CurrentSize, u32 MaxTileSize);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+internal void ShadowAtlas_Initialize(shadow_atlas* Atlas, u32 Size, u32 MinTileSize)
+{
+	Assert(std::has_single_bit(Size) && std::has_single_bit(MinTileSize) && MinTileSize <= Size, "Shadow atlas sizes have to be powers of two!");
+
+	Atlas->Size = Size;
+	Atlas->MinTileSize = MinTileSize;
+	Atlas->LevelCount = std::countr_zero(Size / MinTileSize) + 1;
+	Assert(Atlas->LevelCount <= c_ShadowAtlasMaxLevels, "Too many shadow atlas levels!");
+
+	u32 NodeCount = 0;
+	for (u32 Level = 0; Level < Atlas->LevelCount; Level++)
+	{
+		Atlas->LevelOffsets[Level] = NodeCount;
+		NodeCount += 1u << (Level * 2);
+	}
+	Atlas->LevelOffsets[Atlas->LevelCount] = NodeCount;
+
+	Atlas->Nodes = VmAllocArray(shadow_atlas_node, NodeCount);
+	Atlas->FreeNext = VmAllocArray(u32, NodeCount);
+	Atlas->FreePrev = VmAllocArray(u32, NodeCount);
+
+	for (u32 Level = 0; Level < c_ShadowAtlasMaxLevels; Level++)
+		Atlas->FreeHeads[Level] = c_ShadowAtlasNoTile;
+
+	// Root is the only free node
+	Atlas->Nodes[0] = shadow_atlas_node::Free;
+	Atlas->FreeNext[0] = Atlas->FreePrev[0] = c_ShadowAtlasNoTile;
+	Atlas->FreeHeads[0] = 0;
+	Atlas->FreeCounts[0] = 1;
+}
+
+internal void ShadowAtlas_Destroy(shadow_atlas* Atlas)
+{
+	VmFree(Atlas->Nodes);
+	VmFree(Atlas->FreeNext);
+	VmFree(Atlas->FreePrev);
+	*Atlas = {};
+}
+
+internal u32 ShadowAtlas_GetLevel(const shadow_atlas* Atlas, u32 Node)
+{
+	u32 Level = 0;
+	while (Node >= Atlas->LevelOffsets[Level + 1])
+		Level++;
+
+	return Level;
+}
+
+internal void ShadowAtlas_PushFree(shadow_atlas* Atlas, u32 Level, u32 Node)
+{
+	u32 Head = Atlas->FreeHeads[Level];
+	Atlas->Nodes[Node] = shadow_atlas_node::Free;
+	Atlas->FreeNext[Node] = Head;
+	Atlas->FreePrev[Node] = c_ShadowAtlasNoTile;
+	if (Head != c_ShadowAtlasNoTile)
+		Atlas->FreePrev[Head] = Node;
+
+	Atlas->FreeHeads[Level] = Node;
+	Atlas->FreeCounts[Level]++;
+}
+
+internal void ShadowAtlas_RemoveFree(shadow_atlas* Atlas, u32 Level, u32 Node)
+{
+	u32 Next = Atlas->FreeNext[Node];
+	u32 Prev = Atlas->FreePrev[Node];
+	if (Prev != c_ShadowAtlasNoTile)
+		Atlas->FreeNext[Prev] = Next;
+	else
+		Atlas->FreeHeads[Level] = Next;
+
+	if (Next != c_ShadowAtlasNoTile)
+		Atlas->FreePrev[Next] = Prev;
+
+	Atlas->FreeCounts[Level]--;
+}
+
+// Children of a node are (2X + i, 2Y + j) one level down
+internal u32 ShadowAtlas_GetChild(const shadow_atlas* Atlas, u32 Level, u32 Node, u32 Child)
+{
+	u32 Side = 1u << Level;
+	u32 Local = Node - Atlas->LevelOffsets[Level];
+	u32 X = (Local % Side) * 2 + (Child & 1);
+	u32 Y = (Local / Side) * 2 + (Child >> 1);
+	return Atlas->LevelOffsets[Level + 1] + Y * Side * 2 + X;
+}
+
+internal u32 ShadowAtlas_GetParent(const shadow_atlas* Atlas, u32 Level, u32 Node)
+{
+	u32 Side = 1u << Level;
+	u32 Local = Node - Atlas->LevelOffsets[Level];
+	u32 X = (Local % Side) / 2;
+	u32 Y = (Local / Side) / 2;
+	return Atlas->LevelOffsets[Level - 1] + Y * (Side / 2) + X;
+}
+
+// Free node of the level, splits the closest bigger one when there is none
+internal u32 ShadowAtlas_TakeFree(shadow_atlas* Atlas, u32 Level)
+{
+	u32 Node = Atlas->FreeHeads[Level];
+	if (Node != c_ShadowAtlasNoTile)
+	{
+		ShadowAtlas_RemoveFree(Atlas, Level, Node);
+		return Node;
+	}
+
+	if (Level == 0)
+		return c_ShadowAtlasNoTile;
+
+	u32 Parent = ShadowAtlas_TakeFree(Atlas, Level - 1);
+	if (Parent == c_ShadowAtlasNoTile)
+		return c_ShadowAtlasNoTile;
+
+	// First child is returned, the other three wait in the free list
+	Atlas->Nodes[Parent] = shadow_atlas_node::Split;
+	for (u32 Child = 3; Child > 0; Child--)
+		ShadowAtlas_PushFree(Atlas, Level, ShadowAtlas_GetChild(Atlas, Level - 1, Parent, Child));
+
+	return ShadowAtlas_GetChild(Atlas, Level - 1, Parent, 0);
+}
+
+internal u32 ShadowAtlas_Allocate(shadow_atlas* Atlas, u32 TileSize)
+{
+	Assert(std::has_single_bit(TileSize) && TileSize >= Atlas->MinTileSize && TileSize <= Atlas->Size, "Invalid shadow atlas tile size!");
+
+	u32 Level = std::countr_zero(Atlas->Size / TileSize);
+	u32 Tile = ShadowAtlas_TakeFree(Atlas, Level);
+	if (Tile != c_ShadowAtlasNoTile)
+	{
+		Atlas->Nodes[Tile] = shadow_atlas_node::Used;
+		Atlas->UsedCounts[Level]++;
+	}
+
+	return Tile;
+}
+
+internal void ShadowAtlas_Free(shadow_atlas* Atlas, u32 Tile)
+{
+	Assert(Atlas->Nodes[Tile] == shadow_atlas_node::Used, "Freeing a shadow atlas tile that is not used!");
+
+	u32 Level = ShadowAtlas_GetLevel(Atlas, Tile);
+	Atlas->UsedCounts[Level]--;
+	ShadowAtlas_PushFree(Atlas, Level, Tile);
+
+	// Merge while all four siblings are free
+	while (Level > 0)
+	{
+		u32 Parent = ShadowAtlas_GetParent(Atlas, Level, Tile);
+
+		bool AllFree = true;
+		for (u32 Child = 0; Child < 4 && AllFree; Child++)
+			AllFree = Atlas->Nodes[ShadowAtlas_GetChild(Atlas, Level - 1, Parent, Child)] == shadow_atlas_node::Free;
+
+		if (!AllFree)
+			break;
+
+		for (u32 Child = 0; Child < 4; Child++)
+		{
+			u32 Sibling = ShadowAtlas_GetChild(Atlas, Level - 1, Parent, Child);
+			ShadowAtlas_RemoveFree(Atlas, Level, Sibling);
+			Atlas->Nodes[Sibling] = shadow_atlas_node::Covered;
+		}
+
+		Level--;
+		Tile = Parent;
+		ShadowAtlas_PushFree(Atlas, Level, Tile);
+	}
+}
+
+internal shadow_atlas_rect ShadowAtlas_GetRect(const shadow_atlas* Atlas, u32 Tile)
+{
+	u32 Level = ShadowAtlas_GetLevel(Atlas, Tile);
+	u32 Side = 1u << Level;
+	u32 Local = Tile - Atlas->LevelOffsets[Level];
+	u32 Size = Atlas->Size >> Level;
+	return { (Local % Side) * Size, (Local / Side) * Size, Size };
+}
+
+internal void ShadowAtlas_BeginFrame(shadow_atlas* Atlas)
+{
+	Atlas->Frame++;
+}
+
+internal void ShadowAtlas_ReleaseOwner(shadow_atlas* Atlas, shadow_atlas_owner& Owner)
+{
+	for (u32 i = 0; i < Owner.TileCount; i++)
+		ShadowAtlas_Free(Atlas, Owner.Tiles[i]);
+
+	Owner.TileCount = 0;
+	Owner.TileSize = 0;
+}
+
+internal void ShadowAtlas_Request(shadow_atlas* Atlas, u32 OwnerIndex, u32 TileSize, u32 TileCount)
+{
+	Assert(OwnerIndex < c_ShadowAtlasMaxOwners, "Invalid shadow atlas owner!");
+	Assert(TileCount > 0 && TileCount <= c_ShadowAtlasMaxOwnerTiles, "Invalid shadow atlas tile count!");
+
+	shadow_atlas_owner& Owner = Atlas->Owners[OwnerIndex];
+	Owner.Frame = Atlas->Frame;
+
+	TileSize = glm::clamp(TileSize, Atlas->MinTileSize, Atlas->Size);
+	if (Owner.RequestedSize != TileSize || Owner.RequestedTiles != TileCount)
+	{
+		ShadowAtlas_ReleaseOwner(Atlas, Owner);
+		Owner.RequestedSize = TileSize;
+		Owner.RequestedTiles = TileCount;
+	}
+}
+
+internal const shadow_atlas_stats& ShadowAtlas_EndFrame(shadow_atlas* Atlas)
+{
+	shadow_atlas_stats& Stats = Atlas->Stats;
+	Stats = {};
+
+	// Everything is released before anything is allocated, so the new requests see all the space there is
+	u32 Pending[c_ShadowAtlasMaxOwners];
+	u32 PendingCount = 0;
+	for (u32 i = 0; i < c_ShadowAtlasMaxOwners; i++)
+	{
+		shadow_atlas_owner& Owner = Atlas->Owners[i];
+		Owner.Changed = false;
+
+		if (Owner.Frame != Atlas->Frame)
+		{
+			ShadowAtlas_ReleaseOwner(Atlas, Owner);
+			Owner.RequestedSize = 0;
+			Owner.RequestedTiles = 0;
+			continue;
+		}
+
+		if (Owner.TileCount == 0)
+			Pending[PendingCount++] = i;
+	}
+
+	// Biggest first, smaller tiles fill the holes around them. Insertion sort keeps equal sizes in owner order
+	for (u32 i = 1; i < PendingCount; i++)
+	{
+		u32 Index = Pending[i];
+		u32 j = i;
+		for (; j > 0 && Atlas->Owners[Pending[j - 1]].RequestedSize < Atlas->Owners[Index].RequestedSize; j--)
+			Pending[j] = Pending[j - 1];
+		Pending[j] = Index;
+	}
+
+	for (u32 i = 0; i < PendingCount; i++)
+	{
+		shadow_atlas_owner& Owner = Atlas->Owners[Pending[i]];
+
+		for (u32 Size = Owner.RequestedSize; Size >= Atlas->MinTileSize && Owner.TileCount == 0; Size /= 2)
+		{
+			for (; Owner.TileCount < Owner.RequestedTiles; Owner.TileCount++)
+			{
+				u32 Tile = ShadowAtlas_Allocate(Atlas, Size);
+				if (Tile == c_ShadowAtlasNoTile)
+					break;
+
+				Owner.Tiles[Owner.TileCount] = Tile;
+			}
+
+			// All or nothing, a light with some of its faces is no use
+			if (Owner.TileCount < Owner.RequestedTiles)
+				ShadowAtlas_ReleaseOwner(Atlas, Owner);
+			else
+				Owner.TileSize = Size;
+		}
+
+		Owner.Changed = Owner.TileCount > 0;
+		Stats.Reallocated += Owner.Changed;
+	}
+
+	for (u32 i = 0; i < c_ShadowAtlasMaxOwners; i++)
+	{
+		const shadow_atlas_owner& Owner = Atlas->Owners[i];
+		if (Owner.Frame != Atlas->Frame)
+			continue;
+
+		if (Owner.TileCount == 0)
+		{
+			Stats.Failed++;
+			continue;
+		}
+
+		Stats.Owners++;
+		Stats.Downgraded += Owner.TileSize < Owner.RequestedSize;
+	}
+
+	u64 UsedTexels = 0, FreeTexels = 0;
+	for (u32 Level = 0; Level < Atlas->LevelCount; Level++)
+	{
+		u64 TileTexels = (u64)(Atlas->Size >> Level) * (Atlas->Size >> Level);
+		UsedTexels += Atlas->UsedCounts[Level] * TileTexels;
+		FreeTexels += Atlas->FreeCounts[Level] * TileTexels;
+
+		Stats.Tiles += Atlas->UsedCounts[Level];
+		Stats.TilesPerLevel[Level] = Atlas->UsedCounts[Level];
+		if (Stats.LargestFreeTile == 0 && Atlas->FreeCounts[Level] > 0)
+			Stats.LargestFreeTile = Atlas->Size >> Level;
+	}
+
+	Stats.Occupancy = (f32)((f64)UsedTexels / ((f64)Atlas->Size * Atlas->Size));
+	// Power of two squares only, so the best case for the free texels is the biggest square that fits their count
+	u64 IdealFreeTile = std::bit_floor((u64)glm::sqrt((f64)FreeTexels));
+	Stats.Fragmentation = IdealFreeTile > 0 ? 1.0f - (f32)((f64)Stats.LargestFreeTile * Stats.LargestFreeTile / ((f64)IdealFreeTile * IdealFreeTile)) : 0.0f;
+	return Stats;
+}
+
+internal u32 ShadowAtlas_GetSphereTileSize(const shadow_atlas* Atlas, const camera& Camera, f32 ViewportHeight, v3 Center, f32 Radius, u32 CurrentSize, u32 MaxTileSize)
+{
+	v3 ViewCenter = v3(Camera.View * v4(Center, 1.0f));
+	f32 Distance = glm::length(ViewCenter);
+
+	// Inside of it the light can fill the screen
+	f32 Ideal = (f32)MaxTileSize;
+	if (Distance > Radius)
+	{
+		// Outside of the view frustum nothing close to the camera receives its shadows
+		f32 TanY = glm::tan(Camera.PerspectiveFOV * 0.5f);
+		f32 TanX = TanY * Camera.AspectRatio;
+		bool Outside = ViewCenter.z < -Radius
+			|| (glm::abs(ViewCenter.x) - ViewCenter.z * TanX) > Radius * glm::sqrt(1.0f + TanX * TanX)
+			|| (glm::abs(ViewCenter.y) - ViewCenter.z * TanY) > Radius * glm::sqrt(1.0f + TanY * TanY);
+
+		Ideal = Outside ? 0.0f : 0.5f * Camera.GetProjectedSize(2.0f * Radius, Distance, ViewportHeight);
+	}
+
+	Ideal = glm::clamp(Ideal, (f32)Atlas->MinTileSize, (f32)MaxTileSize);
+	if (CurrentSize != 0 && Ideal <= CurrentSize * c_ShadowAtlasSizeHysteresis && Ideal >= CurrentSize / c_ShadowAtlasSizeHysteresis)
+		return glm::clamp(CurrentSize, Atlas->MinTileSize, MaxTileSize);
+
+	// Closest power of two in log2
+	u32 Size = std::bit_floor((u32)Ideal);
+	if (Ideal > Size * glm::sqrt(2.0f))
+		Size *= 2;
+
+	return glm::clamp(Size, Atlas->MinTileSize, MaxTileSize);
+}
@@ -0,0 +1,58 @@
+// Moment shadow map filtering, separable blur and mip reduction over every cascade slice
+// ShadowMoments.h does the same on the CPU
+
+#ifndef SHADOW_BLUR_TAPS
+#define SHADOW_BLUR_TAPS 5
+#endif
+
+cbuffer root_constants : register(b0)
+{
+    int2 c_Step;        // (1, 0) horizontal, (0, 1) vertical
+    uint c_Size;        // Of the destination mip
+    uint c_SliceCount;
+};
+
+Texture2DArray<float4> g_Source : register(t0);
+RWTexture2DArray<float4> g_Destination : register(u0);
+
+// ShadowMoments_GetBlurWeights, binomial coefficients
+[numthreads(8, 8, 1)]
+void BlurCS(uint3 ThreadID : SV_DispatchThreadID)
+{
+    if (ThreadID.x >= c_Size || ThreadID.y >= c_Size || ThreadID.z >= c_SliceCount)
+        return;
+
+    const int Half = SHADOW_BLUR_TAPS / 2;
+
+    float4 Sum = 0.0;
+    float WeightSum = 0.0;
+    float Coefficient = 1.0;
+
+    [unroll]
+    for (int i = 0; i < SHADOW_BLUR_TAPS; i++)
+    {
+        // Edges clamp to the border texel
+        int2 Texel = clamp(int2(ThreadID.xy) + c_Step * (i - Half), 0, int(c_Size) - 1);
+        Sum += g_Source.Load(int4(Texel, ThreadID.z, 0)) * Coefficient;
+        WeightSum += Coefficient;
+        Coefficient = Coefficient * float(SHADOW_BLUR_TAPS - 1 - i) / float(i + 1);
+    }
+
+    g_Destination[ThreadID] = Sum / WeightSum;
+}
+
+// 2x2 box, g_Source is a view of the mip above
+[numthreads(8, 8, 1)]
+void DownsampleCS(uint3 ThreadID : SV_DispatchThreadID)
+{
+    if (ThreadID.x >= c_Size || ThreadID.y >= c_Size || ThreadID.z >= c_SliceCount)
+        return;
+
+    int2 Texel = int2(ThreadID.xy) * 2;
+    float4 Sum = g_Source.Load(int4(Texel, ThreadID.z, 0))
+               + g_Source.Load(int4(Texel + int2(1, 0), ThreadID.z, 0))
+               + g_Source.Load(int4(Texel + int2(0, 1), ThreadID.z, 0))
+               + g_Source.Load(int4(Texel + int2(1, 1), ThreadID.z, 0));
+
+    g_Destination[ThreadID] = Sum * 0.25;
+}
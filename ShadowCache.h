@@ -0,0 +1,232 @@
+#pragma once
+
+// Static shadow caster cache for the cascades
+// Most of the world does not move, so static casters are rendered once into a cache slice per cascade. Every frame the slice is copied
+// into its cascade and only the dynamic casters are drawn on top, the shadow pass costs about as much as the things that move.
+//
+// Cascades follow the camera, so a slice is bigger than its cascade by a border of texels on every side. It has the same light view
+// and the same texel grid, copying is a whole texel offset plus a linear remap from the slice depth range to the cascade one.
+// A slice is rendered again when:
+// - the light direction or the texel size of its cascade changes
+// - its cascade box no longer fits inside, the slice is then centered on the cascade again
+// - the static casters inside change, a signature over their (Key, Revision) pairs finds added, removed and changed ones
+//
+// Static casters are culled against the slice box and not against receivers, so what a slice holds does not depend on the view.
+// Keys and revisions are the ones the point shadow tracker gets, see D3D12PushShadowCaster.
+//
+// Nothing here knows about a graphics API. Backends render the slices in the mask ShadowCache_EndFrame returns, then copy.
+
+inline constexpr u32 c_ShadowCacheBorder = 256; // Texels around a cascade in its static cache slice
+
+struct shadow_cache_slice
+{
+	m4 ViewProjection;     // Static casters are rendered with it
+	aabb LightSpaceBounds; // Ortho box in light view space, the cascade box plus the border
+	f32 TexelSize;
+	u64 Signature;         // Sum of mixed (Key, Revision) pairs, does not depend on the order casters come in
+	u32 CasterCount;
+	b32 Valid;             // Holds depth rendered with ViewProjection and the casters behind Signature
+
+	// Collected this frame
+	u64 PendingSignature;
+	u32 PendingCount;
+	b32 Recentered;
+};
+
+// Cascade texel (X, Y) reads slice texel (X + OffsetX, Y + OffsetY), depth = saturate(Slice depth * DepthScale + DepthOffset).
+// Casters in front of the cascade depth range are clamped to 0 rather than clipped, they cast onto everything.
+struct shadow_cache_copy
+{
+	i32 OffsetX;
+	i32 OffsetY;
+	f32 DepthScale;
+	f32 DepthOffset;
+};
+
+// Summed over frames, the caller resets them
+struct shadow_cache_stats
+{
+	u32 Copied;         // Slices that were only copied
+	u32 Recentered;     // Rendered because light, texel size or cascade box moved
+	u32 CastersChanged; // Rendered because static casters inside changed
+};
+
+struct shadow_cache
+{
+	m4 LightView;
+	u32 Resolution; // Of the cascades
+	u32 Border;     // Texels on every side
+	u32 Size;       // Resolution + 2 * Border
+	u32 Count;
+	shadow_cache_slice Slices[c_MaxShadowCascades];
+	shadow_cache_stats Stats;
+};
+
+internal void ShadowCache_Initialize(shadow_cache* Cache, u32 Resolution, u32 Border);
+
+// Everything gets rendered again, for when the cache was not kept up to date
+internal void ShadowCache_Invalidate(shadow_cache* Cache);
+
+// After Cascades_Fit, centers the slices their cascades left on them again
+internal void ShadowCache_BeginFrame(shadow_cache* Cache, const shadow_cascades* Cascades);
+
+// Bit per slice the static caster is inside of, its depth belongs to those slices and not to the cascade draw lists
+internal u32 ShadowCache_AddStaticCaster(shadow_cache* Cache, u64 Key, u64 Revision, const aabb& WorldBounds);
+
+// Bit per slice that has to be rendered this frame, they count as valid from here on
+internal u32 ShadowCache_EndFrame(shadow_cache* Cache);
+
+internal shadow_cache_copy ShadowCache_GetCopy(const shadow_cache* Cache, const shadow_cascades* Cascades, u32 Cascade);
+
+// CPU version of the copy pass followed by the depth test of the dynamic casters, Depth already holds the dynamic casters
+internal void ShadowCache_Composite(const shadow_cache* Cache, const shadow_cache_copy& Copy, const f32* Slice, f32* Depth);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+// SplitMix64 finalizer
+inline u64 ShadowCache_Mix(u64 Value)
+{
+	Value = (Value ^ (Value >> 30)) * 0xBF58476D1CE4E5B9ull;
+	Value = (Value ^ (Value >> 27)) * 0x94D049BB133111EBull;
+	return Value ^ (Value >> 31);
+}
+
+internal void ShadowCache_Initialize(shadow_cache* Cache, u32 Resolution, u32 Border)
+{
+	*Cache = {};
+	Cache->Resolution = Resolution;
+	Cache->Border = Border;
+	Cache->Size = Resolution + 2 * Border;
+}
+
+internal void ShadowCache_Invalidate(shadow_cache* Cache)
+{
+	for (u32 i = 0; i < c_MaxShadowCascades; i++)
+		Cache->Slices[i].Valid = false;
+}
+
+internal void ShadowCache_BeginFrame(shadow_cache* Cache, const shadow_cascades* Cascades)
+{
+	if (Cache->LightView != Cascades->LightView)
+		ShadowCache_Invalidate(Cache);
+
+	Cache->LightView = Cascades->LightView;
+	Cache->Count = Cascades->Count;
+
+	for (u32 i = 0; i < Cascades->Count; i++)
+	{
+		const shadow_cascade& Cascade = Cascades->Cascades[i];
+		shadow_cache_slice& Slice = Cache->Slices[i];
+
+		Slice.PendingSignature = 0;
+		Slice.PendingCount = 0;
+		Slice.Recentered = false;
+
+		const aabb& Bounds = Cascade.LightSpaceBounds;
+		const aabb& SliceBounds = Slice.LightSpaceBounds;
+		bool Inside = glm::all(glm::greaterThanEqual(Bounds.Min, SliceBounds.Min)) && glm::all(glm::lessThanEqual(Bounds.Max, SliceBounds.Max));
+
+		if (Slice.Valid && Slice.TexelSize == Cascade.TexelSize && Inside)
+			continue;
+
+		// Depth gets the same border in world units, small changes of the split depth range stay inside too
+		f32 Border = Cache->Border * Cascade.TexelSize;
+		v3 Min = Bounds.Min - v3(Border);
+		v3 Max = Bounds.Max + v3(Border);
+
+		Slice.ViewProjection = glm::orthoLH_ZO(Min.x, Max.x, Min.y, Max.y, Min.z, Max.z) * Cascades->LightView;
+		Slice.LightSpaceBounds = { Min, Max };
+		Slice.TexelSize = Cascade.TexelSize;
+		Slice.Valid = false;
+		Slice.Recentered = true;
+	}
+}
+
+internal u32 ShadowCache_AddStaticCaster(shadow_cache* Cache, u64 Key, u64 Revision, const aabb& WorldBounds)
+{
+	aabb Bounds = AABB_Transform(WorldBounds, Cache->LightView);
+	u64 Hash = ShadowCache_Mix(Key ^ ShadowCache_Mix(Revision));
+
+	u32 Mask = 0;
+	for (u32 i = 0; i < Cache->Count; i++)
+	{
+		shadow_cache_slice& Slice = Cache->Slices[i];
+		if (!Cascades_Overlaps(Bounds, Slice.LightSpaceBounds))
+			continue;
+
+		Slice.PendingSignature += Hash;
+		Slice.PendingCount++;
+		Mask |= 1u << i;
+	}
+
+	return Mask;
+}
+
+internal u32 ShadowCache_EndFrame(shadow_cache* Cache)
+{
+	u32 Mask = 0;
+	for (u32 i = 0; i < Cache->Count; i++)
+	{
+		shadow_cache_slice& Slice = Cache->Slices[i];
+
+		if (Slice.Valid && Slice.Signature == Slice.PendingSignature && Slice.CasterCount == Slice.PendingCount)
+		{
+			Cache->Stats.Copied++;
+			continue;
+		}
+
+		if (Slice.Recentered || !Slice.Valid)
+			Cache->Stats.Recentered++;
+		else
+			Cache->Stats.CastersChanged++;
+
+		Slice.Signature = Slice.PendingSignature;
+		Slice.CasterCount = Slice.PendingCount;
+		Slice.Valid = true;
+		Mask |= 1u << i;
+	}
+
+	return Mask;
+}
+
+internal shadow_cache_copy ShadowCache_GetCopy(const shadow_cache* Cache, const shadow_cascades* Cascades, u32 Cascade)
+{
+	const aabb& Bounds = Cascades->Cascades[Cascade].LightSpaceBounds;
+	const shadow_cache_slice& Slice = Cache->Slices[Cascade];
+	const aabb& SliceBounds = Slice.LightSpaceBounds;
+
+	// Rows go down while light space Y goes up
+	shadow_cache_copy Copy;
+	Copy.OffsetX = (i32)glm::round((Bounds.Min.x - SliceBounds.Min.x) / Slice.TexelSize);
+	Copy.OffsetY = (i32)glm::round((SliceBounds.Max.y - Bounds.Max.y) / Slice.TexelSize);
+
+	f32 Range = Bounds.Max.z - Bounds.Min.z;
+	Copy.DepthScale = (SliceBounds.Max.z - SliceBounds.Min.z) / Range;
+	Copy.DepthOffset = (SliceBounds.Min.z - Bounds.Min.z) / Range;
+	return Copy;
+}
+
+internal void ShadowCache_Composite(const shadow_cache* Cache, const shadow_cache_copy& Copy, const f32* Slice, f32* Depth)
+{
+	const i32 Resolution = (i32)Cache->Resolution;
+	Assert(Resolution % c_SimdWidth == 0, "Cascade resolution has to be a multiple of the SIMD width!");
+
+	f32x8 Scale = F32x8(Copy.DepthScale);
+	f32x8 Offset = F32x8(Copy.DepthOffset);
+
+	for (i32 Y = 0; Y < Resolution; Y++)
+	{
+		const f32* Source = Slice + (u64)(Y + Copy.OffsetY) * Cache->Size + Copy.OffsetX;
+		f32* Destination = Depth + (u64)Y * Resolution;
+
+		for (i32 X = 0; X < Resolution; X += c_SimdWidth)
+		{
+			f32x8 Static = Clamp(MulAdd(F32x8Load(Source + X), Scale, Offset), F32x8Zero(), F32x8(1.0f));
+			F32x8Store(Destination + X, Min(F32x8Load(Destination + X), Static));
+		}
+	}
+}
@@ -0,0 +1,26 @@
+// Copies a static shadow cache slice into a cascade, ShadowCache.h decides the offset and the depth remap
+// Depth test is ALWAYS, the copy replaces the clear. Dynamic casters are drawn on top by Shadow.hlsl.
+
+cbuffer root_constants : register(b0)
+{
+    int2 c_Offset;       // Slice texel = cascade texel + offset
+    float c_DepthScale;  // Slice depth range to the cascade one
+    float c_DepthOffset;
+    uint c_Slice;
+};
+
+Texture2DArray<float> g_StaticCache : register(t0);
+
+// Full screen triangle, no vertex buffer
+float4 VSMain(uint VertexID : SV_VertexID) : SV_POSITION
+{
+    float2 UV = float2((VertexID << 1) & 2, VertexID & 2);
+    return float4(UV * float2(2.0, -2.0) + float2(-1.0, 1.0), 0.0, 1.0);
+}
+
+// Casters in front of the cascade range are clamped rather than clipped, like ShadowCache_Composite
+float PSMain(float4 Position : SV_POSITION) : SV_DEPTH
+{
+    float Depth = g_StaticCache.Load(int4(int2(Position.xy) + c_Offset, c_Slice, 0));
+    return saturate(Depth * c_DepthScale + c_DepthOffset);
+}
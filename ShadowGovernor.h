@@ -0,0 +1,230 @@
+#pragma once
+
+// Shadow quality governor
+// Picks a shadow quality level from measured GPU frame and shadow pass times so the frame stays within a budget. Levels go from
+// the best quality to the cheapest and each step gives up a little: point shadow resolution, cascade resolution, filter taps, shadow distance or a cascade.
+//
+// Samples are smoothed with an exponential average. The level drops after DownFrames frames in a row over the budget and rises
+// after UpFrames frames in a row under Headroom times the budget. After a change nothing happens for CooldownFrames while the
+// timings catch up. The level above is not taken again while it was last measured over the budget, unless the frame stayed
+// under for four times as long, so the governor does not bounce between two levels.
+// When a frame is over the budget but the shadow passes are less than MinShadowShare of it, cheaper shadows would not bring it
+// back and the level stays where it is.
+//
+// Update only looks at the samples it is given, so a recorded trace replays to the same decisions, see Headless_ReplayGovernorTrace.
+
+struct shadow_quality
+{
+	u32 CascadeCount;
+	f32 MaxDistance;
+	u32 ShadowFilter; // Index into c_ShadowFilterPresets
+	u32 PointTileSize; // Largest atlas tile of a point shadow face
+	u32 CascadeResolution; // Texels per cascade side, rendered into a corner of the SHADOW_MAP_SIZE slices
+};
+
+inline constexpr shadow_quality c_ShadowQualityLevels[] =
+{
+	{ 4, 160.0f, 7, 1024, 1024 }, // PCF 5x5
+	{ 4, 160.0f, 5, 1024, 1024 }, // PCF 3x3
+	{ 4, 160.0f, 5, 512,  1024 },
+	{ 4, 160.0f, 5, 512,  768 },
+	{ 4, 120.0f, 5, 512,  768 },
+	{ 3, 120.0f, 5, 512,  768 },
+	{ 3, 120.0f, 1, 256,  512 },  // PCF 2x2
+	{ 3, 80.0f,  1, 256,  512 },
+	{ 2, 80.0f,  1, 128,  512 },
+	{ 2, 60.0f,  0, 128,  384 },  // Hard
+};
+
+inline constexpr u32 c_ShadowQualityLevelCount = CountOf(c_ShadowQualityLevels);
+inline constexpr f32 c_DefaultShadowBudget = 8.0f; // GPU milliseconds of the whole frame
+
+enum class shadow_governor_decision : u32
+{
+	Hold,
+	Lower,
+	Raise,
+	Cooldown,
+	NotShadowBound, // Over the budget, but not because of the shadows
+};
+
+struct shadow_timing_sample
+{
+	f32 FrameMilliseconds;
+	f32 ShadowMilliseconds; // Every shadow pass of the frame
+};
+
+struct shadow_governor_settings
+{
+	f32 BudgetMilliseconds;
+	f32 Headroom;       // Rises only below Headroom * BudgetMilliseconds
+	f32 Smoothing;      // Weight of a new sample in the average
+	u32 DownFrames;
+	u32 UpFrames;
+	u32 CooldownFrames;
+	f32 MinShadowShare;
+};
+
+struct shadow_governor_stats
+{
+	u32 Level;
+	shadow_governor_decision Decision; // Of the last update
+	f32 FrameMilliseconds;             // Averages
+	f32 ShadowMilliseconds;
+	u32 Frames;
+	u32 FramesOverBudget; // Samples, not the average
+	u32 Lowered;
+	u32 Raised;
+};
+
+struct shadow_governor
+{
+	shadow_governor_settings Settings;
+	u32 Level;
+
+	f32 FrameAverage;
+	f32 ShadowAverage;
+	b32 HasAverage; // Restarted on every change, the old level's timings say nothing about the new one
+
+	u32 OverFrames;
+	u32 UnderFrames;
+	u32 Cooldown;
+
+	f32 LevelMilliseconds[c_ShadowQualityLevelCount]; // Average frame time when the level was last left, 0 before that
+
+	shadow_governor_stats Stats;
+};
+
+internal shadow_governor_settings ShadowGovernor_GetDefaultSettings(f32 BudgetMilliseconds);
+internal void ShadowGovernor_Initialize(shadow_governor* Governor, const shadow_governor_settings& Settings);
+
+// One sample per frame, returns what was decided. The new level applies to the next frame
+internal shadow_governor_decision ShadowGovernor_Update(shadow_governor* Governor, const shadow_timing_sample& Sample);
+
+inline const shadow_quality& ShadowGovernor_GetQuality(const shadow_governor* Governor) { return c_ShadowQualityLevels[Governor->Level]; }
+internal const char* ShadowGovernor_GetDecisionName(shadow_governor_decision Decision);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+internal shadow_governor_settings ShadowGovernor_GetDefaultSettings(f32 BudgetMilliseconds)
+{
+	shadow_governor_settings Settings = {};
+	Settings.BudgetMilliseconds = BudgetMilliseconds;
+	Settings.Headroom = 0.8f;
+	Settings.Smoothing = 0.1f;
+	Settings.DownFrames = 10;
+	Settings.UpFrames = 60;
+	Settings.CooldownFrames = 15;
+	Settings.MinShadowShare = 0.1f;
+	return Settings;
+}
+
+internal void ShadowGovernor_Initialize(shadow_governor* Governor, const shadow_governor_settings& Settings)
+{
+	*Governor = {};
+	Governor->Settings = Settings;
+}
+
+internal shadow_governor_decision ShadowGovernor_Update(shadow_governor* Governor, const shadow_timing_sample& Sample)
+{
+	const shadow_governor_settings& Settings = Governor->Settings;
+	shadow_governor_stats& Stats = Governor->Stats;
+
+	if (Governor->HasAverage)
+	{
+		Governor->FrameAverage += (Sample.FrameMilliseconds - Governor->FrameAverage) * Settings.Smoothing;
+		Governor->ShadowAverage += (Sample.ShadowMilliseconds - Governor->ShadowAverage) * Settings.Smoothing;
+	}
+	else
+	{
+		Governor->FrameAverage = Sample.FrameMilliseconds;
+		Governor->ShadowAverage = Sample.ShadowMilliseconds;
+		Governor->HasAverage = true;
+	}
+
+	Stats.Frames++;
+	Stats.FramesOverBudget += Sample.FrameMilliseconds > Settings.BudgetMilliseconds;
+
+	shadow_governor_decision Decision = shadow_governor_decision::Hold;
+	if (Governor->Cooldown > 0)
+	{
+		Governor->Cooldown--;
+		Decision = shadow_governor_decision::Cooldown;
+	}
+	else if (Governor->FrameAverage > Settings.BudgetMilliseconds)
+	{
+		Governor->UnderFrames = 0;
+
+		if (Governor->ShadowAverage < Settings.MinShadowShare * Governor->FrameAverage)
+		{
+			Governor->OverFrames = 0;
+			Decision = shadow_governor_decision::NotShadowBound;
+		}
+		else if (++Governor->OverFrames >= Settings.DownFrames && Governor->Level + 1 < c_ShadowQualityLevelCount)
+		{
+			Decision = shadow_governor_decision::Lower;
+		}
+	}
+	else if (Governor->FrameAverage < Settings.Headroom * Settings.BudgetMilliseconds)
+	{
+		Governor->OverFrames = 0;
+
+		// The level above was too slow the last time, it gets another try only after a long time under
+		if (++Governor->UnderFrames >= Settings.UpFrames && Governor->Level > 0)
+		{
+			f32 Above = Governor->LevelMilliseconds[Governor->Level - 1];
+			if (Above <= Settings.BudgetMilliseconds || Governor->UnderFrames >= 4 * Settings.UpFrames)
+				Decision = shadow_governor_decision::Raise;
+		}
+	}
+	else
+	{
+		Governor->OverFrames = 0;
+		Governor->UnderFrames = 0;
+	}
+
+	if (Decision == shadow_governor_decision::Lower || Decision == shadow_governor_decision::Raise)
+	{
+		Governor->LevelMilliseconds[Governor->Level] = Governor->FrameAverage;
+
+		if (Decision == shadow_governor_decision::Lower)
+		{
+			Governor->Level++;
+			Stats.Lowered++;
+		}
+		else
+		{
+			Governor->Level--;
+			Stats.Raised++;
+		}
+
+		Governor->OverFrames = 0;
+		Governor->UnderFrames = 0;
+		Governor->Cooldown = Settings.CooldownFrames;
+		Governor->HasAverage = false;
+	}
+
+	Stats.Level = Governor->Level;
+	Stats.Decision = Decision;
+	Stats.FrameMilliseconds = Governor->FrameAverage;
+	Stats.ShadowMilliseconds = Governor->ShadowAverage;
+	return Decision;
+}
+
+internal const char* ShadowGovernor_GetDecisionName(shadow_governor_decision Decision)
+{
+	switch (Decision)
+	{
+		case shadow_governor_decision::Hold: return "hold";
+		case shadow_governor_decision::Lower: return "lower";
+		case shadow_governor_decision::Raise: return "raise";
+		case shadow_governor_decision::Cooldown: return "cooldown";
+		case shadow_governor_decision::NotShadowBound: return "not shadow bound";
+	}
+
+	return "unknown";
+}
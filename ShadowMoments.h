@@ -0,0 +1,356 @@
+#pragma once
+
+// Moment shadow maps on the CPU
+// Reference for the VSM/EVSM path of the shadow pass: depth slices are turned into moments like Shadow.hlsl PSMoments does,
+// blurred with the separable binomial kernel of ShadowBlur.hlsl and reduced into mips with its 2x2 box filter.
+// Unlike depth, moments can be filtered before they are used, so a receiver needs one trilinear fetch instead of many comparisons.
+//
+// Channels are stored as planes, a mip of a channel holds every slice one after another. Both blur directions and the mips
+// then work on plain rows of floats, 8 texels at once.
+
+#include "SIMD.h"
+
+// Same as ShadowMoments.hlsl
+inline constexpr u32 c_MaxShadowMomentMips = 12;
+inline constexpr u32 c_MaxShadowMomentBlurTaps = 9;
+inline constexpr f32 c_EVSMPositiveExponent = 40.0f; // e^(2 * 40) still fits a 32-bit float
+inline constexpr f32 c_EVSMNegativeExponent = 5.0f;
+inline constexpr f32 c_ShadowMomentMinVariance = 0.00001f; // Depth units squared, VSM
+inline constexpr f32 c_EVSMMinVarianceScale = 0.0001f;      // Of the warped depth slope, EVSM
+
+struct shadow_moment_stats
+{
+	f32 ConvertMilliseconds;
+	f32 BlurMilliseconds;
+	f32 MipMilliseconds;
+	f32 TotalMilliseconds;
+};
+
+struct shadow_moment_map
+{
+	i32 Size; // Square, multiple of the SIMD width
+	u32 SliceCount;
+	u32 MipCount;
+
+	// What the slices were last built with
+	shadow_filter Filter;
+	u32 BlurTaps;
+
+	// [Mip][Channel], slices of (Size >> Mip)^2
+	f32* Moments[c_MaxShadowMomentMips][4];
+	f32* Scratch[4]; // Horizontal blur result, one slice
+	shadow_moment_stats Stats;
+};
+
+internal void ShadowMoments_Initialize(shadow_moment_map* Map, i32 Size, u32 SliceCount);
+internal void ShadowMoments_Destroy(shadow_moment_map* Map);
+
+// Depth slice of Size^2 -> moments, blurred and mipmapped. Blocks until done
+internal const shadow_moment_stats& ShadowMoments_BuildSlice(shadow_moment_map* Map, u32 Slice, const f32* Depth, shadow_filter Filter, u32 BlurTaps);
+
+// Trilinear fetch like g_ShadowMomentSampler (clamp), Lod is clamped to the mip chain
+internal void ShadowMoments_Sample(const shadow_moment_map* Map, i32x8 Slice, f32x8 U, f32x8 V, f32x8 Lod, f32x8 OutMoments[4]);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+// What the shadow pass writes for a depth, the moment map is cleared to the value of depth 1
+inline v4 ShadowMoments_FromDepth(f32 Depth, shadow_filter Filter)
+{
+	if (Filter == shadow_filter::EVSM)
+	{
+		// Warped around [-1, 1]
+		f32 Warped = Depth * 2.0f - 1.0f;
+		f32 Positive = glm::exp(c_EVSMPositiveExponent * Warped);
+		f32 Negative = -glm::exp(-c_EVSMNegativeExponent * Warped);
+		return v4(Positive, Positive * Positive, Negative, Negative * Negative);
+	}
+
+	return v4(Depth, Depth * Depth, 0.0f, 0.0f);
+}
+
+// Binomial weights, close to a Gaussian and exact in floats. Taps is odd
+inline void ShadowMoments_GetBlurWeights(u32 Taps, f32* Weights)
+{
+	Assert(Taps % 2 == 1 && Taps <= c_MaxShadowMomentBlurTaps, "Moment blur taps has to be odd and 9 at most!");
+
+	f32 Coefficient = 1.0f;
+	f32 Sum = 0.0f;
+	for (u32 i = 0; i < Taps; i++)
+	{
+		Weights[i] = Coefficient;
+		Sum += Coefficient;
+		Coefficient = Coefficient * (f32)(Taps - 1 - i) / (f32)(i + 1);
+	}
+
+	for (u32 i = 0; i < Taps; i++)
+		Weights[i] /= Sum;
+}
+
+inline u32 ShadowMoments_GetMipCount(u32 Size)
+{
+	u32 MipCount = 1;
+	while ((Size >> MipCount) > 0 && MipCount < c_MaxShadowMomentMips)
+		MipCount++;
+
+	return MipCount;
+}
+
+inline u32 ShadowMoments_GetChannelCount(shadow_filter Filter)
+{
+	return Filter == shadow_filter::EVSM ? 4 : 2;
+}
+
+internal void ShadowMoments_Initialize(shadow_moment_map* Map, i32 Size, u32 SliceCount)
+{
+	Assert(Size > 0 && Size % c_SimdWidth == 0, "Moment map size has to be a multiple of the SIMD width!");
+
+	Map->Size = Size;
+	Map->SliceCount = SliceCount;
+	Map->MipCount = ShadowMoments_GetMipCount(Size);
+	Map->Filter = shadow_filter::COUNT;
+
+	for (u32 Mip = 0; Mip < Map->MipCount; Mip++)
+	{
+		i32 MipSize = Size >> Mip;
+		for (u32 Channel = 0; Channel < 4; Channel++)
+			Map->Moments[Mip][Channel] = VmAllocArray(f32, MipSize * MipSize * SliceCount);
+	}
+
+	for (u32 Channel = 0; Channel < 4; Channel++)
+		Map->Scratch[Channel] = VmAllocArray(f32, Size * Size);
+}
+
+internal void ShadowMoments_Destroy(shadow_moment_map* Map)
+{
+	for (u32 Mip = 0; Mip < Map->MipCount; Mip++)
+	{
+		for (u32 Channel = 0; Channel < 4; Channel++)
+			VmFree(Map->Moments[Mip][Channel]);
+	}
+
+	for (u32 Channel = 0; Channel < 4; Channel++)
+		VmFree(Map->Scratch[Channel]);
+}
+
+// BlurCS with a horizontal step, edges clamp to the border texel
+internal void ShadowMoments_BlurRow(const f32* Source, f32* Destination, i32 Size, const f32* Weights, i32 Taps)
+{
+	const i32 Half = Taps / 2;
+
+	for (i32 X = 0; X < Size; X += c_SimdWidth)
+	{
+		f32x8 Sum = F32x8Zero();
+
+		// Interior spans read straight from the row, the ones touching an edge gather with clamped indices
+		if (X >= Half && X + (i32)c_SimdWidth + Half <= Size)
+		{
+			for (i32 i = 0; i < Taps; i++)
+				Sum = MulAdd(F32x8(Weights[i]), F32x8Load(Source + X - Half + i), Sum);
+		}
+		else
+		{
+			i32x8 Lanes = I32x8(X) + I32x8LaneIndex();
+			for (i32 i = 0; i < Taps; i++)
+			{
+				i32x8 Index = Min(Max(Lanes + I32x8(i - Half), I32x8(0)), I32x8(Size - 1));
+				Sum = MulAdd(F32x8(Weights[i]), Gather(Source, Index), Sum);
+			}
+		}
+
+		F32x8Store(Destination + X, Sum);
+	}
+}
+
+// BlurCS with a vertical step, whole rows are weighted and added
+internal void ShadowMoments_BlurColumn(const f32* Source, f32* Destination, i32 Size, i32 Y, const f32* Weights, i32 Taps)
+{
+	const i32 Half = Taps / 2;
+
+	const f32* Rows[c_MaxShadowMomentBlurTaps];
+	for (i32 i = 0; i < Taps; i++)
+		Rows[i] = Source + glm::clamp(Y - Half + i, 0, Size - 1) * Size;
+
+	f32* Out = Destination + Y * Size;
+	for (i32 X = 0; X < Size; X += c_SimdWidth)
+	{
+		f32x8 Sum = F32x8Zero();
+		for (i32 i = 0; i < Taps; i++)
+			Sum = MulAdd(F32x8(Weights[i]), F32x8Load(Rows[i] + X), Sum);
+
+		F32x8Store(Out + X, Sum);
+	}
+}
+
+// DownsampleCS, 2x2 box. Rows of 8 and more gather even and odd texels, the small mips are done one texel at a time
+internal void ShadowMoments_DownsampleRow(const f32* Source, f32* Destination, i32 SourceSize, i32 Y)
+{
+	const i32 Size = SourceSize / 2;
+	const f32* Row0 = Source + (Y * 2) * SourceSize;
+	const f32* Row1 = Row0 + SourceSize;
+	f32* Out = Destination + Y * Size;
+
+	i32 X = 0;
+	for (; X + (i32)c_SimdWidth <= Size; X += c_SimdWidth)
+	{
+		i32x8 Even = (I32x8(X) + I32x8LaneIndex()) * I32x8(2);
+		i32x8 Odd = Even + I32x8(1);
+		f32x8 Sum = Gather(Row0, Even) + Gather(Row0, Odd) + Gather(Row1, Even) + Gather(Row1, Odd);
+		F32x8Store(Out + X, Sum * F32x8(0.25f));
+	}
+
+	for (; X < Size; X++)
+		Out[X] = (Row0[X * 2] + Row0[X * 2 + 1] + Row1[X * 2] + Row1[X * 2 + 1]) * 0.25f;
+}
+
+internal const shadow_moment_stats& ShadowMoments_BuildSlice(shadow_moment_map* Map, u32 Slice, const f32* Depth, shadow_filter Filter, u32 BlurTaps)
+{
+	Assert(Slice < Map->SliceCount, "Moment map slice out of range!");
+	Assert(ShadowFilter_UsesMoments(Filter), "Filter does not use moments!");
+
+	using clock = std::chrono::high_resolution_clock;
+	auto Start = clock::now();
+
+	Map->Filter = Filter;
+	Map->BlurTaps = BlurTaps;
+
+	const i32 Size = Map->Size;
+	const u32 ChannelCount = ShadowMoments_GetChannelCount(Filter);
+	const u64 SliceOffset = (u64)Slice * Size * Size;
+
+	// 1. Moments, what PSMoments writes
+	JobSystem_ParallelFor(&g_Jobs, Size, 16, [Map, Depth, Filter, SliceOffset, Size, ChannelCount](u32 Begin, u32 End)
+	{
+		for (u32 Y = Begin; Y < End; Y++)
+		{
+			for (i32 X = 0; X < Size; X++)
+			{
+				u64 Texel = (u64)Y * Size + X;
+				v4 Moments = ShadowMoments_FromDepth(Depth[Texel], Filter);
+				for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+					Map->Moments[0][Channel][SliceOffset + Texel] = Moments[Channel];
+			}
+		}
+	});
+
+	auto ConvertEnd = clock::now();
+
+	// 2. Separable blur, horizontal into scratch and vertical back
+	f32 Weights[c_MaxShadowMomentBlurTaps];
+	ShadowMoments_GetBlurWeights(BlurTaps, Weights);
+
+	if (BlurTaps > 1)
+	{
+		const i32 Taps = (i32)BlurTaps;
+		JobSystem_ParallelFor(&g_Jobs, Size * ChannelCount, 16, [Map, SliceOffset, Size, &Weights, Taps](u32 Begin, u32 End)
+		{
+			for (u32 i = Begin; i < End; i++)
+			{
+				u32 Channel = i / Size, Y = i % Size;
+				ShadowMoments_BlurRow(Map->Moments[0][Channel] + SliceOffset + (u64)Y * Size, Map->Scratch[Channel] + (u64)Y * Size, Size, Weights, Taps);
+			}
+		});
+
+		JobSystem_ParallelFor(&g_Jobs, Size * ChannelCount, 16, [Map, SliceOffset, Size, &Weights, Taps](u32 Begin, u32 End)
+		{
+			for (u32 i = Begin; i < End; i++)
+			{
+				u32 Channel = i / Size, Y = i % Size;
+				ShadowMoments_BlurColumn(Map->Scratch[Channel], Map->Moments[0][Channel] + SliceOffset, Size, (i32)Y, Weights, Taps);
+			}
+		});
+	}
+
+	auto BlurEnd = clock::now();
+
+	// 3. Mips, each level waits for the one above
+	for (u32 Mip = 1; Mip < Map->MipCount; Mip++)
+	{
+		const i32 SourceSize = Size >> (Mip - 1);
+		const i32 MipSize = SourceSize / 2;
+		const u64 SourceOffset = (u64)Slice * SourceSize * SourceSize;
+		const u64 MipOffset = (u64)Slice * MipSize * MipSize;
+
+		JobSystem_ParallelFor(&g_Jobs, MipSize * ChannelCount, 32, [Map, Mip, SourceSize, MipSize, SourceOffset, MipOffset](u32 Begin, u32 End)
+		{
+			for (u32 i = Begin; i < End; i++)
+			{
+				u32 Channel = i / MipSize, Y = i % MipSize;
+				ShadowMoments_DownsampleRow(Map->Moments[Mip - 1][Channel] + SourceOffset, Map->Moments[Mip][Channel] + MipOffset, SourceSize, (i32)Y);
+			}
+		});
+	}
+
+	auto End = clock::now();
+
+	shadow_moment_stats& Stats = Map->Stats;
+	Stats.ConvertMilliseconds = std::chrono::duration<f32, std::milli>(ConvertEnd - Start).count();
+	Stats.BlurMilliseconds = std::chrono::duration<f32, std::milli>(BlurEnd - ConvertEnd).count();
+	Stats.MipMilliseconds = std::chrono::duration<f32, std::milli>(End - BlurEnd).count();
+	Stats.TotalMilliseconds = std::chrono::duration<f32, std::milli>(End - Start).count();
+	return Stats;
+}
+
+// Bilinear fetch of every channel from one mip, clamp addressing
+internal void ShadowMoments_SampleBilinear(const shadow_moment_map* Map, u32 Mip, i32x8 Slice, f32x8 U, f32x8 V, u32 ChannelCount, f32x8 OutMoments[4])
+{
+	const i32 Size = Map->Size >> Mip;
+	const f32x8 One = F32x8(1.0f);
+
+	f32x8 X = MulAdd(U, F32x8((f32)Size), F32x8(-0.5f));
+	f32x8 Y = MulAdd(V, F32x8((f32)Size), F32x8(-0.5f));
+	f32x8 X0 = Floor(X), Y0 = Floor(Y);
+	f32x8 FracX = X - X0, FracY = Y - Y0;
+
+	const i32x8 Last = I32x8(Size - 1);
+	i32x8 TexelX0 = Min(Max(ConvertToI32(X0), I32x8(0)), Last);
+	i32x8 TexelX1 = Min(Max(ConvertToI32(X0 + One), I32x8(0)), Last);
+	i32x8 TexelY0 = Min(Max(ConvertToI32(Y0), I32x8(0)), Last);
+	i32x8 TexelY1 = Min(Max(ConvertToI32(Y0 + One), I32x8(0)), Last);
+
+	i32x8 SliceBase = Slice * I32x8(Size * Size);
+	i32x8 Row0 = SliceBase + TexelY0 * I32x8(Size);
+	i32x8 Row1 = SliceBase + TexelY1 * I32x8(Size);
+
+	for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+	{
+		const f32* Plane = Map->Moments[Mip][Channel];
+		f32x8 Top = Lerp(Gather(Plane, Row0 + TexelX0), Gather(Plane, Row0 + TexelX1), FracX);
+		f32x8 Bottom = Lerp(Gather(Plane, Row1 + TexelX0), Gather(Plane, Row1 + TexelX1), FracX);
+		OutMoments[Channel] = Lerp(Top, Bottom, FracY);
+	}
+}
+
+internal void ShadowMoments_Sample(const shadow_moment_map* Map, i32x8 Slice, f32x8 U, f32x8 V, f32x8 Lod, f32x8 OutMoments[4])
+{
+	const u32 ChannelCount = ShadowMoments_GetChannelCount(Map->Filter);
+	for (u32 Channel = ChannelCount; Channel < 4; Channel++)
+		OutMoments[Channel] = F32x8Zero();
+
+	Lod = Clamp(Lod, F32x8Zero(), F32x8((f32)(Map->MipCount - 1)));
+
+	// Lanes usually share their mips, walk the ones that are used
+	f32 MinLod = HorizontalMin(Lod), MaxLod = HorizontalMax(Lod);
+	u32 FirstMip = (u32)MinLod;
+	u32 LastMip = glm::min((u32)MaxLod + 1, Map->MipCount - 1);
+
+	f32x8 Result[4] = {};
+	for (u32 Mip = FirstMip; Mip <= LastMip; Mip++)
+	{
+		// Tent weight of this mip for every lane
+		f32x8 Weight = Max(F32x8(1.0f) - Abs(Lod - F32x8((f32)Mip)), F32x8Zero());
+		if (!Any(Weight > F32x8Zero()))
+			continue;
+
+		f32x8 Moments[4];
+		ShadowMoments_SampleBilinear(Map, Mip, Slice, U, V, ChannelCount, Moments);
+		for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+			Result[Channel] = MulAdd(Moments[Channel], Weight, Result[Channel]);
+	}
+
+	for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+		OutMoments[Channel] = Result[Channel];
+}
@@ -0,0 +1,57 @@
+#ifndef __SHADOW_MOMENTS_HLSL_
+#define __SHADOW_MOMENTS_HLSL_
+
+// Moment shadow maps, same constants as ShadowMoments.h
+#define SHADOW_MOMENTS_VSM 1
+#define SHADOW_MOMENTS_EVSM 2
+
+static const float c_EVSMPositiveExponent = 40.0;
+static const float c_EVSMNegativeExponent = 5.0;
+static const float c_ShadowMomentMinVariance = 0.00001;
+static const float c_EVSMMinVarianceScale = 0.0001;
+
+// ShadowMoments_FromDepth
+float4 MomentsFromDepth(float Depth, uint Moments)
+{
+    if (Moments == SHADOW_MOMENTS_EVSM)
+    {
+        // Warped around [-1, 1]
+        float Warped = Depth * 2.0 - 1.0;
+        float Positive = exp(c_EVSMPositiveExponent * Warped);
+        float Negative = -exp(-c_EVSMNegativeExponent * Warped);
+        return float4(Positive, Positive * Positive, Negative, Negative * Negative);
+    }
+
+    return float4(Depth, Depth * Depth, 0.0, 0.0);
+}
+
+// Upper bound of the lit fraction, the part below LightBleeding is cut off
+float ChebyshevUpperBound(float2 Moments, float Mean, float MinVariance, float LightBleeding)
+{
+    float Variance = max(Moments.y - Moments.x * Moments.x, MinVariance);
+    float Distance = Mean - Moments.x;
+    float PMax = Variance / (Variance + Distance * Distance);
+    PMax = saturate((PMax - LightBleeding) / (1.0 - LightBleeding));
+    return Mean <= Moments.x ? 1.0 : PMax;
+}
+
+// Lit fraction of a receiver at Depth from filtered moments
+float ShadowMomentsLit(float4 Moments, float Depth, uint Representation, float LightBleeding)
+{
+    if (Representation == SHADOW_MOMENTS_EVSM)
+    {
+        float4 Warped = MomentsFromDepth(Depth, SHADOW_MOMENTS_EVSM);
+
+        // Variance floor scales with the slope of the warp
+        float2 DepthScale = c_EVSMMinVarianceScale * float2(c_EVSMPositiveExponent * Warped.x, c_EVSMNegativeExponent * Warped.z);
+        float2 MinVariance = DepthScale * DepthScale;
+
+        float Positive = ChebyshevUpperBound(Moments.xy, Warped.x, MinVariance.x, LightBleeding);
+        float Negative = ChebyshevUpperBound(Moments.zw, Warped.z, MinVariance.y, LightBleeding);
+        return min(Positive, Negative);
+    }
+
+    return ChebyshevUpperBound(Moments.xy, Depth, c_ShadowMomentMinVariance, LightBleeding);
+}
+
+#endif
@@ -0,0 +1,520 @@
+#pragma once
+
+// CPU shadow map rasterizer
+// Renders the same triangles as Shadow.hlsl into a float depth buffer, so shadow generation can be checked and timed without a GPU.
+// It follows the shadow pipeline state: clockwise triangles on screen are kept, depth is clipped to [0, 1], LESS_EQUAL with no bias,
+// vertices snap to 8 bits of subpixel precision and edges follow the top-left fill rule like D3D12.
+//
+// Work is split in three stages, each spread over the job system:
+// 1. Setup, triangles are transformed, culled and turned into edge and depth planes
+// 2. Binning, every group of triangles counts and then writes its tile entries
+// 3. Rasterization, a tile at a time per worker, 8 pixels at once. Depth only takes the minimum, so the order of triangles does not matter.
+
+#include "SIMD.h"
+
+inline constexpr i32 c_ShadowRasterTileSize = 64; // Multiple of the SIMD width, a tile of depth fits into L1
+inline constexpr u32 c_ShadowRasterBinGroups = 16;
+inline constexpr u32 c_ShadowRasterSubpixelSteps = 256;
+
+struct shadow_raster_triangle
+{
+	// Planes relative to (MinX, MinY), keeps the values small enough for floats on big shadow maps
+	f32 EdgeA[3], EdgeB[3], EdgeC[3];
+	f32 DepthA, DepthB, DepthC;
+	i32 MinX, MinY, MaxX, MaxY; // Empty when MinX > MaxX
+	u32 TopLeft;                // Bit per edge, pixels exactly on a top or left edge belong to the triangle
+};
+
+struct shadow_raster_draw
+{
+	u32 IndexOffset;
+	u32 IndexCount;
+	u32 FirstTriangle;
+};
+
+struct shadow_raster_stats
+{
+	u32 Triangles;       // Submitted
+	u32 RasterTriangles; // Left after culling and clipping, binned
+	u32 DroppedTriangles;
+	u32 BinEntries;
+	f32 SetupMilliseconds;
+	f32 BinMilliseconds;
+	f32 RasterMilliseconds;
+	f32 TotalMilliseconds;
+};
+
+struct shadow_rasterizer
+{
+	i32 Size; // Square, multiple of the tile size
+	i32 MaxSize;
+	i32 TilesPerSide;
+	i32 TileCount;
+	u32 MaxTriangles;
+	u32 MaxExtraTriangles;
+	u32 MaxBinEntries;
+	u32 MaxDraws;
+
+	// Output, row-major Size x Size, cleared to 1
+	f32* Depth;
+	shadow_raster_stats Stats;
+
+	// Input
+	m4 LightSpaceMatrix;
+	const quad_vertex* Vertices;
+	const u32* Indices;
+	shadow_raster_draw* Draws;
+	u32 DrawCount;
+	u32 TriangleCount;
+
+	// Internal
+	shadow_raster_triangle* Triangles; // Slot per submitted triangle, then the ones created by near plane clipping
+	std::atomic<u32> ExtraTriangleCount;
+	u32* BinCounts;                    // [Group][Tile], turned into write cursors
+	u32* BinOffsets;                   // TileCount + 1
+	u32* BinEntries;
+};
+
+internal void ShadowRaster_Initialize(shadow_rasterizer* Raster, i32 Size, u32 MaxTriangles);
+internal void ShadowRaster_Destroy(shadow_rasterizer* Raster);
+
+// Smaller shadow maps from the same buffers, up to the size it was initialized with. Depth stays row-major Size x Size
+internal void ShadowRaster_Resize(shadow_rasterizer* Raster, i32 Size);
+
+// Same arguments as the GPU pass, the light space matrix, the vertex stream and the index buffer
+internal void ShadowRaster_Begin(shadow_rasterizer* Raster, const m4& LightSpaceMatrix, const quad_vertex* Vertices, const u32* Indices);
+internal void ShadowRaster_AddDraw(shadow_rasterizer* Raster, u32 IndexOffset, u32 IndexCount);
+
+// Blocks until the depth buffer is done, returns the stats
+internal const shadow_raster_stats& ShadowRaster_Render(shadow_rasterizer* Raster);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+internal void ShadowRaster_Initialize(shadow_rasterizer* Raster, i32 Size, u32 MaxTriangles)
+{
+	Assert(Size > 0 && Size % c_ShadowRasterTileSize == 0, "Shadow raster size has to be a multiple of the tile size!");
+
+	Raster->Size = Size;
+	Raster->MaxSize = Size;
+	Raster->TilesPerSide = Size / c_ShadowRasterTileSize;
+	Raster->TileCount = Raster->TilesPerSide * Raster->TilesPerSide;
+	Raster->MaxTriangles = MaxTriangles;
+	Raster->MaxExtraTriangles = MaxTriangles / 8; // Only triangles crossing the near plane make extras
+	Raster->MaxBinEntries = MaxTriangles * 2;
+	Raster->MaxDraws = c_MaxShadowDraws;
+
+	Raster->Depth = VmAllocArray(f32, Size * Size);
+	Raster->Draws = VmAllocArray(shadow_raster_draw, Raster->MaxDraws);
+	Raster->Triangles = VmAllocArray(shadow_raster_triangle, MaxTriangles + Raster->MaxExtraTriangles);
+	Raster->BinCounts = VmAllocArray(u32, c_ShadowRasterBinGroups * Raster->TileCount);
+	Raster->BinOffsets = VmAllocArray(u32, Raster->TileCount + 1);
+	Raster->BinEntries = VmAllocArray(u32, Raster->MaxBinEntries);
+}
+
+internal void ShadowRaster_Destroy(shadow_rasterizer* Raster)
+{
+	VmFree(Raster->Depth);
+	VmFree(Raster->Draws);
+	VmFree(Raster->Triangles);
+	VmFree(Raster->BinCounts);
+	VmFree(Raster->BinOffsets);
+	VmFree(Raster->BinEntries);
+}
+
+internal void ShadowRaster_Resize(shadow_rasterizer* Raster, i32 Size)
+{
+	Assert(Size > 0 && Size % c_ShadowRasterTileSize == 0 && Size <= Raster->MaxSize, "Shadow raster size has to be a multiple of the tile size and fit the buffers!");
+
+	Raster->Size = Size;
+	Raster->TilesPerSide = Size / c_ShadowRasterTileSize;
+	Raster->TileCount = Raster->TilesPerSide * Raster->TilesPerSide;
+}
+
+internal void ShadowRaster_Begin(shadow_rasterizer* Raster, const m4& LightSpaceMatrix, const quad_vertex* Vertices, const u32* Indices)
+{
+	Raster->LightSpaceMatrix = LightSpaceMatrix;
+	Raster->Vertices = Vertices;
+	Raster->Indices = Indices;
+	Raster->DrawCount = 0;
+	Raster->TriangleCount = 0;
+	Raster->Stats = {};
+}
+
+internal void ShadowRaster_AddDraw(shadow_rasterizer* Raster, u32 IndexOffset, u32 IndexCount)
+{
+	u32 TriangleCount = IndexCount / 3;
+	if (TriangleCount == 0)
+		return;
+
+	if (Raster->DrawCount == Raster->MaxDraws || Raster->TriangleCount + TriangleCount > Raster->MaxTriangles)
+	{
+		Raster->Stats.DroppedTriangles += TriangleCount;
+		return;
+	}
+
+	Raster->Draws[Raster->DrawCount++] = { IndexOffset, IndexCount, Raster->TriangleCount };
+	Raster->TriangleCount += TriangleCount;
+}
+
+// Setup
+
+// Returns false for triangles that cannot cover a pixel
+internal bool ShadowRaster_SetupTriangle(const shadow_rasterizer* Raster, const v4* Clip, shadow_raster_triangle* Triangle)
+{
+	const f32 Size = (f32)Raster->Size;
+	const f32 Steps = (f32)c_ShadowRasterSubpixelSteps;
+
+	// To pixels, y goes down like in the render target, snapped to the subpixel grid
+	f32 X[3], Y[3], Z[3];
+	for (u32 i = 0; i < 3; i++)
+	{
+		f32 InvW = 1.0f / Clip[i].w;
+		X[i] = glm::floor((Clip[i].x * InvW * 0.5f + 0.5f) * Size * Steps + 0.5f) / Steps;
+		Y[i] = glm::floor((0.5f - Clip[i].y * InvW * 0.5f) * Size * Steps + 0.5f) / Steps;
+		Z[i] = Clip[i].z * InvW;
+	}
+
+	// Shadow pipeline culls front faces with FrontCounterClockwise, what is left is clockwise on screen
+	f32 Area = (X[1] - X[0]) * (Y[2] - Y[0]) - (X[2] - X[0]) * (Y[1] - Y[0]);
+	if (Area <= 0.0f)
+		return false;
+
+	// Pixels whose centers can be covered
+	i32 MinX = glm::max((i32)glm::ceil(glm::min(X[0], glm::min(X[1], X[2])) - 0.5f), 0);
+	i32 MinY = glm::max((i32)glm::ceil(glm::min(Y[0], glm::min(Y[1], Y[2])) - 0.5f), 0);
+	i32 MaxX = glm::min((i32)glm::floor(glm::max(X[0], glm::max(X[1], X[2])) - 0.5f), Raster->Size - 1);
+	i32 MaxY = glm::min((i32)glm::floor(glm::max(Y[0], glm::max(Y[1], Y[2])) - 0.5f), Raster->Size - 1);
+
+	if (MinX > MaxX || MinY > MaxY)
+		return false;
+
+	// Edge from vertex i + 1 to vertex i + 2 is stored at vertex i, positive inside
+	Triangle->TopLeft = 0;
+	for (u32 i = 0; i < 3; i++)
+	{
+		u32 From = (i + 1) % 3, To = (i + 2) % 3;
+		f32 A = -(Y[To] - Y[From]);
+		f32 B = X[To] - X[From];
+
+		Triangle->EdgeA[i] = A;
+		Triangle->EdgeB[i] = B;
+		Triangle->EdgeC[i] = -(A * (X[From] - MinX) + B * (Y[From] - MinY));
+
+		// Left edges have the inside to the right, top edges are horizontal with the inside below
+		if (A > 0.0f || (A == 0.0f && B > 0.0f))
+			Triangle->TopLeft |= 1u << i;
+	}
+
+	f32 InvArea = 1.0f / Area;
+	f32 DZ1 = Z[1] - Z[0], DZ2 = Z[2] - Z[0];
+	Triangle->DepthA = (DZ1 * (Y[2] - Y[0]) - DZ2 * (Y[1] - Y[0])) * InvArea;
+	Triangle->DepthB = (DZ2 * (X[1] - X[0]) - DZ1 * (X[2] - X[0])) * InvArea;
+	Triangle->DepthC = Z[0] - Triangle->DepthA * (X[0] - MinX) - Triangle->DepthB * (Y[0] - MinY);
+
+	Triangle->MinX = MinX;
+	Triangle->MinY = MinY;
+	Triangle->MaxX = MaxX;
+	Triangle->MaxY = MaxY;
+	return true;
+}
+
+// Triangles crossing the near plane are clipped, the second half of a clipped triangle goes after the submitted ones.
+// Far plane and the rest of the near plane are handled per pixel by the depth clip.
+internal void ShadowRaster_AddTriangle(shadow_rasterizer* Raster, const v4& A, const v4& B, const v4& C, shadow_raster_triangle* Slot)
+{
+	Slot->MinX = 0;
+	Slot->MaxX = -1;
+
+	// Trivial reject, all vertices outside of the same plane
+	if ((A.x > A.w && B.x > B.w && C.x > C.w) || (A.x < -A.w && B.x < -B.w && C.x < -C.w) ||
+		(A.y > A.w && B.y > B.w && C.y > C.w) || (A.y < -A.w && B.y < -B.w && C.y < -C.w) ||
+		(A.z > A.w && B.z > B.w && C.z > C.w) || (A.z < 0.0f && B.z < 0.0f && C.z < 0.0f))
+		return;
+
+	if (A.z >= 0.0f && B.z >= 0.0f && C.z >= 0.0f)
+	{
+		v4 Clip[3] = { A, B, C };
+		ShadowRaster_SetupTriangle(Raster, Clip, Slot);
+		return;
+	}
+
+	v4 Input[3] = { A, B, C };
+	v4 Polygon[4];
+	u32 Count = 0;
+
+	for (u32 i = 0; i < 3; i++)
+	{
+		const v4& Current = Input[i];
+		const v4& Next = Input[(i + 1) % 3];
+
+		if (Current.z >= 0.0f)
+			Polygon[Count++] = Current;
+
+		if ((Current.z >= 0.0f) != (Next.z >= 0.0f))
+		{
+			f32 T = Current.z / (Current.z - Next.z);
+			Polygon[Count++] = Current + (Next - Current) * T;
+		}
+	}
+
+	v4 First[3] = { Polygon[0], Polygon[1], Polygon[2] };
+	ShadowRaster_SetupTriangle(Raster, First, Slot);
+
+	if (Count == 4)
+	{
+		u32 Extra = Raster->ExtraTriangleCount.fetch_add(1);
+		if (Extra >= Raster->MaxExtraTriangles)
+			return;
+
+		v4 Second[3] = { Polygon[0], Polygon[2], Polygon[3] };
+		shadow_raster_triangle* ExtraSlot = &Raster->Triangles[Raster->TriangleCount + Extra];
+		if (!ShadowRaster_SetupTriangle(Raster, Second, ExtraSlot))
+		{
+			ExtraSlot->MinX = 0;
+			ExtraSlot->MaxX = -1;
+		}
+	}
+}
+
+internal void ShadowRaster_SetupTriangles(shadow_rasterizer* Raster, u32 Begin, u32 End)
+{
+	// First draw that contains Begin
+	u32 Low = 0, High = Raster->DrawCount - 1;
+	while (Low < High)
+	{
+		u32 Middle = (Low + High + 1) / 2;
+		if (Raster->Draws[Middle].FirstTriangle <= Begin)
+			Low = Middle;
+		else
+			High = Middle - 1;
+	}
+
+	const m4& M = Raster->LightSpaceMatrix;
+	u32 DrawIndex = Low;
+
+	for (u32 i = Begin; i < End; i++)
+	{
+		const shadow_raster_draw* Draw = &Raster->Draws[DrawIndex];
+		while (i >= Draw->FirstTriangle + Draw->IndexCount / 3)
+			Draw = &Raster->Draws[++DrawIndex];
+
+		const u32* Indices = &Raster->Indices[Draw->IndexOffset + (i - Draw->FirstTriangle) * 3];
+		v4 A = M * Raster->Vertices[Indices[0]].Position;
+		v4 B = M * Raster->Vertices[Indices[1]].Position;
+		v4 C = M * Raster->Vertices[Indices[2]].Position;
+
+		ShadowRaster_AddTriangle(Raster, A, B, C, &Raster->Triangles[i]);
+	}
+}
+
+// Binning
+
+internal void ShadowRaster_BinTriangles(shadow_rasterizer* Raster, u32 TriangleCount)
+{
+	const i32 TileCount = Raster->TileCount;
+	const i32 TilesPerSide = Raster->TilesPerSide;
+	const u32 GroupSize = (TriangleCount + c_ShadowRasterBinGroups - 1) / c_ShadowRasterBinGroups;
+
+	memset(Raster->BinCounts, 0, sizeof(u32) * c_ShadowRasterBinGroups * TileCount);
+	u32 GroupTriangles[c_ShadowRasterBinGroups] = {};
+
+	JobSystem_ParallelFor(&g_Jobs, c_ShadowRasterBinGroups, 1, [Raster, TriangleCount, GroupSize, TileCount, TilesPerSide, &GroupTriangles](u32 GroupBegin, u32 GroupEnd)
+	{
+		for (u32 Group = GroupBegin; Group < GroupEnd; Group++)
+		{
+			u32* Counts = &Raster->BinCounts[Group * TileCount];
+			u32 End = glm::min((Group + 1) * GroupSize, TriangleCount);
+
+			for (u32 i = Group * GroupSize; i < End; i++)
+			{
+				const shadow_raster_triangle& Triangle = Raster->Triangles[i];
+				if (Triangle.MinX > Triangle.MaxX)
+					continue;
+
+				GroupTriangles[Group]++;
+
+				for (i32 TileY = Triangle.MinY / c_ShadowRasterTileSize; TileY <= Triangle.MaxY / c_ShadowRasterTileSize; TileY++)
+					for (i32 TileX = Triangle.MinX / c_ShadowRasterTileSize; TileX <= Triangle.MaxX / c_ShadowRasterTileSize; TileX++)
+						Counts[TileY * TilesPerSide + TileX]++;
+			}
+		}
+	});
+
+	// Groups that do not fit anymore are dropped whole
+	u32 GroupCount = c_ShadowRasterBinGroups;
+	u32 TotalEntries = 0;
+	for (u32 Group = 0; Group < c_ShadowRasterBinGroups; Group++)
+	{
+		u32 GroupEntries = 0;
+		for (i32 Tile = 0; Tile < TileCount; Tile++)
+			GroupEntries += Raster->BinCounts[Group * TileCount + Tile];
+
+		if (GroupCount == c_ShadowRasterBinGroups && TotalEntries + GroupEntries > Raster->MaxBinEntries)
+			GroupCount = Group;
+
+		if (Group < GroupCount)
+		{
+			TotalEntries += GroupEntries;
+			Raster->Stats.RasterTriangles += GroupTriangles[Group];
+		}
+		else
+		{
+			Raster->Stats.DroppedTriangles += GroupTriangles[Group];
+		}
+	}
+
+	// Tile by tile, groups inside of a tile in order, counts become write cursors
+	u32 Offset = 0;
+	for (i32 Tile = 0; Tile < TileCount; Tile++)
+	{
+		Raster->BinOffsets[Tile] = Offset;
+		for (u32 Group = 0; Group < GroupCount; Group++)
+		{
+			u32& Count = Raster->BinCounts[Group * TileCount + Tile];
+			u32 Entries = Count;
+			Count = Offset;
+			Offset += Entries;
+		}
+	}
+	Raster->BinOffsets[TileCount] = Offset;
+	Raster->Stats.BinEntries = Offset;
+
+	JobSystem_ParallelFor(&g_Jobs, GroupCount, 1, [Raster, TriangleCount, GroupSize, TileCount, TilesPerSide](u32 GroupBegin, u32 GroupEnd)
+	{
+		for (u32 Group = GroupBegin; Group < GroupEnd; Group++)
+		{
+			u32* Cursors = &Raster->BinCounts[Group * TileCount];
+			u32 End = glm::min((Group + 1) * GroupSize, TriangleCount);
+
+			for (u32 i = Group * GroupSize; i < End; i++)
+			{
+				const shadow_raster_triangle& Triangle = Raster->Triangles[i];
+				if (Triangle.MinX > Triangle.MaxX)
+					continue;
+
+				for (i32 TileY = Triangle.MinY / c_ShadowRasterTileSize; TileY <= Triangle.MaxY / c_ShadowRasterTileSize; TileY++)
+					for (i32 TileX = Triangle.MinX / c_ShadowRasterTileSize; TileX <= Triangle.MaxX / c_ShadowRasterTileSize; TileX++)
+						Raster->BinEntries[Cursors[TileY * TilesPerSide + TileX]++] = i;
+			}
+		}
+	});
+}
+
+// Rasterization
+
+internal void ShadowRaster_RasterizeTile(shadow_rasterizer* Raster, i32 TileIndex)
+{
+	const i32 Size = Raster->Size;
+	const i32 TileX0 = (TileIndex % Raster->TilesPerSide) * c_ShadowRasterTileSize;
+	const i32 TileY0 = (TileIndex / Raster->TilesPerSide) * c_ShadowRasterTileSize;
+
+	for (i32 Y = 0; Y < c_ShadowRasterTileSize; Y++)
+	{
+		f32* Row = &Raster->Depth[(TileY0 + Y) * Size + TileX0];
+		for (i32 X = 0; X < c_ShadowRasterTileSize; X += c_SimdWidth)
+			F32x8Store(Row + X, F32x8(1.0f));
+	}
+
+	const f32x8 LaneOffset = F32x8LaneIndex() + F32x8(0.5f);
+	const f32x8 Zero = F32x8Zero();
+	const f32x8 One = F32x8(1.0f);
+
+	// Top-left rule with a single compare, E >= 0 on top and left edges and E >= smallest denormal (E > 0) on the others
+	const f32 Threshold[2] = { FLT_TRUE_MIN, 0.0f };
+
+	for (u32 Entry = Raster->BinOffsets[TileIndex]; Entry < Raster->BinOffsets[TileIndex + 1]; Entry++)
+	{
+		const shadow_raster_triangle& Triangle = Raster->Triangles[Raster->BinEntries[Entry]];
+
+		// Spans start at a multiple of 8 inside of the tile, lanes past the triangle fail the edge tests
+		i32 MinX = glm::max(Triangle.MinX, TileX0);
+		i32 MaxX = glm::min(Triangle.MaxX, TileX0 + c_ShadowRasterTileSize - 1);
+		i32 MinY = glm::max(Triangle.MinY, TileY0);
+		i32 MaxY = glm::min(Triangle.MaxY, TileY0 + c_ShadowRasterTileSize - 1);
+		MinX = TileX0 + ((MinX - TileX0) & ~(i32)(c_SimdWidth - 1));
+
+		f32x8 EdgeA0 = F32x8(Triangle.EdgeA[0]), EdgeA1 = F32x8(Triangle.EdgeA[1]), EdgeA2 = F32x8(Triangle.EdgeA[2]);
+		f32x8 Threshold0 = F32x8(Threshold[Triangle.TopLeft & 1]);
+		f32x8 Threshold1 = F32x8(Threshold[(Triangle.TopLeft >> 1) & 1]);
+		f32x8 Threshold2 = F32x8(Threshold[(Triangle.TopLeft >> 2) & 1]);
+		f32x8 DepthA = F32x8(Triangle.DepthA);
+
+		for (i32 Y = MinY; Y <= MaxY; Y++)
+		{
+			f32 PixelY = (f32)(Y - Triangle.MinY) + 0.5f;
+			f32x8 Row0 = F32x8(Triangle.EdgeB[0] * PixelY + Triangle.EdgeC[0]);
+			f32x8 Row1 = F32x8(Triangle.EdgeB[1] * PixelY + Triangle.EdgeC[1]);
+			f32x8 Row2 = F32x8(Triangle.EdgeB[2] * PixelY + Triangle.EdgeC[2]);
+			f32x8 RowDepth = F32x8(Triangle.DepthB * PixelY + Triangle.DepthC);
+
+			f32* DepthRow = &Raster->Depth[Y * Size];
+
+			for (i32 X = MinX; X <= MaxX; X += c_SimdWidth)
+			{
+				f32x8 PixelX = F32x8((f32)(X - Triangle.MinX)) + LaneOffset;
+
+				f32x8 Inside = (MulAdd(EdgeA0, PixelX, Row0) >= Threshold0) & (MulAdd(EdgeA1, PixelX, Row1) >= Threshold1) & (MulAdd(EdgeA2, PixelX, Row2) >= Threshold2);
+				if (!Any(Inside))
+					continue;
+
+				// Depth clip, then LESS_EQUAL
+				f32x8 Depth = MulAdd(DepthA, PixelX, RowDepth);
+				Inside = Inside & (Depth >= Zero) & (Depth <= One);
+
+				f32x8 Current = F32x8Load(DepthRow + X);
+				F32x8Store(DepthRow + X, Select(Inside, Min(Current, Depth), Current));
+			}
+		}
+	}
+}
+
+internal const shadow_raster_stats& ShadowRaster_Render(shadow_rasterizer* Raster)
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto Start = clock::now();
+
+	shadow_raster_stats& Stats = Raster->Stats; // Draws that did not fit are already counted
+	Stats.Triangles = Raster->TriangleCount;
+
+	// 1. Setup
+	Raster->ExtraTriangleCount = 0;
+	JobSystem_ParallelFor(&g_Jobs, Raster->TriangleCount, 16 * 1024, [Raster](u32 Begin, u32 End)
+	{
+		ShadowRaster_SetupTriangles(Raster, Begin, End);
+	});
+
+	u32 ExtraTriangles = Raster->ExtraTriangleCount.load();
+	if (ExtraTriangles > Raster->MaxExtraTriangles)
+	{
+		Stats.DroppedTriangles += ExtraTriangles - Raster->MaxExtraTriangles;
+		ExtraTriangles = Raster->MaxExtraTriangles;
+	}
+
+	u32 TriangleCount = Raster->TriangleCount + ExtraTriangles;
+
+	auto SetupEnd = clock::now();
+
+	// 2. Binning
+	ShadowRaster_BinTriangles(Raster, TriangleCount);
+
+	auto BinEnd = clock::now();
+
+	// 3. Rasterization, a few tiles per job keeps the queue short
+	JobSystem_ParallelFor(&g_Jobs, Raster->TileCount, 4, [Raster](u32 Begin, u32 End)
+	{
+		for (u32 Tile = Begin; Tile < End; Tile++)
+			ShadowRaster_RasterizeTile(Raster, Tile);
+	});
+
+	auto End = clock::now();
+	Stats.SetupMilliseconds = std::chrono::duration<f32, std::milli>(SetupEnd - Start).count();
+	Stats.BinMilliseconds = std::chrono::duration<f32, std::milli>(BinEnd - SetupEnd).count();
+	Stats.RasterMilliseconds = std::chrono::duration<f32, std::milli>(End - BinEnd).count();
+	Stats.TotalMilliseconds = std::chrono::duration<f32, std::milli>(End - Start).count();
+
+	return Stats;
+}
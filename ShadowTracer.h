@@ -0,0 +1,573 @@
+#pragma once
+
+// CPU shadow ray tracer
+// Ground truth for the shadow maps. Traces a shadow ray from every pixel of the software renderer's last frame to every light and
+// writes the same shadow mask SoftwareRenderer_SetShadowMask does, so bias and filter artifacts show up pixel by pixel.
+//
+// Triangles come in as draws over a quad_vertex stream and an index buffer like in the shadow rasterizer, the shadow casters to see
+// what the shadow maps could at best do or the drawn geometry for the ground truth. Back faces block a ray like front faces.
+//
+// The BVH is binary, built top down with binned SAH on the triangle centroids. Triangles are copied into leaf order as a corner and
+// two edges, ready for Möller-Trumbore. Nodes are 32 bytes, the children of an inner node are next to each other.
+//
+// Rays go in packets of 8, a span of the visibility buffer towards one light. Neighboring pixels are close and go the same way,
+// so the packet walks the tree together: a node is opened when any lane that is still looking hits its box and the near child is
+// taken first by the direction of the first of them. A lane stops at its first hit, shadows only ask whether anything is there.
+// Rows are spread over the job system.
+//
+// ShadowTracer_Intersect walks the same tree for the closest hit instead, for bounces that need to know what they hit, see Lightmap.h.
+
+#include "SIMD.h"
+
+inline constexpr u32 c_ShadowTracerBins = 16;
+inline constexpr u32 c_ShadowTracerMaxLeafSize = 8;
+inline constexpr u32 c_ShadowTracerMaxDepth = 48; // Deeper nodes become leaves, bounds the traversal stack
+inline constexpr f32 c_ShadowTracerTraversalCost = 1.0f; // Of a node, relative to a triangle test
+inline constexpr f32 c_ShadowTracerNormalOffset = 0.01f; // Ray origins are moved off the surface along the normal
+
+struct shadow_tracer_node
+{
+	v3 Min;
+	u32 First; // Left child of an inner node, the right one follows it. First triangle of a leaf
+	v3 Max;
+	u16 Count; // Triangles, 0 for inner nodes
+	u16 Axis;  // Split axis of an inner node
+};
+
+struct shadow_tracer_triangle
+{
+	v3 Vertex0;
+	v3 Edge1;
+	v3 Edge2;
+};
+
+struct shadow_tracer_stats
+{
+	u32 Triangles;
+	u32 DroppedTriangles;
+	u32 Nodes;
+	u32 Leaves;
+	u32 Depth;
+	f32 BuildMilliseconds;
+
+	u32 Pixels; // Covered pixels of the last trace
+	u64 Rays;
+	u64 Packets;
+	f32 TraceMilliseconds;
+};
+
+struct shadow_tracer
+{
+	u32 MaxTriangles;
+	u32 TriangleCount;
+	u32 NodeCount;
+
+	// Input
+	const quad_vertex* Vertices;
+	const u32* Indices;
+
+	// Output of the build
+	shadow_tracer_node* Nodes; // 2 * MaxTriangles, root first
+	shadow_tracer_triangle* Triangles; // Leaf order
+
+	// Build
+	shadow_tracer_triangle* Added; // Submission order
+	aabb* Bounds;
+	v3* Centroids;
+	u32* Order; // Leaf order to submission order, kept after the build for ShadowTracer_Intersect
+
+	shadow_tracer_stats Stats;
+};
+
+internal void ShadowTracer_Initialize(shadow_tracer* Tracer, u32 MaxTriangles);
+internal void ShadowTracer_Destroy(shadow_tracer* Tracer);
+
+// Same arguments as the shadow rasterizer, the vertex stream, the index buffer and the draws of the casters
+internal void ShadowTracer_Begin(shadow_tracer* Tracer, const quad_vertex* Vertices, const u32* Indices);
+internal void ShadowTracer_AddDraw(shadow_tracer* Tracer, u32 IndexOffset, u32 IndexCount);
+// Without a vertex stream, Begin can get nullptrs then. False when the tracer is full
+internal bool ShadowTracer_AddTriangle(shadow_tracer* Tracer, v3 P0, v3 P1, v3 P2);
+internal const shadow_tracer_stats& ShadowTracer_Build(shadow_tracer* Tracer);
+
+// Lanes of Active that hit a triangle closer than MaxDistance. Direction has to be normalized
+internal f32x8 ShadowTracer_Occluded(const shadow_tracer* Tracer, const v3x8& Origin, const v3x8& Direction, f32x8 MaxDistance, f32x8 Active);
+
+// Closest hit of the lanes of Active within MaxDistance, returns the lanes that hit something. Distance and the triangle in
+// submission order are only written for those
+internal f32x8 ShadowTracer_Intersect(const shadow_tracer* Tracer, const v3x8& Origin, const v3x8& Direction, f32x8 MaxDistance, f32x8 Active, f32x8* OutDistance, i32x8* OutTriangle);
+
+// Traces the covered pixels of the renderer's last frame to its lights into a mask laid out like SoftwareRenderer_SetShadowMask.
+// Every light is traced, shadowed or not, and every directional light gets its own rays
+internal const shadow_tracer_stats& ShadowTracer_TraceMask(shadow_tracer* Tracer, const software_renderer* Renderer, f32* Mask);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+internal void ShadowTracer_Initialize(shadow_tracer* Tracer, u32 MaxTriangles)
+{
+	Tracer->MaxTriangles = MaxTriangles;
+	Tracer->Nodes = VmAllocArray(shadow_tracer_node, MaxTriangles * 2);
+	Tracer->Triangles = VmAllocArray(shadow_tracer_triangle, MaxTriangles);
+	Tracer->Added = VmAllocArray(shadow_tracer_triangle, MaxTriangles);
+	Tracer->Bounds = VmAllocArray(aabb, MaxTriangles);
+	Tracer->Centroids = VmAllocArray(v3, MaxTriangles);
+	Tracer->Order = VmAllocArray(u32, MaxTriangles);
+}
+
+internal void ShadowTracer_Destroy(shadow_tracer* Tracer)
+{
+	VmFree(Tracer->Nodes);
+	VmFree(Tracer->Triangles);
+	VmFree(Tracer->Added);
+	VmFree(Tracer->Bounds);
+	VmFree(Tracer->Centroids);
+	VmFree(Tracer->Order);
+}
+
+internal void ShadowTracer_Begin(shadow_tracer* Tracer, const quad_vertex* Vertices, const u32* Indices)
+{
+	Tracer->Vertices = Vertices;
+	Tracer->Indices = Indices;
+	Tracer->TriangleCount = 0;
+	Tracer->NodeCount = 0;
+	Tracer->Stats = {};
+}
+
+internal void ShadowTracer_AddDraw(shadow_tracer* Tracer, u32 IndexOffset, u32 IndexCount)
+{
+	for (u32 i = 0; i < IndexCount / 3; i++)
+	{
+		if (Tracer->TriangleCount == Tracer->MaxTriangles)
+		{
+			Tracer->Stats.DroppedTriangles += IndexCount / 3 - i;
+			return;
+		}
+
+		const u32* Index = &Tracer->Indices[IndexOffset + i * 3];
+		ShadowTracer_AddTriangle(Tracer, v3(Tracer->Vertices[Index[0]].Position), v3(Tracer->Vertices[Index[1]].Position), v3(Tracer->Vertices[Index[2]].Position));
+	}
+}
+
+internal bool ShadowTracer_AddTriangle(shadow_tracer* Tracer, v3 P0, v3 P1, v3 P2)
+{
+	if (Tracer->TriangleCount == Tracer->MaxTriangles)
+	{
+		Tracer->Stats.DroppedTriangles++;
+		return false;
+	}
+
+	u32 Slot = Tracer->TriangleCount++;
+	Tracer->Added[Slot] = { P0, P1 - P0, P2 - P0 };
+	Tracer->Bounds[Slot] = { glm::min(P0, glm::min(P1, P2)), glm::max(P0, glm::max(P1, P2)) };
+	Tracer->Centroids[Slot] = (P0 + P1 + P2) * (1.0f / 3.0f);
+	return true;
+}
+
+// Half the surface area, only compared to each other
+inline f32 ShadowTracer_GetArea(const aabb& Box)
+{
+	v3 Extent = glm::max(Box.Max - Box.Min, v3(0.0f));
+	return Extent.x * Extent.y + Extent.y * Extent.z + Extent.z * Extent.x;
+}
+
+inline void ShadowTracer_Grow(aabb* Box, const aabb& Other)
+{
+	Box->Min = glm::min(Box->Min, Other.Min);
+	Box->Max = glm::max(Box->Max, Other.Max);
+}
+
+internal const shadow_tracer_stats& ShadowTracer_Build(shadow_tracer* Tracer)
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto Start = clock::now();
+
+	shadow_tracer_stats& Stats = Tracer->Stats;
+	Stats.Triangles = Tracer->TriangleCount;
+	Stats.Leaves = 0;
+	Stats.Depth = 0;
+
+	for (u32 i = 0; i < Tracer->TriangleCount; i++)
+		Tracer->Order[i] = i;
+
+	struct build_entry
+	{
+		u32 Node;
+		u32 First; // Triangle range in Order
+		u32 Count;
+		u32 Depth;
+	};
+
+	// Depth first, the left child is popped next, so the stack grows by at most one entry per level
+	build_entry Stack[c_ShadowTracerMaxDepth + 2];
+	u32 StackSize = 0;
+
+	Tracer->Nodes[0] = {};
+	Tracer->NodeCount = 1;
+	if (Tracer->TriangleCount > 0)
+		Stack[StackSize++] = { 0, 0, Tracer->TriangleCount, 0 };
+
+	while (StackSize > 0)
+	{
+		build_entry Entry = Stack[--StackSize];
+		shadow_tracer_node& Node = Tracer->Nodes[Entry.Node];
+		const u32 First = Entry.First;
+		const u32 Count = Entry.Count;
+		Stats.Depth = glm::max(Stats.Depth, Entry.Depth);
+
+		aabb Bounds = { v3(FLT_MAX), v3(-FLT_MAX) };
+		aabb CentroidBounds = { v3(FLT_MAX), v3(-FLT_MAX) };
+		for (u32 i = First; i < First + Count; i++)
+		{
+			u32 Triangle = Tracer->Order[i];
+			ShadowTracer_Grow(&Bounds, Tracer->Bounds[Triangle]);
+			ShadowTracer_Grow(&CentroidBounds, { Tracer->Centroids[Triangle], Tracer->Centroids[Triangle] });
+		}
+
+		Node.Min = Bounds.Min;
+		Node.Max = Bounds.Max;
+
+		// Binned SAH over the centroids, along every axis
+		f32 BestCost = FLT_MAX;
+		u32 BestAxis = 0, BestSplit = 0;
+		for (u32 Axis = 0; Axis < 3 && Count > 1; Axis++)
+		{
+			f32 Extent = CentroidBounds.Max[Axis] - CentroidBounds.Min[Axis];
+			if (Extent <= 0.0f)
+				continue;
+
+			aabb BinBounds[c_ShadowTracerBins];
+			u32 BinCounts[c_ShadowTracerBins] = {};
+			for (u32 i = 0; i < c_ShadowTracerBins; i++)
+				BinBounds[i] = { v3(FLT_MAX), v3(-FLT_MAX) };
+
+			f32 Scale = c_ShadowTracerBins / Extent;
+			for (u32 i = First; i < First + Count; i++)
+			{
+				u32 Triangle = Tracer->Order[i];
+				u32 Bin = glm::min((u32)((Tracer->Centroids[Triangle][Axis] - CentroidBounds.Min[Axis]) * Scale), c_ShadowTracerBins - 1);
+				BinCounts[Bin]++;
+				ShadowTracer_Grow(&BinBounds[Bin], Tracer->Bounds[Triangle]);
+			}
+
+			// Split i puts bins [0, i) on the left
+			f32 LeftCosts[c_ShadowTracerBins];
+			aabb Left = { v3(FLT_MAX), v3(-FLT_MAX) };
+			u32 LeftCount = 0;
+			for (u32 i = 1; i < c_ShadowTracerBins; i++)
+			{
+				ShadowTracer_Grow(&Left, BinBounds[i - 1]);
+				LeftCount += BinCounts[i - 1];
+				LeftCosts[i] = LeftCount * ShadowTracer_GetArea(Left);
+			}
+
+			aabb Right = { v3(FLT_MAX), v3(-FLT_MAX) };
+			u32 RightCount = 0;
+			for (u32 i = c_ShadowTracerBins - 1; i > 0; i--)
+			{
+				ShadowTracer_Grow(&Right, BinBounds[i]);
+				RightCount += BinCounts[i];
+				if (RightCount == 0 || RightCount == Count)
+					continue;
+
+				f32 Cost = LeftCosts[i] + RightCount * ShadowTracer_GetArea(Right);
+				if (Cost < BestCost)
+				{
+					BestCost = Cost;
+					BestAxis = Axis;
+					BestSplit = i;
+				}
+			}
+		}
+
+		// Small ranges stay leaves unless splitting is cheaper to trace, large ones are always split
+		f32 Area = ShadowTracer_GetArea(Bounds);
+		bool Split = Count > c_ShadowTracerMaxLeafSize || (BestCost < FLT_MAX && c_ShadowTracerTraversalCost * Area + BestCost < Count * Area);
+		if (Entry.Depth >= c_ShadowTracerMaxDepth || Count < 2)
+			Split = false;
+
+		if (!Split)
+		{
+			Assert(Count <= 0xFFFF, "Shadow tracer leaf is too large!");
+			Node.First = First;
+			Node.Count = (u16)Count;
+			Node.Axis = 0;
+			Stats.Leaves++;
+			continue;
+		}
+
+		u32 Middle = First + Count / 2;
+		if (BestCost < FLT_MAX)
+		{
+			f32 Scale = c_ShadowTracerBins / (CentroidBounds.Max[BestAxis] - CentroidBounds.Min[BestAxis]);
+			Middle = First;
+			for (u32 i = First; i < First + Count; i++)
+			{
+				u32 Triangle = Tracer->Order[i];
+				u32 Bin = glm::min((u32)((Tracer->Centroids[Triangle][BestAxis] - CentroidBounds.Min[BestAxis]) * Scale), c_ShadowTracerBins - 1);
+				if (Bin < BestSplit)
+				{
+					Tracer->Order[i] = Tracer->Order[Middle];
+					Tracer->Order[Middle++] = Triangle;
+				}
+			}
+		}
+		// Otherwise every centroid is in the same place, any half will do
+
+		u32 LeftChild = Tracer->NodeCount;
+		Tracer->NodeCount += 2;
+
+		Node.First = LeftChild;
+		Node.Count = 0;
+		Node.Axis = (u16)BestAxis;
+
+		Stack[StackSize++] = { LeftChild + 1, Middle, First + Count - Middle, Entry.Depth + 1 };
+		Stack[StackSize++] = { LeftChild, First, Middle - First, Entry.Depth + 1 };
+	}
+
+	// Leaf order
+	for (u32 i = 0; i < Tracer->TriangleCount; i++)
+		Tracer->Triangles[i] = Tracer->Added[Tracer->Order[i]];
+
+	Stats.Nodes = Tracer->NodeCount;
+	Stats.BuildMilliseconds = std::chrono::duration<f32, std::milli>(clock::now() - Start).count();
+	return Stats;
+}
+
+internal f32x8 ShadowTracer_Occluded(const shadow_tracer* Tracer, const v3x8& Origin, const v3x8& Direction, f32x8 MaxDistance, f32x8 Active)
+{
+	const f32x8 Zero = F32x8Zero(), One = F32x8(1.0f);
+
+	f32x8 Occluded = Zero;
+	if (Tracer->TriangleCount == 0 || !Any(Active))
+		return Occluded;
+
+	// Axis parallel directions would make 0 * inf in the slab test
+	const f32x8 Epsilon = F32x8(1e-12f);
+	v3x8 InvDirection = {
+		One / Select(Abs(Direction.X) < Epsilon, Epsilon, Direction.X),
+		One / Select(Abs(Direction.Y) < Epsilon, Epsilon, Direction.Y),
+		One / Select(Abs(Direction.Z) < Epsilon, Epsilon, Direction.Z)
+	};
+	const u32 Negative[3] = { MoveMask(Direction.X < Zero), MoveMask(Direction.Y < Zero), MoveMask(Direction.Z < Zero) };
+
+	u32 Stack[c_ShadowTracerMaxDepth + 2];
+	u32 StackSize = 0;
+	Stack[StackSize++] = 0;
+
+	while (StackSize > 0)
+	{
+		const shadow_tracer_node& Node = Tracer->Nodes[Stack[--StackSize]];
+
+		// Slabs
+		f32x8 T0X = (F32x8(Node.Min.x) - Origin.X) * InvDirection.X, T1X = (F32x8(Node.Max.x) - Origin.X) * InvDirection.X;
+		f32x8 T0Y = (F32x8(Node.Min.y) - Origin.Y) * InvDirection.Y, T1Y = (F32x8(Node.Max.y) - Origin.Y) * InvDirection.Y;
+		f32x8 T0Z = (F32x8(Node.Min.z) - Origin.Z) * InvDirection.Z, T1Z = (F32x8(Node.Max.z) - Origin.Z) * InvDirection.Z;
+		f32x8 Near = Max(Max(Min(T0X, T1X), Min(T0Y, T1Y)), Max(Min(T0Z, T1Z), Zero));
+		f32x8 Far = Min(Min(Max(T0X, T1X), Max(T0Y, T1Y)), Min(Max(T0Z, T1Z), MaxDistance));
+
+		f32x8 Hit = Active & (Near <= Far);
+		if (!Any(Hit))
+			continue;
+
+		if (Node.Count == 0)
+		{
+			// Near child on top, the right one when the first lane goes down the split axis
+			u32 RightFirst = (Negative[Node.Axis] >> std::countr_zero(MoveMask(Hit))) & 1;
+			Stack[StackSize++] = Node.First + 1 - RightFirst;
+			Stack[StackSize++] = Node.First + RightFirst;
+			continue;
+		}
+
+		// Möller-Trumbore, one triangle against the lanes of the packet
+		for (u32 i = Node.First; i < Node.First + Node.Count; i++)
+		{
+			const shadow_tracer_triangle& Triangle = Tracer->Triangles[i];
+			v3x8 Edge1 = V3x8(Triangle.Edge1), Edge2 = V3x8(Triangle.Edge2);
+
+			v3x8 P = Cross(Direction, Edge2);
+			f32x8 InvDeterminant = One / Dot(Edge1, P); // Parallel lanes get inf or NaN and fail the tests below
+
+			v3x8 S = Origin - V3x8(Triangle.Vertex0);
+			f32x8 U = Dot(S, P) * InvDeterminant;
+			v3x8 Q = Cross(S, Edge1);
+			f32x8 V = Dot(Direction, Q) * InvDeterminant;
+			f32x8 T = Dot(Edge2, Q) * InvDeterminant;
+
+			f32x8 TriangleHit = Hit & (U >= Zero) & (V >= Zero) & (U + V <= One) & (T > Zero) & (T < MaxDistance);
+			if (!Any(TriangleHit))
+				continue;
+
+			Occluded = Occluded | TriangleHit;
+			Active = AndNot(TriangleHit, Active);
+			Hit = AndNot(TriangleHit, Hit);
+
+			if (!Any(Active))
+				return Occluded;
+		}
+	}
+
+	return Occluded;
+}
+
+internal f32x8 ShadowTracer_Intersect(const shadow_tracer* Tracer, const v3x8& Origin, const v3x8& Direction, f32x8 MaxDistance, f32x8 Active, f32x8* OutDistance, i32x8* OutTriangle)
+{
+	const f32x8 Zero = F32x8Zero(), One = F32x8(1.0f);
+
+	f32x8 Found = Zero;
+	if (Tracer->TriangleCount == 0 || !Any(Active))
+		return Found;
+
+	// Same walk as ShadowTracer_Occluded, but a hit only shortens the lane's ray and the walk goes on until the stack is empty
+	const f32x8 Epsilon = F32x8(1e-12f);
+	v3x8 InvDirection = {
+		One / Select(Abs(Direction.X) < Epsilon, Epsilon, Direction.X),
+		One / Select(Abs(Direction.Y) < Epsilon, Epsilon, Direction.Y),
+		One / Select(Abs(Direction.Z) < Epsilon, Epsilon, Direction.Z)
+	};
+	const u32 Negative[3] = { MoveMask(Direction.X < Zero), MoveMask(Direction.Y < Zero), MoveMask(Direction.Z < Zero) };
+
+	f32x8 Closest = MaxDistance;
+	i32x8 ClosestTriangle = I32x8(-1);
+
+	u32 Stack[c_ShadowTracerMaxDepth + 2];
+	u32 StackSize = 0;
+	Stack[StackSize++] = 0;
+
+	while (StackSize > 0)
+	{
+		const shadow_tracer_node& Node = Tracer->Nodes[Stack[--StackSize]];
+
+		f32x8 T0X = (F32x8(Node.Min.x) - Origin.X) * InvDirection.X, T1X = (F32x8(Node.Max.x) - Origin.X) * InvDirection.X;
+		f32x8 T0Y = (F32x8(Node.Min.y) - Origin.Y) * InvDirection.Y, T1Y = (F32x8(Node.Max.y) - Origin.Y) * InvDirection.Y;
+		f32x8 T0Z = (F32x8(Node.Min.z) - Origin.Z) * InvDirection.Z, T1Z = (F32x8(Node.Max.z) - Origin.Z) * InvDirection.Z;
+		f32x8 Near = Max(Max(Min(T0X, T1X), Min(T0Y, T1Y)), Max(Min(T0Z, T1Z), Zero));
+		f32x8 Far = Min(Min(Max(T0X, T1X), Max(T0Y, T1Y)), Min(Max(T0Z, T1Z), Closest));
+
+		f32x8 Hit = Active & (Near <= Far);
+		if (!Any(Hit))
+			continue;
+
+		if (Node.Count == 0)
+		{
+			u32 RightFirst = (Negative[Node.Axis] >> std::countr_zero(MoveMask(Hit))) & 1;
+			Stack[StackSize++] = Node.First + 1 - RightFirst;
+			Stack[StackSize++] = Node.First + RightFirst;
+			continue;
+		}
+
+		for (u32 i = Node.First; i < Node.First + Node.Count; i++)
+		{
+			const shadow_tracer_triangle& Triangle = Tracer->Triangles[i];
+			v3x8 Edge1 = V3x8(Triangle.Edge1), Edge2 = V3x8(Triangle.Edge2);
+
+			v3x8 P = Cross(Direction, Edge2);
+			f32x8 InvDeterminant = One / Dot(Edge1, P);
+
+			v3x8 S = Origin - V3x8(Triangle.Vertex0);
+			f32x8 U = Dot(S, P) * InvDeterminant;
+			v3x8 Q = Cross(S, Edge1);
+			f32x8 V = Dot(Direction, Q) * InvDeterminant;
+			f32x8 T = Dot(Edge2, Q) * InvDeterminant;
+
+			f32x8 TriangleHit = Hit & (U >= Zero) & (V >= Zero) & (U + V <= One) & (T > Zero) & (T < Closest);
+			if (!Any(TriangleHit))
+				continue;
+
+			Found = Found | TriangleHit;
+			Closest = Select(TriangleHit, T, Closest);
+			ClosestTriangle = AsI32(Select(TriangleHit, AsF32(I32x8((i32)Tracer->Order[i])), AsF32(ClosestTriangle)));
+		}
+	}
+
+	*OutDistance = Closest;
+	*OutTriangle = ClosestTriangle;
+	return Found;
+}
+
+internal const shadow_tracer_stats& ShadowTracer_TraceMask(shadow_tracer* Tracer, const software_renderer* Renderer, f32* Mask)
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto Start = clock::now();
+
+	std::atomic<u32> Pixels = 0;
+	std::atomic<u64> Rays = 0;
+	std::atomic<u64> Packets = 0;
+	JobSystem_ParallelFor(&g_Jobs, (u32)Renderer->Height, 4, [Tracer, Renderer, Mask, &Pixels, &Rays, &Packets](u32 Begin, u32 End)
+	{
+		const i32 Width = Renderer->Width;
+		const u32 PlaneSize = (u32)(Width * Renderer->Height);
+		const light_environment& Lights = Renderer->Lights;
+		const f32x8 Zero = F32x8Zero(), One = F32x8(1.0f), Unreached = F32x8(-1.0f);
+
+		u32 RowPixels = 0;
+		u64 RowRays = 0, RowPackets = 0;
+		auto TraceRays = [Tracer, &RowRays, &RowPackets](const v3x8& Origin, const v3x8& Direction, f32x8 MaxDistance, f32x8 Active)
+		{
+			RowRays += std::popcount(MoveMask(Active));
+			RowPackets++;
+			return ShadowTracer_Occluded(Tracer, Origin, Direction, MaxDistance, Active) & F32x8(1.0f);
+		};
+
+		for (i32 Y = (i32)Begin; Y < (i32)End; Y++)
+		{
+			for (i32 X = 0; X < Width; X += c_SimdWidth)
+			{
+				f32* Out = &Mask[Y * Width + X];
+
+				v3x8 WorldPosition, Normal;
+				f32x8 Covered = SoftwareRenderer_GetSurface(Renderer, X, Y, &WorldPosition, &Normal);
+				if (!Any(Covered))
+				{
+					for (u32 Plane = 0; Plane < SoftwareRenderer_GetShadowMaskPlanes(Lights); Plane++)
+						F32x8Store(Out + Plane * PlaneSize, Unreached);
+					continue;
+				}
+
+				RowPixels += std::popcount(MoveMask(Covered));
+				v3x8 Origin = WorldPosition + Normal * F32x8(c_ShadowTracerNormalOffset);
+
+				for (i32 i = 0; i < Lights.DirectionalLightCount; i++)
+				{
+					v3x8 LightDir = V3x8(glm::normalize(-Lights.DirectionalLight[i].Direction));
+					f32x8 Reaches = Covered & (Dot(Normal, LightDir) > Zero);
+
+					f32x8 Shadow = Any(Reaches) ? TraceRays(Origin, LightDir, F32x8(FLT_MAX), Reaches) : Zero;
+					F32x8Store(Out + i * PlaneSize, Select(Reaches, Shadow, Unreached));
+				}
+
+				// Shadowed fraction of the point lights in range, like the renderer counts them
+				f32x8 PointReached = Zero, PointShadowed = Zero;
+				for (u32 i = 0; i < Renderer->PointLightCount; i++)
+				{
+					const point_light& Light = Renderer->PointLights[i];
+
+					v3x8 ToLight = V3x8(Light.Position) - WorldPosition;
+					f32x8 Reaches = Covered & (Dot(ToLight, ToLight) < F32x8(Light.Radius * Light.Radius)) & (Dot(Normal, ToLight) > Zero);
+					if (!Any(Reaches))
+						continue;
+
+					v3x8 Ray = V3x8(Light.Position) - Origin;
+					f32x8 Distance = Sqrt(Dot(Ray, Ray));
+					PointReached += Reaches & One;
+					PointShadowed += TraceRays(Origin, Ray * (One / Distance), Distance, Reaches);
+				}
+
+				F32x8Store(Out + Lights.DirectionalLightCount * PlaneSize, Select(PointReached > Zero, PointShadowed / Max(PointReached, One), Unreached));
+			}
+		}
+
+		Pixels += RowPixels;
+		Rays += RowRays;
+		Packets += RowPackets;
+	});
+
+	shadow_tracer_stats& Stats = Tracer->Stats;
+	Stats.Pixels = Pixels.load();
+	Stats.Rays = Rays.load();
+	Stats.Packets = Packets.load();
+	Stats.TraceMilliseconds = std::chrono::duration<f32, std::milli>(clock::now() - Start).count();
+	return Stats;
+}
@@ -1,24 +1,151 @@
 #pragma once
 
 #define FIF 2
-inline constexpr u32 c_MaxQuads = 1024;
+inline constexpr u32 c_MaxQuads = 128 * 1024;
 inline constexpr u32 c_MaxQuadVertices = c_MaxQuads * 4;
 inline constexpr u32 c_MaxQuadIndices = c_MaxQuads * 6;
+inline constexpr u32 c_MaxEntities = 64 * 1024;
+inline constexpr u32 c_MaxTransformNodes = 64 * 1024;
+inline constexpr u32 c_MaxShadowCascades = 4;
+inline constexpr u32 c_MaxShadowDraws = 128 * 1024;
+inline constexpr u32 c_MaxPointShadows = 8;       // Point lights past this many do not cast shadows
+inline constexpr u32 c_MaxPointShadowFaces = c_MaxPointShadows * 6;
+inline constexpr f32 c_PointShadowNearPlane = 0.05f; // Far plane is the light radius, same in Quad.hlsl
+inline constexpr f32 c_VoxelOcclusionFloor = 0.5f;   // Light left at a fully occluded block vertex, same in Quad.hlsl
 
 struct quad_vertex
 {
 	v4 Position;
-	v4 Color;
+	v4 Color; // Alpha is the ambient occlusion of block vertices, see ChunkMesher_Build. 1 for everything else
 	v3 Normal;
 };
 
+struct aabb
+{
+	v3 Min;
+	v3 Max;
+};
+
+// World bounds of a transformed box, extents go through the absolute matrix (Arvo)
+inline aabb AABB_Transform(const aabb& Box, const m4& Transform)
+{
+	v3 Center = v3(Transform * v4((Box.Min + Box.Max) * 0.5f, 1.0f));
+	v3 Extents = (Box.Max - Box.Min) * 0.5f;
+
+	v3 WorldExtents = glm::abs(v3(Transform[0])) * Extents.x + glm::abs(v3(Transform[1])) * Extents.y + glm::abs(v3(Transform[2])) * Extents.z;
+	return { Center - WorldExtents, Center + WorldExtents };
+}
+
 struct quad_root_signature_constant_buffer
 {
 	m4 ViewProjection;
 	m4 View;
-	m4 LightSpaceMatrix;
 };
 
+// Matches the shadow_cascades cbuffer in Quad.hlsl
+struct shadow_cascade_constants
+{
+	m4 ViewProjections[c_MaxShadowCascades];
+	v4 SplitFar;  // View depth where each cascade ends
+	v4 DepthBias;
+	v4 TexelSize;  // World units per texel
+	v4 DepthRange; // World units between depth 0 and 1
+	u32 CascadeCount;
+	f32 DepthStepBias; // Depth units, see shadow_cascades
+	f32 UVScale; // Part of a slice the cascades were rendered into
+	u32 _Pad0;
+};
+
+// Shadow filtering, every preset is its own Quad.hlsl permutation (SHADOW_FILTER_* defines), nothing branches at runtime
+enum class shadow_filter : u32
+{
+	Hard = 0,    // One point sampled comparison
+	HardwarePCF, // One comparison sample, the sampler filters 2x2 texels
+	GridPCF,     // Taps x Taps hardware PCF samples a texel apart
+	Poisson,     // Hardware PCF samples on a disk rotated per pixel
+	PCSS,        // Blocker search picks the disk radius per pixel
+	VSM,         // Blurred and mipmapped depth moments, one trilinear fetch and a Chebyshev bound
+	EVSM,        // VSM over exponentially warped depth, positive and negative, far less light bleeding
+
+	COUNT
+};
+
+struct shadow_filter_preset
+{
+	const char* Name;
+	shadow_filter Filter;
+	u32 Taps;          // Grid width, samples on the disk (16 at most), or moment blur taps per direction (odd, 9 at most)
+	f32 Radius;        // Texels, disk radius. PCSS uses it for the blocker search and as the largest filter radius
+	f32 LightSize;     // PCSS only, penumbra width per world unit between blocker and receiver
+	f32 LightBleeding; // Moments only, lower part of the Chebyshev bound that is cut off
+};
+
+// Cheapest first, per pixel
+inline constexpr shadow_filter_preset c_ShadowFilterPresets[] =
+{
+	{ "Hard",        shadow_filter::Hard,        1,  0.0f, 0.0f,  0.0f },
+	{ "PCF 2x2",     shadow_filter::HardwarePCF, 1,  0.0f, 0.0f,  0.0f },
+	{ "VSM 5",       shadow_filter::VSM,         5,  0.0f, 0.0f,  0.3f },
+	{ "EVSM 5",      shadow_filter::EVSM,        5,  0.0f, 0.0f,  0.1f },
+	{ "EVSM 9",      shadow_filter::EVSM,        9,  0.0f, 0.0f,  0.1f },
+	{ "PCF 3x3",     shadow_filter::GridPCF,     3,  0.0f, 0.0f,  0.0f },
+	{ "Poisson 8",   shadow_filter::Poisson,     8,  1.5f, 0.0f,  0.0f },
+	{ "PCF 5x5",     shadow_filter::GridPCF,     5,  0.0f, 0.0f,  0.0f },
+	{ "Poisson 16",  shadow_filter::Poisson,     16, 2.5f, 0.0f,  0.0f },
+	{ "PCSS 16",     shadow_filter::PCSS,        16, 6.0f, 0.04f, 0.0f },
+};
+
+inline constexpr u32 c_ShadowFilterPresetCount = CountOf(c_ShadowFilterPresets);
+inline constexpr u32 c_DefaultShadowFilter = 5; // PCF 3x3
+
+// Same table as c_PoissonDisk in Quad.hlsl
+internal constinit v2 c_ShadowPoissonDisk[16] =
+{
+	v2{ -0.94201624f, -0.39906216f }, v2{ 0.94558609f, -0.76890725f }, v2{ -0.09418410f, -0.92938870f }, v2{ 0.34495938f, 0.29387760f },
+	v2{ -0.91588581f, 0.45771432f }, v2{ -0.81544232f, -0.87912464f }, v2{ -0.38277543f, 0.27676845f }, v2{ 0.97484398f, 0.75648379f },
+	v2{ 0.44323325f, -0.97511554f }, v2{ 0.53742981f, -0.47373420f }, v2{ -0.26496911f, -0.41893023f }, v2{ 0.79197514f, 0.19090188f },
+	v2{ -0.24188840f, 0.99706507f }, v2{ -0.81409955f, 0.91437590f }, v2{ 0.19984126f, 0.78641367f }, v2{ 0.14383161f, -0.14100790f }
+};
+
+// Texture instructions per pixel, PCSS is the worst case (blockers found)
+inline u32 ShadowFilter_GetSampleCount(const shadow_filter_preset& Preset)
+{
+	switch (Preset.Filter)
+	{
+		case shadow_filter::GridPCF: return Preset.Taps * Preset.Taps;
+		case shadow_filter::Poisson: return Preset.Taps;
+		case shadow_filter::PCSS:    return Preset.Taps * 2;
+		default:                     return 1;
+	}
+}
+
+inline bool ShadowFilter_UsesMoments(shadow_filter Filter)
+{
+	return Filter == shadow_filter::VSM || Filter == shadow_filter::EVSM;
+}
+
+// Depth format of the cascades and their static cache
+enum class shadow_depth_format : u32
+{
+	D32, // Float
+	D16, // Unorm, half the memory and bandwidth. Orthographic depth is linear, so a step is the same share of the range everywhere
+};
+
+// Distance between two depths the format can store. Floats near 1 step by 6e-8, far below what the texel bias covers
+inline f32 ShadowDepth_GetStep(shadow_depth_format Format)
+{
+	return Format == shadow_depth_format::D16 ? 1.0f / 65535.0f : 0.0f;
+}
+
+// What the depth target keeps of a depth, unorm rounds to the nearest step
+inline f32 ShadowDepth_Store(f32 Depth, shadow_depth_format Format)
+{
+	if (Format != shadow_depth_format::D16)
+		return Depth;
+
+	return glm::round(glm::clamp(Depth, 0.0f, 1.0f) * 65535.0f) / 65535.0f;
+}
+
 struct shadow_pass_root_signature_constant_buffer
 {
 	m4 LightSpaceMatrix;
@@ -35,7 +162,12 @@ struct camera
 	f32 AspectRatio = 0.0f;
 
 	f32 PerspectiveFOV = glm::pi<f32>() / 2;// bkm::PI_HALF;
-	f32 PerspectiveNear = 0.1f, PerspectiveFar = 1000.0f;
+	f32 PerspectiveNear = 0.1f, PerspectiveFar = 1000.0f; // Far still bounds the shadows and the light clusters with InfiniteFar
+
+	// Reverse Z puts the near plane at depth 1 and the far plane at 0, float depth then keeps its precision in the distance.
+	// Clear to 0 and test GREATER. InfiniteFar only applies to it, nothing is clipped in the distance
+	b32 ReverseZ = false;
+	b32 InfiniteFar = false;
 
 	void RecalculateProjectionOrtho(u32 Width, u32 Height)
 	{
@@ -51,9 +183,36 @@ struct camera
 	{
 		AspectRatio = static_cast<f32>(Width) / Height;
 		Projection = glm::perspectiveLH_ZO(PerspectiveFOV, AspectRatio, PerspectiveNear, PerspectiveFar);
+
+		// Same as bkm::PerspectiveLH_ReverseZ and bkm::InfinitePerspectiveLH_ReverseZ, depth is A + B / z
+		if (ReverseZ)
+		{
+			Projection[2][2] = InfiniteFar ? 0.0f : PerspectiveNear / (PerspectiveNear - PerspectiveFar);
+			Projection[3][2] = InfiniteFar ? PerspectiveNear : PerspectiveFar * PerspectiveNear / (PerspectiveFar - PerspectiveNear);
+		}
 	}
 
 	m4 GetViewProjection() const { return Projection * View; }
+
+	// The CPU rasterizers (occlusion culler, software renderer) clip at z 0 and test LESS. With reverse Z their depth is
+	// w - z, the forward projection with the same planes, or with the far plane at infinity
+	m4 GetForwardViewProjection() const
+	{
+		m4 ViewProjection = GetViewProjection();
+		if (ReverseZ)
+		{
+			for (u32 Column = 0; Column < 4; Column++)
+				ViewProjection[Column][2] = ViewProjection[Column][3] - ViewProjection[Column][2];
+		}
+
+		return ViewProjection;
+	}
+
+	// Height in pixels of an object of WorldSize at Distance from the camera
+	f32 GetProjectedSize(f32 WorldSize, f32 Distance, f32 ViewportHeight) const
+	{
+		return WorldSize * ViewportHeight / (2.0f * glm::tan(PerspectiveFOV * 0.5f) * Distance);
+	}
 };
 
 struct point_light
@@ -65,7 +224,8 @@ struct point_light
 	f32 Radius;
 
 	f32 FallOff;
-	v3 _Pad0;
+	i32 ShadowIndex; // Faces are PointShadowTiles[ShadowIndex * 6 + face], -1 without shadows. Written by PointShadows_AssignTiles
+	v2 _Pad0;
 };
 
 struct directional_light
@@ -76,19 +236,26 @@ struct directional_light
 	f32 _Pad0;
 };
 
+// Point lights are in the light store, the main pass reads them from a structured buffer
 struct light_environment
 {
-	static constexpr u32 MaxPointLights = 64;
 	static constexpr u32 MaxDirectionalLights = 4;
 
 	directional_light DirectionalLight[MaxDirectionalLights];
-	point_light PointLights[MaxPointLights];
-	i32 PointLightCount = 0;
 	i32 DirectionalLightCount = 0;
+	i32 _Pad0[3];
+
+	// Atlas tile per point shadow face, offset and size in UV, size in texels
+	v4 PointShadowTiles[c_MaxPointShadowFaces];
+
+	// Pixel to cluster XY scale, then log2 view depth to cluster Z scale and bias. Written by LightClusters_Build
+	v4 LightClusterScale;
+
+	// World position of the first irradiance probe, then 1 / probe spacing. W is 0 without probes. Written by IrradianceProbes_GetGrid
+	v4 IrradianceProbeGrid;
 
-	inline void Clear() { DirectionalLightCount = PointLightCount = 0; };
+	inline void Clear() { DirectionalLightCount = 0; };
 	inline auto& EmplaceDirectionalLight() { Assert(DirectionalLightCount < MaxDirectionalLights, "Too many directional lights!"); return DirectionalLight[DirectionalLightCount++]; }
-	inline auto& EmplacePointLight() { Assert(PointLightCount < MaxPointLights, "Too many point lights!"); return PointLights[PointLightCount++]; }
 };
 
 // constinit - Ensures that the variable is initialized at compile time
@@ -0,0 +1,1477 @@
+#pragma once
+
+// Software renderer
+// CPU port of the main pass, Quad.hlsl with the Light.hlsl helpers, over the same quad_vertex stream, index buffer and constants.
+// Runs anywhere without a GPU, so the real scene can be rendered headless, compared against goldens and profiled.
+//
+// Rendering is split like a visibility buffer:
+// 1. Setup, VSMain (clip position) for every triangle, near plane clipping, back face culling, edge and depth planes
+// 2. Rasterization, bands of rows in parallel, writes the nearest triangle per pixel (LESS like the main pass)
+// 3. Shading, PSMain for 8 pixels at once. Attributes are interpolated perspective correct from the triangle the pixel ended up with,
+//    so every pixel is shaded exactly once.
+//
+// The shadow map is the cascade array as floats, slice after slice, sampled like g_ShadowMapSampler (point, border 0)
+// and g_ShadowMapComparisonSampler (bilinear LESS_EQUAL compare, border 1). Filter presets are runtime branches here,
+// permutations on the GPU. VSM and EVSM read a shadow_moment_map instead, trilinear with the mip from the UV derivatives.
+// Point light shadows read the shadow atlas, the face is picked per lane and its tile sampled like g_PointShadowSampler
+// (bilinear LESS_EQUAL compare, kept half a texel inside the tile).
+// Virtual shadows replace the cascades when their constants are enabled, page table lookups and fallbacks run per lane.
+// Point lights come packed like the structured buffer and are looped over through the light clusters like on the GPU.
+// A span of 8 pixels loops over the merged lists of all its clusters, the lights a lane's cluster does not have are outside
+// of their radius there and add nothing.
+// With irradiance probes bound, shadows fall to the probes' ambient light instead of black. They are sampled per lane with
+// IrradianceProbes_Sample, the function Quad.hlsl mirrors.
+
+#include "SIMD.h"
+
+inline constexpr i32 c_SoftwareBandHeight = 16;
+inline constexpr u32 c_SoftwareSubpixelSteps = 256;
+inline constexpr u32 c_SoftwareNoTriangle = 0xFFFFFFFF;
+
+// All fields are 4 bytes, shading gathers them by offset
+struct software_triangle
+{
+	// Planes relative to (MinX, MinY), edge i is opposite to corner i
+	f32 EdgeA[3], EdgeB[3], EdgeC[3];
+	f32 DepthA, DepthB, DepthC;
+	f32 InvW[3];       // Of the corners, for perspective correct interpolation
+	f32 Corners[3][3]; // Barycentrics of the corners in the source triangle, near plane clipping moves them
+	u32 Vertices[3];   // Source triangle in the vertex stream
+	i32 MinX, MinY, MaxX, MaxY;
+	u32 TopLeft;
+};
+
+struct software_render_settings
+{
+	v4 ClearColor;
+	b32 EvaluateLights; // Quad.hlsl has the light loops commented out, enable to profile them
+	u32 ShadowFilter;   // Index into c_ShadowFilterPresets, the permutation the main pass is compiled with
+};
+
+struct software_render_stats
+{
+	u32 Triangles;
+	u32 RasterTriangles;
+	u32 DroppedTriangles;
+	u32 ShadedPixels;
+	u64 ShadowSamples; // Shadow map lookups, a 2x2 comparison counts as one like on the GPU
+	u64 PointLightSamples; // Lights in the lists of the shaded pixels, what the GPU loops over
+	f32 SetupMilliseconds;
+	f32 RasterMilliseconds;
+	f32 ShadeMilliseconds;
+	f32 TotalMilliseconds;
+};
+
+struct software_renderer
+{
+	i32 Width; // Multiple of the SIMD width
+	i32 Height;
+	u32 MaxTriangles;
+	u32 MaxExtraTriangles;
+	software_render_settings Settings;
+
+	// Targets, row-major
+	u32* Color; // RGBA8, red in the lowest byte
+	f32* Depth;
+	u32* TriangleIds;
+
+	// Input
+	quad_root_signature_constant_buffer Constants;
+	light_environment Lights;
+	shadow_cascade_constants Cascades;
+	const f32* ShadowMap; // Cascade slices of ShadowMapSize^2
+	i32 ShadowMapSize;
+	const shadow_moment_map* ShadowMoments; // VSM and EVSM presets, built from ShadowMap
+	const f32* ShadowAtlas; // ShadowAtlasSize^2, tiles are in light_environment::PointShadowTiles
+	i32 ShadowAtlasSize;
+	virtual_shadow_constants VirtualShadows;
+	const virtual_shadow_gpu_page* VirtualShadowPages; // c_VirtualShadowTableSize
+	const f32* VirtualShadowPool; // c_VirtualShadowPoolSize^2
+	const point_light* PointLights; // Dense like the light store, see LightStore_Upload
+	u32 PointLightCount;
+	const u32* LightClusters; // light_clusters::Data, every pixel loops over every point light without it
+	const irradiance_probe_gpu* IrradianceProbes; // c_IrradianceProbeCount, light_environment::IrradianceProbeGrid places them
+	f32* ShadowMask; // Optional output, see SoftwareRenderer_SetShadowMask
+	const quad_vertex* Vertices;
+	const u32* Indices;
+
+	// Internal
+	software_triangle* Triangles; // Slot per submitted triangle, then the ones created by near plane clipping
+	u32 TriangleCount;
+	std::atomic<u32> ExtraTriangleCount;
+	i32 BandCount;
+	u32* BandOffsets;
+	u32* BandEntries;
+	u32 MaxBandEntries;
+
+	software_render_stats Stats;
+};
+
+internal void SoftwareRenderer_Initialize(software_renderer* Renderer, i32 Width, i32 Height, u32 MaxTriangles);
+internal void SoftwareRenderer_Destroy(software_renderer* Renderer);
+
+// Same bindings as the main pass
+internal void SoftwareRenderer_SetConstants(software_renderer* Renderer, const quad_root_signature_constant_buffer& Constants, const light_environment& Lights);
+internal void SoftwareRenderer_SetShadowMap(software_renderer* Renderer, const shadow_cascade_constants& Cascades, const f32* ShadowMap, i32 ShadowMapSize);
+internal void SoftwareRenderer_SetShadowMoments(software_renderer* Renderer, const shadow_moment_map* Moments);
+internal void SoftwareRenderer_SetShadowAtlas(software_renderer* Renderer, const f32* Atlas, i32 Size);
+internal void SoftwareRenderer_SetVirtualShadows(software_renderer* Renderer, const virtual_shadow_constants& Constants, const virtual_shadow_gpu_page* Pages, const f32* Pool);
+internal void SoftwareRenderer_SetPointLights(software_renderer* Renderer, const point_light* Lights, u32 Count);
+internal void SoftwareRenderer_SetLightClusters(software_renderer* Renderer, const u32* Clusters);
+internal void SoftwareRenderer_SetIrradianceProbes(software_renderer* Renderer, const irradiance_probe_gpu* Probes); // nullptr turns them off
+
+// Shadows as they were applied, to compare against the ones ShadowTracer_TraceMask traces. nullptr turns it off.
+// A plane of Width * Height per directional light, then one for the point lights. 1 is in shadow, the point plane has the shadowed
+// fraction of the point lights that reach the pixel. -1 where no light of the plane reaches, uncovered, facing away or out of range
+internal void SoftwareRenderer_SetShadowMask(software_renderer* Renderer, f32* Mask);
+inline u32 SoftwareRenderer_GetShadowMaskPlanes(const light_environment& Lights) { return (u32)Lights.DirectionalLightCount + 1; }
+
+// Clears, draws the index range and shades, blocks until done
+internal const software_render_stats& SoftwareRenderer_Render(software_renderer* Renderer, const quad_vertex* Vertices, const u32* Indices, u32 IndexOffset, u32 IndexCount);
+
+// Binary PPM, RGB
+internal bool SoftwareRenderer_WritePPM(const software_renderer* Renderer, const char* Path);
+
+// World position, normalized normal and optionally the vertex color of 8 pixels from X in the last frame's visibility buffer,
+// returns the covered lanes
+internal f32x8 SoftwareRenderer_GetSurface(const software_renderer* Renderer, i32 X, i32 Y, v3x8* WorldPosition, v3x8* Normal, v3x8* Color = nullptr);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+internal void SoftwareRenderer_Initialize(software_renderer* Renderer, i32 Width, i32 Height, u32 MaxTriangles)
+{
+	Assert(Width > 0 && Width % c_SimdWidth == 0 && Height > 0, "Software renderer width has to be a multiple of the SIMD width!");
+
+	Renderer->Width = Width;
+	Renderer->Height = Height;
+	Renderer->MaxTriangles = MaxTriangles;
+	Renderer->MaxExtraTriangles = MaxTriangles / 8;
+	Renderer->Settings.ClearColor = v4(0.2f, 0.3f, 0.8f, 1.0f); // Main pass clear color
+	Renderer->Settings.EvaluateLights = false;
+	Renderer->Settings.ShadowFilter = c_DefaultShadowFilter;
+
+	Renderer->Color = VmAllocArray(u32, Width * Height);
+	Renderer->Depth = VmAllocArray(f32, Width * Height);
+	Renderer->TriangleIds = VmAllocArray(u32, Width * Height);
+	Renderer->Triangles = VmAllocArray(software_triangle, MaxTriangles + Renderer->MaxExtraTriangles);
+
+	Renderer->BandCount = (Height + c_SoftwareBandHeight - 1) / c_SoftwareBandHeight;
+	Renderer->MaxBandEntries = MaxTriangles * 2;
+	Renderer->BandOffsets = VmAllocArray(u32, Renderer->BandCount + 1);
+	Renderer->BandEntries = VmAllocArray(u32, Renderer->MaxBandEntries);
+}
+
+internal void SoftwareRenderer_Destroy(software_renderer* Renderer)
+{
+	VmFree(Renderer->Color);
+	VmFree(Renderer->Depth);
+	VmFree(Renderer->TriangleIds);
+	VmFree(Renderer->Triangles);
+	VmFree(Renderer->BandOffsets);
+	VmFree(Renderer->BandEntries);
+}
+
+internal void SoftwareRenderer_SetConstants(software_renderer* Renderer, const quad_root_signature_constant_buffer& Constants, const light_environment& Lights)
+{
+	Renderer->Constants = Constants;
+	Renderer->Lights = Lights;
+}
+
+internal void SoftwareRenderer_SetShadowMap(software_renderer* Renderer, const shadow_cascade_constants& Cascades, const f32* ShadowMap, i32 ShadowMapSize)
+{
+	Renderer->Cascades = Cascades;
+	Renderer->ShadowMap = ShadowMap;
+	Renderer->ShadowMapSize = ShadowMapSize;
+}
+
+internal void SoftwareRenderer_SetShadowMoments(software_renderer* Renderer, const shadow_moment_map* Moments)
+{
+	Renderer->ShadowMoments = Moments;
+}
+
+internal void SoftwareRenderer_SetShadowAtlas(software_renderer* Renderer, const f32* Atlas, i32 Size)
+{
+	Renderer->ShadowAtlas = Atlas;
+	Renderer->ShadowAtlasSize = Size;
+}
+
+internal void SoftwareRenderer_SetVirtualShadows(software_renderer* Renderer, const virtual_shadow_constants& Constants, const virtual_shadow_gpu_page* Pages, const f32* Pool)
+{
+	Renderer->VirtualShadows = Constants;
+	Renderer->VirtualShadowPages = Pages;
+	Renderer->VirtualShadowPool = Pool;
+}
+
+internal void SoftwareRenderer_SetPointLights(software_renderer* Renderer, const point_light* Lights, u32 Count)
+{
+	Renderer->PointLights = Lights;
+	Renderer->PointLightCount = Count;
+}
+
+internal void SoftwareRenderer_SetLightClusters(software_renderer* Renderer, const u32* Clusters)
+{
+	Renderer->LightClusters = Clusters;
+}
+
+internal void SoftwareRenderer_SetIrradianceProbes(software_renderer* Renderer, const irradiance_probe_gpu* Probes)
+{
+	Renderer->IrradianceProbes = Probes;
+}
+
+internal void SoftwareRenderer_SetShadowMask(software_renderer* Renderer, f32* Mask)
+{
+	Renderer->ShadowMask = Mask;
+}
+
+// Setup
+
+struct software_clip_vertex
+{
+	v4 Clip;
+	v3 Barycentric;
+};
+
+internal bool SoftwareRenderer_SetupTriangle(const software_renderer* Renderer, const software_clip_vertex* Corners, const u32* Vertices, software_triangle* Triangle)
+{
+	const f32 Steps = (f32)c_SoftwareSubpixelSteps;
+
+	f32 X[3], Y[3], Z[3], InvW[3];
+	for (u32 i = 0; i < 3; i++)
+	{
+		InvW[i] = 1.0f / Corners[i].Clip.w;
+		X[i] = glm::floor((Corners[i].Clip.x * InvW[i] * 0.5f + 0.5f) * Renderer->Width * Steps + 0.5f) / Steps;
+		Y[i] = glm::floor((0.5f - Corners[i].Clip.y * InvW[i] * 0.5f) * Renderer->Height * Steps + 0.5f) / Steps;
+		Z[i] = Corners[i].Clip.z * InvW[i];
+	}
+
+	// Main pass culls back faces, clockwise on screen is front facing
+	f32 Area = (X[1] - X[0]) * (Y[2] - Y[0]) - (X[2] - X[0]) * (Y[1] - Y[0]);
+	if (Area <= 0.0f)
+		return false;
+
+	i32 MinX = glm::max((i32)glm::ceil(glm::min(X[0], glm::min(X[1], X[2])) - 0.5f), 0);
+	i32 MinY = glm::max((i32)glm::ceil(glm::min(Y[0], glm::min(Y[1], Y[2])) - 0.5f), 0);
+	i32 MaxX = glm::min((i32)glm::floor(glm::max(X[0], glm::max(X[1], X[2])) - 0.5f), Renderer->Width - 1);
+	i32 MaxY = glm::min((i32)glm::floor(glm::max(Y[0], glm::max(Y[1], Y[2])) - 0.5f), Renderer->Height - 1);
+
+	if (MinX > MaxX || MinY > MaxY)
+		return false;
+
+	Triangle->TopLeft = 0;
+	for (u32 i = 0; i < 3; i++)
+	{
+		u32 From = (i + 1) % 3, To = (i + 2) % 3;
+		f32 A = -(Y[To] - Y[From]);
+		f32 B = X[To] - X[From];
+
+		Triangle->EdgeA[i] = A;
+		Triangle->EdgeB[i] = B;
+		Triangle->EdgeC[i] = -(A * (X[From] - MinX) + B * (Y[From] - MinY));
+
+		if (A > 0.0f || (A == 0.0f && B > 0.0f))
+			Triangle->TopLeft |= 1u << i;
+
+		Triangle->InvW[i] = InvW[i];
+		Triangle->Vertices[i] = Vertices[i];
+		for (u32 j = 0; j < 3; j++)
+			Triangle->Corners[i][j] = Corners[i].Barycentric[j];
+	}
+
+	f32 InvArea = 1.0f / Area;
+	f32 DZ1 = Z[1] - Z[0], DZ2 = Z[2] - Z[0];
+	Triangle->DepthA = (DZ1 * (Y[2] - Y[0]) - DZ2 * (Y[1] - Y[0])) * InvArea;
+	Triangle->DepthB = (DZ2 * (X[1] - X[0]) - DZ1 * (X[2] - X[0])) * InvArea;
+	Triangle->DepthC = Z[0] - Triangle->DepthA * (X[0] - MinX) - Triangle->DepthB * (Y[0] - MinY);
+
+	Triangle->MinX = MinX;
+	Triangle->MinY = MinY;
+	Triangle->MaxX = MaxX;
+	Triangle->MaxY = MaxY;
+	return true;
+}
+
+// Clips against the near plane (z >= 0 in clip space), the far plane is clipped per pixel
+internal void SoftwareRenderer_AddTriangle(software_renderer* Renderer, const u32* Vertices, software_triangle* Slot)
+{
+	const m4& ViewProjection = Renderer->Constants.ViewProjection;
+
+	software_clip_vertex Input[3];
+	for (u32 i = 0; i < 3; i++)
+	{
+		// VSMain
+		Input[i].Clip = ViewProjection * Renderer->Vertices[Vertices[i]].Position;
+		Input[i].Barycentric = v3(0.0f);
+		Input[i].Barycentric[i] = 1.0f;
+	}
+
+	Slot->MinX = 0;
+	Slot->MaxX = -1;
+
+	const v4& A = Input[0].Clip;
+	const v4& B = Input[1].Clip;
+	const v4& C = Input[2].Clip;
+	if ((A.x > A.w && B.x > B.w && C.x > C.w) || (A.x < -A.w && B.x < -B.w && C.x < -C.w) ||
+		(A.y > A.w && B.y > B.w && C.y > C.w) || (A.y < -A.w && B.y < -B.w && C.y < -C.w) ||
+		(A.z > A.w && B.z > B.w && C.z > C.w) || (A.z < 0.0f && B.z < 0.0f && C.z < 0.0f))
+		return;
+
+	if (A.z >= 0.0f && B.z >= 0.0f && C.z >= 0.0f)
+	{
+		SoftwareRenderer_SetupTriangle(Renderer, Input, Vertices, Slot);
+		return;
+	}
+
+	software_clip_vertex Polygon[4];
+	u32 Count = 0;
+
+	for (u32 i = 0; i < 3; i++)
+	{
+		const software_clip_vertex& Current = Input[i];
+		const software_clip_vertex& Next = Input[(i + 1) % 3];
+
+		if (Current.Clip.z >= 0.0f)
+			Polygon[Count++] = Current;
+
+		if ((Current.Clip.z >= 0.0f) != (Next.Clip.z >= 0.0f))
+		{
+			f32 T = Current.Clip.z / (Current.Clip.z - Next.Clip.z);
+			Polygon[Count++] = { Current.Clip + (Next.Clip - Current.Clip) * T, Current.Barycentric + (Next.Barycentric - Current.Barycentric) * T };
+		}
+	}
+
+	software_clip_vertex First[3] = { Polygon[0], Polygon[1], Polygon[2] };
+	SoftwareRenderer_SetupTriangle(Renderer, First, Vertices, Slot);
+
+	if (Count == 4)
+	{
+		u32 Extra = Renderer->ExtraTriangleCount.fetch_add(1);
+		if (Extra >= Renderer->MaxExtraTriangles)
+			return;
+
+		software_clip_vertex Second[3] = { Polygon[0], Polygon[2], Polygon[3] };
+		software_triangle* ExtraSlot = &Renderer->Triangles[Renderer->TriangleCount + Extra];
+		if (!SoftwareRenderer_SetupTriangle(Renderer, Second, Vertices, ExtraSlot))
+		{
+			ExtraSlot->MinX = 0;
+			ExtraSlot->MaxX = -1;
+		}
+	}
+}
+
+// Rasterization
+
+internal void SoftwareRenderer_BinTriangles(software_renderer* Renderer, u32 TriangleCount)
+{
+	software_render_stats& Stats = Renderer->Stats;
+	const i32 BandCount = Renderer->BandCount;
+	u32* Offsets = Renderer->BandOffsets;
+	memset(Offsets, 0, sizeof(u32) * (BandCount + 1));
+
+	// Count into Offsets[Band + 1], drop the triangles that would not fit
+	u32 TotalEntries = 0;
+	for (u32 i = 0; i < TriangleCount; i++)
+	{
+		software_triangle& Triangle = Renderer->Triangles[i];
+		if (Triangle.MinX > Triangle.MaxX)
+			continue;
+
+		i32 First = Triangle.MinY / c_SoftwareBandHeight, Last = Triangle.MaxY / c_SoftwareBandHeight;
+		if (TotalEntries + (Last - First + 1) > Renderer->MaxBandEntries)
+		{
+			Triangle.MaxX = -1;
+			Stats.DroppedTriangles++;
+			continue;
+		}
+
+		TotalEntries += Last - First + 1;
+		Stats.RasterTriangles++;
+		for (i32 Band = First; Band <= Last; Band++)
+			Offsets[Band + 1]++;
+	}
+
+	for (i32 Band = 0; Band < BandCount; Band++)
+		Offsets[Band + 1] += Offsets[Band];
+
+	// Fill, submission order is kept inside of a band so equal depths resolve like on the GPU
+	u32 Cursors[4096 / c_SoftwareBandHeight];
+	Assert(BandCount <= (i32)(CountOf(Cursors)), "Software render target is too tall!");
+	memcpy(Cursors, Offsets, sizeof(u32) * BandCount);
+
+	for (u32 i = 0; i < TriangleCount; i++)
+	{
+		const software_triangle& Triangle = Renderer->Triangles[i];
+		if (Triangle.MinX > Triangle.MaxX)
+			continue;
+
+		for (i32 Band = Triangle.MinY / c_SoftwareBandHeight; Band <= Triangle.MaxY / c_SoftwareBandHeight; Band++)
+			Renderer->BandEntries[Cursors[Band]++] = i;
+	}
+}
+
+internal void SoftwareRenderer_RasterizeBand(software_renderer* Renderer, i32 Band)
+{
+	const i32 Width = Renderer->Width;
+	const i32 BandY0 = Band * c_SoftwareBandHeight;
+	const i32 BandY1 = glm::min(BandY0 + c_SoftwareBandHeight, Renderer->Height) - 1;
+
+	for (i32 i = BandY0 * Width; i < (BandY1 + 1) * Width; i += c_SimdWidth)
+	{
+		F32x8Store(Renderer->Depth + i, F32x8(1.0f));
+		I32x8Store((i32*)Renderer->TriangleIds + i, I32x8((i32)c_SoftwareNoTriangle));
+	}
+
+	const f32x8 LaneOffset = F32x8LaneIndex() + F32x8(0.5f);
+	const f32x8 Zero = F32x8Zero();
+	const f32 Threshold[2] = { FLT_TRUE_MIN, 0.0f }; // Top-left rule, see ShadowRaster.h
+
+	for (u32 Entry = Renderer->BandOffsets[Band]; Entry < Renderer->BandOffsets[Band + 1]; Entry++)
+	{
+		u32 TriangleIndex = Renderer->BandEntries[Entry];
+		const software_triangle& Triangle = Renderer->Triangles[TriangleIndex];
+
+		i32 MinY = glm::max(Triangle.MinY, BandY0);
+		i32 MaxY = glm::min(Triangle.MaxY, BandY1);
+		i32 MinX = Triangle.MinX & ~(i32)(c_SimdWidth - 1);
+
+		f32x8 EdgeA0 = F32x8(Triangle.EdgeA[0]), EdgeA1 = F32x8(Triangle.EdgeA[1]), EdgeA2 = F32x8(Triangle.EdgeA[2]);
+		f32x8 Threshold0 = F32x8(Threshold[Triangle.TopLeft & 1]);
+		f32x8 Threshold1 = F32x8(Threshold[(Triangle.TopLeft >> 1) & 1]);
+		f32x8 Threshold2 = F32x8(Threshold[(Triangle.TopLeft >> 2) & 1]);
+		f32x8 DepthA = F32x8(Triangle.DepthA);
+		i32x8 Id = I32x8((i32)TriangleIndex);
+
+		for (i32 Y = MinY; Y <= MaxY; Y++)
+		{
+			f32 PixelY = (f32)(Y - Triangle.MinY) + 0.5f;
+			f32x8 Row0 = F32x8(Triangle.EdgeB[0] * PixelY + Triangle.EdgeC[0]);
+			f32x8 Row1 = F32x8(Triangle.EdgeB[1] * PixelY + Triangle.EdgeC[1]);
+			f32x8 Row2 = F32x8(Triangle.EdgeB[2] * PixelY + Triangle.EdgeC[2]);
+			f32x8 RowDepth = F32x8(Triangle.DepthB * PixelY + Triangle.DepthC);
+
+			f32* DepthRow = &Renderer->Depth[Y * Width];
+			i32* IdRow = (i32*)&Renderer->TriangleIds[Y * Width];
+
+			for (i32 X = MinX; X <= Triangle.MaxX; X += c_SimdWidth)
+			{
+				f32x8 PixelX = F32x8((f32)(X - Triangle.MinX)) + LaneOffset;
+
+				f32x8 Inside = (MulAdd(EdgeA0, PixelX, Row0) >= Threshold0) & (MulAdd(EdgeA1, PixelX, Row1) >= Threshold1) & (MulAdd(EdgeA2, PixelX, Row2) >= Threshold2);
+				if (!Any(Inside))
+					continue;
+
+				// Depth clip, then LESS
+				f32x8 Depth = MulAdd(DepthA, PixelX, RowDepth);
+				f32x8 Current = F32x8Load(DepthRow + X);
+				Inside = Inside & (Depth >= Zero) & (Depth < Current);
+
+				F32x8Store(DepthRow + X, Select(Inside, Depth, Current));
+				I32x8Store(IdRow + X, AsI32(Select(Inside, AsF32(Id), AsF32(I32x8Load(IdRow + X)))));
+			}
+		}
+	}
+}
+
+// Shading
+
+inline v3x8 SoftwareRenderer_Normalize(const v3x8& V)
+{
+	f32x8 InvLength = F32x8(1.0f) / Sqrt(Dot(V, V));
+	return V * InvLength;
+}
+
+inline v3x8 SoftwareRenderer_Gather(const f32* Base, i32x8 Indices)
+{
+	return { Gather(Base, Indices), Gather(Base + 1, Indices), Gather(Base + 2, Indices) };
+}
+
+// Depth of one texel per lane, lanes outside the map get the border color
+inline f32x8 SoftwareRenderer_FetchShadowTexel(const software_renderer* Renderer, i32x8 Slice, f32x8 TexelX, f32x8 TexelY, f32 Border)
+{
+	const f32x8 Zero = F32x8Zero();
+	const f32 Size = (f32)Renderer->ShadowMapSize;
+	f32x8 InBounds = (TexelX >= Zero) & (TexelX < F32x8(Size)) & (TexelY >= Zero) & (TexelY < F32x8(Size));
+
+	i32x8 TexelIndex = Slice + ConvertToI32(TexelY) * I32x8(Renderer->ShadowMapSize) + ConvertToI32(TexelX);
+	TexelIndex = AsI32(Select(InBounds, AsF32(TexelIndex), Zero));
+	return Select(InBounds, Gather(Renderer->ShadowMap, TexelIndex), F32x8(Border));
+}
+
+// g_ShadowMapSampler, point and border 0
+inline f32x8 SoftwareRenderer_SampleShadowPoint(const software_renderer* Renderer, i32x8 Slice, f32x8 U, f32x8 V)
+{
+	const f32 Size = (f32)Renderer->ShadowMapSize;
+	return SoftwareRenderer_FetchShadowTexel(Renderer, Slice, Floor(U * F32x8(Size)), Floor(V * F32x8(Size)), 0.0f);
+}
+
+// SampleShadowPCF, g_ShadowMapComparisonSampler is LESS_EQUAL on the 2x2 texels around UV, bilinear weights, border 1
+internal f32x8 SoftwareRenderer_SampleShadowPCF(const software_renderer* Renderer, i32x8 Slice, f32x8 U, f32x8 V, f32x8 Reference)
+{
+	const f32 Size = (f32)Renderer->ShadowMapSize;
+	const f32x8 One = F32x8(1.0f);
+
+	f32x8 X = MulAdd(U, F32x8(Size), F32x8(-0.5f));
+	f32x8 Y = MulAdd(V, F32x8(Size), F32x8(-0.5f));
+	f32x8 X0 = Floor(X), Y0 = Floor(Y);
+	f32x8 FracX = X - X0, FracY = Y - Y0;
+	f32x8 X1 = X0 + One, Y1 = Y0 + One;
+
+	f32x8 Lit00 = (Reference <= SoftwareRenderer_FetchShadowTexel(Renderer, Slice, X0, Y0, 1.0f)) & One;
+	f32x8 Lit10 = (Reference <= SoftwareRenderer_FetchShadowTexel(Renderer, Slice, X1, Y0, 1.0f)) & One;
+	f32x8 Lit01 = (Reference <= SoftwareRenderer_FetchShadowTexel(Renderer, Slice, X0, Y1, 1.0f)) & One;
+	f32x8 Lit11 = (Reference <= SoftwareRenderer_FetchShadowTexel(Renderer, Slice, X1, Y1, 1.0f)) & One;
+
+	return Lerp(Lerp(Lit00, Lit10, FracX), Lerp(Lit01, Lit11, FracX), FracY);
+}
+
+// PoissonRotation, (Cos, -Sin, Sin, Cos) per lane
+internal void SoftwareRenderer_PoissonRotation(f32x8 PixelX, f32x8 PixelY, f32x8* Cos, f32x8* Sin)
+{
+	f32x8 Dot = MulAdd(PixelX, F32x8(0.06711056f), PixelY * F32x8(0.00583715f));
+	f32x8 Inner = Dot - Floor(Dot);
+	f32x8 Noise = F32x8(52.9829189f) * Inner;
+	Noise = Noise - Floor(Noise);
+
+	alignas(32) f32 Angles[c_SimdWidth], Cosines[c_SimdWidth], Sines[c_SimdWidth];
+	F32x8Store(Angles, Noise * F32x8(6.2831853f));
+	for (u32 i = 0; i < c_SimdWidth; i++)
+	{
+		Cosines[i] = std::cos(Angles[i]);
+		Sines[i] = std::sin(Angles[i]);
+	}
+
+	*Cos = F32x8Load(Cosines);
+	*Sin = F32x8Load(Sines);
+}
+
+// SamplePoissonPCF, Radius is in UV
+internal f32x8 SoftwareRenderer_SamplePoissonPCF(const software_renderer* Renderer, i32x8 Slice, f32x8 U, f32x8 V, f32x8 Reference, f32x8 Cos, f32x8 Sin, f32x8 Radius, u32 Taps)
+{
+	f32x8 Lit = F32x8Zero();
+	for (u32 i = 0; i < Taps; i++)
+	{
+		f32x8 DiskX = F32x8(c_ShadowPoissonDisk[i].x), DiskY = F32x8(c_ShadowPoissonDisk[i].y);
+		f32x8 OffsetU = (Cos * DiskX - Sin * DiskY) * Radius;
+		f32x8 OffsetV = (Sin * DiskX + Cos * DiskY) * Radius;
+		Lit = Lit + SoftwareRenderer_SampleShadowPCF(Renderer, Slice, U + OffsetU, V + OffsetV, Reference);
+	}
+
+	return Lit * F32x8(1.0f / Taps);
+}
+
+// ChebyshevUpperBound from ShadowMoments.hlsl
+inline f32x8 SoftwareRenderer_ChebyshevUpperBound(f32x8 Moment1, f32x8 Moment2, f32x8 Mean, f32x8 MinVariance, f32 LightBleeding)
+{
+	f32x8 Variance = Max(Moment2 - Moment1 * Moment1, MinVariance);
+	f32x8 Distance = Mean - Moment1;
+	f32x8 PMax = Variance / MulAdd(Distance, Distance, Variance);
+	PMax = Clamp((PMax - F32x8(LightBleeding)) * F32x8(1.0f / (1.0f - LightBleeding)), F32x8Zero(), F32x8(1.0f));
+	return Select(Mean <= Moment1, F32x8(1.0f), PMax);
+}
+
+// ShadowMomentsLit
+internal f32x8 SoftwareRenderer_ShadowMomentsLit(const f32x8 Moments[4], f32x8 Depth, shadow_filter Filter, f32 LightBleeding)
+{
+	if (Filter == shadow_filter::EVSM)
+	{
+		alignas(32) f32 Depths[c_SimdWidth], Positives[c_SimdWidth], Negatives[c_SimdWidth];
+		F32x8Store(Depths, Depth);
+		for (u32 i = 0; i < c_SimdWidth; i++)
+		{
+			v4 Warped = ShadowMoments_FromDepth(Depths[i], Filter);
+			Positives[i] = Warped.x;
+			Negatives[i] = Warped.z;
+		}
+
+		f32x8 Positive = F32x8Load(Positives), Negative = F32x8Load(Negatives);
+		f32x8 PositiveScale = Positive * F32x8(c_EVSMMinVarianceScale * c_EVSMPositiveExponent);
+		f32x8 NegativeScale = Negative * F32x8(c_EVSMMinVarianceScale * c_EVSMNegativeExponent);
+
+		f32x8 PositiveLit = SoftwareRenderer_ChebyshevUpperBound(Moments[0], Moments[1], Positive, PositiveScale * PositiveScale, LightBleeding);
+		f32x8 NegativeLit = SoftwareRenderer_ChebyshevUpperBound(Moments[2], Moments[3], Negative, NegativeScale * NegativeScale, LightBleeding);
+		return Min(PositiveLit, NegativeLit);
+	}
+
+	return SoftwareRenderer_ChebyshevUpperBound(Moments[0], Moments[1], Depth, F32x8(c_ShadowMomentMinVariance), LightBleeding);
+}
+
+// Mip the sampler picks from the screen space UV derivatives, log2 of the longer footprint axis in texels
+internal f32x8 SoftwareRenderer_ShadowMomentLod(f32x8 DUDX, f32x8 DVDX, f32x8 DUDY, f32x8 DVDY, i32 Size)
+{
+	f32x8 LengthX = MulAdd(DUDX, DUDX, DVDX * DVDX);
+	f32x8 LengthY = MulAdd(DUDY, DUDY, DVDY * DVDY);
+	f32x8 Footprint = Max(LengthX, LengthY) * F32x8((f32)Size * (f32)Size);
+
+	alignas(32) f32 Lods[c_SimdWidth];
+	F32x8Store(Lods, Footprint);
+	for (u32 i = 0; i < c_SimdWidth; i++)
+		Lods[i] = Lods[i] > 0.0f ? 0.5f * std::log2(Lods[i]) : 0.0f;
+
+	return F32x8Load(Lods);
+}
+
+// ShadowCalculation from Quad.hlsl for the selected filter preset, 1 is in shadow
+// Samples is the number of shadow map lookups per lane, to compare the cost of the presets
+// WorldDerivatives are ddx and ddy of the world position, only the moment presets read them
+internal f32x8 SoftwareRenderer_ShadowCalculation(const software_renderer* Renderer, const v3x8& WorldPosition, const v3x8* WorldDerivatives, f32x8 ViewDepth, const directional_light& Light, const v3x8& Normal, f32x8 PixelX, f32x8 PixelY, f32x8* Samples)
+{
+	const shadow_cascade_constants& Cascades = Renderer->Cascades;
+	const shadow_filter_preset& Preset = c_ShadowFilterPresets[Renderer->Settings.ShadowFilter];
+	const f32x8 Zero = F32x8Zero();
+	const f32x8 One = F32x8(1.0f);
+
+	*Samples = Zero;
+	if (Cascades.CascadeCount == 0 || !Renderer->ShadowMap)
+		return Zero;
+
+	// SelectCascade
+	i32x8 Cascade = I32x8(0);
+	for (u32 i = 0; i + 1 < Cascades.CascadeCount; i++)
+		Cascade = Cascade - AsI32(ViewDepth > F32x8(Cascades.SplitFar[i])); // Mask is -1
+
+	f32x8 PastLast = ViewDepth > F32x8(Cascades.SplitFar[Cascades.CascadeCount - 1]);
+
+	// Every cascade transforms all lanes, then each lane picks its own
+	const bool UsesMoments = ShadowFilter_UsesMoments(Preset.Filter) && Renderer->ShadowMoments && WorldDerivatives;
+
+	f32x8 ShadowX = Zero, ShadowY = Zero, ShadowZ = Zero, DepthBias = Zero, TexelSize = One, DepthRange = Zero;
+	f32x8 ShadowDerivatives[2][2] = {}; // [ddx, ddy][x, y] in NDC
+	for (u32 i = 0; i < Cascades.CascadeCount; i++)
+	{
+		f32x8 X, Y, Z, W;
+		TransformPoints(Cascades.ViewProjections[i], WorldPosition, &X, &Y, &Z, &W);
+
+		f32x8 Selected = AsF32(Cascade == I32x8((i32)i));
+		if (UsesMoments)
+		{
+			for (u32 Axis = 0; Axis < 2; Axis++)
+			{
+				f32x8 NeighborX, NeighborY, NeighborZ, NeighborW;
+				TransformPoints(Cascades.ViewProjections[i], WorldPosition + WorldDerivatives[Axis], &NeighborX, &NeighborY, &NeighborZ, &NeighborW);
+				ShadowDerivatives[Axis][0] = Select(Selected, NeighborX - X, ShadowDerivatives[Axis][0]);
+				ShadowDerivatives[Axis][1] = Select(Selected, NeighborY - Y, ShadowDerivatives[Axis][1]);
+			}
+		}
+
+		ShadowX = Select(Selected, X, ShadowX);
+		ShadowY = Select(Selected, Y, ShadowY);
+		ShadowZ = Select(Selected, Z, ShadowZ);
+		DepthBias = Select(Selected, F32x8(Cascades.DepthBias[i]), DepthBias);
+		TexelSize = Select(Selected, F32x8(Cascades.TexelSize[i]), TexelSize);
+		DepthRange = Select(Selected, F32x8(Cascades.DepthRange[i]), DepthRange);
+	}
+
+	// Orthographic, no perspective divide. NDC y points up, texture v points down
+	const f32 UVScale = Cascades.UVScale;
+	f32x8 U = MulAdd(ShadowX, F32x8(0.5f * UVScale), F32x8(0.5f * UVScale));
+	f32x8 V = MulAdd(ShadowY, F32x8(-0.5f * UVScale), F32x8(0.5f * UVScale));
+	f32x8 CurrentDepth = ShadowZ - F32x8(Cascades.DepthStepBias);
+
+	i32x8 Slice = Cascade * I32x8(Renderer->ShadowMapSize * Renderer->ShadowMapSize);
+	const f32 Texel = 1.0f / (f32)Renderer->ShadowMapSize;
+
+	// Bias is about a texel of the cascade, grazing angles need more
+	v3x8 LightDir = V3x8(glm::normalize(-Light.Direction));
+	f32x8 Bias = DepthBias * MulAdd(F32x8(2.0f), One - Clamp(Dot(Normal, LightDir), Zero, One), One);
+
+	f32x8 Shadow;
+	switch (Preset.Filter)
+	{
+		case shadow_filter::Hard:
+		{
+			f32x8 ClosestDepth = SoftwareRenderer_SampleShadowPoint(Renderer, Slice, U, V);
+			Shadow = (CurrentDepth - Bias > ClosestDepth) & One;
+			*Samples = One;
+			break;
+		}
+		case shadow_filter::HardwarePCF:
+		{
+			Shadow = One - SoftwareRenderer_SampleShadowPCF(Renderer, Slice, U, V, CurrentDepth - Bias * F32x8(1.5f));
+			*Samples = One;
+			break;
+		}
+		case shadow_filter::GridPCF:
+		{
+			const i32 Half = (i32)Preset.Taps / 2;
+			f32x8 Reference = CurrentDepth - Bias * F32x8(1.5f + Half);
+			f32x8 Lit = Zero;
+
+			for (i32 Y = -Half; Y <= Half; Y++)
+			{
+				for (i32 X = -Half; X <= Half; X++)
+					Lit = Lit + SoftwareRenderer_SampleShadowPCF(Renderer, Slice, U + F32x8(X * Texel), V + F32x8(Y * Texel), Reference);
+			}
+
+			Shadow = One - Lit * F32x8(1.0f / (Preset.Taps * Preset.Taps));
+			*Samples = F32x8((f32)(Preset.Taps * Preset.Taps));
+			break;
+		}
+		case shadow_filter::Poisson:
+		{
+			f32x8 Cos, Sin;
+			SoftwareRenderer_PoissonRotation(PixelX, PixelY, &Cos, &Sin);
+
+			f32x8 Reference = CurrentDepth - Bias * F32x8(1.5f + Preset.Radius);
+			Shadow = One - SoftwareRenderer_SamplePoissonPCF(Renderer, Slice, U, V, Reference, Cos, Sin, F32x8(Preset.Radius * Texel), Preset.Taps);
+			*Samples = F32x8((f32)Preset.Taps);
+			break;
+		}
+		case shadow_filter::PCSS:
+		{
+			f32x8 Cos, Sin;
+			SoftwareRenderer_PoissonRotation(PixelX, PixelY, &Cos, &Sin);
+
+			// Blocker search, average depth of whatever is in front of the receiver
+			f32x8 SearchReference = CurrentDepth - Bias * F32x8(1.5f + Preset.Radius);
+			f32x8 SearchRadius = F32x8(Preset.Radius * Texel);
+			f32x8 BlockerDepth = Zero, BlockerCount = Zero;
+			for (u32 i = 0; i < Preset.Taps; i++)
+			{
+				f32x8 DiskX = F32x8(c_ShadowPoissonDisk[i].x), DiskY = F32x8(c_ShadowPoissonDisk[i].y);
+				f32x8 OffsetU = (Cos * DiskX - Sin * DiskY) * SearchRadius;
+				f32x8 OffsetV = (Sin * DiskX + Cos * DiskY) * SearchRadius;
+				f32x8 Depth = SoftwareRenderer_SampleShadowPoint(Renderer, Slice, U + OffsetU, V + OffsetV);
+
+				f32x8 Blocker = Depth < SearchReference;
+				BlockerDepth = BlockerDepth + (Blocker & Depth);
+				BlockerCount = BlockerCount + (Blocker & One);
+			}
+
+			f32x8 HasBlockers = BlockerCount > Zero;
+			*Samples = Select(HasBlockers, F32x8((f32)(Preset.Taps * 2)), F32x8((f32)Preset.Taps));
+			if (!Any(HasBlockers))
+			{
+				Shadow = Zero;
+				break;
+			}
+
+			// Penumbra grows with the distance to the blocker, in world units and then in texels
+			BlockerDepth = BlockerDepth / Select(HasBlockers, BlockerCount, One);
+			f32x8 Penumbra = (CurrentDepth - BlockerDepth) * DepthRange * F32x8(Preset.LightSize) / TexelSize;
+			f32x8 Radius = Clamp(Penumbra, One, F32x8(Preset.Radius));
+
+			f32x8 Reference = CurrentDepth - Bias * (F32x8(1.5f) + Radius);
+			f32x8 Lit = SoftwareRenderer_SamplePoissonPCF(Renderer, Slice, U, V, Reference, Cos, Sin, Radius * F32x8(Texel), Preset.Taps);
+			Shadow = HasBlockers & (One - Lit);
+			break;
+		}
+		case shadow_filter::VSM:
+		case shadow_filter::EVSM:
+		{
+			if (!UsesMoments)
+			{
+				Shadow = Zero;
+				break;
+			}
+
+			// UV is half of NDC, the sign does not matter for the footprint
+			f32x8 Half = F32x8(0.5f * UVScale);
+			f32x8 Lod = SoftwareRenderer_ShadowMomentLod(ShadowDerivatives[0][0] * Half, ShadowDerivatives[0][1] * Half,
+				ShadowDerivatives[1][0] * Half, ShadowDerivatives[1][1] * Half, Renderer->ShadowMoments->Size);
+
+			// Filtered, so one lookup regardless of the blur
+			f32x8 Moments[4];
+			ShadowMoments_Sample(Renderer->ShadowMoments, Cascade, U, V, Lod, Moments);
+			Shadow = One - SoftwareRenderer_ShadowMomentsLit(Moments, CurrentDepth - Bias, Preset.Filter, Preset.LightBleeding);
+			*Samples = One;
+			break;
+		}
+		default:
+		{
+			Shadow = Zero;
+			break;
+		}
+	}
+
+	// Past the last cascade or behind the far plane, both return before sampling
+	f32x8 Skipped = PastLast | (CurrentDepth > One);
+	*Samples = AndNot(Skipped, *Samples);
+	return AndNot(Skipped, Shadow);
+}
+
+// PointShadowCalculation from Quad.hlsl, 1 is in shadow
+internal f32x8 SoftwareRenderer_PointShadowCalculation(const software_renderer* Renderer, const point_light& Light, const v3x8& WorldPosition, const v3x8& Normal)
+{
+	const f32x8 Zero = F32x8Zero(), One = F32x8(1.0f);
+
+	if (Light.ShadowIndex < 0 || !Renderer->ShadowAtlas)
+		return Zero;
+
+	v3x8 ToSurface = WorldPosition - V3x8(Light.Position);
+	f32x8 Major = Max(Abs(ToSurface.X), Max(Abs(ToSurface.Y), Abs(ToSurface.Z)));
+	f32x8 Outside = Major >= F32x8(Light.Radius);
+	if (All(Outside))
+		return Zero;
+
+	// All faces of a light have the same tile size
+	const u32 FirstTile = (u32)Light.ShadowIndex * c_PointShadowFaceCount;
+	const f32 TileSize = Renderer->Lights.PointShadowTiles[FirstTile].w;
+
+	// Normal offset of about a texel at that distance
+	ToSurface = ToSurface + Normal * (Major * F32x8(3.0f / TileSize));
+
+	f32x8 AbsX = Abs(ToSurface.X), AbsY = Abs(ToSurface.Y), AbsZ = Abs(ToSurface.Z);
+	Major = Max(AbsX, Max(AbsY, AbsZ));
+
+	f32 Near = c_PointShadowNearPlane;
+	f32 Far = Light.Radius;
+	f32x8 Depth = F32x8(Far / (Far - Near)) * (One - F32x8(Near) / Major);
+
+	// Cube face selection, ties go to X then Y like the hardware. Face coordinates (sc, tc) per face:
+	// +X (-z, -y), -X (z, -y), +Y (x, z), -Y (x, -z), +Z (x, -y), -Z (-x, -y)
+	f32x8 IsX = (AbsX >= AbsY) & (AbsX >= AbsZ);
+	f32x8 IsY = AndNot(IsX, AbsY >= AbsZ);
+
+	f32x8 NegativeX = ToSurface.X < Zero, NegativeY = ToSurface.Y < Zero, NegativeZ = ToSurface.Z < Zero;
+
+	f32x8 SC = Select(IsX, Select(NegativeX, ToSurface.Z, Zero - ToSurface.Z), Select(IsY, ToSurface.X, Select(NegativeZ, Zero - ToSurface.X, ToSurface.X)));
+	f32x8 TC = Select(IsY, Select(NegativeY, Zero - ToSurface.Z, ToSurface.Z), Zero - ToSurface.Y);
+	f32x8 Face = Select(IsX, Zero, Select(IsY, F32x8(2.0f), F32x8(4.0f))) + (Select(IsX, NegativeX, Select(IsY, NegativeY, NegativeZ)) & One);
+
+	// Half a texel inside the tile, the clamps also put NaN lanes (uncovered pixels) on the edge
+	f32x8 InvMajor = F32x8(0.5f) / Major;
+	f32x8 U = Clamp(MulAdd(SC, InvMajor, F32x8(0.5f)), F32x8(0.5f / TileSize), F32x8(1.0f - 0.5f / TileSize));
+	f32x8 V = Clamp(MulAdd(TC, InvMajor, F32x8(0.5f)), F32x8(0.5f / TileSize), F32x8(1.0f - 0.5f / TileSize));
+
+	// Tile origin of each lane's face in texels
+	const i32 AtlasSize = Renderer->ShadowAtlasSize;
+	i32x8 Tile = (I32x8((i32)FirstTile) + ConvertToI32(Face)) * I32x8(4);
+	const f32* Tiles = &Renderer->Lights.PointShadowTiles[0].x;
+	i32x8 TileX = ConvertToI32(Gather(Tiles, Tile) * F32x8((f32)AtlasSize));
+	i32x8 TileY = ConvertToI32(Gather(Tiles + 1, Tile) * F32x8((f32)AtlasSize));
+
+	// Bilinear 2x2 compare
+	f32x8 TexelX = MulAdd(U, F32x8(TileSize), F32x8(-0.5f));
+	f32x8 TexelY = MulAdd(V, F32x8(TileSize), F32x8(-0.5f));
+	f32x8 X0 = Floor(TexelX), Y0 = Floor(TexelY);
+	f32x8 FracX = TexelX - X0, FracY = TexelY - Y0;
+
+	// The second texel has no weight on the last row and column, it only has to stay inside
+	f32x8 Last = F32x8(TileSize - 1.0f);
+	i32x8 Column0 = TileX + ConvertToI32(X0), Column1 = TileX + ConvertToI32(Min(X0 + One, Last));
+	i32x8 Row0 = (TileY + ConvertToI32(Y0)) * I32x8(AtlasSize), Row1 = (TileY + ConvertToI32(Min(Y0 + One, Last))) * I32x8(AtlasSize);
+
+	const f32* Base = Renderer->ShadowAtlas;
+	f32x8 Lit00 = (Depth <= Gather(Base, Row0 + Column0)) & One;
+	f32x8 Lit10 = (Depth <= Gather(Base, Row0 + Column1)) & One;
+	f32x8 Lit01 = (Depth <= Gather(Base, Row1 + Column0)) & One;
+	f32x8 Lit11 = (Depth <= Gather(Base, Row1 + Column1)) & One;
+
+	f32x8 Lit = Lerp(Lerp(Lit00, Lit10, FracX), Lerp(Lit01, Lit11, FracX), FracY);
+	return AndNot(Outside, One - Lit);
+}
+
+// Light.hlsl, specular never reaches the result there, so it is not computed
+internal v3x8 SoftwareRenderer_DirectionalLight(const directional_light& Light, const v3x8& Normal, const v3x8& Color, f32x8 Shadow)
+{
+	v3x8 LightDir = V3x8(glm::normalize(-Light.Direction));
+	f32x8 DiffuseAngle = Max(Dot(Normal, LightDir), F32x8Zero());
+
+	v3 Ambient = Light.Intensity * v3(0.5f) * Light.Radiance;
+	v3 Diffuse = Light.Intensity * v3(0.8f) * Light.Radiance;
+
+	// CalculateDirectionalLight2, diffuse is shadowed
+	f32x8 Lit = (F32x8(1.0f) - Shadow) * DiffuseAngle;
+	return {
+		Color.X * MulAdd(F32x8(Diffuse.x), Lit, F32x8(Ambient.x)),
+		Color.Y * MulAdd(F32x8(Diffuse.y), Lit, F32x8(Ambient.y)),
+		Color.Z * MulAdd(F32x8(Diffuse.z), Lit, F32x8(Ambient.z))
+	};
+}
+
+// CalculatePointLight2, diffuse is shadowed
+internal v3x8 SoftwareRenderer_PointLight(const point_light& Light, const v3x8& Normal, const v3x8& WorldPosition, const v3x8& Color, f32x8 Shadow)
+{
+	v3x8 ToLight = V3x8(Light.Position) - WorldPosition;
+	f32x8 DistanceSquared = Dot(ToLight, ToLight);
+	v3x8 LightDir = ToLight * (F32x8(1.0f) / Sqrt(DistanceSquared));
+
+	f32x8 DiffuseAngle = Max(Dot(Normal, LightDir), F32x8Zero()) * (F32x8(1.0f) - Shadow);
+
+	f32x8 Attenuation = Clamp(F32x8(1.0f) - DistanceSquared * F32x8(1.0f / (Light.Radius * Light.Radius)), F32x8Zero(), F32x8(1.0f));
+	Attenuation = Attenuation * Lerp(Attenuation, F32x8(1.0f), F32x8(Light.FallOff));
+
+	v3 Ambient = Light.Intensity * v3(0.05f);
+	v3 Diffuse = Light.Radiance * Light.Intensity * v3(0.8f);
+	return {
+		Color.X * MulAdd(F32x8(Diffuse.x), DiffuseAngle, F32x8(Ambient.x)) * Attenuation,
+		Color.Y * MulAdd(F32x8(Diffuse.y), DiffuseAngle, F32x8(Ambient.y)) * Attenuation,
+		Color.Z * MulAdd(F32x8(Diffuse.z), DiffuseAngle, F32x8(Ambient.z)) * Attenuation
+	};
+}
+
+// Light lists of the clusters of a span, walked in merged order. Every light once, ascending like each list
+struct software_light_lists
+{
+	const u32* Lists[c_SimdWidth];
+	u32 Counts[c_SimdWidth];
+	u32 ListCount;
+	u32 Next;      // Without clusters, every light from Next to End
+	u32 End;
+};
+
+internal void SoftwareRenderer_GetPointLights(const software_renderer* Renderer, u32 CoveredMask, i32 X, i32 Y, f32x8 ViewDepth, software_light_lists* Lists, u64* Samples)
+{
+	Lists->ListCount = 0;
+	Lists->Next = Lists->End = 0;
+
+	if (!Renderer->LightClusters)
+	{
+		Lists->End = Renderer->PointLightCount;
+		*Samples += (u64)std::popcount(CoveredMask) * Renderer->PointLightCount;
+		return;
+	}
+
+	alignas(32) f32 Depths[c_SimdWidth];
+	F32x8Store(Depths, ViewDepth);
+
+	u32 Clusters[c_SimdWidth];
+	for (u32 Lanes = CoveredMask; Lanes; Lanes &= Lanes - 1)
+	{
+		u32 Lane = std::countr_zero(Lanes);
+		u32 Cluster = LightClusters_GetIndex(Renderer->Lights.LightClusterScale, X + Lane + 0.5f, Y + 0.5f, Depths[Lane]);
+		u32 Header = Renderer->LightClusters[Cluster];
+		u32 Count = Header & c_MaxLightsPerCluster;
+		*Samples += Count;
+
+		// Neighbors mostly share a cluster
+		bool Seen = false;
+		for (u32 i = 0; i < Lists->ListCount && !Seen; i++)
+			Seen = Clusters[i] == Cluster;
+
+		if (Seen || Count == 0)
+			continue;
+
+		Clusters[Lists->ListCount] = Cluster;
+		Lists->Lists[Lists->ListCount] = Renderer->LightClusters + (Header >> c_LightClusterCountBits);
+		Lists->Counts[Lists->ListCount] = Count;
+		Lists->ListCount++;
+	}
+}
+
+// Next light of the merged lists, false when all are done
+inline bool SoftwareRenderer_NextPointLight(software_light_lists* Lists, u32* Light)
+{
+	if (Lists->ListCount == 0)
+	{
+		*Light = Lists->Next++;
+		return *Light < Lists->End;
+	}
+
+	u32 Lowest = 0xFFFFFFFF;
+	for (u32 i = 0; i < Lists->ListCount; i++)
+	{
+		if (Lists->Counts[i] > 0)
+			Lowest = glm::min(Lowest, Lists->Lists[i][0]);
+	}
+
+	for (u32 i = 0; i < Lists->ListCount; i++)
+	{
+		if (Lists->Counts[i] > 0 && Lists->Lists[i][0] == Lowest)
+		{
+			Lists->Lists[i]++;
+			Lists->Counts[i]--;
+		}
+	}
+
+	*Light = Lowest;
+	return Lowest != 0xFFFFFFFF;
+}
+
+// SampleVirtualShadow from Quad.hlsl, 1 when lit and -1 when the page has no depth yet
+internal f32 SoftwareRenderer_SampleVirtualShadow(const software_renderer* Renderer, v3 LightPosition, u32 Level, f32 BiasTexels)
+{
+	const virtual_shadow_constants& Constants = Renderer->VirtualShadows;
+	f32 PageSize = Constants.PageSize * (f32)(1u << Level);
+	i32 PageX = (i32)glm::floor(LightPosition.x / PageSize);
+	i32 PageY = (i32)glm::floor(LightPosition.y / PageSize);
+
+	const virtual_shadow_gpu_page& Entry = Renderer->VirtualShadowPages[VirtualShadows_GetTableIndex(Level, PageX, PageY)];
+	if (Entry.Tag != VirtualShadows_PackTag(PageX, PageY) || Entry.PhysicalPage == c_VirtualShadowNoPage)
+		return -1.0f;
+
+	// Rows go down while light space Y goes up
+	f32 InPageX = LightPosition.x / PageSize - (f32)PageX;
+	f32 InPageY = LightPosition.y / PageSize - (f32)PageY;
+	u32 TexelX = glm::min((u32)(InPageX * c_VirtualShadowPageSize), c_VirtualShadowPageSize - 1);
+	u32 TexelY = glm::min((u32)((1.0f - InPageY) * c_VirtualShadowPageSize), c_VirtualShadowPageSize - 1);
+	shadow_atlas_rect Rect = VirtualShadows_GetPoolRect(Entry.PhysicalPage);
+	f32 ClosestDepth = Renderer->VirtualShadowPool[(u64)(Rect.Y + TexelY) * c_VirtualShadowPoolSize + Rect.X + TexelX];
+
+	f32 TexelSize = PageSize / c_VirtualShadowPageSize;
+	f32 Depth = (LightPosition.z - BiasTexels * TexelSize - Entry.DepthMin) * Entry.DepthScale;
+	return Depth <= ClosestDepth ? 1.0f : 0.0f;
+}
+
+// VirtualShadowCalculation from Quad.hlsl, 1 is in shadow. The page table lookups do not vectorize, every covered lane on its own
+internal f32x8 SoftwareRenderer_VirtualShadowCalculation(const software_renderer* Renderer, const v3x8& WorldPosition, f32x8 ViewDistance, const directional_light& Light, const v3x8& Normal, u32 CoveredMask, f32x8* Samples)
+{
+	const virtual_shadow_constants& Constants = Renderer->VirtualShadows;
+	v3 LightDir = glm::normalize(-Light.Direction);
+
+	alignas(32) f32 PositionX[c_SimdWidth], PositionY[c_SimdWidth], PositionZ[c_SimdWidth];
+	alignas(32) f32 NormalX[c_SimdWidth], NormalY[c_SimdWidth], NormalZ[c_SimdWidth];
+	alignas(32) f32 Distances[c_SimdWidth], Shadows[c_SimdWidth] = {}, LaneSamples[c_SimdWidth] = {};
+	F32x8Store(PositionX, WorldPosition.X);
+	F32x8Store(PositionY, WorldPosition.Y);
+	F32x8Store(PositionZ, WorldPosition.Z);
+	F32x8Store(NormalX, Normal.X);
+	F32x8Store(NormalY, Normal.Y);
+	F32x8Store(NormalZ, Normal.Z);
+	F32x8Store(Distances, ViewDistance);
+
+	for (u32 i = 0; i < c_SimdWidth; i++)
+	{
+		if (!(CoveredMask & (1u << i)))
+			continue;
+
+		v3 LightPosition = v3(Constants.LightView * v4(PositionX[i], PositionY[i], PositionZ[i], 1.0f));
+
+		// VirtualShadowLevel
+		f32 Texels = glm::max(Distances[i] * Constants.LodScale, 1.0f);
+		u32 Level = glm::min((u32)glm::floor(glm::log2(Texels)) + Constants.LodBias, c_VirtualShadowLevels - 1);
+		f32 TexelSize = Constants.PageSize * (f32)(1u << Level) / c_VirtualShadowPageSize;
+
+		f32 NdotL = glm::clamp(glm::dot(v3(NormalX[i], NormalY[i], NormalZ[i]), LightDir), 0.0f, 1.0f);
+		f32 BiasTexels = 1.5f * (1.0f + 2.0f * (1.0f - NdotL)) * 2.5f;
+
+		f32 Lit = 0.0f;
+		for (i32 Y = -1; Y <= 1; Y++)
+		{
+			for (i32 X = -1; X <= 1; X++)
+			{
+				v3 Tap = LightPosition + v3((f32)X, (f32)Y, 0.0f) * TexelSize;
+
+				f32 TapLit = 1.0f;
+				for (u32 L = Level; L < c_VirtualShadowLevels; L++)
+				{
+					f32 Sample = SoftwareRenderer_SampleVirtualShadow(Renderer, Tap, L, BiasTexels);
+					LaneSamples[i] += 1.0f;
+					if (Sample >= 0.0f)
+					{
+						TapLit = Sample;
+						break;
+					}
+				}
+
+				Lit += TapLit;
+			}
+		}
+
+		Shadows[i] = 1.0f - Lit / 9.0f;
+	}
+
+	*Samples = F32x8Load(LaneSamples);
+	return F32x8Load(Shadows);
+}
+
+// World position of the source triangle at a pixel of the clipped one, edges unclamped
+internal v3x8 SoftwareRenderer_InterpolatePosition(const f32* Triangles, const f32* Vertices, i32x8 Base, f32x8 PixelX, f32x8 PixelY)
+{
+	constexpr i32 VertexStride = sizeof(quad_vertex) / 4;
+
+	f32x8 Weights[3], WeightSum = F32x8Zero();
+	for (u32 i = 0; i < 3; i++)
+	{
+		f32x8 A = Gather(Triangles + offsetof(software_triangle, EdgeA) / 4 + i, Base);
+		f32x8 B = Gather(Triangles + offsetof(software_triangle, EdgeB) / 4 + i, Base);
+		f32x8 C = Gather(Triangles + offsetof(software_triangle, EdgeC) / 4 + i, Base);
+		f32x8 InvW = Gather(Triangles + offsetof(software_triangle, InvW) / 4 + i, Base);
+
+		Weights[i] = MulAdd(A, PixelX, MulAdd(B, PixelY, C)) * InvW;
+		WeightSum = WeightSum + Weights[i];
+	}
+
+	// Degenerate sums only happen on uncovered lanes, which are discarded
+	f32x8 InvWeightSum = F32x8(1.0f) / Select(WeightSum == F32x8Zero(), F32x8(1.0f), WeightSum);
+
+	v3x8 Position = {};
+	for (u32 j = 0; j < 3; j++)
+	{
+		f32x8 Barycentric = F32x8Zero();
+		for (u32 i = 0; i < 3; i++)
+			Barycentric = MulAdd(Weights[i], Gather(Triangles + offsetof(software_triangle, Corners) / 4 + i * 3 + j, Base), Barycentric);
+
+		i32x8 Vertex = Gather((const i32*)Triangles + offsetof(software_triangle, Vertices) / 4 + j, Base) * I32x8(VertexStride);
+		Position = Position + SoftwareRenderer_Gather(Vertices + offsetof(quad_vertex, Position) / 4, Vertex) * (Barycentric * InvWeightSum);
+	}
+
+	return Position;
+}
+
+// Perspective correct attributes of the source triangle at a pixel of the clipped one, what PSMain gets from the rasterizer
+internal void SoftwareRenderer_InterpolateSurface(const f32* Triangles, const f32* Vertices, i32x8 Base, f32x8 PixelX, f32x8 PixelY, f32x8 Covered, v3x8* OutWorldPosition, v3x8* OutColor, v3x8* OutNormal, f32x8* OutOcclusion)
+{
+	constexpr i32 VertexStride = sizeof(quad_vertex) / 4;
+	const f32x8 Zero = F32x8Zero();
+	const f32x8 One = F32x8(1.0f);
+
+	// Edge i is proportional to the barycentric of corner i
+	f32x8 Weights[3], WeightSum = Zero;
+	for (u32 i = 0; i < 3; i++)
+	{
+		f32x8 A = Gather(Triangles + offsetof(software_triangle, EdgeA) / 4 + i, Base);
+		f32x8 B = Gather(Triangles + offsetof(software_triangle, EdgeB) / 4 + i, Base);
+		f32x8 C = Gather(Triangles + offsetof(software_triangle, EdgeC) / 4 + i, Base);
+		f32x8 InvW = Gather(Triangles + offsetof(software_triangle, InvW) / 4 + i, Base);
+
+		Weights[i] = Max(MulAdd(A, PixelX, MulAdd(B, PixelY, C)), Zero) * InvW;
+		WeightSum = WeightSum + Weights[i];
+	}
+
+	f32x8 InvWeightSum = One / Select(Covered, WeightSum, One);
+
+	// Back to the source triangle
+	v3x8 WorldPosition = {}, Color = {}, Normal = {};
+	f32x8 Occlusion = Zero;
+	for (u32 j = 0; j < 3; j++)
+	{
+		f32x8 Barycentric = Zero;
+		for (u32 i = 0; i < 3; i++)
+			Barycentric = MulAdd(Weights[i], Gather(Triangles + offsetof(software_triangle, Corners) / 4 + i * 3 + j, Base), Barycentric);
+		Barycentric = Barycentric * InvWeightSum;
+
+		i32x8 Vertex = Gather((const i32*)Triangles + offsetof(software_triangle, Vertices) / 4 + j, Base) * I32x8(VertexStride);
+		v3x8 Position = SoftwareRenderer_Gather(Vertices + offsetof(quad_vertex, Position) / 4, Vertex);
+		v3x8 VertexColor = SoftwareRenderer_Gather(Vertices + offsetof(quad_vertex, Color) / 4, Vertex);
+		v3x8 VertexNormal = SoftwareRenderer_Gather(Vertices + offsetof(quad_vertex, Normal) / 4, Vertex);
+		f32x8 VertexOcclusion = Gather(Vertices + offsetof(quad_vertex, Color) / 4 + 3, Vertex);
+
+		WorldPosition = WorldPosition + Position * Barycentric;
+		Color = Color + VertexColor * Barycentric;
+		Normal = Normal + VertexNormal * Barycentric;
+		Occlusion = MulAdd(VertexOcclusion, Barycentric, Occlusion);
+	}
+
+	*OutWorldPosition = WorldPosition;
+	*OutColor = Color;
+	*OutNormal = Normal;
+	*OutOcclusion = Occlusion;
+}
+
+// IrradianceProbeSample per covered lane, saturated like in Quad.hlsl
+internal v3x8 SoftwareRenderer_IrradianceProbeSample(const software_renderer* Renderer, u32 CoveredMask, const v3x8& WorldPosition, const v3x8& Normal)
+{
+	alignas(32) f32 Lanes[6][c_SimdWidth];
+	F32x8Store(Lanes[0], WorldPosition.X);
+	F32x8Store(Lanes[1], WorldPosition.Y);
+	F32x8Store(Lanes[2], WorldPosition.Z);
+	F32x8Store(Lanes[3], Normal.X);
+	F32x8Store(Lanes[4], Normal.Y);
+	F32x8Store(Lanes[5], Normal.Z);
+
+	alignas(32) f32 Ambient[3][c_SimdWidth] = {};
+	for (u32 i = 0; i < c_SimdWidth; i++)
+	{
+		if (!(CoveredMask & (1u << i)))
+			continue;
+
+		v3 Irradiance = IrradianceProbes_Sample(Renderer->IrradianceProbes, Renderer->Lights.IrradianceProbeGrid, v3(Lanes[0][i], Lanes[1][i], Lanes[2][i]), v3(Lanes[3][i], Lanes[4][i], Lanes[5][i]));
+		for (u32 Channel = 0; Channel < 3; Channel++)
+			Ambient[Channel][i] = glm::clamp(Irradiance[Channel], 0.0f, 1.0f);
+	}
+
+	return { F32x8Load(Ambient[0]), F32x8Load(Ambient[1]), F32x8Load(Ambient[2]) };
+}
+
+internal f32x8 SoftwareRenderer_GetSurface(const software_renderer* Renderer, i32 X, i32 Y, v3x8* WorldPosition, v3x8* Normal, v3x8* Color)
+{
+	constexpr i32 TriangleStride = sizeof(software_triangle) / 4;
+	const f32* Triangles = (const f32*)Renderer->Triangles;
+
+	i32x8 Id = I32x8Load((const i32*)&Renderer->TriangleIds[Y * Renderer->Width + X]);
+	f32x8 Covered = AsF32(Id == I32x8((i32)c_SoftwareNoTriangle)) ^ AsF32(I32x8(-1));
+	if (!Any(Covered))
+		return Covered;
+
+	// Same as SoftwareRenderer_ShadeBand
+	i32x8 Base = AsI32(Select(Covered, AsF32(Id), F32x8Zero())) * I32x8(TriangleStride);
+	f32x8 PixelX = ConvertToF32(I32x8(X) - Gather((const i32*)Triangles + offsetof(software_triangle, MinX) / 4, Base)) + (F32x8LaneIndex() + F32x8(0.5f));
+	f32x8 PixelY = ConvertToF32(I32x8(Y) - Gather((const i32*)Triangles + offsetof(software_triangle, MinY) / 4, Base)) + F32x8(0.5f);
+
+	v3x8 SurfaceColor;
+	f32x8 Occlusion;
+	SoftwareRenderer_InterpolateSurface(Triangles, (const f32*)Renderer->Vertices, Base, PixelX, PixelY, Covered, WorldPosition, &SurfaceColor, Normal, &Occlusion);
+	*Normal = SoftwareRenderer_Normalize(*Normal);
+	if (Color)
+		*Color = SurfaceColor;
+	return Covered;
+}
+
+internal u32 SoftwareRenderer_ShadeBand(software_renderer* Renderer, i32 Band, u64* OutShadowSamples, u64* OutPointLightSamples)
+{
+	const i32 Width = Renderer->Width;
+	const i32 BandY0 = Band * c_SoftwareBandHeight;
+	const i32 BandY1 = glm::min(BandY0 + c_SoftwareBandHeight, Renderer->Height);
+
+	constexpr i32 TriangleStride = sizeof(software_triangle) / 4;
+	const f32* Triangles = (const f32*)Renderer->Triangles;
+	const f32* Vertices = (const f32*)Renderer->Vertices;
+
+	const f32x8 LaneOffset = F32x8LaneIndex() + F32x8(0.5f);
+	const f32x8 Zero = F32x8Zero();
+	const f32x8 One = F32x8(1.0f);
+	const i32x8 NoTriangle = I32x8((i32)c_SoftwareNoTriangle);
+	const v4& Clear = Renderer->Settings.ClearColor;
+	const u32 ClearColor = (u32)(Clear.r * 255.0f + 0.5f) | ((u32)(Clear.g * 255.0f + 0.5f) << 8) | ((u32)(Clear.b * 255.0f + 0.5f) << 16) | ((u32)(Clear.a * 255.0f + 0.5f) << 24);
+	const directional_light& ShadowLight = Renderer->Lights.DirectionalLight[0];
+	const bool UsesMoments = ShadowFilter_UsesMoments(c_ShadowFilterPresets[Renderer->Settings.ShadowFilter].Filter) && Renderer->ShadowMoments;
+	const u32 PlaneSize = (u32)(Width * Renderer->Height);
+	const bool UsesProbes = Renderer->IrradianceProbes && Renderer->Lights.IrradianceProbeGrid.w != 0.0f;
+
+	u32 ShadedPixels = 0;
+	u64 ShadowSamples = 0;
+	u64 PointLightSamples = 0;
+
+	for (i32 Y = BandY0; Y < BandY1; Y++)
+	{
+		for (i32 X = 0; X < Width; X += c_SimdWidth)
+		{
+			u32* Out = &Renderer->Color[Y * Width + X];
+			i32x8 Id = I32x8Load((const i32*)&Renderer->TriangleIds[Y * Width + X]);
+			f32x8 Covered = AsF32(Id == NoTriangle) ^ AsF32(I32x8(-1));
+
+			u32 CoveredMask = MoveMask(Covered);
+			if (CoveredMask == 0)
+			{
+				for (u32 i = 0; i < c_SimdWidth; i++)
+					Out[i] = ClearColor;
+				continue;
+			}
+
+			ShadedPixels += std::popcount(CoveredMask);
+
+			// Uncovered lanes read triangle 0, their results are thrown away
+			i32x8 Base = AsI32(Select(Covered, AsF32(Id), Zero)) * I32x8(TriangleStride);
+
+			f32x8 PixelX = ConvertToF32(I32x8(X) - Gather((const i32*)Triangles + offsetof(software_triangle, MinX) / 4, Base)) + LaneOffset;
+			f32x8 PixelY = ConvertToF32(I32x8(Y) - Gather((const i32*)Triangles + offsetof(software_triangle, MinY) / 4, Base)) + F32x8(0.5f);
+
+			v3x8 WorldPosition, Color, Normal;
+			f32x8 Occlusion;
+			SoftwareRenderer_InterpolateSurface(Triangles, Vertices, Base, PixelX, PixelY, Covered, &WorldPosition, &Color, &Normal, &Occlusion);
+
+			// ddx and ddy for the moment mip selection, the neighbors extrapolate past the edges like helper lanes
+			v3x8 WorldDerivatives[2];
+			if (UsesMoments)
+			{
+				WorldDerivatives[0] = SoftwareRenderer_InterpolatePosition(Triangles, Vertices, Base, PixelX + One, PixelY) - WorldPosition;
+				WorldDerivatives[1] = SoftwareRenderer_InterpolatePosition(Triangles, Vertices, Base, PixelX, PixelY + One) - WorldPosition;
+			}
+
+			// PSMain
+			f32x8 ViewX, ViewY, ViewZ, ViewW;
+			TransformPoints(Renderer->Constants.View, WorldPosition, &ViewX, &ViewY, &ViewZ, &ViewW);
+
+			Normal = SoftwareRenderer_Normalize(Normal);
+
+			// SV_Position is the pixel center
+			f32x8 Samples, Shadow;
+			if (Renderer->VirtualShadows.Enabled)
+			{
+				f32x8 ViewDistance = Sqrt(MulAdd(ViewX, ViewX, MulAdd(ViewY, ViewY, ViewZ * ViewZ)));
+				Shadow = SoftwareRenderer_VirtualShadowCalculation(Renderer, WorldPosition, ViewDistance, ShadowLight, Normal, CoveredMask, &Samples);
+			}
+			else
+				Shadow = SoftwareRenderer_ShadowCalculation(Renderer, WorldPosition, UsesMoments ? WorldDerivatives : nullptr, ViewZ, ShadowLight, Normal, F32x8((f32)X) + LaneOffset, F32x8(Y + 0.5f), &Samples);
+			ShadowSamples += (u64)HorizontalAdd(Covered & Samples);
+
+			// Every directional light gets the shadow of the first one
+			f32* Mask = Renderer->ShadowMask ? &Renderer->ShadowMask[Y * Width + X] : nullptr;
+			if (Mask)
+			{
+				for (i32 i = 0; i < Renderer->Lights.DirectionalLightCount; i++)
+				{
+					v3x8 LightDir = V3x8(glm::normalize(-Renderer->Lights.DirectionalLight[i].Direction));
+					f32x8 Reaches = Covered & (Dot(Normal, LightDir) > Zero);
+					F32x8Store(Mask + i * PlaneSize, Select(Reaches, Shadow, F32x8(-1.0f)));
+				}
+			}
+
+			v3x8 Result;
+			if (Renderer->Settings.EvaluateLights)
+			{
+				Result = { Zero, Zero, Zero };
+				for (i32 i = 0; i < Renderer->Lights.DirectionalLightCount; i++)
+					Result = Result + SoftwareRenderer_DirectionalLight(Renderer->Lights.DirectionalLight[i], Normal, Color, Shadow);
+			}
+			else if (UsesProbes)
+			{
+				// Shadows fall to the probes' ambient light
+				v3x8 Ambient = SoftwareRenderer_IrradianceProbeSample(Renderer, CoveredMask, WorldPosition, Normal);
+				f32x8 Lit = One - Shadow;
+				Result = { Color.X * Lerp(Ambient.X, One, Lit), Color.Y * Lerp(Ambient.Y, One, Lit), Color.Z * Lerp(Ambient.Z, One, Lit) };
+			}
+			else
+			{
+				// Point lights on top of the shadowed base color
+				Result = Color * (One - Shadow);
+			}
+
+			// Ascending like the cluster lists
+			software_light_lists Lists;
+			SoftwareRenderer_GetPointLights(Renderer, CoveredMask, X, Y, ViewZ, &Lists, &PointLightSamples);
+
+			f32x8 PointReached = Zero, PointShadowed = Zero;
+			u32 LightIndex;
+			while (SoftwareRenderer_NextPointLight(&Lists, &LightIndex))
+			{
+				const point_light& Light = Renderer->PointLights[LightIndex];
+				f32x8 PointShadow = SoftwareRenderer_PointShadowCalculation(Renderer, Light, WorldPosition, Normal);
+				Result = Result + SoftwareRenderer_PointLight(Light, Normal, WorldPosition, Color, PointShadow);
+
+				if (Mask)
+				{
+					v3x8 ToLight = V3x8(Light.Position) - WorldPosition;
+					f32x8 Reaches = Covered & (Dot(ToLight, ToLight) < F32x8(Light.Radius * Light.Radius)) & (Dot(Normal, ToLight) > Zero);
+					PointReached += Reaches & One;
+					PointShadowed += Reaches & PointShadow;
+				}
+			}
+
+			if (Mask)
+				F32x8Store(Mask + Renderer->Lights.DirectionalLightCount * PlaneSize, Select(PointReached > Zero, PointShadowed / Max(PointReached, One), F32x8(-1.0f)));
+
+			// Voxel ambient occlusion from the block mesher
+			Result = Result * Lerp(F32x8(c_VoxelOcclusionFloor), One, Occlusion);
+
+			// UNORM conversion
+			f32x8 Scale = F32x8(255.0f), Half = F32x8(0.5f);
+			i32x8 R = ConvertToI32(MulAdd(Clamp(Result.X, Zero, One), Scale, Half));
+			i32x8 G = ConvertToI32(MulAdd(Clamp(Result.Y, Zero, One), Scale, Half));
+			i32x8 B = ConvertToI32(MulAdd(Clamp(Result.Z, Zero, One), Scale, Half));
+			i32x8 Packed = R | (G << 8) | (B << 16) | I32x8((i32)0xFF000000);
+
+			alignas(32) i32 Pixels[c_SimdWidth];
+			I32x8Store(Pixels, Packed);
+			for (u32 i = 0; i < c_SimdWidth; i++)
+				Out[i] = (CoveredMask & (1u << i)) ? (u32)Pixels[i] : ClearColor;
+		}
+	}
+
+	*OutShadowSamples = ShadowSamples;
+	*OutPointLightSamples = PointLightSamples;
+	return ShadedPixels;
+}
+
+internal const software_render_stats& SoftwareRenderer_Render(software_renderer* Renderer, const quad_vertex* Vertices, const u32* Indices, u32 IndexOffset, u32 IndexCount)
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto Start = clock::now();
+
+	software_render_stats& Stats = Renderer->Stats;
+	Stats = {};
+
+	Renderer->Vertices = Vertices;
+	Renderer->Indices = Indices;
+
+	u32 TriangleCount = IndexCount / 3;
+	if (TriangleCount > Renderer->MaxTriangles)
+	{
+		Stats.DroppedTriangles = TriangleCount - Renderer->MaxTriangles;
+		TriangleCount = Renderer->MaxTriangles;
+	}
+
+	Stats.Triangles = TriangleCount;
+	Renderer->TriangleCount = TriangleCount;
+	Renderer->ExtraTriangleCount = 0;
+
+	// 1. Setup
+	JobSystem_ParallelFor(&g_Jobs, TriangleCount, 16 * 1024, [Renderer, IndexOffset](u32 Begin, u32 End)
+	{
+		for (u32 i = Begin; i < End; i++)
+			SoftwareRenderer_AddTriangle(Renderer, &Renderer->Indices[IndexOffset + i * 3], &Renderer->Triangles[i]);
+	});
+
+	u32 ExtraTriangles = Renderer->ExtraTriangleCount.load();
+	if (ExtraTriangles > Renderer->MaxExtraTriangles)
+	{
+		Stats.DroppedTriangles += ExtraTriangles - Renderer->MaxExtraTriangles;
+		ExtraTriangles = Renderer->MaxExtraTriangles;
+	}
+
+	SoftwareRenderer_BinTriangles(Renderer, TriangleCount + ExtraTriangles);
+
+	auto SetupEnd = clock::now();
+
+	// 2. Rasterization
+	JobSystem_ParallelFor(&g_Jobs, Renderer->BandCount, 1, [Renderer](u32 Begin, u32 End)
+	{
+		for (u32 Band = Begin; Band < End; Band++)
+			SoftwareRenderer_RasterizeBand(Renderer, Band);
+	});
+
+	auto RasterEnd = clock::now();
+
+	// Spans without coverage are not written
+	if (Renderer->ShadowMask)
+	{
+		u64 MaskSize = (u64)Renderer->Width * Renderer->Height * SoftwareRenderer_GetShadowMaskPlanes(Renderer->Lights);
+		for (u64 i = 0; i < MaskSize; i++)
+			Renderer->ShadowMask[i] = -1.0f;
+	}
+
+	// 3. Shading
+	std::atomic<u32> ShadedPixels = 0;
+	std::atomic<u64> ShadowSamples = 0;
+	std::atomic<u64> PointLightSamples = 0;
+	JobSystem_ParallelFor(&g_Jobs, Renderer->BandCount, 1, [Renderer, &ShadedPixels, &ShadowSamples, &PointLightSamples](u32 Begin, u32 End)
+	{
+		for (u32 Band = Begin; Band < End; Band++)
+		{
+			u64 BandShadowSamples, BandPointLightSamples;
+			ShadedPixels += SoftwareRenderer_ShadeBand(Renderer, Band, &BandShadowSamples, &BandPointLightSamples);
+			ShadowSamples += BandShadowSamples;
+			PointLightSamples += BandPointLightSamples;
+		}
+	});
+
+	auto End = clock::now();
+	Stats.ShadedPixels = ShadedPixels.load();
+	Stats.ShadowSamples = ShadowSamples.load();
+	Stats.PointLightSamples = PointLightSamples.load();
+	Stats.SetupMilliseconds = std::chrono::duration<f32, std::milli>(SetupEnd - Start).count();
+	Stats.RasterMilliseconds = std::chrono::duration<f32, std::milli>(RasterEnd - SetupEnd).count();
+	Stats.ShadeMilliseconds = std::chrono::duration<f32, std::milli>(End - RasterEnd).count();
+	Stats.TotalMilliseconds = std::chrono::duration<f32, std::milli>(End - Start).count();
+
+	return Stats;
+}
+
+internal bool SoftwareRenderer_WritePPM(const software_renderer* Renderer, const char* Path)
+{
+#if defined(_WIN32)
+	FILE* File = nullptr;
+	fopen_s(&File, Path, "wb");
+#else
+	FILE* File = fopen(Path, "wb");
+#endif
+
+	if (!File)
+	{
+		Err("Could not open %s!", Path);
+		return false;
+	}
+
+	fprintf(File, "P6\n%d %d\n255\n", Renderer->Width, Renderer->Height);
+
+	u8* Row = VmAllocArray(u8, Renderer->Width * 3);
+	for (i32 Y = 0; Y < Renderer->Height; Y++)
+	{
+		for (i32 X = 0; X < Renderer->Width; X++)
+		{
+			u32 Pixel = Renderer->Color[Y * Renderer->Width + X];
+			Row[X * 3 + 0] = (u8)(Pixel & 0xFF);
+			Row[X * 3 + 1] = (u8)((Pixel >> 8) & 0xFF);
+			Row[X * 3 + 2] = (u8)((Pixel >> 16) & 0xFF);
+		}
+		fwrite(Row, 1, Renderer->Width * 3, File);
+	}
+
+	VmFree(Row);
+	fclose(File);
+	return true;
+}
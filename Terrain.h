@@ -0,0 +1,281 @@
+#pragma once
+
+// Terrain generator
+// Fills a region of the block world from noise, the same seed and settings always produce the same world.
+//  1. Heightmaps per chunk column (2D fBm, a low frequency mountain mask on top), in parallel
+//  2. Chunks that can contain anything are allocated, the only serial part
+//  3. Chunks are filled in parallel, 3D noise carves caves below the surface
+//
+// Every chunk is owned by exactly one job, so jobs never need synchronization.
+
+#include "Noise.h"
+
+struct terrain_settings
+{
+	u32 Seed;
+
+	f32 BaseHeight;
+	f32 HillHeight;
+	f32 HillFrequency;
+	u32 HillOctaves;
+	f32 MountainHeight;
+	f32 MountainFrequency;
+
+	f32 SeaLevel;  // Sand below this
+	f32 SnowLevel; // Snow above this
+
+	b32 Caves;
+	f32 CaveFrequency;
+	f32 CaveThreshold; // Higher means fewer caves
+	u32 CaveOctaves;
+};
+
+struct terrain_stats
+{
+	u32 ChunksFilled;
+	u64 SolidBlocks;
+	f32 HeightmapMilliseconds;
+	f32 FillMilliseconds;
+	f32 TotalMilliseconds;
+};
+
+internal terrain_settings Terrain_GetDefaultSettings(u32 Seed);
+
+// Region is in chunk coordinates, [MinChunk, MaxChunk), clamped to the world
+internal terrain_stats Terrain_Generate(block_world* World, const terrain_settings& Settings, v3i MinChunk, v3i MaxChunk);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+inline constexpr i32 c_ChunkColumnSize = c_ChunkSize * c_ChunkSize;
+
+internal terrain_settings Terrain_GetDefaultSettings(u32 Seed)
+{
+	terrain_settings Settings = {};
+	Settings.Seed = Seed;
+
+	Settings.BaseHeight = 0.0f;
+	Settings.HillHeight = 48.0f;
+	Settings.HillFrequency = 1.0f / 128.0f;
+	Settings.HillOctaves = 5;
+	Settings.MountainHeight = 96.0f;
+	Settings.MountainFrequency = 1.0f / 512.0f;
+
+	Settings.SeaLevel = -16.0f;
+	Settings.SnowLevel = 32.0f;
+
+	Settings.Caves = true;
+	Settings.CaveFrequency = 1.0f / 32.0f;
+	Settings.CaveThreshold = 0.3f;
+	Settings.CaveOctaves = 2;
+
+	return Settings;
+}
+
+// Heights of one chunk column, [z][x], already floored
+internal i32 Terrain_BuildHeightmap(const noise_table* Noise, const terrain_settings& Settings, v3i ColumnBlockMin, f32* Heights)
+{
+	const f32x8 Lanes = F32x8LaneIndex();
+	f32x8 MaxHeight = F32x8(-1e9f);
+
+	for (i32 Z = 0; Z < c_ChunkSize; Z++)
+	{
+		f32x8 WorldZ = F32x8((f32)(ColumnBlockMin.z + Z));
+
+		for (i32 X = 0; X < c_ChunkSize; X += c_SimdWidth)
+		{
+			f32x8 WorldX = F32x8((f32)(ColumnBlockMin.x + X)) + Lanes;
+
+			f32x8 Hills = Noise_FBm2(Noise, WorldX * F32x8(Settings.HillFrequency), WorldZ * F32x8(Settings.HillFrequency), Settings.HillOctaves);
+
+			// Mountains only where the mask is positive, squared for sharper ridges
+			f32x8 Mask = Max(Noise_FBm2(Noise, WorldX * F32x8(Settings.MountainFrequency) + F32x8(1000.0f), WorldZ * F32x8(Settings.MountainFrequency), 2), F32x8Zero()) * F32x8(2.0f);
+			f32x8 Mountains = Mask * Mask * Abs(Hills + F32x8(0.5f));
+
+			f32x8 Height = Floor(F32x8(Settings.BaseHeight) + Hills * F32x8(Settings.HillHeight) + Mountains * F32x8(Settings.MountainHeight));
+			F32x8Store(&Heights[Z * c_ChunkSize + X], Height);
+			MaxHeight = Max(MaxHeight, Height);
+		}
+	}
+
+	return (i32)HorizontalMax(MaxHeight);
+}
+
+internal u8 Terrain_GetMaterial(const terrain_settings& Settings, i32 Y, i32 Height)
+{
+	i32 Depth = Height - Y;
+
+	if (Depth > 3)
+		return 1; // Stone
+
+	if (Height <= (i32)Settings.SeaLevel + 1)
+		return 4; // Sand
+
+	if (Depth == 0)
+		return Height >= (i32)Settings.SnowLevel ? 5 : 3; // Snow or grass
+
+	return 2; // Dirt
+}
+
+internal u32 Terrain_FillChunk(const noise_table* Noise, const terrain_settings& Settings, chunk* Chunk, const f32* Heights)
+{
+	const v3i BlockMin = Chunk_GetBlockMin(Chunk->Coord);
+	const f32x8 Lanes = F32x8LaneIndex();
+	const f32x8 CaveFrequency = F32x8(Settings.CaveFrequency);
+	const f32x8 CaveThreshold = F32x8(Settings.CaveThreshold);
+	u32 SolidCount = 0;
+
+	for (i32 Z = 0; Z < c_ChunkSize; Z++)
+	{
+		const f32* HeightRow = &Heights[Z * c_ChunkSize];
+		f32x8 WorldZ = F32x8((f32)(BlockMin.z + Z));
+
+		for (i32 Y = 0; Y < c_ChunkSize; Y++)
+		{
+			i32 WorldY = BlockMin.y + Y;
+			u8* Row = &Chunk->Blocks[Chunk_GetBlockIndex(0, Y, Z)];
+
+			for (i32 X = 0; X < c_ChunkSize; X += c_SimdWidth)
+			{
+				f32x8 Height = F32x8Load(&HeightRow[X]);
+				f32x8 Solid = F32x8((f32)WorldY) <= Height;
+
+				u32 SolidMask = MoveMask(Solid);
+				if (SolidMask == 0)
+				{
+					memset(Row + X, 0, c_SimdWidth);
+					continue;
+				}
+
+				// Caves, stretched vertically so they run more like tunnels than blobs
+				if (Settings.Caves)
+				{
+					f32x8 WorldX = F32x8((f32)(BlockMin.x + X)) + Lanes;
+					f32x8 Cave = Noise_FBm3(Noise, WorldX * CaveFrequency, F32x8((f32)WorldY) * CaveFrequency * F32x8(2.0f), WorldZ * CaveFrequency, Settings.CaveOctaves);
+					SolidMask &= ~MoveMask(Abs(Cave) < CaveThreshold * F32x8(0.25f));
+				}
+
+				alignas(32) f32 Heights8[8];
+				F32x8Store(Heights8, Height);
+
+				for (u32 Lane = 0; Lane < c_SimdWidth; Lane++)
+				{
+					bool IsSolid = SolidMask & (1u << Lane);
+					Row[X + Lane] = IsSolid ? Terrain_GetMaterial(Settings, WorldY, (i32)Heights8[Lane]) : 0;
+					SolidCount += IsSolid;
+				}
+			}
+		}
+	}
+
+	Chunk->SolidCount = SolidCount;
+	Chunk->Version++;
+
+	return SolidCount;
+}
+
+internal terrain_stats Terrain_Generate(block_world* World, const terrain_settings& Settings, v3i MinChunk, v3i MaxChunk)
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto Start = clock::now();
+
+	terrain_stats Stats = {};
+
+	MinChunk = glm::max(MinChunk, v3i(0));
+	MaxChunk = glm::min(MaxChunk, v3i(c_WorldChunksX, c_WorldChunksY, c_WorldChunksZ));
+	if (glm::any(glm::greaterThanEqual(MinChunk, MaxChunk)))
+		return Stats;
+
+	noise_table Noise;
+	Noise_Initialize(&Noise, Settings.Seed);
+
+	const i32 ColumnsX = MaxChunk.x - MinChunk.x;
+	const i32 ColumnsZ = MaxChunk.z - MinChunk.z;
+	const u32 ColumnCount = ColumnsX * ColumnsZ;
+
+	// 1. Heightmaps
+	f32* Heights = VmAllocArray(f32, ColumnCount * c_ChunkColumnSize);
+	i32* MaxHeights = VmAllocArray(i32, ColumnCount);
+
+	JobSystem_ParallelFor(&g_Jobs, ColumnCount, 1, [&](u32 Begin, u32 End)
+	{
+		for (u32 Column = Begin; Column < End; Column++)
+		{
+			v3i ChunkCoord = MinChunk + v3i(Column % ColumnsX, 0, Column / ColumnsX);
+			MaxHeights[Column] = Terrain_BuildHeightmap(&Noise, Settings, Chunk_GetBlockMin(ChunkCoord), &Heights[Column * c_ChunkColumnSize]);
+		}
+	});
+
+	auto HeightmapEnd = clock::now();
+
+	// 2. Allocation, existing chunks are always refilled since they may hold old content
+	struct fill_job
+	{
+		chunk* Chunk;
+		u32 Column;
+	};
+
+	const u32 MaxJobs = ColumnCount * (MaxChunk.y - MinChunk.y);
+	fill_job* Jobs = VmAllocArray(fill_job, MaxJobs);
+	u32 JobCount = 0;
+
+	for (u32 Column = 0; Column < ColumnCount; Column++)
+	{
+		for (i32 ChunkY = MinChunk.y; ChunkY < MaxChunk.y; ChunkY++)
+		{
+			v3i ChunkCoord = MinChunk + v3i(Column % ColumnsX, 0, Column / ColumnsX);
+			ChunkCoord.y = ChunkY;
+
+			bool HasTerrain = Chunk_GetBlockMin(ChunkCoord).y <= MaxHeights[Column];
+			bool Exists = World->Chunks[BlockWorld_GetChunkIndex(ChunkCoord)] != nullptr;
+
+			if (HasTerrain || Exists)
+				Jobs[JobCount++] = { BlockWorld_GetOrCreateChunk(World, ChunkCoord), Column };
+		}
+	}
+
+	// 3. Fill
+	std::atomic<u64> SolidBlocks = 0;
+	JobSystem_ParallelFor(&g_Jobs, JobCount, 1, [&](u32 Begin, u32 End)
+	{
+		u64 Solid = 0;
+		for (u32 i = Begin; i < End; i++)
+			Solid += Terrain_FillChunk(&Noise, Settings, Jobs[i].Chunk, &Heights[Jobs[i].Column * c_ChunkColumnSize]);
+
+		SolidBlocks.fetch_add(Solid, std::memory_order_relaxed);
+	});
+
+	// Neighbors just outside of the region cull against our blocks
+	for (i32 Z = MinChunk.z - 1; Z <= MaxChunk.z; Z++)
+	{
+		for (i32 Y = MinChunk.y - 1; Y <= MaxChunk.y; Y++)
+		{
+			for (i32 X = MinChunk.x - 1; X <= MaxChunk.x; X++)
+			{
+				v3i Coord(X, Y, Z);
+				bool Inside = glm::all(glm::greaterThanEqual(Coord, MinChunk)) && glm::all(glm::lessThan(Coord, MaxChunk));
+				if (Inside || !BlockWorld_IsChunkCoordValid(Coord))
+					continue;
+
+				if (chunk* Neighbor = World->Chunks[BlockWorld_GetChunkIndex(Coord)])
+					Neighbor->Version++;
+			}
+		}
+	}
+
+	VmFree(Heights);
+	VmFree(MaxHeights);
+	VmFree(Jobs);
+
+	auto End = clock::now();
+	Stats.ChunksFilled = JobCount;
+	Stats.SolidBlocks = SolidBlocks.load();
+	Stats.HeightmapMilliseconds = std::chrono::duration<f32, std::milli>(HeightmapEnd - Start).count();
+	Stats.FillMilliseconds = std::chrono::duration<f32, std::milli>(End - HeightmapEnd).count();
+	Stats.TotalMilliseconds = std::chrono::duration<f32, std::milli>(End - Start).count();
+
+	return Stats;
+}
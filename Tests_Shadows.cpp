@@ -0,0 +1,962 @@
+#include "Headless_Shadows.h"
+
+#include "Shadows.h"
+#include "Frustum.h"
+#include "Cascades.h"
+#include "ShadowAtlas.h"
+#include "LightStore.h"
+#include "PointShadows.h"
+#include "ShadowCache.h"
+#include "VirtualShadows.h"
+
+#include <vector>
+
+// Tests
+// Checks the backend-neutral shadow modules against what they promise, without a window, a GPU or a scene.
+// Built like Headless_Shadows, prints every failed check and returns the number of failures, so CI can run it as is.
+//
+// Usage: Tests_Shadows
+
+struct test_state
+{
+	const char* Group;
+	u32 Checks;
+	u32 Failed;
+};
+
+global test_state g_Tests;
+
+#define TestCheck(__cond__, ...) do { \
+    g_Tests.Checks++; \
+    if (!(__cond__)) { \
+        g_Tests.Failed++; \
+        Err("[%s] %s:%d: %s", g_Tests.Group, __FILE__, __LINE__, #__cond__); \
+        Err(__VA_ARGS__); \
+    } \
+} while(0)
+
+internal void Tests_BeginGroup(const char* Group)
+{
+	g_Tests.Group = Group;
+	Trace("%s", Group);
+}
+
+// Same camera for every test that needs one, Position and a yaw/pitch rotation
+internal camera Tests_GetCamera(v3 Position, f32 Yaw, f32 Pitch, f32 Far)
+{
+	camera Camera;
+	Camera.PerspectiveFar = Far;
+	Camera.View = glm::inverse(glm::translate(m4(1.0f), Position) * glm::toMat4(qtn(v3(Pitch, Yaw, 0.0f))));
+	Camera.RecalculateProjectionPerspective(1280, 720);
+	return Camera;
+}
+
+// Frustum
+
+// What D3D12_Shadows.h had before Frustum.h, kept as it was as the reference. NDC depth is [-1, 1] here
+internal std::vector<glm::vec4> getFrustumCornersWorldSpace(const glm::mat4& proj, const glm::mat4& view)
+{
+	const auto inv = glm::inverse(proj * view);
+
+	std::vector<glm::vec4> frustumCorners;
+	for (unsigned int x = 0; x < 2; ++x)
+	{
+		for (unsigned int y = 0; y < 2; ++y)
+		{
+			for (unsigned int z = 0; z < 2; ++z)
+			{
+				const glm::vec4 pt =
+					inv * glm::vec4(
+						2.0f * x - 1.0f,
+						2.0f * y - 1.0f,
+						2.0f * z - 1.0f,
+						1.0f);
+				frustumCorners.push_back(pt / pt.w);
+			}
+		}
+	}
+
+	return frustumCorners;
+}
+
+inline bool Tests_Near(v3 A, v3 B, f32 Tolerance)
+{
+	return glm::length(A - B) <= Tolerance * (1.0f + glm::length(B));
+}
+
+inline v3 Tests_GetLane(const v3x8& V, u32 Lane)
+{
+	alignas(32) f32 X[c_SimdWidth], Y[c_SimdWidth], Z[c_SimdWidth];
+	F32x8Store(X, V.X);
+	F32x8Store(Y, V.Y);
+	F32x8Store(Z, V.Z);
+	return v3(X[Lane], Y[Lane], Z[Lane]);
+}
+
+internal void Tests_Frustum()
+{
+	Tests_BeginGroup("Frustum");
+
+	const m4 LightView = glm::lookAtLH(v3(0.0f), glm::normalize(v3(0.4f, -1.0f, 0.3f)), v3(0.0f, 1.0f, 0.0f));
+
+	for (u32 Test = 0; Test < 100; Test++)
+	{
+		f32 T = (f32)Test;
+		camera Camera = Tests_GetCamera(v3(T, 2.0f * T, -T), T * 0.3f, glm::sin(T * 0.1f), 200.0f);
+		m4 InverseView = glm::inverse(Camera.View);
+		f32 TanHalfFOV = glm::tan(Camera.PerspectiveFOV * 0.5f);
+
+		// The reference gets the same frustum with its own depth range, corner (x, y, z) is its index x * 4 + y * 2 + z
+		m4 ProjectionNO = glm::perspectiveLH_NO(Camera.PerspectiveFOV, Camera.AspectRatio, Camera.PerspectiveNear, Camera.PerspectiveFar);
+		std::vector<glm::vec4> Reference = getFrustumCornersWorldSpace(ProjectionNO, Camera.View);
+		v3 ReferenceCorners[c_FrustumCornerCount];
+		for (u32 i = 0; i < c_FrustumCornerCount; i++)
+			ReferenceCorners[i] = v3(Reference[(i & 1) * 4 + ((i >> 1) & 1) * 2 + (i >> 2)]);
+
+		v3 Corners[c_FrustumCornerCount], SliceCorners[c_FrustumCornerCount];
+		Frustum_GetCorners(glm::inverse(Camera.GetViewProjection()), Corners);
+		Frustum_GetSliceCorners(InverseView, TanHalfFOV, Camera.AspectRatio, Camera.PerspectiveNear, Camera.PerspectiveFar, SliceCorners);
+
+		for (u32 i = 0; i < c_FrustumCornerCount; i++)
+		{
+			TestCheck(Tests_Near(Corners[i], ReferenceCorners[i], 1e-3f), "Camera %u corner %u: (%f, %f, %f), reference (%f, %f, %f)",
+				Test, i, Corners[i].x, Corners[i].y, Corners[i].z, ReferenceCorners[i].x, ReferenceCorners[i].y, ReferenceCorners[i].z);
+			TestCheck(Tests_Near(SliceCorners[i], ReferenceCorners[i], 1e-3f), "Camera %u slice corner %u: (%f, %f, %f), reference (%f, %f, %f)",
+				Test, i, SliceCorners[i].x, SliceCorners[i].y, SliceCorners[i].z, ReferenceCorners[i].x, ReferenceCorners[i].y, ReferenceCorners[i].z);
+		}
+
+		// Fits against the reference corners
+		bounding_sphere Sphere = Frustum_FitSphere(Corners);
+		aabb Bounds = Frustum_FitBounds(Corners, LightView);
+		aabb ReferenceBounds = { v3(FLT_MAX), v3(-FLT_MAX) };
+		v3 ReferenceCenter = v3(0.0f);
+		for (u32 i = 0; i < c_FrustumCornerCount; i++)
+		{
+			v3 Corner = v3(LightView * v4(ReferenceCorners[i], 1.0f));
+			ReferenceBounds.Min = glm::min(ReferenceBounds.Min, Corner);
+			ReferenceBounds.Max = glm::max(ReferenceBounds.Max, Corner);
+			ReferenceCenter += ReferenceCorners[i] / (f32)c_FrustumCornerCount;
+
+			f32 Distance = glm::distance(ReferenceCorners[i], Sphere.Center);
+			TestCheck(Distance <= Sphere.Radius * 1.001f, "Camera %u: corner %u is %f from the center of a sphere of %f", Test, i, Distance, Sphere.Radius);
+		}
+
+		TestCheck(Tests_Near(Sphere.Center, ReferenceCenter, 1e-3f), "Camera %u: sphere center (%f, %f, %f), reference (%f, %f, %f)",
+			Test, Sphere.Center.x, Sphere.Center.y, Sphere.Center.z, ReferenceCenter.x, ReferenceCenter.y, ReferenceCenter.z);
+		TestCheck(Tests_Near(Bounds.Min, ReferenceBounds.Min, 1e-3f) && Tests_Near(Bounds.Max, ReferenceBounds.Max, 1e-3f), "Camera %u: light space box (%f, %f, %f) to (%f, %f, %f)",
+			Test, Bounds.Min.x, Bounds.Min.y, Bounds.Min.z, Bounds.Max.x, Bounds.Max.y, Bounds.Max.z);
+
+		// 8 slices at once, lane i has to match the scalar functions over the same slice
+		alignas(32) f32 Near[c_SimdWidth], Far[c_SimdWidth];
+		for (u32 Lane = 0; Lane < c_SimdWidth; Lane++)
+		{
+			Near[Lane] = Camera.PerspectiveNear + Lane * 3.0f;
+			Far[Lane] = Near[Lane] + 4.0f + Lane * T;
+		}
+
+		v3x8 Corners8[c_FrustumCornerCount], Center8, Min8, Max8;
+		f32x8 Radius8;
+		Frustum_GetSliceCorners8(InverseView, TanHalfFOV, Camera.AspectRatio, F32x8Load(Near), F32x8Load(Far), Corners8);
+		Frustum_FitSpheres8(Corners8, &Center8, &Radius8);
+		Frustum_FitBounds8(Corners8, LightView, &Min8, &Max8);
+
+		alignas(32) f32 Radius[c_SimdWidth];
+		F32x8Store(Radius, Radius8);
+
+		for (u32 Lane = 0; Lane < c_SimdWidth; Lane++)
+		{
+			v3 LaneCorners[c_FrustumCornerCount];
+			Frustum_GetSliceCorners(InverseView, TanHalfFOV, Camera.AspectRatio, Near[Lane], Far[Lane], LaneCorners);
+
+			for (u32 i = 0; i < c_FrustumCornerCount; i++)
+				TestCheck(Tests_Near(Tests_GetLane(Corners8[i], Lane), LaneCorners[i], 1e-5f), "Camera %u lane %u: 8-wide corner %u differs", Test, Lane, i);
+
+			bounding_sphere LaneSphere = Frustum_FitSphere(LaneCorners);
+			aabb LaneBounds = Frustum_FitBounds(LaneCorners, LightView);
+			TestCheck(Tests_Near(Tests_GetLane(Center8, Lane), LaneSphere.Center, 1e-5f) && glm::abs(Radius[Lane] - LaneSphere.Radius) <= 1e-5f * (1.0f + LaneSphere.Radius),
+				"Camera %u lane %u: 8-wide sphere radius %f, scalar %f", Test, Lane, Radius[Lane], LaneSphere.Radius);
+			TestCheck(Tests_Near(Tests_GetLane(Min8, Lane), LaneBounds.Min, 1e-5f) && Tests_Near(Tests_GetLane(Max8, Lane), LaneBounds.Max, 1e-5f),
+				"Camera %u lane %u: 8-wide light space box differs", Test, Lane);
+		}
+	}
+}
+
+// Cascades
+
+internal void Tests_Cascades()
+{
+	Tests_BeginGroup("Cascades");
+
+	// Splits start at near, end at far and grow. Lambda 0 is uniform, 1 is logarithmic
+	{
+		f32 Splits[c_MaxShadowCascades + 1];
+		for (f32 Lambda : { 0.0f, 0.5f, 0.75f, 1.0f })
+		{
+			Cascades_ComputeSplits(0.1f, 160.0f, c_MaxShadowCascades, Lambda, Splits);
+			TestCheck(Splits[0] == 0.1f && Splits[c_MaxShadowCascades] == 160.0f, "Lambda %.2f: splits %f to %f", Lambda, Splits[0], Splits[c_MaxShadowCascades]);
+
+			for (u32 i = 0; i < c_MaxShadowCascades; i++)
+				TestCheck(Splits[i] < Splits[i + 1], "Lambda %.2f: split %u at %f, split %u at %f", Lambda, i, Splits[i], i + 1, Splits[i + 1]);
+		}
+
+		Cascades_ComputeSplits(1.0f, 101.0f, 4, 0.0f, Splits);
+		TestCheck(glm::abs(Splits[1] - 26.0f) < 1e-4f && glm::abs(Splits[2] - 51.0f) < 1e-4f, "Uniform splits %f %f", Splits[1], Splits[2]);
+
+		Cascades_ComputeSplits(1.0f, 16.0f, 4, 1.0f, Splits);
+		TestCheck(glm::abs(Splits[1] - 2.0f) < 1e-4f && glm::abs(Splits[2] - 4.0f) < 1e-4f, "Logarithmic splits %f %f", Splits[1], Splits[2]);
+	}
+
+	const cascade_settings Settings = Cascades_GetDefaultSettings(1024);
+	const v3 LightDirection = glm::normalize(v3(0.4f, -1.0f, 0.3f));
+
+	// Every split is inside its cascade box and its ortho projection, the box is the sphere around the split
+	for (u32 Test = 0; Test < 64; Test++)
+	{
+		f32 T = (f32)Test;
+		camera Camera = Tests_GetCamera(v3(T * 7.0f, 20.0f, -T * 3.0f), T * 0.37f, glm::sin(T * 0.5f), 1000.0f);
+
+		shadow_cascades Cascades = {};
+		Cascades_Fit(&Cascades, Settings, Camera, LightDirection);
+		TestCheck(Cascades.Count == Settings.CascadeCount, "%u cascades", Cascades.Count);
+
+		m4 InverseView = glm::inverse(Camera.View);
+		for (u32 i = 0; i < Cascades.Count; i++)
+		{
+			const shadow_cascade& Cascade = Cascades.Cascades[i];
+			v3 Corners[c_FrustumCornerCount];
+			Frustum_GetSliceCorners(InverseView, glm::tan(Camera.PerspectiveFOV * 0.5f), Camera.AspectRatio, Cascade.SplitNear, Cascade.SplitFar, Corners);
+
+			v3 Size = Cascade.LightSpaceBounds.Max - Cascade.LightSpaceBounds.Min;
+			TestCheck(glm::abs(Size.x - Size.y) < 1e-3f * Size.x, "Camera %u cascade %u: box is %f x %f", Test, i, Size.x, Size.y);
+			TestCheck(glm::abs(Cascade.TexelSize * Settings.Resolution - Size.x) < 1e-3f * Size.x, "Camera %u cascade %u: texel %f for a box of %f", Test, i, Cascade.TexelSize, Size.x);
+
+			for (u32 Corner = 0; Corner < c_FrustumCornerCount; Corner++)
+			{
+				v4 Clip = Cascade.ViewProjection * v4(Corners[Corner], 1.0f);
+				v3 NDC = v3(Clip) / Clip.w;
+				bool Inside = glm::abs(NDC.x) <= 1.0001f && glm::abs(NDC.y) <= 1.0001f && NDC.z >= -1e-4f && NDC.z <= 1.0001f;
+				TestCheck(Inside, "Camera %u cascade %u: corner %u at NDC (%f, %f, %f)", Test, i, Corner, NDC.x, NDC.y, NDC.z);
+			}
+		}
+	}
+
+	// Rotating the camera in place does not change the size of any cascade
+	{
+		shadow_cascades First = {};
+		Cascades_Fit(&First, Settings, Tests_GetCamera(v3(10.0f, 20.0f, 30.0f), 0.0f, 0.0f, 1000.0f), LightDirection);
+
+		for (u32 Test = 1; Test < 32; Test++)
+		{
+			shadow_cascades Rotated = {};
+			Cascades_Fit(&Rotated, Settings, Tests_GetCamera(v3(10.0f, 20.0f, 30.0f), Test * 0.2f, glm::sin(Test * 0.9f), 1000.0f), LightDirection);
+
+			for (u32 i = 0; i < First.Count; i++)
+			{
+				f32 Before = First.Cascades[i].LightSpaceBounds.Max.x - First.Cascades[i].LightSpaceBounds.Min.x;
+				f32 After = Rotated.Cascades[i].LightSpaceBounds.Max.x - Rotated.Cascades[i].LightSpaceBounds.Min.x;
+				TestCheck(glm::abs(Before - After) < 1e-4f * Before, "Rotation %u cascade %u: box went from %f to %f", Test, i, Before, After);
+			}
+		}
+	}
+
+	// Moving the camera moves the cascades in whole texels, a point of the world stays at the same place inside its texel
+	{
+		const v3 Point = v3(3.3f, 1.7f, 8.1f);
+		f32 Reference[c_MaxShadowCascades][2] = {};
+
+		for (u32 Test = 0; Test < 64; Test++)
+		{
+			v3 Position = v3(0.0f, 10.0f, 0.0f) + v3(0.013f, 0.007f, -0.011f) * (f32)Test;
+			shadow_cascades Cascades = {};
+			Cascades_Fit(&Cascades, Settings, Tests_GetCamera(Position, 0.3f, -0.2f, 1000.0f), LightDirection);
+
+			for (u32 i = 0; i < Cascades.Count; i++)
+			{
+				v4 Clip = Cascades.Cascades[i].ViewProjection * v4(Point, 1.0f);
+				v2 Texel = (v2(Clip) * 0.5f + 0.5f) * (f32)Settings.Resolution;
+				v2 Offset = Texel - glm::floor(Texel);
+
+				if (Test == 0)
+				{
+					Reference[i][0] = Offset.x;
+					Reference[i][1] = Offset.y;
+					continue;
+				}
+
+				// Offsets right next to a texel edge can wrap around
+				f32 DifferenceX = glm::abs(Offset.x - Reference[i][0]);
+				f32 DifferenceY = glm::abs(Offset.y - Reference[i][1]);
+				DifferenceX = glm::min(DifferenceX, 1.0f - DifferenceX);
+				DifferenceY = glm::min(DifferenceY, 1.0f - DifferenceY);
+				TestCheck(DifferenceX < 0.01f && DifferenceY < 0.01f, "Step %u cascade %u: point moved (%f, %f) texels inside its texel", Test, i, DifferenceX, DifferenceY);
+			}
+		}
+	}
+
+	// Casters between the light and a receiver are kept, the ones behind it or beside it are not
+	{
+		camera Camera = Tests_GetCamera(v3(0.0f, 10.0f, 0.0f), 0.0f, 0.0f, 1000.0f);
+		shadow_cascades Cascades = {};
+		Cascades_Fit(&Cascades, Settings, Camera, LightDirection);
+
+		v3 Receiver = v3(0.0f, 10.0f, 20.0f);
+		Cascades_AddReceiver(&Cascades, { Receiver - v3(2.0f), Receiver + v3(2.0f) });
+		Cascades_BuildCasterBounds(&Cascades, Settings);
+
+		auto GetMask = [&Cascades](v3 Center) { return Cascades_GetCasterMask(&Cascades, { Center - v3(0.5f), Center + v3(0.5f) }); };
+		TestCheck(GetMask(Receiver - LightDirection * 10.0f) != 0, "Caster above the receiver is culled");
+		TestCheck(GetMask(Receiver + LightDirection * 10.0f) == 0, "Caster behind the receiver has mask 0x%X", GetMask(Receiver + LightDirection * 10.0f));
+		TestCheck(GetMask(Receiver + v3(40.0f, 0.0f, 0.0f)) == 0, "Caster beside the receiver has mask 0x%X", GetMask(Receiver + v3(40.0f, 0.0f, 0.0f)));
+
+		// Without receivers nothing can cast a visible shadow
+		Cascades_Fit(&Cascades, Settings, Camera, LightDirection);
+		Cascades_BuildCasterBounds(&Cascades, Settings);
+		TestCheck(GetMask(Receiver - LightDirection * 10.0f) == 0, "Caster without receivers has mask 0x%X", GetMask(Receiver - LightDirection * 10.0f));
+	}
+}
+
+// Shadow atlas
+
+// Free and used nodes have to cover the atlas exactly once, and the counts per level have to match them
+internal bool Tests_CheckAtlasNodes(const shadow_atlas* Atlas, u8* Cells)
+{
+	u32 Side = Atlas->Size / Atlas->MinTileSize;
+	memset(Cells, 0, Side * Side);
+
+	u32 FreeCounts[c_ShadowAtlasMaxLevels] = {}, UsedCounts[c_ShadowAtlasMaxLevels] = {};
+	for (u32 Level = 0; Level < Atlas->LevelCount; Level++)
+	{
+		for (u32 Node = Atlas->LevelOffsets[Level]; Node < Atlas->LevelOffsets[Level + 1]; Node++)
+		{
+			if (Atlas->Nodes[Node] != shadow_atlas_node::Free && Atlas->Nodes[Node] != shadow_atlas_node::Used)
+				continue;
+
+			(Atlas->Nodes[Node] == shadow_atlas_node::Free ? FreeCounts : UsedCounts)[Level]++;
+
+			shadow_atlas_rect Rect = ShadowAtlas_GetRect(Atlas, Node);
+			for (u32 Y = Rect.Y / Atlas->MinTileSize; Y < (Rect.Y + Rect.Size) / Atlas->MinTileSize; Y++)
+			{
+				for (u32 X = Rect.X / Atlas->MinTileSize; X < (Rect.X + Rect.Size) / Atlas->MinTileSize; X++)
+					Cells[Y * Side + X]++;
+			}
+		}
+	}
+
+	for (u32 i = 0; i < Side * Side; i++)
+	{
+		if (Cells[i] != 1)
+			return false;
+	}
+
+	for (u32 Level = 0; Level < Atlas->LevelCount; Level++)
+	{
+		if (FreeCounts[Level] != Atlas->FreeCounts[Level] || UsedCounts[Level] != Atlas->UsedCounts[Level])
+			return false;
+	}
+
+	return true;
+}
+
+// Allocation only fails when no free node is as big as the tile
+internal bool Tests_HasFreeTile(const shadow_atlas* Atlas, u32 TileSize)
+{
+	for (u32 Level = 0; Level < Atlas->LevelCount && (Atlas->Size >> Level) >= TileSize; Level++)
+	{
+		if (Atlas->FreeCounts[Level] > 0)
+			return true;
+	}
+
+	return false;
+}
+
+// Same sequence on every run
+inline u32 Tests_Random(u32* State)
+{
+	*State = *State * 1664525u + 1013904223u;
+	return *State >> 8;
+}
+
+internal void Tests_ShadowAtlas()
+{
+	Tests_BeginGroup("Shadow atlas");
+
+	shadow_atlas* Atlas = VmAllocArray(shadow_atlas, 1);
+	ShadowAtlas_Initialize(Atlas, c_ShadowAtlasSize, c_ShadowAtlasMinTile);
+	u32 Side = Atlas->Size / Atlas->MinTileSize;
+	u8* Cells = VmAllocArray(u8, Side * Side);
+
+	// 16 tiles of a quarter fill it, the 17th does not fit, freeing them merges everything back into the root
+	{
+		u32 Tiles[16];
+		for (u32 i = 0; i < CountOf(Tiles); i++)
+		{
+			Tiles[i] = ShadowAtlas_Allocate(Atlas, Atlas->Size / 4);
+			TestCheck(Tiles[i] != c_ShadowAtlasNoTile, "Quarter tile %u did not fit", i);
+		}
+
+		TestCheck(ShadowAtlas_Allocate(Atlas, Atlas->MinTileSize) == c_ShadowAtlasNoTile, "Full atlas handed out a tile");
+		TestCheck(Tests_CheckAtlasNodes(Atlas, Cells), "Full atlas nodes do not cover it once");
+
+		for (u32 i = 0; i < CountOf(Tiles); i++)
+			ShadowAtlas_Free(Atlas, Tiles[i]);
+
+		TestCheck(Atlas->FreeCounts[0] == 1 && Atlas->Nodes[0] == shadow_atlas_node::Free, "Emptied atlas did not merge back into the root");
+	}
+
+	// Checkerboard of freed tiles, every free texel is in a tile too small to merge
+	{
+		u32 Tiles[256];
+		for (u32 i = 0; i < CountOf(Tiles); i++)
+			Tiles[i] = ShadowAtlas_Allocate(Atlas, Atlas->Size / 16);
+
+		for (u32 i = 0; i < CountOf(Tiles); i++)
+		{
+			shadow_atlas_rect Rect = ShadowAtlas_GetRect(Atlas, Tiles[i]);
+			if (((Rect.X + Rect.Y) / Rect.Size) & 1)
+			{
+				ShadowAtlas_Free(Atlas, Tiles[i]);
+				Tiles[i] = c_ShadowAtlasNoTile;
+			}
+		}
+
+		ShadowAtlas_BeginFrame(Atlas);
+		shadow_atlas_stats Stats = ShadowAtlas_EndFrame(Atlas);
+		TestCheck(Stats.Occupancy == 0.5f && Stats.LargestFreeTile == Atlas->Size / 16, "Checkerboard: occupancy %.3f, largest free tile %u", Stats.Occupancy, Stats.LargestFreeTile);
+		TestCheck(Stats.Fragmentation > 0.9f, "Checkerboard: fragmentation %.3f", Stats.Fragmentation);
+
+		for (u32 i = 0; i < CountOf(Tiles); i++)
+		{
+			if (Tiles[i] != c_ShadowAtlasNoTile)
+				ShadowAtlas_Free(Atlas, Tiles[i]);
+		}
+
+		ShadowAtlas_BeginFrame(Atlas);
+		Stats = ShadowAtlas_EndFrame(Atlas);
+		TestCheck(Stats.Occupancy == 0.0f && Stats.Fragmentation == 0.0f && Stats.LargestFreeTile == Atlas->Size, "Emptied: occupancy %.3f, fragmentation %.3f, largest free tile %u",
+			Stats.Occupancy, Stats.Fragmentation, Stats.LargestFreeTile);
+	}
+
+	// Random allocations and frees of every size, twice as many allocations so the atlas keeps running full
+	{
+		u32 Live[1024];
+		u32 LiveCount = 0, Random = 1, Failed = 0;
+		for (u32 Step = 0; Step < 20000; Step++)
+		{
+			if (LiveCount > 0 && (LiveCount == CountOf(Live) || Tests_Random(&Random) % 3 == 0))
+			{
+				u32 i = Tests_Random(&Random) % LiveCount;
+				ShadowAtlas_Free(Atlas, Live[i]);
+				Live[i] = Live[--LiveCount];
+			}
+			else
+			{
+				u32 TileSize = Atlas->MinTileSize << (Tests_Random(&Random) % 5);
+				u32 Tile = ShadowAtlas_Allocate(Atlas, TileSize);
+				if (Tile == c_ShadowAtlasNoTile)
+				{
+					Failed++;
+					TestCheck(!Tests_HasFreeTile(Atlas, TileSize), "Step %u: %u tile failed with a free node big enough", Step, TileSize);
+				}
+				else
+				{
+					TestCheck(ShadowAtlas_GetRect(Atlas, Tile).Size == TileSize, "Step %u: asked for %u, got %u", Step, TileSize, ShadowAtlas_GetRect(Atlas, Tile).Size);
+					Live[LiveCount++] = Tile;
+				}
+			}
+
+			if (Step % 100 == 0)
+				TestCheck(Tests_CheckAtlasNodes(Atlas, Cells), "Step %u: nodes do not cover the atlas once", Step);
+		}
+
+		TestCheck(Failed > 0, "Churn never filled the atlas, it tests nothing about running out");
+
+		while (LiveCount > 0)
+			ShadowAtlas_Free(Atlas, Live[--LiveCount]);
+
+		TestCheck(Atlas->FreeCounts[0] == 1 && Atlas->Nodes[0] == shadow_atlas_node::Free, "Atlas did not merge back into the root after the churn");
+	}
+
+	// Owners keep their tiles while they request the same size, everything else stays where it is when one changes
+	{
+		u32 Before[8][c_PointShadowFaceCount];
+		ShadowAtlas_BeginFrame(Atlas);
+		for (u32 Owner = 0; Owner < 8; Owner++)
+			ShadowAtlas_Request(Atlas, Owner, 256, c_PointShadowFaceCount);
+
+		shadow_atlas_stats Stats = ShadowAtlas_EndFrame(Atlas);
+		TestCheck(Stats.Owners == 8 && Stats.Tiles == 48 && Stats.Reallocated == 8, "%u owners, %u tiles, %u reallocated", Stats.Owners, Stats.Tiles, Stats.Reallocated);
+		TestCheck(Stats.Occupancy == 48.0f * 256 * 256 / ((f32)Atlas->Size * Atlas->Size), "Occupancy %.4f", Stats.Occupancy);
+
+		for (u32 Owner = 0; Owner < 8; Owner++)
+			memcpy(Before[Owner], Atlas->Owners[Owner].Tiles, sizeof(Before[Owner]));
+
+		ShadowAtlas_BeginFrame(Atlas);
+		for (u32 Owner = 0; Owner < 8; Owner++)
+			ShadowAtlas_Request(Atlas, Owner, Owner == 3 ? 512 : 256, c_PointShadowFaceCount);
+
+		Stats = ShadowAtlas_EndFrame(Atlas);
+		TestCheck(Stats.Reallocated == 1 && Atlas->Owners[3].Changed && Atlas->Owners[3].TileSize == 512, "Resized owner: %u reallocated, tile size %u", Stats.Reallocated, Atlas->Owners[3].TileSize);
+
+		for (u32 Owner = 0; Owner < 8; Owner++)
+		{
+			if (Owner != 3)
+				TestCheck(!Atlas->Owners[Owner].Changed && memcmp(Before[Owner], Atlas->Owners[Owner].Tiles, sizeof(Before[Owner])) == 0, "Owner %u lost its tiles", Owner);
+		}
+
+		// Owners that stop requesting give their tiles back
+		ShadowAtlas_BeginFrame(Atlas);
+		for (u32 Owner = 0; Owner < 4; Owner++)
+			ShadowAtlas_Request(Atlas, Owner, Owner == 3 ? 512 : 256, c_PointShadowFaceCount);
+
+		Stats = ShadowAtlas_EndFrame(Atlas);
+		TestCheck(Stats.Owners == 4 && Stats.Tiles == 24 && Stats.Reallocated == 0, "%u owners, %u tiles, %u reallocated", Stats.Owners, Stats.Tiles, Stats.Reallocated);
+
+		ShadowAtlas_BeginFrame(Atlas);
+		Stats = ShadowAtlas_EndFrame(Atlas);
+		TestCheck(Stats.Tiles == 0 && Atlas->FreeCounts[0] == 1, "%u tiles left without owners", Stats.Tiles);
+	}
+
+	// More than fits: biggest first, the rest fall back to smaller tiles or get nothing, and keep that while nothing changes
+	{
+		ShadowAtlas_BeginFrame(Atlas);
+		for (u32 Owner = 0; Owner < c_ShadowAtlasMaxOwners; Owner++)
+			ShadowAtlas_Request(Atlas, Owner, c_ShadowAtlasMaxTile, c_PointShadowFaceCount);
+
+		shadow_atlas_stats Stats = ShadowAtlas_EndFrame(Atlas);
+		TestCheck(Stats.Owners + Stats.Failed == c_ShadowAtlasMaxOwners, "%u owners and %u failed of %u", Stats.Owners, Stats.Failed, c_ShadowAtlasMaxOwners);
+		TestCheck(Stats.Downgraded > 0 && Stats.Failed > 0, "Overfull atlas: %u downgraded, %u failed", Stats.Downgraded, Stats.Failed);
+		TestCheck(Atlas->Owners[0].TileSize == c_ShadowAtlasMaxTile, "First owner got %u", Atlas->Owners[0].TileSize);
+		TestCheck(Tests_CheckAtlasNodes(Atlas, Cells), "Overfull atlas nodes do not cover it once");
+
+		ShadowAtlas_BeginFrame(Atlas);
+		for (u32 Owner = 0; Owner < c_ShadowAtlasMaxOwners; Owner++)
+			ShadowAtlas_Request(Atlas, Owner, c_ShadowAtlasMaxTile, c_PointShadowFaceCount);
+
+		u32 Owners = Stats.Owners;
+		Stats = ShadowAtlas_EndFrame(Atlas);
+		TestCheck(Stats.Reallocated == 0 && Stats.Owners == Owners, "Same overfull requests again: %u reallocated, %u owners instead of %u", Stats.Reallocated, Stats.Owners, Owners);
+
+		ShadowAtlas_BeginFrame(Atlas);
+		ShadowAtlas_EndFrame(Atlas);
+	}
+
+	// Owners come and go and change sizes every few frames
+	{
+		u32 Random = 7;
+		u32 Sizes[c_ShadowAtlasMaxOwners] = {};
+		u32 Kept[c_ShadowAtlasMaxOwners][c_ShadowAtlasMaxOwnerTiles] = {};
+		for (u32 Frame = 0; Frame < 500; Frame++)
+		{
+			ShadowAtlas_BeginFrame(Atlas);
+			u32 Requesting = 0;
+			bool SameRequest[c_ShadowAtlasMaxOwners] = {};
+			for (u32 Owner = 0; Owner < c_ShadowAtlasMaxOwners; Owner++)
+			{
+				u32 Roll = Tests_Random(&Random) % 100;
+				u32 Size = Roll < 5 ? 0 : Roll < 15 ? (Atlas->MinTileSize << (Tests_Random(&Random) % 5)) : Sizes[Owner];
+				SameRequest[Owner] = Size != 0 && Size == Sizes[Owner];
+				Sizes[Owner] = Size;
+				if (Size == 0)
+					continue;
+
+				ShadowAtlas_Request(Atlas, Owner, Size, c_PointShadowFaceCount);
+				Requesting++;
+			}
+
+			const shadow_atlas_stats& Stats = ShadowAtlas_EndFrame(Atlas);
+			TestCheck(Stats.Owners + Stats.Failed == Requesting, "Frame %u: %u owners and %u failed of %u requests", Frame, Stats.Owners, Stats.Failed, Requesting);
+			TestCheck(Tests_CheckAtlasNodes(Atlas, Cells), "Frame %u: nodes do not cover the atlas once", Frame);
+
+			for (u32 Owner = 0; Owner < c_ShadowAtlasMaxOwners; Owner++)
+			{
+				const shadow_atlas_owner& State = Atlas->Owners[Owner];
+				for (u32 i = 0; i < State.TileCount; i++)
+				{
+					TestCheck(Atlas->Nodes[State.Tiles[i]] == shadow_atlas_node::Used && ShadowAtlas_GetRect(Atlas, State.Tiles[i]).Size == State.TileSize,
+						"Frame %u: owner %u tile %u is not a used %u tile", Frame, Owner, i, State.TileSize);
+				}
+
+				// Same request with tiles last frame keeps the very same tiles
+				if (SameRequest[Owner] && Kept[Owner][0] != 0 && State.TileCount > 0)
+					TestCheck(!State.Changed && memcmp(Kept[Owner], State.Tiles, sizeof(u32) * State.TileCount) == 0, "Frame %u: owner %u got new tiles for the same request", Frame, Owner);
+
+				memset(Kept[Owner], 0, sizeof(Kept[Owner]));
+				if (State.TileCount > 0)
+					memcpy(Kept[Owner], State.Tiles, sizeof(u32) * State.TileCount);
+			}
+		}
+	}
+
+	VmFree(Cells);
+	ShadowAtlas_Destroy(Atlas);
+	VmFree(Atlas);
+}
+
+// Point shadows
+
+struct tests_point_caster
+{
+	u64 Key;
+	u64 Revision;
+	v3 Center;
+};
+
+// One frame of the tracker, returns the faces of every light that have to be rendered and marks them clean like a backend would
+internal u32 Tests_PointShadowFrame(point_shadow_tracker* Tracker, shadow_atlas* Atlas, light_store* Lights, light_environment* Environment,
+	const camera& Camera, const tests_point_caster* Casters, u32 CasterCount, u32* DirtyFaces)
+{
+	PointShadows_BeginFrame(Tracker, Lights);
+	PointShadows_AssignTiles(Tracker, Atlas, Lights, Environment, Camera, 720.0f);
+
+	for (u32 i = 0; i < CasterCount; i++)
+		PointShadows_SubmitCaster(Tracker, Casters[i].Key, Casters[i].Revision, { Casters[i].Center - v3(0.5f), Casters[i].Center + v3(0.5f) });
+
+	const point_shadow_stats& Stats = PointShadows_EndFrame(Tracker);
+	for (u32 i = 0; i < Tracker->LightCount; i++)
+	{
+		DirtyFaces[i] = PointShadows_GetDirtyFaces(Tracker, i);
+		PointShadows_MarkClean(Tracker, i, DirtyFaces[i]);
+	}
+
+	return Stats.DirtyFaces;
+}
+
+internal void Tests_PointShadows()
+{
+	Tests_BeginGroup("Point shadows");
+
+	// Face masks, +X -X +Y -Y +Z -Z
+	TestCheck(PointShadows_GetFaceMask(v3(0.0f), 10.0f, { v3(4.5f, -0.5f, -0.5f), v3(5.5f, 0.5f, 0.5f) }) == 0x01, "Box on +X");
+	TestCheck(PointShadows_GetFaceMask(v3(0.0f), 10.0f, { v3(-0.5f, -5.5f, -0.5f), v3(0.5f, -4.5f, 0.5f) }) == 0x08, "Box on -Y");
+	TestCheck(PointShadows_GetFaceMask(v3(0.0f), 10.0f, { v3(4.5f, 4.5f, -0.5f), v3(5.5f, 5.5f, 0.5f) }) == 0x05, "Box on the +X +Y edge");
+	TestCheck(PointShadows_GetFaceMask(v3(0.0f), 10.0f, { v3(-1.0f), v3(1.0f) }) == c_PointShadowAllFaces, "Box around the light");
+	TestCheck(PointShadows_GetFaceMask(v3(0.0f), 10.0f, { v3(10.5f, -0.5f, -0.5f), v3(11.5f, 0.5f, 0.5f) }) == 0, "Box past the radius");
+
+	light_store* Lights = VmAllocArray(light_store, 1);
+	LightStore_Initialize(Lights, 16);
+	light_environment* Environment = VmAllocArray(light_environment, 1);
+	shadow_atlas* Atlas = VmAllocArray(shadow_atlas, 1);
+	ShadowAtlas_Initialize(Atlas, c_ShadowAtlasSize, c_ShadowAtlasMinTile);
+	point_shadow_tracker* Tracker = VmAllocArray(point_shadow_tracker, 1);
+	PointShadows_Initialize(Tracker, 64);
+
+	camera Camera = Tests_GetCamera(v3(0.0f, 0.0f, -20.0f), 0.0f, 0.0f, 1000.0f);
+	light_handle Light = LightStore_Create(Lights, v3(0.0f), 10.0f, 1.0f, v3(1.0f), 1.0f, light_flags::CastsShadow);
+	LightStore_Create(Lights, v3(100.0f, 0.0f, 0.0f), 10.0f, 1.0f, v3(1.0f), 1.0f, light_flags::CastsShadow);
+	LightStore_Create(Lights, v3(0.0f, 50.0f, 0.0f), 10.0f, 1.0f, v3(1.0f), 1.0f); // No shadows, never tracked
+
+	tests_point_caster Casters[] =
+	{
+		{ 1, 0, v3(5.0f, 0.0f, 0.0f) },   // +X of the first light
+		{ 2, 0, v3(0.0f, 0.0f, -5.0f) },  // -Z of the first light
+		{ 3, 0, v3(100.0f, 0.0f, 5.0f) }, // +Z of the second light
+		{ 4, 0, v3(50.0f, 0.0f, 0.0f) },  // Outside of every light
+	};
+	u32 CasterCount = CountOf(Casters);
+	u32 Dirty[c_MaxPointShadows] = {};
+
+	// New lights render their whole cube once, then nothing changes and nothing renders
+	Tests_PointShadowFrame(Tracker, Atlas, Lights, Environment, Camera, Casters, CasterCount, Dirty);
+	TestCheck(Tracker->LightCount == 2, "%u shadowed lights", Tracker->LightCount);
+	TestCheck(Dirty[0] == c_PointShadowAllFaces && Dirty[1] == c_PointShadowAllFaces, "First frame dirty faces 0x%X 0x%X", Dirty[0], Dirty[1]);
+	TestCheck(Tracker->Stats.TrackedCasters == 3, "%u tracked casters, the one outside of every light is not tracked", Tracker->Stats.TrackedCasters);
+
+	for (u32 Frame = 0; Frame < 8; Frame++)
+	{
+		u32 Faces = Tests_PointShadowFrame(Tracker, Atlas, Lights, Environment, Camera, Casters, CasterCount, Dirty);
+		TestCheck(Faces == 0, "Static frame %u rendered %u faces", Frame, Faces);
+	}
+
+	// Moving inside its face dirties only that face of only that light
+	Casters[0].Center.x += 1.0f;
+	Tests_PointShadowFrame(Tracker, Atlas, Lights, Environment, Camera, Casters, CasterCount, Dirty);
+	TestCheck(Dirty[0] == 0x01 && Dirty[1] == 0, "Moved on +X: dirty faces 0x%X 0x%X", Dirty[0], Dirty[1]);
+	TestCheck(Tracker->Stats.MovedCasters == 1, "%u moved casters", Tracker->Stats.MovedCasters);
+
+	// Moving to another face dirties the face it left and the one it entered
+	Casters[0].Center = v3(0.0f, 6.0f, 0.0f);
+	Tests_PointShadowFrame(Tracker, Atlas, Lights, Environment, Camera, Casters, CasterCount, Dirty);
+	TestCheck(Dirty[0] == 0x05 && Dirty[1] == 0, "Moved from +X to +Y: dirty faces 0x%X 0x%X", Dirty[0], Dirty[1]);
+
+	// A new revision at the same place dirties what it sees
+	Casters[1].Revision++;
+	Tests_PointShadowFrame(Tracker, Atlas, Lights, Environment, Camera, Casters, CasterCount, Dirty);
+	TestCheck(Dirty[0] == 0x20 && Dirty[1] == 0, "New revision on -Z: dirty faces 0x%X 0x%X", Dirty[0], Dirty[1]);
+
+	// Casters outside of every light can do what they want
+	Casters[3].Center.y += 3.0f;
+	Casters[3].Revision++;
+	u32 Faces = Tests_PointShadowFrame(Tracker, Atlas, Lights, Environment, Camera, Casters, CasterCount, Dirty);
+	TestCheck(Faces == 0, "Caster outside of every light rendered %u faces", Faces);
+
+	// Removed, then added back
+	Tests_PointShadowFrame(Tracker, Atlas, Lights, Environment, Camera, Casters, CasterCount - 2, Dirty);
+	TestCheck(Dirty[0] == 0 && Dirty[1] == 0x10, "Removed on +Z of the second light: dirty faces 0x%X 0x%X", Dirty[0], Dirty[1]);
+	TestCheck(Tracker->Stats.RemovedCasters == 1 && Tracker->Stats.TrackedCasters == 2, "%u removed, %u tracked", Tracker->Stats.RemovedCasters, Tracker->Stats.TrackedCasters);
+
+	Tests_PointShadowFrame(Tracker, Atlas, Lights, Environment, Camera, Casters, CasterCount, Dirty);
+	TestCheck(Dirty[0] == 0 && Dirty[1] == 0x10, "Added on +Z of the second light: dirty faces 0x%X 0x%X", Dirty[0], Dirty[1]);
+	TestCheck(Tracker->Stats.AddedCasters == 1, "%u added casters", Tracker->Stats.AddedCasters);
+
+	// Leaving the radius is a removal
+	Casters[1].Center = v3(0.0f, 0.0f, -30.0f);
+	Tests_PointShadowFrame(Tracker, Atlas, Lights, Environment, Camera, Casters, CasterCount, Dirty);
+	TestCheck(Dirty[0] == 0x20 && Dirty[1] == 0, "Left the radius on -Z: dirty faces 0x%X 0x%X", Dirty[0], Dirty[1]);
+	TestCheck(Tracker->Stats.RemovedCasters == 1, "%u removed casters", Tracker->Stats.RemovedCasters);
+
+	// Moving the light invalidates its whole cube and nothing else
+	LightStore_SetPosition(Lights, Light, v3(0.0f, 1.0f, 0.0f));
+	Tests_PointShadowFrame(Tracker, Atlas, Lights, Environment, Camera, Casters, CasterCount, Dirty);
+	TestCheck(Dirty[0] == c_PointShadowAllFaces && Dirty[1] == 0, "Moved light: dirty faces 0x%X 0x%X", Dirty[0], Dirty[1]);
+
+	Faces = Tests_PointShadowFrame(Tracker, Atlas, Lights, Environment, Camera, Casters, CasterCount, Dirty);
+	TestCheck(Faces == 0, "Static frame after all that rendered %u faces", Faces);
+
+	PointShadows_Destroy(Tracker);
+	ShadowAtlas_Destroy(Atlas);
+	LightStore_Destroy(Lights);
+	VmFree(Tracker);
+	VmFree(Atlas);
+	VmFree(Environment);
+	VmFree(Lights);
+}
+
+// Virtual shadows
+
+struct tests_virtual_caster
+{
+	u64 Key;
+	u64 Revision;
+	aabb Bounds;
+};
+
+// One frame over a flat ground of 32 unit receivers around the camera and the casters, like the backends submit them
+internal const virtual_shadow_stats& Tests_VirtualShadowFrame(virtual_shadow_map* Map, const m4& LightView, const camera& Camera, f32 ViewportHeight,
+	const tests_virtual_caster* Casters, u32 CasterCount)
+{
+	VirtualShadows_BeginFrame(Map, LightView, Camera, ViewportHeight);
+
+	v3 Position = v3(glm::inverse(Camera.View)[3]);
+	for (i32 Z = -5; Z < 5; Z++)
+	{
+		for (i32 X = -5; X < 5; X++)
+		{
+			v3 Min = v3(glm::floor(Position.x / 32.0f) * 32.0f + X * 32.0f, -1.0f, glm::floor(Position.z / 32.0f) * 32.0f + Z * 32.0f);
+			VirtualShadows_AddReceiver(Map, { Min, Min + v3(32.0f, 1.0f, 32.0f) });
+		}
+	}
+
+	for (u32 i = 0; i < CasterCount; i++)
+		VirtualShadows_AddCaster(Map, Casters[i].Key, Casters[i].Revision, Casters[i].Bounds);
+
+	return VirtualShadows_EndFrame(Map);
+}
+
+// Requested pages are in their table slot with their ancestors and resident unless they overflowed, pool pages have one owner and the GPU table says the same
+internal bool Tests_CheckVirtualPages(const virtual_shadow_map* Map, virtual_shadow_gpu_page* Table, u8* PoolUsers)
+{
+	memset(PoolUsers, 0, c_VirtualShadowPoolPageCount);
+	VirtualShadows_GetPageTable(Map, Table);
+
+	u32 Resident = 0, Missing = 0;
+	for (u32 Index = 0; Index < c_VirtualShadowTableSize; Index++)
+	{
+		const virtual_shadow_page& Page = Map->Pages[Index];
+		if (!Page.Occupied)
+			continue;
+
+		if (VirtualShadows_GetTableIndex(Page.Level, Page.X, Page.Y) != Index || Table[Index].Tag != VirtualShadows_PackTag(Page.X, Page.Y))
+			return false;
+
+		if (Page.RequestFrame == Map->Frame && Page.Level + 1 < c_VirtualShadowLevels)
+		{
+			const virtual_shadow_page& Parent = Map->Pages[VirtualShadows_GetTableIndex(Page.Level + 1, Page.X >> 1, Page.Y >> 1)];
+			if (Parent.RequestFrame != Map->Frame || Parent.X != (Page.X >> 1) || Parent.Y != (Page.Y >> 1))
+				return false;
+		}
+
+		if (Page.RequestFrame == Map->Frame && Page.PhysicalPage == c_VirtualShadowNoPage)
+			Missing++;
+
+		if (Page.PhysicalPage != c_VirtualShadowNoPage)
+		{
+			if (Map->PageOwners[Page.PhysicalPage] != Index || PoolUsers[Page.PhysicalPage]++ > 0)
+				return false;
+
+			Resident++;
+		}
+
+		if (Table[Index].PhysicalPage != (Page.Valid ? Page.PhysicalPage : c_VirtualShadowNoPage))
+			return false;
+	}
+
+	return Missing == Map->Stats.Overflowed && Resident + Map->FreeCount == c_VirtualShadowPoolPageCount;
+}
+
+internal u32 Tests_CountVirtualPages(const virtual_shadow_map* Map, const aabb& A, const aabb& B)
+{
+	u32 Count = 0;
+	for (u32 Index = 0; Index < c_VirtualShadowTableSize; Index++)
+	{
+		if (Map->Pages[Index].RequestFrame == Map->Frame && (VirtualShadows_CasterOverlapsPage(Map, Index, A) || VirtualShadows_CasterOverlapsPage(Map, Index, B)))
+			Count++;
+	}
+
+	return Count;
+}
+
+internal void Tests_VirtualShadows()
+{
+	Tests_BeginGroup("Virtual shadows");
+
+	virtual_shadow_map* Map = VmAllocArray(virtual_shadow_map, 1);
+	VirtualShadows_Initialize(Map, VirtualShadows_GetDefaultSettings(-64.0f, 64.0f));
+	virtual_shadow_gpu_page* Table = VmAllocArray(virtual_shadow_gpu_page, c_VirtualShadowTableSize);
+	u8* PoolUsers = VmAllocArray(u8, c_VirtualShadowPoolPageCount);
+
+	const m4 LightView = glm::lookAtLH(v3(0.0f), glm::normalize(v3(0.4f, -1.0f, 0.3f)), v3(0.0f, 1.0f, 0.0f));
+	camera Camera = Tests_GetCamera(v3(0.0f, 10.0f, 0.0f), 0.0f, 0.4f, 1000.0f);
+	tests_virtual_caster Casters[] =
+	{
+		{ 1, 0, { v3(4.0f, 0.0f, 10.0f), v3(6.0f, 8.0f, 12.0f) } },
+		{ 2, 0, { v3(-20.0f, 0.0f, 30.0f), v3(-12.0f, 4.0f, 38.0f) } },
+		{ 3, 0, { v3(40.0f, 0.0f, 60.0f), v3(44.0f, 20.0f, 64.0f) } },
+	};
+	u32 CasterCount = CountOf(Casters);
+
+	// First frame requests the pages the ground samples, all of them fit and the render budget takes the coarse ones first
+	virtual_shadow_stats Stats = Tests_VirtualShadowFrame(Map, LightView, Camera, 720.0f, Casters, CasterCount);
+	TestCheck(Stats.Requested > Map->Settings.MaxPageRenders && Stats.Requested < c_VirtualShadowPoolPageCount, "%u pages requested", Stats.Requested);
+	TestCheck(Stats.Resident == Stats.Requested && Stats.Allocated == Stats.Requested && Stats.Overflowed == 0, "%u requested, %u resident, %u allocated, %u overflowed",
+		Stats.Requested, Stats.Resident, Stats.Allocated, Stats.Overflowed);
+	TestCheck(Stats.Rendered == Map->Settings.MaxPageRenders && Stats.Waiting == Stats.Requested - Stats.Rendered, "%u rendered, %u waiting", Stats.Rendered, Stats.Waiting);
+	TestCheck(Tests_CheckVirtualPages(Map, Table, PoolUsers), "Page table after the first frame");
+
+	u32 RenderedLevel = c_VirtualShadowLevels;
+	for (u32 i = 0; i < Map->RenderCount; i++)
+		RenderedLevel = glm::min(RenderedLevel, Map->Pages[Map->RenderList[i]].Level);
+	for (u32 Index = 0; Index < c_VirtualShadowTableSize; Index++)
+	{
+		const virtual_shadow_page& Page = Map->Pages[Index];
+		if (Page.RequestFrame == Map->Frame && !Page.Valid)
+			TestCheck(Page.Level <= RenderedLevel, "Level %u page waits behind a level %u one", Page.Level, RenderedLevel);
+	}
+
+	// Waiting pages are rendered over the next frames, then a static scene renders nothing
+	u32 Frames = 1;
+	while (Stats.Waiting > 0 && Frames < 32)
+	{
+		Stats = Tests_VirtualShadowFrame(Map, LightView, Camera, 720.0f, Casters, CasterCount);
+		Frames++;
+	}
+	TestCheck(Stats.Waiting == 0, "Still %u pages waiting after %u frames", Stats.Waiting, Frames);
+
+	Stats = Tests_VirtualShadowFrame(Map, LightView, Camera, 720.0f, Casters, CasterCount);
+	TestCheck(Stats.Rendered == 0 && Stats.Allocated == 0 && Stats.Evicted == 0, "Static frame: %u rendered, %u allocated, %u evicted", Stats.Rendered, Stats.Allocated, Stats.Evicted);
+
+	// A moving caster renders the pages it left and the ones it entered, nothing else
+	aabb Before = Casters[0].Bounds;
+	Casters[0].Bounds.Min.x += 3.0f;
+	Casters[0].Bounds.Max.x += 3.0f;
+	Casters[0].Revision++;
+	Stats = Tests_VirtualShadowFrame(Map, LightView, Camera, 720.0f, Casters, CasterCount);
+	u32 Touched = Tests_CountVirtualPages(Map, Before, Casters[0].Bounds);
+	TestCheck(Stats.Rendered > 0 && Stats.Rendered == Touched && Stats.Waiting == 0, "Moved caster: %u rendered of the %u it touched, %u waiting", Stats.Rendered, Touched, Stats.Waiting);
+	for (u32 i = 0; i < Map->RenderCount; i++)
+	{
+		u32 Page = Map->RenderList[i];
+		TestCheck(VirtualShadows_CasterOverlapsPage(Map, Page, Before) || VirtualShadows_CasterOverlapsPage(Map, Page, Casters[0].Bounds), "Moved caster rendered page %u it never touched", Page);
+	}
+
+	Stats = Tests_VirtualShadowFrame(Map, LightView, Camera, 720.0f, Casters, CasterCount);
+	TestCheck(Stats.Rendered == 0, "Frame after the move rendered %u pages", Stats.Rendered);
+
+	// Removing it renders the pages it is in now, the same bounds under a new key do too
+	Stats = Tests_VirtualShadowFrame(Map, LightView, Camera, 720.0f, Casters + 1, CasterCount - 1);
+	Touched = Tests_CountVirtualPages(Map, Casters[0].Bounds, Casters[0].Bounds);
+	TestCheck(Stats.Rendered > 0 && Stats.Rendered == Touched, "Removed caster: %u rendered of the %u it is in", Stats.Rendered, Touched);
+
+	Stats = Tests_VirtualShadowFrame(Map, LightView, Camera, 720.0f, Casters, CasterCount);
+	TestCheck(Stats.Rendered == Touched, "Caster back: %u rendered of the %u it is in", Stats.Rendered, Touched);
+
+	Casters[0].Key = 4;
+	Stats = Tests_VirtualShadowFrame(Map, LightView, Camera, 720.0f, Casters, CasterCount);
+	TestCheck(Stats.Rendered == Touched, "New key: %u rendered of the %u it is in", Stats.Rendered, Touched);
+
+	// Nothing requested under it, nothing to render
+	tests_virtual_caster Far = { 5, 0, { v3(600.0f, 0.0f, 600.0f), v3(610.0f, 10.0f, 610.0f) } };
+	tests_virtual_caster More[] = { Casters[0], Casters[1], Casters[2], Far };
+	Stats = Tests_VirtualShadowFrame(Map, LightView, Camera, 720.0f, More, CountOf(More));
+	TestCheck(Stats.Rendered == 0, "Caster out of the window rendered %u pages", Stats.Rendered);
+
+	Stats = Tests_VirtualShadowFrame(Map, LightView, Camera, 720.0f, Casters, CasterCount);
+	TestCheck(Tests_CheckVirtualPages(Map, Table, PoolUsers), "Page table after the caster changes");
+
+	// A new light direction invalidates every page
+	const m4 OtherLightView = glm::lookAtLH(v3(0.0f), glm::normalize(v3(-0.3f, -1.0f, 0.2f)), v3(0.0f, 1.0f, 0.0f));
+	Stats = Tests_VirtualShadowFrame(Map, OtherLightView, Camera, 720.0f, Casters, CasterCount);
+	TestCheck(Stats.Rendered == Map->Settings.MaxPageRenders && Stats.Waiting > 0, "New light direction: %u rendered, %u waiting", Stats.Rendered, Stats.Waiting);
+
+	// Walking away fills the pool, the pages nobody requested for longest go first
+	u32 Evicted = 0;
+	for (u32 Step = 0; Step < 24; Step++)
+	{
+		camera Walked = Tests_GetCamera(v3(Step * 40.0f, 10.0f, 0.0f), 0.0f, 0.4f, 1000.0f);
+		Stats = Tests_VirtualShadowFrame(Map, LightView, Walked, 720.0f, Casters, CasterCount);
+		Evicted += Stats.Evicted;
+		TestCheck(Stats.Resident == Stats.Requested && Stats.Overflowed == 0, "Step %u: %u requested, %u resident, %u overflowed", Step, Stats.Requested, Stats.Resident, Stats.Overflowed);
+		TestCheck(Tests_CheckVirtualPages(Map, Table, PoolUsers), "Page table at step %u", Step);
+	}
+	TestCheck(Evicted > 0 && Map->FreeCount < c_VirtualShadowPoolPageCount / 4, "Walking evicted %u pages, %u pool pages still free", Evicted, Map->FreeCount);
+
+	// The place before the last is still resident but for the pages whose table slots the last window took over, the first one was evicted long ago
+	Stats = Tests_VirtualShadowFrame(Map, LightView, Tests_GetCamera(v3(22 * 40.0f, 10.0f, 0.0f), 0.0f, 0.4f, 1000.0f), 720.0f, Casters, CasterCount);
+	u32 StepBack = Stats.Allocated;
+	Stats = Tests_VirtualShadowFrame(Map, LightView, Tests_GetCamera(v3(0.0f, 10.0f, 0.0f), 0.0f, 0.4f, 1000.0f), 720.0f, Casters, CasterCount);
+	TestCheck(StepBack * 8 < Stats.Requested, "Going back one step allocated %u pages", StepBack);
+	TestCheck(Stats.Allocated == Stats.Requested, "Going back to the start allocated %u of %u pages", Stats.Allocated, Stats.Requested);
+
+	// Requests past the pool overflow, the next frame then samples a coarser level until everything fits again
+	Stats = Tests_VirtualShadowFrame(Map, LightView, Camera, 16384.0f, Casters, CasterCount);
+	TestCheck(Stats.Overflowed > 0 && Stats.LodBias == 0, "Huge viewport: %u overflowed at bias %u", Stats.Overflowed, Stats.LodBias);
+	TestCheck(Tests_CheckVirtualPages(Map, Table, PoolUsers), "Page table after the overflow");
+
+	Stats = Tests_VirtualShadowFrame(Map, LightView, Camera, 16384.0f, Casters, CasterCount);
+	TestCheck(Stats.LodBias == 1, "Bias %u after an overflow", Stats.LodBias);
+
+	// Climbs until the pages fit, then holds since a finer level would not fit four times over
+	for (Frames = 0; Frames < 16 && Stats.Overflowed > 0; Frames++)
+		Stats = Tests_VirtualShadowFrame(Map, LightView, Camera, 16384.0f, Casters, CasterCount);
+	u32 Settled = Stats.LodBias;
+	TestCheck(Stats.Overflowed == 0 && Settled > 1, "Still %u overflowed at bias %u after %u frames", Stats.Overflowed, Settled, Frames);
+	for (u32 Frame = 0; Frame < 8; Frame++)
+	{
+		Stats = Tests_VirtualShadowFrame(Map, LightView, Camera, 16384.0f, Casters, CasterCount);
+		TestCheck(Stats.LodBias == Settled && Stats.Overflowed == 0, "Frame %u after settling: bias %u, %u overflowed", Frame, Stats.LodBias, Stats.Overflowed);
+	}
+
+	for (Frames = 0; Frames < 16 && Stats.LodBias > 0; Frames++)
+		Stats = Tests_VirtualShadowFrame(Map, LightView, Camera, 720.0f, Casters, CasterCount);
+	TestCheck(Stats.LodBias == 0, "Bias still %u after %u frames of a normal viewport", Stats.LodBias, Frames);
+
+	VmFree(PoolUsers);
+	VmFree(Table);
+	VirtualShadows_Destroy(Map);
+	VmFree(Map);
+}
+
+int main()
+{
+	Tests_Frustum();
+	Tests_Cascades();
+	Tests_ShadowAtlas();
+	Tests_PointShadows();
+	Tests_VirtualShadows();
+
+	if (g_Tests.Failed > 0)
+		Err("%u of %u checks failed", g_Tests.Failed, g_Tests.Checks);
+	else
+		Info("All %u checks passed", g_Tests.Checks);
+
+	return (int)g_Tests.Failed;
+}
@@ -0,0 +1,434 @@
+#pragma once
+
+// Transform hierarchy
+// Nodes are stored breadth first: all roots, then all nodes of depth 1, and so on. Inside of a level, nodes are grouped by parent,
+// so the children of any node are one contiguous range of the next level. That gives us:
+//  - parents are always computed before their children, a level can be split across workers without any locking
+//  - marking a subtree dirty is just writing the dirty bytes of a range
+//
+// Structural changes (create, destroy, reparent) only flag the hierarchy, the order is rebuilt once at the start of the next update.
+// Handles go through a slot table, so they survive the reordering.
+
+inline constexpr u32 c_MaxTransformDepth = 32;
+inline constexpr u32 c_InvalidTransformIndex = 0xFFFFFFFF;
+
+enum transform_dirty : u8
+{
+	TransformDirty_Local = 1 << 0, // Position, rotation or scale changed, local matrix has to be rebuilt
+	TransformDirty_World = 1 << 1, // Parent moved
+};
+
+struct transform_node
+{
+	u32 Slot;
+	u32 Generation; // 0 is never valid
+};
+
+struct transform_hierarchy
+{
+	u32 Capacity;
+	u32 Count;
+
+	// Dense, breadth first
+	v3* Positions;
+	v3* Rotations; // Euler angles, same as entities
+	v3* Scales;
+	aabb* LocalBounds;
+	m4* LocalMatrices;
+	m4* WorldMatrices;
+	aabb* WorldBounds;
+	u8* Dirty;           // transform_dirty bits
+	u32* Parents;        // Dense index, c_InvalidTransformIndex for roots
+	u32* FirstChildren;  // Dense index of the first child
+	u32* ChildCounts;
+	u32* DenseToSlot;
+
+	u32 LevelBegin[c_MaxTransformDepth + 1];
+	u32 LevelCount;
+
+	// Sparse
+	u32* SlotToDense;    // Next free slot while the slot is unused
+	u32* ParentSlots;    // Authoritative parent links, the dense ones are derived from them
+	u32* Generations;
+	u32 FreeSlot;
+	u32 SlotCount;
+
+	b32 NeedsRebuild;
+};
+
+internal void TransformHierarchy_Initialize(transform_hierarchy* Hierarchy, u32 Capacity);
+internal transform_node TransformHierarchy_Create(transform_hierarchy* Hierarchy, transform_node Parent, v3 Position, v3 Rotation = v3(0.0f), v3 Scale = v3(1.0f));
+internal void TransformHierarchy_Destroy(transform_hierarchy* Hierarchy, transform_node Node); // Destroys the whole subtree
+internal void TransformHierarchy_SetParent(transform_hierarchy* Hierarchy, transform_node Node, transform_node Parent);
+internal bool TransformHierarchy_IsValid(const transform_hierarchy* Hierarchy, transform_node Node);
+
+internal void TransformHierarchy_SetLocalPosition(transform_hierarchy* Hierarchy, transform_node Node, v3 Position);
+internal void TransformHierarchy_SetLocalRotation(transform_hierarchy* Hierarchy, transform_node Node, v3 Rotation);
+internal void TransformHierarchy_SetLocalScale(transform_hierarchy* Hierarchy, transform_node Node, v3 Scale);
+internal void TransformHierarchy_SetLocalBounds(transform_hierarchy* Hierarchy, transform_node Node, const aabb& Bounds);
+
+// Valid after TransformHierarchy_Update
+internal const m4& TransformHierarchy_GetWorldMatrix(const transform_hierarchy* Hierarchy, transform_node Node);
+internal const aabb& TransformHierarchy_GetWorldBounds(const transform_hierarchy* Hierarchy, transform_node Node);
+
+// Propagates local changes to world matrices and bounds, returns how many nodes were recomputed
+internal u32 TransformHierarchy_Update(transform_hierarchy* Hierarchy);
+internal void TransformHierarchy_MarkAllDirty(transform_hierarchy* Hierarchy);
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+internal void TransformHierarchy_Initialize(transform_hierarchy* Hierarchy, u32 Capacity)
+{
+	Hierarchy->Capacity = Capacity;
+	Hierarchy->Count = 0;
+
+	Hierarchy->Positions = VmAllocArray(v3, Capacity);
+	Hierarchy->Rotations = VmAllocArray(v3, Capacity);
+	Hierarchy->Scales = VmAllocArray(v3, Capacity);
+	Hierarchy->LocalBounds = VmAllocArray(aabb, Capacity);
+	Hierarchy->LocalMatrices = VmAllocArray(m4, Capacity);
+	Hierarchy->WorldMatrices = VmAllocArray(m4, Capacity);
+	Hierarchy->WorldBounds = VmAllocArray(aabb, Capacity);
+	Hierarchy->Dirty = VmAllocArray(u8, Capacity);
+	Hierarchy->Parents = VmAllocArray(u32, Capacity);
+	Hierarchy->FirstChildren = VmAllocArray(u32, Capacity);
+	Hierarchy->ChildCounts = VmAllocArray(u32, Capacity);
+	Hierarchy->DenseToSlot = VmAllocArray(u32, Capacity);
+
+	Hierarchy->SlotToDense = VmAllocArray(u32, Capacity);
+	Hierarchy->ParentSlots = VmAllocArray(u32, Capacity);
+	Hierarchy->Generations = VmAllocArray(u32, Capacity);
+	Hierarchy->FreeSlot = c_InvalidTransformIndex;
+	Hierarchy->SlotCount = 0;
+}
+
+internal bool TransformHierarchy_IsValid(const transform_hierarchy* Hierarchy, transform_node Node)
+{
+	return Node.Generation != 0 && Node.Slot < Hierarchy->SlotCount && Hierarchy->Generations[Node.Slot] == Node.Generation;
+}
+
+internal u32 TransformHierarchy_GetIndex(const transform_hierarchy* Hierarchy, transform_node Node)
+{
+	Assert(TransformHierarchy_IsValid(Hierarchy, Node), "Invalid transform node!");
+	return Hierarchy->SlotToDense[Node.Slot];
+}
+
+internal transform_node TransformHierarchy_Create(transform_hierarchy* Hierarchy, transform_node Parent, v3 Position, v3 Rotation, v3 Scale)
+{
+	Assert(Hierarchy->Count < Hierarchy->Capacity, "Transform hierarchy is full!");
+
+	u32 Slot;
+	if (Hierarchy->FreeSlot != c_InvalidTransformIndex)
+	{
+		Slot = Hierarchy->FreeSlot;
+		Hierarchy->FreeSlot = Hierarchy->SlotToDense[Slot];
+	}
+	else
+	{
+		Slot = Hierarchy->SlotCount++;
+	}
+
+	if (Hierarchy->Generations[Slot] == 0)
+		Hierarchy->Generations[Slot] = 1;
+
+	// Appended for now, moves to its level in the rebuild
+	u32 Index = Hierarchy->Count++;
+	Hierarchy->SlotToDense[Slot] = Index;
+	Hierarchy->DenseToSlot[Index] = Slot;
+	Hierarchy->ParentSlots[Slot] = TransformHierarchy_IsValid(Hierarchy, Parent) ? Parent.Slot : c_InvalidTransformIndex;
+
+	Hierarchy->Positions[Index] = Position;
+	Hierarchy->Rotations[Index] = Rotation;
+	Hierarchy->Scales[Index] = Scale;
+	Hierarchy->LocalBounds[Index] = { v3(-0.5f), v3(0.5f) };
+	Hierarchy->Dirty[Index] = TransformDirty_Local;
+
+	Hierarchy->NeedsRebuild = true;
+
+	return { Slot, Hierarchy->Generations[Slot] };
+}
+
+internal void TransformHierarchy_SetParent(transform_hierarchy* Hierarchy, transform_node Node, transform_node Parent)
+{
+	u32 Index = TransformHierarchy_GetIndex(Hierarchy, Node);
+	u32 ParentSlot = TransformHierarchy_IsValid(Hierarchy, Parent) ? Parent.Slot : c_InvalidTransformIndex;
+
+	// No cycles
+	for (u32 Slot = ParentSlot; Slot != c_InvalidTransformIndex; Slot = Hierarchy->ParentSlots[Slot])
+		Assert(Slot != Node.Slot, "Node cannot be parented to its own descendant!");
+
+	Hierarchy->ParentSlots[Node.Slot] = ParentSlot;
+	Hierarchy->Dirty[Index] |= TransformDirty_World;
+	Hierarchy->NeedsRebuild = true;
+}
+
+internal void TransformHierarchy_SetLocalPosition(transform_hierarchy* Hierarchy, transform_node Node, v3 Position)
+{
+	u32 Index = TransformHierarchy_GetIndex(Hierarchy, Node);
+	Hierarchy->Positions[Index] = Position;
+	Hierarchy->Dirty[Index] |= TransformDirty_Local;
+}
+
+internal void TransformHierarchy_SetLocalRotation(transform_hierarchy* Hierarchy, transform_node Node, v3 Rotation)
+{
+	u32 Index = TransformHierarchy_GetIndex(Hierarchy, Node);
+	Hierarchy->Rotations[Index] = Rotation;
+	Hierarchy->Dirty[Index] |= TransformDirty_Local;
+}
+
+internal void TransformHierarchy_SetLocalScale(transform_hierarchy* Hierarchy, transform_node Node, v3 Scale)
+{
+	u32 Index = TransformHierarchy_GetIndex(Hierarchy, Node);
+	Hierarchy->Scales[Index] = Scale;
+	Hierarchy->Dirty[Index] |= TransformDirty_Local;
+}
+
+internal void TransformHierarchy_SetLocalBounds(transform_hierarchy* Hierarchy, transform_node Node, const aabb& Bounds)
+{
+	u32 Index = TransformHierarchy_GetIndex(Hierarchy, Node);
+	Hierarchy->LocalBounds[Index] = Bounds;
+	Hierarchy->Dirty[Index] |= TransformDirty_World;
+}
+
+internal const m4& TransformHierarchy_GetWorldMatrix(const transform_hierarchy* Hierarchy, transform_node Node)
+{
+	return Hierarchy->WorldMatrices[TransformHierarchy_GetIndex(Hierarchy, Node)];
+}
+
+internal const aabb& TransformHierarchy_GetWorldBounds(const transform_hierarchy* Hierarchy, transform_node Node)
+{
+	return Hierarchy->WorldBounds[TransformHierarchy_GetIndex(Hierarchy, Node)];
+}
+
+internal void TransformHierarchy_MarkAllDirty(transform_hierarchy* Hierarchy)
+{
+	memset(Hierarchy->Dirty, TransformDirty_Local, Hierarchy->Count);
+}
+
+internal void TransformHierarchy_Rebuild(transform_hierarchy* Hierarchy);
+
+internal void TransformHierarchy_Destroy(transform_hierarchy* Hierarchy, transform_node Node)
+{
+	if (!TransformHierarchy_IsValid(Hierarchy, Node))
+		return;
+
+	// Child ranges are only valid in the breadth first order
+	if (Hierarchy->NeedsRebuild)
+		TransformHierarchy_Rebuild(Hierarchy);
+
+	u32* Subtree = VmAllocArray(u32, Hierarchy->Count);
+	u32 SubtreeCount = 0;
+	Subtree[SubtreeCount++] = Node.Slot;
+
+	for (u32 i = 0; i < SubtreeCount; i++)
+	{
+		u32 Index = Hierarchy->SlotToDense[Subtree[i]];
+		for (u32 c = 0; c < Hierarchy->ChildCounts[Index]; c++)
+			Subtree[SubtreeCount++] = Hierarchy->DenseToSlot[Hierarchy->FirstChildren[Index] + c];
+	}
+
+	for (u32 i = 0; i < SubtreeCount; i++)
+	{
+		u32 Slot = Subtree[i];
+
+		// Swap-remove, the rebuild restores the order
+		u32 Index = Hierarchy->SlotToDense[Slot];
+		u32 Last = --Hierarchy->Count;
+		if (Index != Last)
+		{
+			Hierarchy->Positions[Index] = Hierarchy->Positions[Last];
+			Hierarchy->Rotations[Index] = Hierarchy->Rotations[Last];
+			Hierarchy->Scales[Index] = Hierarchy->Scales[Last];
+			Hierarchy->LocalBounds[Index] = Hierarchy->LocalBounds[Last];
+			Hierarchy->LocalMatrices[Index] = Hierarchy->LocalMatrices[Last];
+			Hierarchy->WorldMatrices[Index] = Hierarchy->WorldMatrices[Last];
+			Hierarchy->WorldBounds[Index] = Hierarchy->WorldBounds[Last];
+			Hierarchy->Dirty[Index] = Hierarchy->Dirty[Last];
+
+			u32 MovedSlot = Hierarchy->DenseToSlot[Last];
+			Hierarchy->DenseToSlot[Index] = MovedSlot;
+			Hierarchy->SlotToDense[MovedSlot] = Index;
+		}
+
+		if (++Hierarchy->Generations[Slot] == 0)
+			Hierarchy->Generations[Slot] = 1;
+
+		Hierarchy->ParentSlots[Slot] = c_InvalidTransformIndex;
+		Hierarchy->SlotToDense[Slot] = Hierarchy->FreeSlot;
+		Hierarchy->FreeSlot = Slot;
+	}
+
+	VmFree(Subtree);
+	Hierarchy->NeedsRebuild = true;
+}
+
+// Reorders the dense arrays breadth first, O(n) and only after structural changes
+internal void TransformHierarchy_Rebuild(transform_hierarchy* Hierarchy)
+{
+	const u32 Count = Hierarchy->Count;
+
+	// Children of every slot in CSR form, slot based
+	u32* ChildOffsets = VmAllocArray(u32, Hierarchy->SlotCount + 1);
+	u32* Children = VmAllocArray(u32, Count);
+	u32* Order = VmAllocArray(u32, Count); // Old dense indices in the new order
+
+	for (u32 i = 0; i < Count; i++)
+	{
+		u32 ParentSlot = Hierarchy->ParentSlots[Hierarchy->DenseToSlot[i]];
+		if (ParentSlot != c_InvalidTransformIndex)
+			ChildOffsets[ParentSlot + 1]++;
+	}
+
+	for (u32 Slot = 0; Slot < Hierarchy->SlotCount; Slot++)
+		ChildOffsets[Slot + 1] += ChildOffsets[Slot];
+
+	{
+		u32* Cursors = VmAllocArray(u32, Hierarchy->SlotCount);
+		memcpy(Cursors, ChildOffsets, sizeof(u32) * Hierarchy->SlotCount);
+
+		for (u32 i = 0; i < Count; i++)
+		{
+			u32 Slot = Hierarchy->DenseToSlot[i];
+			u32 ParentSlot = Hierarchy->ParentSlots[Slot];
+			if (ParentSlot != c_InvalidTransformIndex)
+				Children[Cursors[ParentSlot]++] = Slot;
+		}
+
+		VmFree(Cursors);
+	}
+
+	// Breadth first walk, roots keep their relative order
+	u32 OrderCount = 0;
+	for (u32 i = 0; i < Count; i++)
+	{
+		if (Hierarchy->ParentSlots[Hierarchy->DenseToSlot[i]] == c_InvalidTransformIndex)
+			Order[OrderCount++] = i;
+	}
+
+	Hierarchy->LevelCount = 0;
+	u32 LevelEnd = 0;
+	for (u32 i = 0; i < OrderCount; i++)
+	{
+		if (i == LevelEnd)
+		{
+			Assert(Hierarchy->LevelCount < c_MaxTransformDepth, "Transform hierarchy is too deep!");
+			Hierarchy->LevelBegin[Hierarchy->LevelCount++] = i;
+			LevelEnd = OrderCount;
+		}
+
+		u32 Slot = Hierarchy->DenseToSlot[Order[i]];
+		for (u32 c = ChildOffsets[Slot]; c < ChildOffsets[Slot + 1]; c++)
+			Order[OrderCount++] = Hierarchy->SlotToDense[Children[c]];
+	}
+	Hierarchy->LevelBegin[Hierarchy->LevelCount] = OrderCount;
+
+	Assert(OrderCount == Count, "Transform hierarchy has nodes that are not reachable from a root!");
+
+	// Permute everything through a scratch copy
+	auto Permute = [Count, Order](auto* Array)
+	{
+		using type = std::remove_pointer_t<decltype(Array)>;
+		type* Scratch = VmAllocArray(type, Count);
+		for (u32 i = 0; i < Count; i++)
+			Scratch[i] = Array[Order[i]];
+		memcpy(Array, Scratch, sizeof(type) * Count);
+		VmFree(Scratch);
+	};
+
+	Permute(Hierarchy->Positions);
+	Permute(Hierarchy->Rotations);
+	Permute(Hierarchy->Scales);
+	Permute(Hierarchy->LocalBounds);
+	Permute(Hierarchy->LocalMatrices);
+	Permute(Hierarchy->WorldMatrices);
+	Permute(Hierarchy->WorldBounds);
+	Permute(Hierarchy->Dirty);
+	Permute(Hierarchy->DenseToSlot);
+
+	for (u32 i = 0; i < Count; i++)
+		Hierarchy->SlotToDense[Hierarchy->DenseToSlot[i]] = i;
+
+	// Dense links, children were appended right after each other so they form a range
+	for (u32 i = 0; i < Count; i++)
+	{
+		u32 Slot = Hierarchy->DenseToSlot[i];
+		u32 ParentSlot = Hierarchy->ParentSlots[Slot];
+		Hierarchy->Parents[i] = ParentSlot != c_InvalidTransformIndex ? Hierarchy->SlotToDense[ParentSlot] : c_InvalidTransformIndex;
+
+		u32 ChildCount = ChildOffsets[Slot + 1] - ChildOffsets[Slot];
+		Hierarchy->ChildCounts[i] = ChildCount;
+		Hierarchy->FirstChildren[i] = ChildCount > 0 ? Hierarchy->SlotToDense[Children[ChildOffsets[Slot]]] : c_InvalidTransformIndex;
+	}
+
+	VmFree(ChildOffsets);
+	VmFree(Children);
+	VmFree(Order);
+
+	Hierarchy->NeedsRebuild = false;
+}
+
+internal u32 TransformHierarchy_Update(transform_hierarchy* Hierarchy)
+{
+	if (Hierarchy->NeedsRebuild)
+		TransformHierarchy_Rebuild(Hierarchy);
+
+	std::atomic<u32> Updated = 0;
+
+	for (u32 Level = 0; Level < Hierarchy->LevelCount; Level++)
+	{
+		const u32 Begin = Hierarchy->LevelBegin[Level];
+		const u32 End = Hierarchy->LevelBegin[Level + 1];
+
+		// Children of different parents never overlap, so batches can mark them without synchronization
+		JobSystem_ParallelFor(&g_Jobs, End - Begin, 4096, [Hierarchy, Begin, &Updated](u32 BatchBegin, u32 BatchEnd)
+		{
+			u8* Dirty = Hierarchy->Dirty;
+			u32 Count = 0;
+
+			for (u32 i = Begin + BatchBegin; i < Begin + BatchEnd; i++)
+			{
+				// Clean runs are skipped 8 nodes at a time
+				if ((i & 7) == 0 && i + 8 <= Begin + BatchEnd)
+				{
+					u64 Eight;
+					memcpy(&Eight, &Dirty[i], sizeof(Eight));
+					if (Eight == 0)
+					{
+						i += 7;
+						continue;
+					}
+				}
+
+				if (Dirty[i] == 0)
+					continue;
+
+				if (Dirty[i] & TransformDirty_Local)
+				{
+					Hierarchy->LocalMatrices[i] = glm::translate(m4(1.0f), Hierarchy->Positions[i])
+						* glm::toMat4(qtn(Hierarchy->Rotations[i]))
+						* glm::scale(m4(1.0f), Hierarchy->Scales[i]);
+				}
+
+				u32 Parent = Hierarchy->Parents[i];
+				const m4& World = Hierarchy->WorldMatrices[i] = Parent != c_InvalidTransformIndex
+					? MultiplyM4(Hierarchy->WorldMatrices[Parent], Hierarchy->LocalMatrices[i])
+					: Hierarchy->LocalMatrices[i];
+
+				Hierarchy->WorldBounds[i] = AABB_Transform(Hierarchy->LocalBounds[i], World);
+				Dirty[i] = 0;
+				Count++;
+
+				for (u32 c = 0; c < Hierarchy->ChildCounts[i]; c++)
+					Dirty[Hierarchy->FirstChildren[i] + c] |= TransformDirty_World;
+			}
+
+			Updated.fetch_add(Count, std::memory_order_relaxed);
+		});
+	}
+
+	return Updated.load();
+}
@@ -0,0 +1,580 @@
+#pragma once
+
+// Virtual shadow map for the directional light
+// A square window of the world, centered on the camera and seen from the light, gets one huge shadow map
+// (c_VirtualShadowPages * c_VirtualShadowPageSize texels per side) that only exists where someone looks at it. It is cut into
+// pages of c_VirtualShadowPageSize texels and every level of a mip chain has pages twice as big in world units as the one before.
+// Pages are what gets allocated, rendered and cached. A page lives in one tile of the physical pool, a single depth texture.
+//
+// Every frame:
+// - Receivers the camera sees request the pages their pixels sample. A pixel samples the level where one of its texels is about
+//   a pixel on screen, a box is split into pages with a quadtree walk until each page is as fine as its closest point needs.
+//   Every requested page requests its coarser ancestors too, they are the fallback while a page waits for a render.
+// - Casters sign the requested pages they overlap in light space, a signature over their (Key, Revision) pairs like in the
+//   static shadow cache. A page is rendered again when its signature or caster count changed since its last render.
+// - EndFrame hands pool pages to requested pages without one. A full pool evicts the pages nobody requested for longest.
+//   Dirty pages are rendered coarsest first, at most MaxPageRenders a frame, the rest keep their stale depth for a frame or two.
+//   When even that fails and a requested page gets no pool page, the LOD bias goes up a level for the next frame.
+//
+// The page table has one entry per page of the window, wrapped around like a clipmap, so moving the window only touches the
+// entries of pages that scrolled in. An entry remembers the page it holds, lookups compare that tag.
+// Depth of a page is its own light view Z range, from the vertical extent of the world inside its column.
+//
+// Nothing here knows about a graphics API. Backends render the pages in RenderList into their pool rects, then upload the table.
+
+inline constexpr u32 c_VirtualShadowPageSize = 128;  // Texels per page side, same in Quad.hlsl
+inline constexpr u32 c_VirtualShadowPages = 128;     // Pages per side of the finest level, 16k texels of virtual resolution
+inline constexpr u32 c_VirtualShadowLevels = 6;      // Every level has pages twice as big as the one before
+inline constexpr u32 c_VirtualShadowPoolSize = 4096; // Physical pages share one depth texture, 32x32 of them
+inline constexpr u32 c_VirtualShadowMaxPageRenders = 128;
+inline constexpr u32 c_VirtualShadowNoPage = 0xFFFFFFFF;
+inline constexpr u32 c_VirtualShadowTableSize = (c_VirtualShadowPages * c_VirtualShadowPages - (c_VirtualShadowPages >> c_VirtualShadowLevels) * (c_VirtualShadowPages >> c_VirtualShadowLevels)) * 4 / 3;
+inline constexpr u32 c_VirtualShadowPoolPages = c_VirtualShadowPoolSize / c_VirtualShadowPageSize; // Per side
+inline constexpr u32 c_VirtualShadowPoolPageCount = c_VirtualShadowPoolPages * c_VirtualShadowPoolPages;
+static_assert((c_VirtualShadowPages >> (c_VirtualShadowLevels - 1)) > 0, "Coarsest virtual shadow level needs at least one page!");
+static_assert(c_VirtualShadowPages <= 0x8000, "Page coordinates have to fit the 16 bit tag!");
+
+// Matches virtual_shadow_page in Quad.hlsl, one per page table entry
+struct virtual_shadow_gpu_page
+{
+	u32 Tag;          // Page X in the low 16 bits and Y in the high ones, the entry belongs to another page when they differ
+	u32 PhysicalPage; // Pool page, c_VirtualShadowNoPage when nothing was rendered yet
+	f32 DepthMin;     // Light view Z of depth 0
+	f32 DepthScale;   // 1 / light view Z range
+};
+
+// Matches the virtual_shadows cbuffer in Quad.hlsl
+struct virtual_shadow_constants
+{
+	m4 LightView;
+	f32 PageSize;  // World units per page of the finest level
+	f32 LodScale;  // Finest level texels per pixel at a view distance of 1
+	u32 LodBias;   // Levels added to the one the distance picks
+	u32 Enabled;
+};
+
+struct virtual_shadow_settings
+{
+	f32 WindowSize;     // World units per side, receivers outside are not shadowed
+	u32 MaxPageRenders; // Per frame
+	f32 WorldMinY;      // Vertical extent of everything that casts, gives the pages their depth range
+	f32 WorldMaxY;
+};
+
+struct virtual_shadow_page
+{
+	i32 X; // Page coordinates of its level, light view XY / page size
+	i32 Y;
+	u32 Level;
+	f32 DepthMin;
+	f32 DepthMax;
+	u32 PhysicalPage;
+	u32 RequestFrame; // Last frame a receiver wanted it
+	u64 Signature;    // Sum of mixed (Key, Revision) pairs it was rendered with
+	u32 CasterCount;
+	b32 Valid;        // Its pool page holds depth rendered with Signature
+	b32 Occupied;     // The table entry holds a page at all
+
+	// Collected this frame
+	u64 PendingSignature;
+	u32 PendingCount;
+};
+
+// Of the last frame
+struct virtual_shadow_stats
+{
+	u32 Requested;  // Pages some receiver samples, ancestors included
+	u32 Resident;   // Requested and in the pool
+	u32 Allocated;  // Got a pool page this frame
+	u32 Evicted;    // Lost their pool page to someone else, or scrolled out of the window
+	u32 Rendered;
+	u32 Waiting;    // Dirty but over the render budget, stale depth until a later frame
+	u32 Overflowed; // Requested but the pool is full of requested pages
+	u32 LodBias;
+};
+
+struct virtual_shadow_map
+{
+	virtual_shadow_settings Settings;
+	m4 LightView;  // Rotation only, like the cascades
+	f32 PageSize;  // World units per page of the finest level
+	f32 LodScale;
+	u32 LodBias;
+	v3 LightSpaceCamera;
+	aabb FrustumBounds; // Light space, receivers are clipped to it
+	i32 WindowPageX; // Finest level page of the window corner
+	i32 WindowPageY;
+	u32 Frame;
+
+	virtual_shadow_page* Pages;      // c_VirtualShadowTableSize, level by level
+	u32* Requested[c_VirtualShadowLevels]; // Table indices, as many as the level has pages
+	u32 RequestedCounts[c_VirtualShadowLevels];
+
+	u32* FreePages;  // Pool pages nobody holds
+	u32 FreeCount;
+	u32* PageOwners; // Table index per pool page, c_VirtualShadowNoPage when free
+	u32* Evictable;  // Scratch for EndFrame
+
+	u32* RenderList; // Table indices, this frame
+	u32 RenderCount;
+
+	virtual_shadow_stats Stats;
+};
+
+internal virtual_shadow_settings VirtualShadows_GetDefaultSettings(f32 WorldMinY, f32 WorldMaxY);
+internal void VirtualShadows_Initialize(virtual_shadow_map* Map, const virtual_shadow_settings& Settings);
+internal void VirtualShadows_Destroy(virtual_shadow_map* Map);
+
+// Every page gets rendered again, for when the map was not kept up to date
+internal void VirtualShadows_Invalidate(virtual_shadow_map* Map);
+
+// LightView is Cascades_Fit's, rotation only. A different one invalidates every page
+internal void VirtualShadows_BeginFrame(virtual_shadow_map* Map, const m4& LightView, const camera& Camera, f32 ViewportHeight);
+
+// Receivers are whatever the camera sees this frame, add them after BeginFrame and before the casters
+internal void VirtualShadows_AddReceiver(virtual_shadow_map* Map, const aabb& WorldBounds);
+
+// Every shadow caster, static or not, after the receivers
+internal void VirtualShadows_AddCaster(virtual_shadow_map* Map, u64 Key, u64 Revision, const aabb& WorldBounds);
+
+// Allocates pool pages and builds RenderList, its pages count as valid from here on
+internal const virtual_shadow_stats& VirtualShadows_EndFrame(virtual_shadow_map* Map);
+
+// Whether a caster has to be drawn into a page of RenderList
+internal bool VirtualShadows_CasterOverlapsPage(const virtual_shadow_map* Map, u32 Page, const aabb& WorldBounds);
+internal m4 VirtualShadows_GetPageViewProjection(const virtual_shadow_map* Map, u32 Page);
+internal shadow_atlas_rect VirtualShadows_GetPoolRect(u32 PhysicalPage);
+
+internal void VirtualShadows_GetConstants(const virtual_shadow_map* Map, virtual_shadow_constants* Constants);
+
+// Writes c_VirtualShadowTableSize entries, pages without valid depth have no physical page
+internal void VirtualShadows_GetPageTable(const virtual_shadow_map* Map, virtual_shadow_gpu_page* Table);
+
+// Table slot of page (X, Y), the level wraps around every (c_VirtualShadowPages >> Level) pages. Same in Quad.hlsl
+inline u32 VirtualShadows_GetTableIndex(u32 Level, i32 X, i32 Y)
+{
+	const u32 Pages = c_VirtualShadowPages >> Level;
+	const u32 Offset = (c_VirtualShadowPages * c_VirtualShadowPages - Pages * Pages) * 4 / 3;
+	return Offset + ((u32)Y & (Pages - 1)) * Pages + ((u32)X & (Pages - 1));
+}
+
+inline u32 VirtualShadows_PackTag(i32 X, i32 Y)
+{
+	return ((u32)X & 0xFFFF) | ((u32)Y << 16);
+}
+
+// CPP
+// CPP
+// CPP
+// CPP
+// CPP
+
+internal virtual_shadow_settings VirtualShadows_GetDefaultSettings(f32 WorldMinY, f32 WorldMaxY)
+{
+	virtual_shadow_settings Settings = {};
+	Settings.WindowSize = 320.0f; // About 2 cm texels at the finest level
+	Settings.MaxPageRenders = c_VirtualShadowMaxPageRenders;
+	Settings.WorldMinY = WorldMinY;
+	Settings.WorldMaxY = WorldMaxY;
+	return Settings;
+}
+
+internal void VirtualShadows_Initialize(virtual_shadow_map* Map, const virtual_shadow_settings& Settings)
+{
+	Assert(Settings.MaxPageRenders <= c_VirtualShadowPoolPageCount, "More virtual shadow page renders than pool pages!");
+
+	*Map = {};
+	Map->Settings = Settings;
+	Map->PageSize = Settings.WindowSize / c_VirtualShadowPages;
+
+	Map->Pages = VmAllocArray(virtual_shadow_page, c_VirtualShadowTableSize);
+	for (u32 Level = 0; Level < c_VirtualShadowLevels; Level++)
+	{
+		u32 Pages = c_VirtualShadowPages >> Level;
+		Map->Requested[Level] = VmAllocArray(u32, Pages * Pages);
+	}
+
+	Map->FreePages = VmAllocArray(u32, c_VirtualShadowPoolPageCount);
+	Map->PageOwners = VmAllocArray(u32, c_VirtualShadowPoolPageCount);
+	Map->Evictable = VmAllocArray(u32, c_VirtualShadowPoolPageCount);
+	Map->RenderList = VmAllocArray(u32, c_VirtualShadowPoolPageCount);
+
+	// Lowest pool pages get handed out first
+	for (u32 i = 0; i < c_VirtualShadowPoolPageCount; i++)
+	{
+		Map->FreePages[i] = c_VirtualShadowPoolPageCount - 1 - i;
+		Map->PageOwners[i] = c_VirtualShadowNoPage;
+	}
+	Map->FreeCount = c_VirtualShadowPoolPageCount;
+}
+
+internal void VirtualShadows_Destroy(virtual_shadow_map* Map)
+{
+	VmFree(Map->Pages);
+	for (u32 Level = 0; Level < c_VirtualShadowLevels; Level++)
+		VmFree(Map->Requested[Level]);
+
+	VmFree(Map->FreePages);
+	VmFree(Map->PageOwners);
+	VmFree(Map->Evictable);
+	VmFree(Map->RenderList);
+	*Map = {};
+}
+
+internal void VirtualShadows_Invalidate(virtual_shadow_map* Map)
+{
+	for (u32 i = 0; i < c_VirtualShadowTableSize; i++)
+		Map->Pages[i].Valid = false;
+}
+
+internal f32 VirtualShadows_GetPageSize(const virtual_shadow_map* Map, u32 Level)
+{
+	return Map->PageSize * (f32)(1u << Level);
+}
+
+// Same as VirtualShadowLevel in Quad.hlsl
+internal u32 VirtualShadows_GetLevel(const virtual_shadow_map* Map, f32 Distance)
+{
+	f32 Texels = glm::max(Distance * Map->LodScale, 1.0f);
+	u32 Level = (u32)glm::floor(glm::log2(Texels)) + Map->LodBias;
+	return glm::min(Level, c_VirtualShadowLevels - 1);
+}
+
+internal void VirtualShadows_ReleasePhysicalPage(virtual_shadow_map* Map, virtual_shadow_page& Page)
+{
+	if (Page.PhysicalPage == c_VirtualShadowNoPage)
+		return;
+
+	Map->PageOwners[Page.PhysicalPage] = c_VirtualShadowNoPage;
+	Map->FreePages[Map->FreeCount++] = Page.PhysicalPage;
+	Page.PhysicalPage = c_VirtualShadowNoPage;
+	Page.Valid = false;
+	Map->Stats.Evicted++;
+}
+
+// Light view Z range of whatever can be inside the column of the page, the world is a slab between WorldMinY and WorldMaxY
+internal void VirtualShadows_AssignPage(virtual_shadow_map* Map, u32 Index, u32 Level, i32 X, i32 Y)
+{
+	virtual_shadow_page& Page = Map->Pages[Index];
+	if (Page.Occupied)
+		VirtualShadows_ReleasePhysicalPage(Map, Page);
+
+	Page = {};
+	Page.X = X;
+	Page.Y = Y;
+	Page.Level = Level;
+	Page.PhysicalPage = c_VirtualShadowNoPage;
+	Page.Occupied = true;
+
+	// World Y = dot(light position, world Y axis in light space), solved for light Z at the corners of the column
+	const m4& LightView = Map->LightView;
+	f32 A = LightView[1][0], B = LightView[1][1], C = LightView[1][2];
+	if (glm::abs(C) < 0.05f)
+		C = C < 0.0f ? -0.05f : 0.05f; // Light along the ground, the range gets huge instead of infinite
+
+	f32 PageSize = VirtualShadows_GetPageSize(Map, Level);
+	f32 DepthMin = FLT_MAX, DepthMax = -FLT_MAX;
+	for (u32 Corner = 0; Corner < 8; Corner++)
+	{
+		f32 CornerX = (f32)(X + (i32)(Corner & 1)) * PageSize;
+		f32 CornerY = (f32)(Y + (i32)((Corner >> 1) & 1)) * PageSize;
+		f32 WorldY = (Corner & 4) ? Map->Settings.WorldMaxY : Map->Settings.WorldMinY;
+		f32 Z = (WorldY - A * CornerX - B * CornerY) / C;
+		DepthMin = glm::min(DepthMin, Z);
+		DepthMax = glm::max(DepthMax, Z);
+	}
+
+	Page.DepthMin = DepthMin - 1.0f;
+	Page.DepthMax = DepthMax + 1.0f;
+}
+
+// Pages of the level the light space box touches, clipped to the window. False when there are none
+internal bool VirtualShadows_GetPageRange(const virtual_shadow_map* Map, const aabb& Bounds, u32 Level, i32* MinX, i32* MinY, i32* MaxX, i32* MaxY)
+{
+	f32 InvPageSize = 1.0f / VirtualShadows_GetPageSize(Map, Level);
+	i32 WindowX = Map->WindowPageX >> Level;
+	i32 WindowY = Map->WindowPageY >> Level;
+	i32 Last = (i32)(c_VirtualShadowPages >> Level) - 1;
+
+	*MinX = glm::max((i32)glm::floor(Bounds.Min.x * InvPageSize), WindowX);
+	*MinY = glm::max((i32)glm::floor(Bounds.Min.y * InvPageSize), WindowY);
+	*MaxX = glm::min((i32)glm::floor(Bounds.Max.x * InvPageSize), WindowX + Last);
+	*MaxY = glm::min((i32)glm::floor(Bounds.Max.y * InvPageSize), WindowY + Last);
+	return *MinX <= *MaxX && *MinY <= *MaxY;
+}
+
+internal void VirtualShadows_BeginFrame(virtual_shadow_map* Map, const m4& LightView, const camera& Camera, f32 ViewportHeight)
+{
+	if (Map->LightView != LightView)
+		VirtualShadows_Invalidate(Map);
+
+	Map->LightView = LightView;
+	Map->Frame++;
+
+	// Last frame decides the bias of this one. Down only when four times the pages fit, so it does not flip every frame
+	const virtual_shadow_stats& Last = Map->Stats;
+	if (Last.Overflowed > 0 && Map->LodBias < c_VirtualShadowLevels - 1)
+		Map->LodBias++;
+	else if (Map->LodBias > 0 && Last.Requested * 4 < c_VirtualShadowPoolPageCount)
+		Map->LodBias--;
+
+	Map->Stats = {};
+	Map->Stats.LodBias = Map->LodBias;
+
+	// One texel of the finest level covers a pixel at the distance where LodScale * Distance is 1
+	f32 TexelSize = Map->PageSize / c_VirtualShadowPageSize;
+	Map->LodScale = 2.0f * glm::tan(Camera.PerspectiveFOV * 0.5f) / (ViewportHeight * TexelSize);
+
+	m4 InverseView = glm::inverse(Camera.View);
+	Map->LightSpaceCamera = v3(LightView * InverseView[3]);
+
+	// Nothing past the window gets shadows anyway
+	v3 Corners[c_FrustumCornerCount];
+	f32 Far = glm::min(Camera.PerspectiveFar, Map->Settings.WindowSize);
+	Frustum_GetSliceCorners(InverseView, glm::tan(Camera.PerspectiveFOV * 0.5f), Camera.AspectRatio, Camera.PerspectiveNear, Far, Corners);
+	Map->FrustumBounds = Frustum_FitBounds(Corners, LightView);
+
+	// Snapped to the coarsest pages, so the window corner is a page corner on every level
+	i32 Snap = 1 << (c_VirtualShadowLevels - 1);
+	f32 Half = Map->Settings.WindowSize * 0.5f;
+	f32 CoarsestSize = VirtualShadows_GetPageSize(Map, c_VirtualShadowLevels - 1);
+	Map->WindowPageX = (i32)glm::floor((Map->LightSpaceCamera.x - Half) / CoarsestSize) * Snap;
+	Map->WindowPageY = (i32)glm::floor((Map->LightSpaceCamera.y - Half) / CoarsestSize) * Snap;
+
+	for (u32 Level = 0; Level < c_VirtualShadowLevels; Level++)
+		Map->RequestedCounts[Level] = 0;
+	Map->RenderCount = 0;
+}
+
+// The page and its ancestors, stops at the first one that was already requested this frame
+internal void VirtualShadows_RequestPage(virtual_shadow_map* Map, u32 Level, i32 X, i32 Y)
+{
+	for (; Level < c_VirtualShadowLevels; Level++, X >>= 1, Y >>= 1)
+	{
+		u32 Index = VirtualShadows_GetTableIndex(Level, X, Y);
+		virtual_shadow_page& Page = Map->Pages[Index];
+		if (!Page.Occupied || Page.X != X || Page.Y != Y)
+			VirtualShadows_AssignPage(Map, Index, Level, X, Y);
+
+		if (Page.RequestFrame == Map->Frame)
+			return;
+
+		Page.RequestFrame = Map->Frame;
+		Page.PendingSignature = 0;
+		Page.PendingCount = 0;
+		Map->Requested[Level][Map->RequestedCounts[Level]++] = Index;
+	}
+}
+
+// Requests the page when its part of the box is as fine as it needs, its children otherwise
+internal void VirtualShadows_RequestBox(virtual_shadow_map* Map, const aabb& Bounds, u32 Level, i32 X, i32 Y)
+{
+	f32 PageSize = VirtualShadows_GetPageSize(Map, Level);
+	v3 PartMin = v3(glm::max(Bounds.Min.x, X * PageSize), glm::max(Bounds.Min.y, Y * PageSize), Bounds.Min.z);
+	v3 PartMax = v3(glm::min(Bounds.Max.x, (X + 1) * PageSize), glm::min(Bounds.Max.y, (Y + 1) * PageSize), Bounds.Max.z);
+
+	v3 Closest = glm::clamp(Map->LightSpaceCamera, PartMin, PartMax);
+	if (Level == 0 || VirtualShadows_GetLevel(Map, glm::distance(Closest, Map->LightSpaceCamera)) >= Level)
+	{
+		VirtualShadows_RequestPage(Map, Level, X, Y);
+		return;
+	}
+
+	i32 MinX, MinY, MaxX, MaxY;
+	if (!VirtualShadows_GetPageRange(Map, Bounds, Level - 1, &MinX, &MinY, &MaxX, &MaxY))
+		return;
+
+	for (i32 ChildY = glm::max(MinY, Y * 2); ChildY <= glm::min(MaxY, Y * 2 + 1); ChildY++)
+	{
+		for (i32 ChildX = glm::max(MinX, X * 2); ChildX <= glm::min(MaxX, X * 2 + 1); ChildX++)
+			VirtualShadows_RequestBox(Map, Bounds, Level - 1, ChildX, ChildY);
+	}
+}
+
+internal void VirtualShadows_AddReceiver(virtual_shadow_map* Map, const aabb& WorldBounds)
+{
+	aabb Bounds = AABB_Transform(WorldBounds, Map->LightView);
+	Bounds.Min = glm::max(Bounds.Min, Map->FrustumBounds.Min);
+	Bounds.Max = glm::min(Bounds.Max, Map->FrustumBounds.Max);
+	if (glm::any(glm::greaterThan(Bounds.Min, Bounds.Max)))
+		return;
+
+	// No pixel of the box needs a coarser level than its farthest corner
+	v3 Farthest = glm::max(glm::abs(Bounds.Min - Map->LightSpaceCamera), glm::abs(Bounds.Max - Map->LightSpaceCamera));
+	u32 Level = VirtualShadows_GetLevel(Map, glm::length(Farthest));
+
+	i32 MinX, MinY, MaxX, MaxY;
+	if (!VirtualShadows_GetPageRange(Map, Bounds, Level, &MinX, &MinY, &MaxX, &MaxY))
+		return;
+
+	for (i32 Y = MinY; Y <= MaxY; Y++)
+	{
+		for (i32 X = MinX; X <= MaxX; X++)
+			VirtualShadows_RequestBox(Map, Bounds, Level, X, Y);
+	}
+}
+
+internal void VirtualShadows_AddCaster(virtual_shadow_map* Map, u64 Key, u64 Revision, const aabb& WorldBounds)
+{
+	aabb Bounds = AABB_Transform(WorldBounds, Map->LightView);
+	u64 Hash = ShadowCache_Mix(Key ^ ShadowCache_Mix(Revision));
+
+	// Depth ranges hold the whole world slab, overlapping the column is enough
+	for (u32 Level = 0; Level < c_VirtualShadowLevels; Level++)
+	{
+		if (Map->RequestedCounts[Level] == 0)
+			continue;
+
+		i32 MinX, MinY, MaxX, MaxY;
+		if (!VirtualShadows_GetPageRange(Map, Bounds, Level, &MinX, &MinY, &MaxX, &MaxY))
+			continue;
+
+		for (i32 Y = MinY; Y <= MaxY; Y++)
+		{
+			for (i32 X = MinX; X <= MaxX; X++)
+			{
+				virtual_shadow_page& Page = Map->Pages[VirtualShadows_GetTableIndex(Level, X, Y)];
+				if (Page.RequestFrame != Map->Frame || Page.X != X || Page.Y != Y)
+					continue;
+
+				Page.PendingSignature += Hash;
+				Page.PendingCount++;
+			}
+		}
+	}
+}
+
+internal const virtual_shadow_stats& VirtualShadows_EndFrame(virtual_shadow_map* Map)
+{
+	virtual_shadow_stats& Stats = Map->Stats;
+
+	// Resident pages nobody requested, least recently requested first. Built the first time the pool runs out
+	u32 EvictableCount = 0, EvictCursor = 0;
+	bool EvictableBuilt = false;
+	auto Evict = [&]() -> bool
+	{
+		if (!EvictableBuilt)
+		{
+			for (u32 i = 0; i < c_VirtualShadowPoolPageCount; i++)
+			{
+				u32 Owner = Map->PageOwners[i];
+				if (Owner != c_VirtualShadowNoPage && Map->Pages[Owner].RequestFrame != Map->Frame)
+					Map->Evictable[EvictableCount++] = Owner;
+			}
+
+			// Insertion sort, mostly in order already since pages age together
+			for (u32 i = 1; i < EvictableCount; i++)
+			{
+				u32 Index = Map->Evictable[i];
+				u32 Frame = Map->Pages[Index].RequestFrame;
+				u32 j = i;
+				while (j > 0 && Map->Pages[Map->Evictable[j - 1]].RequestFrame > Frame)
+				{
+					Map->Evictable[j] = Map->Evictable[j - 1];
+					j--;
+				}
+				Map->Evictable[j] = Index;
+			}
+
+			EvictableBuilt = true;
+		}
+
+		if (EvictCursor == EvictableCount)
+			return false;
+
+		VirtualShadows_ReleasePhysicalPage(Map, Map->Pages[Map->Evictable[EvictCursor++]]);
+		return true;
+	};
+
+	// Coarse levels first, they are the fallback of everything finer
+	for (u32 Level = c_VirtualShadowLevels; Level-- > 0;)
+	{
+		for (u32 i = 0; i < Map->RequestedCounts[Level]; i++)
+		{
+			u32 Index = Map->Requested[Level][i];
+			virtual_shadow_page& Page = Map->Pages[Index];
+			Stats.Requested++;
+
+			if (Page.PhysicalPage == c_VirtualShadowNoPage)
+			{
+				if (Map->FreeCount == 0 && !Evict())
+				{
+					Stats.Overflowed++;
+					continue;
+				}
+
+				Page.PhysicalPage = Map->FreePages[--Map->FreeCount];
+				Page.Valid = false;
+				Map->PageOwners[Page.PhysicalPage] = Index;
+				Stats.Allocated++;
+			}
+
+			Stats.Resident++;
+			if (Page.Valid && Page.Signature == Page.PendingSignature && Page.CasterCount == Page.PendingCount)
+				continue;
+
+			if (Map->RenderCount == Map->Settings.MaxPageRenders)
+			{
+				Stats.Waiting++;
+				continue;
+			}
+
+			Page.Signature = Page.PendingSignature;
+			Page.CasterCount = Page.PendingCount;
+			Page.Valid = true;
+			Map->RenderList[Map->RenderCount++] = Index;
+			Stats.Rendered++;
+		}
+	}
+
+	return Stats;
+}
+
+internal bool VirtualShadows_CasterOverlapsPage(const virtual_shadow_map* Map, u32 Index, const aabb& WorldBounds)
+{
+	const virtual_shadow_page& Page = Map->Pages[Index];
+	aabb Bounds = AABB_Transform(WorldBounds, Map->LightView);
+
+	f32 PageSize = VirtualShadows_GetPageSize(Map, Page.Level);
+	f32 MinX = Page.X * PageSize, MinY = Page.Y * PageSize;
+	return Bounds.Max.x >= MinX && Bounds.Min.x <= MinX + PageSize && Bounds.Max.y >= MinY && Bounds.Min.y <= MinY + PageSize;
+}
+
+internal m4 VirtualShadows_GetPageViewProjection(const virtual_shadow_map* Map, u32 Index)
+{
+	const virtual_shadow_page& Page = Map->Pages[Index];
+	f32 PageSize = VirtualShadows_GetPageSize(Map, Page.Level);
+	f32 MinX = Page.X * PageSize, MinY = Page.Y * PageSize;
+	return glm::orthoLH_ZO(MinX, MinX + PageSize, MinY, MinY + PageSize, Page.DepthMin, Page.DepthMax) * Map->LightView;
+}
+
+internal shadow_atlas_rect VirtualShadows_GetPoolRect(u32 PhysicalPage)
+{
+	shadow_atlas_rect Rect;
+	Rect.X = (PhysicalPage % c_VirtualShadowPoolPages) * c_VirtualShadowPageSize;
+	Rect.Y = (PhysicalPage / c_VirtualShadowPoolPages) * c_VirtualShadowPageSize;
+	Rect.Size = c_VirtualShadowPageSize;
+	return Rect;
+}
+
+internal void VirtualShadows_GetConstants(const virtual_shadow_map* Map, virtual_shadow_constants* Constants)
+{
+	Constants->LightView = Map->LightView;
+	Constants->PageSize = Map->PageSize;
+	Constants->LodScale = Map->LodScale;
+	Constants->LodBias = Map->LodBias;
+	Constants->Enabled = true;
+}
+
+internal void VirtualShadows_GetPageTable(const virtual_shadow_map* Map, virtual_shadow_gpu_page* Table)
+{
+	for (u32 i = 0; i < c_VirtualShadowTableSize; i++)
+	{
+		const virtual_shadow_page& Page = Map->Pages[i];
+		virtual_shadow_gpu_page& Entry = Table[i];
+		Entry.Tag = Page.Occupied ? VirtualShadows_PackTag(Page.X, Page.Y) : 0xFFFFFFFF;
+		Entry.PhysicalPage = Page.Valid ? Page.PhysicalPage : c_VirtualShadowNoPage;
+		Entry.DepthMin = Page.DepthMin;
+		Entry.DepthScale = Page.DepthMax > Page.DepthMin ? 1.0f / (Page.DepthMax - Page.DepthMin) : 0.0f;
+	}
+}
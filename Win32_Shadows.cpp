@@ -47,6 +47,8 @@ int main()
 	g_IsRunning = true;
 	game_input Input = {};
 
+	JobSystem_Initialize(&g_Jobs);
+
 	d3d12_context* D3D12Context = VmAllocArray(d3d12_context, 1);
 	D3D12Context_Initialize(D3D12Context, Window);
 	
@@ -1,3 +1,12 @@
+// STL headers that use 'internal' or 'global' as identifiers (ios_base::internal, locale::global)
+// have to be included before the defines below
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <chrono>
+
 // General defines
 #define internal static
 #define local_persist static
@@ -57,6 +66,7 @@ constexpr Enum& operator^=(Enum& ioLHS, Enum inRHS)                  \
 
 // Just to replace "new"s everywhere, they are slow as fuck
 #define VmAllocArray(__type, __count) (__type*)::VirtualAlloc(nullptr, sizeof(__type) * __count, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE)
+#define VmFree(__ptr) ::VirtualFree(__ptr, 0, MEM_RELEASE)
 
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
@@ -126,12 +136,14 @@ using b32 = u32;
 #include "glm/glm.hpp"
 #include "glm/gtc/constants.hpp"
 #include "glm/gtc/matrix_transform.hpp"
+#include "glm/gtc/packing.hpp"
 #include "glm/gtx/quaternion.hpp"
 
 using v4 = glm::vec4;
 using v3 = glm::vec3;
 using v2 = glm::vec2;
 using v2i = glm::i32vec2;
+using v3i = glm::i32vec3;
 using m3 = glm::mat3;
 using m4 = glm::mat4;
 using qtn = glm::quat;
@@ -147,7 +159,7 @@ struct game_window
 
 enum class key : u32
 {
-	W = 0, S, A, D, Q, E, T, G, F, H, N, M, Up, Down, Left, Right, Shift, Control, BackSpace, Space, COUNT
+	W = 0, S, A, D, Q, E, T, G, F, H, N, M, K, J, C, L, O, P, R, V, B, U, I, X, Up, Down, Left, Right, Shift, Control, BackSpace, Space, COUNT
 };
 
 enum class mouse : u32
@@ -401,6 +413,18 @@ internal void Win32ProcessEvents(game_input* Input, const game_window& Window)
 				case 'H': { Input->SetKeyState(key::H, IsDown); break; }
 				case 'N': { Input->SetKeyState(key::N, IsDown); break; }
 				case 'M': { Input->SetKeyState(key::M, IsDown); break; }
+				case 'K': { Input->SetKeyState(key::K, IsDown); break; }
+				case 'J': { Input->SetKeyState(key::J, IsDown); break; }
+				case 'C': { Input->SetKeyState(key::C, IsDown); break; }
+				case 'L': { Input->SetKeyState(key::L, IsDown); break; }
+				case 'O': { Input->SetKeyState(key::O, IsDown); break; }
+				case 'P': { Input->SetKeyState(key::P, IsDown); break; }
+				case 'R': { Input->SetKeyState(key::R, IsDown); break; }
+				case 'V': { Input->SetKeyState(key::V, IsDown); break; }
+				case 'B': { Input->SetKeyState(key::B, IsDown); break; }
+				case 'U': { Input->SetKeyState(key::U, IsDown); break; }
+				case 'I': { Input->SetKeyState(key::I, IsDown); break; }
+				case 'X': { Input->SetKeyState(key::X, IsDown); break; }
 				case 'T':
 				{
 					Input->SetKeyState(key::T, IsDown);